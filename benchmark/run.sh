@@ -0,0 +1,187 @@
+#!/bin/bash
+
+# ==================================================================================================
+#      Initialization
+# ==================================================================================================
+
+# Benchmark harness for gappa. This mirrors the test harness in test/run.sh, but instead of
+# checking output files, it times the hot code paths on synthetic data that is generated with
+# the simulate commands, and writes the timings to a csv file, so that per-commit performance
+# can be tracked over time. Run it via `make -C build gappa_benchmark`, or directly from here.
+
+# Change to the directory where this script is located, so that we can call it from anywhere.
+cd `dirname ${0}`
+
+# Size parameters of the synthetic dataset, and number of repetitions per benchmark.
+# Can be overridden from the environment to scale the benchmarks up or down.
+BENCH_TAXA=${BENCH_TAXA:-500}
+BENCH_SAMPLES=${BENCH_SAMPLES:-10}
+BENCH_PQUERIES=${BENCH_PQUERIES:-5000}
+BENCH_SEQ_LENGTH=${BENCH_SEQ_LENGTH:-1000}
+BENCH_REPS=${BENCH_REPS:-3}
+
+# Prepare output directories for log files and files produced by the commands.
+BASEOUTDIR="out"
+LOGDIR="log"
+DATADIR="data"
+rm -rf ${BASEOUTDIR}/
+rm -rf ${LOGDIR}/
+rm -rf ${DATADIR}/
+mkdir ${BASEOUTDIR}
+mkdir ${LOGDIR}
+mkdir -p ${DATADIR}/jplace
+
+# This script needs bc.
+if [ -z "`which bc`" ] ; then
+    echo "Program 'bc' not found. Cannot run this script."
+    exit 1
+fi
+
+# On MacOS, the default `date` does not support nanoseconds, which we however use here...
+# So make sure that we have the gnu core utils version available, and alias this.
+# See https://apple.stackexchange.com/a/47181
+if [[ $OSTYPE == 'darwin'* ]]; then
+    if [ -z "`which gdate`" ] ; then
+        echo "Program 'gdate' not found. Cannot run this script on MacOS."
+        exit 1
+    fi
+fi
+
+# Color the spectrum!
+COLOR_RED="\033[31m"
+COLOR_GREEN="\033[32m"
+COLOR_END="\033[0m"
+
+# ==================================================================================================
+#      Helper Functions
+# ==================================================================================================
+
+# For macos, we need a different date function that is gnu compatible and supports nanoseconds.
+nanotime() {
+    if [[ $OSTYPE == 'darwin'* ]]; then
+        gdate +%s%N
+    else
+        date +%s%N
+    fi
+}
+
+# ==================================================================================================
+#      Find Binary
+# ==================================================================================================
+
+# Try to use $PATH by default, then try local binary
+GAPPA=$(which gappa 2> /dev/null)
+[[ -z "${GAPPA}" ]] && GAPPA="../bin/gappa"
+
+# Check that we got an executable
+if [[ ! -x "${GAPPA}" ]] ; then
+    echo "gappa binary not found or is not executable"
+    exit 1
+fi
+
+# ==================================================================================================
+#      Generate Synthetic Data
+# ==================================================================================================
+
+echo "Generating synthetic dataset:" \
+     "${BENCH_TAXA} taxa, ${BENCH_SAMPLES} samples, ${BENCH_PQUERIES} pqueries each"
+
+# Random reference tree.
+${GAPPA} simulate random-tree \
+    --leaf-count ${BENCH_TAXA} \
+    --out-dir ${DATADIR} \
+    > ${LOGDIR}/generate.log 2>&1 \
+|| { echo "Data generation failed, see ${LOGDIR}/generate.log"; exit 1; }
+
+# Random placements on that tree. We use fixed seeds per sample, so that the dataset is
+# reproducible across runs and machines, and timings stay comparable.
+for i in `seq 1 ${BENCH_SAMPLES}`; do
+    ${GAPPA} simulate random-placements \
+        --reference-tree ${DATADIR}/random-tree.newick \
+        --pquery-count ${BENCH_PQUERIES} \
+        --seed ${i} \
+        --out-dir ${DATADIR}/jplace \
+        >> ${LOGDIR}/generate.log 2>&1 \
+    || { echo "Data generation failed, see ${LOGDIR}/generate.log"; exit 1; }
+    mv ${DATADIR}/jplace/random-placements.jplace ${DATADIR}/jplace/sample_${i}.jplace
+done
+
+# Synthetic taxonomic assignment of the reference taxa, for the assign benchmark.
+# We group the leaves into clades by their first letter, which gives a shallow
+# but structurally valid taxonomy.
+grep -oE '[a-z]+:' ${DATADIR}/random-tree.newick \
+    | tr -d ':' \
+    | sort -u \
+    | awk '{ print $0 "\tBase;Clade_" substr($0,1,1) ";" $0 }' \
+    > ${DATADIR}/taxon-file.tsv
+
+# ==================================================================================================
+#      Launch Benchmarks
+# ==================================================================================================
+
+# Either get all scripts that we have, or the user provided ones via wildcard inclusion
+SCRIPTS=`ls ./scripts/*.sh`
+[[ "${1}" ]] && SCRIPTS=`ls ./scripts/*${1}*.sh`
+
+# Some user output. Ugly: We except paths names without spaces here...
+BENCHCOUNT=`echo ${SCRIPTS} | sed 's/ /\n/g' | wc -l`
+printf "${COLOR_GREEN}[==========]${COLOR_END} ${BENCHCOUNT} benchmarks, ${BENCH_REPS} repetitions each\n\n"
+
+# Machine readable output: one csv line per repetition of each benchmark.
+CSVFILE=${BASEOUTDIR}/benchmark.csv
+echo "benchmark,taxa,samples,pqueries,rep,wall_s" > ${CSVFILE}
+
+# Status: How often did we fail?
+FAILCOUNT=0
+STARTTIME=`nanotime`
+
+# Run all 'em scripts!
+for SCRIPT in ${SCRIPTS} ; do
+    if [[ ! -f ${SCRIPT} ]]; then
+        echo "Benchmark case ${SCRIPT} not found"
+        exit 1
+    fi
+
+    # Get pure file name as our benchmark name, and print for user
+    BENCHNAME=$(basename "${SCRIPT%.*}")
+    printf "${COLOR_GREEN}[ RUN      ]${COLOR_END} ${BENCHNAME}\n"
+
+    for REP in `seq 1 ${BENCH_REPS}`; do
+
+        # Make sure that each repetition writes to its own fresh out directory,
+        # so that repetitions do not differ due to leftover files.
+        OUTDIR=${BASEOUTDIR}/${BENCHNAME}
+        rm -rf ${OUTDIR}
+        mkdir ${OUTDIR}
+
+        # Run the benchmark, embedded in measurement tools and user printouts.
+        # We source the scripts, so that they have access to all helper functions and vars here.
+        STIME=`nanotime`
+        source "${SCRIPT}" "${GAPPA}" > ${LOGDIR}/${BENCHNAME}-${REP}.log 2>&1
+        RESULT=$?
+        ETIME=`nanotime`
+        DURATION=`echo "scale=3;(${ETIME} - ${STIME})/(10^09)" | bc | awk '{printf "%.3f", $0}'`
+
+        # Final user printout for the repetition, and the csv line.
+        if [[ ${RESULT} == 0 ]]; then
+            printf "${COLOR_GREEN}[     DONE ]${COLOR_END} rep ${REP}: ${DURATION}s\n"
+            echo "${BENCHNAME},${BENCH_TAXA},${BENCH_SAMPLES},${BENCH_PQUERIES},${REP},${DURATION}" >> ${CSVFILE}
+        else
+            printf "${COLOR_RED}[     FAIL ]${COLOR_END} rep ${REP}: ${DURATION}s\n"
+            FAILCOUNT=$((FAILCOUNT+1))
+        fi
+    done
+done
+
+# Some user output.
+ENDTIME=`nanotime`
+TOTALDURATION=`echo "scale=3;(${ENDTIME} - ${STARTTIME})/(10^09)" | bc | awk '{printf "%.3f", $0}'`
+printf "\n${COLOR_GREEN}[==========]${COLOR_END} ${TOTALDURATION}s\n"
+
+if [[ ${FAILCOUNT} == 0 ]]; then
+    printf "${COLOR_GREEN}[   PASSED ]${COLOR_END} ${BENCHCOUNT} benchmarks, results in ${CSVFILE}\n"
+else
+    printf "${COLOR_RED}[   FAILED ]${COLOR_END} ${FAILCOUNT} benchmark runs\n"
+fi
+
+exit ${FAILCOUNT}
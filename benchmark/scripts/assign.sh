@@ -0,0 +1,8 @@
+#!/bin/bash
+
+# Hot path: per-query taxonomic assignment.
+${GAPPA} examine assign \
+    --jplace-path "data/jplace" \
+    --taxon-file "data/taxon-file.tsv" \
+    --out-dir ${OUTDIR} \
+    || return 1
@@ -0,0 +1,7 @@
+#!/bin/bash
+
+# Hot path: pairwise earth movers distances between all samples.
+${GAPPA} analyze krd \
+    --jplace-path "data/jplace" \
+    --out-dir ${OUTDIR} \
+    || return 1
@@ -0,0 +1,7 @@
+#!/bin/bash
+
+# Hot path: jplace parsing. The info command scans and summarizes all samples,
+# so its runtime is dominated by reading the input files.
+${GAPPA} examine info \
+    --jplace-path "data/jplace" \
+    || return 1
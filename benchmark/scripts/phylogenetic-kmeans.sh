@@ -0,0 +1,9 @@
+#!/bin/bash
+
+# Hot path: kmeans iteration with tree mass distances.
+${GAPPA} analyze phylogenetic-kmeans \
+    --jplace-path "data/jplace" \
+    --k 4 \
+    --write-overview-file \
+    --out-dir ${OUTDIR} \
+    || return 1
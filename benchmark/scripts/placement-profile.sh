@@ -0,0 +1,9 @@
+#!/bin/bash
+
+# Hot path: per-edge mass and imbalance matrix computation (placement profiles).
+${GAPPA} analyze dispersion \
+    --jplace-path "data/jplace" \
+    --mass-norm "relative" \
+    --write-newick-tree \
+    --out-dir ${OUTDIR} \
+    || return 1
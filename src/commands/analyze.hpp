@@ -31,6 +31,7 @@
 #include "commands/analyze/edgepca.hpp"
 #include "commands/analyze/kmeans_imbalance.hpp"
 #include "commands/analyze/kmeans_phylogenetic.hpp"
+#include "commands/analyze/knn.hpp"
 #include "commands/analyze/krd.hpp"
 #include "commands/analyze/nhd.hpp"
 #include "commands/analyze/placement_factorization.hpp"
@@ -61,6 +62,7 @@ inline void setup_analyze( CLI::App& app )
     setup_dispersion( *sub );
     setup_edgepca( *sub );
     setup_ikmeans( *sub );
+    setup_knn( *sub );
     setup_krd( *sub );
     setup_pkmeans( *sub );
     setup_placement_factorization( *sub );
@@ -25,10 +25,11 @@
 
 #include "options/global.hpp"
 #include "tools/cli_setup.hpp"
+#include "tools/edge_imbalance.hpp"
+#include "tools/sample_columns.hpp"
 
 #include "CLI/CLI.hpp"
 
-#include "genesis/placement/function/epca.hpp"
 #include "genesis/placement/function/functions.hpp"
 #include "genesis/placement/function/helper.hpp"
 #include "genesis/placement/function/masses.hpp"
@@ -39,14 +40,20 @@
 #include "genesis/utils/core/fs.hpp"
 #include "genesis/utils/math/correlation.hpp"
 #include "genesis/utils/math/matrix.hpp"
+#include "genesis/utils/math/ranking.hpp"
 #include "genesis/utils/math/statistics.hpp"
 #include "genesis/utils/text/string.hpp"
 
 #include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <future>
 #include <limits>
+#include <memory>
+#include <numeric>
 #include <string>
 #include <unordered_set>
+#include <vector>
 
 #ifdef GENESIS_OPENMP
 #   include <omp.h>
@@ -88,6 +95,54 @@ struct CorrelationVariant
     CorrelationMethod correlation_value;
 };
 
+/**
+ * @brief Reusable buffers for the fractional (mid-rank) ranking of one matrix column.
+ *
+ * The Spearman correlation is the Pearson correlation of the ranks. Ranking a column needs
+ * a sort permutation and a rank vector, and allocating those anew for every edge column
+ * dominates the Spearman runtime for large trees. Each thread of the correlation loop
+ * keeps one instance of this struct, so that the buffers are allocated once and reused
+ * across all edge columns that the thread processes.
+ */
+struct EdgeColumnRanking
+{
+    std::vector<size_t> order;
+    std::vector<double> ranks;
+
+    /**
+     * @brief Compute the fractional ranks of the given column of the matrix,
+     * with ties getting their mid-rank, and return a reference to the internal buffer.
+     */
+    std::vector<double> const& fractional( genesis::utils::Matrix<double> const& mat, size_t col )
+    {
+        auto const n = mat.rows();
+        order.resize( n );
+        ranks.resize( n );
+
+        // Sort the row indices of the column by their value.
+        std::iota( order.begin(), order.end(), static_cast<size_t>( 0 ));
+        std::sort( order.begin(), order.end(), [&]( size_t lhs, size_t rhs ){
+            return mat( lhs, col ) < mat( rhs, col );
+        });
+
+        // Assign ranks, with each group of tied values getting the average of their ranks.
+        size_t i = 0;
+        while( i < n ) {
+            size_t j = i + 1;
+            while( j < n && mat( order[j], col ) == mat( order[i], col ) ) {
+                ++j;
+            }
+            auto const rank = static_cast<double>( i + j + 1 ) / 2.0;
+            for( size_t k = i; k < j; ++k ) {
+                ranks[ order[k] ] = rank;
+            }
+            i = j;
+        }
+
+        return ranks;
+    }
+};
+
 // =================================================================================================
 //      Setup
 // =================================================================================================
@@ -103,9 +158,11 @@ void setup_correlation( CLI::App& app )
 
     // Jplace input
     options->jplace_input.add_jplace_input_opt_to_app( sub );
+    options->jplace_input.add_profile_cache_opt_to_app( sub );
     options->jplace_input.add_mass_norm_opt_to_app( sub, true );
     options->jplace_input.add_point_mass_opt_to_app( sub );
     options->jplace_input.add_ignore_multiplicities_opt_to_app( sub );
+    options->jplace_input.add_subsample_opt_to_app( sub );
 
     // Metadata table input.
     options->metadata_input.add_table_input_opt_to_app( sub, true );
@@ -274,7 +331,7 @@ void make_correlation_color_tree(
     auto color_norm = ColorNormalizationDiverging( -1.0, 1.0 );
 
     // Now, make a color vector and write to files.
-    auto const colors = color_map( color_norm, values );
+    auto const colors = ColorMapOptions::map_colors( color_map, color_norm, values );
     options.tree_output.write_tree_to_files(
         tree,
         colors,
@@ -310,6 +367,12 @@ void run_with_matrix(
         throw std::runtime_error( "Internal Error: Jplace files and Dataframe have differing lengths." );
     }
 
+    // The tree renders are independent of the correlation computations of the following
+    // variants, and the svg layout of a large tree is expensive, so we run them as
+    // background tasks on the global thread pool, which both overlaps them with the
+    // remaining computations and renders several trees concurrently.
+    std::vector<std::future<void>> render_tasks;
+
     // Loop over all variants that have been set.
     for( auto const& variant : variants ) {
 
@@ -348,42 +411,253 @@ void run_with_matrix(
             // Prepare a vector for the correlation coefficients of all edges.
             auto corr_vec = std::vector<double>( tree.edge_count() );
 
+            // For Spearman, the ranks of the metadata column are the same for every edge,
+            // so compute them once up front, instead of re-ranking the column within each
+            // of the per-edge correlation calls.
+            std::vector<double> meta_ranks;
+            if( variant.correlation_value == CorrelationVariant::kSpearman ) {
+                meta_ranks = ranking_fractional( meta_dbl.begin(), meta_dbl.end() );
+            }
+
             // Fill the vector by calculating correlation of each edge of the tree.
-            #pragma omp parallel for
-            for( size_t e = 0; e < tree.edge_count(); ++e ) {
-                switch( variant.correlation_value ) {
-                    case CorrelationVariant::kPearson: {
-                        corr_vec[e] = pearson_correlation_coefficient(
-                            meta_dbl.begin(), meta_dbl.end(),
-                            edge_values.col( e ).begin(), edge_values.col( e ).end()
-                        );
-                        break;
-                    }
-                    case CorrelationVariant::kSpearman: {
-                        corr_vec[e] = spearmans_rank_correlation_coefficient(
-                            meta_dbl.begin(), meta_dbl.end(),
-                            edge_values.col( e ).begin(), edge_values.col( e ).end()
-                        );
-                        break;
-                    }
-                    case CorrelationVariant::kKendall: {
-                        corr_vec[e] = kendalls_tau_correlation_coefficient(
-                            meta_dbl.begin(), meta_dbl.end(),
-                            edge_values.col( e ).begin(), edge_values.col( e ).end()
-                        );
-                        break;
-                    }
-                    default: {
-                        throw std::runtime_error( "Internal Error: Invalid correlation variant." );
+            // Each thread ranks its edge columns with its own reusable buffers,
+            // so that the ranking for Spearman runs in the same parallel pass as the
+            // correlation proper, without per-edge allocations.
+            #pragma omp parallel
+            {
+                EdgeColumnRanking ranking;
+
+                #pragma omp for schedule(dynamic)
+                for( size_t e = 0; e < tree.edge_count(); ++e ) {
+                    switch( variant.correlation_value ) {
+                        case CorrelationVariant::kPearson: {
+                            corr_vec[e] = pearson_correlation_coefficient(
+                                meta_dbl.begin(), meta_dbl.end(),
+                                edge_values.col( e ).begin(), edge_values.col( e ).end()
+                            );
+                            break;
+                        }
+                        case CorrelationVariant::kSpearman: {
+                            auto const& edge_ranks = ranking.fractional( edge_values, e );
+                            corr_vec[e] = pearson_correlation_coefficient(
+                                meta_ranks.begin(), meta_ranks.end(),
+                                edge_ranks.begin(), edge_ranks.end()
+                            );
+                            break;
+                        }
+                        case CorrelationVariant::kKendall: {
+                            corr_vec[e] = kendalls_tau_correlation_coefficient(
+                                meta_dbl.begin(), meta_dbl.end(),
+                                edge_values.col( e ).begin(), edge_values.col( e ).end()
+                            );
+                            break;
+                        }
+                        default: {
+                            throw std::runtime_error( "Internal Error: Invalid correlation variant." );
+                        }
                     }
                 }
             }
 
-            // Make a tree using the data vector and name of the variant and field.
-            make_correlation_color_tree(
-                options, corr_vec, tree,  meta_col.name() + "_" + variant.name
-            );
+            // Make a tree using the data vector and name of the variant and field,
+            // as a background task. The vector is moved into shared ownership,
+            // so that the task can outlive this loop iteration.
+            auto const infix = meta_col.name() + "_" + variant.name;
+            auto corr_ptr = std::make_shared<std::vector<double>>( std::move( corr_vec ));
+            render_tasks.push_back( global_options.thread_pool().enqueue(
+                [ &options, &tree, corr_ptr, infix ](){
+                    make_correlation_color_tree( options, *corr_ptr, tree, infix );
+                }
+            ));
+        }
+    }
+
+    // Wait for the renders; get() also rethrows any exception of a task.
+    for( auto& task : render_tasks ) {
+        task.get();
+    }
+}
+
+// =================================================================================================
+//      Run Streaming
+// =================================================================================================
+
+/**
+ * @brief Run with streaming per-sample accumulation, without the full profile matrices.
+ *
+ * Pearson correlation only needs the sufficient statistics (counts, sums, sums of squares,
+ * and sums of products), which can be accumulated per sample in a single pass over the input
+ * files. This brings the memory down from one matrix row per sample to a fixed set of
+ * accumulators per edge and metadata column, so that sample count no longer matters for memory.
+ * Spearman and Kendall need the full per-edge value lists for ranking, and hence keep using
+ * the matrix based path.
+ */
+void run_streaming_pearson(
+    CorrelationOptions const&              options,
+    std::vector<CorrelationVariant> const& variants,
+    genesis::utils::Dataframe const&       df
+) {
+    using namespace genesis;
+    using namespace genesis::placement;
+    using namespace genesis::utils;
+
+    auto const file_count = options.jplace_input.file_count();
+    auto const col_count = df.cols();
+    bool const with_masses
+        = ( options.edge_values == "both" ) || ( options.edge_values == "masses" );
+    bool const with_imbalances
+        = ( options.edge_values == "both" ) || ( options.edge_values == "imbalances" );
+
+    // Per-edge accumulators for one edge value type: for each metadata column, the pairwise
+    // statistics of the edge values against that column. The statistics are kept per column,
+    // as samples with a missing (non-finite) metadata value are skipped for that column only,
+    // matching the pairwise handling of the matrix based path.
+    struct PearsonAccumulator
+    {
+        Matrix<double>      sum_x;
+        Matrix<double>      sum_xx;
+        Matrix<double>      sum_xy;
+        std::vector<double> sum_y;
+        std::vector<double> sum_yy;
+        std::vector<size_t> count;
+
+        void init( size_t cols, size_t edges )
+        {
+            sum_x  = Matrix<double>( cols, edges, 0.0 );
+            sum_xx = Matrix<double>( cols, edges, 0.0 );
+            sum_xy = Matrix<double>( cols, edges, 0.0 );
+            sum_y  = std::vector<double>( cols, 0.0 );
+            sum_yy = std::vector<double>( cols, 0.0 );
+            count  = std::vector<size_t>( cols, 0 );
+        }
+
+        void accumulate( size_t col, double meta_value, std::vector<double> const& edge_values )
+        {
+            if( ! std::isfinite( meta_value )) {
+                return;
+            }
+            ++count[ col ];
+            sum_y[ col ]  += meta_value;
+            sum_yy[ col ] += meta_value * meta_value;
+            for( size_t e = 0; e < edge_values.size(); ++e ) {
+                sum_x( col, e )  += edge_values[e];
+                sum_xx( col, e ) += edge_values[e] * edge_values[e];
+                sum_xy( col, e ) += edge_values[e] * meta_value;
+            }
         }
+
+        double correlation( size_t col, size_t edge ) const
+        {
+            auto const n = static_cast<double>( count[ col ]);
+            if( count[ col ] < 2 ) {
+                return std::numeric_limits<double>::quiet_NaN();
+            }
+            auto const cov_xy = n * sum_xy( col, edge ) - sum_x( col, edge ) * sum_y[ col ];
+            auto const var_x  = n * sum_xx( col, edge ) - sum_x( col, edge ) * sum_x( col, edge );
+            auto const var_y  = n * sum_yy[ col ] - sum_y[ col ] * sum_y[ col ];
+            if( var_x <= 0.0 || var_y <= 0.0 ) {
+                return std::numeric_limits<double>::quiet_NaN();
+            }
+            return cov_xy / std::sqrt( var_x * var_y );
+        }
+    };
+    PearsonAccumulator masses_acc;
+    PearsonAccumulator imbalances_acc;
+
+    // Read the first file up front, so that the tree is known and the accumulators can be
+    // initialized once, before the parallel loop over the remaining files starts.
+    size_t fc = 0;
+    LOG_MSG2 << "Reading file " << ( ++fc ) << " of " << file_count
+             << ": " << options.jplace_input.file_path( 0 );
+    auto const first_smpl = options.jplace_input.sample( 0 );
+    auto const tree = first_smpl.tree();
+    if( with_masses ) {
+        masses_acc.init( col_count, tree.edge_count() );
+    }
+    EdgeImbalanceLayout imbalance_layout;
+    if( with_imbalances ) {
+        imbalances_acc.init( col_count, tree.edge_count() );
+        imbalance_layout = EdgeImbalanceLayout( tree );
+    }
+
+    // Helper to process one sample: compute its edge value vectors, and add them to the
+    // accumulators against each metadata column. The accumulation is serialized; it is cheap
+    // compared to reading and parsing the jplace file, which stays parallel.
+    // The imbalances are derived from the mass vector via the shared postorder layout,
+    // so we need the masses in either case. The mass accumulation itself is threaded
+    // when the caller is not already processing samples in parallel.
+    auto accumulate_sample = [&]( size_t fi, Sample const& smpl, bool parallel_masses ){
+        auto const edge_masses = accumulate_edge_masses( smpl, parallel_masses );
+        auto const edge_imbals
+            = with_imbalances
+            ? imbalance_layout.imbalance_vector(
+                edge_masses, options.jplace_input.mass_norm_relative()
+            )
+            : std::vector<double>()
+        ;
+
+        #pragma omp critical (gappa_correlation_accumulate)
+        {
+            for( size_t col = 0; col < col_count; ++col ) {
+                auto const meta_value = df[ col ].as<double>()[ fi ];
+                if( with_masses ) {
+                    masses_acc.accumulate( col, meta_value, edge_masses );
+                }
+                if( with_imbalances ) {
+                    imbalances_acc.accumulate( col, meta_value, edge_imbals );
+                }
+            }
+        }
+    };
+    accumulate_sample( 0, first_smpl, true );
+
+    // Stream the remaining jplace files in parallel. Only the accumulators are kept,
+    // so the memory use is independent of the number of samples.
+    bool const parallel_samples = file_count > 2;
+    #pragma omp parallel for schedule(dynamic) if( parallel_samples )
+    for( size_t fi = 1; fi < file_count; ++fi ) {
+        LOG_MSG2 << "Reading file " << ( ++fc ) << " of " << file_count
+                 << ": " << options.jplace_input.file_path( fi );
+
+        auto const smpl = options.jplace_input.sample( fi );
+        if( ! genesis::placement::compatible_trees( tree, smpl.tree() ) ) {
+            throw std::runtime_error( "Input jplace files have differing reference trees." );
+        }
+        accumulate_sample( fi, smpl, ! parallel_samples );
+    }
+
+    // Finalize: turn the accumulators into per-edge correlations, and write the trees.
+    // As in the matrix based path, the renders run as background tasks on the global
+    // thread pool, so that several trees are rendered concurrently.
+    std::vector<std::future<void>> render_tasks;
+    for( auto const& variant : variants ) {
+        assert( variant.correlation_value == CorrelationVariant::kPearson );
+        auto const& acc
+            = variant.edge_values == CorrelationVariant::kMasses
+            ? masses_acc
+            : imbalances_acc
+        ;
+
+        for( size_t col = 0; col < col_count; ++col ) {
+            LOG_MSG1 << "Writing Pearson correlation with meta-data column "
+                     << df[ col ].name() << ".";
+
+            auto corr_ptr = std::make_shared<std::vector<double>>( tree.edge_count() );
+            for( size_t e = 0; e < tree.edge_count(); ++e ) {
+                (*corr_ptr)[e] = acc.correlation( col, e );
+            }
+            auto const infix = df[ col ].name() + "_" + variant.name;
+            render_tasks.push_back( global_options.thread_pool().enqueue(
+                [ &options, &tree, corr_ptr, infix ](){
+                    make_correlation_color_tree( options, *corr_ptr, tree, infix );
+                }
+            ));
+        }
+    }
+
+    // Wait for the renders; get() also rethrows any exception of a task.
+    for( auto& task : render_tasks ) {
+        task.get();
     }
 }
 
@@ -433,6 +707,22 @@ void run_correlation( CorrelationOptions const& options )
     //     Calculations and Output
     // -------------------------------------------------------------------------
 
+    // If only Pearson correlation is requested, we can stream the samples and accumulate
+    // the statistics on the fly, without ever holding the full profile matrices in memory.
+    // When a profile cache is in use, we take the matrix path instead, so that the cache
+    // can be loaded (or written for later commands in the pipeline).
+    if( options.method == "pearson" && options.jplace_input.profile_cache().empty() ) {
+        if( options.jplace_input.file_count() <= 1 ) {
+            throw std::runtime_error(
+                "Cannot compute edge correlation of a single sample, as the method is meant to relate "
+                "a set of samples to their meta-data features."
+            );
+        }
+        LOG_MSG1 << "Calculating correlations with streaming accumulation and writing files.";
+        run_streaming_pearson( options, variants, df );
+        return;
+    }
+
     // Get the data. Read all samples and calcualte the matrices.
     auto const profile = options.jplace_input.placement_profile();
     assert( profile.edge_masses.rows() == profile.edge_imbalances.rows() );
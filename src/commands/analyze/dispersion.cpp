@@ -38,6 +38,8 @@
 #include "genesis/utils/math/matrix.hpp"
 
 #include <cassert>
+#include <cmath>
+#include <vector>
 
 #ifdef GENESIS_OPENMP
 #   include <omp.h>
@@ -97,9 +99,11 @@ void setup_dispersion( CLI::App& app )
 
     // Input.
     options->jplace_input.add_jplace_input_opt_to_app( sub );
+    options->jplace_input.add_profile_cache_opt_to_app( sub );
     options->jplace_input.add_mass_norm_opt_to_app( sub, true );
     options->jplace_input.add_point_mass_opt_to_app( sub );
     options->jplace_input.add_ignore_multiplicities_opt_to_app( sub );
+    options->jplace_input.add_subsample_opt_to_app( sub );
 
     // Edge value representation
     sub->add_option(
@@ -266,7 +270,7 @@ void make_dispersion_color_tree(
     }
 
     // Now, make a color vector and write to files.
-    auto const colors = color_map( *color_norm, values );
+    auto const colors = ColorMapOptions::map_colors( color_map, *color_norm, values );
     options.tree_output.write_tree_to_files(
         tree,
         colors,
@@ -305,10 +309,56 @@ void run_with_matrix(
             return ret;
         }
 
-        // Iterate columns.
-        #pragma omp parallel for
+        // Compute all per-column means and stddevs in two row-major passes over the matrix,
+        // instead of iterating it column-wise against its layout, which for wide matrices
+        // (one column per edge) thrashes the cache. Each thread accumulates into a local
+        // per-column vector over its share of the rows, which are then merged.
+        auto sums = std::vector<double>( data.cols(), 0.0 );
+        auto sqs  = std::vector<double>( data.cols(), 0.0 );
+
+        #pragma omp parallel
+        {
+            auto local = std::vector<double>( data.cols(), 0.0 );
+
+            #pragma omp for schedule(static) nowait
+            for( size_t r = 0; r < data.rows(); ++r ) {
+                for( size_t c = 0; c < data.cols(); ++c ) {
+                    local[c] += data( r, c );
+                }
+            }
+            #pragma omp critical (gappa_dispersion_mean_reduce)
+            {
+                for( size_t c = 0; c < data.cols(); ++c ) {
+                    sums[c] += local[c];
+                }
+            }
+        }
+        for( size_t c = 0; c < data.cols(); ++c ) {
+            ret[c].mean = sums[c] / static_cast<double>( data.rows() );
+        }
+
+        // Second pass for the squared deviations from the mean, keeping the numerical
+        // stability of the two-pass algorithm that the per-column computation had.
+        #pragma omp parallel
+        {
+            auto local = std::vector<double>( data.cols(), 0.0 );
+
+            #pragma omp for schedule(static) nowait
+            for( size_t r = 0; r < data.rows(); ++r ) {
+                for( size_t c = 0; c < data.cols(); ++c ) {
+                    auto const d = data( r, c ) - ret[c].mean;
+                    local[c] += d * d;
+                }
+            }
+            #pragma omp critical (gappa_dispersion_stddev_reduce)
+            {
+                for( size_t c = 0; c < data.cols(); ++c ) {
+                    sqs[c] += local[c];
+                }
+            }
+        }
         for( size_t c = 0; c < data.cols(); ++c ) {
-            ret[c] = mean_stddev( data.col(c).begin(), data.col(c).end() );
+            ret[c].stddev = std::sqrt( sqs[c] / static_cast<double>( data.rows() ));
         }
 
         return ret;
@@ -329,14 +379,21 @@ void run_with_matrix(
         vmr_vec[ i ] = mean_stddev[ i ].stddev * mean_stddev[ i ].stddev / mean_stddev[ i ].mean;
     }
 
-    // Loop over all variants that have been set.
+    // Collect the variants that use the current input matrix.
+    // This is ugly, I know. But the distinction has to be made somewhere...
+    std::vector<DispersionVariant const*> active;
     for( auto const& variant : variants ) {
-
-        // Only process the variants that have the current input metrix.
-        // This is ugly, I know. But the distinction has to be made somewhere...
-        if( variant.edge_values != edge_values ) {
-            continue;
+        if( variant.edge_values == edge_values ) {
+            active.push_back( &variant );
         }
+    }
+
+    // Render and write the color trees of all variants in parallel. The renders are
+    // independent of each other, and the svg layout of a large tree is expensive,
+    // so with several measures, a sequential output phase would dominate the command.
+    #pragma omp parallel for schedule(dynamic)
+    for( size_t vi = 0; vi < active.size(); ++vi ) {
+        auto const& variant = *active[vi];
 
         // Get the data vector that we want to use for this variant.
         std::vector<double> const* vec;
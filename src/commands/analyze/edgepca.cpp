@@ -26,6 +26,7 @@
 #include "options/global.hpp"
 #include "tools/cli_setup.hpp"
 #include "tools/misc.hpp"
+#include "tools/randomized_svd.hpp"
 
 #include "CLI/CLI.hpp"
 
@@ -35,8 +36,12 @@
 #include "genesis/tree/formats/newick/simple_writer.hpp"
 #include "genesis/tree/function/functions.hpp"
 #include "genesis/utils/io/output_stream.hpp"
+#include "genesis/utils/math/matrix.hpp"
 
+#include <algorithm>
 #include <fstream>
+#include <utility>
+#include <vector>
 
 // =================================================================================================
 //      Setup
@@ -53,6 +58,7 @@ void setup_edgepca( CLI::App& app )
 
     // Add jplace input options.
     opt->jplace_input.add_jplace_input_opt_to_app( sub );
+    opt->jplace_input.add_profile_cache_opt_to_app( sub );
 
     // Kappa
     sub->add_option(
@@ -86,6 +92,7 @@ void setup_edgepca( CLI::App& app )
     // Other jplace settings
     opt->jplace_input.add_point_mass_opt_to_app( sub );
     opt->jplace_input.add_ignore_multiplicities_opt_to_app( sub );
+    opt->jplace_input.add_subsample_opt_to_app( sub );
 
     // Color.
     opt->color_map.add_color_list_opt_to_app( sub, "spectral" );
@@ -154,39 +161,129 @@ void run_edgepca( EdgepcaOptions const& options )
     //     Processing
     // -------------------------------------------------------------
 
-    // Read samples
-    auto const sample_set = options.jplace_input.sample_set();
-    if(  sample_set.size() < 2 ) {
+    // Read samples. We only need the edge imbalance matrix here, not the full samples,
+    // and not the edge masses, which halves the memory of the data reading.
+    auto profile = options.jplace_input.placement_profile( true, true, false );
+    auto const set_size = profile.edge_imbalances.rows();
+    if( set_size < 2 ) {
         throw std::runtime_error("Need at least two input jplace files to compute EdgePCA");
     }
 
     // TODO check kappa and epsilon ranges!
-    // TODO edge pca technically only needs the imbalance matrix. could refactor this to save mem!
 
     // Run, Forrest, run!
     LOG_MSG1 << "Running Edge PCA";
-    auto const epca_data = epca( sample_set, options.kappa, options.epsilon, options.components );
+
+    // Restrict the imbalance matrix to the inner edges, as leaf edges do not carry
+    // imbalance information, keeping track of the original edge indices of the columns.
+    auto inner_edges = std::vector<size_t>();
+    for( size_t e = 0; e < profile.tree.edge_count(); ++e ) {
+        if( ! genesis::tree::is_leaf( profile.tree.edge_at( e ))) {
+            inner_edges.push_back( e );
+        }
+    }
+    auto imbalance_matrix = utils::Matrix<double>( set_size, inner_edges.size() );
+    advise_huge_pages(
+        imbalance_matrix.data().data(),
+        imbalance_matrix.rows() * imbalance_matrix.cols() * sizeof( double )
+    );
+    #pragma omp parallel for schedule(static)
+    for( size_t r = 0; r < set_size; ++r ) {
+        for( size_t c = 0; c < inner_edges.size(); ++c ) {
+            imbalance_matrix( r, c ) = profile.edge_imbalances( r, inner_edges[c] );
+        }
+    }
+    profile.edge_imbalances = utils::Matrix<double>();
+
+    // Splitify transform with the given kappa, then filter out constant columns,
+    // which do not contribute to the PCA.
+    epca_splitify_transform( imbalance_matrix, options.kappa );
+    auto edge_indices = std::move( inner_edges );
+    if( options.epsilon >= 0.0 ) {
+        auto const kept_columns = utils::filter_constant_columns( imbalance_matrix, options.epsilon );
+        auto filtered_indices = std::vector<size_t>();
+        filtered_indices.reserve( kept_columns.size() );
+        for( auto const col : kept_columns ) {
+            filtered_indices.push_back( edge_indices[ col ]);
+        }
+        edge_indices = std::move( filtered_indices );
+    }
+    if( edge_indices.empty() ) {
+        throw std::runtime_error(
+            "Cannot run Edge PCA: all columns of the imbalance matrix are constant."
+        );
+    }
+
+    // Center the columns, as we compute the PCA of the covariance via an SVD of the
+    // centered data matrix.
+    #pragma omp parallel for schedule(static)
+    for( size_t c = 0; c < imbalance_matrix.cols(); ++c ) {
+        double mean = 0.0;
+        for( size_t r = 0; r < set_size; ++r ) {
+            mean += imbalance_matrix( r, c );
+        }
+        mean /= static_cast<double>( set_size );
+        for( size_t r = 0; r < set_size; ++r ) {
+            imbalance_matrix( r, c ) -= mean;
+        }
+    }
+
+    // Instead of a full dense eigen-decomposition, compute only the requested number of
+    // components with a randomized truncated SVD, which for the typical handful of
+    // plotted components reduces the decomposition to a few thin matrix products.
+    auto const max_rank = std::min( set_size, imbalance_matrix.cols() );
+    auto const rank
+        = options.components == 0
+        ? max_rank
+        : std::min( options.components, max_rank )
+    ;
+    auto const svd = randomized_svd( imbalance_matrix, rank );
+
+    // Assemble the result in the same shape as the genesis Edge PCA data:
+    // eigenvalues of the covariance matrix, eigenvectors as columns, and the
+    // projection of the (centered) data onto the components.
+    struct {
+        std::vector<double> eigenvalues;
+        utils::Matrix<double> eigenvectors;
+        utils::Matrix<double> projection;
+        std::vector<size_t> edge_indices;
+    } epca_data;
+    epca_data.edge_indices = std::move( edge_indices );
+    epca_data.eigenvalues = std::vector<double>( rank, 0.0 );
+    for( size_t c = 0; c < rank; ++c ) {
+        epca_data.eigenvalues[c]
+            = svd.singular_values[c] * svd.singular_values[c]
+            / static_cast<double>( set_size - 1 )
+        ;
+    }
+    epca_data.eigenvectors = svd.v;
+    epca_data.projection = utils::Matrix<double>( set_size, rank );
+    for( size_t r = 0; r < set_size; ++r ) {
+        for( size_t c = 0; c < rank; ++c ) {
+            epca_data.projection( r, c ) = svd.u( r, c ) * svd.singular_values[c];
+        }
+    }
 
     // Some checks
     internal_check(
-        epca_data.eigenvalues.size()  == options.components,
-        "Edge PCA data invalid. epca_data.eigenvalues.size() != options.components"
+        epca_data.eigenvalues.size()  == rank,
+        "Edge PCA data invalid. epca_data.eigenvalues.size() != rank"
     );
     internal_check(
         epca_data.eigenvectors.rows() == epca_data.edge_indices.size(),
         "Edge PCA data invalid. epca_data.eigenvectors.rows() != epca_data.edge_indices.size()"
     );
     internal_check(
-        epca_data.eigenvectors.cols() == options.components,
-        "Edge PCA data invalid. epca_data.eigenvectors.cols() != options.components"
+        epca_data.eigenvectors.cols() == rank,
+        "Edge PCA data invalid. epca_data.eigenvectors.cols() != rank"
     );
     internal_check(
-        epca_data.projection.rows()   == sample_set.size(),
-        "Edge PCA data invalid. epca_data.projection.rows() != sample_set.size()"
+        epca_data.projection.rows()   == set_size,
+        "Edge PCA data invalid. epca_data.projection.rows() != set_size"
     );
     internal_check(
-        epca_data.projection.cols()   == options.components,
-        "Edge PCA data invalid. epca_data.projection.cols() != options.components"
+        epca_data.projection.cols()   == rank,
+        "Edge PCA data invalid. epca_data.projection.cols() != rank"
     );
 
     // -------------------------------------------------------------
@@ -194,7 +291,7 @@ void run_edgepca( EdgepcaOptions const& options )
     // -------------------------------------------------------------
 
     // Some helpful user output.
-    auto const& tree = sample_set.at(0).tree();
+    auto const& tree = profile.tree;
     LOG_BOLD;
     LOG_MSG1 << "Tree contains a total of " << tree.edge_count() << " edges, thereof "
              << genesis::tree::inner_edge_count( tree ) << " inner edges (not leading to a leaf). "
@@ -254,7 +351,7 @@ void run_edgepca( EdgepcaOptions const& options )
     }
 
     // Also, write a newick tree with the inner edge indices
-    auto edge_index_tree = sample_set[0].tree();
+    auto edge_index_tree = profile.tree;
     for( size_t i = 0; i < tree.edge_count(); ++i ) {
         using genesis::tree::CommonNodeData;
         if( genesis::tree::is_leaf(tree.edge_at(i)) ) {
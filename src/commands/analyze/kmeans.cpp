@@ -24,12 +24,29 @@
 #include "commands/analyze/kmeans.hpp"
 
 #include "options/global.hpp"
+#include "tools/kmeans.hpp"
+#include "tools/misc.hpp"
 
 #include "CLI/CLI.hpp"
 
+#include "genesis/utils/containers/matrix.hpp"
+#include "genesis/utils/core/fs.hpp"
+#include "genesis/utils/core/options.hpp"
+#include "genesis/utils/formats/csv/reader.hpp"
+#include "genesis/utils/io/input_source.hpp"
 #include "genesis/utils/io/output_stream.hpp"
 #include "genesis/utils/text/string.hpp"
 
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+
 #ifdef GENESIS_OPENMP
 #   include <omp.h>
 #endif
@@ -43,8 +60,9 @@ void setup_kmeans(
     CLI::App* app,
     std::string const& file_prefix
 ) {
-    // Sample input
-    opt->jplace_input.add_jplace_input_opt_to_app( app );
+    // Sample input. Not required here, as a precomputed distance matrix
+    // can be given instead, see below.
+    opt->jplace_input.add_jplace_input_opt_to_app( app, false );
 
     // Number of clusters to find.
     auto k_opt = app->add_option(
@@ -57,6 +75,59 @@ void setup_kmeans(
     k_opt->group( "Settings" );
     k_opt->required();
 
+    // Mini-batch mode for massive sample sets.
+    auto mini_batch_opt = app->add_option(
+        "--mini-batch",
+        opt->mini_batch,
+        "If set, run mini-batch k-means with this many samples per batch, instead of "
+        "full-batch Lloyd iterations whose per-iteration cost scales with the total number "
+        "of samples. This approximates the full-batch clustering, and is meant for sample "
+        "sets that are too large to converge in reasonable time otherwise. "
+        "Batch sizes of 100-1000 times k work well in practice."
+    );
+    mini_batch_opt->group( "Settings" );
+
+    // Warm start from a previous assignment file.
+    auto init_assignments_opt = app->add_option(
+        "--init-assignments",
+        opt->init_assignments,
+        "Assignment file of a previous run (as written by this command) to seed the initial "
+        "centroids from, instead of kmeans++ seeding. Useful for re-running with a slightly "
+        "different k or with some added samples, where the previous clusters are already close "
+        "to the result, which cuts the number of iterations massively. Samples not listed in "
+        "the file are simply assigned to the seeded centroids in the first iteration."
+    );
+    init_assignments_opt->check( CLI::ExistingFile );
+    init_assignments_opt->group( "Settings" );
+
+    // Checkpointing, for long runs on unreliable hardware.
+    auto checkpoint_dir_opt = app->add_option(
+        "--checkpoint-dir",
+        opt->checkpoint_dir,
+        "Directory to store the cluster assignments of each iteration in. If the command is "
+        "interrupted, a rerun with the same input and settings resumes from the assignments of "
+        "the last completed iteration of the current k, instead of starting over. The directory "
+        "is created if needed; the checkpoint files are removed once their k has finished. "
+        "When resuming, also pass `--allow-file-overwriting` if the interrupted run already "
+        "wrote some output files."
+    );
+    checkpoint_dir_opt->group( "Settings" );
+
+    // Precomputed distance matrix, as an alternative to jplace input.
+    auto distance_matrix_opt = app->add_option(
+        "--distance-matrix-file",
+        opt->distance_matrix_file,
+        "Precomputed pairwise distance matrix of the samples, instead of jplace input. "
+        "Accepts the labeled `matrix` text format as well as the `binary` format, as written "
+        "by `gappa analyze krd`. With a matrix, k-medoids clustering is run on the given "
+        "distances, so that clustering experiments over different k reuse cached distances "
+        "instead of recomputing them. The cluster centers are then samples (medoids) rather "
+        "than computed centroids, and no centroid trees are written."
+    );
+    distance_matrix_opt->check( CLI::ExistingFile );
+    distance_matrix_opt->group( "Settings" );
+    distance_matrix_opt->excludes( opt->jplace_input.jplace_input_option );
+
     // Overview file.
     auto overview_file_opt = app->add_flag(
         "--write-overview-file",
@@ -69,6 +140,7 @@ void setup_kmeans(
     // Other jplace settings
     opt->jplace_input.add_point_mass_opt_to_app( app );
     opt->jplace_input.add_ignore_multiplicities_opt_to_app( app );
+    opt->jplace_input.add_subsample_opt_to_app( app );
 
     // Color.
     opt->color_map.add_color_list_opt_to_app( app, "BuPuBk" );
@@ -156,6 +228,156 @@ std::vector<size_t> get_k_values( KmeansOptions const& options )
     return result;
 }
 
+/**
+ * @brief Names of the input samples, in input order, as used in the assignment files.
+ */
+static std::vector<std::string> jplace_sample_names_( KmeansOptions const& options )
+{
+    auto names = std::vector<std::string>( options.jplace_input.file_count() );
+    for( size_t fi = 0; fi < names.size(); ++fi ) {
+        names[fi] = options.jplace_input.base_file_name( fi );
+    }
+    return names;
+}
+
+/**
+ * @brief Read a tab-separated assignment file (as written by write_assignment_file() or
+ * the checkpointing) into a per-sample cluster vector, matched against the given
+ * sample names.
+ *
+ * Samples without an assignment in the file are marked with the maximum size_t value.
+ * Returns the vector and the number of samples that were found in the file.
+ */
+static std::pair<std::vector<size_t>, size_t> read_assignment_file_(
+    std::vector<std::string> const& names,
+    std::string const& path
+) {
+    using namespace genesis::utils;
+
+    // Read the assignment file into a map from sample name to cluster.
+    // The file is tab-separated with a header, see write_assignment_file().
+    auto assignment_of = std::unordered_map<std::string, size_t>();
+    auto const lines = file_read_lines( path );
+    for( size_t li = 1; li < lines.size(); ++li ) {
+        if( lines[li].empty() ) {
+            continue;
+        }
+        auto const fields = split( lines[li], "\t" );
+        if( fields.size() < 2 ) {
+            throw std::runtime_error(
+                "Invalid assignment file '" + path + "' at line " +
+                std::to_string( li + 1 ) + ": expecting tab-separated sample and cluster columns."
+            );
+        }
+        try {
+            assignment_of[ fields[0] ] = std::stoul( fields[1] );
+        } catch( ... ) {
+            throw std::runtime_error(
+                "Invalid assignment file '" + path + "' at line " +
+                std::to_string( li + 1 ) + ": cannot parse cluster index '" + fields[1] + "'."
+            );
+        }
+    }
+
+    // Match against the current samples. Samples without a previous assignment
+    // (for example, newly added ones) are marked as unassigned.
+    auto result = std::vector<size_t>( names.size(), std::numeric_limits<size_t>::max() );
+    size_t found = 0;
+    for( size_t fi = 0; fi < names.size(); ++fi ) {
+        auto const it = assignment_of.find( names[fi] );
+        if( it != assignment_of.end() ) {
+            result[fi] = it->second;
+            ++found;
+        }
+    }
+    return { std::move( result ), found };
+}
+
+std::vector<size_t> read_initial_assignments( KmeansOptions const& options )
+{
+    // Samples that are unassigned here are simply assigned in the initial
+    // assignment pass of the clustering.
+    auto read = read_assignment_file_( jplace_sample_names_( options ), options.init_assignments );
+    auto const set_size = options.jplace_input.file_count();
+    if( read.second == 0 ) {
+        throw std::runtime_error(
+            "None of the input samples appear in the assignment file '" +
+            options.init_assignments + "'."
+        );
+    }
+    LOG_MSG1 << "Seeding clusters from previous assignments of " << read.second
+             << " of " << set_size << " samples.";
+    return std::move( read.first );
+}
+
+// =================================================================================================
+//      Checkpointing
+// =================================================================================================
+
+/**
+ * @brief Path of the checkpoint file for one k, see the --checkpoint-dir option.
+ */
+static std::string kmeans_checkpoint_path_( KmeansOptions const& options, size_t k )
+{
+    return options.checkpoint_dir + "/kmeans_k_" + std::to_string( k ) + "_checkpoint.csv";
+}
+
+std::vector<size_t> load_kmeans_checkpoint(
+    KmeansOptions const& options,
+    size_t k
+) {
+    using namespace genesis::utils;
+
+    auto const path = kmeans_checkpoint_path_( options, k );
+    if( ! file_exists( path )) {
+        return {};
+    }
+
+    // Only resume if the checkpoint covers exactly the current input samples;
+    // otherwise the input has changed, and the checkpoint does not apply.
+    auto read = read_assignment_file_( jplace_sample_names_( options ), path );
+    if( read.second != options.jplace_input.file_count() ) {
+        LOG_WARN << "Warning: Checkpoint file " << path << " does not match the input samples. "
+                 << "Ignoring it and starting over.";
+        return {};
+    }
+    LOG_MSG1 << "Resuming k=" << k << " from the checkpointed assignments in " << path;
+    return std::move( read.first );
+}
+
+void write_kmeans_checkpoint(
+    KmeansOptions const& options,
+    size_t k,
+    std::vector<size_t> const& assignments
+) {
+    using namespace genesis::utils;
+
+    // Write to a temporary file first, then rename, so that an interruption during
+    // the write cannot leave a truncated checkpoint behind.
+    dir_create( options.checkpoint_dir, true );
+    auto const path = kmeans_checkpoint_path_( options, k );
+    auto const tmp_path = path + ".tmp";
+    {
+        std::ofstream checkpoint_stream;
+        file_output_stream( tmp_path, checkpoint_stream );
+        checkpoint_stream << "Sample\tCluster\n";
+        for( size_t fi = 0; fi < assignments.size(); ++fi ) {
+            checkpoint_stream << options.jplace_input.base_file_name( fi )
+                              << "\t" << assignments[fi] << "\n";
+        }
+    }
+    if( std::rename( tmp_path.c_str(), path.c_str() ) != 0 ) {
+        throw std::runtime_error( "Cannot write checkpoint file '" + path + "'." );
+    }
+}
+
+void remove_kmeans_checkpoint(
+    KmeansOptions const& options,
+    size_t k
+) {
+    std::remove( kmeans_checkpoint_path_( options, k ).c_str() );
+}
+
 // =================================================================================================
 //      Output
 // =================================================================================================
@@ -195,7 +417,9 @@ KmeansClusterOverview print_cluster_info(
     KmeansOptions const& options,
     std::vector<size_t> const& assignments,
     genesis::utils::KmeansClusteringInfo const& cluster_info,
-    size_t k
+    size_t k,
+    double initialization_seconds,
+    double iteration_seconds
 ) {
     // Currentky not needed
     (void) options;
@@ -244,6 +468,12 @@ KmeansClusterOverview print_cluster_info(
     LOG_MSG1 << "Total average distance: " << avg_dst;
     LOG_MSG1 << "Total average variance: " << avg_var;
 
+    // Time split between seeding and iterating, to see where a run spends its time.
+    if( initialization_seconds > 0.0 || iteration_seconds > 0.0 ) {
+        LOG_MSG1 << "Initialization took " << initialization_seconds << "s, "
+                 << "iterations took " << iteration_seconds << "s";
+    }
+
     return { k, avg_dst, avg_var };
 }
 
@@ -267,3 +497,247 @@ void write_overview_file(
         (*ov_os) << l.k << "\t" << l.avg_distance << "\t" << l.avg_variance << "\n";
     }
 }
+
+// =================================================================================================
+//      K-Medoids on a Distance Matrix
+// =================================================================================================
+
+/**
+ * @brief Read a distance matrix file as written by MatrixOutputOptions, either in the
+ * labeled `matrix` text format or in the `binary` format.
+ *
+ * Returns the matrix and the sample names of its rows; the names are empty if the file
+ * was written without labels.
+ */
+static std::pair<genesis::utils::Matrix<double>, std::vector<std::string>> read_distance_matrix_(
+    std::string const& path
+) {
+    using namespace genesis;
+    using namespace genesis::utils;
+
+    // Peek at the file to see whether it is in the binary format.
+    std::ifstream file( path, std::ios::binary );
+    char magic[8];
+    file.read( magic, sizeof( magic ));
+    if( file && std::memcmp( magic, "GAPPAMX1", 8 ) == 0 ) {
+
+        // Binary format: value size, dimensions, row names, raw row-major values,
+        // see write_matrix_binary_() in the matrix output options.
+        auto fail = [&](){
+            throw std::runtime_error( "Invalid binary matrix file '" + path + "'." );
+        };
+        auto read_uint64 = [&](){
+            uint64_t value;
+            file.read( reinterpret_cast<char*>( &value ), sizeof( value ));
+            if( ! file ) {
+                fail();
+            }
+            return value;
+        };
+        uint8_t value_size;
+        file.read( reinterpret_cast<char*>( &value_size ), sizeof( value_size ));
+        if( ! file || ( value_size != 4 && value_size != 8 )) {
+            fail();
+        }
+        auto const rows = read_uint64();
+        auto const cols = read_uint64();
+        if( rows != cols || rows == 0 ) {
+            throw std::runtime_error(
+                "Invalid distance matrix file '" + path + "': expecting a square matrix."
+            );
+        }
+        auto const name_count = read_uint64();
+        if( name_count != 0 && name_count != rows ) {
+            fail();
+        }
+        auto names = std::vector<std::string>( name_count );
+        for( auto& name : names ) {
+            name.resize( read_uint64() );
+            file.read( &name[0], name.size() );
+            if( ! file ) {
+                fail();
+            }
+        }
+        auto mat = Matrix<double>( rows, cols );
+        advise_huge_pages( mat.data().data(), rows * cols * sizeof( double ));
+        if( value_size == 8 ) {
+            for( size_t r = 0; r < rows; ++r ) {
+                file.read(
+                    reinterpret_cast<char*>( &mat( r, 0 )), cols * sizeof( double )
+                );
+                if( ! file ) {
+                    fail();
+                }
+            }
+        } else {
+            // Single precision values, see the --precision option of krd.
+            auto row = std::vector<float>( cols );
+            for( size_t r = 0; r < rows; ++r ) {
+                file.read(
+                    reinterpret_cast<char*>( row.data() ), cols * sizeof( float )
+                );
+                if( ! file ) {
+                    fail();
+                }
+                for( size_t c = 0; c < cols; ++c ) {
+                    mat( r, c ) = static_cast<double>( row[c] );
+                }
+            }
+        }
+        return { std::move( mat ), std::move( names ) };
+    }
+    file.close();
+
+    // Text format: a labeled square matrix, tab or comma separated.
+    auto reader = CsvReader();
+    reader.separator_chars( ",\t" );
+    auto const table = reader.read( from_file( path ));
+    if( table.size() < 2 || table[0].size() != table.size() ) {
+        throw std::runtime_error(
+            "Invalid distance matrix file '" + path + "': expecting a labeled square matrix "
+            "in `matrix` format, or a `binary` matrix file."
+        );
+    }
+    auto const n = table.size() - 1;
+    auto names = std::vector<std::string>( table[0].begin() + 1, table[0].end() );
+    auto mat = genesis::utils::Matrix<double>( n, n );
+    for( size_t r = 0; r < n; ++r ) {
+        auto const& line = table[ r + 1 ];
+        if( line.size() != n + 1 || line[0] != names[r] ) {
+            throw std::runtime_error(
+                "Invalid distance matrix file '" + path + "': row labels do not match columns."
+            );
+        }
+        for( size_t c = 0; c < n; ++c ) {
+            try {
+                mat( r, c ) = std::stod( line[ c + 1 ] );
+            } catch( ... ) {
+                throw std::runtime_error(
+                    "Invalid distance matrix file '" + path + "': cannot parse matrix entry."
+                );
+            }
+        }
+    }
+    return { std::move( mat ), std::move( names ) };
+}
+
+void run_kmeans_medoids( KmeansOptions const& options )
+{
+    using namespace genesis::utils;
+
+    // Settings that only apply to the k-means iterations over the raw samples.
+    if( options.mini_batch > 0 ) {
+        throw CLI::ValidationError(
+            "--mini-batch",
+            "Mini-batch mode is not available with a precomputed distance matrix, "
+            "as k-medoids runs finish quickly anyway."
+        );
+    }
+    if( ! options.checkpoint_dir.empty() ) {
+        LOG_MSG1 << "Ignoring --checkpoint-dir: runs on a precomputed distance matrix "
+                 << "finish without checkpointing.";
+    }
+
+    // Get the values of k to run.
+    auto const ks = get_k_values( options );
+
+    // Check for existing files. No centroid trees are written in this mode,
+    // as the cluster centers are samples, not mass trees.
+    std::vector<std::pair<std::string, std::string>> files_to_check;
+    for( auto k : ks ) {
+        files_to_check.push_back({ assignment_infix(k), "csv" });
+    }
+    if( options.overview_file ) {
+        files_to_check.push_back({ "overview", "csv" });
+    }
+    options.file_output.check_output_files_nonexistence( files_to_check );
+    if( ! options.tree_output.get_extensions().empty() ) {
+        LOG_WARN << "Warning: No centroid trees are written when clustering a precomputed "
+                 << "distance matrix, as the cluster centers are samples, not mass trees.";
+    }
+
+    // Read the distances.
+    LOG_MSG1 << "Reading distance matrix.";
+    auto labeled = read_distance_matrix_( options.distance_matrix_file );
+    auto const& distances = labeled.first;
+    auto names = std::move( labeled.second );
+    auto const n = distances.rows();
+    if( n < 2 ) {
+        throw std::runtime_error( "Cannot run k-medoids with fewer than 2 samples." );
+    }
+    if( names.empty() ) {
+        names.resize( n );
+        for( size_t i = 0; i < n; ++i ) {
+            names[i] = "sample_" + std::to_string( i );
+        }
+    }
+    LOG_MSG1 << "Found " << n << " samples.";
+
+    // Warm start from a previous assignment file, if given,
+    // matched against the names of the matrix.
+    auto initial_assignments = std::vector<size_t>();
+    if( ! options.init_assignments.empty() ) {
+        auto read = read_assignment_file_( names, options.init_assignments );
+        if( read.second == 0 ) {
+            throw std::runtime_error(
+                "None of the matrix samples appear in the assignment file '" +
+                options.init_assignments + "'."
+            );
+        }
+        LOG_MSG1 << "Seeding clusters from previous assignments of " << read.second
+                 << " of " << n << " samples.";
+        initial_assignments = std::move( read.first );
+    }
+
+    // Run k-medoids for every specified k, concurrently against the shared read-only
+    // distance matrix. Each k gets its own engine, as the engine holds the per-run state
+    // (assignments, medoids); the inner loops serialize while multiple ks are in flight,
+    // so the threads work on the k sweep instead.
+    auto overview = std::vector<KmeansClusterOverview>( ks.size() );
+    auto const num_jobs = std::min( ks.size(), Options::get().number_of_threads() );
+    #pragma omp parallel for schedule(dynamic) num_threads( num_jobs )
+    for( size_t ki = 0; ki < ks.size(); ++ki ) {
+        auto const k = ks[ki];
+        LOG_MSG1 << "Running k-medoids with k=" << k;
+
+        auto kmedoids = MatrixKmedoids();
+        kmedoids.report_iteration = [k]( size_t iteration ){
+            LOG_MSG2 << " - k=" << k << " iteration " << iteration;
+        };
+
+        kmedoids.initial_assignments( initial_assignments );
+        auto const iterations = kmedoids.run( distances, k );
+        auto const clust_info = kmedoids.cluster_info( distances );
+
+        // Write the per-k output, and keep the log lines of one k together.
+        #pragma omp critical(GAPPA_KMEANS_OUTPUT)
+        {
+            LOG_BOLD;
+            LOG_MSG1 << "k=" << k << " finished after " << iterations << " iterations";
+
+            // Report the medoid samples, which are the cluster centers.
+            for( size_t c = 0; c < k; ++c ) {
+                LOG_MSG2 << " - Cluster " << c << " medoid: " << names[ kmedoids.medoids()[c] ];
+            }
+
+            // Write the assignment file, with the same columns as the k-means runs.
+            auto assm_os = options.file_output.get_output_target( assignment_infix(k), "csv" );
+            (*assm_os) << "Sample\tCluster\tDistance\n";
+            for( size_t s = 0; s < n; ++s ) {
+                (*assm_os) << names[s];
+                (*assm_os) << "\t" << kmedoids.assignments()[s];
+                (*assm_os) << "\t" << clust_info.distances[s];
+                (*assm_os) << "\n";
+            }
+
+            // Print some cluster info, and collect it for the overview file.
+            overview[ki] = print_cluster_info(
+                options, kmedoids.assignments(), clust_info, k,
+                kmedoids.initialization_seconds(), kmedoids.iteration_seconds()
+            );
+        }
+    }
+
+    // Write the overview file for elbow plots etc.
+    write_overview_file( options, overview );
+}
@@ -47,6 +47,10 @@ public:
 
     std::string ks;
     bool        overview_file;
+    size_t      mini_batch = 0;
+    std::string init_assignments;
+    std::string checkpoint_dir;
+    std::string distance_matrix_file;
 
     JplaceInputOptions jplace_input;
     ColorMapOptions    color_map;
@@ -83,6 +87,26 @@ std::vector<size_t> get_k_values(
     KmeansOptions const& options
 );
 
+std::vector<size_t> read_initial_assignments(
+    KmeansOptions const& options
+);
+
+std::vector<size_t> load_kmeans_checkpoint(
+    KmeansOptions const& options,
+    size_t k
+);
+
+void write_kmeans_checkpoint(
+    KmeansOptions const& options,
+    size_t k,
+    std::vector<size_t> const& assignments
+);
+
+void remove_kmeans_checkpoint(
+    KmeansOptions const& options,
+    size_t k
+);
+
 void write_assignment_file(
     KmeansOptions const& options,
     std::vector<size_t> const& assignments,
@@ -94,7 +118,9 @@ KmeansClusterOverview print_cluster_info(
     KmeansOptions const& options,
     std::vector<size_t> const& assignments,
     genesis::utils::KmeansClusteringInfo const& cluster_info,
-    size_t k
+    size_t k,
+    double initialization_seconds = 0.0,
+    double iteration_seconds = 0.0
 );
 
 void write_overview_file(
@@ -102,4 +128,14 @@ void write_overview_file(
     std::vector<KmeansClusterOverview> const& overview
 );
 
+/**
+ * @brief Run k-medoids clustering on the precomputed distance matrix given via
+ * the --distance-matrix-file option, instead of reading the jplace input.
+ *
+ * The clustering commands call this (and return) when the option is set,
+ * so that clustering experiments over different k run against cached distances
+ * (as written by `gappa analyze krd`) instead of recomputing them.
+ */
+void run_kmeans_medoids( KmeansOptions const& options );
+
 #endif // include guard
@@ -26,6 +26,8 @@
 #include "commands/analyze/kmeans.hpp"
 #include "options/global.hpp"
 #include "tools/cli_setup.hpp"
+#include "tools/kmeans.hpp"
+#include "tools/simd_dispatch.hpp"
 
 #include "CLI/CLI.hpp"
 
@@ -36,12 +38,17 @@
 #include "genesis/tree/mass_tree/functions.hpp"
 #include "genesis/tree/mass_tree/kmeans.hpp"
 #include "genesis/tree/mass_tree/tree.hpp"
+#include "genesis/utils/core/options.hpp"
 #include "genesis/utils/io/output_stream.hpp"
 #include "genesis/utils/math/euclidean_kmeans.hpp"
 #include "genesis/utils/math/matrix.hpp"
 #include "genesis/utils/text/string.hpp"
 
+#include <algorithm>
+#include <cassert>
+#include <cmath>
 #include <fstream>
+#include <utility>
 
 #ifdef GENESIS_OPENMP
 #   include <omp.h>
@@ -156,6 +163,13 @@ void run_ikmeans( IkmeansOptions const& options )
     using namespace genesis::tree;
     using namespace genesis::utils;
 
+    // With a precomputed distance matrix, run k-medoids on the cached distances instead
+    // of reading the samples and recomputing imbalance distances.
+    if( ! options.distance_matrix_file.empty() ) {
+        run_kmeans_medoids( options );
+        return;
+    }
+
     // Print some user output.
     options.jplace_input.print();
 
@@ -182,31 +196,111 @@ void run_ikmeans( IkmeansOptions const& options )
         }
     }
 
-    // Set up kmeans.
-    auto ikmeans = EuclideanKmeans( profile.edge_imbalances.cols() );
-    ikmeans.report_iteration = [&]( size_t iteration ){
-        LOG_MSG2 << " - Iteration " << iteration;
+    // Set up kmeans, with triangle-inequality pruning of the distance evaluations,
+    // see AcceleratedKmeans. The euclidean distance is a metric, so the pruning is exact.
+    // The distance evaluations against the centroids dominate the k-means runtime;
+    // the kernel streams the raw contiguous buffers with the widest vector instructions
+    // of the executing CPU, see euclidean_distance() in the simd dispatch layer.
+    // This instance serves as the configured prototype; each k runs on its own copy.
+    auto ikmeans = AcceleratedKmeans<std::vector<double>>();
+    ikmeans.distance_function = [](
+        std::vector<double> const& lhs, std::vector<double> const& rhs
+    ){
+        assert( lhs.size() == rhs.size() );
+        return euclidean_distance( lhs.data(), rhs.data(), lhs.size() );
+    };
+    ikmeans.centroid_function = [](
+        std::vector<std::vector<double>> const& data, std::vector<size_t> const& members
+    ){
+        assert( ! members.empty() );
+        auto centroid = std::vector<double>( data[ members[0] ].size(), 0.0 );
+        auto const size = centroid.size();
+        for( auto const mi : members ) {
+            auto const* row = data[mi].data();
+            #pragma omp simd
+            for( size_t i = 0; i < size; ++i ) {
+                centroid[i] += row[i];
+            }
+        }
+        auto const scale = 1.0 / static_cast<double>( members.size() );
+        for( auto& e : centroid ) {
+            e *= scale;
+        }
+        return centroid;
+    };
+    ikmeans.blend_function = [](
+        std::vector<double>& centroid, std::vector<double> const& point, double learning_rate
+    ){
+        // Convex combination of centroid and sample, for the mini-batch updates.
+        assert( centroid.size() == point.size() );
+        auto const size = centroid.size();
+        auto const* row = point.data();
+        #pragma omp simd
+        for( size_t i = 0; i < size; ++i ) {
+            centroid[i] = ( 1.0 - learning_rate ) * centroid[i] + learning_rate * row[i];
+        }
     };
+    ikmeans.mini_batch_size( options.mini_batch );
 
-    // Run kmeans for every specified k.
-    auto const ks = get_k_values( options );
-    std::vector<KmeansClusterOverview> overview;
-    for( auto const& k : ks ) {
+    // Warm start from a previous assignment file, if given.
+    auto initial_assignments = std::vector<size_t>();
+    if( ! options.init_assignments.empty() ) {
+        initial_assignments = read_initial_assignments( options );
+    }
 
-        // Run it.
-        LOG_BOLD;
+    // Run kmeans for every specified k, concurrently against the shared read-only data.
+    // Each k gets its own copy of the configured engine, as the engine holds the per-run
+    // state (assignments, centroids). The inner loops of the engine are parallel as well;
+    // while multiple ks are in flight, those regions serialize, so the threads work on
+    // the k sweep instead of idling in the sequential tail of each single clustering.
+    auto const ks = get_k_values( options );
+    auto overview = std::vector<KmeansClusterOverview>( ks.size() );
+    auto const num_jobs = std::min( ks.size(), Options::get().number_of_threads() );
+    #pragma omp parallel for schedule(dynamic) num_threads( num_jobs )
+    for( size_t ki = 0; ki < ks.size(); ++ki ) {
+        auto const k = ks[ki];
         LOG_MSG1 << "Running Imbalance Kmeans with k=" << k;
-        auto const iterations = ikmeans.run( edge_imb_vec, k );
-        auto const clust_info = ikmeans.cluster_info( edge_imb_vec );
-        LOG_MSG1 << "Finished after " << iterations << " iterations";
 
-        // Write output.
-        write_assignment_file( options, ikmeans.assignments(), clust_info, k );
-        write_ikmeans_cluster_trees( options, profile, ikmeans.assignments(), k );
+        // Per-k engine, with the log and checkpoint callbacks bound to this k.
+        auto kmeans = ikmeans;
+        kmeans.report_iteration = [k]( size_t iteration ){
+            LOG_MSG2 << " - k=" << k << " iteration " << iteration;
+        };
+
+        // With checkpointing, resume from the assignments of the last completed iteration
+        // of an interrupted run, and store the assignments after each iteration.
+        auto k_initial = initial_assignments;
+        if( ! options.checkpoint_dir.empty() ) {
+            auto resumed = load_kmeans_checkpoint( options, k );
+            if( ! resumed.empty() ) {
+                k_initial = std::move( resumed );
+            }
+            kmeans.checkpoint_iteration = [&options, k](
+                size_t, std::vector<size_t> const& assignments
+            ){
+                write_kmeans_checkpoint( options, k, assignments );
+            };
+        }
 
-        // Print some cluster info, and collect it for the overview file.
-        auto const ci = print_cluster_info( options, ikmeans.assignments(), clust_info, k );
-        overview.push_back( ci );
+        kmeans.initial_assignments( k_initial );
+        auto const iterations = kmeans.run( edge_imb_vec, k );
+        auto const clust_info = kmeans.cluster_info( edge_imb_vec );
+        if( ! options.checkpoint_dir.empty() ) {
+            remove_kmeans_checkpoint( options, k );
+        }
+
+        // Write the per-k output files, and keep the cluster info lines of one k together.
+        #pragma omp critical(GAPPA_KMEANS_OUTPUT)
+        {
+            LOG_BOLD;
+            LOG_MSG1 << "k=" << k << " finished after " << iterations << " iterations";
+            write_assignment_file( options, kmeans.assignments(), clust_info, k );
+            write_ikmeans_cluster_trees( options, profile, kmeans.assignments(), k );
+            overview[ki] = print_cluster_info(
+                options, kmeans.assignments(), clust_info, k,
+                kmeans.initialization_seconds(), kmeans.iteration_seconds()
+            );
+        }
     }
 
     // Write the overview file for elbow plots etc.
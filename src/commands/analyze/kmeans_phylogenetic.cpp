@@ -26,6 +26,7 @@
 #include "commands/analyze/kmeans.hpp"
 #include "options/global.hpp"
 #include "tools/cli_setup.hpp"
+#include "tools/kmeans.hpp"
 
 #include "CLI/CLI.hpp"
 
@@ -36,10 +37,14 @@
 #include "genesis/tree/mass_tree/functions.hpp"
 #include "genesis/tree/mass_tree/kmeans.hpp"
 #include "genesis/tree/mass_tree/tree.hpp"
+#include "genesis/utils/core/options.hpp"
 #include "genesis/utils/io/output_stream.hpp"
 #include "genesis/utils/text/string.hpp"
 
+#include <algorithm>
+#include <cassert>
 #include <fstream>
+#include <utility>
 
 #ifdef GENESIS_OPENMP
 #   include <omp.h>
@@ -138,6 +143,13 @@ void run_pkmeans( PkmeansOptions const& options )
     using namespace genesis::tree;
     using namespace genesis::utils;
 
+    // With a precomputed distance matrix, run k-medoids on the cached distances instead
+    // of reading the samples and recomputing earth movers distances.
+    if( ! options.distance_matrix_file.empty() ) {
+        run_kmeans_medoids( options );
+        return;
+    }
+
     // Print some user output.
     options.jplace_input.print();
 
@@ -164,33 +176,103 @@ void run_pkmeans( PkmeansOptions const& options )
         }
     }
 
-    // Set up kmeans.
-    auto mkmeans = MassTreeKmeans();
-    mkmeans.report_iteration = [&]( size_t iteration ){
-        LOG_MSG2 << " - Iteration " << iteration;
+    // Set up kmeans, with triangle-inequality pruning of the distance evaluations,
+    // see AcceleratedKmeans. The earth movers distance is a metric, so the pruning is exact.
+    // This instance serves as the configured prototype; each k runs on its own copy.
+    auto mkmeans = AcceleratedKmeans<MassTree>();
+    mkmeans.distance_function = []( MassTree const& lhs, MassTree const& rhs ){
+        return earth_movers_distance( lhs, rhs, 1.0 );
     };
-    if( options.bins > 0 ) {
-        mkmeans.accumulate_centroid_masses( options.bins );
-    }
+    mkmeans.centroid_function = [&](
+        std::vector<MassTree> const& data, std::vector<size_t> const& members
+    ){
+        // Average the masses of the member trees. With binning, also keep the number
+        // of mass points on the centroid bounded, as it accumulates all member masses.
+        assert( ! members.empty() );
+        auto centroid = data[ members[0] ];
+        for( size_t i = 1; i < members.size(); ++i ) {
+            mass_tree_merge_trees_inplace( centroid, data[ members[i] ] );
+        }
+        for( auto& edge : centroid.edges() ) {
+            for( auto& mass : edge.data<MassTreeEdgeData>().masses ) {
+                mass.second /= static_cast<double>( members.size() );
+            }
+        }
+        if( options.bins > 0 ) {
+            mass_tree_binify_masses( centroid, options.bins );
+        }
+        return centroid;
+    };
+    mkmeans.blend_function = [&](
+        MassTree& centroid, MassTree const& point, double learning_rate
+    ){
+        // Convex combination of centroid and sample, for the mini-batch updates.
+        mass_tree_merge_trees_inplace( centroid, point, 1.0 - learning_rate, learning_rate );
+        if( options.bins > 0 ) {
+            mass_tree_binify_masses( centroid, options.bins );
+        }
+    };
+    mkmeans.mini_batch_size( options.mini_batch );
 
-    // Run kmeans for every specified k.
-    std::vector<KmeansClusterOverview> overview;
-    for( auto const& k : ks ) {
+    // Warm start from a previous assignment file, if given.
+    auto initial_assignments = std::vector<size_t>();
+    if( ! options.init_assignments.empty() ) {
+        initial_assignments = read_initial_assignments( options );
+    }
 
-        // Run it.
-        LOG_BOLD;
+    // Run kmeans for every specified k, concurrently against the shared read-only mass
+    // trees. Each k gets its own copy of the configured engine, as the engine holds the
+    // per-run state (assignments, centroids). The inner loops of the engine are parallel
+    // as well; while multiple ks are in flight, those regions serialize, so the threads
+    // work on the k sweep instead of idling in the sequential tail of each clustering.
+    // Note that each k in flight holds its own k centroid trees in memory.
+    auto overview = std::vector<KmeansClusterOverview>( ks.size() );
+    auto const num_jobs = std::min( ks.size(), Options::get().number_of_threads() );
+    #pragma omp parallel for schedule(dynamic) num_threads( num_jobs )
+    for( size_t ki = 0; ki < ks.size(); ++ki ) {
+        auto const k = ks[ki];
         LOG_MSG1 << "Running Phylogenetic Kmeans with k=" << k;
-        auto const iterations = mkmeans.run( mass_trees, k );
-        auto const clust_info = mkmeans.cluster_info( mass_trees );
-        LOG_MSG1 << "Finished after " << iterations << " iterations";
 
-        // Write output.
-        write_assignment_file( options, mkmeans.assignments(), clust_info, k );
-        write_pkmeans_cluster_trees( options, mkmeans.centroids(), k );
+        // Per-k engine, with the log and checkpoint callbacks bound to this k.
+        auto kmeans = mkmeans;
+        kmeans.report_iteration = [k]( size_t iteration ){
+            LOG_MSG2 << " - k=" << k << " iteration " << iteration;
+        };
+
+        // With checkpointing, resume from the assignments of the last completed iteration
+        // of an interrupted run, and store the assignments after each iteration.
+        auto k_initial = initial_assignments;
+        if( ! options.checkpoint_dir.empty() ) {
+            auto resumed = load_kmeans_checkpoint( options, k );
+            if( ! resumed.empty() ) {
+                k_initial = std::move( resumed );
+            }
+            kmeans.checkpoint_iteration = [&options, k](
+                size_t, std::vector<size_t> const& assignments
+            ){
+                write_kmeans_checkpoint( options, k, assignments );
+            };
+        }
+
+        kmeans.initial_assignments( k_initial );
+        auto const iterations = kmeans.run( mass_trees, k );
+        auto const clust_info = kmeans.cluster_info( mass_trees );
+        if( ! options.checkpoint_dir.empty() ) {
+            remove_kmeans_checkpoint( options, k );
+        }
 
-        // Print some cluster info, and collect it for the overview file.
-        auto const ci = print_cluster_info( options, mkmeans.assignments(), clust_info, k );
-        overview.push_back( ci );
+        // Write the per-k output files, and keep the cluster info lines of one k together.
+        #pragma omp critical(GAPPA_KMEANS_OUTPUT)
+        {
+            LOG_BOLD;
+            LOG_MSG1 << "k=" << k << " finished after " << iterations << " iterations";
+            write_assignment_file( options, kmeans.assignments(), clust_info, k );
+            write_pkmeans_cluster_trees( options, kmeans.centroids(), k );
+            overview[ki] = print_cluster_info(
+                options, kmeans.assignments(), clust_info, k,
+                kmeans.initialization_seconds(), kmeans.iteration_seconds()
+            );
+        }
     }
 
     // Write the overview file for elbow plots etc.
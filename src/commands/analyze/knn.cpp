@@ -0,0 +1,240 @@
+/*
+    gappa - Genesis Applications for Phylogenetic Placement Analysis
+    Copyright (C) 2017-2024 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+#include "commands/analyze/knn.hpp"
+
+#include "options/global.hpp"
+#include "tools/cli_setup.hpp"
+#include "tools/sparse_masses.hpp"
+
+#include "CLI/CLI.hpp"
+
+#include "genesis/tree/function/operators.hpp"
+#include "genesis/tree/mass_tree/tree.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+#include <memory>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef GENESIS_OPENMP
+#   include <omp.h>
+#endif
+
+// =================================================================================================
+//      Setup
+// =================================================================================================
+
+void setup_knn( CLI::App& app )
+{
+    // Create the options and subcommand objects.
+    auto opt = std::make_shared<KnnOptions>();
+    auto sub = app.add_subcommand(
+        "knn",
+        "Find the k nearest neighboring samples of each sample, "
+        "using the Kantorovich-Rubinstein (KR) distance."
+    );
+
+    // File input. The collection of samples to search in.
+    opt->jplace_input.add_jplace_input_opt_to_app( sub );
+
+    // Optional query files. Without them, the neighbors are searched among the input
+    // samples themselves. Registered on a second input object, so that the queries are
+    // read with the same settings as the collection.
+    auto query_opt = opt->query_input.add_multi_file_input_opt_to_app(
+        sub, "query-jplace", "jplace(\\.gz)?", "jplace[.gz]", false, "Input"
+    );
+    query_opt->description(
+        "List of jplace files or directories to use as queries. If given, the nearest "
+        "neighbors of each query among the `--jplace-path` samples are reported. "
+        "Without queries, the input samples are queried against each other instead."
+    );
+
+    // Number of neighbors.
+    sub->add_option(
+        "--k",
+        opt->k,
+        "Number of nearest neighbors to report per query. If the collection contains "
+        "fewer samples than that, all of them are reported.",
+        true
+    )->group( "Settings" );
+
+    // Exponent for kr integration
+    sub->add_option(
+        "--exponent",
+        opt->exponent,
+        "Exponent for KR integration.",
+        true
+    )->group( "Settings" );
+
+    // Further input settings
+    opt->jplace_input.add_point_mass_opt_to_app( sub );
+    opt->jplace_input.add_ignore_multiplicities_opt_to_app( sub );
+    opt->jplace_input.add_subsample_opt_to_app( sub );
+
+    // Output
+    opt->file_output.add_default_output_opts_to_app( sub );
+    opt->file_output.add_file_compress_opt_to_app( sub );
+
+    // Set the run function as callback to be called when this subcommand is issued.
+    // Hand over the options by copy, so that their shared ptr stays alive in the lambda.
+    sub->callback( gappa_cli_callback(
+        sub,
+        {
+            "Evans2012-kr-distance"
+        },
+        [ opt ]() {
+            run_knn( *opt );
+        }
+    ));
+}
+
+// =================================================================================================
+//      Run
+// =================================================================================================
+
+void run_knn( KnnOptions const& options )
+{
+    using namespace genesis;
+    using namespace genesis::tree;
+
+    // Check if any of the files we are going to produce already exists. If so, fail early.
+    options.file_output.check_output_files_nonexistence( "knn", "csv" );
+
+    // Print some user output.
+    options.jplace_input.print();
+
+    // Base checks. In self mode, each sample is queried against the others,
+    // so we need at least two of them for any pair to exist.
+    auto const self_mode = ( options.query_input.file_count() == 0 );
+    if( options.k == 0 ) {
+        throw std::runtime_error( "Cannot run knn with --k 0." );
+    }
+    if( self_mode && options.jplace_input.file_count() < 2 ) {
+        throw std::runtime_error( "Cannot run knn with fewer than 2 samples." );
+    }
+
+    // Read the collection, and compress the mass trees into their sparse representation,
+    // freeing the trees as we go, see krd for the rationale. We do not compact the trees:
+    // compaction prunes subtrees that are empty across one set of samples, which the
+    // other set might well occupy.
+    auto mass_trees = options.jplace_input.mass_tree_set( true, false );
+    auto const layout = MassTreeLayout( mass_trees[0] );
+    auto const collection_names = options.jplace_input.base_file_names();
+    auto const cn = mass_trees.size();
+    auto collection = std::vector<SparseMasses>( cn );
+    for( size_t i = 0; i < cn; ++i ) {
+        collection[i] = layout.compress( mass_trees[i] );
+        mass_trees[i] = MassTree();
+    }
+    mass_trees.clear();
+
+    // Read the queries the same way. In self mode, they are the collection itself.
+    auto query_names = collection_names;
+    auto queries = std::vector<SparseMasses>();
+    if( ! self_mode ) {
+        auto query_trees = options.query_input.mass_tree_set( true, false );
+        if( ! identical_topology( layout.template_tree(), query_trees[0] )) {
+            throw std::runtime_error(
+                "Query jplace files have a differing reference tree than the input samples."
+            );
+        }
+        query_names = options.query_input.base_file_names();
+        queries.resize( query_trees.size() );
+        for( size_t i = 0; i < query_trees.size(); ++i ) {
+            queries[i] = layout.compress( query_trees[i] );
+            query_trees[i] = MassTree();
+        }
+        query_trees.clear();
+    }
+    auto const qn = self_mode ? cn : queries.size();
+
+    // For each query, find the k nearest samples of the collection. Queries are
+    // independent of each other, so we process them in parallel.
+    LOG_MSG1 << "Searching nearest neighbors.";
+    auto results = std::vector<std::vector<std::pair<double, size_t>>>( qn );
+    size_t query_count = 0;
+    #pragma omp parallel for schedule(dynamic)
+    for( size_t qi = 0; qi < qn; ++qi ) {
+        auto const& query = self_mode ? collection[qi] : queries[qi];
+
+        // Keep the k best candidates in a max heap, so that its top is the current k-th
+        // best distance. Once the heap is full, that distance bounds the EMD computation:
+        // a pair whose accumulated work exceeds it cannot make it into the heap anyway,
+        // so the kernel abandons it early, see MassTreeLayout::earth_movers_distance().
+        using Candidate = std::pair<double, size_t>;
+        std::priority_queue<Candidate> best;
+        for( size_t ri = 0; ri < cn; ++ri ) {
+            if( self_mode && ri == qi ) {
+                continue;
+            }
+            auto const bound = ( best.size() == options.k )
+                ? best.top().first
+                : std::numeric_limits<double>::infinity()
+            ;
+            auto const dist = layout.earth_movers_distance(
+                query, collection[ri], options.exponent, bound
+            );
+            if( dist < bound ) {
+                best.emplace( dist, ri );
+                if( best.size() > options.k ) {
+                    best.pop();
+                }
+            }
+        }
+
+        // Unwind the heap into the result list, nearest neighbor first.
+        auto& result = results[qi];
+        result.resize( best.size() );
+        for( size_t i = best.size(); i > 0; --i ) {
+            result[ i - 1 ] = best.top();
+            best.pop();
+        }
+
+        // Progress report per finished query.
+        size_t current;
+        #pragma omp atomic capture
+        current = ++query_count;
+        LOG_MSG2 << "Processed query " << current << " of " << qn
+                 << ": " << query_names[qi];
+    }
+
+    // Write the neighbor list.
+    LOG_MSG1 << "Writing neighbor list.";
+    auto target = options.file_output.get_output_target( "knn", "csv" );
+    (*target) << "Query,Rank,Neighbor,Distance\n";
+    for( size_t qi = 0; qi < qn; ++qi ) {
+        for( size_t i = 0; i < results[qi].size(); ++i ) {
+            (*target) << query_names[qi];
+            (*target) << "," << ( i + 1 );
+            (*target) << "," << collection_names[ results[qi][i].second ];
+            (*target) << "," << results[qi][i].first;
+            (*target) << "\n";
+        }
+    }
+}
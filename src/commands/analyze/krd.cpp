@@ -25,6 +25,11 @@
 
 #include "options/global.hpp"
 #include "tools/cli_setup.hpp"
+#include "tools/misc.hpp"
+#include "tools/profiler.hpp"
+#include "tools/progress.hpp"
+#include "tools/randomized_svd.hpp"
+#include "tools/sparse_masses.hpp"
 
 #include "CLI/CLI.hpp"
 
@@ -42,15 +47,36 @@
 
 #include "genesis/utils/containers/matrix.hpp"
 #include "genesis/utils/containers/matrix/operators.hpp"
+#include "genesis/utils/core/fs.hpp"
+#include "genesis/utils/formats/csv/reader.hpp"
+#include "genesis/utils/io/input_source.hpp"
 #include "genesis/utils/io/output_stream.hpp"
+#include "genesis/utils/text/string.hpp"
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
 #include <fstream>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
 
 #ifdef GENESIS_OPENMP
 #   include <omp.h>
 #endif
 
+#if ! defined( _WIN32 )
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <unistd.h>
+#endif
+
 // =================================================================================================
 //      Setup
 // =================================================================================================
@@ -64,8 +90,8 @@ void setup_krd( CLI::App& app )
         "Calculate the pairwise Kantorovich-Rubinstein (KR) distance matrix between samples."
     );
 
-    // File input
-    opt->jplace_input.add_jplace_input_opt_to_app( sub );
+    // File input. Not required, as the shard merge mode works on matrix files only.
+    opt->jplace_input.add_jplace_input_opt_to_app( sub, false );
 
     // Exponent for kr integration
     sub->add_option(
@@ -82,9 +108,116 @@ void setup_krd( CLI::App& app )
         "Divide the KR distance by the tree length to get normalized values."
     )->group( "Settings" );
 
+    // Approximate mode.
+    sub->add_option(
+        "--approximate-resolution",
+        opt->approximate_resolution,
+        "If set, compute approximate distances by collapsing all subtrees of the reference "
+        "tree whose height is at most the given branch-length resolution into single mass "
+        "points before the distance computation. This trades exactness for speed, for "
+        "example for a first triage of large sample sets; an upper bound on the introduced "
+        "error is reported. The bound is exact for `--exponent 1` only."
+    )->group( "Settings" );
+
     // Further input settings
     opt->jplace_input.add_point_mass_opt_to_app( sub );
     opt->jplace_input.add_ignore_multiplicities_opt_to_app( sub );
+    opt->jplace_input.add_subsample_opt_to_app( sub );
+
+    // Principal coordinates of the distance matrix.
+    auto mds_opt = sub->add_option(
+        "--mds-dimensions",
+        opt->mds_dimensions,
+        "If set, also compute the given number of principal coordinates (classical "
+        "multidimensional scaling) of the distance matrix, directly from the in-memory "
+        "matrix, and write them to a `krd_mds.csv` table with one row per sample. "
+        "This replaces the round-trip of loading the full distance matrix into external "
+        "tools just to compute a small embedding."
+    )->group( "Settings" );
+
+    // Numeric precision of the distance matrix.
+    sub->add_option(
+        "--precision",
+        opt->precision,
+        "Numeric precision used for storing the distance matrix. `float32` halves the memory "
+        "needed for the matrix, and still yields about 7 significant digits, which for large "
+        "sample sets can decide whether a run fits into memory.",
+        true
+    )->group( "Settings" )
+    ->transform(
+        CLI::IsMember({ "double", "float32" }, CLI::ignore_case )
+    );
+
+    // Sharding, for fanning the computation out over multiple nodes.
+    auto shard_opt = sub->add_option(
+        "--shard",
+        opt->shard,
+        "Compute only one stripe of the sample pairs, given as `i/n` with 1 <= i <= n, "
+        "and write a partial matrix (zero for pairs of other stripes) to a file with "
+        "a `shard_i_of_n` infix. Run once per stripe, on any machine, with identical "
+        "input samples and settings, then combine the results with `--merge-shards`."
+    )->group( "Settings" );
+    auto merge_opt = sub->add_option(
+        "--merge-shards",
+        opt->merge_shards,
+        "Stitch the partial matrices of `--shard` runs (in `matrix` format, with labels) "
+        "into the final distance matrix, without computing any distances. "
+        "All partial matrices need to use the same samples in the same order."
+    )->check( CLI::ExistingFile )->group( "Settings" );
+    shard_opt->excludes( merge_opt );
+    merge_opt->excludes( shard_opt );
+
+    // Incremental updates of an existing matrix.
+    auto prev_opt = sub->add_option(
+        "--previous-matrix",
+        opt->previous_matrix,
+        "Previously computed krd matrix (in `matrix` format, with labels) to update "
+        "incrementally: distances between samples that already appear in it are reused, "
+        "and only pairs involving new samples are computed. All samples of the previous "
+        "matrix have to be part of the input, with unchanged settings."
+    )->check( CLI::ExistingFile )->group( "Settings" );
+    prev_opt->excludes( merge_opt );
+    merge_opt->excludes( prev_opt );
+
+    // Targeted pair computation instead of the full matrix.
+    auto pairs_opt = sub->add_option(
+        "--pairs",
+        opt->pairs_file,
+        "File listing specific sample pairs to compute, given as two tab- or comma-separated "
+        "sample names (base file names of the input samples) per line. Instead of the full "
+        "pairwise matrix, only the listed pairs are computed, and written as a "
+        "`krd_pairs` list with one `sample-a, sample-b, distance` line per pair. "
+        "Useful for targeted questions such as comparing new samples against a reference "
+        "set, where computing all pairs would be wasteful."
+    )->check( CLI::ExistingFile )->group( "Settings" );
+    pairs_opt->excludes( shard_opt );
+    pairs_opt->excludes( merge_opt );
+    pairs_opt->excludes( prev_opt );
+    pairs_opt->excludes( mds_opt );
+
+    // Checkpointing, for long runs on unreliable hardware.
+    auto checkpoint_opt = sub->add_option(
+        "--checkpoint-dir",
+        opt->checkpoint_dir,
+        "Directory to periodically store the completed rows of the distance matrix in "
+        "(roughly every ten minutes). If the command is interrupted, a rerun with the same "
+        "input samples and settings resumes from the last checkpoint instead of starting "
+        "over. The directory is created if needed; the checkpoint file is removed once "
+        "the final matrix has been written."
+    )->group( "Settings" );
+    checkpoint_opt->excludes( merge_opt );
+    checkpoint_opt->excludes( pairs_opt );
+
+    // File-backed matrix, for results larger than RAM.
+    sub->add_option(
+        "--mmap-matrix-dir",
+        opt->mmap_matrix_dir,
+        "Directory for a scratch file that backs the distance matrix via memory mapping. "
+        "If set, the distances are written into file-backed memory as they are computed, "
+        "and the OS pages matrix blocks in and out as needed, so that the size of the "
+        "result matrix is no longer capped by RAM. Best placed on fast local storage; "
+        "the scratch file is removed once the final matrix has been written."
+    )->group( "Settings" );
 
     // Output
     // std::string const matrix_optname = "krd";
@@ -110,18 +243,538 @@ void setup_krd( CLI::App& app )
 }
 
 // =================================================================================================
-//      Run
+//      Run Helpers
 // =================================================================================================
 
-void run_krd( KrdOptions const& options )
+/**
+ * @brief Parse the `--shard` option value of the form `i/n` into a zero-based
+ * shard index and the total number of shards.
+ */
+static std::pair<size_t, size_t> parse_shard_( std::string const& value )
 {
+    auto const pos = value.find( '/' );
+    size_t index = 0;
+    size_t total = 0;
+    try {
+        if( pos == std::string::npos ) {
+            throw std::invalid_argument( "no separator" );
+        }
+        index = std::stoul( value.substr( 0, pos ));
+        total = std::stoul( value.substr( pos + 1 ));
+    } catch( ... ) {
+        throw CLI::ValidationError(
+            "--shard (" + value + ")", "Invalid value, has to be of the form `i/n`."
+        );
+    }
+    if( total == 0 || index == 0 || index > total ) {
+        throw CLI::ValidationError(
+            "--shard (" + value + ")", "Invalid value, needs 1 <= i <= n."
+        );
+    }
+    return { index - 1, total };
+}
+
+/**
+ * @brief Read a labeled distance matrix in `matrix` format, as written by the shard runs.
+ */
+static std::pair<genesis::utils::Matrix<double>, std::vector<std::string>> read_labeled_matrix_(
+    std::string const& path
+) {
     using namespace genesis;
-    using namespace genesis::placement;
-    using namespace genesis::tree;
     using namespace genesis::utils;
 
-    // Check if any of the files we are going to produce already exists. If so, fail early.
+    auto reader = CsvReader();
+    reader.separator_chars( ",\t" );
+    auto const table = reader.read( from_file( path ));
+    if( table.size() < 2 || table[0].size() != table.size() ) {
+        throw std::runtime_error(
+            "Invalid partial matrix file '" + path + "': expecting a labeled square matrix."
+        );
+    }
+
+    auto const n = table.size() - 1;
+    auto names = std::vector<std::string>( table[0].begin() + 1, table[0].end() );
+    auto mat = Matrix<double>( n, n );
+    for( size_t r = 0; r < n; ++r ) {
+        auto const& line = table[ r + 1 ];
+        if( line.size() != n + 1 || line[0] != names[r] ) {
+            throw std::runtime_error(
+                "Invalid partial matrix file '" + path + "': row labels do not match columns."
+            );
+        }
+        for( size_t c = 0; c < n; ++c ) {
+            try {
+                mat( r, c ) = std::stod( line[ c + 1 ] );
+            } catch( ... ) {
+                throw std::runtime_error(
+                    "Invalid partial matrix file '" + path + "': cannot parse matrix entry."
+                );
+            }
+        }
+    }
+    return { std::move( mat ), std::move( names ) };
+}
+
+/**
+ * @brief Compute the principal coordinates (classical MDS) of the distance matrix and
+ * write the embedding table, see the --mds-dimensions option.
+ *
+ * The distances are accessed via the given callable, so that the computation works on
+ * both precisions of the in-memory matrix as well as on merged shard matrices.
+ */
+static void run_krd_mds_(
+    KrdOptions const& options,
+    std::function<double( size_t, size_t )> const& distance,
+    size_t n,
+    std::vector<std::string> const& names
+) {
+    using namespace genesis::utils;
+
+    auto const dims = std::min( options.mds_dimensions, n - 1 );
+    LOG_MSG1 << "Computing " << dims << " principal coordinates.";
+    ProfilerGuard mds_guard( "principal coordinates" );
+
+    // Double centering: the Gram matrix B = -1/2 J D^2 J, built from the squared
+    // distances, their row means, and the grand mean. This temporarily needs a second
+    // matrix of the size of the distance matrix, in double precision.
+    auto gram = Matrix<double>( n, n );
+    auto row_means = std::vector<double>( n, 0.0 );
+    double grand_mean = 0.0;
+    #pragma omp parallel for schedule(static) reduction(+:grand_mean)
+    for( size_t i = 0; i < n; ++i ) {
+        double sum = 0.0;
+        for( size_t j = 0; j < n; ++j ) {
+            auto const d = distance( i, j );
+            gram( i, j ) = d * d;
+            sum += d * d;
+        }
+        row_means[i] = sum / static_cast<double>( n );
+        grand_mean += sum;
+    }
+    grand_mean /= static_cast<double>( n ) * static_cast<double>( n );
+    #pragma omp parallel for schedule(static)
+    for( size_t i = 0; i < n; ++i ) {
+        for( size_t j = 0; j < n; ++j ) {
+            gram( i, j ) = -0.5 * ( gram( i, j ) - row_means[i] - row_means[j] + grand_mean );
+        }
+    }
+
+    // Leading eigenpairs of the symmetric Gram matrix, via the randomized solver that
+    // edgepca already uses. The singular vectors of a symmetric matrix are its
+    // eigenvectors; the sign of each eigenvalue follows from the orientation of the
+    // corresponding left and right vector pair. Coordinates only exist for positive
+    // eigenvalues; negative ones indicate the non-Euclidean part of the distances.
+    auto const svd = randomized_svd( gram, dims );
+    auto eigenvalues = std::vector<double>();
+    for( size_t c = 0; c < svd.singular_values.size(); ++c ) {
+        double orientation = 0.0;
+        for( size_t i = 0; i < n; ++i ) {
+            orientation += svd.u( i, c ) * svd.v( i, c );
+        }
+        auto const eigenvalue = ( orientation < 0.0 ? -1.0 : 1.0 ) * svd.singular_values[c];
+        if( eigenvalue <= 0.0 ) {
+            break;
+        }
+        eigenvalues.push_back( eigenvalue );
+    }
+    if( eigenvalues.size() < dims ) {
+        LOG_WARN << "Warning: Only " << eigenvalues.size() << " of the requested " << dims
+                 << " principal coordinates have positive eigenvalues; "
+                 << "the remaining dimensions are omitted.";
+    }
+    double eigenvalue_sum = 0.0;
+    for( auto const ev : eigenvalues ) {
+        eigenvalue_sum += ev;
+    }
+    for( size_t c = 0; c < eigenvalues.size(); ++c ) {
+        LOG_MSG2 << "Principal coordinate " << ( c + 1 ) << " has eigenvalue "
+                 << eigenvalues[c] << " (" << ( 100.0 * eigenvalues[c] / eigenvalue_sum )
+                 << "% of the positive spectrum).";
+    }
+
+    // Write the embedding table: one row per sample, scaled by the root of the eigenvalue.
+    auto target = options.file_output.get_output_target( "krd_mds", "csv" );
+    auto& os = target->ostream();
+    os << "Sample";
+    for( size_t c = 0; c < eigenvalues.size(); ++c ) {
+        os << ",PCo" << ( c + 1 );
+    }
+    os << "\n";
+    for( size_t i = 0; i < n; ++i ) {
+        os << names[i];
+        for( size_t c = 0; c < eigenvalues.size(); ++c ) {
+            os << "," << svd.u( i, c ) * std::sqrt( eigenvalues[c] );
+        }
+        os << "\n";
+    }
+}
+
+// =================================================================================================
+//      Matrix Storage
+// =================================================================================================
+
+/**
+ * @brief Backing storage for the distance matrix: plain heap memory by default, or a
+ * memory-mapped scratch file when a path is given, see the --mmap-matrix-dir option.
+ *
+ * With the file backing, the matrix pages live in the page cache and are written back
+ * to the scratch file by the OS under memory pressure, so the result matrix no longer
+ * needs to fit into RAM. All accesses go through the same raw pointer either way,
+ * so the computation does not need to distinguish the two cases.
+ */
+template<typename T>
+class KrdMatrixStore
+{
+public:
+
+    KrdMatrixStore( size_t element_count, std::string const& backing_path )
+        : size_( element_count * sizeof( T ))
+    {
+        if( backing_path.empty() ) {
+            heap_ = std::unique_ptr<T[]>( new T[ element_count ]);
+            data_ = heap_.get();
+
+            // Only the anonymous heap memory can be collapsed into transparent huge
+            // pages; the file-backed mapping below stays on normal page cache pages.
+            advise_huge_pages( data_, size_ );
+            return;
+        }
+
+        #if defined( _WIN32 )
+            (void) backing_path;
+            throw std::runtime_error(
+                "File-backed distance matrices are not supported on this platform."
+            );
+        #else
+            fd_ = ::open( backing_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644 );
+            if( fd_ < 0 ) {
+                throw std::runtime_error(
+                    "Cannot create matrix scratch file '" + backing_path + "'."
+                );
+            }
+            if( ::ftruncate( fd_, static_cast<off_t>( size_ )) != 0 ) {
+                ::close( fd_ );
+                throw std::runtime_error(
+                    "Cannot size matrix scratch file '" + backing_path + "' to " +
+                    std::to_string( size_ ) + " bytes. Is there enough disk space?"
+                );
+            }
+            auto const mapped = ::mmap(
+                nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0
+            );
+            if( mapped == MAP_FAILED ) {
+                ::close( fd_ );
+                throw std::runtime_error(
+                    "Cannot memory-map matrix scratch file '" + backing_path + "'."
+                );
+            }
+            data_ = static_cast<T*>( mapped );
+        #endif
+    }
+
+    ~KrdMatrixStore()
+    {
+        #if ! defined( _WIN32 )
+            if( fd_ >= 0 ) {
+                ::munmap( data_, size_ );
+                ::close( fd_ );
+            }
+        #endif
+    }
+
+    KrdMatrixStore( KrdMatrixStore const& ) = delete;
+    KrdMatrixStore& operator= ( KrdMatrixStore const& ) = delete;
+
+    T* data()
+    {
+        return data_;
+    }
+
+private:
+
+    size_t size_;
+    std::unique_ptr<T[]> heap_;
+    T* data_ = nullptr;
+    int fd_ = -1;
+};
+
+// =================================================================================================
+//      Checkpointing
+// =================================================================================================
+
+/**
+ * @brief Magic header of the krd checkpoint file, see the --checkpoint-dir option.
+ */
+static std::string const krd_checkpoint_magic_ = "gappa-krd-checkpoint-v1";
+
+/**
+ * @brief Store the current state of the distance matrix in the checkpoint file.
+ *
+ * The file contains the sample names (to detect input changes on resume), one completion
+ * flag per matrix row, and the raw matrix values. Only rows whose flag is set are trusted
+ * when loading; rows that were in progress during the write are simply recomputed.
+ * The file is written to a temporary path first and then renamed, so that an interruption
+ * during the write cannot leave a truncated checkpoint behind.
+ */
+template<typename T>
+static void save_krd_checkpoint_(
+    std::string const& path,
+    std::vector<std::string> const& names,
+    std::vector<uint8_t> const& row_done,
+    T const* data
+) {
+    using namespace genesis::utils;
+
+    auto const n = names.size();
+    auto const tmp_path = path + ".tmp";
+    {
+        std::ofstream os;
+        file_output_stream( tmp_path, os, std::ios::out | std::ios::binary );
+        auto write_uint64 = [&]( uint64_t value ){
+            os.write( reinterpret_cast<char const*>( &value ), sizeof( value ));
+        };
+
+        os.write( krd_checkpoint_magic_.data(), krd_checkpoint_magic_.size() );
+        uint8_t const value_size = sizeof( T );
+        os.write( reinterpret_cast<char const*>( &value_size ), sizeof( value_size ));
+        write_uint64( n );
+        for( auto const& name : names ) {
+            write_uint64( name.size() );
+            os.write( name.data(), name.size() );
+        }
+        os.write( reinterpret_cast<char const*>( row_done.data() ), n );
+        os.write( reinterpret_cast<char const*>( data ), n * n * sizeof( T ));
+    }
+    if( std::rename( tmp_path.c_str(), path.c_str() ) != 0 ) {
+        throw std::runtime_error( "Cannot write checkpoint file '" + path + "'." );
+    }
+}
+
+/**
+ * @brief Load a checkpoint written by save_krd_checkpoint_(), if present and matching.
+ *
+ * Returns whether the checkpoint was loaded. On a mismatch (different samples, or a
+ * different matrix precision), a warning is issued and the checkpoint is ignored.
+ */
+template<typename T>
+static bool load_krd_checkpoint_(
+    std::string const& path,
+    std::vector<std::string> const& names,
+    std::vector<uint8_t>& row_done,
+    T* data
+) {
+    using namespace genesis::utils;
+
+    if( ! file_exists( path )) {
+        return false;
+    }
+    std::ifstream is( path, std::ios::binary );
+    if( ! is ) {
+        return false;
+    }
+    auto const mismatch = [&]( std::string const& reason ){
+        LOG_WARN << "Warning: Checkpoint file " << path << " " << reason
+                 << ". Ignoring it and starting over.";
+        return false;
+    };
+    auto read_uint64 = [&]() {
+        uint64_t value = 0;
+        is.read( reinterpret_cast<char*>( &value ), sizeof( value ));
+        return value;
+    };
+
+    auto const n = names.size();
+    auto magic = std::string( krd_checkpoint_magic_.size(), '\0' );
+    is.read( &magic[0], magic.size() );
+    if( ! is || magic != krd_checkpoint_magic_ ) {
+        return mismatch( "is not a krd checkpoint" );
+    }
+    uint8_t value_size = 0;
+    is.read( reinterpret_cast<char*>( &value_size ), sizeof( value_size ));
+    if( value_size != sizeof( T )) {
+        return mismatch( "uses a different matrix precision" );
+    }
+    if( read_uint64() != n ) {
+        return mismatch( "uses a different number of samples" );
+    }
+    for( auto const& name : names ) {
+        auto stored = std::string( read_uint64(), '\0' );
+        is.read( &stored[0], stored.size() );
+        if( ! is || stored != name ) {
+            return mismatch( "uses different samples (or a different sample order)" );
+        }
+    }
+    is.read( reinterpret_cast<char*>( row_done.data() ), n );
+    is.read( reinterpret_cast<char*>( data ), n * n * sizeof( T ));
+    if( ! is ) {
+        return mismatch( "is truncated" );
+    }
+
+    // The pairs of a completed row are stored authoritatively in its upper triangle part;
+    // the mirrored values may belong to rows that were still in progress. Rebuild the
+    // mirrors from the completed rows, so that the matrix is consistent again.
+    for( size_t i = 0; i < n; ++i ) {
+        if( ! row_done[i] ) {
+            continue;
+        }
+        for( size_t j = i + 1; j < n; ++j ) {
+            data[ j * n + i ] = data[ i * n + j ];
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Combine the partial matrices of shard runs into the final matrix.
+ *
+ * Each pair was computed by exactly one shard and is zero in all others,
+ * so the entry-wise maximum stitches the stripes back together.
+ */
+static void run_krd_merge_shards_( KrdOptions const& options )
+{
+    using namespace genesis::utils;
+
     std::string const infix = "krd_matrix";
+    options.file_output.check_output_files_nonexistence( infix, options.matrix_output.file_extension() );
+    if( options.mds_dimensions > 0 ) {
+        options.file_output.check_output_files_nonexistence( "krd_mds", "csv" );
+    }
+
+    Matrix<double> result;
+    std::vector<std::string> names;
+    for( auto const& path : options.merge_shards ) {
+        LOG_MSG1 << "Reading partial matrix " << path;
+        auto part = read_labeled_matrix_( path );
+        if( names.empty() ) {
+            result = std::move( part.first );
+            names  = std::move( part.second );
+        } else {
+            if( part.second != names ) {
+                throw std::runtime_error(
+                    "Partial matrix '" + path + "' uses different samples (or a different "
+                    "sample order) than the previous ones."
+                );
+            }
+            for( size_t i = 0; i < result.size(); ++i ) {
+                result[i] = std::max( result[i], part.first[i] );
+            }
+        }
+    }
+
+    LOG_MSG1 << "Writing distance matrix.";
+    options.matrix_output.write_matrix(
+        options.file_output.get_output_target( infix, options.matrix_output.file_extension() ),
+        result, names, names, "Sample"
+    );
+
+    // The merged matrix is the complete one, so the embedding can be computed here as well.
+    if( options.mds_dimensions > 0 ) {
+        run_krd_mds_(
+            options,
+            [&]( size_t i, size_t j ){
+                return result( i, j );
+            },
+            names.size(), names
+        );
+    }
+}
+
+/**
+ * @brief Sparse mass representation of all input samples, see read_krd_masses_().
+ */
+struct KrdMassData
+{
+    MassTreeLayout layout;
+    double tree_diameter = 0.0;
+    std::vector<SparseMasses> sparse_masses;
+};
+
+/**
+ * @brief Shared preprocessing of the krd computation modes: read the samples, compress
+ * their masses into the sparse representation, and optionally coarsen them, see the
+ * --approximate-resolution option.
+ */
+static KrdMassData read_krd_masses_( KrdOptions const& options )
+{
+    using namespace genesis;
+    using namespace genesis::tree;
+
+    // Read files.
+    auto mass_trees = options.jplace_input.mass_tree_set( true, true );
+    auto const n = mass_trees.size();
+
+    // Compress the mass trees into their sparse representation, and free the trees,
+    // so that the memory needed for the samples is bounded by the number of placed
+    // masses instead of the number of samples times the size of the tree.
+    // The tree diameter is needed for --normalize, so get it before freeing the trees.
+    KrdMassData data;
+    data.layout = MassTreeLayout( mass_trees[0] );
+    data.tree_diameter = diameter( mass_trees[0] );
+    data.sparse_masses = std::vector<SparseMasses>( n );
+    size_t mass_entries = 0;
+    for( size_t i = 0; i < n; ++i ) {
+        data.sparse_masses[i] = data.layout.compress( mass_trees[i] );
+        mass_entries += data.sparse_masses[i].entries.size();
+        mass_trees[i] = MassTree();
+    }
+    mass_trees.clear();
+    LOG_MSG2 << "Compressed the masses of " << n << " samples into " << mass_entries
+             << " sparse entries.";
+
+    // Approximate mode: collapse small subtrees into single mass points, see the
+    // --approximate-resolution option. The error of each pairwise distance is bounded
+    // by the sum of the mass-times-distance that the coarsening moved in its two
+    // samples, so the largest bound over all pairs uses the two largest sample totals.
+    if( options.approximate_resolution > 0.0 ) {
+        auto const plan = data.layout.coarsening( options.approximate_resolution );
+        auto moved = std::vector<double>( n, 0.0 );
+        size_t coarse_entries = 0;
+        for( size_t i = 0; i < n; ++i ) {
+            data.sparse_masses[i] = data.layout.coarsen( data.sparse_masses[i], plan, moved[i] );
+            coarse_entries += data.sparse_masses[i].entries.size();
+        }
+        double max1 = 0.0;
+        double max2 = 0.0;
+        for( auto const m : moved ) {
+            if( m > max1 ) {
+                max2 = max1;
+                max1 = m;
+            } else if( m > max2 ) {
+                max2 = m;
+            }
+        }
+        auto error_bound = max1 + max2;
+        if( options.normalize ) {
+            error_bound /= data.tree_diameter;
+        }
+        LOG_MSG1 << "Approximation: collapsed the reference tree to " << plan.kept_edge_count
+                 << " of " << data.layout.edge_count() << " distinguishable edges, reducing the "
+                 << "masses to " << coarse_entries << " sparse entries. The error of each "
+                 << "reported distance is at most " << error_bound << ".";
+        if( options.exponent != 1.0 ) {
+            LOG_WARN << "Warning: The approximation error bound assumes `--exponent 1`. "
+                     << "For other exponents, it is only a heuristic estimate.";
+        }
+    }
+
+    return data;
+}
+
+/**
+ * @brief Targeted pair mode: compute only the sample pairs listed in the --pairs file,
+ * instead of the full pairwise matrix.
+ *
+ * The samples are read and compressed exactly as in the matrix computation, but only the
+ * listed pairs are evaluated, and written as a list, in the layout of the `list` matrix
+ * format. For a handful of targeted pairs on a large sample set, this turns a matrix-sized
+ * run into an interactive one.
+ */
+static void run_krd_pairs_( KrdOptions const& options )
+{
+    using namespace genesis::utils;
+
+    // Check if the produced file already exists. If so, fail early.
+    std::string const infix = "krd_pairs";
     options.file_output.check_output_files_nonexistence( infix, "csv" );
 
     // Print some user output.
@@ -132,28 +785,312 @@ void run_krd( KrdOptions const& options )
         throw std::runtime_error( "Cannot run krd with fewer than 2 samples." );
     }
 
-    // Read files.
-    auto const mass_trees = options.jplace_input.mass_tree_set();
+    // Resolve the requested pairs against the sample names before the expensive reading,
+    // so that typos in the pair list fail fast.
+    auto const names = options.jplace_input.base_file_names();
+    auto const pairs = read_sample_pairs( "--pairs", options.pairs_file, names );
+    LOG_MSG1 << "Computing " << pairs.size() << " listed sample pair distances.";
+
+    // Read the samples, and compute the listed pairs in parallel.
+    auto const data = read_krd_masses_( options );
+    auto distances = std::vector<double>( pairs.size(), 0.0 );
+    auto progress = ProgressReporter( "Computed sample pair distances", pairs.size() );
+    ProfilerGuard compute_guard( "pairwise kr distances" );
+    #pragma omp parallel for schedule(dynamic)
+    for( size_t pi = 0; pi < pairs.size(); ++pi ) {
+        auto dist = data.layout.earth_movers_distance(
+            data.sparse_masses[ pairs[pi].first ],
+            data.sparse_masses[ pairs[pi].second ],
+            options.exponent
+        );
+        if( options.normalize ) {
+            dist /= data.tree_diameter;
+        }
+        distances[pi] = dist;
+        progress.increment();
+    }
+    progress.finish();
+    compute_guard.stop();
+
+    // Write the pairs in the order of the input file.
+    LOG_MSG1 << "Writing pair distance list.";
+    auto target = options.file_output.get_output_target( infix, "csv" );
+    auto& os = target->ostream();
+    for( size_t pi = 0; pi < pairs.size(); ++pi ) {
+        os << names[ pairs[pi].first ] << "\t" << names[ pairs[pi].second ]
+           << "\t" << distances[pi] << "\n";
+    }
+}
+
+/**
+ * @brief Main part of the krd computation, over the matrix value type.
+ *
+ * Templated so that the distance matrix can be stored in single precision
+ * when requested via `--precision float32`, see setup_krd().
+ */
+template<typename T>
+static void run_krd_compute_(
+    KrdOptions const& options,
+    size_t shard_index,
+    size_t shard_total,
+    std::string const& infix
+) {
+    using namespace genesis;
+    using namespace genesis::placement;
+    using namespace genesis::tree;
+    using namespace genesis::utils;
+
+    // Print some user output.
+    options.jplace_input.print();
+
+    // Base check
+    if( options.jplace_input.file_count() < 2 ) {
+        throw std::runtime_error( "Cannot run krd with fewer than 2 samples." );
+    }
+
+    // Read the samples into their sparse mass representation.
+    auto const names = options.jplace_input.base_file_names();
+    auto mass_data = read_krd_masses_( options );
+    auto const& layout = mass_data.layout;
+    auto const& sparse_masses = mass_data.sparse_masses;
+    auto const tree_diameter = mass_data.tree_diameter;
+    auto const n = sparse_masses.size();
 
-    // Calculate result matrix.
+    // Calculate result matrix. We compute the upper triangle only, with one row of the
+    // matrix as the unit of work, dynamically distributed over the threads (rows towards
+    // the bottom of the triangle contain fewer pairs, so static scheduling would leave
+    // cores idle), and mirror each distance into the symmetric half.
     LOG_MSG1 << "Calculating pairwise KR distances.";
-    auto krd_matrix = earth_movers_distance( mass_trees, options.exponent );
+
+    // Store the result in a raw buffer instead of a Matrix: either heap memory, or, see
+    // --mmap-matrix-dir, a memory-mapped scratch file for results larger than RAM.
+    // Neither allocation touches the memory (a Matrix would zero-fill it on the main
+    // thread), so the zeroing below is the first write to each page, and in the heap case,
+    // the first-touch policy of the OS then distributes the pages over the NUMA nodes of
+    // the worker threads. This avoids funneling all matrix writes through the memory of
+    // one socket on multi-socket machines, in particular together with the global
+    // --pin-threads option.
+    std::string mmap_path;
+    if( ! options.mmap_matrix_dir.empty() ) {
+        dir_create( options.mmap_matrix_dir, true );
+        mmap_path = options.mmap_matrix_dir + "/" + infix + "_scratch.mmap";
+        LOG_MSG1 << "Backing the distance matrix with scratch file " << mmap_path;
+    }
+    auto krd_store = KrdMatrixStore<T>( n * n, mmap_path );
+    auto* const krd_data = krd_store.data();
+    #pragma omp parallel for schedule(static)
+    for( size_t i = 0; i < n; ++i ) {
+        std::fill( krd_data + i * n, krd_data + ( i + 1 ) * n, static_cast<T>( 0.0 ));
+    }
+    auto krd_matrix = [&]( size_t i, size_t j ) -> T& {
+        return krd_data[ i * n + j ];
+    };
+
+    // Checkpointing: load the state of a previous interrupted run, if present, see the
+    // --checkpoint-dir option. Rows that it marks as completed are skipped in the pair
+    // loop below. The vector stays empty when checkpointing is not requested.
+    auto row_done = std::vector<uint8_t>();
+    std::string checkpoint_path;
+    auto last_checkpoint = std::chrono::steady_clock::now();
+    if( ! options.checkpoint_dir.empty() ) {
+        dir_create( options.checkpoint_dir, true );
+        checkpoint_path = options.checkpoint_dir + "/" + infix + "_checkpoint.bin";
+        row_done.assign( n, 0 );
+        if( load_krd_checkpoint_( checkpoint_path, names, row_done, krd_data )) {
+            auto const done_rows = static_cast<size_t>(
+                std::count( row_done.begin(), row_done.end(), 1 )
+            );
+            LOG_MSG1 << "Resuming from checkpoint: " << done_rows << " of " << n
+                     << " matrix rows already computed.";
+        }
+    }
+
+    // Incremental mode: fill in the distances between previously known samples from the
+    // given matrix, and mark them, so that only new-vs-old and new-vs-new pairs are computed.
+    auto is_new = std::vector<bool>( n, true );
+    size_t old_count = 0;
+    if( ! options.previous_matrix.empty() ) {
+        auto const prev = read_labeled_matrix_( options.previous_matrix );
+        std::unordered_map<std::string, size_t> old_index;
+        for( size_t i = 0; i < prev.second.size(); ++i ) {
+            old_index[ prev.second[i] ] = i;
+        }
+        for( size_t i = 0; i < names.size(); ++i ) {
+            if( old_index.count( names[i] ) > 0 ) {
+                is_new[i] = false;
+                ++old_count;
+            }
+        }
+        if( old_count != prev.second.size() ) {
+            throw std::runtime_error(
+                "All samples of the previous matrix need to be part of the input, "
+                "so that distances between old and new samples can be computed."
+            );
+        }
+        for( size_t i = 0; i < names.size(); ++i ) {
+            for( size_t j = 0; j < names.size(); ++j ) {
+                if( ! is_new[i] && ! is_new[j] ) {
+                    krd_matrix( i, j ) = static_cast<T>(
+                        prev.first( old_index.at( names[i] ), old_index.at( names[j] ))
+                    );
+                }
+            }
+        }
+        LOG_MSG1 << "Reusing " << ( old_count * ( old_count - 1 ) / 2 ) << " distances of "
+                 << old_count << " previously computed samples.";
+    }
+    auto const pair_total
+        = ( n * ( n - 1 ) / 2
+        -   old_count * ( old_count - 1 ) / 2 ) / shard_total;
+    auto progress = ProgressReporter( "Computed sample pair distances", pair_total );
+
+    ProfilerGuard compute_guard( "pairwise kr distances" );
+    #pragma omp parallel for schedule(dynamic)
+    for( size_t i = 0; i < n; ++i ) {
+
+        // When resuming from a checkpoint, skip the rows that are already done.
+        if( ! row_done.empty() && row_done[i] ) {
+            continue;
+        }
+
+        size_t row_pairs = 0;
+        for( size_t j = i + 1; j < n; ++j ) {
+
+            // Incremental mode: pairs between previously known samples are already filled.
+            if( ! is_new[i] && ! is_new[j] ) {
+                continue;
+            }
+
+            // With sharding, only compute the pairs of our stripe, using the linear
+            // index of the pair in the upper triangle for an even round-robin split.
+            auto const pair_index = i * ( 2 * n - i - 1 ) / 2 + ( j - i - 1 );
+            if( pair_index % shard_total != shard_index ) {
+                continue;
+            }
+            ++row_pairs;
+
+            auto const dist = static_cast<T>( layout.earth_movers_distance(
+                sparse_masses[i], sparse_masses[j], options.exponent
+            ));
+            krd_matrix( i, j ) = dist;
+            krd_matrix( j, i ) = dist;
+        }
+
+        // Progress report per finished row, sampled by the background reporter thread.
+        progress.increment( row_pairs );
+
+        // Checkpointing: mark the row as completed, and periodically persist the matrix.
+        // The critical section also makes the row data of other threads that have already
+        // set their completion flag visible to the thread that writes the file.
+        if( ! row_done.empty() ) {
+            #pragma omp critical(GAPPA_KRD_CHECKPOINT)
+            {
+                row_done[i] = 1;
+                auto const now = std::chrono::steady_clock::now();
+                auto const since = std::chrono::duration_cast<std::chrono::seconds>(
+                    now - last_checkpoint
+                ).count();
+                if( since >= 600 ) {
+                    last_checkpoint = now;
+                    save_krd_checkpoint_( checkpoint_path, names, row_done, krd_data );
+                }
+            }
+        }
+    }
+    progress.finish();
+    compute_guard.stop();
 
     // Normalize by tree diameter if necessary. See https://doi.org/10.1111/j.1467-9868.2011.01018.x
     // for the rationale to normalize by diameter.
     if( options.normalize ) {
-        assert( mass_trees.size() > 0 );
-        auto const len = diameter( mass_trees[0] );
-        for( auto& e : krd_matrix ) {
-            e /= len;
+        auto const len = static_cast<T>( tree_diameter );
+        for( size_t i = 0; i < n; ++i ) {
+            for( size_t j = 0; j < n; ++j ) {
+                // Distances reused from a previous matrix were already normalized there.
+                if( is_new[i] || is_new[j] ) {
+                    krd_matrix( i, j ) /= len;
+                }
+            }
         }
     }
 
     // Write output matrix in the specified format
     LOG_MSG1 << "Writing distance matrix.";
-    auto const names = options.jplace_input.base_file_names();
+    ProfilerGuard write_guard( "matrix output write" );
     options.matrix_output.write_matrix(
-        options.file_output.get_output_target( infix, "csv" ),
-        krd_matrix, names, names, "Sample"
+        options.file_output.get_output_target( infix, options.matrix_output.file_extension() ),
+        krd_data, n, n, names, names, "Sample"
     );
+    write_guard.stop();
+
+    // Compute the principal coordinates from the in-memory matrix, see --mds-dimensions.
+    if( options.mds_dimensions > 0 ) {
+        run_krd_mds_(
+            options,
+            [&]( size_t i, size_t j ){
+                return static_cast<double>( krd_matrix( i, j ));
+            },
+            n, names
+        );
+    }
+
+    // The final matrix is written, so the checkpoint is no longer needed.
+    if( ! checkpoint_path.empty() ) {
+        std::remove( checkpoint_path.c_str() );
+    }
+}
+
+// =================================================================================================
+//      Run
+// =================================================================================================
+
+void run_krd( KrdOptions const& options )
+{
+    // Merge mode: stitch partial matrices, no distance computation at all.
+    if( ! options.merge_shards.empty() ) {
+        run_krd_merge_shards_( options );
+        return;
+    }
+
+    // Pair mode: compute only the listed pairs, no matrix at all.
+    if( ! options.pairs_file.empty() ) {
+        run_krd_pairs_( options );
+        return;
+    }
+
+    // Shard setup. Without --shard, this is one shard covering all pairs.
+    size_t shard_index = 0;
+    size_t shard_total = 1;
+    if( ! options.shard.empty() ) {
+        auto const shard = parse_shard_( options.shard );
+        shard_index = shard.first;
+        shard_total = shard.second;
+    }
+
+    // The embedding only makes sense on the complete matrix, not on a stripe of it.
+    if( shard_total > 1 && options.mds_dimensions > 0 ) {
+        throw CLI::ValidationError(
+            "--mds-dimensions",
+            "Cannot be used together with --shard; "
+            "compute the embedding on the merged matrix via --merge-shards instead."
+        );
+    }
+
+    // Check if any of the files we are going to produce already exists. If so, fail early.
+    std::string infix = "krd_matrix";
+    if( shard_total > 1 ) {
+        infix += "_shard_" + std::to_string( shard_index + 1 )
+              +  "_of_"    + std::to_string( shard_total );
+    }
+    options.file_output.check_output_files_nonexistence( infix, options.matrix_output.file_extension() );
+    if( options.mds_dimensions > 0 ) {
+        options.file_output.check_output_files_nonexistence( "krd_mds", "csv" );
+    }
+
+    // Run in the requested matrix precision.
+    if( genesis::utils::to_lower( options.precision ) == "float32" ) {
+        run_krd_compute_<float>( options, shard_index, shard_total, infix );
+    } else {
+        run_krd_compute_<double>( options, shard_index, shard_total, infix );
+    }
 }
@@ -43,6 +43,16 @@ public:
 
     double exponent = 1.0;
     bool normalize = false;
+    double approximate_resolution = 0.0;
+    size_t mds_dimensions = 0;
+
+    std::string shard;
+    std::vector<std::string> merge_shards;
+    std::string previous_matrix;
+    std::string pairs_file;
+    std::string precision = "double";
+    std::string checkpoint_dir;
+    std::string mmap_matrix_dir;
 
     JplaceInputOptions jplace_input;
     FileOutputOptions file_output;
@@ -25,6 +25,9 @@
 
 #include "options/global.hpp"
 #include "tools/cli_setup.hpp"
+#include "tools/misc.hpp"
+#include "tools/progress.hpp"
+#include "tools/simd_dispatch.hpp"
 
 #include "CLI/CLI.hpp"
 
@@ -38,7 +41,12 @@
 #include "genesis/utils/containers/matrix/operators.hpp"
 #include "genesis/utils/io/output_stream.hpp"
 
+#include <algorithm>
+#include <cassert>
+#include <cmath>
 #include <fstream>
+#include <stdexcept>
+#include <vector>
 
 #ifdef GENESIS_OPENMP
 #   include <omp.h>
@@ -60,6 +68,7 @@ void setup_nhd( CLI::App& app )
     // Add common options.
     opt->jplace_input.add_jplace_input_opt_to_app( sub );
     opt->jplace_input.add_point_mass_opt_to_app( sub );
+    opt->jplace_input.add_subsample_opt_to_app( sub );
 
     // Output
     std::string const matrix_optname = "";
@@ -78,6 +87,16 @@ void setup_nhd( CLI::App& app )
         true
     );
 
+    // Targeted pair computation instead of the full matrix.
+    sub->add_option(
+        "--pairs",
+        opt->pairs_file,
+        "File listing specific sample pairs to compute, given as two tab- or comma-separated "
+        "sample names (base file names of the input samples) per line. Instead of the full "
+        "pairwise matrix, only the listed pairs are computed, and written as a "
+        "`nhd_pairs` list with one `sample-a, sample-b, distance` line per pair."
+    )->check( CLI::ExistingFile );
+
     // Set the run function as callback to be called when this subcommand is issued.
     // Hand over the options by copy, so that their shared ptr stays alive in the lambda.
     sub->callback( gappa_cli_callback(
@@ -101,8 +120,11 @@ void run_nhd( NhdOptions const& options )
     using namespace genesis::utils;
 
     // Check if any of the files we are going to produce already exists. If so, fail early.
-    std::string const infix = "nhd_matrix";
-    options.file_output.check_output_files_nonexistence( infix, "csv" );
+    std::string const infix = options.pairs_file.empty() ? "nhd_matrix" : "nhd_pairs";
+    options.file_output.check_output_files_nonexistence(
+        infix,
+        options.pairs_file.empty() ? options.matrix_output.file_extension() : "csv"
+    );
 
     // Print some user output.
     options.jplace_input.print();
@@ -113,19 +135,15 @@ void run_nhd( NhdOptions const& options )
     Matrix<double> node_distances;
     Matrix<signed char> node_sides;
     auto hist_vecs = std::vector<NodeDistanceHistogramSet>( set_size );
-    size_t file_count = 0;
 
     // TODO do we need tree compatibility and size checks? this is implicitly covered by
     // the exceptions when calculating histogram distnaces, but we might want nicer errors.
 
     // Load files.
+    auto read_progress = ProgressReporter( "Reading jplace files", set_size );
     #pragma omp parallel for schedule(dynamic)
     for( size_t fi = 0; fi < set_size; ++fi ) {
 
-        // User output.
-        LOG_MSG2 << "Processing file " << (++file_count) << " of " << set_size
-                 << ": " << options.jplace_input.file_path( fi );
-
         // Read in file.
         auto const sample = options.jplace_input.sample( fi );
 
@@ -141,16 +159,115 @@ void run_nhd( NhdOptions const& options )
 
         // Fill the histograms for this sample.
         hist_vecs[fi] = node_distance_histogram_set( sample, node_distances, node_sides, options.bins );
+        read_progress.increment();
     }
+    read_progress.finish();
 
     LOG_MSG1 << "Calculating pairwise node histogram distances.";
 
-    // Calcualte result matrix.
-    auto const nhd_matrix = node_histogram_distance( hist_vecs );
+    // Flatten the histograms into one contiguous array per sample, with the bin counts
+    // padded to a multiple of the SIMD width, so that the distance kernel below runs over
+    // plain dense arrays instead of chasing the nested vectors of the genesis histograms.
+    // We store each histogram as its prefix sums (its CDF): the distance between two
+    // histograms of a node is the earth movers distance in one dimension, which over the
+    // CDFs becomes a plain weighted sum of absolute differences, without the sequential
+    // mass-carrying loop of the direct formulation, and thus fully vectorizable.
+    // The histogram ranges only depend on the tree, so the bin widths (the weights of
+    // the sum) are shared between all samples. Padding entries are zero in all samples
+    // and hence do not contribute to any distance.
+    auto const num_nodes = hist_vecs[0].histograms.size();
+    auto const stride = ( options.bins + 7 ) & ~size_t( 7 );
+    auto const flat_size = num_nodes * stride;
+
+    auto weights = std::vector<double>( flat_size, 0.0 );
+    for( size_t n = 0; n < num_nodes; ++n ) {
+        auto const& hist = hist_vecs[0].histograms[n];
+        auto const bin_width = ( hist.max - hist.min ) / static_cast<double>( options.bins );
+        std::fill(
+            weights.begin() + n * stride,
+            weights.begin() + n * stride + options.bins,
+            bin_width
+        );
+    }
+
+    auto flat_cdfs = std::vector<std::vector<double>>( set_size );
+    #pragma omp parallel for schedule(dynamic) if( set_size > 1 )
+    for( size_t fi = 0; fi < set_size; ++fi ) {
+        if( hist_vecs[fi].histograms.size() != num_nodes ) {
+            throw std::runtime_error( "Input jplace files have differing reference trees." );
+        }
+        auto flat = std::vector<double>( flat_size, 0.0 );
+        for( size_t n = 0; n < num_nodes; ++n ) {
+            auto const& bins = hist_vecs[fi].histograms[n].bins;
+            assert( bins.size() == options.bins );
+            double accu = 0.0;
+            for( size_t b = 0; b < bins.size(); ++b ) {
+                accu += bins[b];
+                flat[ n * stride + b ] = accu;
+            }
+        }
+        flat_cdfs[fi] = std::move( flat );
+        hist_vecs[fi].histograms.clear();
+    }
+
+    // Targeted pair mode: compute only the listed pairs instead of the full matrix,
+    // and write them as a list, see the --pairs option.
+    if( ! options.pairs_file.empty() ) {
+        auto const names = options.jplace_input.base_file_names();
+        auto const pairs = read_sample_pairs( "--pairs", options.pairs_file, names );
+        LOG_MSG1 << "Computing " << pairs.size() << " listed sample pair distances.";
+
+        auto distances = std::vector<double>( pairs.size(), 0.0 );
+        auto pair_progress = ProgressReporter( "Computed sample pair distances", pairs.size() );
+        #pragma omp parallel for schedule(dynamic)
+        for( size_t pi = 0; pi < pairs.size(); ++pi ) {
+            distances[pi] = weighted_l1_distance(
+                flat_cdfs[ pairs[pi].first ].data(),
+                flat_cdfs[ pairs[pi].second ].data(),
+                weights.data(), flat_size
+            );
+            pair_progress.increment();
+        }
+        pair_progress.finish();
+
+        // Write the pairs in the order of the input file.
+        LOG_MSG1 << "Writing pair distance list.";
+        auto target = options.file_output.get_output_target( infix, "csv" );
+        auto& os = target->ostream();
+        for( size_t pi = 0; pi < pairs.size(); ++pi ) {
+            os << names[ pairs[pi].first ] << "\t" << names[ pairs[pi].second ]
+               << "\t" << distances[pi] << "\n";
+        }
+        return;
+    }
+
+    // Calculate the result matrix. As in krd, we compute the upper triangle only, one row
+    // of pairs per work unit with dynamic scheduling, and mirror into the symmetric half.
+    auto nhd_matrix = Matrix<double>( set_size, set_size, 0.0 );
+    auto const pair_total = set_size * ( set_size - 1 ) / 2;
+    auto progress = ProgressReporter( "Computed sample pair distances", pair_total );
+
+    #pragma omp parallel for schedule(dynamic)
+    for( size_t i = 0; i < set_size; ++i ) {
+        auto const* fa = flat_cdfs[i].data();
+        for( size_t j = i + 1; j < set_size; ++j ) {
+            auto const* fb = flat_cdfs[j].data();
+
+            // The distance is a weighted sum of absolute CDF differences, computed by
+            // the dispatched kernel with the widest vector instructions of the CPU.
+            auto const dist = weighted_l1_distance( fa, fb, weights.data(), flat_size );
+            nhd_matrix( i, j ) = dist;
+            nhd_matrix( j, i ) = dist;
+        }
+
+        // Progress report per finished row, sampled by the background reporter thread.
+        progress.increment( set_size - i - 1 );
+    }
+    progress.finish();
 
     LOG_MSG1 << "Writing distance matrix.";
     options.matrix_output.write_matrix(
-        options.file_output.get_output_target( infix, "csv" ),
+        options.file_output.get_output_target( infix, options.matrix_output.file_extension() ),
         nhd_matrix
     );
 }
@@ -43,6 +43,7 @@ public:
 
     size_t bins = 50;
     bool normalize = false; // TODO unused
+    std::string pairs_file;
 
     JplaceInputOptions jplace_input;
     FileOutputOptions file_output;
@@ -25,6 +25,7 @@
 
 #include "options/global.hpp"
 #include "tools/cli_setup.hpp"
+#include "tools/phylo_factor.hpp"
 
 #include "CLI/CLI.hpp"
 
@@ -78,6 +79,7 @@ void setup_placement_factorization( CLI::App& app )
     // Jplace Settings
     opt->jplace_input.add_point_mass_opt_to_app( sub );
     opt->jplace_input.add_ignore_multiplicities_opt_to_app( sub );
+    opt->jplace_input.add_subsample_opt_to_app( sub );
 
     // -----------------------------------------------------------
     //     Balance Settings
@@ -500,8 +502,10 @@ void run_placement_factorization( PlacementFactorizationOptions const& options )
     // per factor (iteration), and the inner per edge index.
     auto glm_coeffs = prepare_glm_coefficients( options, balances );
 
-    // Ruuuuuun!
-    auto const factors = phylogenetic_factorization(
+    // Ruuuuuun! The edges of each factor are evaluated in parallel; the objective
+    // function below only writes to its own edge's entry of the coefficients,
+    // so it is safe to be called concurrently.
+    auto const factors = parallel_phylogenetic_factorization(
         balances,
         [&]( size_t iteration, size_t edge_index, std::vector<double> const& balances ){
             auto const fit = glm_fit( meta.matrix, balances, glm_family_gaussian() );
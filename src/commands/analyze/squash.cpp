@@ -25,17 +25,22 @@
 
 #include "options/global.hpp"
 #include "tools/cli_setup.hpp"
+#include "tools/squash_clustering.hpp"
 
 #include "CLI/CLI.hpp"
 
 #include "genesis/placement/function/operators.hpp"
 #include "genesis/placement/function/functions.hpp"
 #include "genesis/tree/mass_tree/functions.hpp"
-#include "genesis/tree/mass_tree/squash_clustering.hpp"
+#include "genesis/utils/core/options.hpp"
 #include "genesis/utils/core/std.hpp"
 #include "genesis/utils/io/output_stream.hpp"
 
+#include <chrono>
+#include <deque>
 #include <fstream>
+#include <future>
+#include <memory>
 
 // =================================================================================================
 //      Setup
@@ -62,9 +67,39 @@ void setup_squash( CLI::App& app )
     )->group( "Settings" );
 
 
+    // Disk-backed storage of cluster trees, for runs that do not fit into memory.
+    auto spill_dir_opt = sub->add_option(
+        "--spill-directory",
+        opt->spill_directory,
+        "If set, keep the cluster mass trees in a disk-backed least-recently-used store in this "
+        "directory instead of in memory, so that the memory needed for the clustering is bounded "
+        "by `--max-trees-in-memory` instead of the number of remaining clusters. Spilling and "
+        "reloading trees costs time, so only use this for runs that otherwise exceed memory. "
+        "The directory is created if needed; the spill files are deleted after the run."
+    )->group( "Settings" );
+    sub->add_option(
+        "--max-trees-in-memory",
+        opt->max_trees_in_memory,
+        "Number of cluster mass trees to keep in memory when `--spill-directory` is used. "
+        "If 0 (default), twice the number of threads is used."
+    )->group( "Settings" )
+    ->needs( spill_dir_opt );
+
+    // Checkpointing, for long runs on unreliable hardware.
+    sub->add_option(
+        "--checkpoint-dir",
+        opt->checkpoint_dir,
+        "Directory to periodically store the clustering state in (roughly every ten minutes). "
+        "If the command is interrupted, a rerun with the same input samples and settings resumes "
+        "from the last checkpoint instead of starting over; as the cluster tree files are then "
+        "written again, such a rerun also needs `--allow-file-overwriting`. The directory is "
+        "created if needed; the checkpoint file is removed once the clustering has finished."
+    )->group( "Settings" );
+
     // Other jplace settings
     opt->jplace_input.add_point_mass_opt_to_app( sub );
     opt->jplace_input.add_ignore_multiplicities_opt_to_app( sub );
+    opt->jplace_input.add_subsample_opt_to_app( sub );
 
     // Color.
     opt->color_map.add_color_list_opt_to_app( sub, "BuPuBk" );
@@ -116,43 +151,99 @@ void run_squash( SquashOptions const& options )
     // Print some user output.
     options.jplace_input.print();
 
-    // Get color map and norm.
-    auto color_map  = options.color_map.color_map();
-    auto color_norm = options.color_norm.get_sequential_norm();
+    // Get the color map. The norm is created per tree in the writer tasks below,
+    // as it is autoscaled to each tree and hence cannot be shared between them.
+    auto const color_map = options.color_map.color_map();
 
     // Read in the trees and immediately convert them to mass trees to save storage.
-    auto mass_trees = options.jplace_input.mass_tree_set();
+    auto mass_trees = options.jplace_input.mass_tree_set( true, true );
 
-    // Set up squash clustering.
-    auto sc = tree::SquashClustering();
+    // Set up squash clustering. This runs the per-step distance updates in parallel,
+    // using the global thread count, see ParallelSquashClustering.
+    auto sc = ParallelSquashClustering();
     sc.p( options.exponent );
+    if( ! options.spill_directory.empty() ) {
+        auto max_trees = options.max_trees_in_memory;
+        if( max_trees == 0 ) {
+            max_trees = 2 * utils::Options::get().number_of_threads();
+        }
+        sc.spill_directory( options.spill_directory );
+        sc.max_trees_in_memory( max_trees );
+        LOG_MSG1 << "Spilling cluster trees to " << options.spill_directory
+                 << ", keeping at most " << max_trees << " trees in memory.";
+    }
+    if( ! options.checkpoint_dir.empty() ) {
+        sc.checkpoint_directory( options.checkpoint_dir );
+    }
     sc.report_initialization = [&](){
         LOG_MSG2 << " - Initializing";
     };
+    auto step_start = std::chrono::steady_clock::now();
     sc.report_step = [&]( size_t i, size_t total ){
-        LOG_MSG2 << " - Step " << i << " of " << total;
+        auto const now = std::chrono::steady_clock::now();
+        auto const secs = std::chrono::duration_cast<std::chrono::duration<double>>(
+            now - step_start
+        ).count();
+        step_start = now;
+        if( i == 1 ) {
+            LOG_MSG2 << " - Step " << i << " of " << total;
+        } else {
+            LOG_MSG2 << " - Step " << i << " of " << total
+                     << " (previous step took " << secs << "s)";
+        }
     };
+    // Hand finished cluster trees to background writer tasks on the global thread pool,
+    // so that the merge sequence does not stall on tree serialization and disk latency
+    // at every step. The window of pending writes is small, to bound the number of tree
+    // copies held in memory; when it is full, we wait for the oldest write to finish
+    // before accepting the next tree.
+    size_t const max_pending_writes = 4;
+    std::deque<std::future<void>> pending_writes;
     sc.write_cluster_tree = [&]( tree::MassTree const& cluster_tree, size_t index ){
-        // Prepare colors
-        auto const masses = tree::mass_tree_mass_per_edge( cluster_tree );
-        color_norm->autoscale_max( masses );
-
-        // Now, make a color vector and write to files.
-        auto const colors = color_map( *color_norm, masses );
-        options.tree_output.write_tree_to_files(
-            cluster_tree,
-            colors,
-            color_map,
-            *color_norm,
-            options.file_output,
-            "tree_" + std::to_string( index )
-        );
+        // Without any tree output formats, there is nothing to write, and in particular
+        // no reason to copy the tree for a writer task.
+        if( options.tree_output.get_extensions().empty() ) {
+            return;
+        }
+        if( pending_writes.size() >= max_pending_writes ) {
+            pending_writes.front().get();
+            pending_writes.pop_front();
+        }
+
+        // Copy the tree for the task, as the clustering keeps modifying and freeing
+        // its trees while the write is still in flight.
+        auto tree_copy = std::make_shared<tree::MassTree>( cluster_tree );
+        pending_writes.push_back( global_options.thread_pool().enqueue(
+            [&options, &color_map, tree_copy, index](){
+                // Prepare colors, with a fresh norm autoscaled to this tree.
+                auto const masses = tree::mass_tree_mass_per_edge( *tree_copy );
+                auto color_norm = options.color_norm.get_sequential_norm();
+                color_norm->autoscale_max( masses );
+
+                // Now, make a color vector and write to files.
+                auto const colors = color_map( *color_norm, masses );
+                options.tree_output.write_tree_to_files(
+                    *tree_copy,
+                    colors,
+                    color_map,
+                    *color_norm,
+                    options.file_output,
+                    "tree_" + std::to_string( index )
+                );
+            }
+        ));
     };
 
     // Run, Forrest, run!
     LOG_MSG1 << "Running Squash Clustering";
     sc.run( std::move( mass_trees ) );
 
+    // Wait for the remaining tree writes, surfacing any exception that a write threw.
+    while( ! pending_writes.empty() ) {
+        pending_writes.front().get();
+        pending_writes.pop_front();
+    }
+
     LOG_MSG1 << "Writing output files";
 
     // Write output cluster tree to newick.
@@ -47,6 +47,10 @@ public:
     double exponent = 1.0;
     bool normalize = false; // TODO unused
 
+    std::string spill_directory;
+    size_t max_trees_in_memory = 0;
+    std::string checkpoint_dir;
+
     JplaceInputOptions jplace_input;
     ColorMapOptions    color_map;
     ColorNormOptions   color_norm;
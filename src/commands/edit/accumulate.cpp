@@ -25,19 +25,22 @@
 
 #include "options/global.hpp"
 #include "tools/cli_setup.hpp"
+#include "tools/jplace_stream_writer.hpp"
+#include "tools/sample_columns.hpp"
 
 #include "CLI/CLI.hpp"
 
-#include "genesis/placement/formats/jplace_writer.hpp"
 #include "genesis/placement/function/functions.hpp"
 #include "genesis/placement/function/masses.hpp"
 #include "genesis/tree/function/functions.hpp"
 #include "genesis/tree/iterator/postorder.hpp"
 #include "genesis/utils/io/output_target.hpp"
 
+#include <algorithm>
 #include <cassert>
 #include <limits>
 #include <utility>
+#include <vector>
 
 #ifdef GENESIS_OPENMP
 #   include <omp.h>
@@ -120,88 +123,163 @@ void run_accumulate( AccumulateOptions const& options )
     normalize_weight_ratios( sample );
     auto& tree = sample.tree();
 
+    // Gather the placement data into contiguous columns, so that the buffer
+    // initialization per pquery below reads linear memory instead of chasing through
+    // the placement objects. The columns are a copy, so rewriting the placements of
+    // the pqueries further down does not invalidate them.
+    auto const columns = sample_columns( sample );
+
     // We will delete the pqueries that cannot be accumulated. Store them here.
     std::vector<size_t> removal_collector;
 
+    // Precompute the postorder arrangement of the edges once. We store the edge index at each
+    // postorder position and vice versa, as well as the postorder position of each edge's parent
+    // edge (the next one towards the root), with a sentinel for the edges adjacent to the root.
+    // With masses stored per postorder position, moving them up the tree then becomes a single
+    // ascending scan over a contiguous buffer, pushing each entry to its parent position,
+    // instead of a pointer-chasing tree traversal per pquery.
+    auto const edge_count = tree.edge_count();
+    auto const no_parent = std::numeric_limits<size_t>::max();
+    auto postorder_of_edge = std::vector<size_t>( edge_count );
+    auto edge_at_position  = std::vector<size_t>( edge_count );
+    auto parent_position   = std::vector<size_t>( edge_count, no_parent );
+    size_t position = 0;
+    for( auto it : postorder( tree )) {
+
+        // We are interested in edges, so skip the last iteration.
+        if( it.is_last_iteration() ) {
+            continue;
+        }
+        postorder_of_edge[ it.edge().index() ] = position;
+        edge_at_position[ position ] = it.edge().index();
+        ++position;
+    }
+    assert( position == edge_count );
+    for( auto it = tree.begin_edges(); it != tree.end_edges(); ++it ) {
+        auto const& upper_node = it->primary_link().node();
+        if( ! is_root( upper_node )) {
+            parent_position[ postorder_of_edge[ it->index() ]]
+                = postorder_of_edge[ upper_node.primary_link().edge().index() ];
+
+            // Postorder lists children before their parents.
+            assert(
+                parent_position[ postorder_of_edge[ it->index() ]]
+                > postorder_of_edge[ it->index() ]
+            );
+        }
+    }
+
     // Replace the placements of each pquery by one placement
     // that accumulates the mass at a basal branch.
-    for( size_t i = 0; i < sample.size(); ++i ) {
-        auto& pqry = sample.at(i);
-
-        // We need the masses per edge of the pquery.
-        auto masses = std::vector<double>( tree.edge_count(), 0.0 );
+    // The pqueries are independent of each other, so we process them in parallel,
+    // with per-thread mass buffers that are reused (and selectively reset) across pqueries.
+    #pragma omp parallel
+    {
+        // Masses per edge (by postorder position) of the current pquery.
+        auto masses = std::vector<double>( edge_count, 0.0 );
 
         // Furthermore, store the weighted pendant length of all placements in the subtree.
         // We want the resulting pendant length to be the weighted average of all pendant lengths
-        // in the accumulated subtree. So, we propagate the weighted sum of pend lengths up the tree,
-        // and divide by the sum of weights in the end to get the average.
+        // in the accumulated subtree. So, we propagate the weighted sum of pend lengths up the
+        // tree, and divide by the sum of weights in the end to get the average.
         // This sum of weights happens to be the sum of lwrs that is already stored in masses[].
-        auto pendant = std::vector<double>( tree.edge_count(), 0.0 );
-
-        // Init both with the values from the pquery.
-        for( auto const& place : pqry.placements() ) {
-            assert( masses[ place.edge().index() ] == 0.0 );
-            masses[ place.edge().index() ] = place.like_weight_ratio;
-            pendant[ place.edge().index() ] = place.like_weight_ratio * place.pendant_length;
-        }
-
-        // Move the masses up the tree until they exceed the threshold.
-        bool exceeded_threshold = false;
-        size_t result_edge = std::numeric_limits<size_t>::max();
-        for( auto it : postorder( tree )) {
-
-            // We are interested in edges, so skip the last iteration.
-            if( it.is_last_iteration() ) {
-                continue;
+        auto pendant = std::vector<double>( edge_count, 0.0 );
+
+        // Positions that the current pquery has touched, for resetting the buffers afterwards,
+        // and the pqueries that this thread could not accumulate.
+        std::vector<size_t> touched;
+        std::vector<size_t> local_removal;
+
+        #pragma omp for schedule(static)
+        for( size_t i = 0; i < sample.size(); ++i ) {
+            auto& pqry = sample.at(i);
+
+            // Init the buffers with the values from the placement columns of the pquery.
+            auto first_position = edge_count;
+            for( size_t k = columns.placements_begin( i ); k < columns.placements_end( i ); ++k ) {
+                auto const pp = postorder_of_edge[ columns.edge_indices[k] ];
+                assert( masses[ pp ] == 0.0 );
+                masses[ pp ]  = columns.like_weight_ratios[k];
+                pendant[ pp ] = columns.like_weight_ratios[k] * columns.pendant_lengths[k];
+                touched.push_back( pp );
+                first_position = std::min( first_position, pp );
             }
 
-            auto& cur_mass = masses[ it.edge().index() ];
-            auto& cur_pend = pendant[ it.edge().index() ];
+            // Move the masses up the tree until they exceed the threshold. All positions before
+            // the first placement are zero, so we start the scan there. Each nonzero entry has
+            // already received the masses of its subtree when we reach it, as children come
+            // before their parents in postorder.
+            bool exceeded_threshold = false;
+            size_t result_position = no_parent;
+            for( size_t pp = first_position; pp < edge_count; ++pp ) {
+                if( masses[ pp ] == 0.0 ) {
+                    continue;
+                }
+
+                // Check result.
+                if( masses[ pp ] >= options.threshold ) {
+                    exceeded_threshold = true;
+                    result_position = pp;
+                    break;
+                }
+
+                // Push the mass and pendant length to the parent edge.
+                auto const par = parent_position[ pp ];
+                if( par != no_parent ) {
+                    masses[ par ]  += masses[ pp ];
+                    pendant[ par ] += pendant[ pp ];
+                    touched.push_back( par );
+                }
+            }
 
-            // Add subtree masses and pendant lengths.
-            auto link = &it.link().next();
-            while( link != &it.link() ) {
-                cur_mass += masses[ link->edge().index() ];
-                cur_pend += pendant[ link->edge().index() ];
-                link = &link->next();
+            // If there is a branch where the accumualtion worked, use it.
+            // If not, put on removal list! This can happen if the masses are distributed across
+            // different directions from the root - in that case, we do not consider this a valid
+            // accumulation.
+            if( exceeded_threshold ) {
+                auto const result_edge = edge_at_position[ result_position ];
+                pqry.clear_placements();
+                auto& place = pqry.add_placement( tree.edge_at( result_edge ));
+
+                // Set a new lwr of 1.0, as we throw away everything else.
+                place.like_weight_ratio = 1.0;
+
+                // Set the pendant length to the weighted average of the lengths in the subtree.
+                place.pendant_length = pendant[ result_position ] / masses[ result_position ];
+
+                // Set the position along the branch. It does not really matter that much,
+                // so do a nice little thing and set it at the position along the branch
+                // that corresponds to the accumulated mass. So, if the placement represents 96% of
+                // the mass, it is placed at 0.96 along the branch.
+                // This way, pqueries get distinct prox lengths, which might help in downstream
+                // analyses.
+                auto const bl = tree.edge_at( result_edge ).data<CommonEdgeData>().branch_length;
+                assert( masses[ result_position ] >= options.threshold );
+                place.proximal_length = bl * masses[ result_position ];
+            } else {
+                local_removal.push_back( i );
             }
 
-            // Check result.
-            if( cur_mass >= options.threshold ) {
-                exceeded_threshold = true;
-                result_edge = it.edge().index();
-                break;
+            // Reset the buffer entries that this pquery has used.
+            for( auto const pp : touched ) {
+                masses[ pp ]  = 0.0;
+                pendant[ pp ] = 0.0;
             }
+            touched.clear();
         }
-        assert( result_edge < std::numeric_limits<size_t>::max() );
-
-        // If there is a branch where the accumualtion worked, use it.
-        // If not, put on removal list! This can happen if the masses are distributed across different
-        // directions from the root - in that case, we do not consider this a valid accumulation.
-        if( exceeded_threshold ) {
-            pqry.clear_placements();
-            auto& place = pqry.add_placement( tree.edge_at( result_edge ));
-
-            // Set a new lwr of 1.0, as we throw away everything else.
-            place.like_weight_ratio = 1.0;
-
-            // Set the pendant length to the weighted average of the lengths in the subtree.
-            place.pendant_length = pendant[ result_edge ] / masses[ result_edge ];
-
-            // Set the position along the branch. It does not really matter that much,
-            // so do a nice little thing and set it at the position along the branch
-            // that corresponds to the accumulated mass. So, if the placement represents 96% of
-            // the mass, it is placed at 0.96 along the branch.
-            // This way, pqueries get distinct prox lengths, which might help in downstream
-            // analyses.
-            auto const bl = tree.edge_at( result_edge ).data<CommonEdgeData>().branch_length;
-            assert( masses[ result_edge] >= options.threshold );
-            place.proximal_length = bl * masses[ result_edge ];
-        } else {
-            removal_collector.push_back( i );
+
+        #pragma omp critical(GAPPA_ACCUMULATE_REMOVAL)
+        {
+            removal_collector.insert(
+                removal_collector.end(), local_removal.begin(), local_removal.end()
+            );
         }
     }
 
+    // The removal loop below deletes back to front, so it needs the indices in order,
+    // which the per-thread collection above does not guarantee.
+    std::sort( removal_collector.begin(), removal_collector.end() );
+
     // User output about the removal.
     if( ! removal_collector.empty() ) {
         LOG_MSG1 << "The following pquries have their placement masses distributed "
@@ -229,7 +307,7 @@ void run_accumulate( AccumulateOptions const& options )
     }
 
     // Write the new sample to a file.
-    JplaceWriter().write(
+    write_jplace_sample(
         sample,
         options.jplace_output.get_output_target( "accumulated", "jplace" )
     );
@@ -25,11 +25,11 @@
 
 #include "options/global.hpp"
 #include "tools/cli_setup.hpp"
+#include "tools/jplace_stream_writer.hpp"
 
 #include "CLI/CLI.hpp"
 
 #include "genesis/placement/formats/jplace_reader.hpp"
-#include "genesis/placement/formats/jplace_writer.hpp"
 #include "genesis/placement/function/functions.hpp"
 #include "genesis/placement/function/helper.hpp"
 #include "genesis/placement/function/operators.hpp"
@@ -59,6 +59,8 @@
 
 #include <algorithm>
 #include <cassert>
+#include <cstdint>
+#include <mutex>
 #include <string>
 #include <stdexcept>
 #include <vector>
@@ -84,9 +86,17 @@ using CladeTaxaList = std::unordered_map<std::string, std::vector<std::string>>;
 using CladeEdgeList = std::vector<std::pair<std::string, std::unordered_set<size_t>>>;
 
 /**
- * @brief Contains a list of clades, each itself contianing all pquery names in that clade.
+ * @brief Flat index from pquery name to the clade that the pquery was extracted into.
+ *
+ * The fasta partitioning looks up every read name exactly once in the single hash map,
+ * instead of probing one name set per clade, so the per-read cost is independent of the
+ * number of clades.
  */
-using PqueryNamesPerCladeList = std::unordered_map<std::string, std::unordered_set<std::string>>;
+struct PqueryCladeIndex
+{
+    std::vector<std::string> clade_names;
+    std::unordered_map<std::string, uint32_t> name_to_clade;
+};
 
 // =================================================================================================
 //      Setup
@@ -376,69 +386,90 @@ void extract_pqueries(
     ExtractOptions const&             options,
     CladeEdgeList const&              clade_edges,
     genesis::placement::Sample const& sample,
-    genesis::placement::SampleSet&    sample_set
+    genesis::placement::SampleSet&    sample_set,
+    bool                              parallel_pqueries
 ) {
     using namespace ::genesis::placement;
 
-    // Process all pqueries of the given sample.
-    // We again use openmp here, so that even if only a single file is given, we make use of threads.
-    #pragma omp parallel for
-    for( size_t qi = 0; qi < sample.size(); ++qi ) {
-        auto const& pquery = sample.at( qi );
-
-        // Prepare an accumulator that collects the mass per clade for this pquery.
-        // The indices in the vector are the same as the ones in the clade_edge vector.
-        std::vector<double> mass_per_clade( clade_edges.size(), 0.0 );
-
-        // For each placement, find its edge and the clade that this edge belongs to.
-        // For this clade, accumulate the placement's like weight ratio.
-        for( auto const& placement : pquery.placements() ) {
-
-            // Find the correct clade for the edge of this placement by scanning them all
-            // (this is a bit inefficient, but for now, it works).
-            for( size_t i = 0; i < clade_edges.size(); ++i ) {
-                if( clade_edges[i].second.count( placement.edge().index() ) > 0 ) {
+    // Flatten the clade edge sets into a read-only array that maps each edge index of the tree
+    // to the index of its clade in the clade_edges vector. The clades partition the edges of the
+    // tree (get_clade_edges() ensures this), so each placement then resolves its clade with a
+    // single lookup, instead of scanning the hash sets of all clades.
+    auto clade_of_edge = std::vector<size_t>( sample.tree().edge_count(), clade_edges.size() );
+    for( size_t i = 0; i < clade_edges.size(); ++i ) {
+        for( auto const edge : clade_edges[i].second ) {
+            assert( edge < clade_of_edge.size() );
+            assert( clade_of_edge[ edge ] == clade_edges.size() );
+            clade_of_edge[ edge ] = i;
+        }
+    }
 
-                    // If we found the correct clade, accumulate to its mass.
-                    mass_per_clade[i] += placement.like_weight_ratio;
-                }
-            }
+    // Resolve the target samples once, in clade order, with the special uncertain sample at the
+    // end. These pointers stay stable while we fill the samples below.
+    auto sample_ptrs = std::vector<Sample*>( clade_edges.size() + 1, nullptr );
+    for( size_t i = 0; i < clade_edges.size(); ++i ) {
+        sample_ptrs[i] = find_sample( sample_set, clade_edges[i].first );
+        if( sample_ptrs[i] == nullptr ) {
+            throw std::runtime_error( "Internal error: Lost sample " + clade_edges[i].first );
         }
+    }
+    sample_ptrs[ clade_edges.size() ] = find_sample( sample_set, options.uncertain_clade_name );
+    if( sample_ptrs[ clade_edges.size() ] == nullptr ) {
+        throw std::runtime_error( "Internal error: Lost sample " + options.uncertain_clade_name );
+    }
 
-        // Now check whether there is a clade that has equal or more than `threshold` percent
-        // of the placement's weight ratio. If so, this is the one we assign the pquery to.
-        bool found_clade = false;
-        for( size_t i = 0; i < mass_per_clade.size(); ++i ) {
-            // Only execute the main body of this loop when we found a fitting clade.
-            if( mass_per_clade[i] < options.threshold ) {
-                continue;
+    // Process all pqueries of the given sample. If the enclosing per-file loop is not parallel
+    // (single input file), we use threads here instead, see run_extract().
+    // Each thread collects the pquery indices per target sample locally, and merges them into
+    // the shared sample set once at the end, so that the critical section is entered once per
+    // thread instead of once per pquery.
+    #pragma omp parallel if( parallel_pqueries )
+    {
+        auto local_targets = std::vector<std::vector<size_t>>( sample_ptrs.size() );
+
+        #pragma omp for schedule(static)
+        for( size_t qi = 0; qi < sample.size(); ++qi ) {
+            auto const& pquery = sample.at( qi );
+
+            // Prepare an accumulator that collects the mass per clade for this pquery.
+            // The indices in the vector are the same as the ones in the clade_edge vector.
+            std::vector<double> mass_per_clade( clade_edges.size(), 0.0 );
+
+            // For each placement, find its edge and the clade that this edge belongs to.
+            // For this clade, accumulate the placement's like weight ratio.
+            for( auto const& placement : pquery.placements() ) {
+                assert( placement.edge().index() < clade_of_edge.size() );
+                auto const clade_index = clade_of_edge[ placement.edge().index() ];
+                assert( clade_index < clade_edges.size() );
+                mass_per_clade[ clade_index ] += placement.like_weight_ratio;
             }
-            found_clade = true;
 
-            // Get the sample from the set that has the current clade's name.
-            auto sample_ptr = find_sample( sample_set, clade_edges[i].first );
-            if( sample_ptr == nullptr ) {
-                throw std::runtime_error( "Internal error: Lost sample " + clade_edges[i].first );
+            // Now check whether there is a clade that has equal or more than `threshold` percent
+            // of the placement's weight ratio. If so, this is the one we assign the pquery to.
+            bool found_clade = false;
+            for( size_t i = 0; i < mass_per_clade.size(); ++i ) {
+                // Only execute the main body of this loop when we found a fitting clade.
+                if( mass_per_clade[i] < options.threshold ) {
+                    continue;
+                }
+                found_clade = true;
+                local_targets[i].push_back( qi );
             }
 
-            // Add a copy of the pquery to the sample.
-            #pragma omp critical(GAPPA_EXTRACT_ADD_SAMPLE)
-            {
-                sample_ptr->add( pquery );
+            // If there is no sure assignment ( < threshold ) for this pquery, we copy it into the
+            // special `uncertain` sample.
+            if( ! found_clade ) {
+                local_targets[ clade_edges.size() ].push_back( qi );
             }
         }
 
-        // If there is no sure assignment ( < threshold ) for this pquery, we copy it into the
-        // special `uncertain` sample.
-        if( ! found_clade ) {
-            auto sample_ptr = find_sample( sample_set, options.uncertain_clade_name );
-            if( sample_ptr == nullptr ) {
-                throw std::runtime_error( "Internal error: Lost sample " + options.uncertain_clade_name );
-            }
-
-            #pragma omp critical(GAPPA_EXTRACT_ADD_SAMPLE)
-            {
-                sample_ptr->add( pquery );
+        // Copy the collected pqueries of this thread into the shared samples.
+        #pragma omp critical(GAPPA_EXTRACT_ADD_SAMPLE)
+        {
+            for( size_t i = 0; i < local_targets.size(); ++i ) {
+                for( auto const qi : local_targets[i] ) {
+                    sample_ptrs[i]->add( sample.at( qi ));
+                }
             }
         }
     }
@@ -467,10 +498,9 @@ void write_sample_set(
     LOG_MSG1 << "Writing " << sample_set.size() << " clade sample files.";
 
     // Write files.
-    auto writer = JplaceWriter();
     #pragma omp parallel for schedule(dynamic)
     for( size_t si = 0; si < sample_set.size(); ++si ) {
-        writer.write(
+        write_jplace_sample(
             sample_set.at( si ),
             options.jplace_output.get_output_target( sample_set.name_at( si ), "jplace" )
         );
@@ -567,27 +597,36 @@ void write_color_tree(
 // =================================================================================================
 
 /**
- * @brief Get the names of all pqueries per clade.
+ * @brief Build the flat index from pquery name to clade.
  */
-PqueryNamesPerCladeList get_pqueries_per_clade(
+PqueryCladeIndex get_pquery_clade_index(
     genesis::placement::SampleSet const& sample_set
 ) {
-    PqueryNamesPerCladeList list;
+    PqueryCladeIndex index;
     size_t duplicate_names = 0;
 
+    // Reserve the map for all names at once, to avoid rehashing while filling it.
+    size_t total_names = 0;
     for( size_t si = 0; si < sample_set.size(); ++si ) {
+        total_names += genesis::placement::total_name_count( sample_set.at(si) );
+    }
+    index.name_to_clade.reserve( total_names );
+
+    for( size_t si = 0; si < sample_set.size(); ++si ) {
+        auto const clade_index = static_cast<uint32_t>( index.clade_names.size() );
+        index.clade_names.push_back( sample_set.name_at(si) );
+
         for( auto const& pquery : sample_set.at(si) ) {
             for( auto const& pquery_name : pquery.names() ) {
 
-                // Check if it is not already there.
-                for( auto const& clade : list ) {
-                    if( clade.second.count( pquery_name.name ) > 0 ) {
-                        ++duplicate_names;
-                    }
+                // Add it to the index. A name that is already there (in this or another
+                // clade) is a duplicate; we keep its first occurrence.
+                auto const entry = index.name_to_clade.emplace(
+                    pquery_name.name, clade_index
+                );
+                if( ! entry.second ) {
+                    ++duplicate_names;
                 }
-
-                // Add it to the list.
-                list[ sample_set.name_at(si) ].insert( pquery_name.name );
             }
         }
     }
@@ -599,16 +638,16 @@ PqueryNamesPerCladeList get_pqueries_per_clade(
                  << "Thus, this should better be fixed first!";
     }
 
-    return list;
+    return index;
 }
 
 // =================================================================================================
-//      Clade Names List
+//      Sequence Extraction
 // =================================================================================================
 
 void extract_sequences(
     ExtractOptions const& options,
-    PqueryNamesPerCladeList const& list
+    PqueryCladeIndex const& index
 ) {
     using namespace ::genesis;
     using namespace ::genesis::sequence;
@@ -617,25 +656,50 @@ void extract_sequences(
     // User output.
     options.sequence_input.print();
 
+    // Buffered writer per clade. Each clade has its own sequence cache and its own lock,
+    // so that threads reading different fasta files only ever contend when they append
+    // to the same clade at the same time, instead of serializing all sequence handling
+    // behind one global critical section. Flushes append to the per-clade file under
+    // the same lock, so concurrent flushes to one file cannot interleave.
+    struct CladeSequenceBuffer
+    {
+        std::string file_name;
+        SequenceSet cache;
+        std::mutex  mutex;
+    };
+    auto buffers = std::vector<CladeSequenceBuffer>( index.clade_names.size() );
+
     // Lazy prep: We write empty files first, which makes sure (again) that they do not exist,
     // and that we can later append to them.
-    for( auto const& clade : list ) {
-        file_write( "", options.sequence_output.get_output_filename( clade.first, "fasta" ));
+    for( size_t ci = 0; ci < index.clade_names.size(); ++ci ) {
+        buffers[ci].file_name = options.sequence_output.get_output_filename(
+            index.clade_names[ci], "fasta"
+        );
+        file_write( "", buffers[ci].file_name );
     }
 
     // Helpers.
     auto const set_size = options.sequence_input.file_count();
     size_t file_count = 0;
-    auto writer = FastaWriter();
+    auto const writer = FastaWriter();
+
+    // Flush the cache of a clade to its file. The caller needs to hold the clade lock.
+    auto flush_buffer = [&]( CladeSequenceBuffer& buffer ){
+        std::ofstream out_stream( buffer.file_name, std::ofstream::app );
+        if( out_stream.fail() ) {
+            throw std::runtime_error(
+                "Cannot append sequences to file " + buffer.file_name + "."
+            );
+        }
+        writer.write( buffer.cache, genesis::utils::to_stream( out_stream ));
+        buffer.cache.clear();
+    };
 
     // Count for user output.
     size_t total_seqs_count = 0;
     size_t missing_seqs_count = 0;
 
-    // Cache sequences per clade while extracting.
-    std::unordered_map< std::string, SequenceSet > clade_sequences;
-
-    // Process the input files.
+    // Process the input files in parallel, one file per thread.
     #pragma omp parallel for schedule(dynamic)
     for( size_t fi = 0; fi < set_size; ++fi ) {
         auto const& fasta_filename = options.sequence_input.file_path( fi );
@@ -644,76 +708,55 @@ void extract_sequences(
         LOG_MSG2 << "Processing file " << ( ++file_count ) << " of " << set_size
                  << ": " << options.sequence_input.file_path( fi );
 
+        // Per-file counters, added to the totals once at the end of the file,
+        // instead of one atomic update per read.
+        size_t local_total = 0;
+        size_t local_missing = 0;
+
         auto it = FastaInputIterator(
             from_file( fasta_filename ),
             options.sequence_input.fasta_reader()
         );
         while( it ) {
-            #pragma omp atomic
-            ++total_seqs_count;
-
-            // Try to find the fasta sequence name in a clade.
-            PqueryNamesPerCladeList::const_iterator clade_it = list.end();
-            for( auto lit = list.begin(); lit != list.end(); ++lit ) {
-                if( lit->second.count( it->label() ) > 0 ) {
-                    clade_it = lit;
-                    break;
-                }
-            }
-
-            // If not, skip this sequence.
-            if( clade_it == list.end() ) {
-                #pragma omp atomic
-                ++missing_seqs_count;
+            ++local_total;
 
+            // Look up the clade of the read, with a single hash lookup.
+            // If its name does not appear in any clade, skip the sequence.
+            auto const found = index.name_to_clade.find( it->label() );
+            if( found == index.name_to_clade.end() ) {
+                ++local_missing;
                 ++it;
                 continue;
             }
 
-            // Add the sequence to the clade set, and write if cache too big.
-            #pragma omp critical(GAPPA_CHUNKIFY_UPDATE_SEQUENCES)
+            // Add the sequence to the clade cache, and write if the cache is full.
+            auto& buffer = buffers[ found->second ];
             {
-                // Get the sequence cache for the clade and add ther sequence to it.
-                auto& clade_seqs = clade_sequences[ clade_it->first ];
-                clade_seqs.add( *it );
-
-                // If the cache is full, flush it.
-                if( clade_seqs.size() >= 1000 ) {
-
-                    // Prepare file for appending.
-                    auto const fn = options.sequence_output.get_output_filename(
-                        clade_it->first, "fasta"
-                    );
-                    std::ofstream out_stream( fn, std::ofstream::app );
-                    if( out_stream.fail() ) {
-                        throw std::runtime_error( "Cannot append sequences to file " + fn + "." );
-                    }
-
-                    // Write and clear.
-                    writer.write( clade_seqs, genesis::utils::to_stream( out_stream ));
-                    clade_seqs.clear();
+                std::lock_guard<std::mutex> lock( buffer.mutex );
+                buffer.cache.add( *it );
+                if( buffer.cache.size() >= 1000 ) {
+                    flush_buffer( buffer );
                 }
             }
 
             ++it;
         }
-    }
 
-    // Flush clade caches.
-    for( auto const& clade_seqs : clade_sequences ) {
+        #pragma omp atomic
+        total_seqs_count += local_total;
+        #pragma omp atomic
+        missing_seqs_count += local_missing;
+    }
 
-        // Prepare file for appending.
-        auto const fn = options.sequence_output.get_output_filename( clade_seqs.first, "fasta" );
-        std::ofstream out_stream( fn, std::ofstream::app );
-        if( out_stream.fail() ) {
-            throw std::runtime_error( "Cannot append sequences to file '" + fn + "'." );
+    // Flush the remaining clade caches.
+    for( auto& buffer : buffers ) {
+        if( ! buffer.cache.empty() ) {
+            flush_buffer( buffer );
         }
-
-        // Write.
-        writer.write( clade_seqs.second, genesis::utils::to_stream( out_stream ));
     }
 
-    LOG_MSG1 << "Collected " << total_seqs_count << " sequences in " << list.size() << " clades.";
+    LOG_MSG1 << "Collected " << total_seqs_count << " sequences in "
+             << index.clade_names.size() << " clades.";
     if( missing_seqs_count > 0 ) {
         LOG_MSG1 << "Thereof, " << missing_seqs_count << " sequences could not be assigned to any "
                  << "clade, because their name does not appear in any jplace file.";
@@ -752,11 +795,18 @@ void run_extract( ExtractOptions const& options )
     // Resulting sample set, gets filled with the extracted pqueries for each clade.
     SampleSet sample_set;
 
-    #pragma omp parallel for schedule(dynamic)
+    // With multiple input files, we parallelize over the files; with a single one, we instead
+    // let extract_pqueries() parallelize over its pqueries, so that threads are used either way.
+    bool const parallel_files = set_size > 1;
+
+    #pragma omp parallel for schedule(dynamic) if( parallel_files )
     for( size_t fi = 0; fi < set_size; ++fi ) {
 
         // User output.
-        LOG_MSG2 << "Processing file " << ( ++file_count ) << " of " << set_size
+        size_t current_count;
+        #pragma omp atomic capture
+        current_count = ++file_count;
+        LOG_MSG2 << "Processing file " << current_count << " of " << set_size
                  << ": " << options.jplace_input.file_path( fi ) << "\n";
 
         // Read the sample.
@@ -792,7 +842,7 @@ void run_extract( ExtractOptions const& options )
         normalize_weight_ratios( sample );
 
         // Do the work!
-        extract_pqueries( options, clade_edges, sample, sample_set );
+        extract_pqueries( options, clade_edges, sample, sample_set, ! parallel_files );
     }
 
     // Write everything to jplace files.
@@ -801,8 +851,8 @@ void run_extract( ExtractOptions const& options )
     // If there were sequences given as input as well, extract them!
     // We can also delete the samples to save some mem. Not needed any more.
     if( options.sequence_input.file_count() > 0 ) {
-        auto const list = get_pqueries_per_clade( sample_set );
+        auto const index = get_pquery_clade_index( sample_set );
         sample_set.clear();
-        extract_sequences( options, list );
+        extract_sequences( options, index );
     }
 }
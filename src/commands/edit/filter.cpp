@@ -25,18 +25,24 @@
 
 #include "options/global.hpp"
 #include "tools/cli_setup.hpp"
+#include "tools/jplace_stream_writer.hpp"
+#include "tools/misc.hpp"
+#include "tools/name_matcher.hpp"
 
 #include "CLI/CLI.hpp"
 
 #include "genesis/placement/formats/jplace_writer.hpp"
 #include "genesis/placement/function/functions.hpp"
 #include "genesis/placement/function/masses.hpp"
+#include "genesis/placement/function/operators.hpp"
 #include "genesis/tree/function/functions.hpp"
 #include "genesis/utils/core/fs.hpp"
 #include "genesis/utils/io/output_target.hpp"
 
 #include <cassert>
+#include <memory>
 #include <utility>
+#include <vector>
 
 #ifdef GENESIS_OPENMP
 #   include <omp.h>
@@ -157,7 +163,10 @@ void setup_filter( CLI::App& app )
         "--keep-names",
         options->keep_names.value(),
         "Keep queries whose name matches the given names, which can be provided either as a "
-        "regular expression (regex), or as a file with one name per line. Remove all others."
+        "regular expression (regex), or as a file with one name per line. Remove all others. "
+        "Name lists, plain alternations of names (`a|b|c`), prefixes (`abc.*`), and substrings "
+        "(`.*abc.*`) are matched with dedicated fast lookup structures, so that even lists with "
+        "hundreds of thousands of names can be used; other patterns are evaluated as a regex."
     );
     options->keep_names.option()->group( "Name Filters" );
 
@@ -166,7 +175,8 @@ void setup_filter( CLI::App& app )
         "--remove-names",
         options->remove_names.value(),
         "Remove queries whose name matches the given names, which can be provided either as a "
-        "regular expression (regex), or as a file with one name per line. Keep all others."
+        "regular expression (regex), or as a file with one name per line. Keep all others. "
+        "The same fast matching structures as for `--keep-names` are used."
     );
     options->remove_names.option()->group( "Name Filters" );
 
@@ -196,151 +206,112 @@ void setup_filter( CLI::App& app )
 //      Run Helpers
 // =================================================================================================
 
-void filter_sample( FilterOptions const& options, genesis::placement::Sample& sample )
+/**
+ * @brief Count the removals done by each filter, for user output after the streaming run.
+ */
+struct FilterCounts
 {
+    size_t min_accumulated_mass = 0;
+    size_t min_mass_threshold   = 0;
+    size_t max_n_placements     = 0;
+    size_t min_pendant_len      = 0;
+    size_t max_pendant_len      = 0;
+
+    size_t empty_pqueries       = 0;
+    size_t keep_names           = 0;
+    size_t remove_names         = 0;
+};
+
+/**
+ * @brief Return whether any name of the pquery matches the given name matcher.
+ */
+bool matches_any_name( NameMatcher const& matcher, genesis::placement::Pquery const& pquery )
+{
+    for( auto const& name : pquery.names() ) {
+        if( matcher.matches( name.name )) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Apply all filters to a single pquery. Returns whether the pquery is to be kept.
+ *
+ * This is the per-pquery equivalent of the previous whole-sample filtering, so that the
+ * command can run as a streaming pipeline without holding all input samples in memory.
+ */
+bool filter_pquery(
+    FilterOptions const& options,
+    genesis::placement::Pquery& pquery,
+    NameMatcher const& keep_matcher,
+    NameMatcher const& remove_matcher,
+    FilterCounts& counts
+) {
     using namespace genesis;
     using namespace genesis::placement;
-    using namespace genesis::utils;
 
     // Normalize before, if needed
     if( options.normalize_before.value() ) {
-        normalize_weight_ratios( sample );
+        normalize_weight_ratios( pquery );
     }
 
-    // Some user output prep
-    auto placement_count = total_placement_count( sample );
-
-    // Min accumulated mass
+    // Placement filters. We keep track of the number of removed placement locations
+    // per filter, for the user output at the end of the run.
+    auto placement_count = pquery.placement_size();
     if( options.min_accumulated_mass ) {
-        filter_min_accumulated_weight( sample, options.min_accumulated_mass.value() );
-
-        // User output
-        auto new_placement_count = total_placement_count( sample );
-        assert( new_placement_count <= placement_count );
-        LOG_MSG1 << "Removed " << ( placement_count - new_placement_count ) << " placement locations "
-                 << "due to " << options.min_accumulated_mass.option()->get_name() << " filtering.";
-        placement_count = new_placement_count;
+        filter_min_accumulated_weight( pquery, options.min_accumulated_mass.value() );
+        assert( pquery.placement_size() <= placement_count );
+        counts.min_accumulated_mass += placement_count - pquery.placement_size();
+        placement_count = pquery.placement_size();
     }
-
-    // Min mass threshold
     if( options.min_mass_threshold ) {
-        filter_min_weight_threshold( sample, options.min_mass_threshold.value() );
-
-        // User output
-        auto new_placement_count = total_placement_count( sample );
-        assert( new_placement_count <= placement_count );
-        LOG_MSG1 << "Removed " << ( placement_count - new_placement_count ) << " placement locations "
-                 << "due to " << options.min_mass_threshold.option()->get_name() << " filtering.";
-        placement_count = new_placement_count;
+        filter_min_weight_threshold( pquery, options.min_mass_threshold.value() );
+        assert( pquery.placement_size() <= placement_count );
+        counts.min_mass_threshold += placement_count - pquery.placement_size();
+        placement_count = pquery.placement_size();
     }
-
-    // Max n placements
     if( options.max_n_placements ) {
-        if( options.max_n_placements.value() == 0 ) {
-            throw CLI::ValidationError(
-                "--max-n-placements (" + std::to_string( options.max_n_placements.value() ) +  ")",
-                "Invalid value; has to be > 0, as otherwise all placements would be removed "
-                "from the query."
-            );
-        }
-        filter_n_max_weight_placements( sample, options.max_n_placements.value() );
-
-        // User output
-        auto new_placement_count = total_placement_count( sample );
-        assert( new_placement_count <= placement_count );
-        LOG_MSG1 << "Removed " << ( placement_count - new_placement_count ) << " placement locations "
-                 << "due to " << options.max_n_placements.option()->get_name() << " filtering.";
-        placement_count = new_placement_count;
+        filter_n_max_weight_placements( pquery, options.max_n_placements.value() );
+        assert( pquery.placement_size() <= placement_count );
+        counts.max_n_placements += placement_count - pquery.placement_size();
+        placement_count = pquery.placement_size();
     }
-
-    // Min pendant length
     if( options.min_pendant_len ) {
-        filter_min_pendant_length( sample, options.min_pendant_len.value() );
-
-        // User output
-        auto new_placement_count = total_placement_count( sample );
-        assert( new_placement_count <= placement_count );
-        LOG_MSG1 << "Removed " << ( placement_count - new_placement_count ) << " placement locations "
-                 << "due to " << options.min_pendant_len.option()->get_name() << " filtering.";
-        placement_count = new_placement_count;
+        filter_min_pendant_length( pquery, options.min_pendant_len.value() );
+        assert( pquery.placement_size() <= placement_count );
+        counts.min_pendant_len += placement_count - pquery.placement_size();
+        placement_count = pquery.placement_size();
     }
-
-    // Max pendant length
     if( options.max_pendant_len ) {
-        filter_max_pendant_length( sample, options.max_pendant_len.value() );
-
-        // User output
-        auto new_placement_count = total_placement_count( sample );
-        assert( new_placement_count <= placement_count );
-        LOG_MSG1 << "Removed " << ( placement_count - new_placement_count ) << " placement locations "
-                 << "due to " << options.max_pendant_len.option()->get_name() << " filtering.";
-        placement_count = new_placement_count;
+        filter_max_pendant_length( pquery, options.max_pendant_len.value() );
+        assert( pquery.placement_size() <= placement_count );
+        counts.max_pendant_len += placement_count - pquery.placement_size();
+        placement_count = pquery.placement_size();
     }
 
-    // Some user output prep
-    auto name_count = total_name_count( sample );
-
-    // Finally, remove all pqueries that have no placements left after the above filtering,
+    // Remove pqueries that have no placements left after the above filtering,
     // and normalize if needed. We remove first, so that the normalization does not need
     // to operate on empty pqueries, which currently throws and exception in genesis.
-    if( ! options.no_remove_empty.value() ) {
-        remove_empty_placement_pqueries( sample );
-
-        // User output
-        auto new_name_count = total_name_count( sample );
-        assert( new_name_count <= name_count );
-        if( new_name_count != name_count ) {
-            LOG_MSG1 << "Removed " << ( name_count - new_name_count ) << " placement names / pqueries "
-            << "which did not contain any placement locations after placement filtering. Use "
-            << options.no_remove_empty.option()->get_name() << " to change this behavior.";
-        }
-        name_count = new_name_count;
+    if( ! options.no_remove_empty.value() && pquery.placement_size() == 0 ) {
+        ++counts.empty_pqueries;
+        return false;
     }
-    if( options.normalize_after.value() ) {
-        normalize_weight_ratios( sample );
+    if( options.normalize_after.value() && pquery.placement_size() > 0 ) {
+        normalize_weight_ratios( pquery );
     }
 
-    // Keeping names
-    if( options.keep_names ) {
-        if( is_file( options.keep_names.value() )) {
-            // Bit expensive to do the double conversion here, but for this use case,
-            // that should suffice.
-            auto const list = file_read_lines( options.keep_names.value() );
-            auto const set = std::unordered_set<std::string>( list.begin(), list.end() );
-            filter_pqueries_keeping_names( sample, set );
-        } else {
-            // Assume it's a regex.
-            filter_pqueries_keeping_names( sample, options.keep_names.value() );
-        }
-
-        // User output
-        auto new_name_count = total_name_count( sample );
-        assert( new_name_count <= name_count );
-        LOG_MSG1 << "Removed " << ( name_count - new_name_count ) << " placement names / pqueries "
-                 << "due to " << options.keep_names.option()->get_name() << " filtering.";
-        name_count = new_name_count;
+    // Name filters.
+    if( keep_matcher.active() && ! matches_any_name( keep_matcher, pquery )) {
+        ++counts.keep_names;
+        return false;
     }
-
-    // Removing names
-    if( options.remove_names ) {
-        if( is_file( options.remove_names.value() )) {
-            // Bit expensive to do the double conversion here, but for this use case,
-            // that should suffice.
-            auto const list = file_read_lines( options.remove_names.value() );
-            auto const set = std::unordered_set<std::string>( list.begin(), list.end() );
-            filter_pqueries_removing_names( sample, set );
-        } else {
-            // Assume it's a regex.
-            filter_pqueries_removing_names( sample, options.remove_names.value() );
-        }
-
-        // User output
-        auto new_name_count = total_name_count( sample );
-        assert( new_name_count <= name_count );
-        LOG_MSG1 << "Removed " << ( name_count - new_name_count ) << " placement names / pqueries "
-                 << "due to " << options.remove_names.option()->get_name() << " filtering.";
-        name_count = new_name_count;
+    if( remove_matcher.active() && matches_any_name( remove_matcher, pquery )) {
+        ++counts.remove_names;
+        return false;
     }
+
+    return true;
 }
 
 // =================================================================================================
@@ -356,6 +327,15 @@ void run_filter( FilterOptions const& options )
     // Check if any of the files we are going to produce already exists. If so, fail early.
     options.jplace_output.check_output_files_nonexistence( "filter", "jplace" );
 
+    // Check user input that cannot be expressed as CLI11 validators.
+    if( options.max_n_placements && options.max_n_placements.value() == 0 ) {
+        throw CLI::ValidationError(
+            "--max-n-placements (" + std::to_string( options.max_n_placements.value() ) +  ")",
+            "Invalid value; has to be > 0, as otherwise all placements would be removed "
+            "from the query."
+        );
+    }
+
     // Print some user output.
     options.jplace_input.print();
 
@@ -363,15 +343,118 @@ void run_filter( FilterOptions const& options )
     LOG_MSG1 << "Reading " << options.jplace_input.file_count() << " sample"
              << ( options.jplace_input.file_count() > 1 ? "s" : "" ) << ".";
 
-    // Get all queries of all samples. Requires that all have the same ref tree.
-    auto sample = options.jplace_input.merged_samples();
+    // Prepare the name matchers once, so that name list files are only read a single time.
+    NameMatcher keep_matcher;
+    NameMatcher remove_matcher;
+    if( options.keep_names ) {
+        keep_matcher = make_name_matcher( options.keep_names.value() );
+    }
+    if( options.remove_names ) {
+        remove_matcher = make_name_matcher( options.remove_names.value() );
+    }
+
+    // Streaming pipeline: iterate the input files one at a time (with the next file being
+    // parsed in the background), filter the pqueries of each sample in parallel, and emit
+    // the survivors in their input order directly to the output document. This way, we
+    // never hold more than two input samples in memory.
+    // Requires that all input files have the same reference tree.
+    auto const target = options.jplace_output.get_output_target( "filter", "jplace" );
+    std::unique_ptr<JplaceStreamWriter> writer;
+    FilterCounts counts;
+    genesis::tree::Tree first_tree;
+    for( size_t fi = 0; fi < options.jplace_input.file_count(); ++fi ) {
+
+        // User output.
+        LOG_MSG2 << "Reading file " << ( fi + 1 ) << " of " << options.jplace_input.file_count()
+                 << ": " << options.jplace_input.file_path( fi );
+
+        auto smpl = options.jplace_input.sample_prefetch( fi );
+        if( first_tree.empty() ) {
+            first_tree = smpl.tree();
+        } else if( ! compatible_trees( first_tree, smpl.tree() )) {
+            throw std::runtime_error( "Input jplace files have differing reference trees." );
+        }
+        if( ! writer ) {
+            writer = std::unique_ptr<JplaceStreamWriter>(
+                new JplaceStreamWriter( smpl.tree(), target )
+            );
+        }
+
+        // The filter decisions are independent per pquery, so we make them in parallel,
+        // with per-thread filter counts merged at the end, and only the ordered writing
+        // of the survivors is sequential.
+        auto keep = std::vector<char>( smpl.size(), 0 );
+        #pragma omp parallel
+        {
+            FilterCounts local_counts;
+
+            #pragma omp for schedule(dynamic)
+            for( size_t pi = 0; pi < smpl.size(); ++pi ) {
+                keep[pi] = filter_pquery(
+                    options, smpl.at( pi ), keep_matcher, remove_matcher, local_counts
+                );
+            }
+
+            #pragma omp critical(GAPPA_FILTER_COUNTS)
+            {
+                counts.min_accumulated_mass += local_counts.min_accumulated_mass;
+                counts.min_mass_threshold   += local_counts.min_mass_threshold;
+                counts.max_n_placements     += local_counts.max_n_placements;
+                counts.min_pendant_len      += local_counts.min_pendant_len;
+                counts.max_pendant_len      += local_counts.max_pendant_len;
+                counts.empty_pqueries       += local_counts.empty_pqueries;
+                counts.keep_names           += local_counts.keep_names;
+                counts.remove_names         += local_counts.remove_names;
+            }
+        }
+        for( size_t pi = 0; pi < smpl.size(); ++pi ) {
+            if( keep[pi] ) {
+                writer->write( smpl.at( pi ));
+            }
+        }
 
-    // Run the filtering.
-    filter_sample( options, sample );
+        // Free the sample on a background thread, so that the next file can be
+        // processed while the millions of small allocations are being returned.
+        dispose_async( smpl );
+    }
+    if( writer ) {
+        writer->finish();
+    } else {
+        LOG_MSG1 << "Input files do not contain any pqueries; no output was written.";
+    }
 
-    // Write the new sample to a file.
-    JplaceWriter().write(
-        sample,
-        options.jplace_output.get_output_target( "filter", "jplace" )
-    );
+    // User output about the work of each filter, same as before the streaming rewrite.
+    if( options.min_accumulated_mass ) {
+        LOG_MSG1 << "Removed " << counts.min_accumulated_mass << " placement locations "
+                 << "due to " << options.min_accumulated_mass.option()->get_name() << " filtering.";
+    }
+    if( options.min_mass_threshold ) {
+        LOG_MSG1 << "Removed " << counts.min_mass_threshold << " placement locations "
+                 << "due to " << options.min_mass_threshold.option()->get_name() << " filtering.";
+    }
+    if( options.max_n_placements ) {
+        LOG_MSG1 << "Removed " << counts.max_n_placements << " placement locations "
+                 << "due to " << options.max_n_placements.option()->get_name() << " filtering.";
+    }
+    if( options.min_pendant_len ) {
+        LOG_MSG1 << "Removed " << counts.min_pendant_len << " placement locations "
+                 << "due to " << options.min_pendant_len.option()->get_name() << " filtering.";
+    }
+    if( options.max_pendant_len ) {
+        LOG_MSG1 << "Removed " << counts.max_pendant_len << " placement locations "
+                 << "due to " << options.max_pendant_len.option()->get_name() << " filtering.";
+    }
+    if( counts.empty_pqueries > 0 ) {
+        LOG_MSG1 << "Removed " << counts.empty_pqueries << " placement names / pqueries "
+                 << "which did not contain any placement locations after placement filtering. Use "
+                 << options.no_remove_empty.option()->get_name() << " to change this behavior.";
+    }
+    if( options.keep_names ) {
+        LOG_MSG1 << "Removed " << counts.keep_names << " placement names / pqueries "
+                 << "due to " << options.keep_names.option()->get_name() << " filtering.";
+    }
+    if( options.remove_names ) {
+        LOG_MSG1 << "Removed " << counts.remove_names << " placement names / pqueries "
+                 << "due to " << options.remove_names.option()->get_name() << " filtering.";
+    }
 }
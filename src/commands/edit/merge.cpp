@@ -25,6 +25,7 @@
 
 #include "options/global.hpp"
 #include "tools/cli_setup.hpp"
+#include "tools/jplace_stream_writer.hpp"
 
 #include "CLI/CLI.hpp"
 
@@ -35,6 +36,7 @@
 #include "genesis/utils/io/output_target.hpp"
 
 #include <cassert>
+#include <memory>
 #include <utility>
 
 #ifdef GENESIS_OPENMP
@@ -114,12 +116,22 @@ void run_merge( MergeOptions const& options )
     LOG_MSG1 << "Reading " << options.jplace_input.file_count() << " sample"
              << ( options.jplace_input.file_count() > 1 ? "s" : "" ) << ".";
 
-    // Get all queries of all samples. Requires that all have the same ref tree.
-    auto sample = options.jplace_input.merged_samples();
-
-    // Write the new sample to a file.
-    JplaceWriter().write(
-        sample,
-        options.jplace_output.get_output_target( "merge", "jplace" )
-    );
+    // Streaming pipeline: read the pqueries of all input files one file at a time,
+    // and emit them to the output document as we go, instead of first merging everything
+    // into one Sample in memory. Requires that all have the same ref tree.
+    auto const target = options.jplace_output.get_output_target( "merge", "jplace" );
+    std::unique_ptr<JplaceStreamWriter> writer;
+    options.jplace_input.for_each_pquery( [&]( Pquery& pquery, Sample const& smpl ){
+        if( ! writer ) {
+            writer = std::unique_ptr<JplaceStreamWriter>(
+                new JplaceStreamWriter( smpl.tree(), target )
+            );
+        }
+        writer->write( pquery );
+    });
+    if( writer ) {
+        writer->finish();
+    } else {
+        LOG_MSG1 << "Input files do not contain any pqueries; no output was written.";
+    }
 }
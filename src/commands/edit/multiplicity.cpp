@@ -25,28 +25,29 @@
 
 #include "options/global.hpp"
 #include "tools/cli_setup.hpp"
+#include "tools/jplace_stream_writer.hpp"
 
 #include "CLI/CLI.hpp"
 
-#include "genesis/placement/formats/jplace_writer.hpp"
-#include "genesis/sequence/formats/fasta_input_iterator.hpp"
-#include "genesis/sequence/formats/fasta_reader.hpp"
 #include "genesis/sequence/functions/labels.hpp"
 #include "genesis/utils/formats/csv/reader.hpp"
+#include "genesis/utils/io/input_stream.hpp"
 #include "genesis/utils/io/output_stream.hpp"
 #include "genesis/utils/io/output_target.hpp"
 
 #include <algorithm>
 #include <cassert>
 #include <fstream>
+#include <functional>
 #include <map>
-#include <unordered_map>
 #include <utility>
 
 #ifdef GENESIS_OPENMP
 #   include <omp.h>
 #endif
 
+#include <sparsepp/spp.h>
+
 // =================================================================================================
 //      Typedefs
 // =================================================================================================
@@ -56,8 +57,12 @@
  *
  * A special case is the empty key (no jplace file name), which is used if the user simply
  * provided a list of abundances per pquery name, with no specified sample name.
+ *
+ * We use the vendored sparsepp hash map here, as the inner map holds one entry per pquery
+ * name, which can be many millions, and the lookups are on the hot path of the per-sample
+ * application loop.
  */
-using MultiplicityMap = std::unordered_map<std::string, std::unordered_map<std::string, double>>;
+using MultiplicityMap = spp::sparse_hash_map<std::string, spp::sparse_hash_map<std::string, double>>;
 
 /**
  * @brief Same as the MultiplicityMap, but keeps its keys sorted.
@@ -216,6 +221,46 @@ std::pair<MultiplicityMap, std::vector<std::string>> get_multiplicities_csv_file
     return { result, duplicates };
 }
 
+/**
+ * @brief Scan a fasta file and call @p callback with the label of each sequence.
+ *
+ * We only need the labels here, so there is no point in running the full fasta parser,
+ * which validates and copies the sequence sites. Instead, only the header lines are
+ * materialized, while sequence lines are skipped in the input buffer without copying,
+ * which reduces the label extraction to a fraction of the file reading time.
+ */
+void scan_fasta_labels_(
+    std::string const& file_path,
+    std::function<void( std::string const& )> const& callback
+) {
+    using namespace genesis;
+
+    // The input stream transparently decompresses gzipped files for us.
+    auto it = utils::InputStream( utils::from_file( file_path ));
+    std::string label;
+    while( it ) {
+        if( *it == '>' ) {
+
+            // Header line: take everything after the leading `>` as the label,
+            // which is what the fasta reader does as well.
+            ++it;
+            label.clear();
+            it.get_line( label );
+            callback( label );
+
+        } else {
+
+            // Sequence (or stray empty) line: skip to the next line without copying.
+            while( it && *it != '\n' ) {
+                ++it;
+            }
+            if( it ) {
+                ++it;
+            }
+        }
+    }
+}
+
 std::pair<MultiplicityMap, std::vector<std::string>> get_multiplicities_fasta_files(
     MultiplicityOptions const& options
 ) {
@@ -229,21 +274,24 @@ std::pair<MultiplicityMap, std::vector<std::string>> get_multiplicities_fasta_fi
     MultiplicityMap result;
     std::vector<std::string> duplicates;
 
-    // Read fasta files in parallel.
+    // Read fasta files in parallel. Each file fills its own local map first,
+    // which is merged into the shared result once per file, so that the per-label
+    // work does not serialize on a shared lock.
     #pragma omp parallel for schedule(dynamic)
     for( size_t file_idx = 0; file_idx < options.sequence_input.file_count(); ++file_idx ) {
         auto const file_path = options.sequence_input.file_path( file_idx );
         auto const sample = options.sequence_input.base_file_name( file_idx );
 
-        // Iterate the file and read all sequence labels.
-        auto seq_it = sequence::FastaInputIterator( utils::from_file( file_path ));
-        while( seq_it ) {
+        spp::sparse_hash_map<std::string, double> file_map;
+        std::vector<std::string> file_duplicates;
+
+        // Scan the labels of the file. The sequences themselves are not needed here.
+        scan_fasta_labels_( file_path, [&]( std::string const& label ){
             std::string pquery;
             double      value;
 
             // First try to simply use the abundance.
             // This accepts both formats "size=123" and "_123".
-            auto const& label = seq_it->label();
             auto const abun = sequence::guess_sequence_abundance( label );
             pquery = abun.first;
             value = abun.second;
@@ -277,22 +325,35 @@ std::pair<MultiplicityMap, std::vector<std::string>> get_multiplicities_fasta_fi
                 pquery = label;
             }
 
-            // Set the value in the result.
-            #pragma omp critical(GAPPA_MULTIPLICITY_ADD_MULTIPLICITY)
-            {
-                // Check if it is a duplicate.
-                if( result[ sample ].count( pquery ) > 0 ) {
-                    duplicates.push_back(
-                        sample + ( sample.empty() ? "" : " " ) + pquery
-                    );
-                }
-
-                // Store in result.
-                result[ sample ][ pquery ] = value;
+            // Check if it is a duplicate, and store in the per-file map.
+            if( file_map.count( pquery ) > 0 ) {
+                file_duplicates.push_back(
+                    sample + ( sample.empty() ? "" : " " ) + pquery
+                );
             }
+            file_map[ pquery ] = value;
+        });
 
-            // Next sequence;
-            ++seq_it;
+        // Merge the per-file results into the shared map.
+        #pragma omp critical(GAPPA_MULTIPLICITY_ADD_MULTIPLICITY)
+        {
+            auto& sample_map = result[ sample ];
+            if( sample_map.empty() ) {
+                sample_map = std::move( file_map );
+            } else {
+                // Multiple input files with the same base name feed the same sample.
+                for( auto const& entry : file_map ) {
+                    if( sample_map.count( entry.first ) > 0 ) {
+                        file_duplicates.push_back(
+                            sample + ( sample.empty() ? "" : " " ) + entry.first
+                        );
+                    }
+                    sample_map[ entry.first ] = entry.second;
+                }
+            }
+            duplicates.insert(
+                duplicates.end(), file_duplicates.begin(), file_duplicates.end()
+            );
         }
     }
 
@@ -357,6 +418,10 @@ void change_multiplicities( MultiplicityOptions const& options )
     // Get all multiplicites. That might need some memory, but for now, easier that way.
     auto multips = get_multiplicities( options );
 
+    // Create the default (sample-less) entry up front if it is not present, so that the
+    // map is strictly read-only in the parallel loop below.
+    auto const& default_mult = multips[""];
+
     // Preparations.
     size_t file_count = 0;
     auto const set_size = options.jplace_input.file_count();
@@ -375,19 +440,18 @@ void change_multiplicities( MultiplicityOptions const& options )
         auto const basename = options.jplace_input.base_file_name( fi );
 
         // If there is an entry for this sample in the multiplicities, use it.
-        // Otherwise, use the default empty one (which might be created if not present).
-        auto const& smp_mult = (
-            multips.count( basename ) > 0
-            ? multips.at( basename )
-            : multips[""]
-        );
+        // Otherwise, use the default (sample-less) one.
+        auto const smp_it = multips.find( basename );
+        auto const& smp_mult = smp_it != multips.end() ? smp_it->second : default_mult;
 
-        // Set the new multiplicity for each pquery name.
+        // Set the new multiplicity for each pquery name. One hash lookup per name.
         for( auto& pquery : sample ) {
             for( auto& pqn : pquery.names() ) {
-                if( smp_mult.count( pqn.name ) > 0 ) {
-                    pqn.multiplicity = smp_mult.at( pqn.name );
+                auto const mult_it = smp_mult.find( pqn.name );
+                if( mult_it != smp_mult.end() ) {
+                    pqn.multiplicity = mult_it->second;
                 } else {
+                    #pragma omp atomic
                     ++not_found;
 
                     // User output.
@@ -399,7 +463,7 @@ void change_multiplicities( MultiplicityOptions const& options )
         }
 
         // Write sample back to file.
-        genesis::placement::JplaceWriter().write(
+        write_jplace_sample(
             sample,
             options.file_output.get_output_target( basename, "jplace" )
         );
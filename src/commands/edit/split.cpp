@@ -25,10 +25,10 @@
 
 #include "options/global.hpp"
 #include "tools/cli_setup.hpp"
+#include "tools/jplace_stream_writer.hpp"
 
 #include "CLI/CLI.hpp"
 
-#include "genesis/placement/formats/jplace_writer.hpp"
 #include "genesis/placement/function/functions.hpp"
 #include "genesis/placement/function/sample_set.hpp"
 #include "genesis/utils/containers/matrix.hpp"
@@ -41,14 +41,14 @@
 #include <algorithm>
 #include <cassert>
 #include <fstream>
-#include <unordered_map>
-#include <unordered_set>
 #include <utility>
 
 #ifdef GENESIS_OPENMP
 #   include <omp.h>
 #endif
 
+#include <sparsepp/spp.h>
+
 // =================================================================================================
 //      Typedefs
 // =================================================================================================
@@ -67,9 +67,10 @@ struct SampleContent
      * @brief Map from a pquery (index in the pquery_names vector) to its abundance.
      *
      * We use this form instead of a full OTU table, because those are often quite spare,
-     * and we do not want to waste memory.
+     * and we do not want to waste memory. The vendored sparsepp map keeps the per-entry
+     * overhead low for tables with many OTUs.
      */
-    std::unordered_map<size_t, double> pqueries;
+    spp::sparse_hash_map<size_t, double> pqueries;
 };
 
 /**
@@ -181,8 +182,8 @@ OtuTable read_split_file( SplitOptions const& options )
     auto const table = reader.read( utils::from_file( options.split_file ));
 
     // The list in the file is not expected to be sorted. Thus, use lookups to find entries.
-    std::unordered_map<std::string, size_t> pquery_to_index;
-    std::unordered_map<std::string, size_t> sample_to_index;
+    spp::sparse_hash_map<std::string, size_t> pquery_to_index;
+    spp::sparse_hash_map<std::string, size_t> sample_to_index;
 
     // Iterate it once to get all pquery names and sample in a fixed order.
     // Unfortunate, but the price we pay for a smaller data structure.
@@ -312,7 +313,7 @@ OtuTable read_otu_table_file( SplitOptions const& options )
     }
 
     // Read the table and fill the rest of our result.
-    std::unordered_set<std::string> unique_check;
+    spp::sparse_hash_set<std::string> unique_check;
     while( otu_is ) {
         auto const line = reader.parse_line( otu_is );
         if( line.size() != header.size() ) {
@@ -409,7 +410,7 @@ void run_split( SplitOptions const& options )
     // TODO make average branch length?!
 
     // Create a mapping from pquery names to the pquery that contains the name.
-    std::unordered_map<std::string, Pquery const*> name_map;
+    spp::sparse_hash_map<std::string, Pquery const*> name_map;
     for( auto const& sample : sample_set ) {
         for( auto const& pquery : sample ) {
             for( auto const& pname : pquery.names() ) {
@@ -432,8 +433,10 @@ void run_split( SplitOptions const& options )
         auto const& sample_entry = otu_table.samples[si];
 
         // User output.
-        ++file_count;
-        LOG_MSG2 << "Writing file " << file_count << " of " << otu_table.samples.size()
+        size_t current_count;
+        #pragma omp atomic capture
+        current_count = ++file_count;
+        LOG_MSG2 << "Writing file " << current_count << " of " << otu_table.samples.size()
                  << ": " << options.file_output.get_output_filename( sample_entry.name, "jplace" );
 
         // Create a new sample and fill it with the needed pqueries.
@@ -467,7 +470,7 @@ void run_split( SplitOptions const& options )
         }
 
         // Write the new sample to a file.
-        JplaceWriter().write(
+        write_jplace_sample(
             target,
             options.file_output.get_output_target( sample_entry.name, "jplace" )
         );
@@ -34,6 +34,8 @@
 #include "commands/examine/lwr_distribution.hpp"
 #include "commands/examine/lwr_histogram.hpp"
 #include "commands/examine/lwr_list.hpp"
+#include "commands/examine/lwr_overview.hpp"
+#include "commands/examine/validate.hpp"
 
 #include "options/global.hpp"
 #include "tools/cli_setup.hpp"
@@ -63,6 +65,8 @@ inline void setup_examine( CLI::App& app )
     setup_lwr_distribution( *sub );
     setup_lwr_histogram( *sub );
     setup_lwr_list( *sub );
+    setup_lwr_overview( *sub );
+    setup_validate( *sub );
 
     // Add the global options to each of the above subcommands.
     global_options.add_to_module( *sub );
@@ -25,6 +25,7 @@
 
 #include "options/global.hpp"
 #include "tools/cli_setup.hpp"
+#include "tools/profiler.hpp"
 
 #include "CLI/CLI.hpp"
 
@@ -57,10 +58,16 @@
 #include "genesis/placement/pquery.hpp"
 #include "genesis/placement/pquery/placement.hpp"
 #include "genesis/placement/function/manipulation.hpp"
+#include "genesis/placement/function/operators.hpp"
 
+#include <algorithm>
 #include <cassert>
+#include <cstdio>
 #include <fstream>
+#include <sstream>
+#include <string>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 #include <limits>
 
@@ -496,6 +503,29 @@ void add_lwr_to_taxonomy(   double const lwr,
     } while( cur_tax != nullptr );
 }
 
+/**
+ * @brief Merge the LWR accumulations of @p src into @p dst, recursively.
+ *
+ * Used to combine the per-thread taxonomies of the parallel assignment loop.
+ */
+void merge_assign_taxonomies( Taxonomy& dst, Taxonomy const& src )
+{
+    for( auto const& src_child : src ) {
+        auto& dst_child = dst.has_child( src_child.name() )
+            ? dst.get_child( src_child.name() )
+            : dst.add_child( src_child.name() )
+        ;
+        if ( src_child.has_data() ) {
+            if( not dst_child.has_data() ) {
+                dst_child.reset_data( AssignTaxonData::create() );
+            }
+            dst_child.data<AssignTaxonData>().LWR  += src_child.data<AssignTaxonData>().LWR;
+            dst_child.data<AssignTaxonData>().aLWR += src_child.data<AssignTaxonData>().aLWR;
+        }
+        merge_assign_taxonomies( dst_child, src_child );
+    }
+}
+
 Taxon const * get_most_supported(Taxonomy const& tax)
 {
     Taxon const * most_supported = nullptr;
@@ -520,26 +550,46 @@ Taxon const * get_most_supported(Taxonomy const& tax)
     return most_supported;
 }
 
-void print_weighted_taxopath(
-    std::ostream& stream,
+/**
+ * @brief Append a value to the buffer with the same `%.4g` formatting that the former
+ * `stream << std::setprecision(4)` produced, without going through iostream operators.
+ *
+ * With per-query results, one row is formatted per pquery, and with tens of millions
+ * of pqueries, the stream state handling and locale checks of the iostream operators
+ * dominated the formatting time.
+ */
+inline void append_assign_value( std::string& buffer, double value )
+{
+    char chars[32];
+    auto const len = std::snprintf( chars, sizeof( chars ), "%.4g", value );
+    buffer.append( chars, len );
+}
+
+void append_weighted_taxopath(
+    std::string& buffer,
     std::string const& name,
     Taxon const& taxon,
     double const sum)
 {
-    stream << std::setprecision(4);
     if ( not name.empty() ) {
-        stream << name << "\t";
+        buffer += name;
+        buffer += '\t';
     }
-    stream << taxon.data<AssignTaxonData>().LWR;
-    stream << "\t" << taxon.data<AssignTaxonData>().LWR / sum;
-    stream << "\t" << taxon.data<AssignTaxonData>().aLWR;
-    stream << "\t" << taxon.data<AssignTaxonData>().aLWR / sum;
-    stream << "\t" << TaxopathGenerator().to_string( taxon );
-    stream << "\n";
+    auto const& data = taxon.data<AssignTaxonData>();
+    append_assign_value( buffer, data.LWR );
+    buffer += '\t';
+    append_assign_value( buffer, data.LWR / sum );
+    buffer += '\t';
+    append_assign_value( buffer, data.aLWR );
+    buffer += '\t';
+    append_assign_value( buffer, data.aLWR / sum );
+    buffer += '\t';
+    buffer += TaxopathGenerator().to_string( taxon );
+    buffer += '\n';
 }
 
 void print_taxonomy_with_lwr(
-    std::ostream& stream,
+    std::string& buffer,
     std::string const& name,
     Taxonomy const& tax,
     size_t const base_tax_level,
@@ -553,7 +603,7 @@ void print_taxonomy_with_lwr(
 
     if ( options.best_hit ) {
         Taxon const * most_supported = get_most_supported( tax );
-        print_weighted_taxopath(stream, name, *most_supported, sum);
+        append_weighted_taxopath(buffer, name, *most_supported, sum);
     } else {
         preorder_for_each( tax, [&]( Taxon const& taxon ){
             // Only print if there is some weight.
@@ -568,13 +618,13 @@ void print_taxonomy_with_lwr(
                 return;
             }
 
-            print_weighted_taxopath(stream, name, taxon, sum);
+            append_weighted_taxopath(buffer, name, taxon, sum);
         });
     }
 }
 
 void print_sativa_string(
-    std::ostream& stream,
+    std::string& buffer,
     std::string const& name,
     Taxonomy const& tax
 ) {
@@ -594,10 +644,20 @@ void print_sativa_string(
     std::reverse( std::begin(confidences), std::end(confidences) );
     std::reverse( std::begin(taxpath), std::end(taxpath) );
 
-    stream << name;
-    stream << "\t" << join( taxpath, ";" );
-    stream << "\t" << join( confidences, ";" );
-    stream << "\n";
+    buffer += name;
+    buffer += '\t';
+    buffer += join( taxpath, ";" );
+    buffer += '\t';
+    for( size_t i = 0; i < confidences.size(); ++i ) {
+        if( i > 0 ) {
+            buffer += ';';
+        }
+        // Default stream precision, as the former join() of the doubles used.
+        char chars[32];
+        auto const len = std::snprintf( chars, sizeof( chars ), "%g", confidences[i] );
+        buffer.append( chars, len );
+    }
+    buffer += '\n';
 }
 
 void print_taxonomy_table(
@@ -609,8 +669,11 @@ void print_taxonomy_table(
     std::ofstream stream;
     genesis::utils::file_output_stream( path, stream );
 
+    std::string buffer;
+    print_taxonomy_with_lwr( buffer, "", tax, base_tax_level, options );
+
     stream << "LWR\tfract\taLWR\tafract\ttaxopath\n";
-    print_taxonomy_with_lwr( stream, "", tax, base_tax_level, options );
+    stream << buffer;
 }
 
 using vec_iter = std::vector<std::string>::const_iterator;
@@ -726,6 +789,77 @@ Taxon* prune( Taxon* const taxon )
     return parent;
 }
 
+/**
+ * Hashed lookup index over the reference taxonomy.
+ *
+ * Stores the taxa of the (immutable) reference taxonomy in preorder, the preorder interval
+ * spanned by each subtree, and a hash map from lower-case taxon name to the preorder positions
+ * of all taxa with that name. This turns the repeated name searches of the taxonomy transfer,
+ * which would otherwise traverse the reference taxonomy for every queried taxon, into
+ * constant-time hash lookups.
+ */
+struct ReferenceTaxonomyIndex
+{
+    explicit ReferenceTaxonomyIndex( Taxonomy const& map )
+    {
+        index_( map );
+    }
+
+    /**
+     * Find the first taxon (in preorder) below @p scope whose name closely equals @p name,
+     * or nullptr if there is none. A nullptr @p scope searches the whole reference taxonomy.
+     *
+     * This matches what a depth-first find_taxon() with an equals_closely() predicate returns,
+     * but via two hash lookups and a binary search instead of a taxonomy traversal.
+     */
+    Taxon const* find_descendant( Taxonomy const* scope, std::string const& name ) const
+    {
+        auto const nit = name_positions_.find( to_lower( name ));
+        if ( nit == name_positions_.end() ) {
+            return nullptr;
+        }
+
+        // determine the preorder interval to search: the scope's subtree, excluding the
+        // scope itself, or everything if the scope is not an indexed taxon (i.e., the root)
+        size_t begin = 0;
+        size_t end   = taxa_.size();
+        auto const pit = positions_.find( scope );
+        if ( pit != positions_.end() ) {
+            begin = pit->second + 1;
+            end   = subtree_end_[ pit->second ];
+        }
+
+        // the positions per name are ascending, so the first one in the interval is
+        // the first preorder hit
+        auto const& positions = nit->second;
+        auto const hit = std::lower_bound( positions.begin(), positions.end(), begin );
+        if ( hit == positions.end() or *hit >= end ) {
+            return nullptr;
+        }
+        return taxa_[ *hit ];
+    }
+
+private:
+
+    void index_( Taxonomy const& tax )
+    {
+        for ( auto const& child : tax ) {
+            auto const pos = taxa_.size();
+            taxa_.push_back( &child );
+            positions_[ &child ] = pos;
+            name_positions_[ to_lower( child.name() ) ].push_back( pos );
+            subtree_end_.push_back( 0 );
+            index_( child );
+            subtree_end_[ pos ] = taxa_.size();
+        }
+    }
+
+    std::vector<Taxon const*> taxa_;
+    std::vector<size_t> subtree_end_;
+    std::unordered_map<Taxonomy const*, size_t> positions_;
+    std::unordered_map<std::string, std::vector<size_t>> name_positions_;
+};
+
 /**
  * Maps the given Taxon and its predeccesors according to the given Taxonomy.
  *
@@ -734,7 +868,7 @@ Taxon* prune( Taxon* const taxon )
  * successfully.
  *
  */
-Taxon const* map_according_to( Taxonomy const& map, Taxon& taxon, std::string const& rank_constraint )
+Taxon const* map_according_to( ReferenceTaxonomyIndex const& map, Taxon& taxon, std::string const& rank_constraint )
 {
     // short cuircuit if Taxon already mapped
     if( not taxon.id().empty() ) {
@@ -775,14 +909,13 @@ Taxon const* map_according_to( Taxonomy const& map, Taxon& taxon, std::string co
     }
 
     // then go through the taxon_list in reverse order
-    // Use a pointer that is updated in the loop while we go deeper and deeper into the mapping taxonomy.
-    Taxonomy const* cur_ref_taxon = &map;
+    // Use a pointer that is updated in the loop while we go deeper and deeper into the mapping
+    // taxonomy; null means the whole reference taxonomy.
+    Taxonomy const* cur_ref_taxon = nullptr;
     for (auto it = taxon_list.rbegin(); it != taxon_list.rend(); ++it) {
         bool do_mapping = true;
-        // find current taxon in map
-        auto const entry = find_taxon( *cur_ref_taxon, [&cur_taxon](Taxon const& other) {
-            return equals_closely( cur_taxon->name(), other.name() );
-        });
+        // find current taxon in the reference index
+        auto const entry = map.find_descendant( cur_ref_taxon, cur_taxon->name() );
 
         if ( entry ) {
         // success:
@@ -864,6 +997,12 @@ void add_taxon_ids( Taxonomy& tax, AssignOptions const& options )
     tr.rank_field_position(2);
     tr.read( genesis::utils::from_file( options.taxonomy_file ), map );
 
+    // build the hashed lookup index over the reference taxonomy once up front;
+    // the reference is not modified during the mapping, so the index stays valid.
+    // (the query-side lookups by tmp_id below cannot be indexed the same way,
+    // as the query taxonomy is restructured while mapping)
+    auto const map_index = ReferenceTaxonomyIndex( map );
+
     /* dirty hack time! yaay
     *  since we will have a very hard time changing the taxonomy while traversing it
     *  my dirty solution is to first give the leaves of the taxonomy unique IDs
@@ -887,7 +1026,7 @@ void add_taxon_ids( Taxonomy& tax, AssignOptions const& options )
         // its possible that we don't find the taxon since it may have been pruned
         if ( taxon ) {
             LOG_MSG3 << "== trying to map " << taxon->name() << " ==";
-            map_according_to( map, *taxon, options.rank_constraint );
+            map_according_to( map_index, *taxon, options.rank_constraint );
         }
     }
 }
@@ -1040,42 +1179,58 @@ double proximity( double const length, double const close, double const distant
     return 1 - pos;
 }
 
-static void assign( Sample const& sample,
-                    std::vector<Taxopath> const& node_labels,
-                    AssignOptions const& options,
-                    std::shared_ptr<genesis::utils::BaseOutputTarget> per_pquery_result_file_target
-                    )
+// defined below; needed by the per-sample loop of assign() to root each sample
+// the same way as the reference tree used for the labelling
+void outgroup_rooting( Sample& sample, std::vector<std::string> const& outgroup_names );
+
+/**
+ * @brief Process the pqueries of one sample, using the shared read-only node labelling.
+ *
+ * The labelling is computed once per run, see run_assign(), as all samples share the
+ * same reference tree. The LWR mass is accumulated into @p diversity, guarded by a
+ * critical section, and, if per-query results are requested, the result lines are
+ * appended to the given per-file buffers in pquery order.
+ */
+static void assign_sample( Sample const& sample,
+                           std::vector<Taxopath> const& node_labels,
+                           AssignOptions const& options,
+                           Taxopath const& outlier_taxopath,
+                           double const outlier_length,
+                           Taxonomy& diversity,
+                           std::string* per_pq_block,
+                           std::string* sativa_block
+                           )
 {
     bool    const   auto_ratio = ( options.dist_ratio < 0.0 );
     double  const   dist_ratio = options.dist_ratio;
     assert( auto_ratio or ( dist_ratio >= 0.0 and dist_ratio <= 1.0 ) );
 
     auto const& tree = sample.tree();
-
-    Taxonomy diversity;
-
-    std::ostream* per_pquery_out_stream = nullptr;
     bool const per_query_results = options.per_query_results;
 
+    // The pqueries are independent of each other given the precomputed node labels,
+    // so we process them in parallel, with per-thread taxonomy accumulators that are
+    // merged into the global one at the end. The per-query result lines are buffered
+    // per pquery and joined in input order afterwards.
+    // (With multiple input files, the per-file loop of assign() is parallel already,
+    // and this inner region simply runs single threaded.)
+    auto const pquery_count = sample.size();
+    auto per_pq_lines = std::vector<std::string>();
+    auto sativa_lines = std::vector<std::string>();
     if ( per_query_results ) {
-        // genesis::utils::file_output_stream( per_pquery_result_file, per_pquery_out_stream );
-        per_pquery_out_stream = &per_pquery_result_file_target->ostream();
-        (*per_pquery_out_stream) << "name\tLWR\tfract\taLWR\tafract\ttaxopath\n";
-    }
-
-    std::ofstream sativa_out_stream;
-    if ( options.sativa ) {
-        genesis::utils::file_output_stream(
-            options.file_output.get_output_filename( "sativa", "tsv" ),
-            sativa_out_stream
-        );
+        per_pq_lines.resize( pquery_count );
+        if ( options.sativa ) {
+            sativa_lines.resize( pquery_count );
+        }
     }
 
-    // set up stuff to deal with outliers
-    Taxopath outlier_taxopath({ "DISTANT" });
-    auto const outlier_length = diameter( sample.tree() ) / 2.0;
+    #pragma omp parallel
+    {
+    Taxonomy local_diversity;
 
-    for ( auto const& pq : sample.pqueries() ) {
+    #pragma omp for schedule(dynamic)
+    for ( size_t pqi = 0; pqi < pquery_count; ++pqi ) {
+        auto const& pq = sample.at( pqi );
         Taxonomy per_pq_assignments;
 
         using PqueryName = genesis::placement::PqueryName;
@@ -1155,11 +1310,11 @@ static void assign( Sample const& sample,
                 }
             }
 
-            // then to the global one
-            add_lwr_to_taxonomy( proximal_portion,  proximal_tax,   diversity );
-            add_lwr_to_taxonomy( distal_portion,    distal_tax,     diversity );
+            // then to the thread-local global one
+            add_lwr_to_taxonomy( proximal_portion,  proximal_tax,   local_diversity );
+            add_lwr_to_taxonomy( distal_portion,    distal_tax,     local_diversity );
             if ( pendant_portion > 0.0 ) {
-                add_lwr_to_taxonomy( pendant_portion, outlier_taxopath, diversity );
+                add_lwr_to_taxonomy( pendant_portion, outlier_taxopath, local_diversity );
             }
         }
 
@@ -1171,61 +1326,198 @@ static void assign( Sample const& sample,
                 }
                 composite_name += name;
             }
-            assert( per_pquery_out_stream );
-            print_taxonomy_with_lwr(*per_pquery_out_stream,
+            // Format the result rows straight into the per-pquery buffers,
+            // without a stream in between, see append_weighted_taxopath().
+            print_taxonomy_with_lwr(per_pq_lines[ pqi ],
                                     composite_name,
                                     per_pq_assignments,
                                     0,
                                     options );
 
             if ( options.sativa ) {
-                print_sativa_string( sativa_out_stream, composite_name, per_pq_assignments );
+                print_sativa_string( sativa_lines[ pqi ], composite_name, per_pq_assignments );
             }
         }
     }
 
-    // if specified, use the taxonomy table to label the taxopaths according to their tax IDs
-    if ( not options.taxonomy_file.empty() ) {
-        add_taxon_ids( diversity, options );
+    // merge this thread's accumulation into the global taxonomy
+    #pragma omp critical (gappa_assign_merge_diversity)
+    {
+        merge_assign_taxonomies( diversity, local_diversity );
     }
+    } // end of parallel region
 
-    // ========= OUTPUT =============
+    // join the buffered per-query results of this sample, in pquery order
+    if ( per_query_results ) {
+        assert( per_pq_block );
+        for ( size_t pqi = 0; pqi < pquery_count; ++pqi ) {
+            *per_pq_block += per_pq_lines[ pqi ];
+            if ( options.sativa ) {
+                assert( sativa_block );
+                *sativa_block += sativa_lines[ pqi ];
+            }
+        }
+    }
+}
 
-    // return diversity profile
-    print_taxonomy_table(
-        options, 0, diversity,
-        options.file_output.get_output_filename( "profile", "tsv" )
-    );
+static void assign( AssignOptions const& options,
+                    Sample&& first_sample,
+                    std::vector<Taxopath> const& node_labels,
+                    std::vector<std::string> const& outgroup_names,
+                    std::shared_ptr<genesis::utils::BaseOutputTarget> per_pquery_result_file_target
+                    )
+{
+    Taxonomy diversity;
+
+    std::ostream* per_pquery_out_stream = nullptr;
+    bool const per_query_results = options.per_query_results;
 
-    // print result in CAMI format if desired
-    if ( options.cami ) {
-        print_cami(
-            options, diversity,
-            options.file_output.get_output_filename( "cami", "profile"  )
+    if ( per_query_results ) {
+        // genesis::utils::file_output_stream( per_pquery_result_file, per_pquery_out_stream );
+        per_pquery_out_stream = &per_pquery_result_file_target->ostream();
+        (*per_pquery_out_stream) << "name\tLWR\tfract\taLWR\tafract\ttaxopath\n";
+    }
+
+    std::ofstream sativa_out_stream;
+    if ( options.sativa ) {
+        genesis::utils::file_output_stream(
+            options.file_output.get_output_filename( "sativa", "tsv" ),
+            sativa_out_stream
         );
     }
 
-    // print result in krona format if desired
-    if ( options.krona ) {
-        print_krona(
-            options, diversity,
-            options.file_output.get_output_filename( "krona", "profile"  )
+    // set up stuff to deal with outliers. the outlier radius depends only on the
+    // shared reference tree, so we compute it once instead of once per sample.
+    Taxopath outlier_taxopath({ "DISTANT" });
+    auto const outlier_length = diameter( first_sample.tree() ) / 2.0;
+
+    // keep a copy of the reference tree, so that the remaining samples can be checked
+    // against it; the first sample itself is consumed by the loop below.
+    auto const ref_tree = first_sample.tree();
+
+    // per-file buffers for the per-query result lines, written in input order after the loop
+    auto const file_count = options.jplace_input.file_count();
+    auto per_pq_blocks = std::vector<std::string>( per_query_results ? file_count : 0 );
+    auto sativa_blocks = std::vector<std::string>(
+        ( per_query_results and options.sativa ) ? file_count : 0
+    );
+
+    // Process the samples in parallel, sharing the read-only node labelling.
+    // The memory budget caps how many samples are held at once, see --memory-limit.
+    size_t file_counter = 0;
+    bool const parallel_files = file_count > 1;
+    auto const max_in_flight = options.jplace_input.max_concurrent_samples();
+    ProfilerGuard compute_guard( "per-query assignment" );
+    #pragma omp parallel for schedule(dynamic) if( parallel_files ) num_threads( max_in_flight )
+    for ( size_t fi = 0; fi < file_count; ++fi ) {
+
+        // User output.
+        size_t current_counter;
+        #pragma omp atomic capture
+        current_counter = ++file_counter;
+        LOG_MSG2 << "Processing file " << current_counter << " of " << file_count
+                 << ": " << options.jplace_input.file_path( fi );
+
+        // The first sample was already read and rooted to compute the labelling;
+        // all other samples are read, and rooted the same way, here.
+        Sample sample;
+        if ( fi == 0 ) {
+            sample = std::move( first_sample );
+        } else {
+            sample = options.jplace_input.sample( fi );
+            if ( not outgroup_names.empty() ) {
+                outgroup_rooting( sample, outgroup_names );
+            }
+            if ( not genesis::placement::compatible_trees( ref_tree, sample.tree() ) ) {
+                throw std::runtime_error{"Input jplace files have differing reference trees."};
+            }
+        }
+
+        assign_sample(
+            sample, node_labels, options, outlier_taxopath, outlier_length, diversity,
+            per_query_results ? &per_pq_blocks[ fi ] : nullptr,
+            ( per_query_results and options.sativa ) ? &sativa_blocks[ fi ] : nullptr
         );
     }
+    compute_guard.stop();
+
+    // write the buffered per-query results in input order
+    if ( per_query_results ) {
+        assert( per_pquery_out_stream );
+        for ( size_t fi = 0; fi < file_count; ++fi ) {
+            (*per_pquery_out_stream) << per_pq_blocks[ fi ];
+            if ( options.sativa ) {
+                sativa_out_stream << sativa_blocks[ fi ];
+            }
+        }
+    }
+
+    // if specified, use the taxonomy table to label the taxopaths according to their tax IDs
+    if ( not options.taxonomy_file.empty() ) {
+        add_taxon_ids( diversity, options );
+    }
 
-    // constrain to subtaxonomy if specified
+    // ========= OUTPUT =============
+
+    // resolve the subtaxonomy constraint up front (it may throw a user error),
+    // so that the parallel output writing below stays exception free
+    Taxon const* subtaxonomy = nullptr;
     if ( not options.sub_taxopath.empty() ) {
-        const auto& subtaxonomy = get_subtaxonomy( diversity, options );
+        subtaxonomy = &get_subtaxonomy( diversity, options );
+    }
 
-        // Get the level of the taxon to be printed.
-        // Need this for the max level filter.
-        auto const base_level = taxon_level( subtaxonomy );
+    // The accumulation is complete and the taxonomy immutable now. Each output format
+    // streams its file per taxon in a single preorder pass, and the files are independent
+    // of each other, so we write them in parallel.
+    ProfilerGuard output_guard( "assignment output write" );
+    #pragma omp parallel sections
+    {
+        // return diversity profile
+        #pragma omp section
+        {
+            print_taxonomy_table(
+                options, 0, diversity,
+                options.file_output.get_output_filename( "profile", "tsv" )
+            );
+        }
 
-        // and print to file
-        print_taxonomy_table(
-            options, base_level, subtaxonomy,
-            options.file_output.get_output_filename( "profile_filtered", "tsv"  )
-        );
+        // print result in CAMI format if desired
+        #pragma omp section
+        {
+            if ( options.cami ) {
+                print_cami(
+                    options, diversity,
+                    options.file_output.get_output_filename( "cami", "profile"  )
+                );
+            }
+        }
+
+        // print result in krona format if desired
+        #pragma omp section
+        {
+            if ( options.krona ) {
+                print_krona(
+                    options, diversity,
+                    options.file_output.get_output_filename( "krona", "profile"  )
+                );
+            }
+        }
+
+        // constrain to subtaxonomy if specified
+        #pragma omp section
+        {
+            if ( subtaxonomy ) {
+                // Get the level of the taxon to be printed.
+                // Need this for the max level filter.
+                auto const base_level = taxon_level( *subtaxonomy );
+
+                // and print to file
+                print_taxonomy_table(
+                    options, base_level, *subtaxonomy,
+                    options.file_output.get_output_filename( "profile_filtered", "tsv"  )
+                );
+            }
+        }
     }
 }
 
@@ -1310,8 +1602,21 @@ void label_undetermined_nodes( PlacementTree const& tree, std::vector<Taxopath>&
 void run_assign( AssignOptions const& options )
 {
     options.jplace_input.print();
-    auto sample = options.jplace_input.merged_samples();
-    auto& tree = sample.tree();
+
+    // get the names of the outgroup taxa, if rooting was requested
+    std::vector<std::string> outgroup_names;
+    if ( not options.outgroup_file.empty() ) {
+        std::ifstream outgroup_file( options.outgroup_file );
+        std::copy(std::istream_iterator<std::string>(outgroup_file),
+            std::istream_iterator<std::string>(),
+            std::back_inserter(outgroup_names));
+    }
+
+    // All samples of a run share the same reference tree, so the taxonomic labelling of
+    // its nodes is computed once, from the first sample, and then shared read-only across
+    // the per-sample assignment loop in assign().
+    auto first_sample = options.jplace_input.sample( 0 );
+    auto& tree = first_sample.tree();
 
     if ( not is_bifurcating(tree) ) {
         throw std::runtime_error{"Supplied tree is not bifurcating."};
@@ -1321,15 +1626,8 @@ void run_assign( AssignOptions const& options )
     LOG_MSG1 << "Running the assignment";
 
     // root the tree if necessary
-    if ( not options.outgroup_file.empty() ) {
-        // get the names of the outgroup taxa
-        std::vector<std::string> names;
-        std::ifstream outgroup_file( options.outgroup_file );
-        std::copy(std::istream_iterator<std::string>(outgroup_file),
-            std::istream_iterator<std::string>(),
-            std::back_inserter(names));
-        // root
-        outgroup_rooting(sample, names);
+    if ( not outgroup_names.empty() ) {
+        outgroup_rooting( first_sample, outgroup_names );
     }
 
     // vector to hold the per node taxopaths
@@ -1352,7 +1650,7 @@ void run_assign( AssignOptions const& options )
 
     // per rank LWR score eval
     assign(
-        sample, node_labels, options,
+        options, std::move( first_sample ), node_labels, outgroup_names,
         options.file_output.get_output_target( "per_query", "tsv"  )
     );
 }
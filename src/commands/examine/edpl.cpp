@@ -25,16 +25,19 @@
 
 #include "options/global.hpp"
 #include "tools/cli_setup.hpp"
+#include "tools/sample_columns.hpp"
+#include "tools/tree_cache.hpp"
+#include "tools/tree_fingerprint.hpp"
 
 #include "CLI/CLI.hpp"
 
 #include "genesis/placement/function/functions.hpp"
 #include "genesis/placement/function/masses.hpp"
-#include "genesis/placement/function/measures.hpp"
 #include "genesis/placement/function/operators.hpp"
 
 #include "genesis/tree/common_tree/distances.hpp"
 #include "genesis/tree/common_tree/functions.hpp"
+#include "genesis/tree/common_tree/tree.hpp"
 #include "genesis/tree/function/distances.hpp"
 #include "genesis/tree/function/functions.hpp"
 
@@ -43,8 +46,13 @@
 #include "genesis/utils/math/histogram.hpp"
 #include "genesis/utils/math/histogram/stats.hpp"
 
+#include <algorithm>
 #include <cassert>
 #include <fstream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <utility>
 
 #ifdef GENESIS_OPENMP
 #   include <omp.h>
@@ -89,8 +97,8 @@ void setup_edpl( CLI::App& app )
         "--no-list-file",
         opt->no_list_file,
         "If set, do not write out the EDPL per pquery, but just the histogram file. "
-        "As the list needs to keep all pquery names in memory (to get the correct order), "
-        "the memory requirements might be too large. In that case, this option can help."
+        "The list is streamed while the samples are being processed, so this is mostly "
+        "useful to avoid a very large output file, not for memory reasons."
     )->group( "Settings" );
 
     // Output
@@ -109,6 +117,167 @@ void setup_edpl( CLI::App& app )
     ));
 }
 
+// =================================================================================================
+//      Packed Node Distances
+// =================================================================================================
+
+/**
+ * @brief Pairwise node distance matrix of the reference tree, stored as the single precision
+ * upper triangle only.
+ *
+ * The matrix is symmetric with a zero diagonal, so storing the full double matrix wastes
+ * memory; for a 50k node tree, it alone needs 20 GB, while the packed single precision half
+ * fits in a quarter of that. Single precision is still far beyond the branch length resolution
+ * of typical input trees. The matrix is built row by row in parallel, so that the full double
+ * matrix never needs to be materialized either.
+ */
+class PackedNodeDistances
+{
+public:
+
+    explicit PackedNodeDistances( genesis::tree::Tree const& tree )
+        : node_count_( tree.node_count() )
+    {
+        auto const packed_size = node_count_ * ( node_count_ + 1 ) / 2;
+
+        // With --tree-cache-dir set, try to load the matrix from a previous run on the
+        // same tree; the fingerprint includes the branch lengths, which the distances
+        // depend on. On a miss, compute and store it for the next command in the pipeline.
+        auto const fingerprint = tree_metric_fingerprint( tree );
+        if( tree_cache_load( fingerprint, "node-distances-f32", packed_size, values_ )) {
+            return;
+        }
+
+        values_.resize( packed_size );
+        #pragma omp parallel for schedule(dynamic)
+        for( size_t i = 0; i < node_count_; ++i ) {
+            auto const row = genesis::tree::node_branch_length_distance_vector(
+                tree, &tree.node_at( i )
+            );
+            auto const offset = row_offset_( i );
+            for( size_t j = i; j < node_count_; ++j ) {
+                values_[ offset + ( j - i ) ] = static_cast<float>( row[ j ] );
+            }
+        }
+        tree_cache_store( fingerprint, "node-distances-f32", values_ );
+    }
+
+    double operator()( size_t i, size_t j ) const
+    {
+        if( i > j ) {
+            std::swap( i, j );
+        }
+        assert( j < node_count_ );
+        return values_[ row_offset_( i ) + ( j - i ) ];
+    }
+
+    size_t node_count() const
+    {
+        return node_count_;
+    }
+
+private:
+
+    size_t row_offset_( size_t i ) const
+    {
+        // The rows above row i hold ( node_count_ - k ) entries each, for k < i.
+        return i * node_count_ - i * ( i - 1 ) / 2;
+    }
+
+    size_t node_count_;
+    std::vector<float> values_;
+};
+
+/**
+ * @brief Per-edge data of the reference tree that the edpl kernel needs:
+ * node indices of both ends and the branch length, indexed by edge index.
+ *
+ * All samples share the tree, so these arrays are built once and then shared
+ * read-only across the per-sample loop, like the node distance matrix.
+ */
+struct EdgeEndpoints
+{
+    explicit EdgeEndpoints( genesis::tree::Tree const& tree )
+        : primary_nodes( tree.edge_count() )
+        , secondary_nodes( tree.edge_count() )
+        , branch_lengths( tree.edge_count() )
+    {
+        for( auto const& edge : tree.edges() ) {
+            primary_nodes[ edge.index() ]   = edge.primary_node().index();
+            secondary_nodes[ edge.index() ] = edge.secondary_node().index();
+            branch_lengths[ edge.index() ]
+                = edge.data<genesis::tree::CommonEdgeData>().branch_length
+            ;
+        }
+    }
+
+    std::vector<size_t> primary_nodes;
+    std::vector<size_t> secondary_nodes;
+    std::vector<double> branch_lengths;
+};
+
+/**
+ * @brief Expected Distance between Placement Locations of a pquery, using the packed
+ * node distances. Computes the same value as the genesis edpl() on the full matrix.
+ *
+ * For pqueries with many placements, the pairwise loop dominates. The per-placement data
+ * is read from the contiguous columns of the sample view, with the edge endpoint data
+ * looked up from small shared per-edge arrays, so that the inner loop is free of pointer
+ * chasing and branches, and can be vectorized by the compiler.
+ */
+double packed_edpl_(
+    SampleColumns const& columns,
+    size_t pquery_index,
+    PackedNodeDistances const& node_distances,
+    EdgeEndpoints const& edges
+) {
+    auto const begin = columns.placements_begin( pquery_index );
+    auto const end   = columns.placements_end( pquery_index );
+    auto const num_placements = end - begin;
+    if( num_placements < 2 ) {
+        return 0.0;
+    }
+
+    // Base pointers into the placement columns of this pquery.
+    auto const* lwr  = columns.like_weight_ratios.data() + begin;
+    auto const* prox = columns.proximal_lengths.data() + begin;
+    auto const* edge = columns.edge_indices.data() + begin;
+
+    // Weighted pairwise sum kernel. Per row, the distance cases are computed branch-free
+    // for all pairs, with the rare same-edge case folded in via a select, so that the
+    // inner loop vectorizes.
+    double sum = 0.0;
+    for( size_t i = 0; i < num_placements; ++i ) {
+        auto const lwr_i  = lwr[i];
+        auto const prox_i = prox[i];
+        auto const edge_i = edge[i];
+        auto const dist_i = edges.branch_lengths[ edge_i ] - prox_i;
+        auto const pri_i  = edges.primary_nodes[ edge_i ];
+        auto const sec_i  = edges.secondary_nodes[ edge_i ];
+
+        double row_sum = 0.0;
+        #pragma omp simd reduction(+:row_sum)
+        for( size_t j = i + 1; j < num_placements; ++j ) {
+            auto const edge_j = edge[j];
+            auto const pri_j  = edges.primary_nodes[ edge_j ];
+            auto const pp = prox_i + node_distances( pri_i, pri_j ) + prox[j];
+            auto const pd = prox_i + node_distances( pri_i, edges.secondary_nodes[ edge_j ] )
+                          + edges.branch_lengths[ edge_j ] - prox[j];
+            auto const dp = dist_i + node_distances( sec_i, pri_j ) + prox[j];
+            auto const path_dist = std::min( pp, std::min( pd, dp ));
+            auto const dist = ( edge_i == edge_j )
+                ? std::abs( prox_i - prox[j] )
+                : path_dist
+            ;
+            row_sum += lwr_i * lwr[j] * dist;
+        }
+        sum += row_sum;
+    }
+
+    // Each unordered pair contributes twice to the expectation.
+    return 2.0 * sum;
+}
+
 // =================================================================================================
 //      Run
 // =================================================================================================
@@ -132,28 +301,64 @@ void run_edpl( EdplOptions const& options )
 
     // Prepare intermediate data.
     Tree tree;
-    utils::Matrix<double> node_distances;
+    std::unique_ptr<PackedNodeDistances> node_distances;
+    std::unique_ptr<EdgeEndpoints> edge_endpoints;
     size_t file_count = 0;
     double max_edpl = - std::numeric_limits<double>::infinity();
 
-    // Helper for expressiveness and conciseness.
-    // Stores an edpl value for a pquery name.
-    struct NameEdpl
-    {
-        std::string name;
-        double      mult;
-        double      edpl;
-    };
-
-    // Prepare result. The outer vector is indexed by samples, the inner lists the pquery names
-    // and their edpl per pquery. That is, pqueries with multiple names get multiple entries here.
-    // We store this first so that the result file is written in the correct order.
-    // Not nice, but the data size should be okay. If this ever leads to memory issues,
-    // we need to re-think the parallelization scheme...
-    auto edpl_values = std::vector<std::vector<NameEdpl>>( options.jplace_input.file_count() );
-
-    // Read all jplace files.
-    #pragma omp parallel for schedule(dynamic)
+    // Read the reference tree from the first input file, and compute its node distance
+    // matrix and per-edge data once up front. All samples share the tree, so both can
+    // then be shared read-only across the parallel per-sample loop below.
+    if( options.jplace_input.file_count() > 0 ) {
+        tree = options.jplace_input.sample( 0 ).tree();
+        LOG_MSG2 << "Computing the node distance matrix of the reference tree.";
+        node_distances = std::unique_ptr<PackedNodeDistances>(
+            new PackedNodeDistances( tree )
+        );
+        edge_endpoints = std::unique_ptr<EdgeEndpoints>(
+            new EdgeEndpoints( tree )
+        );
+    }
+
+    // With a fixed histogram range (--histogram-max), the bins are known up front, and the
+    // values can be accumulated into per-thread histograms right away, which are merged at
+    // the end. With the automatic range (default), the bin edges depend on the overall
+    // maximum, so the values are kept until all samples are done -- but only as compact
+    // (edpl, multiplicity) pairs per thread, without the name strings of the old all-in-one
+    // result storage, which dominated the memory for large archives.
+    bool const streaming_hist = options.histogram_max > 0.0;
+    #if defined( GENESIS_OPENMP )
+        auto const num_buckets = static_cast<size_t>( omp_get_max_threads() );
+    #else
+        auto const num_buckets = static_cast<size_t>( 1 );
+    #endif
+    auto thread_hists = std::vector<Histogram>();
+    if( streaming_hist ) {
+        thread_hists.assign(
+            num_buckets, Histogram( options.histogram_bins, 0.0, options.histogram_max )
+        );
+    }
+    auto thread_values = std::vector<std::vector<std::pair<double, double>>>(
+        streaming_hist ? 0 : num_buckets
+    );
+
+    // The list file is streamed while the samples are being processed: each file's rows are
+    // handed to the writer once all preceding files have been written, so that the rows keep
+    // their input order, and only the files currently in flight are ever buffered.
+    std::shared_ptr<genesis::utils::BaseOutputTarget> list_ofs;
+    if( ! options.no_list_file ) {
+        list_ofs = options.file_output.get_output_target( "edpl_list", "csv" );
+        (*list_ofs) << "Sample,Pquery,Multiplicity,EDPL\n";
+    }
+    std::map<size_t, std::string> pending_rows;
+    size_t next_list_file = 0;
+
+    // Read all jplace files. With multiple files, we parallelize across them; with a
+    // single file, across its pqueries instead, so that large single samples also
+    // use all cores.
+    bool const parallel_files = options.jplace_input.file_count() > 1;
+    auto const max_in_flight = options.jplace_input.max_concurrent_samples();
+    #pragma omp parallel for schedule(dynamic) if( parallel_files ) num_threads( max_in_flight )
     for( size_t fi = 0; fi < options.jplace_input.file_count(); ++fi ) {
 
         // User output
@@ -163,75 +368,87 @@ void run_edpl( EdplOptions const& options )
         // Read in file.
         auto const sample = options.jplace_input.sample( fi );
 
-        // Check whether the tree is the same, and get its distance matrix.
-        #pragma omp critical(GAPPA_EDPL_TREE)
-        {
-            // Tree
-            if( tree.empty() ) {
-                assert( node_distances.empty() );
-                tree = sample.tree();
-                node_distances = node_branch_length_distance_matrix( tree );
-            } else if( ! genesis::placement::compatible_trees( tree, sample.tree() ) ) {
-                throw std::runtime_error( "Input jplace files have differing reference trees." );
-            }
-            assert( ! node_distances.empty() );
+        // Check whether the tree is the same. The distance matrix itself is precomputed
+        // and only read here, so no synchronization is needed.
+        if( ! genesis::placement::compatible_trees( tree, sample.tree() ) ) {
+            throw std::runtime_error( "Input jplace files have differing reference trees." );
         }
 
         // Some safety instead of an assertion.
         if(
             tree.empty() ||
-            node_distances.rows() != tree.node_count() ||
-            node_distances.cols() != tree.node_count()
+            ! node_distances || ! edge_endpoints ||
+            node_distances->node_count() != tree.node_count()
         ) {
             throw std::runtime_error( "Internal Error: Distance matrix disagrees with tree." );
         }
 
-        // Calculate the edpl for the sample and store it per pquery name.
-        // We reserve entries for each pquery. If there are pqueries with multiple names,
-        // this will lead to reallocation, but in the standard case, this is faster.
-        // Also, we later copy the entries to the result, to make sure we do not store more data
-        // than necessary.
-        assert( fi < edpl_values.size() && edpl_values[fi].empty() );
-        auto temp = std::vector<NameEdpl>();
-        temp.reserve( sample.size() );
-
-        for( auto const& pquery : sample ) {
-            auto const edplv = edpl( pquery, node_distances );
-            max_edpl = std::max( max_edpl, edplv );
-
-            // If we do not write a list file, we can simply add empty strings.
-            // This is a bit inefficient, but makes the rest of the code so much easier.
-            // Good enough for now.
-            if( options.no_list_file ) {
-                auto const mult = total_multiplicity( pquery );
-                temp.push_back({ "", mult, edplv });
+        // Gather the placement data of the sample into contiguous columns,
+        // which the edpl kernel below then reads without any pointer chasing.
+        auto const columns = sample_columns( sample );
+
+        // Compute the edpl per pquery. This is the expensive part, so if the files
+        // themselves are not processed in parallel, we parallelize here.
+        auto edpls = std::vector<double>( sample.size() );
+        #pragma omp parallel for schedule(dynamic) if( ! parallel_files )
+        for( size_t pi = 0; pi < sample.size(); ++pi ) {
+            edpls[pi] = packed_edpl_( columns, pi, *node_distances, *edge_endpoints );
+        }
+
+        // Accumulate the values into the histogram store of this thread, and format the
+        // list rows of this sample. The histogram uses the total multiplicity per pquery,
+        // which equals the sum over its per-name entries of the list.
+        #if defined( GENESIS_OPENMP )
+            auto const bucket = static_cast<size_t>( omp_get_thread_num() );
+        #else
+            auto const bucket = static_cast<size_t>( 0 );
+        #endif
+        assert( bucket < num_buckets );
+        std::ostringstream rows;
+        auto const& file_name = options.jplace_input.base_file_name( fi );
+        double local_max = - std::numeric_limits<double>::infinity();
+        for( size_t pi = 0; pi < sample.size(); ++pi ) {
+            auto const edplv = edpls[pi];
+            auto const mult = columns.multiplicities[pi];
+            local_max = std::max( local_max, edplv );
+
+            if( streaming_hist ) {
+                thread_hists[ bucket ].accumulate( edplv, mult );
             } else {
-                for( auto const& name : pquery.names() ) {
-                    temp.push_back({ name.name, name.multiplicity, edplv });
+                thread_values[ bucket ].emplace_back( edplv, mult );
+            }
+            if( ! options.no_list_file ) {
+                for( auto const& name : sample.at( pi ).names() ) {
+                    rows << file_name << "," << name.name << "," << name.multiplicity
+                         << "," << edplv << "\n";
                 }
             }
         }
-        edpl_values[fi] = temp;
-    }
-
-    // User output
-    LOG_MSG1 << "Writing output files.";
 
-    if( ! options.no_list_file ) {
-        // Prepare list file
-        auto list_ofs = options.file_output.get_output_target( "edpl_list", "csv" );
-
-        // Write list file.
-        (*list_ofs) << "Sample,Pquery,Multiplicity,EDPL\n";
-        for( size_t fi = 0; fi < options.jplace_input.file_count(); ++fi ) {
-            auto const file_name = options.jplace_input.base_file_name( fi );
+        // Merge the per-file maximum into the global one.
+        #pragma omp critical(GAPPA_EDPL_MAX)
+        {
+            max_edpl = std::max( max_edpl, local_max );
+        }
 
-            for( auto const& entry : edpl_values[fi] ) {
-                (*list_ofs) << file_name << "," << entry.name << "," << entry.mult;
-                (*list_ofs) << "," << entry.edpl << "\n";
+        // Stream out the list rows, in input file order.
+        if( ! options.no_list_file ) {
+            #pragma omp critical(GAPPA_EDPL_LIST)
+            {
+                pending_rows[ fi ] = rows.str();
+                while( pending_rows.count( next_list_file ) > 0 ) {
+                    (*list_ofs) << pending_rows[ next_list_file ];
+                    pending_rows.erase( next_list_file );
+                    ++next_list_file;
+                }
             }
         }
     }
+    assert( pending_rows.empty() );
+
+    // User output. The list file has already been streamed at this point.
+    LOG_MSG1 << "Writing output files.";
+    list_ofs.reset();
 
     // Get the max value to use for the histogram. Use a warning if needed.
     if( options.histogram_max > 0.0 && options.histogram_max < 0.75 * max_edpl ) {
@@ -259,11 +476,20 @@ void run_edpl( EdplOptions const& options )
     }
     auto const hist_max = options.histogram_max < 0.0 ? max_edpl : options.histogram_max;
 
-    // Make and fill the histogram.
+    // Make and fill the histogram: either by merging the per-thread bin counters,
+    // or, with the automatic range, from the retained per-thread value pairs.
     auto hist = Histogram( options.histogram_bins, 0.0, hist_max );
-    for( size_t fi = 0; fi < options.jplace_input.file_count(); ++fi ) {
-        for( auto const& entry : edpl_values[fi] ) {
-            hist.accumulate( entry.edpl, entry.mult );
+    if( streaming_hist ) {
+        for( auto const& thread_hist : thread_hists ) {
+            for( size_t i = 0; i < hist.bins(); ++i ) {
+                hist.accumulate_bin( i, thread_hist[i] );
+            }
+        }
+    } else {
+        for( auto const& values : thread_values ) {
+            for( auto const& entry : values ) {
+                hist.accumulate( entry.first, entry.second );
+            }
         }
     }
 
@@ -109,11 +109,15 @@ void run_graft( GraftOptions const& options )
     // so the assignment does not change.
 
     size_t file_counter = 0;
-    #pragma omp parallel for schedule(dynamic)
+    auto const max_in_flight = options.jplace_input.max_concurrent_samples();
+    #pragma omp parallel for schedule(dynamic) num_threads( max_in_flight )
     for( size_t i = 0; i < options.jplace_input.file_count(); ++i ) {
 
         // User output.
-        LOG_MSG2 << "Reading file " << ( ++file_counter ) << " of " << options.jplace_input.file_count()
+        size_t current_counter;
+        #pragma omp atomic capture
+        current_counter = ++file_counter;
+        LOG_MSG2 << "Reading file " << current_counter << " of " << options.jplace_input.file_count()
                  << ": " << options.jplace_input.file_path( i );
 
         // Read the sample and make the tree.
@@ -25,19 +25,22 @@
 
 #include "options/global.hpp"
 #include "tools/cli_setup.hpp"
+#include "tools/sample_columns.hpp"
 
 #include "CLI/CLI.hpp"
 
 #include "genesis/placement/formats/jplace_reader.hpp"
 #include "genesis/placement/function/helper.hpp"
-#include "genesis/placement/function/masses.hpp"
 #include "genesis/placement/function/operators.hpp"
 #include "genesis/placement/function/tree.hpp"
 #include "genesis/tree/common_tree/newick_writer.hpp"
+#include "genesis/utils/color/color.hpp"
 #include "genesis/utils/core/fs.hpp"
 
 #include <algorithm>
+#include <memory>
 #include <stdexcept>
+#include <vector>
 
 #ifdef GENESIS_OPENMP
 #   include <omp.h>
@@ -62,6 +65,17 @@ void setup_heat_tree( CLI::App& app )
     options->jplace_input.add_point_mass_opt_to_app( sub );
     options->jplace_input.add_ignore_multiplicities_opt_to_app( sub );
 
+    // Per sample mode.
+    sub->add_flag(
+        "--per-sample-trees",
+        options->per_sample_trees,
+        "Instead of accumulating the masses of all samples into one tree, write one heat tree "
+        "per input sample, using the sample file name as the output file name. All samples are "
+        "processed within one invocation, in parallel, which is considerably faster than one "
+        "run of this command per sample. The color scaling is computed per sample; set "
+        "--min-value and --max-value to get a scale that is comparable across samples."
+    )->group( "Settings" );
+
     // Color. We allow max, but not min, as this is always 0.
     options->color_map.add_color_list_opt_to_app( sub, "BuPuBk" );
     options->color_map.add_under_opt_to_app( sub );
@@ -87,12 +101,145 @@ void setup_heat_tree( CLI::App& app )
     ));
 }
 
+// =================================================================================================
+//      Run Helpers
+// =================================================================================================
+
+/**
+ * @brief Prepare the color normalization for a set of edge masses: autoscale,
+ * apply the log-scaling safety handling, and overwrite with the user settings.
+ *
+ * The masses may be modified by the zero-handling for log scaling.
+ */
+static std::unique_ptr<genesis::utils::ColorNormalizationLinear> prepare_heat_tree_color_norm_(
+    HeatTreeOptions const& options,
+    std::vector<double>& masses
+) {
+    auto color_norm = options.color_norm.get_sequential_norm();
+
+    // First, autoscale to get the max.
+    // Finally, apply the user settings that might have been provided.
+    color_norm->autoscale( masses );
+    auto const auto_min = color_norm->min_value();
+    if( options.color_norm.log_scaling() ) {
+
+        // Some user friendly safety. Min of 0 does not work with log scaling.
+        // Instead, if we have a max > 1, we set min to 1, which is a good case for absolute abundances.
+        // For relative abundances (normalized samples), the max is < 1, so we set the min to some
+        // value below that that spans some orders of magnitude. This is all used as default anyway,
+        // as users can overwrite this via --min-value.
+        if( color_norm->min_value() <= 0.0 ) {
+            if( color_norm->max_value() > 1.0 ) {
+                color_norm->min_value( 1.0 );
+            } else {
+                color_norm->min_value( color_norm->max_value() / 10e4 );
+            }
+            // color_map.clip_under( true );
+        }
+
+    } else {
+        color_norm->min_value( 0.0 );
+    }
+
+    // Now overwrite the above "default" settings with what the user specified
+    // (in case that they actually did specify certain values).
+    options.color_norm.apply_options( *color_norm );
+
+    // Issue a warning if we needed to set the min due to log, but there was no manual overwrite,
+    // and if this leads to having under values.
+    if( options.color_norm.log_scaling() && auto_min <= 0.0 ) {
+        if( ! *options.color_norm.min_value_option && ! *options.color_map.clip_under_option ) {
+            LOG_WARN << "Warning: Some branches have mass 0, which cannot be shown using --log-scaling. "
+                     << "Hence, the minimum was set to " << color_norm->min_value() << " instead.\n"
+                     << "This will lead to those branches being shown in the color specified by "
+                     << "--mask-color. Use --clip-under and --min-value to change this.";
+        } else {
+
+            // The log color norm yields -inf for 0 values.
+            // But if we have clip under or a min value, this is not what we want.
+            // So, set 0 values to something that is not invalid.
+            for( auto& v : masses ) {
+                if( v <= 0.0 ) {
+                    v = color_norm->min_value() / 2.0;
+                }
+            }
+        }
+    }
+
+    return color_norm;
+}
+
+/**
+ * @brief Run the per sample mode: one heat tree per input file, see --per-sample-trees.
+ */
+static void run_heat_tree_per_sample_( HeatTreeOptions const& options )
+{
+    using namespace genesis;
+    using namespace genesis::placement;
+
+    // Prepare output file names and check if any of them already exists. If so, fail early.
+    std::vector<std::pair<std::string, std::string>> files_to_check;
+    for( size_t fi = 0; fi < options.jplace_input.file_count(); ++fi ) {
+        for( auto const& e : options.tree_output.get_extensions() ) {
+            files_to_check.push_back({ options.jplace_input.base_file_name( fi ), e });
+        }
+    }
+    options.file_output.check_output_files_nonexistence( files_to_check );
+
+    // User is warned when not using any tree outputs.
+    options.tree_output.check_tree_formats();
+
+    // User output.
+    options.jplace_input.print();
+
+    // Each sample yields an independent tree, so we render them in parallel.
+    // With a single file, the mass accumulation is threaded instead.
+    size_t file_count = 0;
+    bool const parallel_files = options.jplace_input.file_count() > 1;
+    auto const max_in_flight = options.jplace_input.max_concurrent_samples();
+    #pragma omp parallel for schedule(dynamic) if( parallel_files ) num_threads( max_in_flight )
+    for( size_t fi = 0; fi < options.jplace_input.file_count(); ++fi ) {
+
+        // User output
+        LOG_MSG2 << "Processing file " << ( ++file_count ) << " of "
+                 << options.jplace_input.file_count()
+                 << ": " << options.jplace_input.file_path( fi );
+
+        // Read in file. This also already applies all normalizations,
+        // so that no further accumulation or scaling of the masses is needed here.
+        auto const sample = options.jplace_input.sample( fi );
+        auto masses = accumulate_edge_masses( sample, ! parallel_files );
+
+        // Get color map and norm for this sample.
+        auto const color_map = options.color_map.color_map();
+        auto const color_norm = prepare_heat_tree_color_norm_( options, masses );
+
+        // Make the color vector and write the tree files for this sample.
+        auto const colors = ColorMapOptions::map_colors( color_map, *color_norm, masses );
+        options.tree_output.write_tree_to_files(
+            sample.tree(),
+            colors,
+            color_map,
+            *color_norm,
+            options.file_output,
+            options.jplace_input.base_file_name( fi )
+        );
+    }
+}
+
 // =================================================================================================
 //      Run
 // =================================================================================================
 
 void run_heat_tree( HeatTreeOptions const& options )
 {
+    // The per sample mode shares the coloring with the accumulated mode,
+    // but has its own output naming and main loop.
+    if( options.per_sample_trees ) {
+        run_heat_tree_per_sample_( options );
+        return;
+    }
+
     using namespace genesis;
     using namespace genesis::placement;
     using namespace genesis::tree;
@@ -116,7 +263,10 @@ void run_heat_tree( HeatTreeOptions const& options )
     size_t file_count = 0;
 
     // Read all jplace files and accumulate their masses.
-    #pragma omp parallel for schedule(dynamic)
+    // With a single file, the mass accumulation is threaded instead.
+    bool const parallel_files = options.jplace_input.file_count() > 1;
+    auto const max_in_flight = options.jplace_input.max_concurrent_samples();
+    #pragma omp parallel for schedule(dynamic) if( parallel_files ) num_threads( max_in_flight )
     for( size_t fi = 0; fi < options.jplace_input.file_count(); ++fi ) {
 
         // User output
@@ -127,7 +277,7 @@ void run_heat_tree( HeatTreeOptions const& options )
         auto const sample = options.jplace_input.sample( fi );
 
         // Get masses per edge.
-        auto const masses = placement_mass_per_edges_with_multiplicities( sample );
+        auto const masses = accumulate_edge_masses( sample, ! parallel_files );
 
         // The main accumulation is single threaded.
         // We could optimize more, but seriously, it is fast enough already.
@@ -161,61 +311,13 @@ void run_heat_tree( HeatTreeOptions const& options )
         }
     }
 
-    // Get color map and norm.
-    auto color_map  = options.color_map.color_map();
-    auto color_norm = options.color_norm.get_sequential_norm();
-
-    // First, autoscale to get the max.
-    // Finally, apply the user settings that might have been provided.
-    color_norm->autoscale( total_masses );
-    auto const auto_min = color_norm->min_value();
-    if( options.color_norm.log_scaling() ) {
-
-        // Some user friendly safety. Min of 0 does not work with log scaling.
-        // Instead, if we have a max > 1, we set min to 1, which is a good case for absolute abundances.
-        // For relative abundances (normalized samples), the max is < 1, so we set the min to some
-        // value below that that spans some orders of magnitude. This is all used as default anyway,
-        // as users can overwrite this via --min-value.
-        if( color_norm->min_value() <= 0.0 ) {
-            if( color_norm->max_value() > 1.0 ) {
-                color_norm->min_value( 1.0 );
-            } else {
-                color_norm->min_value( color_norm->max_value() / 10e4 );
-            }
-            // color_map.clip_under( true );
-        }
-
-    } else {
-        color_norm->min_value( 0.0 );
-    }
-
-    // Now overwrite the above "default" settings with what the user specified
-    // (in case that they actually did specify certain values).
-    options.color_norm.apply_options( *color_norm );
-
-    // Issue a warning if we needed to set the min due to log, but there was no manual overwrite,
-    // and if this leads to having under values.
-    if( options.color_norm.log_scaling() && auto_min <= 0.0 ) {
-        if( ! *options.color_norm.min_value_option && ! *options.color_map.clip_under_option ) {
-            LOG_WARN << "Warning: Some branches have mass 0, which cannot be shown using --log-scaling. "
-                     << "Hence, the minimum was set to " << color_norm->min_value() << " instead.\n"
-                     << "This will lead to those branches being shown in the color specified by "
-                     << "--mask-color. Use --clip-under and --min-value to change this.";
-        } else {
-
-            // The log color norm yields -inf for 0 values.
-            // But if we have clip under or a min value, this is not what we want.
-            // So, set 0 values to something that is not invalid.
-            for( auto& v : total_masses ) {
-                if( v <= 0.0 ) {
-                    v = color_norm->min_value() / 2.0;
-                }
-            }
-        }
-    }
+    // Get color map and norm, scaled to the accumulated masses.
+    auto const color_map  = options.color_map.color_map();
+    auto const color_norm = prepare_heat_tree_color_norm_( options, total_masses );
 
-    // Now, make a color vector and write to files.
-    auto const colors = color_map( *color_norm, total_masses );
+    // Now, make a color vector and write to files. The per-edge color lookups are
+    // independent of each other, so for large trees we compute them in parallel.
+    auto const colors = ColorMapOptions::map_colors( color_map, *color_norm, total_masses );
     options.tree_output.write_tree_to_files(
         tree,
         colors,
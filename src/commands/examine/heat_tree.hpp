@@ -44,6 +44,8 @@ class HeatTreeOptions
 {
 public:
 
+    bool per_sample_trees = false;
+
     ColorMapOptions    color_map;
     ColorNormOptions   color_norm;
     JplaceInputOptions jplace_input;
@@ -28,12 +28,15 @@
 
 #include "CLI/CLI.hpp"
 
-#include "genesis/tree/function/functions.hpp"
+#include "genesis/utils/io/input_source.hpp"
+#include "genesis/utils/io/input_stream.hpp"
 
 #include <algorithm>
 #include <cassert>
+#include <cstring>
 #include <ios>
 #include <iomanip>
+#include <string>
 
 #ifdef GENESIS_OPENMP
 #   include <omp.h>
@@ -66,6 +69,128 @@ void setup_info( CLI::App& app )
     ));
 }
 
+// =================================================================================================
+//      Streaming Scan
+// =================================================================================================
+
+/**
+ * @brief Statistics of one jplace file, as obtained from its raw character stream.
+ */
+struct JplaceFileInfo
+{
+    size_t branches = 0;
+    size_t leaves   = 0;
+    size_t pqueries = 0;
+};
+
+/**
+ * @brief Count the basic statistics of a jplace file by scanning its character stream,
+ * without materializing the json document or a Sample.
+ *
+ * We only need the counts here: the pqueries are the objects directly within the top-level
+ * `placements` array, the branches are the `{...}` edge number annotations of the reference
+ * tree, and the leaves are its comma-separated taxa. All of these can be obtained from a
+ * single pass over the raw characters, tracking json strings and nesting depth, which takes
+ * constant memory regardless of the file size.
+ */
+JplaceFileInfo scan_jplace_file( std::string const& path )
+{
+    using namespace genesis::utils;
+
+    JplaceFileInfo info;
+    InputStream it( from_file( path ));
+
+    // Parser state: whether we are in a string (with escapes), the content of the most
+    // recently finished string, the key that awaits its value (only tracked for the
+    // top-level object), the current nesting depth of objects and arrays combined,
+    // and the depth of the top-level placements array, if we are inside it.
+    bool in_string = false;
+    bool escaped   = false;
+    std::string token;
+    std::string pending_key;
+    size_t depth = 0;
+    long placements_depth = -1;
+
+    while( it ) {
+        char const c = *it;
+        ++it;
+
+        // Within strings, we only look for the closing quote, and collect the content.
+        if( in_string ) {
+            if( escaped ) {
+                escaped = false;
+                token += c;
+            } else if( c == '\\' ) {
+                escaped = true;
+            } else if( c == '"' ) {
+                in_string = false;
+
+                // A finished string can be the tree value that we are waiting for.
+                if( depth == 1 && pending_key == "tree" ) {
+                    for( auto const tc : token ) {
+                        if( tc == '{' ) {
+                            ++info.branches;
+                        } else if( tc == ',' ) {
+                            ++info.leaves;
+                        }
+                    }
+                    if( info.leaves > 0 || info.branches > 0 ) {
+                        ++info.leaves;
+                    }
+                    pending_key.clear();
+                }
+            } else {
+                token += c;
+            }
+            continue;
+        }
+
+        switch( c ) {
+            case '"': {
+                in_string = true;
+                token.clear();
+                break;
+            }
+            case ':': {
+                // The most recently finished string was a key.
+                pending_key = token;
+                break;
+            }
+            case '{': {
+                if( placements_depth >= 0 && depth == static_cast<size_t>( placements_depth )) {
+                    ++info.pqueries;
+                }
+                ++depth;
+                pending_key.clear();
+                break;
+            }
+            case '[': {
+                if( depth == 1 && pending_key == "placements" ) {
+                    placements_depth = static_cast<long>( depth ) + 1;
+                }
+                ++depth;
+                pending_key.clear();
+                break;
+            }
+            case '}':
+            case ']': {
+                assert( depth > 0 );
+                --depth;
+                if( placements_depth >= 0 && depth < static_cast<size_t>( placements_depth )) {
+                    placements_depth = -1;
+                }
+                break;
+            }
+            default: {
+                // Other value characters (numbers, bools, whitespace) are not needed.
+                break;
+            }
+        }
+    }
+
+    return info;
+}
+
 // =================================================================================================
 //      Run
 // =================================================================================================
@@ -73,55 +198,44 @@ void setup_info( CLI::App& app )
 void run_info( InfoOptions const& options )
 {
     using namespace genesis;
-    using namespace genesis::placement;
-    using namespace genesis::tree;
     using namespace genesis::utils;
 
     // Print some user output.
     options.jplace_input.print();
 
-    // Helper for expressiveness and conciseness.
-    struct SampleInfo
-    {
-        std::string name;
-        size_t      branches;
-        size_t      leaves;
-        size_t      pqueries;
-    };
+    // The file names are known up front, so we can compute the table layout and print the
+    // header before reading anything, and then print each row as its file completes,
+    // without keeping any per-sample data around.
+    size_t name_width = std::strlen( "Sample" );
+    for( auto const& bfn : options.jplace_input.base_file_names() ) {
+        name_width = std::max( name_width, bfn.size() );
+    }
 
-    // Prepare result. The vector is indexed by samples.
-    auto sample_infos = std::vector<SampleInfo>( options.jplace_input.file_count() );
-    size_t name_width = 0;
+    LOG_BOLD;
+    LOG_MSG1 << std::left << std::setw( name_width + 1 ) << "Sample"
+             << "    Branches      Leaves    Pqueries";
 
-    // Read all jplace files.
+    // Scan all jplace files, streaming their statistics from the raw character stream.
     size_t file_count = 0;
     #pragma omp parallel for schedule(dynamic)
     for( size_t fi = 0; fi < options.jplace_input.file_count(); ++fi ) {
 
         // User output
-        LOG_MSG2 << "Processing file " << ( ++file_count ) << " of " << options.jplace_input.file_count()
+        size_t current_count;
+        #pragma omp atomic capture
+        current_count = ++file_count;
+        LOG_MSG2 << "Processing file " << current_count << " of " << options.jplace_input.file_count()
                  << ": " << options.jplace_input.file_path( fi );
 
-        // Read in file.
-        auto sample = options.jplace_input.sample( fi );
-
-        // Store result.
-        assert( fi < sample_infos.size() );
-        sample_infos[fi].name = options.jplace_input.base_file_name( fi );
-        sample_infos[fi].branches = sample.tree().edge_count();
-        sample_infos[fi].leaves = genesis::tree::leaf_node_count( sample.tree() );
-        sample_infos[fi].pqueries = sample.size();
-
-        name_width = std::max( name_width, sample_infos[fi].name.size() );
-    }
-
-    LOG_BOLD;
-    LOG_MSG1 << std::left << std::setw( name_width + 1 ) << "Sample"
-             << "    Branches      Leaves    Pqueries";
-    for( auto const& info : sample_infos ) {
-        LOG_MSG1 << std::left << std::setw( name_width + 1 ) << info.name
-                 << std::right << std::setw( 12 ) << info.branches
-                 << std::right << std::setw( 12 ) << info.leaves
-                 << std::right << std::setw( 12 ) << info.pqueries;
+        // Scan the file and print its row.
+        auto const info = scan_jplace_file( options.jplace_input.file_path( fi ));
+        #pragma omp critical(GAPPA_INFO_PRINT)
+        {
+            LOG_MSG1 << std::left << std::setw( name_width + 1 )
+                     << options.jplace_input.base_file_name( fi )
+                     << std::right << std::setw( 12 ) << info.branches
+                     << std::right << std::setw( 12 ) << info.leaves
+                     << std::right << std::setw( 12 ) << info.pqueries;
+        }
     }
 }
@@ -25,6 +25,7 @@
 
 #include "options/global.hpp"
 #include "tools/cli_setup.hpp"
+#include "tools/quantile_sketch.hpp"
 
 #include "CLI/CLI.hpp"
 
@@ -39,6 +40,7 @@
 #include <algorithm>
 #include <cassert>
 #include <fstream>
+#include <functional>
 #include <utility>
 #include <vector>
 
@@ -72,7 +74,10 @@ void setup_lwr_distribution( CLI::App& app )
         opt->num_entries,
         "Number of entries representing the pqueries. This is the length of the output table, "
         "representing the pquery LWR distribution. If set to 0, or if the input has fewer "
-        "pqueries that the given number, the output table will contain all pqueries.",
+        "pqueries that the given number, the output table will contain all pqueries. "
+        "With a fixed number of entries, the distribution is accumulated in a streaming "
+        "quantile sketch, so that memory stays bounded for arbitrarily large inputs; "
+        "the positions of the representative pqueries are then approximate.",
         true
     )->group( "Settings" );
 
@@ -158,8 +163,46 @@ void run_lwr_distribution( LwrDistributionOptions const& options )
     };
     auto collection = std::vector<LwrEntry>();
 
-    // Read all jplace files.
-    #pragma omp parallel for schedule(dynamic)
+    // The ordering of the output table: largest first, either by the weighted sort value,
+    // or lexicographically by the LWRs, see --numerical-sort.
+    std::function<bool( LwrEntry const&, LwrEntry const& )> order_entries;
+    if( options.numerical_sort ) {
+        order_entries = []( LwrEntry const& lhs, LwrEntry const& rhs ){
+            assert( lhs.lwrs.size() == rhs.lwrs.size() );
+
+            // Sort by LWR, starting with the most likely one.
+            // If those are identical, compare the second most likely, and so forth,
+            // until we find one that differs and which then gives the sort order.
+            // We sort by largest LWR first.
+            for( size_t i = 0; i < lhs.lwrs.size(); ++i ) {
+                if( lhs.lwrs[i] != rhs.lwrs[i] ) {
+                    return lhs.lwrs[i] > rhs.lwrs[i];
+                }
+            }
+            return false;
+        };
+    } else {
+        order_entries = []( LwrEntry const& lhs, LwrEntry const& rhs ){
+            // Simply sort by the pre-computed sort value.
+            // We sort by largest LWR sort value first.
+            return lhs.sort_value > rhs.sort_value;
+        };
+    }
+
+    // With a fixed number of output entries (the normal case), we do not need to hold all
+    // pqueries: the output rows sit at fixed quantile positions of the sorted collection,
+    // so a mergeable quantile sketch per file, merged across the parallel loop, suffices.
+    // Its buffer is sized so that the rank error stays well below the spacing between
+    // output rows, and memory stays bounded no matter how many pqueries the input has.
+    // Only when all pqueries are requested (--num-entries 0) do we collect them all.
+    bool const use_sketch = options.num_entries > 0;
+    auto const sketch_buffer = std::max<size_t>( 4096, 8 * options.num_entries );
+    auto sketch = ItemQuantileSketch<LwrEntry>( sketch_buffer, order_entries );
+
+    // Read all jplace files. The memory budget caps how many samples
+    // are held at once, see --memory-limit.
+    auto const max_in_flight = options.jplace_input.max_concurrent_samples();
+    #pragma omp parallel for schedule(dynamic) num_threads( max_in_flight )
     for( size_t fi = 0; fi < options.jplace_input.file_count(); ++fi ) {
 
         // User output
@@ -169,9 +212,13 @@ void run_lwr_distribution( LwrDistributionOptions const& options )
                  << ": " << options.jplace_input.file_path( fi );
 
         // Read in file.
-        auto sample = options.jplace_input.sample( fi );
+        auto sample = options.jplace_input.sample_prefetch( fi );
         sort_placements_by_weight( sample );
 
+        // Per-file sketch, merged into the shared one below, so that the accumulation
+        // runs without locking.
+        auto local_sketch = ItemQuantileSketch<LwrEntry>( sketch_buffer, order_entries );
+
         // Check whether the tree is the same. This is totally not needed for the calculation,
         // but the case where we want different trees to be summarized sounds more like and error.
         if( ! options.no_compat_check ) {
@@ -194,10 +241,12 @@ void run_lwr_distribution( LwrDistributionOptions const& options )
         // yield some speedup. We use the current capacity as a proxy for the current size
         // (we cannot use actual size, due to the parallel loop). This might cause the vector
         // to overshoot the needed size, but we can live with that.
-        auto const needed_extra_cap = total_name_count( sample );
-        #pragma omp critical(GAPPA_LWR_DIST_COLLECTION)
-        {
-            collection.reserve( collection.capacity() + needed_extra_cap );
+        if( ! use_sketch ) {
+            auto const needed_extra_cap = total_name_count( sample );
+            #pragma omp critical(GAPPA_LWR_DIST_COLLECTION)
+            {
+                collection.reserve( collection.capacity() + needed_extra_cap );
+            }
         }
 
         // The main accumulation is single threaded.
@@ -220,18 +269,25 @@ void run_lwr_distribution( LwrDistributionOptions const& options )
                 sort_value += lwr / static_cast<double>( n + 1 );
             }
 
-            // Now add the LWRs to the collection.
-            #pragma omp critical(GAPPA_LWR_DIST_COLLECTION)
-            {
-                // Add the values as often as the pquery has names,
-                // as each of them represents a different pquery.
-                LwrEntry entry;
-                entry.sample_index = fi;
-                entry.sort_value = sort_value;
-                entry.lwrs = std::move(lwrs);
+            // Now add the LWRs to the collection or the sketch.
+            // Add the values as often as the pquery has names,
+            // as each of them represents a different pquery.
+            LwrEntry entry;
+            entry.sample_index = fi;
+            entry.sort_value = sort_value;
+            entry.lwrs = std::move(lwrs);
+            if( use_sketch ) {
                 for( auto const& name : pquery.names() ) {
                     entry.pquery_name = name.name;
-                    collection.emplace_back( entry );
+                    local_sketch.insert( entry );
+                }
+            } else {
+                #pragma omp critical(GAPPA_LWR_DIST_COLLECTION)
+                {
+                    for( auto const& name : pquery.names() ) {
+                        entry.pquery_name = name.name;
+                        collection.emplace_back( entry );
+                    }
                 }
             }
 
@@ -241,38 +297,26 @@ void run_lwr_distribution( LwrDistributionOptions const& options )
             pquery.clear_placements();
             pquery.clear_names();
         }
+
+        // Fold the pqueries of this file into the shared sketch.
+        if( use_sketch ) {
+            #pragma omp critical(GAPPA_LWR_DIST_COLLECTION)
+            {
+                sketch.merge( std::move( local_sketch ));
+            }
+        }
     }
-    LOG_MSG1 << "Found " << collection.size() << " pqueries";
+    auto const total_pqueries = use_sketch ? sketch.count() : collection.size();
+    LOG_MSG1 << "Found " << total_pqueries << " pqueries";
 
-    // Sort according to needs
+    // Sort according to needs. In sketch mode, only the retained representatives are
+    // sorted, whose number is bounded by the sketch buffers; otherwise, all pqueries.
     LOG_MSG1 << "Sorting pqueries by LWR";
-    if( options.numerical_sort ) {
-        std::sort(
-            collection.begin(), collection.end(),
-            []( LwrEntry const& lhs, LwrEntry const& rhs ){
-                assert( lhs.lwrs.size() == rhs.lwrs.size() );
-
-                // Sort by LWR, starting with the most likely one.
-                // If those are identical, compare the second most likely, and so forth,
-                // until we find one that differs and which then gives the sort order.
-                // We sort by largest LWR first.
-                for( size_t i = 0; i < lhs.lwrs.size(); ++i ) {
-                    if( lhs.lwrs[i] != rhs.lwrs[i] ) {
-                        return lhs.lwrs[i] > rhs.lwrs[i];
-                    }
-                }
-                return false;
-            }
-        );
+    auto weighted = std::vector<ItemQuantileSketch<LwrEntry>::WeightedItem>();
+    if( use_sketch ) {
+        weighted = sketch.sorted_weighted_items();
     } else {
-        std::sort(
-            collection.begin(), collection.end(),
-            []( LwrEntry const& lhs, LwrEntry const& rhs ){
-                // Simply sort by the pre-computed sort value.
-                // We sort by largest LWR sort value first.
-                return lhs.sort_value > rhs.sort_value;
-            }
-        );
+        std::sort( collection.begin(), collection.end(), order_entries );
     }
 
     // Get the number of rows to write. In the normal case, we write `num_entries` many rows,
@@ -280,17 +324,21 @@ void run_lwr_distribution( LwrDistributionOptions const& options )
     // If there are not that many pqueries, we only write as many as there are;
     // if the number of output entries set by the user is 0, we also write all that there are.
     auto const max_e
-        = ( options.num_entries == 0 || collection.size() < options.num_entries )
-        ? collection.size()
+        = ( options.num_entries == 0 || total_pqueries < options.num_entries )
+        ? total_pqueries
         : options.num_entries
     ;
 
     // User output
-    if( max_e == collection.size() ) {
+    if( max_e == total_pqueries ) {
         LOG_MSG1 << "Writing output table with all " << max_e << " pqueries";
     } else {
         LOG_MSG1 << "Writing output table with " << max_e << " representative pqueries";
     }
+    if( use_sketch && ! sketch.is_exact() ) {
+        LOG_MSG2 << "The representatives are drawn from a streaming quantile sketch; "
+                 << "their positions in the overall LWR distribution are approximate.";
+    }
 
     // Prepare file
     auto ofs = options.file_output.get_output_target( "lwr-distribution", "csv" );
@@ -302,25 +350,41 @@ void run_lwr_distribution( LwrDistributionOptions const& options )
     }
     (*ofs) << ",Remainder\n";
 
-    // Write data rows.
+    // Write data rows. In sketch mode, we walk the cumulative weights of the sorted
+    // representatives along with the (increasing) target ranks, so that each row reports
+    // the representative covering the rank of its position in the distribution.
+    size_t wi = 0;
+    uint64_t cum_weight = 0;
     for( size_t e = 0; e < max_e; ++e ) {
 
         // Get the index of the pquery that sits at the e/max_e position in the collection.
         // We compute it so that the first and the last entry of the collection are always
         // part of the output.
-        auto const index = static_cast<size_t>(
-            static_cast<double>( collection.size() - 1 ) *
+        auto const index = max_e < 2 ? 0 : static_cast<size_t>(
+            static_cast<double>( total_pqueries - 1 ) *
             static_cast<double>( e ) /
             static_cast<double>( max_e - 1 )
         );
-        assert( index < collection.size() );
-        assert( collection[index].lwrs.size() == options.num_lwrs + 1 );
+        assert( index < total_pqueries );
+
+        LwrEntry const* entry;
+        if( use_sketch ) {
+            while( wi + 1 < weighted.size() && cum_weight + weighted[wi].weight <= index ) {
+                cum_weight += weighted[wi].weight;
+                ++wi;
+            }
+            assert( wi < weighted.size() );
+            entry = &weighted[wi].item;
+        } else {
+            entry = &collection[index];
+        }
+        assert( entry->lwrs.size() == options.num_lwrs + 1 );
 
         // Print the entry with all its LWRs.
         (*ofs) << (index + 1);
-        (*ofs) << "," << options.jplace_input.base_file_name( collection[index].sample_index );
-        (*ofs) << "," << collection[index].pquery_name;
-        for( auto const& v : collection[index].lwrs ) {
+        (*ofs) << "," << options.jplace_input.base_file_name( entry->sample_index );
+        (*ofs) << "," << entry->pquery_name;
+        for( auto const& v : entry->lwrs ) {
             (*ofs) << "," << v;
         }
         (*ofs) << "\n";
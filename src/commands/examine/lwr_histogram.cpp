@@ -25,6 +25,7 @@
 
 #include "options/global.hpp"
 #include "tools/cli_setup.hpp"
+#include "tools/sample_columns.hpp"
 
 #include "CLI/CLI.hpp"
 
@@ -127,8 +128,10 @@ void run_lwr_histogram( LwrHistogramOptions const& options )
     size_t name_count = 0;
     auto hists = std::vector<Histogram>( options.num_lwrs + 1, { options.histogram_bins, 0.0, 1.0 });
 
-    // Read all jplace files.
-    #pragma omp parallel for schedule(dynamic)
+    // Read all jplace files. The memory budget caps how many samples
+    // are held at once, see --memory-limit.
+    auto const max_in_flight = options.jplace_input.max_concurrent_samples();
+    #pragma omp parallel for schedule(dynamic) num_threads( max_in_flight )
     for( size_t fi = 0; fi < options.jplace_input.file_count(); ++fi ) {
 
         // User output
@@ -156,20 +159,28 @@ void run_lwr_histogram( LwrHistogramOptions const& options )
             }
         }
 
+        // Gather the placement data into contiguous columns outside of the critical
+        // section, so that the single threaded accumulation below only scans linear
+        // memory, instead of pointer-chasing through the pquery objects.
+        auto const columns = sample_columns( sample );
+        auto const names = total_name_count( sample );
+
         // The main accumulation is single threaded.
         // We could optimize more, but seriously, it is fast enough already.
         #pragma omp critical(GAPPA_LWR_HIST_ACC)
         {
-            for( auto const& pquery : sample ) {
-                ++pquery_count;
-                name_count += pquery.name_size();
-                auto const mult = total_multiplicity( pquery );
-                auto const max_n = std::min( options.num_lwrs, pquery.placement_size() );
-                for( size_t n = 0; n < max_n; ++n ) {
-                    hists[n].accumulate( pquery.placement_at( n ).like_weight_ratio, mult );
+            pquery_count += columns.pquery_count();
+            name_count += names;
+            for( size_t qi = 0; qi < columns.pquery_count(); ++qi ) {
+                auto const begin = columns.placements_begin( qi );
+                auto const end   = columns.placements_end( qi );
+                auto const mult  = columns.multiplicities[qi];
+                auto const max_n = std::min( begin + options.num_lwrs, end );
+                for( size_t n = begin; n < max_n; ++n ) {
+                    hists[ n - begin ].accumulate( columns.like_weight_ratios[n], mult );
                 }
-                for( size_t n = max_n; n < pquery.placement_size(); ++n ) {
-                    hists.back().accumulate( pquery.placement_at( n ).like_weight_ratio, mult );
+                for( size_t n = max_n; n < end; ++n ) {
+                    hists.back().accumulate( columns.like_weight_ratios[n], mult );
                 }
             }
         }
@@ -25,6 +25,8 @@
 
 #include "options/global.hpp"
 #include "tools/cli_setup.hpp"
+#include "tools/misc.hpp"
+#include "tools/tree_fingerprint.hpp"
 
 #include "CLI/CLI.hpp"
 
@@ -37,7 +39,11 @@
 #include "genesis/utils/math/histogram/stats.hpp"
 
 #include <cassert>
+#include <cstdio>
 #include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
 
 #ifdef GENESIS_OPENMP
 #   include <omp.h>
@@ -69,6 +75,16 @@ void setup_lwr_list( CLI::App& app )
         true
     )->group( "Settings" );
 
+    // Shard the output per input file.
+    sub->add_flag(
+        "--shard-output",
+        opt->shard_output,
+        "Instead of one large `lwr-list.csv`, write one `lwr-list-<filename>.csv` per input jplace "
+        "file, each with its own header line. The shards are written in parallel; without this "
+        "flag, they are still produced in parallel internally, but concatenated into the single "
+        "output file at the end."
+    )->group( "Settings" );
+
     // // Offer to ignore the check for tree compatibility
     // sub->add_flag(
     //     "--no-compatibility-check",
@@ -95,102 +111,189 @@ void setup_lwr_list( CLI::App& app )
 //      Run
 // =================================================================================================
 
+/**
+ * @brief Append a number to a row buffer, matching the default stream formatting
+ * (`%g` with precision 6), but without the locale and virtual call overhead of an ostream.
+ */
+static void append_number_( std::string& buffer, double value )
+{
+    char tmp[32];
+    auto const len = std::snprintf( tmp, sizeof( tmp ), "%.6g", value );
+    if( len > 0 ) {
+        buffer.append( tmp, static_cast<size_t>( len ));
+    }
+}
+
 void run_lwr_list( LwrListOptions const& options )
 {
     using namespace genesis;
     using namespace genesis::placement;
-    using namespace genesis::tree;
     using namespace genesis::utils;
 
     // Prepare output file names and check if any of them already exists. If so, fail early.
-    options.file_output.check_output_files_nonexistence( "lwr-list", "csv" );
+    std::vector<std::string> shard_infixes;
+    for( auto const& bfn : options.jplace_input.base_file_names() ) {
+        shard_infixes.push_back( "lwr-list-" + bfn );
+    }
+    if( options.shard_output ) {
+        std::vector<std::pair<std::string, std::string>> check_files;
+        for( auto const& infix : shard_infixes ) {
+            check_files.push_back({ infix, "csv" });
+        }
+        options.file_output.check_output_files_nonexistence( check_files );
+    } else {
+        options.file_output.check_output_files_nonexistence( "lwr-list", "csv" );
+    }
 
     // Print some user output.
     options.jplace_input.print();
 
-    // Prepare intermediate data.
-    Tree tree;
-    size_t file_count = 0;
-    size_t pquery_count = 0;
-    size_t name_count = 0;
-
-    // Prepare list file.
-    auto list_ofs = options.file_output.get_output_target( "lwr-list", "csv" );
-
-    // Write list file header.
-    (*list_ofs) << "Sample,PqueryName,Multiplicity";
+    // Build the header line once; in sharded mode, each shard gets its own copy.
+    std::string header = "Sample,PqueryName,Multiplicity";
     if( options.num_lwrs == 0 ) {
-        (*list_ofs) << ",LWRs...";
+        header += ",LWRs...";
     } else {
         for( size_t i = 0; i < options.num_lwrs; ++i ) {
-            (*list_ofs) << ",LWR." << (i+1);
+            header += ",LWR." + std::to_string( i + 1 );
         }
-        (*list_ofs) << ",Remainder";
+        header += ",Remainder";
     }
-    (*list_ofs) << "\n";
+    header += "\n";
+
+    // Prepare intermediate data. Without --shard-output, each file's rows go into a part
+    // file next to the final output, which are concatenated (in input order) at the end.
+    auto const total_files = options.jplace_input.file_count();
+    auto const final_path = options.file_output.get_output_filename( "lwr-list", "csv" );
+    auto part_paths = std::vector<std::string>( total_files );
+    auto fingerprints = std::vector<Murmur3::DigestType>( total_files );
+    size_t file_count = 0;
+    size_t pquery_count = 0;
+    size_t name_count = 0;
 
-    // Read all jplace files.
-    // Here, we do one at a time, in order to get the correct output order of table rows.
-    for( size_t fi = 0; fi < options.jplace_input.file_count(); ++fi ) {
-        // User output
-        LOG_MSG2 << "Processing file " << ( ++file_count ) << " of " << options.jplace_input.file_count()
+    // Process the files in parallel. Each file formats its rows into a buffer and writes
+    // its own shard, so that the list generation is bounded by disk bandwidth instead of
+    // single-core formatting speed.
+    auto const max_in_flight = options.jplace_input.max_concurrent_samples();
+    #pragma omp parallel for schedule(dynamic) num_threads( max_in_flight )
+    for( size_t fi = 0; fi < total_files; ++fi ) {
+
+        // User output.
+        size_t current_counter;
+        #pragma omp atomic capture
+        current_counter = ++file_count;
+        LOG_MSG2 << "Processing file " << current_counter << " of " << total_files
                  << ": " << options.jplace_input.file_path( fi );
 
         // Read in file.
         auto sample = options.jplace_input.sample( fi );
         sort_placements_by_weight( sample );
 
-        // Check whether the tree is the same. This is totally not needed for the calculation,
-        // but the case where we want different trees to be summarized sounds more like an error.
+        // Fingerprint the reference tree; the compatibility check runs after the loop.
         if( ! options.no_compat_check ) {
-            // Tree
-            if( tree.empty() ) {
-                tree = sample.tree();
-            } else if( ! genesis::placement::compatible_trees( tree, sample.tree() ) ) {
-                throw std::runtime_error(
-                    "Input jplace files have differing reference trees. "
-                    // "(Disable this check using --no-compat-check)"
-                );
-            }
+            fingerprints[fi] = placement_tree_fingerprint( sample.tree() );
         }
 
-        // Go through all pqueries and their names that are in the current file.
+        // Format all rows of this file into a buffer.
+        std::string buffer;
+        buffer.reserve( sample.size() * ( 32 + 8 * ( options.num_lwrs + 1 )));
+        auto const file_name = options.jplace_input.base_file_name( fi );
+        size_t local_pqueries = 0;
+        size_t local_names = 0;
         for( auto const& pquery : sample ) {
-            ++pquery_count;
+            ++local_pqueries;
             for( auto const& name : pquery.names() ) {
-                ++name_count;
-                auto const file_name = options.jplace_input.base_file_name( fi );
-                (*list_ofs) << file_name << "," << name.name << "," << name.multiplicity;
+                ++local_names;
+                buffer += file_name;
+                buffer += ',';
+                buffer += name.name;
+                buffer += ',';
+                append_number_( buffer, name.multiplicity );
 
                 // Print the LWRs as needed, and potentially the remainder.
                 if( options.num_lwrs == 0 ) {
                     // Special case: Print all LWRs - not a table any more.
                     for( size_t i = 0; i < pquery.placement_size(); ++i ) {
-                        (*list_ofs) << "," << pquery.placement_at( i ).like_weight_ratio;
+                        buffer += ',';
+                        append_number_( buffer, pquery.placement_at( i ).like_weight_ratio );
                     }
                 } else if( options.num_lwrs < pquery.placement_size() ) {
                     // More placements than we want to print - accumuate the rest into the remainder.
                     for( size_t i = 0; i < options.num_lwrs; ++i ) {
-                        (*list_ofs) << "," << pquery.placement_at( i ).like_weight_ratio;
+                        buffer += ',';
+                        append_number_( buffer, pquery.placement_at( i ).like_weight_ratio );
                     }
                     double remainder = 0.0;
                     for( size_t i = options.num_lwrs; i < pquery.placement_size(); ++i ) {
                         remainder += pquery.placement_at( i ).like_weight_ratio;
                     }
-                    (*list_ofs) << "," << remainder;
+                    buffer += ',';
+                    append_number_( buffer, remainder );
                 } else {
                     // Fewer placements than we want to print - fill the rest of the row
                     // up with zeros, and print a zero remainder.
                     for( size_t i = 0; i < pquery.placement_size(); ++i ) {
-                        (*list_ofs) << "," << pquery.placement_at( i ).like_weight_ratio;
+                        buffer += ',';
+                        append_number_( buffer, pquery.placement_at( i ).like_weight_ratio );
                     }
                     for( size_t i = pquery.placement_size(); i < options.num_lwrs; ++i ) {
-                        (*list_ofs) << ",0.0";
+                        buffer += ",0.0";
                     }
-                    (*list_ofs) << ",0.0";
+                    buffer += ",0.0";
                 }
-                (*list_ofs) << "\n";
+                buffer += '\n';
+            }
+        }
+        #pragma omp atomic
+        pquery_count += local_pqueries;
+        #pragma omp atomic
+        name_count += local_names;
+
+        // Write the shard: either as its own output file, or as a part file for the
+        // final concatenation. Part files are plain, as the final target handles the
+        // compression setting.
+        if( options.shard_output ) {
+            auto target = options.file_output.get_output_target( shard_infixes[fi], "csv" );
+            (*target) << header << buffer;
+        } else {
+            part_paths[fi] = final_path + ".part-" + std::to_string( fi );
+            std::ofstream part_ofs;
+            genesis::utils::file_output_stream( part_paths[fi], part_ofs );
+            part_ofs << buffer;
+        }
+
+        // Free the sample in the background while the next file is being processed.
+        dispose_async( sample );
+    }
+
+    // Check whether the trees are the same. This is totally not needed for the calculation,
+    // but the case where we want different trees to be summarized sounds more like an error.
+    if( ! options.no_compat_check ) {
+        for( size_t fi = 1; fi < total_files; ++fi ) {
+            if( fingerprints[fi] != fingerprints[0] ) {
+                throw std::runtime_error(
+                    "Input jplace files have differing reference trees. "
+                    // "(Disable this check using --no-compat-check)"
+                );
+            }
+        }
+    }
+
+    // Without --shard-output, concatenate the part files into the final list,
+    // in input order, and clean them up.
+    if( ! options.shard_output ) {
+        auto list_ofs = options.file_output.get_output_target( "lwr-list", "csv" );
+        (*list_ofs) << header;
+        for( size_t fi = 0; fi < total_files; ++fi ) {
+            std::ifstream part_ifs( part_paths[fi], std::ios::binary );
+            if( ! part_ifs ) {
+                throw std::runtime_error( "Cannot read part file " + part_paths[fi] );
+            }
+            // An empty part (a sample without names) would set the fail bit via rdbuf.
+            if( part_ifs.peek() != std::ifstream::traits_type::eof() ) {
+                (*list_ofs) << part_ifs.rdbuf();
             }
+            part_ifs.close();
+            std::remove( part_paths[fi].c_str() );
         }
     }
 
@@ -42,6 +42,7 @@ public:
 
     size_t num_lwrs         = 5;
     bool   no_compat_check  = false;
+    bool   shard_output     = false;
 
     JplaceInputOptions jplace_input;
     FileOutputOptions  file_output;
@@ -0,0 +1,393 @@
+/*
+    gappa - Genesis Applications for Phylogenetic Placement Analysis
+    Copyright (C) 2017-2024 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+#include "commands/examine/lwr_overview.hpp"
+
+#include "options/global.hpp"
+#include "tools/cli_setup.hpp"
+#include "tools/misc.hpp"
+#include "tools/sample_columns.hpp"
+
+#include "CLI/CLI.hpp"
+
+#include "genesis/placement/function/functions.hpp"
+#include "genesis/placement/function/masses.hpp"
+#include "genesis/placement/function/operators.hpp"
+
+#include "genesis/utils/io/output_stream.hpp"
+#include "genesis/utils/math/histogram.hpp"
+#include "genesis/utils/math/histogram/stats.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <fstream>
+#include <utility>
+#include <vector>
+
+#ifdef GENESIS_OPENMP
+#   include <omp.h>
+#endif
+
+// =================================================================================================
+//      Setup
+// =================================================================================================
+
+void setup_lwr_overview( CLI::App& app )
+{
+    // Create the options and subcommand objects.
+    auto opt = std::make_shared<LwrOverviewOptions>();
+    auto sub = app.add_subcommand(
+        "lwr-overview",
+        "Produce the outputs of lwr-list, lwr-histogram, and lwr-distribution "
+        "in a single pass over the input files."
+    );
+
+    // File input
+    opt->jplace_input.add_jplace_input_opt_to_app( sub );
+
+    // How many lwrs to output
+    sub->add_option(
+        "--num-lwrs",
+        opt->num_lwrs,
+        "Number of LWRs per pquery to use in all three outputs "
+        "(most likely, second most likely, etc); all remaining LWRs are accumulated "
+        "into the Remainder column.",
+        true
+    )->group( "Settings" );
+
+    // Number of histogram bins.
+    sub->add_option(
+        "--histogram-bins",
+        opt->histogram_bins,
+        "Number of histogram bins for the lwr-histogram output.",
+        true
+    )->group( "Settings" );
+
+    // Number of distribution entries.
+    sub->add_option(
+        "--num-entries",
+        opt->num_entries,
+        "Number of entries representing the pqueries in the lwr-distribution output. "
+        "If set to 0, or if the input has fewer pqueries than the given number, "
+        "the output table will contain all pqueries.",
+        true
+    )->group( "Settings" );
+
+    // How to sort the per-pquery LWRs to create the distribution table.
+    sub->add_flag(
+        "--numerical-sort",
+        opt->numerical_sort,
+        "Sort the entries of the lwr-distribution output by the most likely LWR first, "
+        "breaking ties by the second most likely LWR, and so forth, instead of the "
+        "default weighted sum of the LWRs of each pquery."
+    )->group( "Settings" );
+
+    // Output
+    opt->file_output.add_default_output_opts_to_app( sub );
+
+    // Set the run function as callback to be called when this subcommand is issued.
+    // Hand over the options by copy, so that their shared ptr stays alive in the lambda.
+    sub->callback( gappa_cli_callback(
+        sub,
+        {},
+        [ opt ]() {
+            run_lwr_overview( *opt );
+        }
+    ));
+}
+
+// =================================================================================================
+//      Run
+// =================================================================================================
+
+void run_lwr_overview( LwrOverviewOptions const& options )
+{
+    using namespace genesis;
+    using namespace genesis::placement;
+    using namespace genesis::tree;
+    using namespace genesis::utils;
+
+    // Prepare output file names and check if any of them already exists. If so, fail early.
+    options.file_output.check_output_files_nonexistence({
+        { "lwr-list", "csv" }, { "lwr-histogram", "csv" }, { "lwr-distribution", "csv" }
+    });
+
+    // Print some user output.
+    options.jplace_input.print();
+
+    // Prepare intermediate data.
+    Tree tree;
+    size_t file_count = 0;
+    size_t pquery_count = 0;
+    size_t name_count = 0;
+
+    // Accumulators for the histogram output.
+    auto hists = std::vector<Histogram>( options.num_lwrs + 1, { options.histogram_bins, 0.0, 1.0 });
+
+    // Collection of all pquery LWRs, for the distribution output.
+    // Same layout as in the lwr-distribution command.
+    struct LwrEntry
+    {
+        size_t              sample_index;
+        std::string         pquery_name;
+        double              sort_value;
+        std::vector<double> lwrs;
+    };
+    auto collection = std::vector<LwrEntry>();
+
+    // Prepare list file and write its header.
+    auto list_ofs = options.file_output.get_output_target( "lwr-list", "csv" );
+    (*list_ofs) << "Sample,PqueryName,Multiplicity";
+    for( size_t i = 0; i < options.num_lwrs; ++i ) {
+        (*list_ofs) << ",LWR." << (i+1);
+    }
+    (*list_ofs) << ",Remainder\n";
+
+    // Read all jplace files, processing each of them once for all three outputs.
+    // The list output needs its rows in input order, so the files are processed
+    // sequentially, with the next file being read and parsed on a background thread.
+    for( size_t fi = 0; fi < options.jplace_input.file_count(); ++fi ) {
+        // User output
+        LOG_MSG2 << "Processing file " << ( ++file_count ) << " of " << options.jplace_input.file_count()
+                 << ": " << options.jplace_input.file_path( fi );
+
+        // Read in file.
+        auto sample = options.jplace_input.sample_prefetch( fi );
+        sort_placements_by_weight( sample );
+
+        // Check whether the tree is the same. This is totally not needed for the calculation,
+        // but the case where we want different trees to be summarized sounds more like an error.
+        if( ! options.no_compat_check ) {
+            if( tree.empty() ) {
+                tree = sample.tree();
+            } else if( ! genesis::placement::compatible_trees( tree, sample.tree() ) ) {
+                throw std::runtime_error(
+                    "Input jplace files have differing reference trees. "
+                );
+            }
+        }
+
+        collection.reserve( collection.size() + total_name_count( sample ));
+        auto const file_name = options.jplace_input.base_file_name( fi );
+
+        // Gather the placement data into contiguous columns, so that the loop below
+        // only scans linear memory for the numeric fields. Names are not part of the
+        // columns, so they are still read from the pqueries.
+        auto const columns = sample_columns( sample );
+
+        // Go through all pqueries of the current file, and feed all three outputs.
+        for( size_t qi = 0; qi < columns.pquery_count(); ++qi ) {
+            auto& pquery = sample.at( qi );
+            ++pquery_count;
+            auto const mult  = columns.multiplicities[qi];
+            auto const begin = columns.placements_begin( qi );
+            auto const end   = columns.placements_end( qi );
+            auto const max_n = std::min( begin + options.num_lwrs, end );
+
+            // Accumulate the histograms, and prepare the per-pquery LWR vector
+            // (top n LWRs, and the accumulated remainder as an additional last entry),
+            // along with the sort value for the default distribution sort order.
+            auto lwrs = std::vector<double>( options.num_lwrs + 1, 0.0 );
+            double sort_value = 0.0;
+            for( size_t n = begin; n < max_n; ++n ) {
+                auto const lwr = columns.like_weight_ratios[n];
+                hists[ n - begin ].accumulate( lwr, mult );
+                lwrs[ n - begin ] = lwr;
+                sort_value += lwr / static_cast<double>( n - begin + 1 );
+            }
+            for( size_t n = max_n; n < end; ++n ) {
+                auto const lwr = columns.like_weight_ratios[n];
+                hists.back().accumulate( lwr, mult );
+                lwrs.back() += lwr;
+                sort_value += lwr / static_cast<double>( n - begin + 1 );
+            }
+
+            // Write the list rows, and fill the distribution collection,
+            // one entry per pquery name.
+            for( auto const& name : pquery.names() ) {
+                ++name_count;
+                (*list_ofs) << file_name << "," << name.name << "," << name.multiplicity;
+                for( auto const& v : lwrs ) {
+                    (*list_ofs) << "," << v;
+                }
+                (*list_ofs) << "\n";
+
+                LwrEntry entry;
+                entry.sample_index = fi;
+                entry.pquery_name = name.name;
+                entry.sort_value = sort_value;
+                entry.lwrs = lwrs;
+                collection.push_back( std::move( entry ));
+            }
+
+            // We are done with this pquery, and will never need it again.
+            pquery.clear_placements();
+            pquery.clear_names();
+        }
+
+        // Free the sample in the background while the next file is being read.
+        dispose_async( sample );
+    }
+    LOG_MSG << "Processed " << pquery_count << " pqueries with " << name_count << " names";
+
+    // -------------------------------------------------------------------------
+    //     Histogram Output
+    // -------------------------------------------------------------------------
+
+    LOG_MSG1 << "Writing histogram table.";
+    auto hist_ofs = options.file_output.get_output_target( "lwr-histogram", "csv" );
+
+    // Write histogram header, and get sum for each of them
+    // so that we can later use them for normalization.
+    (*hist_ofs) << "Bin,Start,End,Range";
+    auto hist_sums = std::vector<double>( options.num_lwrs + 1, 0.0 );
+    for( size_t i = 0; i < options.num_lwrs; ++i ) {
+        (*hist_ofs) << ",Value." << (i+1);
+        hist_sums[i] = sum( hists[i] );
+    }
+    (*hist_ofs) << ",Value.Remainder";
+    hist_sums.back() = sum( hists.back() );
+    for( size_t i = 0; i < options.num_lwrs; ++i ) {
+        (*hist_ofs) << ",Percentage." << (i+1);
+    }
+    (*hist_ofs) << ",Percentage.Remainder";
+    for( size_t i = 0; i < options.num_lwrs; ++i ) {
+        (*hist_ofs) << ",AccumulatedValue." << (i+1);
+    }
+    (*hist_ofs) << ",AccumulatedValue.Remainder";
+    for( size_t i = 0; i < options.num_lwrs; ++i ) {
+        (*hist_ofs) << ",AccumulatedPercentage." << (i+1);
+    }
+    (*hist_ofs) << ",AccumulatedPercentage.Remainder";
+    (*hist_ofs) << "\n";
+
+    // Write histogram rows.
+    auto hist_accs = std::vector<double>( options.num_lwrs + 1, 0.0 );
+    for( size_t b = 0; b < options.histogram_bins; ++b ) {
+        (*hist_ofs) << b << ",";
+        (*hist_ofs) << hists[0].bin_range(b).first << "," << hists[0].bin_range(b).second;
+        (*hist_ofs) << ",\"[" << hists[0].bin_range(b).first << ", ";
+        (*hist_ofs) << hists[0].bin_range(b).second << ")\"";
+
+        for( size_t n = 0; n < options.num_lwrs + 1; ++n ) {
+            hist_accs[n] += hists[n][b];
+            (*hist_ofs) << "," << hists[n][b];
+        }
+        for( size_t n = 0; n < options.num_lwrs + 1; ++n ) {
+            (*hist_ofs) << "," << ( hists[n][b] / hist_sums[n] );
+        }
+        for( size_t n = 0; n < options.num_lwrs + 1; ++n ) {
+            (*hist_ofs) << "," << hist_accs[n];
+        }
+        for( size_t n = 0; n < options.num_lwrs + 1; ++n ) {
+            (*hist_ofs) << "," << ( hist_accs[n] / hist_sums[n] );
+        }
+        (*hist_ofs) << "\n";
+    }
+
+    // -------------------------------------------------------------------------
+    //     Distribution Output
+    // -------------------------------------------------------------------------
+
+    // Sort according to needs
+    LOG_MSG1 << "Sorting pqueries by LWR";
+    if( options.numerical_sort ) {
+        std::sort(
+            collection.begin(), collection.end(),
+            []( LwrEntry const& lhs, LwrEntry const& rhs ){
+                assert( lhs.lwrs.size() == rhs.lwrs.size() );
+
+                // Sort by LWR, starting with the most likely one.
+                // If those are identical, compare the second most likely, and so forth,
+                // until we find one that differs and which then gives the sort order.
+                // We sort by largest LWR first.
+                for( size_t i = 0; i < lhs.lwrs.size(); ++i ) {
+                    if( lhs.lwrs[i] != rhs.lwrs[i] ) {
+                        return lhs.lwrs[i] > rhs.lwrs[i];
+                    }
+                }
+                return false;
+            }
+        );
+    } else {
+        std::sort(
+            collection.begin(), collection.end(),
+            []( LwrEntry const& lhs, LwrEntry const& rhs ){
+                // Simply sort by the pre-computed sort value.
+                // We sort by largest LWR sort value first.
+                return lhs.sort_value > rhs.sort_value;
+            }
+        );
+    }
+
+    // Get the number of rows to write. In the normal case, we write `num_entries` many rows,
+    // picking them at the respective relative position in the sorted collection.
+    // If there are not that many pqueries, we only write as many as there are;
+    // if the number of output entries set by the user is 0, we also write all that there are.
+    auto const max_e
+        = ( options.num_entries == 0 || collection.size() < options.num_entries )
+        ? collection.size()
+        : options.num_entries
+    ;
+
+    // User output
+    if( max_e == collection.size() ) {
+        LOG_MSG1 << "Writing distribution table with all " << max_e << " pqueries";
+    } else {
+        LOG_MSG1 << "Writing distribution table with " << max_e << " representative pqueries";
+    }
+
+    // Prepare file
+    auto dist_ofs = options.file_output.get_output_target( "lwr-distribution", "csv" );
+
+    // Write header, using an R-friendly format with dots as delimiters in column names.
+    (*dist_ofs) << "Index,Sample,PqueryName";
+    for( size_t i = 0; i < options.num_lwrs; ++i ) {
+        (*dist_ofs) << ",LWR." << (i+1);
+    }
+    (*dist_ofs) << ",Remainder\n";
+
+    // Write data rows.
+    for( size_t e = 0; e < max_e; ++e ) {
+
+        // Get the index of the pquery that sits at the e/max_e position in the collection.
+        // We compute it so that the first and the last entry of the collection are always
+        // part of the output.
+        auto const index = static_cast<size_t>(
+            static_cast<double>( collection.size() - 1 ) *
+            static_cast<double>( e ) /
+            static_cast<double>( max_e - 1 )
+        );
+        assert( index < collection.size() );
+        assert( collection[index].lwrs.size() == options.num_lwrs + 1 );
+
+        // Print the entry with all its LWRs.
+        (*dist_ofs) << (index + 1);
+        (*dist_ofs) << "," << options.jplace_input.base_file_name( collection[index].sample_index );
+        (*dist_ofs) << "," << collection[index].pquery_name;
+        for( auto const& v : collection[index].lwrs ) {
+            (*dist_ofs) << "," << v;
+        }
+        (*dist_ofs) << "\n";
+    }
+}
@@ -0,0 +1,656 @@
+/*
+    gappa - Genesis Applications for Phylogenetic Placement Analysis
+    Copyright (C) 2017-2024 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+#include "commands/examine/validate.hpp"
+
+#include "options/global.hpp"
+#include "tools/cli_setup.hpp"
+
+#include "CLI/CLI.hpp"
+
+#include "genesis/utils/io/input_source.hpp"
+#include "genesis/utils/io/input_stream.hpp"
+
+#include <cassert>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#ifdef GENESIS_OPENMP
+#   include <omp.h>
+#endif
+
+// =================================================================================================
+//      Setup
+// =================================================================================================
+
+void setup_validate( CLI::App& app )
+{
+    // Create the options and subcommand objects.
+    auto opt = std::make_shared<ValidateOptions>();
+    auto sub = app.add_subcommand(
+        "validate",
+        "Check jplace files for structural and content errors, without fully parsing them."
+    );
+
+    // File input
+    opt->jplace_input.add_jplace_input_opt_to_app( sub );
+
+    // Set the run function as callback to be called when this subcommand is issued.
+    // Hand over the options by copy, so that their shared ptr stays alive in the lambda.
+    sub->callback( gappa_cli_callback(
+        sub,
+        {},
+        [ opt ]() {
+            run_validate( *opt );
+        }
+    ));
+}
+
+// =================================================================================================
+//      Streaming Validation
+// =================================================================================================
+
+/**
+ * @brief Maximum number of errors to report per file before giving up on it.
+ */
+static const size_t max_errors_per_file_ = 20;
+
+/**
+ * @brief The parts of a jplace file that the row checks depend on: the `fields` list,
+ * and the edge numbers annotated in the `tree` string.
+ *
+ * Some placement programs write these after the `placements` array, so we collect them
+ * in a first scan of the file, and then validate the placements against them in a second.
+ * The first scan stops as soon as both are found, so that for files with the header up
+ * front (pplacer and friends), it only touches the first few kilobytes.
+ */
+struct JplaceFileHeader
+{
+    bool has_tree   = false;
+    bool has_fields = false;
+
+    std::vector<std::string> fields;
+    std::unordered_set<long> edge_nums;
+
+    // Issues found while parsing the tree edge annotations.
+    bool bad_edge_annotation = false;
+    bool duplicate_edge_nums = false;
+};
+
+/**
+ * @brief Scan a jplace file for its `fields` list and the edge numbers of its `tree` string.
+ *
+ * This is a minimal json lexer: it only tracks strings (with escapes), nesting depth,
+ * and the keys of the top-level object, and skips everything else. Structural errors
+ * are left for the validation scan to report; here, we just stop at the end of the input.
+ */
+static JplaceFileHeader scan_jplace_header_( std::string const& path )
+{
+    using namespace genesis::utils;
+
+    JplaceFileHeader header;
+    InputStream it( from_file( path ));
+
+    bool in_string = false;
+    bool escaped   = false;
+    std::string token;
+    std::string pending_key;
+    size_t depth = 0;
+    long fields_depth = -1;
+
+    while( it ) {
+        char const c = *it;
+        ++it;
+
+        if( in_string ) {
+            if( escaped ) {
+                escaped = false;
+                token += c;
+            } else if( c == '\\' ) {
+                escaped = true;
+            } else if( c == '"' ) {
+                in_string = false;
+
+                // String elements of the fields array.
+                if( fields_depth >= 0 && depth == static_cast<size_t>( fields_depth )) {
+                    header.fields.push_back( token );
+                }
+
+                // The tree string: extract the `{N}` edge number annotations.
+                if( depth == 1 && pending_key == "tree" ) {
+                    size_t pos = 0;
+                    while( pos < token.size() ) {
+                        if( token[pos] != '{' ) {
+                            ++pos;
+                            continue;
+                        }
+                        ++pos;
+                        auto const start = pos;
+                        while( pos < token.size() && token[pos] >= '0' && token[pos] <= '9' ) {
+                            ++pos;
+                        }
+                        if( pos == start || pos == token.size() || token[pos] != '}' ) {
+                            header.bad_edge_annotation = true;
+                            continue;
+                        }
+                        auto const num = std::strtol( token.substr( start, pos - start ).c_str(), nullptr, 10 );
+                        if( ! header.edge_nums.insert( num ).second ) {
+                            header.duplicate_edge_nums = true;
+                        }
+                        ++pos;
+                    }
+                    header.has_tree = true;
+                    pending_key.clear();
+                }
+            } else {
+                token += c;
+            }
+            continue;
+        }
+
+        switch( c ) {
+            case '"': {
+                in_string = true;
+                token.clear();
+                break;
+            }
+            case ':': {
+                pending_key = token;
+                break;
+            }
+            case '{': {
+                ++depth;
+                pending_key.clear();
+                break;
+            }
+            case '[': {
+                if( depth == 1 && pending_key == "fields" ) {
+                    fields_depth = static_cast<long>( depth ) + 1;
+                }
+                ++depth;
+                pending_key.clear();
+                break;
+            }
+            case '}':
+            case ']': {
+                if( depth > 0 ) {
+                    --depth;
+                }
+                if( fields_depth >= 0 && depth < static_cast<size_t>( fields_depth )) {
+                    fields_depth = -1;
+                    header.has_fields = true;
+                }
+                break;
+            }
+            default: {
+                break;
+            }
+        }
+
+        // For files that store the header before the placements, we are done after a few lines.
+        if( header.has_tree && header.has_fields ) {
+            break;
+        }
+    }
+
+    return header;
+}
+
+/**
+ * @brief Validate the structure and content of a jplace file against its header,
+ * returning the list of errors found (empty if the file is valid).
+ *
+ * Like the header scan, this streams over the raw characters in constant memory,
+ * without materializing the json document or a Sample. It is not a full json parser:
+ * it checks container nesting and string termination, and the jplace-specific content
+ * (required keys, placement row lengths, edge numbers, and LWR ranges), which is what
+ * breaks in truncated or corrupt files.
+ */
+static std::vector<std::string> validate_jplace_file_(
+    std::string const& path,
+    JplaceFileHeader const& header
+) {
+    using namespace genesis::utils;
+
+    std::vector<std::string> errors;
+    auto report = [&]( std::string const& msg ) {
+        if( errors.size() < max_errors_per_file_ ) {
+            errors.push_back( msg );
+        }
+    };
+
+    // Checks on the header itself, reported once per file.
+    long edge_num_idx = -1;
+    long lwr_idx      = -1;
+    if( header.has_fields ) {
+        for( size_t i = 0; i < header.fields.size(); ++i ) {
+            if( header.fields[i] == "edge_num" ) {
+                edge_num_idx = static_cast<long>( i );
+            }
+            if( header.fields[i] == "like_weight_ratio" ) {
+                lwr_idx = static_cast<long>( i );
+            }
+        }
+        if( edge_num_idx < 0 ) {
+            report( "The \"fields\" list is missing the required \"edge_num\" entry." );
+        }
+        if( lwr_idx < 0 ) {
+            report( "The \"fields\" list is missing the required \"like_weight_ratio\" entry." );
+        }
+    }
+    if( header.has_tree ) {
+        if( header.edge_nums.empty() ) {
+            report( "The \"tree\" string does not contain any {N} edge number annotations." );
+        }
+        if( header.bad_edge_annotation ) {
+            report( "The \"tree\" string contains malformed {N} edge number annotations." );
+        }
+        if( header.duplicate_edge_nums ) {
+            report( "The \"tree\" string contains duplicate edge numbers." );
+        }
+    }
+
+    // The containers that a character position can be nested in, as far as we track them.
+    enum class Context
+    {
+        kRoot, kFields, kPlacements, kPquery, kPArray, kPRow, kOther
+    };
+    std::vector<Context> stack;
+    std::vector<char> closers;
+
+    // Lexer state, as in the header scan.
+    InputStream it( from_file( path ));
+    bool in_string = false;
+    bool escaped   = false;
+    std::string token;
+    std::string pending_key;
+    bool string_pending = false;
+
+    // Top-level keys that the format requires.
+    bool seen_version    = false;
+    bool seen_tree       = false;
+    bool seen_fields     = false;
+    bool seen_placements = false;
+
+    // Per-pquery and per-row state for the content checks.
+    size_t pquery_count  = 0;
+    bool   pq_seen_p     = false;
+    bool   pq_seen_name  = false;
+    double pq_lwr_sum    = 0.0;
+    size_t row_values    = 0;
+    std::string scalar;
+
+    // Check one scalar value (number, bool, null) at its position in the current context.
+    auto finish_scalar = [&]() {
+        if( scalar.empty() ) {
+            return;
+        }
+        if( ! stack.empty() && stack.back() == Context::kPRow ) {
+            char* end = nullptr;
+            auto const value = std::strtod( scalar.c_str(), &end );
+            if( end == scalar.c_str() || *end != '\0' ) {
+                report(
+                    "At " + it.at() + ": non-numeric value \"" + scalar
+                    + "\" in a placement of pquery " + std::to_string( pquery_count ) + "."
+                );
+            } else if( static_cast<long>( row_values ) == edge_num_idx ) {
+                if( value != static_cast<double>( static_cast<long>( value )) ) {
+                    report(
+                        "At " + it.at() + ": edge_num \"" + scalar + "\" of pquery "
+                        + std::to_string( pquery_count ) + " is not an integer."
+                    );
+                } else if(
+                    header.has_tree &&
+                    header.edge_nums.count( static_cast<long>( value )) == 0
+                ) {
+                    report(
+                        "At " + it.at() + ": edge_num " + scalar + " of pquery "
+                        + std::to_string( pquery_count )
+                        + " does not exist in the reference tree."
+                    );
+                }
+            } else if( static_cast<long>( row_values ) == lwr_idx ) {
+                if( !( value >= 0.0 ) || value > 1.0 + 1e-6 ) {
+                    report(
+                        "At " + it.at() + ": like_weight_ratio " + scalar + " of pquery "
+                        + std::to_string( pquery_count ) + " is not in [ 0.0, 1.0 ]."
+                    );
+                } else {
+                    pq_lwr_sum += value;
+                }
+            }
+            ++row_values;
+        } else if( ! stack.empty() && stack.back() == Context::kRoot ) {
+            if( pending_key == "version" ) {
+                seen_version = true;
+            }
+            pending_key.clear();
+        }
+        scalar.clear();
+    };
+
+    // A string that turned out to be a value rather than a key.
+    auto finish_string_value = [&]() {
+        string_pending = false;
+        if( stack.empty() ) {
+            return;
+        }
+        switch( stack.back() ) {
+            case Context::kRoot: {
+                if( pending_key == "tree" ) {
+                    seen_tree = true;
+                } else if( pending_key == "version" ) {
+                    seen_version = true;
+                }
+                pending_key.clear();
+                break;
+            }
+            case Context::kPRow: {
+                report(
+                    "At " + it.at() + ": string value in a placement of pquery "
+                    + std::to_string( pquery_count ) + ", expected a number."
+                );
+                ++row_values;
+                break;
+            }
+            default: {
+                break;
+            }
+        }
+    };
+
+    bool root_closed = false;
+    while( it && errors.size() < max_errors_per_file_ ) {
+        char const c = *it;
+
+        if( in_string ) {
+            ++it;
+            if( escaped ) {
+                escaped = false;
+            } else if( c == '\\' ) {
+                escaped = true;
+            } else if( c == '"' ) {
+                in_string = false;
+                string_pending = true;
+            } else {
+                token += c;
+            }
+            continue;
+        }
+
+        // Outside of strings, any non-whitespace after the root closed is junk.
+        if( root_closed && c != ' ' && c != '\t' && c != '\n' && c != '\r' ) {
+            report( "At " + it.at() + ": content after the end of the top-level object." );
+            break;
+        }
+
+        switch( c ) {
+            case '"': {
+                if( string_pending ) {
+                    finish_string_value();
+                }
+                in_string = true;
+                token.clear();
+                break;
+            }
+            case ':': {
+                finish_scalar();
+                if( string_pending ) {
+                    pending_key = token;
+                    string_pending = false;
+                } else {
+                    report( "At " + it.at() + ": colon without a preceding key string." );
+                }
+                break;
+            }
+            case ',': {
+                finish_scalar();
+                if( string_pending ) {
+                    finish_string_value();
+                }
+                break;
+            }
+            case '{':
+            case '[': {
+                finish_scalar();
+                if( string_pending ) {
+                    finish_string_value();
+                }
+
+                // Determine what kind of container this opens.
+                auto context = Context::kOther;
+                if( stack.empty() ) {
+                    if( c == '{' ) {
+                        context = Context::kRoot;
+                    } else {
+                        report( "At " + it.at() + ": the top-level element must be an object." );
+                    }
+                } else if( stack.back() == Context::kRoot && c == '[' ) {
+                    if( pending_key == "fields" ) {
+                        context = Context::kFields;
+                        seen_fields = true;
+                    } else if( pending_key == "placements" ) {
+                        context = Context::kPlacements;
+                        seen_placements = true;
+                    }
+                } else if( stack.back() == Context::kPlacements ) {
+                    if( c == '{' ) {
+                        context = Context::kPquery;
+                        ++pquery_count;
+                        pq_seen_p    = false;
+                        pq_seen_name = false;
+                        pq_lwr_sum   = 0.0;
+                    } else {
+                        report(
+                            "At " + it.at() + ": element " + std::to_string( pquery_count + 1 )
+                            + " of the \"placements\" array is not an object."
+                        );
+                    }
+                } else if( stack.back() == Context::kPquery && c == '[' ) {
+                    if( pending_key == "p" ) {
+                        context = Context::kPArray;
+                        pq_seen_p = true;
+                    } else if( pending_key == "n" || pending_key == "nm" ) {
+                        pq_seen_name = true;
+                    }
+                } else if( stack.back() == Context::kPArray ) {
+                    if( c == '[' ) {
+                        context = Context::kPRow;
+                        row_values = 0;
+                    } else {
+                        report(
+                            "At " + it.at() + ": placement of pquery "
+                            + std::to_string( pquery_count ) + " is not an array."
+                        );
+                    }
+                }
+                stack.push_back( context );
+                closers.push_back( c == '{' ? '}' : ']' );
+                pending_key.clear();
+                break;
+            }
+            case '}':
+            case ']': {
+                finish_scalar();
+                if( string_pending ) {
+                    finish_string_value();
+                }
+                if( stack.empty() ) {
+                    report( "At " + it.at() + ": closing \"" + std::string( 1, c ) + "\" without a matching opener." );
+                    break;
+                }
+                if( closers.back() != c ) {
+                    report(
+                        "At " + it.at() + ": mismatched \"" + std::string( 1, c )
+                        + "\", expected \"" + std::string( 1, closers.back() ) + "\"."
+                    );
+                }
+
+                // Content checks when a tracked container closes.
+                switch( stack.back() ) {
+                    case Context::kPRow: {
+                        if( header.has_fields && row_values != header.fields.size() ) {
+                            report(
+                                "At " + it.at() + ": placement of pquery "
+                                + std::to_string( pquery_count ) + " has "
+                                + std::to_string( row_values ) + " values, but \"fields\" lists "
+                                + std::to_string( header.fields.size() ) + "."
+                            );
+                        }
+                        break;
+                    }
+                    case Context::kPquery: {
+                        if( ! pq_seen_p ) {
+                            report(
+                                "Pquery " + std::to_string( pquery_count )
+                                + " is missing its \"p\" placements array."
+                            );
+                        }
+                        if( ! pq_seen_name ) {
+                            report(
+                                "Pquery " + std::to_string( pquery_count )
+                                + " is missing its \"n\" or \"nm\" name entry."
+                            );
+                        }
+                        if( lwr_idx >= 0 && pq_lwr_sum > 1.0 + 1e-3 ) {
+                            report(
+                                "Pquery " + std::to_string( pquery_count )
+                                + " has a like_weight_ratio sum of "
+                                + std::to_string( pq_lwr_sum ) + " > 1.0."
+                            );
+                        }
+                        break;
+                    }
+                    default: {
+                        break;
+                    }
+                }
+                stack.pop_back();
+                closers.pop_back();
+                if( stack.empty() ) {
+                    root_closed = true;
+                }
+                break;
+            }
+            case ' ':
+            case '\t':
+            case '\n':
+            case '\r': {
+                finish_scalar();
+                break;
+            }
+            default: {
+                // Part of a number, bool, or null.
+                scalar += c;
+                break;
+            }
+        }
+        ++it;
+    }
+
+    // End of input checks.
+    if( in_string ) {
+        report( "Unexpected end of input within a string." );
+    } else if( ! stack.empty() ) {
+        report(
+            "Unexpected end of input with " + std::to_string( stack.size() )
+            + " unclosed objects or arrays. The file is likely truncated."
+        );
+    } else if( ! root_closed ) {
+        report( "The file does not contain a top-level object." );
+    }
+    if( root_closed ) {
+        if( ! seen_version ) {
+            report( "Missing the top-level \"version\" entry." );
+        }
+        if( ! seen_tree ) {
+            report( "Missing the top-level \"tree\" entry." );
+        }
+        if( ! seen_fields ) {
+            report( "Missing the top-level \"fields\" entry." );
+        }
+        if( ! seen_placements ) {
+            report( "Missing the top-level \"placements\" entry." );
+        }
+    }
+    if( errors.size() >= max_errors_per_file_ ) {
+        errors.push_back( "Stopped the scan after " + std::to_string( max_errors_per_file_ ) + " errors." );
+    }
+
+    return errors;
+}
+
+// =================================================================================================
+//      Run
+// =================================================================================================
+
+void run_validate( ValidateOptions const& options )
+{
+    // Print some user output.
+    options.jplace_input.print();
+
+    // Validate all files in parallel, at I/O speed, and report their errors as they finish.
+    size_t file_count = 0;
+    size_t invalid_count = 0;
+    #pragma omp parallel for schedule(dynamic)
+    for( size_t fi = 0; fi < options.jplace_input.file_count(); ++fi ) {
+
+        // User output
+        size_t current_count;
+        #pragma omp atomic capture
+        current_count = ++file_count;
+        LOG_MSG2 << "Processing file " << current_count << " of " << options.jplace_input.file_count()
+                 << ": " << options.jplace_input.file_path( fi );
+
+        // First scan for the fields and tree edge numbers, then validate against them.
+        auto const& path = options.jplace_input.file_path( fi );
+        auto const header = scan_jplace_header_( path );
+        auto const errors = validate_jplace_file_( path, header );
+
+        if( ! errors.empty() ) {
+            #pragma omp atomic
+            ++invalid_count;
+            #pragma omp critical(GAPPA_VALIDATE_PRINT)
+            {
+                LOG_MSG1 << "Invalid file " << path << ":";
+                for( auto const& error : errors ) {
+                    LOG_MSG1 << "    " << error;
+                }
+            }
+        }
+    }
+
+    // Summary, and a non-zero exit for scripting if anything was wrong.
+    LOG_BOLD;
+    if( invalid_count == 0 ) {
+        LOG_MSG1 << "All " << options.jplace_input.file_count() << " files are valid.";
+    } else {
+        throw std::runtime_error(
+            "Found " + std::to_string( invalid_count ) + " invalid files out of "
+            + std::to_string( options.jplace_input.file_count() ) + "."
+        );
+    }
+}
@@ -24,8 +24,9 @@
 #include "commands/prepare/chunkify.hpp"
 
 #include "options/global.hpp"
+#include "tools/abundance_map.hpp"
 #include "tools/cli_setup.hpp"
-#include "tools/version.hpp"
+#include "tools/murmur3.hpp"
 
 #include "CLI/CLI.hpp"
 
@@ -35,11 +36,14 @@
 #include "genesis/sequence/formats/fasta_writer.hpp"
 #include "genesis/sequence/functions/labels.hpp"
 
+#include "genesis/utils/core/fs.hpp"
 #include "genesis/utils/core/std.hpp"
+#include "genesis/utils/io/deserializer.hpp"
 #include "genesis/utils/io/input_source.hpp"
 #include "genesis/utils/io/input_stream.hpp"
 #include "genesis/utils/io/output_stream.hpp"
 #include "genesis/utils/io/output_target.hpp"
+#include "genesis/utils/io/serializer.hpp"
 #include "genesis/utils/text/string.hpp"
 #include "genesis/utils/tools/hash/md5.hpp"
 #include "genesis/utils/tools/hash/sha1.hpp"
@@ -51,10 +55,19 @@
 
 #include <sparsepp/spp.h>
 
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
 #include <cstdio>
 #include <fstream>
+#include <future>
+#include <limits>
+#include <memory>
+#include <queue>
 #include <unordered_map>
 #include <unordered_set>
+#include <utility>
+#include <vector>
 
 // =================================================================================================
 //      Typedefs
@@ -115,19 +128,54 @@ void setup_chunkify( CLI::App& app )
     sub->add_option(
         "--min-abundance",
         opt->min_abundance,
-        "Minimum abundance of a single sequence. Sequences below are filtered out.",
+        "Minimum abundance of a sequence. The abundance is accumulated over all records of "
+        "the sequence, using their abundance annotations (e.g., `;size=123`), across all "
+        "input files; records are filtered out until the accumulated abundance of their "
+        "sequence reaches this threshold, and hence never reach the hashing, chunk output, "
+        "and abundance maps. Occurrences seen before a sequence reaches the threshold are "
+        "not counted in the abundance maps.",
         true
     )->group( "Settings" );
 
+    // Abundance Map Limit
+    sub->add_option(
+        "--abundance-map-limit",
+        opt->abundance_map_limit,
+        "Maximum number of unique sequences of one input file to keep in the in-memory "
+        "abundance map at a time. When a file exceeds the limit, sorted runs of the map are "
+        "spilled to temporary files in the abundance output directory, and merged into the "
+        "final abundance map file afterwards, so that memory usage stays bounded no matter "
+        "how many unique sequences a file contains. If set to 0 (default), the whole map is "
+        "kept in memory.",
+        true
+    )->group( "Settings" );
+
+    // Abundance Map Format
+    sub->add_option(
+        "--abundance-format",
+        opt->abundance_format,
+        "File format for the abundance maps. The binary format stores raw digest bytes and "
+        "compact integers instead of json text; for maps with many unique sequences, it is "
+        "an order of magnitude smaller and faster to read back by the unchunkify command. "
+        "The json format is human-readable, and kept for compatibility with existing "
+        "pipelines and tooling.",
+        true
+    )->group( "Settings" )
+    ->transform(
+        CLI::IsMember({ "json", "binary" }, CLI::ignore_case )
+    );
+
     // Hash Function
     sub->add_option(
         "--hash-function",
         opt->hash_function,
-        "Hash function for re-naming and identifying sequences.",
+        "Hash function for re-naming and identifying sequences. MurmurHash3 is a fast "
+        "non-cryptographic function, for when only well-distributed deduplication keys are "
+        "needed; the others are cryptographic, but considerably slower to compute.",
         true
     )->group( "Settings" )
     ->transform(
-        CLI::IsMember({ "SHA1", "SHA256", "MD5" }, CLI::ignore_case )
+        CLI::IsMember({ "SHA1", "SHA256", "MD5", "MurmurHash3" }, CLI::ignore_case )
     );
 
     // -----------------------------------------------------------
@@ -136,6 +184,12 @@ void setup_chunkify( CLI::App& app )
 
     opt->chunk_output.set_optionname( "chunks" );
     opt->chunk_output.add_default_output_opts_to_app( sub );
+    opt->chunk_output.add_file_compress_opt_to_app( sub );
+
+    // Compressed chunk files are written in blocked gzip with a `.gzi` seek index sidecar,
+    // so that downstream tooling can access parts of a chunk without decompressing it
+    // from the start, see tools/gzip_seek_index.hpp.
+    opt->chunk_output.set_gzip_seek_index( true );
 
     opt->abundance_output.set_optionname( "abundances" );
     opt->abundance_output.add_default_output_opts_to_app( sub );
@@ -183,66 +237,271 @@ void write_chunk_file(
     ));
 }
 
-void write_abundance_map_file(
+/**
+ * @brief Return the file extension of the abundance maps, depending on the chosen format.
+ */
+std::string abundance_map_extension( ChunkifyOptions const& options )
+{
+    return options.abundance_format == "binary" ? "bmap" : "json";
+}
+
+/**
+ * @brief Open the abundance map file for one input file in the chosen format,
+ * and return the writer for its entries.
+ */
+AbundanceMapWriter make_abundance_map_writer(
     ChunkifyOptions const& options,
-    AbundancesHashMap const& seq_abundances,
     size_t input_file_counter
 ) {
-    using namespace genesis::utils;
-
     // Base name of the current input file
     auto const base_fn = options.sequence_input.base_file_name( input_file_counter );
 
-    // Pprepare a new abundance file
-    auto ofs = options.abundance_output.get_output_target(
-        "abundances_" + base_fn, "json"
+    return AbundanceMapWriter(
+        options.abundance_output.get_output_target(
+            "abundances_" + base_fn, abundance_map_extension( options )
+        ),
+        options.abundance_format == "binary"
+            ? AbundanceMapFormat::kBinary
+            : AbundanceMapFormat::kJson
+        ,
+        base_fn,
+        options.hash_function
     );
-    (*ofs) << "{\n";
-
-    // Write file metadata.
-    (*ofs) << "  \"sample\": \"" << base_fn << "\",\n";
-    (*ofs) << "  \"gappa\": \"" << gappa_version() << "\",\n";
-    (*ofs) << "  \"invocation\": \"" << global_options.command_line() << "\",\n";
-    (*ofs) << "  \"hash\": \"" << options.hash_function << "\",\n";
-
-    // Write name of the input file for later identification.
-    (*ofs) << "  \"abundances\": [";
+}
 
+void write_abundance_map_file(
+    ChunkifyOptions const& options,
+    AbundancesHashMap const& seq_abundances,
+    size_t input_file_counter
+) {
     // Write abundance information for this file.
-    bool is_first_seq = true;
+    auto writer = make_abundance_map_writer( options, input_file_counter );
     for( auto seq_it = seq_abundances.begin(); seq_it != seq_abundances.end(); ++seq_it ) {
+        writer.write( seq_it->first, seq_it->second.chunk_num, seq_it->second.abundances );
+    }
+    writer.finish();
+}
+
+// =================================================================================================
+//      Abundance Prefilter
+// =================================================================================================
 
-        // Print comma for all but the first entry.
-        if( ! is_first_seq ) {
-            (*ofs) << ",";
+/**
+ * @brief Count-min sketch over the accumulated abundances of the input sequences,
+ * used as a prefilter for --min-abundance.
+ *
+ * The sketch admits a sequence once its accumulated abundance, summed over all records of
+ * the sequence seen so far across all input files, reaches the given threshold. Counting is
+ * approximate: hash collisions can only overestimate a count, so a sequence is never admitted
+ * later than its true accumulated abundance allows, but rare collision victims may be admitted
+ * early, which merely costs them the filtering they would have received. That is, the filter
+ * has false admits, but never false drops.
+ *
+ * The row positions are derived from the two halves of one 128 bit MurmurHash3 of the
+ * sequence, so the prefilter does not need the (potentially cryptographic, and expensive)
+ * --hash-function digests, which are then only computed for admitted sequences.
+ */
+class AbundanceSketch
+{
+public:
+
+    explicit AbundanceSketch( size_t const threshold )
+        : threshold_( threshold )
+    {
+        // Only allocate the counters if the threshold makes the sketch do anything.
+        // Four rows of 2^22 counters (128 MB) keep the collision rate negligible
+        // even for inputs with billions of unique sequences.
+        if( threshold_ > 1 ) {
+            counts_.resize( depth_ * width_, 0 );
         }
-        is_first_seq = false;
-        (*ofs) << "\n";
+    }
 
-        // Print sequence data.
-        (*ofs) << "    [ \"" << seq_it->first << "\", ";
-        (*ofs) << seq_it->second.chunk_num << ", {";
+    /**
+     * @brief Add @p count to the accumulated abundance of @p sites, and return whether
+     * the accumulated abundance has reached the threshold.
+     *
+     * Thread-safe, so that the parallel per-file loop can share one sketch.
+     */
+    bool accumulate_and_admit( std::string const& sites, size_t count )
+    {
+        // Without a meaningful threshold, everything is admitted, and nothing counted.
+        if( threshold_ <= 1 ) {
+            return true;
+        }
 
-        // Write per label abundances.
-        bool is_first_abun = true;
-        for( auto const& label_abun : seq_it->second.abundances ) {
+        auto const digest = Murmur3::string_digest( sites );
+        uint64_t estimate = std::numeric_limits<uint64_t>::max();
+        for( size_t row = 0; row < depth_; ++row ) {
 
-            // Print comma for all but the first entry.
-            if( ! is_first_abun ) {
-                (*ofs) << ",";
-            }
-            is_first_abun = false;
-            (*ofs) << "\n";
+            // Derive the position in this row from the two digest halves (double hashing).
+            auto const pos = row * width_ + ( digest.h1 + row * digest.h2 ) % width_;
 
-            (*ofs) << "      \"" << label_abun.first << "\": " << label_abun.second;
+            uint64_t new_value;
+            #pragma omp atomic capture
+            new_value = ( counts_[ pos ] += count );
+            estimate = std::min( estimate, new_value );
         }
+        return estimate >= threshold_;
+    }
+
+private:
+
+    size_t threshold_;
+
+    static const size_t depth_ = 4;
+    static const size_t width_ = size_t(1) << 22;
+
+    std::vector<uint64_t> counts_;
+};
 
-        (*ofs) << "\n    }]";
+// =================================================================================================
+//      Abundance Spilling
+// =================================================================================================
+
+/**
+ * @brief Spill the current in-memory abundance map as a sorted run to a temporary file,
+ * and clear the map. See --abundance-map-limit.
+ *
+ * Entries are sorted by hash, so that all runs of one input file can be merge-read
+ * in a single sequential pass later, see merge_abundance_runs().
+ */
+void spill_abundance_run(
+    std::string const& run_path,
+    AbundancesHashMap& seq_abundances
+) {
+    using namespace genesis::utils;
+
+    // Move the entries out of the map, and sort them by hash.
+    std::vector<std::pair<std::string, SequenceInfo>> entries;
+    entries.reserve( seq_abundances.size() );
+    for( auto& seq_entry : seq_abundances ) {
+        entries.push_back({ seq_entry.first, std::move( seq_entry.second ) });
     }
+    seq_abundances.clear();
+    std::sort(
+        entries.begin(), entries.end(),
+        []( std::pair<std::string, SequenceInfo> const& lhs,
+            std::pair<std::string, SequenceInfo> const& rhs
+        ){
+            return lhs.first < rhs.first;
+        }
+    );
 
-    // Finish the file.
-    (*ofs) << "\n  ]\n";
-    (*ofs) << "}\n";
+    // Write the sorted run.
+    auto ser = Serializer( to_file( run_path ));
+    ser << static_cast<uint64_t>( entries.size() );
+    for( auto const& entry : entries ) {
+        ser << entry.first;
+        ser << static_cast<uint64_t>( entry.second.chunk_num );
+        ser << static_cast<uint64_t>( entry.second.abundances.size() );
+        for( auto const& label_abun : entry.second.abundances ) {
+            ser << label_abun.first;
+            ser << static_cast<uint64_t>( label_abun.second );
+        }
+    }
+}
+
+/**
+ * @brief Merge the sorted runs of one input file into its final abundance map file,
+ * and remove the temporary run files. See --abundance-map-limit.
+ *
+ * Each run is read sequentially, and a heap over the current head entry of each run
+ * yields the hashes in sorted order, with entries of the same hash from different runs
+ * combined into one. Only one entry per run is in memory at a time, so that the merge
+ * is independent of the number of unique sequences.
+ */
+void merge_abundance_runs(
+    ChunkifyOptions const& options,
+    std::vector<std::string> const& run_paths,
+    size_t input_file_counter
+) {
+    using namespace genesis::utils;
+
+    // Open all runs, and prepare reading their entries one at a time.
+    struct RunReader
+    {
+        Deserializer reader;
+        uint64_t     remaining;
+
+        explicit RunReader( std::string const& path )
+            : reader( from_file( path ))
+            , remaining( 0 )
+        {
+            reader >> remaining;
+        }
+    };
+    auto runs = std::vector<std::unique_ptr<RunReader>>();
+    runs.reserve( run_paths.size() );
+    for( auto const& run_path : run_paths ) {
+        runs.push_back( genesis::utils::make_unique<RunReader>( run_path ));
+    }
+    auto read_entry = [&]( size_t run_index, std::string& hash_hex, SequenceInfo& info ){
+        auto& run = *runs[ run_index ];
+        assert( run.remaining > 0 );
+        --run.remaining;
+        uint64_t chunk_num;
+        uint64_t label_count;
+        run.reader >> hash_hex;
+        run.reader >> chunk_num;
+        run.reader >> label_count;
+        info.chunk_num = chunk_num;
+        info.abundances.clear();
+        for( uint64_t li = 0; li < label_count; ++li ) {
+            std::string label;
+            uint64_t abundance;
+            run.reader >> label;
+            run.reader >> abundance;
+            info.abundances[ label ] += abundance;
+        }
+    };
+
+    // Heap over the head entry of each run, yielding the smallest hash first.
+    // The heap itself only holds the hashes and run indices; the full head entries
+    // are kept per run, so that each one exists only once.
+    using HeapEntry = std::pair<std::string, size_t>;
+    std::priority_queue<HeapEntry, std::vector<HeapEntry>, std::greater<HeapEntry>> heap;
+    auto heads = std::vector<SequenceInfo>( runs.size() );
+    for( size_t ri = 0; ri < runs.size(); ++ri ) {
+        if( runs[ri]->remaining > 0 ) {
+            std::string hash_hex;
+            read_entry( ri, hash_hex, heads[ri] );
+            heap.push({ std::move( hash_hex ), ri });
+        }
+    }
+
+    // Write the merged entries in sorted hash order.
+    auto writer = make_abundance_map_writer( options, input_file_counter );
+    while( ! heap.empty() ) {
+
+        // Take the smallest hash, and combine the entries of all runs that contain it.
+        // The chunk num is the same in all of them, as it is assigned when the hash
+        // is first seen, and shared via the chunk map afterwards.
+        auto const hash_hex = heap.top().first;
+        SequenceInfo info;
+        while( ! heap.empty() && heap.top().first == hash_hex ) {
+            auto const ri = heap.top().second;
+            heap.pop();
+            info.chunk_num = heads[ri].chunk_num;
+            for( auto const& label_abun : heads[ri].abundances ) {
+                info.abundances[ label_abun.first ] += label_abun.second;
+            }
+
+            // Advance the run that we just consumed the head of.
+            if( runs[ri]->remaining > 0 ) {
+                std::string next_hex;
+                read_entry( ri, next_hex, heads[ri] );
+                heap.push({ std::move( next_hex ), ri });
+            }
+        }
+        writer.write( hash_hex, info.chunk_num, info.abundances );
+    }
+    writer.finish();
+
+    // Remove the temporary run files.
+    runs.clear();
+    for( auto const& run_path : run_paths ) {
+        std::remove( run_path.c_str() );
+    }
 }
 
 // =================================================================================================
@@ -280,84 +539,184 @@ void run_chunkify_with_hash( ChunkifyOptions const& options )
     size_t min_abun_count = 0;
     auto const set_size = options.sequence_input.file_count();
 
+    // Full chunks are written on background threads, so that neither reading nor hashing
+    // has to wait for the disk. We keep the futures around to wait for (and to surface
+    // errors of) the pending writes at the end.
+    std::vector<std::future<void>> chunk_writers;
+
+    // Number of sequences that are read ahead and hashed as one batch. Large enough to keep
+    // all threads busy in the parallel hashing below, small enough to not matter memory-wise.
+    size_t const batch_size = 4096;
+
+    // With multiple input files, we parallelize over the files; with a single one, we instead
+    // parallelize the hashing within each batch, so that all cores are used either way.
+    bool const parallel_files = set_size > 1;
+
+    // Two-tier abundance filter, see --min-abundance: records are only admitted once the
+    // accumulated abundance of their sequence reaches the threshold, so that low-abundance
+    // sequences never reach the hashing, the chunk map, or the output files.
+    // The sketch is shared across all input files.
+    AbundanceSketch abundance_sketch( options.min_abundance );
+
     // Iterate fasta files
-    #pragma omp parallel for schedule(dynamic)
+    #pragma omp parallel for schedule(dynamic) if( parallel_files )
     for( size_t fi = 0; fi < set_size; ++fi ) {
         auto const& fasta_filename = options.sequence_input.file_path( fi );
 
         // User output
-        LOG_MSG2 << "Processing file " << ( ++file_count ) << " of " << set_size
+        size_t current_count;
+        #pragma omp atomic capture
+        current_count = ++file_count;
+        LOG_MSG2 << "Processing file " << current_count << " of " << set_size
                  << ": " << fasta_filename;
 
         // Count identical sequences of this fasta file, accessed via their hash.
         AbundancesHashMap seq_abundances;
 
+        // Temporary files with sorted runs of the abundance map of this file,
+        // if the map exceeds the memory limit, see --abundance-map-limit.
+        std::vector<std::string> run_paths;
+        auto const run_path_base =
+            dir_normalize_path( options.abundance_output.out_dir() )
+            + "abundances_" + options.sequence_input.base_file_name( fi ) + "_run_"
+        ;
+
         // Iterate sequences
         auto it = FastaInputIterator(
             from_file( fasta_filename ),
             options.sequence_input.fasta_reader()
         );
+
+        // Per-batch buffers, reused across batches.
+        std::vector<Sequence> batch;
+        std::vector<std::pair<std::string, size_t>> abundances;
+        std::vector<typename HashFunction::DigestType> digests;
+        std::vector<std::string> hexes;
+
         while( it ) {
-            #pragma omp atomic
-            ++total_seqs_count;
 
-            // Check for min abundance.
-            auto const abundance = guess_sequence_abundance( *it );
-            if( abundance.second < options.min_abundance ) {
+            // Read the next batch of sequences that pass the abundance filter.
+            batch.clear();
+            abundances.clear();
+            size_t batch_total = 0;
+            while( it && batch.size() < batch_size ) {
+                ++batch_total;
+
+                // Check for min abundance. A record whose own abundance annotation reaches
+                // the threshold passes immediately; others only once the abundance
+                // accumulated over all records of their sequence does.
+                auto abundance = guess_sequence_abundance( *it );
+                if( abundance_sketch.accumulate_and_admit( it->sites(), abundance.second )) {
+                    batch.push_back( *it );
+                    abundances.push_back( std::move( abundance ));
+                }
                 ++it;
-                continue;
             }
             #pragma omp atomic
-            ++min_abun_count;
-
-            // Calculate (relatively expensive) hashes.
-            auto const hash_digest = HashFunction::read_digest( from_string( it->sites() ));
-            auto const hash_hex = HashFunction::digest_to_hex( hash_digest );
+            total_seqs_count += batch_total;
+            #pragma omp atomic
+            min_abun_count += batch.size();
+
+            // Calculate the (relatively expensive) hashes of the whole batch.
+            digests.resize( batch.size() );
+            hexes.resize( batch.size() );
+            #pragma omp parallel for schedule(static) if( ! parallel_files )
+            for( size_t bi = 0; bi < batch.size(); ++bi ) {
+                digests[bi] = HashFunction::read_digest( from_string( batch[bi].sites() ));
+                hexes[bi]   = HashFunction::digest_to_hex( digests[bi] );
+            }
 
-            // Increment seq abundance for this file and label.
-            auto& seq_abun = seq_abundances[ hash_hex ];
-            seq_abun.abundances[ abundance.first ] += abundance.second;
+            // Increment the seq abundances for this file and the labels of the batch.
+            // These are file-local, so no synchronization is needed for them.
+            auto infos = std::vector<SequenceInfo*>( batch.size(), nullptr );
+            for( size_t bi = 0; bi < batch.size(); ++bi ) {
+                infos[bi] = &seq_abundances[ hexes[bi] ];
+                infos[bi]->abundances[ abundances[bi].first ] += abundances[bi].second;
+            }
 
-            // The hash calculation above is the main work of this loop.
-            // The rest is "just" setting some values (and the occasional chunk flush),
-            // but we need a fully blown critical section for them.
+            // Update the shared chunk map with the whole batch, under one critical section.
+            // Chunks that become full are only moved out here; they are written below,
+            // outside of the lock.
+            std::vector<std::pair<SequenceSet, size_t>> full_chunks;
             #pragma omp critical(GAPPA_CHUNKIFY_UPDATE_MAPS)
             {
-                auto const hash_it = hash_to_chunk.find( hash_digest );
-                if( hash_it != hash_to_chunk.end() ) {
-
-                    // We saw that sequence before. Don't need to add it to the chunk,
-                    // just use its chunk count for the current file.
-                    seq_abun.chunk_num = hash_it->second;
-
-                } else {
-
-                    // New sequence: never saw that hash before. Add it to the chunk, store chunk num.
-                    current_chunk.add( Sequence( hash_hex, it->sites() ));
-                    hash_to_chunk[ hash_digest ] = chunk_count;
-                    seq_abun.chunk_num = chunk_count;
+                for( size_t bi = 0; bi < batch.size(); ++bi ) {
+                    auto const hash_it = hash_to_chunk.find( digests[bi] );
+                    if( hash_it != hash_to_chunk.end() ) {
+
+                        // We saw that sequence before. Don't need to add it to the chunk,
+                        // just use its chunk count for the current file.
+                        infos[bi]->chunk_num = hash_it->second;
+
+                    } else {
+
+                        // New sequence: never saw that hash before.
+                        // Add it to the chunk, store chunk num.
+                        current_chunk.add( Sequence( hexes[bi], batch[bi].sites() ));
+                        hash_to_chunk[ digests[bi] ] = chunk_count;
+                        infos[bi]->chunk_num = chunk_count;
+
+                        // If a chunk is full, move it out for writing.
+                        if( current_chunk.size() >= options.chunk_size ) {
+                            full_chunks.push_back({ std::move( current_chunk ), chunk_count });
+                            ++chunk_count;
+                            current_chunk.clear();
+                        }
+                    }
+                }
+            }
 
-                    // If a chunk is full, flush it.
-                    if( current_chunk.size() >= options.chunk_size ) {
-                        write_chunk_file( options, current_chunk, chunk_count );
-                        ++chunk_count;
-                        current_chunk.clear();
+            // Hand the full chunks of this batch over to background writer threads.
+            for( auto& full_chunk : full_chunks ) {
+                auto chunk_ptr = std::make_shared<SequenceSet>( std::move( full_chunk.first ));
+                auto const chunk_num = full_chunk.second;
+                auto writer = global_options.thread_pool().enqueue(
+                    [ &options, chunk_ptr, chunk_num ](){
+                        write_chunk_file( options, *chunk_ptr, chunk_num );
                     }
+                );
+                #pragma omp critical(GAPPA_CHUNKIFY_CHUNK_WRITERS)
+                {
+                    chunk_writers.push_back( std::move( writer ));
                 }
             }
 
-            ++it;
+            // If the abundance map has grown past the memory limit, spill it as a sorted
+            // run to a temporary file. This happens after the chunk nums of the batch have
+            // been assigned above, so that each spilled entry is complete; a hash that
+            // occurs again later simply starts a fresh entry, which the merge combines.
+            if(
+                options.abundance_map_limit > 0 &&
+                seq_abundances.size() >= options.abundance_map_limit
+            ) {
+                auto run_path = run_path_base + std::to_string( run_paths.size() ) + ".tmp";
+                spill_abundance_run( run_path, seq_abundances );
+                run_paths.push_back( std::move( run_path ));
+            }
         }
 
-        // Finished a fasta file. Write its abundances.
-        write_abundance_map_file( options, seq_abundances, fi );
+        // Finished a fasta file. Write its abundances: directly from memory if nothing
+        // was spilled, or by merging the sorted runs otherwise.
+        if( run_paths.empty() ) {
+            write_abundance_map_file( options, seq_abundances, fi );
+        } else {
+            if( ! seq_abundances.empty() ) {
+                auto run_path = run_path_base + std::to_string( run_paths.size() ) + ".tmp";
+                spill_abundance_run( run_path, seq_abundances );
+                run_paths.push_back( std::move( run_path ));
+            }
+            merge_abundance_runs( options, run_paths, fi );
+        }
     }
 
     // -----------------------------------------------------------
     //     Finish
     // -----------------------------------------------------------
 
-    // Write the remaining chunk.
+    // Wait for the background chunk writes, then write the remaining partial chunk.
+    for( auto& writer : chunk_writers ) {
+        writer.get();
+    }
     write_chunk_file( options, current_chunk, chunk_count );
 
     LOG_MSG1 << "Processed " << total_seqs_count << " sequences, thereof "
@@ -382,7 +741,9 @@ void run_chunkify( ChunkifyOptions const& options )
 
     // Check if any of the files we are going to produce already exists. If so, fail early.
     options.chunk_output.check_output_files_nonexistence( "chunk_*", "fasta" );
-    options.abundance_output.check_output_files_nonexistence( "abundances_*", "json" );
+    options.abundance_output.check_output_files_nonexistence(
+        "abundances_*", abundance_map_extension( options )
+    );
 
     // Print some user output.
     options.sequence_input.print();
@@ -397,6 +758,8 @@ void run_chunkify( ChunkifyOptions const& options )
         run_chunkify_with_hash<SHA256>( options );
     } else if( options.hash_function == "MD5" ) {
         run_chunkify_with_hash<MD5>( options );
+    } else if( options.hash_function == "MurmurHash3" ) {
+        run_chunkify_with_hash<Murmur3>( options );
     } else {
         throw CLI::ConversionError( "Unknown hash function: " + options.hash_function );
     }
@@ -42,6 +42,8 @@ public:
 
     size_t      chunk_size = 50000;
     size_t      min_abundance = 1;
+    size_t      abundance_map_limit = 0;
+    std::string abundance_format = "json";
     std::string hash_function = "SHA1";
 
     SequenceInputOptions sequence_input;
@@ -25,12 +25,12 @@
 
 #include "options/global.hpp"
 #include "tools/cli_setup.hpp"
+#include "tools/newick_buffer_writer.hpp"
 
 #include "CLI/CLI.hpp"
 
 #include "genesis/tree/formats/newick/simple_reader.hpp"
 #include "genesis/tree/formats/newick/simple_tree.hpp"
-#include "genesis/tree/formats/newick/simple_writer.hpp"
 #include "genesis/tree/function/functions.hpp"
 
 #include "genesis/utils/core/fs.hpp"
@@ -252,8 +252,10 @@ void run_clean_tree( CleanTreeOptions const& options )
         LOG_WARN << "No cleaning option was provided. Tree will be written as-is.";
     }
 
-    // Create a newick tree from it.
+    // Create a newick tree from it. We use our buffered serializer here, which keeps the
+    // remaining comments, values, and tags of the simple tree, but writes large trees
+    // considerably faster than the generic genesis writer.
     LOG_MSG1 << "Writing output tree.";
-    auto nw = SimpleNewickTreeNewickWriter();
+    auto nw = NewickBufferWriter();
     nw.write( tree, options.file_output.get_output_target( "clean-tree", "newick" ));
 }
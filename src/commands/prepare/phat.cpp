@@ -25,6 +25,7 @@
 
 #include "options/global.hpp"
 #include "tools/cli_setup.hpp"
+#include "tools/murmur3.hpp"
 
 #include "CLI/CLI.hpp"
 
@@ -49,6 +50,7 @@
 #include "genesis/taxonomy/taxonomy.hpp"
 #include "genesis/taxonomy/taxopath.hpp"
 
+#include "genesis/utils/core/fs.hpp"
 #include "genesis/utils/core/std.hpp"
 #include "genesis/utils/io/input_source.hpp"
 #include "genesis/utils/io/output_stream.hpp"
@@ -58,14 +60,25 @@
 #   include <omp.h>
 #endif
 
+#include <algorithm>
 #include <cctype>
 #include <map>
 #include <fstream>
+#include <unordered_map>
+#include <vector>
 
 // =================================================================================================
 //      Typedefs
 // =================================================================================================
 
+/**
+ * @brief Map from taxon to a hash of its sequence content.
+ *
+ * Used for the entropy cache, see calculate_entropy(): a taxon whose hash is unchanged
+ * between runs has the same sequences, and thus the same entropy.
+ */
+using TaxonContentHashes = std::unordered_map<genesis::taxonomy::Taxon const*, Murmur3::DigestType>;
+
 // =================================================================================================
 //      Setup
 // =================================================================================================
@@ -168,6 +181,16 @@ void setup_phat( CLI::App& app )
         "to try out new ideas."
     )->group( "Taxonomy Expansion" );
 
+    // Entropy cache file
+    sub->add_option(
+        "--entropy-cache-file",
+        opt->entropy_cache_file,
+        "If provided, the per-taxon entropies are persisted to this file, together with a hash "
+        "of each taxon's sequence content. On following runs with a new database release, taxa "
+        "whose sequences did not change then reuse the cached entropy instead of recomputing it. "
+        "The file is (over)written at the end of each run."
+    )->group( "Taxonomy Expansion" );
+
     // -----------------------------------------------------------
     //     Consensus options
     // -----------------------------------------------------------
@@ -297,8 +320,11 @@ genesis::taxonomy::Taxonomy read_taxonomy( PhatOptions const& options )
 //      Fill Site Counts
 // =================================================================================================
 
-void fill_site_counts( PhatOptions const& options, genesis::taxonomy::Taxonomy& tax )
-{
+void fill_site_counts(
+    PhatOptions const& options,
+    genesis::taxonomy::Taxonomy& tax,
+    TaxonContentHashes& taxon_hashes
+) {
     using namespace genesis::sequence;
     using namespace genesis::taxonomy;
     using namespace genesis::utils;
@@ -316,6 +342,11 @@ void fill_site_counts( PhatOptions const& options, genesis::taxonomy::Taxonomy&
 
     // Prepare helpers.
     auto taxopath_parser = TaxopathParser();
+
+    // Many sequences share the same taxopath. Cache the resolution from taxopath string to
+    // taxon (including failed lookups), so that parsing and taxonomy traversal happen once
+    // per distinct path, instead of once per sequence.
+    std::unordered_map<std::string, Taxon*> taxon_lookup_cache;
     auto fasta_reader = FastaReader();
     fasta_reader.site_casing( FastaReader::SiteCasing::kToUpper );
 
@@ -347,11 +378,18 @@ void fill_site_counts( PhatOptions const& options, genesis::taxonomy::Taxonomy&
         // Parse the taxo path and find it in the taxonomy.
         // If the first attempt fails, remove the last element (assumed to be species level),
         // and try again. If we fail again, we cannot use this sequence.
-        auto taxopath = taxopath_parser.parse( taxopath_str );
-        auto taxp = find_taxon_by_taxopath( tax, taxopath );
-        if( taxp == nullptr ) {
-            taxopath.pop_back();
+        Taxon* taxp = nullptr;
+        auto const cache_it = taxon_lookup_cache.find( taxopath_str );
+        if( cache_it != taxon_lookup_cache.end() ) {
+            taxp = cache_it->second;
+        } else {
+            auto taxopath = taxopath_parser.parse( taxopath_str );
             taxp = find_taxon_by_taxopath( tax, taxopath );
+            if( taxp == nullptr ) {
+                taxopath.pop_back();
+                taxp = find_taxon_by_taxopath( tax, taxopath );
+            }
+            taxon_lookup_cache[ taxopath_str ] = taxp;
         }
         if( taxp == nullptr ) {
             LOG_MSG3 << "Sequence " << it->label() << " not found in the taxonomy!";
@@ -371,6 +409,11 @@ void fill_site_counts( PhatOptions const& options, genesis::taxonomy::Taxonomy&
             continue;
         }
 
+        // Hash the sequence content, for the entropy cache. The per-taxon hashes are
+        // accumulated commutatively, so that they do not depend on the order of the
+        // sequences in the input file, which may differ between database releases.
+        auto const seq_hash = Murmur3::string_digest( it->sites() );
+
         // Accummulate counts for all taxonomic ranks.
         // We go up in the taxonomy and add counts to all super-clades as well,
         // until we reach the super taxon that is not part of the selected sub-clade
@@ -378,6 +421,9 @@ void fill_site_counts( PhatOptions const& options, genesis::taxonomy::Taxonomy&
         auto cur_tax = taxp;
         do {
             cur_tax->data<EntropyTaxonData>().counts.add_sequence( *it );
+            auto& tax_hash = taxon_hashes[ cur_tax ];
+            tax_hash.h1 += seq_hash.h1;
+            tax_hash.h2 += seq_hash.h2;
             cur_tax = cur_tax->parent();
         } while( cur_tax != nullptr && cur_tax->has_data() );
 
@@ -423,10 +469,14 @@ void fill_site_counts( PhatOptions const& options, genesis::taxonomy::Taxonomy&
 //      Calculate Entropy
 // =================================================================================================
 
-void calculate_entropy( PhatOptions const& options, genesis::taxonomy::Taxonomy& tax )
-{
+void calculate_entropy(
+    PhatOptions const& options,
+    genesis::taxonomy::Taxonomy& tax,
+    TaxonContentHashes const& taxon_hashes
+) {
     using namespace genesis::sequence;
     using namespace genesis::taxonomy;
+    using namespace genesis::utils;
 
     if( options.no_taxa_selection ) {
         LOG_MSG1 << "Skipping entropy calculation due to --no-taxa-selection being set.";
@@ -440,17 +490,97 @@ void calculate_entropy( PhatOptions const& options, genesis::taxonomy::Taxonomy&
     // auto opt = SiteEntropyOptions::kWeighted;
     auto opt = SiteEntropyOptions::kIncludeGaps;
 
-    // Calculate! Skip those that do not have data, that is, which are not part of the subtaxonomy.
-    // This is a simple way of testing for the subtaxonomy, instead of finding it again here.
-    auto calc_entropies = [&]( Taxon& t ) {
-        if( ! t.has_data() ) {
-            return;
+    // If an entropy cache file from a previous run is given, load it. It maps taxopaths to the
+    // sequence content hash and entropy of the previous run; taxa whose hash is unchanged can
+    // reuse the entropy without recomputing it, which makes runs on a new release of a database
+    // fast when only a fraction of the sequences changed.
+    struct EntropyCacheEntry
+    {
+        Murmur3::DigestType content_hash;
+        double entropy;
+    };
+    std::unordered_map<std::string, EntropyCacheEntry> entropy_cache;
+    if( ! options.entropy_cache_file.empty() && is_file( options.entropy_cache_file )) {
+        LOG_MSG1 << "Loading entropy cache file " << options.entropy_cache_file;
+        auto const lines = split( file_read( options.entropy_cache_file ), "\r\n" );
+        for( auto const& line : lines ) {
+            auto const fields = split( line, "\t" );
+            if( fields.size() != 3 ) {
+                throw std::runtime_error(
+                    "Invalid entropy cache file: " + options.entropy_cache_file
+                );
+            }
+            entropy_cache[ fields[0] ] = {
+                Murmur3::hex_to_digest( fields[1] ), std::stod( fields[2] )
+            };
         }
+    }
 
-        auto const& counts = t.data<EntropyTaxonData>().counts;
-        t.data<EntropyTaxonData>().entropy = average_entropy( counts, false, opt );
-    };
-    preorder_for_each( tax, calc_entropies );
+    // Collect the taxa to process first. Skip those that do not have data, that is, which are
+    // not part of the subtaxonomy. This is a simple way of testing for the subtaxonomy,
+    // instead of finding it again here.
+    std::vector<Taxon*> taxa;
+    preorder_for_each( tax, [&]( Taxon& t ) {
+        if( t.has_data() ) {
+            taxa.push_back( &t );
+        }
+    });
+
+    // We need the taxopaths as cache keys, and to write the cache below.
+    auto const tax_gen = TaxopathGenerator();
+    auto taxopaths = std::vector<std::string>( taxa.size() );
+
+    // Calculate! The taxa are independent of each other, so this can run in parallel.
+    size_t reused_count = 0;
+    #pragma omp parallel for schedule(dynamic)
+    for( size_t i = 0; i < taxa.size(); ++i ) {
+        taxopaths[i] = tax_gen( *taxa[i] );
+
+        // If the taxon has the same sequence content as in the cached run, reuse its entropy.
+        auto const hash_it = taxon_hashes.find( taxa[i] );
+        if( hash_it != taxon_hashes.end() ) {
+            auto const cache_it = entropy_cache.find( taxopaths[i] );
+            if(
+                cache_it != entropy_cache.end() &&
+                cache_it->second.content_hash == hash_it->second
+            ) {
+                taxa[i]->data<EntropyTaxonData>().entropy = cache_it->second.entropy;
+                #pragma omp atomic
+                ++reused_count;
+                continue;
+            }
+        }
+
+        auto const& counts = taxa[i]->data<EntropyTaxonData>().counts;
+        taxa[i]->data<EntropyTaxonData>().entropy = average_entropy( counts, false, opt );
+    }
+    if( ! entropy_cache.empty() ) {
+        LOG_MSG1 << "Reused cached entropy for " << reused_count << " of " << taxa.size()
+                 << " taxa.";
+    }
+
+    // Write the cache for the next run, with the hashes and entropies of this run.
+    if( ! options.entropy_cache_file.empty() ) {
+        LOG_MSG1 << "Writing entropy cache file " << options.entropy_cache_file;
+
+        // Plain stream here: unlike the result files, the cache is meant to be overwritten
+        // on every run, so it does not go through the file overwrite protection.
+        std::ofstream cache_ofs( options.entropy_cache_file );
+        if( ! cache_ofs ) {
+            throw std::runtime_error(
+                "Cannot write entropy cache file: " + options.entropy_cache_file
+            );
+        }
+        cache_ofs.precision( 17 );
+        for( size_t i = 0; i < taxa.size(); ++i ) {
+            auto const hash_it = taxon_hashes.find( taxa[i] );
+            auto const content_hash = hash_it != taxon_hashes.end()
+                ? hash_it->second
+                : Murmur3::DigestType();
+            cache_ofs << taxopaths[i] << "\t" << Murmur3::digest_to_hex( content_hash )
+                      << "\t" << taxa[i]->data<EntropyTaxonData>().entropy << "\n";
+        }
+    }
 }
 
 // =================================================================================================
@@ -533,7 +663,8 @@ void generate_consensus_sequences( PhatOptions const& options, genesis::taxonomy
     ) {
         out << ">" << name << "\n";
         for (size_t i = 0; i < sites.length(); i += 80) {
-            out << sites.substr(i, 80) << "\n";
+            out.write( &sites[i], std::min<size_t>( 80, sites.length() - i ));
+            out << "\n";
         }
     };
 
@@ -543,46 +674,60 @@ void generate_consensus_sequences( PhatOptions const& options, genesis::taxonomy
     );
     auto const tax_gen = TaxopathGenerator();
 
+    // Check the consensus method once up front, instead of in the parallel loop below.
+    if(
+        options.consensus_method != "majorities" &&
+        options.consensus_method != "cavener" &&
+        options.consensus_method != "threshold"
+    ) {
+        throw CLI::ConversionError( "Unknown consensus method: " + options.consensus_method );
+    }
+
     // Collect taxa that do not have any data
     std::vector<std::string> no_data_taxa;
 
-    // Calculate consensus sequences and write them.
-    auto make_consensus_sequences = [&]( Taxon const& t ) {
-
-        // Skip taxa that are not in the subtaxonomy.
+    // Collect the border taxa of the subtaxonomy in preorder, so that the consensus sequences
+    // can be computed in parallel, while the output file keeps its usual order.
+    std::vector<Taxon const*> border_taxa;
+    preorder_for_each( tax, [&]( Taxon const& t ) {
         if( ! t.has_data() ) {
             return;
         }
-
-        // Only interested in the border taxa.
         if( t.data<EntropyTaxonData>().status != EntropyTaxonData::PruneStatus::kBorder ) {
             return;
         }
-
-        // Prep.
-        auto const name = sanitize_label( tax_gen(t) );
+        border_taxa.push_back( &t );
+    });
+
+    // Calculate the consensus sequences. The taxa are independent of each other.
+    auto names = std::vector<std::string>( border_taxa.size() );
+    auto sites = std::vector<std::string>( border_taxa.size() );
+    #pragma omp parallel for schedule(dynamic)
+    for( size_t i = 0; i < border_taxa.size(); ++i ) {
+        auto const& t = *border_taxa[i];
         auto const& counts = t.data<EntropyTaxonData>().counts;
+        names[i] = sanitize_label( tax_gen(t) );
 
-        // Collect taxa with no data. This is reported to the user later.
-        if( counts.added_sequences_count() == 0 ) {
-            no_data_taxa.push_back( name );
-        }
-
-        // Consensus sequence.
-        std::string sites;
         if( options.consensus_method == "majorities" ) {
-            sites = consensus_sequence_with_majorities( counts );
+            sites[i] = consensus_sequence_with_majorities( counts );
         } else if( options.consensus_method == "cavener" ) {
-            sites = consensus_sequence_cavener( counts );
+            sites[i] = consensus_sequence_cavener( counts );
         } else if( options.consensus_method == "threshold" ) {
-            sites = consensus_sequence_with_threshold( counts, options.consensus_threshold );
-        } else {
-            throw CLI::ConversionError( "Unknown consensus method: " + options.consensus_method );
+            sites[i] = consensus_sequence_with_threshold( counts, options.consensus_threshold );
         }
-        write_fasta_sequence( cons_target->ostream(), name, sites );
+    }
 
-    };
-    preorder_for_each( tax, make_consensus_sequences );
+    // Write the sequences, in the order of the taxa in the taxonomy.
+    for( size_t i = 0; i < border_taxa.size(); ++i ) {
+
+        // Collect taxa with no data. This is reported to the user later.
+        auto const& counts = border_taxa[i]->data<EntropyTaxonData>().counts;
+        if( counts.added_sequences_count() == 0 ) {
+            no_data_taxa.push_back( names[i] );
+        }
+
+        write_fasta_sequence( cons_target->ostream(), names[i], sites[i] );
+    }
 
     // User warning for empty taxa
     if( ! no_data_taxa.empty() ) {
@@ -686,8 +831,9 @@ void run_phat( PhatOptions const& options )
 
     // Run the whole thing!
     auto taxonomy = read_taxonomy( options );
-    fill_site_counts( options, taxonomy );
-    calculate_entropy( options, taxonomy );
+    TaxonContentHashes taxon_hashes;
+    fill_site_counts( options, taxonomy, taxon_hashes );
+    calculate_entropy( options, taxonomy, taxon_hashes );
     select_taxa( options, taxonomy );
     generate_consensus_sequences( options, taxonomy );
     write_info_files( options, taxonomy );
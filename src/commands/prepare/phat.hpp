@@ -52,6 +52,7 @@ public:
     size_t min_tax_level        = 0;
     bool   allow_approximation  = false;
     bool   no_taxa_selection    = false;
+    std::string entropy_cache_file;
 
     // Consensus options.
     std::string consensus_method = "majorities";
@@ -41,12 +41,10 @@
 #include "genesis/tree/common_tree/newick_writer.hpp"
 
 #include "genesis/utils/core/fs.hpp"
-#include "genesis/utils/formats/csv/input_iterator.hpp"
-#include "genesis/utils/formats/csv/reader.hpp"
 #include "genesis/utils/io/input_source.hpp"
 #include "genesis/utils/io/output_target.hpp"
 
-#include <cassert>
+#include <array>
 #include <cctype>
 #include <string>
 #include <stdexcept>
@@ -179,32 +177,49 @@ void run_taxonomy_tree( TaxonomyTreeOptions const& options )
         // sort_by_name( taxonomy );
     }
 
-    // If taxon list is given, read it.
+    // If taxon list is given, read it. The file has one name and one taxopath per line,
+    // separated by a tab, often for millions of taxa. We hence read the whole file into
+    // memory at once and scan for the delimiters ourselves, which avoids the per-cell string
+    // handling of the generic csv machinery, and reuse a single taxopath parser throughout.
     std::unordered_map<std::string, Taxopath> taxa_list;
     if( ! options.taxon_list_file.empty() ) {
-        auto reader = CsvReader();
-        reader.separator_chars( "\t" );
-        auto csv_it = CsvInputIterator( from_file( options.taxon_list_file ), reader );
-        while( csv_it ) {
-            auto const& line = *csv_it;
-            if( line.size() != 2 ) {
+        auto const content = file_read( options.taxon_list_file );
+        auto const parser = TaxopathParser();
+
+        size_t pos = 0;
+        while( pos < content.size() ) {
+
+            // Find the end of the line, excluding any trailing carriage return.
+            auto line_end = content.find( '\n', pos );
+            if( line_end == std::string::npos ) {
+                line_end = content.size();
+            }
+            auto term = line_end;
+            if( term > pos && content[ term - 1 ] == '\r' ) {
+                --term;
+            }
+
+            // The line needs to consist of exactly two fields.
+            auto const tab = content.find( '\t', pos );
+            if( tab >= term || content.find( '\t', tab + 1 ) < term ) {
                 throw CLI::ValidationError(
                     "--taxon-list-file (" + options.taxon_list_file + ")",
                     "Invalid line that does not have two fields."
                 );
             }
-            if( taxa_list.count( line[0] ) > 0 ) {
+
+            auto name = content.substr( pos, tab - pos );
+            if( taxa_list.count( name ) > 0 ) {
                 throw CLI::ValidationError(
                     "--taxon-list-file (" + options.taxon_list_file + ")",
-                    "Duplicate taxon name (" + line[0] + ")."
+                    "Duplicate taxon name (" + name + ")."
                 );
             }
 
-            assert( line.size() == 2 );
-            auto const path = TaxopathParser().parse( line[1] );
-            taxa_list[ line[0] ] = path;
+            auto const path = parser.parse( content.substr( tab + 1, term - tab - 1 ));
+            taxa_list[ std::move( name ) ] = path;
 
-            csv_it.increment();
+            pos = line_end + 1;
         }
     }
 
@@ -222,8 +237,11 @@ void run_taxonomy_tree( TaxonomyTreeOptions const& options )
     // but maybe still better warn the user about this!
     // We do this check here, directly on the tree, so that we only warn about chars
     // that will actually be in the output file.
-    auto is_valid_name_char = [&]( char c ){
-        return   ::isprint(c)
+    // We precompute a lookup table over all characters once, so that the scanning loops
+    // below are plain byte scans, instead of calling the ctype functions per character.
+    std::array<bool, 256> valid_char_table;
+    for( size_t c = 0; c < valid_char_table.size(); ++c ) {
+        valid_char_table[c] = ::isprint(c)
             && ! ::isspace(c)
             && c != ':'
             && c != ';'
@@ -234,6 +252,9 @@ void run_taxonomy_tree( TaxonomyTreeOptions const& options )
             && c != ','
             && c != '"'
         ;
+    }
+    auto is_valid_name_char = [&]( char c ){
+        return valid_char_table[ static_cast<unsigned char>( c ) ];
     };
     if( options.replace_invalid_chars ) {
         size_t inval_cnt = 0;
@@ -24,12 +24,15 @@
 #include "commands/prepare/unchunkify.hpp"
 
 #include "options/global.hpp"
+#include "tools/abundance_map.hpp"
+#include "tools/bloom_filter.hpp"
 #include "tools/cli_setup.hpp"
+#include "tools/jplace_stream_writer.hpp"
+#include "tools/murmur3.hpp"
 
 #include "CLI/CLI.hpp"
 
 #include "genesis/placement/formats/jplace_reader.hpp"
-#include "genesis/placement/formats/jplace_writer.hpp"
 #include "genesis/placement/sample.hpp"
 
 #include "genesis/sequence/sequence.hpp"
@@ -39,9 +42,6 @@
 
 #include "genesis/utils/containers/mru_cache.hpp"
 #include "genesis/utils/core/fs.hpp"
-#include "genesis/utils/formats/json/document.hpp"
-#include "genesis/utils/formats/json/iterator.hpp"
-#include "genesis/utils/formats/json/reader.hpp"
 #include "genesis/utils/io/input_source.hpp"
 #include "genesis/utils/io/output_target.hpp"
 #include "genesis/utils/text/string.hpp"
@@ -53,12 +53,19 @@
 #   include <omp.h>
 #endif
 
+#include <sparsepp/spp.h>
+
 #include <algorithm>
 #include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <future>
 #include <limits>
 #include <memory>
+#include <set>
 #include <unordered_map>
 #include <utility>
+#include <vector>
 
 // =================================================================================================
 //      Typedefs
@@ -75,6 +82,24 @@ enum class UnchunkifyMode
     kJplaceInput
 };
 
+/**
+ * @brief Hash map type for the digest lookup structures of this command.
+ *
+ * We use the open-addressing map of sparsepp instead of std::unordered_map, as the maps
+ * here can hold hundreds of millions of digests, where the node allocations and pointer
+ * chasing of the standard map dominate both build time and memory.
+ *
+ * sparsepp has issues with old debug versions of the STL, so we need to deactivate in
+ * these cases, same as in the chunkify command.
+ */
+#if ( defined(DEBUG) && !defined(__clang__) && defined(__GNUC__) && __GNUC___ <= 5 )
+    template< typename K, typename V >
+    using DigestHashMap = std::unordered_map< K, V >;
+#else
+    template< typename K, typename V >
+    using DigestHashMap = spp::sparse_hash_map< K, V >;
+#endif
+
 /**
  * @brief Store a sample, along with a map from sequence hash to the pquery index in the sample.
  *
@@ -84,7 +109,7 @@ template< class HashFunction >
 struct MappedSample
 {
     genesis::placement::Sample sample;
-    std::unordered_map<typename HashFunction::DigestType, size_t> hash_to_index;
+    DigestHashMap<typename HashFunction::DigestType, size_t> hash_to_index;
 };
 
 /**
@@ -102,7 +127,7 @@ struct SamplePqueryIndices
  * Needed for the jplace files input mode.
  */
 template< class HashFunction >
-using HashToIndexMap = std::unordered_map<typename HashFunction::DigestType, SamplePqueryIndices>;
+using HashToIndexMap = DigestHashMap<typename HashFunction::DigestType, SamplePqueryIndices>;
 
 /**
  * @brief Cache for chunk jplace files, mapping from file path to sample.
@@ -128,7 +153,7 @@ void setup_unchunkify( CLI::App& app )
     // -----------------------------------------------------------
 
     opt->abundance_map_input.add_multi_file_input_opt_to_app(
-        sub, "abundances", "json(\\.gz)?", "json[.gz]"
+        sub, "abundances", "(json|bmap)(\\.gz)?", "(json|bmap)[.gz]"
     );
     opt->jplace_input.add_jplace_input_opt_to_app( sub, false )->group( "Input" );
     opt->sequence_input.add_sequence_input_opt_to_app( sub, false )->group( "Input" );
@@ -165,6 +190,17 @@ void setup_unchunkify( CLI::App& app )
         true
     )->group( "Settings" );
 
+    // Map batch size
+    sub->add_option(
+        "--map-batch-size",
+        opt->map_batch_size,
+        "Number of abundance map files that are processed together in one chunk-major pass. "
+        "Within a batch, each referenced chunk jplace file is loaded only once, so larger "
+        "batches read each chunk fewer times overall, at the cost of keeping more per-sample "
+        "data in memory.",
+        true
+    )->group( "Settings" );
+
     // Hash Function
     sub->add_option(
         "--hash-function",
@@ -173,7 +209,7 @@ void setup_unchunkify( CLI::App& app )
         true
     )->group( "Settings" )
     ->transform(
-        CLI::IsMember({ "SHA1", "SHA256", "MD5" }, CLI::ignore_case )
+        CLI::IsMember({ "SHA1", "SHA256", "MD5", "MurmurHash3" }, CLI::ignore_case )
     );
 
     // Make the three input modes mutually exclusive.
@@ -270,32 +306,47 @@ HashToIndexMap<HashFunction> get_hash_to_indices_map(
 
     // Load all (!) chunk files once (possibly removing the earlier ones from the cache while
     // doing so), and for each pquery, store its names and indices for later lookup.
-    // As the actual storage is critical, this loop does not scale well.
-    // But at least, the file loading is done in parallel... Could optimize if needed.
+    // Each thread collects the entries of its files locally, and merges them into the shared
+    // map once per file, so that the lock is not taken per pquery name.
     #pragma omp parallel for schedule(dynamic)
     for( size_t sample_idx = 0; sample_idx < options.jplace_input.file_count(); ++sample_idx ) {
 
         auto const file_path = options.jplace_input.file_path( sample_idx );
         auto const chunk = chunk_cache.fetch_copy( file_path );
 
+        // Chunk files have one hash name per pquery, so the pquery count of the sample
+        // is the exact final size of the map.
+        HashToIndexMap<HashFunction> local_map;
+        local_map.reserve( chunk->sample.size() );
         for( size_t pquery_idx = 0; pquery_idx < chunk->sample.size(); ++pquery_idx ) {
             auto const& pquery = chunk->sample.at( pquery_idx );
 
             for( auto const& name : pquery.names() ) {
                 auto const digest = HashFunction::hex_to_digest( name.name );
-                if( hash_map.count( digest ) > 0 ) {
-                    auto const file2 = options.jplace_input.file_path(
-                        hash_map[ digest ].sample_index
-                    );
+                if( ! local_map.insert({ digest, { sample_idx, pquery_idx }}).second ) {
                     throw std::runtime_error(
-                        "Pquery with hash name '" + name.name + "' exists in multiple files: " +
-                        file_path + " and " + file2
+                        "Pquery with hash name '" + name.name +
+                        "' exists multiple times in file: " + file_path
                     );
                 }
+            }
+        }
 
-                #pragma omp critical(GAPPA_UNCHUNKIFY_FILL_HASH_INDICES_MAP)
-                {
-                    hash_map[ digest ] = { sample_idx, pquery_idx };
+        #pragma omp critical(GAPPA_UNCHUNKIFY_FILL_HASH_INDICES_MAP)
+        {
+            // Grow the shared map by whole files, instead of rehashing entry by entry.
+            hash_map.reserve( hash_map.size() + local_map.size() );
+            for( auto const& entry : local_map ) {
+                auto const inserted = hash_map.insert( entry );
+                if( ! inserted.second ) {
+                    auto const file2 = options.jplace_input.file_path(
+                        inserted.first->second.sample_index
+                    );
+                    throw std::runtime_error(
+                        "Pquery with hash name '" +
+                        HashFunction::digest_to_hex( entry.first ) +
+                        "' exists in multiple files: " + file_path + " and " + file2
+                    );
                 }
             }
         }
@@ -363,7 +414,9 @@ std::shared_ptr<MappedSample<HashFunction>> load_sample(
     );
 
     // If we are in a mode that needs per-sample indicies, create the map from hashes to indices.
+    // Chunk files have one hash name per pquery, so the pquery count is the final map size.
     if( mode == UnchunkifyMode::kChunkFileExpression || mode == UnchunkifyMode::kChunkListFile ) {
+        mapped_sample->hash_to_index.reserve( mapped_sample->sample.size() );
         for( size_t pquery_idx = 0; pquery_idx < mapped_sample->sample.size(); ++pquery_idx ) {
             auto const& pquery = mapped_sample->sample.at( pquery_idx );
 
@@ -385,27 +438,38 @@ std::shared_ptr<MappedSample<HashFunction>> load_sample(
 }
 
 /**
- * @brief Sort the abundance by chunk id, in order to minimize loading.
+ * @brief Extract the two 64 bit hashes for the Bloom prefilter from a digest.
+ *
+ * All supported digest types provide at least 128 bit of well-mixed hash output,
+ * so two words of the digest itself serve as the independent hashes.
  */
-void sort_abundances_by_chunk_id(
-    genesis::utils::JsonDocument::ArrayType& arr,
-    std::string const& map_filename
+template< class HashFunction >
+std::pair<uint64_t, uint64_t> digest_bloom_hashes(
+    typename HashFunction::DigestType const& digest
 ) {
-    using namespace genesis::utils;
+    static_assert(
+        sizeof( typename HashFunction::DigestType ) >= 16,
+        "Digest types need at least 128 bit for the Bloom prefilter."
+    );
+    uint64_t hash_1;
+    uint64_t hash_2;
+    std::memcpy( &hash_1, reinterpret_cast<char const*>( &digest ),     sizeof( hash_1 ));
+    std::memcpy( &hash_2, reinterpret_cast<char const*>( &digest ) + 8, sizeof( hash_2 ));
+    return { hash_1, hash_2 };
+}
 
-    auto sort_by_chunk_id = [&]( JsonDocument const& lhs, JsonDocument const& rhs )
-    {
-        // Caution.
-        if(
-            ! lhs.is_array() || lhs.size() != 3 || ! lhs[1].is_number_unsigned() ||
-            ! rhs.is_array() || rhs.size() != 3 || ! rhs[1].is_number_unsigned()
-        ) {
-            throw std::runtime_error( "Invalid abundance map: " + map_filename );
+/**
+ * @brief Sort the abundance by chunk id, in order to minimize loading.
+ */
+void sort_abundances_by_chunk_id( std::vector<AbundanceMapEntry>& entries )
+{
+    std::sort(
+        entries.begin(), entries.end(),
+        []( AbundanceMapEntry const& lhs, AbundanceMapEntry const& rhs )
+        {
+            return lhs.chunk_num < rhs.chunk_num;
         }
-
-        return lhs.get_array()[1].get_number_unsigned() < rhs.get_array()[1].get_number_unsigned();
-    };
-    std::sort( arr.begin(), arr.end(), sort_by_chunk_id );
+    );
 }
 
 // =================================================================================================
@@ -415,7 +479,7 @@ void sort_abundances_by_chunk_id(
 /**
  * @brief Inner loop function for proessing an abundance map file.
  *
- * Its main input is a sequence entry from the json abundance map.
+ * Its main input is a sequence entry from the abundance map.
  * It then uses all kind of other inputs (unfortunately...), and returns the jplace chunk from
  * the cache along with the index of the pquery that was specified in the sequence entry.
  *
@@ -424,8 +488,9 @@ void sort_abundances_by_chunk_id(
  */
 template< class HashFunction >
 std::pair<std::shared_ptr<MappedSample<HashFunction>>, size_t> get_chunk_and_pquery(
-    genesis::utils::JsonDocument const& seq_entry,
+    AbundanceMapEntry const&            seq_entry,
     HashToIndexMap<HashFunction> const& hash_to_indices,
+    BloomFilter const&                  hash_bloom,
     std::vector<std::string>     const& chunk_list,
     UnchunkifyOptions const&            options,
     UnchunkifyMode const&               mode,
@@ -434,22 +499,8 @@ std::pair<std::shared_ptr<MappedSample<HashFunction>>, size_t> get_chunk_and_pqu
 ) {
     using namespace genesis::utils;
 
-    // Test the json object:
-    //  [0]: the hash hex value
-    //  [1]: the chunk number
-    //  [2]: the object that maps sequence labels to abundances
-    if(
-        ! seq_entry.is_array() ||
-        seq_entry.size() != 3  ||
-        ! seq_entry[0].is_string() ||
-        ! seq_entry[1].is_number_unsigned() ||
-        ! seq_entry[2].is_object()
-    ) {
-        throw std::runtime_error( "Invalid abundance map: " + map_filename );
-    }
-
     // Get the hash that we are trying to find the the chunks.
-    auto const digest = HashFunction::hex_to_digest( seq_entry[0].get_string() );
+    auto const digest = HashFunction::hex_to_digest( seq_entry.hash_hex );
 
     // Get sample path depending on mode.
     std::string sample_file_path;
@@ -457,10 +508,18 @@ std::pair<std::shared_ptr<MappedSample<HashFunction>>, size_t> get_chunk_and_pqu
     if( mode == UnchunkifyMode::kJplaceInput ) {
 
         // In jplace input mode, get both sample path and pquery index from the big map.
-        if( hash_to_indices.count( digest ) == 0 ) {
+        // A large share of the probes miss (sequences filtered out between chunkify and
+        // placement), so we consult the Bloom prefilter first: a definite "not there"
+        // answer costs one cache line, instead of a full probe of the multi-GB map.
+        auto const bloom_hashes = digest_bloom_hashes<HashFunction>( digest );
+        if( ! hash_bloom.may_contain( bloom_hashes.first, bloom_hashes.second )) {
             // The hash is not there. Return empty.
             return {};
         }
+        if( hash_to_indices.count( digest ) == 0 ) {
+            // False positive of the prefilter; the full probe settles it. Return empty.
+            return {};
+        }
         auto const& indices = hash_to_indices.at( digest );
         sample_file_path = options.jplace_input.file_path( indices.sample_index );
         pquery_idx = indices.pquery_index;
@@ -468,7 +527,7 @@ std::pair<std::shared_ptr<MappedSample<HashFunction>>, size_t> get_chunk_and_pqu
     } else if( mode == UnchunkifyMode::kChunkFileExpression ) {
 
         // In expression mode, get the sample path by replacing in the expression.
-        auto const chunk_num = seq_entry[1].get_number_unsigned();
+        auto const chunk_num = seq_entry.chunk_num;
         sample_file_path = replace_all(
             options.chunk_file_expression, "@", std::to_string( chunk_num )
         );
@@ -481,7 +540,7 @@ std::pair<std::shared_ptr<MappedSample<HashFunction>>, size_t> get_chunk_and_pqu
     } else if( mode == UnchunkifyMode::kChunkListFile ) {
 
         // In list file mode, get the path from the list file.
-        auto const chunk_num = seq_entry[1].get_number_unsigned();
+        auto const chunk_num = seq_entry.chunk_num;
         if( chunk_num >= chunk_list.size() ) {
             throw std::runtime_error(
                 "Chunk index " + std::to_string( chunk_num ) + " does not exist in chunk list file, " +
@@ -517,32 +576,13 @@ std::pair<std::shared_ptr<MappedSample<HashFunction>>, size_t> get_chunk_and_pqu
  * the actual sequence labels and abundances fromt he map file.
  */
 void add_sequence_names_and_abundances(
-    genesis::utils::JsonDocument const& seq_entry,
-    genesis::placement::Pquery&         pquery,
-    std::string const&                  map_filename
+    AbundanceMapEntry const&    seq_entry,
+    genesis::placement::Pquery& pquery
 ) {
-    // That was checked before already, but why not. It's cheap.
-    if(
-        ! seq_entry.is_array() ||
-        seq_entry.size() != 3  ||
-        ! seq_entry[0].is_string() ||
-        ! seq_entry[1].is_number_unsigned() ||
-        ! seq_entry[2].is_object()
-    ) {
-        throw std::runtime_error( "Invalid abundance map: " + map_filename );
-    }
-
     // Remove the hash name, and add the actual sequence names and abundances.
     pquery.clear_names();
-    auto const& mult_arr = seq_entry[2].get_object();
-    for( auto const& mult_obj : mult_arr ) {
-        auto const& label = mult_obj.first;
-        if( ! mult_obj.second.is_number_unsigned() ) {
-            throw std::runtime_error( "Invalid abundance map: " + map_filename );
-        }
-        auto const mult = mult_obj.second.get_number_unsigned();
-
-        pquery.add_name( label, mult );
+    for( auto const& label_abun : seq_entry.abundances ) {
+        pquery.add_name( label_abun.first, label_abun.second );
     }
 }
 
@@ -550,17 +590,16 @@ void add_sequence_names_and_abundances(
  * @brief Write the actual sequences associated with this sequence hash to the output file.
  */
 void write_all_seqs_of_hash(
-    genesis::utils::JsonDocument const&     seq_entry,
-    genesis::sequence::SequenceSet const&   msa,
-    std::ofstream&                          outstream,
-    std::string const&                      map_filename
+    AbundanceMapEntry const&              seq_entry,
+    genesis::sequence::SequenceSet const& msa,
+    std::ofstream&                        outstream
 ) {
     using namespace genesis::sequence;
 
     assert( outstream.is_open() );
 
     // get the hash name and its associated sequence
-    auto const hash = seq_entry[0].get_string();
+    auto const& hash = seq_entry.hash_hex;
     auto const seq_ptr = find_sequence( msa, hash );
 
     if ( seq_ptr == nullptr ) {
@@ -571,15 +610,10 @@ void write_all_seqs_of_hash(
     Sequence seq = *seq_ptr;
 
     // get the actual names for this hash, add all those sequences to the output file
-    auto const& mult_arr = seq_entry[2].get_object();
-    for( auto const& mult_obj : mult_arr ) {
-        auto const& label = mult_obj.first;
-        if( ! mult_obj.second.is_number_unsigned() ) {
-            throw std::runtime_error( "Invalid abundance map: " + map_filename );
-        }
+    for( auto const& label_abun : seq_entry.abundances ) {
 
         // adjust the label
-        seq.label( label );
+        seq.label( label_abun.first );
 
         // write out
         FastaWriter().write_sequence( seq, outstream );
@@ -608,9 +642,6 @@ void run_unchunkify_with_hash( UnchunkifyOptions const& options )
     //     Prepare Helper Data
     // -----------------------------------------------------------
 
-    // Writer for samples
-    auto const jplace_writer = JplaceWriter();
-
     // Make a cache for storing the jplace chunk files.
     // We load a file given its path. This makes it flexible for the different
     // modes to decide how they get the path from their input.
@@ -626,6 +657,15 @@ void run_unchunkify_with_hash( UnchunkifyOptions const& options )
     // It is only filled if the mode is actually jplace input.
     auto const hash_to_indices = get_hash_to_indices_map<HashFunction>( options, chunk_cache, mode );
 
+    // Bloom prefilter over the keys of the map, so that the many lookup misses during the
+    // abundance map processing are answered without probing the map itself. Empty (and
+    // never consulted) in the other modes, where the map is empty as well.
+    BloomFilter hash_bloom( hash_to_indices.size() );
+    for( auto const& entry : hash_to_indices ) {
+        auto const bloom_hashes = digest_bloom_hashes<HashFunction>( entry.first );
+        hash_bloom.insert( bloom_hashes.first, bloom_hashes.second );
+    }
+
     // Mode Chunk List file. Read the list file.
     // It is only filled if the mode is actually chunk list file.
     auto const chunk_list = get_chunk_list_file( options, mode );
@@ -639,92 +679,165 @@ void run_unchunkify_with_hash( UnchunkifyOptions const& options )
     size_t total_seqs_count = 0;
     size_t not_found_count = 0;
 
-    // Iterate map files
-    #pragma omp parallel for schedule(dynamic)
-    for( size_t fi = 0; fi < options.abundance_map_input.file_count(); ++fi ) {
-        auto const& map_filename = options.abundance_map_input.file_path( fi );
-
-        // User output
-        LOG_MSG2 << "Processing file " << ( ++file_count ) << " of "
-                 << options.abundance_map_input.file_count()
-                 << ": " << map_filename;
-
-        // Read map file and do some checks.
-        auto doc = JsonReader().read( genesis::utils::from_file( map_filename ));
-        if( ! doc.is_object() ) {
-            throw std::runtime_error( "Invalid abundance map: " + map_filename );
-        }
-        auto hash_it = doc.find( "hash" );
-        if( hash_it == doc.end() || ! hash_it->is_string() ) {
-            throw std::runtime_error( "Invalid abundance map: " + map_filename );
-        }
-        if( ! equals_ci( hash_it->get_string(), options.hash_function )) {
-            throw std::runtime_error(
-                "Command was called with hash function " + options.hash_function +
-                ", but abundance map file specifies hash function " + hash_it->get_string() +
-                ": " + map_filename
-            );
-        }
-        auto abun_it = doc.find( "abundances" );
-        if( abun_it == doc.end() || ! abun_it->is_array() ) {
-            throw std::runtime_error( "Invalid abundance map: " + map_filename );
-        }
-
-        // Sort mapped sequences by chunk id, in order to minimize loading.
-        sort_abundances_by_chunk_id( abun_it->get_array(), map_filename );
+    auto const map_count = options.abundance_map_input.file_count();
+    auto const batch_size = std::max<size_t>( 1, options.map_batch_size );
 
-        // Create empty sample.
+    // Per-map state while its batch is being processed.
+    struct MapFileState
+    {
+        std::string map_filename;
+        std::string sample_name;
+        AbundanceMap map;
         Sample sample;
+        std::ofstream per_sample_msa;
+        size_t next_entry = 0;
+    };
+
+    // Process the abundance maps in batches, and the entries within each batch chunk-major:
+    // all entries of all maps of the batch that refer to a given chunk are processed while
+    // that chunk is loaded, before moving on to the next chunk. Together with the sorting of
+    // the entries by chunk, this way each chunk jplace file is parsed once per batch, instead
+    // of the cache thrashing that occurs when many maps walk the chunks independently.
+    for( size_t batch_begin = 0; batch_begin < map_count; batch_begin += batch_size ) {
+        auto const batch_end = std::min( map_count, batch_begin + batch_size );
+        auto states = std::vector<MapFileState>( batch_end - batch_begin );
+
+        // Read and validate all abundance maps of the batch.
+        #pragma omp parallel for schedule(dynamic)
+        for( size_t bi = 0; bi < states.size(); ++bi ) {
+            auto& state = states[bi];
+            state.map_filename = options.abundance_map_input.file_path( batch_begin + bi );
+
+            // User output
+            size_t current_count;
+            #pragma omp atomic capture
+            current_count = ++file_count;
+            LOG_MSG2 << "Processing file " << current_count << " of " << map_count
+                     << ": " << state.map_filename;
+
+            // Read map file (json or binary, depending on the extension) and do some checks.
+            state.map = read_abundance_map( state.map_filename );
+            if( ! equals_ci( state.map.hash_function, options.hash_function )) {
+                throw std::runtime_error(
+                    "Command was called with hash function " + options.hash_function +
+                    ", but abundance map file specifies hash function " + state.map.hash_function +
+                    ": " + state.map_filename
+                );
+            }
+
+            // Sort mapped sequences by chunk id, so that the entries for each chunk
+            // form one contiguous run in the array.
+            sort_abundances_by_chunk_id( state.map.entries );
 
-        // Get sample name.
-        auto sample_name_it = doc.find( "sample" );
-        if( sample_name_it == doc.end() || ! sample_name_it->is_string() ) {
-            throw std::runtime_error( "Invalid abundance map: " + map_filename );
+            // Get sample name.
+            state.sample_name = state.map.sample;
+
+            // if we are to write per-sample MSAs, prepare an output stream for this sample
+            if( write_per_sample_MSAs ) {
+                state.per_sample_msa = std::ofstream(
+                    options.file_output.out_dir() + state.sample_name + ".fasta"
+                );
+            }
         }
-        auto const& sample_name = sample_name_it->get_string();
-
-        // if we are to write per-sample MSAs, prepare a FastaWriter for this sample
-        std::ofstream per_sample_msa = write_per_sample_MSAs
-            ? std::ofstream(options.file_output.out_dir() + sample_name + ".fasta")
-            : std::ofstream();
-
-        // Loop over mapped sequences and add them to the sample.
-        for( auto seq_entry_it = abun_it->begin(); seq_entry_it != abun_it->end(); ++seq_entry_it ) {
-            #pragma omp atomic
-            ++total_seqs_count;
-
-            // Get the chunk and pquery index.
-            // If not found, there is no pquery for the current sequence.
-            auto const chunk_and_pquery = get_chunk_and_pquery(
-                *seq_entry_it, hash_to_indices, chunk_list, options, mode, map_filename, chunk_cache
-            );
-            auto const chunk = chunk_and_pquery.first;
-            auto const pquery_idx = chunk_and_pquery.second;
-            if( ! chunk ) {
-                #pragma omp atomic
-                ++not_found_count;
-                continue;
+
+        // Collect the distinct chunk numbers that this batch references, in ascending order.
+        // This is the schedule for the chunk-major pass below.
+        std::set<size_t> batch_chunks;
+        for( auto const& state : states ) {
+            for( auto const& seq_entry : state.map.entries ) {
+                batch_chunks.insert( seq_entry.chunk_num );
             }
+        }
 
-            // New sample: give it a tree!
-            if( sample.empty() ) {
-                sample = Sample( chunk->sample.tree() );
+        // Work through the chunks of the schedule.
+        std::future<void> prefetch;
+        for( auto chunk_it = batch_chunks.begin(); chunk_it != batch_chunks.end(); ++chunk_it ) {
+            auto const chunk_num = *chunk_it;
+
+            // Start loading the next needed chunk in the background, so that it is ready in the
+            // cache once we get to it. In jplace input mode, the file for a chunk number is not
+            // known up front, so we cannot prefetch there.
+            auto const next_it = std::next( chunk_it );
+            if( next_it != batch_chunks.end() ) {
+                std::string next_path;
+                if( mode == UnchunkifyMode::kChunkFileExpression ) {
+                    next_path = replace_all(
+                        options.chunk_file_expression, "@", std::to_string( *next_it )
+                    );
+                } else if(
+                    mode == UnchunkifyMode::kChunkListFile && *next_it < chunk_list.size()
+                ) {
+                    next_path = chunk_list[ *next_it ];
+                }
+                if( ! next_path.empty() && file_exists( next_path )) {
+                    prefetch = global_options.thread_pool().enqueue(
+                        [ &chunk_cache, next_path ](){
+                            chunk_cache.fetch_copy( next_path );
+                        }
+                    );
+                }
             }
 
-            // Fill in the sequence, with labels and abundances.
-            auto& pquery = sample.add( chunk->sample.at( pquery_idx ));
-            add_sequence_names_and_abundances( *seq_entry_it, pquery, map_filename );
+            // Process the run of entries for the current chunk in every map of the batch,
+            // and add the resulting pqueries to the respective samples.
+            #pragma omp parallel for schedule(dynamic)
+            for( size_t bi = 0; bi < states.size(); ++bi ) {
+                auto& state = states[bi];
+                auto const& entries = state.map.entries;
+                while(
+                    state.next_entry < entries.size() &&
+                    entries[ state.next_entry ].chunk_num == chunk_num
+                ) {
+                    auto const& seq_entry = entries[ state.next_entry ];
+                    ++state.next_entry;
+                    #pragma omp atomic
+                    ++total_seqs_count;
+
+                    // Get the chunk and pquery index.
+                    // If not found, there is no pquery for the current sequence.
+                    auto const chunk_and_pquery = get_chunk_and_pquery(
+                        seq_entry, hash_to_indices, hash_bloom, chunk_list, options, mode,
+                        state.map_filename, chunk_cache
+                    );
+                    auto const chunk = chunk_and_pquery.first;
+                    auto const pquery_idx = chunk_and_pquery.second;
+                    if( ! chunk ) {
+                        #pragma omp atomic
+                        ++not_found_count;
+                        continue;
+                    }
+
+                    // New sample: give it a tree!
+                    if( state.sample.empty() ) {
+                        state.sample = Sample( chunk->sample.tree() );
+                    }
+
+                    // Fill in the sequence, with labels and abundances.
+                    auto& pquery = state.sample.add( chunk->sample.at( pquery_idx ));
+                    add_sequence_names_and_abundances( seq_entry, pquery );
+
+                    if ( write_per_sample_MSAs ) {
+                        write_all_seqs_of_hash( seq_entry, hashed_msa, state.per_sample_msa );
+                    }
+                }
+            }
 
-            if ( write_per_sample_MSAs ) {
-                write_all_seqs_of_hash( *seq_entry_it, hashed_msa, per_sample_msa, map_filename );
+            // Make sure the prefetch is done before advancing, as it uses local state.
+            if( prefetch.valid() ) {
+                prefetch.get();
             }
         }
 
-        // We are done with the map/sample. Write it.
-        jplace_writer.write(
-            sample,
-            options.file_output.get_output_target( sample_name, "jplace" )
-        );
+        // All entries of the batch are processed now. Write the resulting samples.
+        #pragma omp parallel for schedule(dynamic)
+        for( size_t bi = 0; bi < states.size(); ++bi ) {
+            auto& state = states[bi];
+            assert( state.next_entry == state.map.entries.size() );
+            write_jplace_sample(
+                state.sample,
+                options.file_output.get_output_target( state.sample_name, "jplace" )
+            );
+        }
     }
 
     LOG_MSG1 << "Wrote " << total_seqs_count << " sequences to sample files.";
@@ -759,6 +872,8 @@ void run_unchunkify( UnchunkifyOptions const& options )
         run_unchunkify_with_hash<SHA256>( options );
     } else if( options.hash_function == "MD5" ) {
         run_unchunkify_with_hash<MD5>( options );
+    } else if( options.hash_function == "MurmurHash3" ) {
+        run_unchunkify_with_hash<Murmur3>( options );
     } else {
         throw CLI::ConversionError( "Unknown hash function: " + options.hash_function );
     }
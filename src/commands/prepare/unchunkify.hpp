@@ -45,6 +45,7 @@ public:
     std::string chunk_list_file;
     std::string chunk_file_expression;
     size_t jplace_cache_size = 0;
+    size_t map_batch_size = 64;
     std::string hash_function = "SHA1";
 
     JplaceInputOptions jplace_input;
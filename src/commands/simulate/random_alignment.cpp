@@ -31,10 +31,14 @@
 
 #include "genesis/utils/io/output_stream.hpp"
 
+#include <algorithm>
+#include <array>
 #include <cassert>
 #include <cctype>
 #include <cmath>
+#include <cstdint>
 #include <cstdlib>
+#include <ctime>
 #include <fstream>
 #include <stdexcept>
 #include <string>
@@ -131,6 +135,62 @@ void setup_random_alignment( CLI::App& app )
     ));
 }
 
+// =================================================================================================
+//      Random Generator
+// =================================================================================================
+
+/**
+ * @brief Mix a 64 bit value, following the splitmix64 finalizer.
+ *
+ * Used to turn a seed and a sequence counter into well distributed generator states,
+ * so that each sequence can be generated independently of the others.
+ */
+static inline uint64_t random_alignment_mix_64_( uint64_t x )
+{
+    x += 0x9e3779b97f4a7c15ull;
+    x = ( x ^ ( x >> 30 )) * 0xbf58476d1ce4e5b9ull;
+    x = ( x ^ ( x >> 27 )) * 0x94d049bb133111ebull;
+    return x ^ ( x >> 31 );
+}
+
+/**
+ * @brief Minimal xoshiro256** generator, yielding 64 random bits (8 random bytes) per step,
+ * which is an order of magnitude faster than drawing individual characters via std::rand().
+ *
+ * Each instance is seeded from a base seed and a sequence counter, so that sequences can be
+ * generated in parallel with independent streams.
+ */
+struct RandomAlignmentGenerator
+{
+    RandomAlignmentGenerator( uint64_t seed, uint64_t counter )
+    {
+        state[0] = random_alignment_mix_64_( seed ^ counter );
+        state[1] = random_alignment_mix_64_( state[0] );
+        state[2] = random_alignment_mix_64_( state[1] );
+        state[3] = random_alignment_mix_64_( state[2] );
+    }
+
+    inline uint64_t next()
+    {
+        auto const rotl = []( uint64_t x, int k )
+        {
+            return ( x << k ) | ( x >> ( 64 - k ));
+        };
+
+        uint64_t const result = rotl( state[1] * 5, 7 ) * 9;
+        uint64_t const t = state[1] << 17;
+        state[2] ^= state[0];
+        state[3] ^= state[1];
+        state[1] ^= state[2];
+        state[0] ^= state[3];
+        state[2] ^= t;
+        state[3] = rotl( state[3], 45 );
+        return result;
+    }
+
+    uint64_t state[4];
+};
+
 // =================================================================================================
 //      Run
 // =================================================================================================
@@ -139,9 +199,6 @@ void run_random_alignment( RandomAlignmentOptions const& options )
 {
     using namespace ::genesis;
 
-    // Init randomness.
-    std::srand( std::time( nullptr ));
-
     // Check that at least one of the options is set.
     if( ! options.write_fasta && ! options.write_strict_phylip && ! options.write_relaxed_phylip ) {
         throw CLI::ValidationError(
@@ -161,6 +218,12 @@ void run_random_alignment( RandomAlignmentOptions const& options )
             "Sequence length has to be greater than zero."
         );
     }
+    if( options.characters.empty() || options.characters.size() > 256 ) {
+        throw CLI::ValidationError(
+            "--characters",
+            "Character set has to contain between 1 and 256 characters."
+        );
+    }
 
     // Open streams as needed. This fails if the files already exist.
     std::shared_ptr<genesis::utils::BaseOutputTarget> fasta_os;
@@ -175,58 +238,104 @@ void run_random_alignment( RandomAlignmentOptions const& options )
         (*phylip_os) << options.num_sequences << " " << options.len_sequences << "\n";
     }
 
-    // Write sequences. We do not use our sequence classes of the fasta or phylip writers,
-    // as the file formats are simple and we do not want to store all those sequences in memory.
-    for( size_t s = 0; s < options.num_sequences; ++s ) {
+    // Precompute a byte-to-character lookup table for the character set.
+    // Each random byte below the rejection limit maps to a character; the limit is the largest
+    // multiple of the set size that fits into a byte, so that all characters are equally likely.
+    // Bytes at or above the limit are rejected, which discards at most a tiny fraction of the
+    // random bytes, while avoiding the modulo bias that the previous per-site sampling had.
+    auto const num_chars = options.characters.size();
+    size_t const reject_limit = 256 - ( 256 % num_chars );
+    std::array<char, 256> char_table;
+    for( size_t b = 0; b < reject_limit; ++b ) {
+        char_table[b] = options.characters[ b % num_chars ];
+    }
 
-        // Write sequence name header.
-        auto const name = random_indexed_name( s, options.num_sequences );
-        if( options.write_fasta ) {
-            (*fasta_os) << ">" << name << "\n";
+    // Base seed for the per-sequence generators.
+    auto const base_seed = static_cast<uint64_t>( std::time( nullptr ));
+
+    // Fill a sequence content buffer with random characters from the set,
+    // consuming the generator output eight random bytes at a time.
+    auto const generate_sequence = [&]( size_t seq_index, std::string& buffer )
+    {
+        buffer.resize( options.len_sequences );
+        auto gen = RandomAlignmentGenerator( base_seed, seq_index );
+        size_t pos = 0;
+        while( pos < options.len_sequences ) {
+            auto random = gen.next();
+            for( size_t b = 0; b < 8 && pos < options.len_sequences; ++b ) {
+                auto const byte = static_cast<unsigned char>( random & 0xFF );
+                random >>= 8;
+                if( byte < reject_limit ) {
+                    buffer[ pos ] = char_table[ byte ];
+                    ++pos;
+                }
+            }
         }
-        if( options.write_strict_phylip ) {
-            if( name.size() > 10 ) {
-                // Should never happen. This would be equlivalent to 26^10 sequences.
-                // Still, let's check.
-                throw std::runtime_error(
-                    "Cannot handle this many sequences in strict phylip format."
-                );
+    };
+
+    // Write a sequence content buffer with a line break every 80 characters.
+    auto const write_wrapped = [&]( genesis::utils::BaseOutputTarget& target, std::string const& buffer )
+    {
+        auto& out = target.ostream();
+        for( size_t pos = 0; pos < buffer.size(); pos += 80 ) {
+            out.write( &buffer[ pos ], std::min<size_t>( 80, buffer.size() - pos ));
+            if( pos + 80 < buffer.size() ) {
+                out << "\n";
             }
-            (*phylip_os) << name << std::string( 10 - name.size(), ' ' );
         }
-        if( options.write_relaxed_phylip ) {
-            (*phylip_os) << name << " ";
+        out << "\n";
+    };
+
+    // Write sequences. We do not use our sequence classes of the fasta or phylip writers,
+    // as the file formats are simple and we do not want to store all those sequences in memory.
+    // We generate the sequence contents in parallel batches, and write each finished batch
+    // in order, so that only a bounded number of sequences is in memory at any time.
+    size_t const batch_size = 512;
+    std::vector<std::string> batch;
+    for( size_t batch_begin = 0; batch_begin < options.num_sequences; batch_begin += batch_size ) {
+        auto const batch_end = std::min( batch_begin + batch_size, options.num_sequences );
+        batch.resize( batch_end - batch_begin );
+
+        // Generate the contents of the batch in parallel. The buffers are reused across batches.
+        #pragma omp parallel for schedule(static)
+        for( size_t i = 0; i < batch.size(); ++i ) {
+            generate_sequence( batch_begin + i, batch[i] );
         }
 
-        // Write content.
-        for( size_t l = 0; l < options.len_sequences; ++l ) {
+        // Write the batch in order.
+        for( size_t i = 0; i < batch.size(); ++i ) {
+            auto const s = batch_begin + i;
 
-            // Write new line ever so often, except for the stupid strict phylip format.
-            if( l > 0 && l % 80 == 0 ) {
-                if( options.write_fasta ) {
-                    (*fasta_os) << "\n";
-                }
-                if( options.write_relaxed_phylip ) {
-                    (*phylip_os) << "\n";
+            // Write sequence name header.
+            auto const name = random_indexed_name( s, options.num_sequences );
+            if( options.write_fasta ) {
+                (*fasta_os) << ">" << name << "\n";
+            }
+            if( options.write_strict_phylip ) {
+                if( name.size() > 10 ) {
+                    // Should never happen. This would be equlivalent to 26^10 sequences.
+                    // Still, let's check.
+                    throw std::runtime_error(
+                        "Cannot handle this many sequences in strict phylip format."
+                    );
                 }
+                (*phylip_os) << name << std::string( 10 - name.size(), ' ' );
+            }
+            if( options.write_relaxed_phylip ) {
+                (*phylip_os) << name << " ";
             }
 
-            // Get a random char from the set and write it.
-            auto const c = options.characters[ std::rand() % options.characters.size() ];
+            // Write content. New lines every so often, except for the stupid strict phylip format.
             if( options.write_fasta ) {
-                (*fasta_os) << c;
+                write_wrapped( *fasta_os, batch[i] );
             }
-            if( options.write_strict_phylip || options.write_relaxed_phylip ) {
-                (*phylip_os) << c;
+            if( options.write_strict_phylip ) {
+                phylip_os->ostream().write( batch[i].data(), batch[i].size() );
+                (*phylip_os) << "\n";
+            }
+            if( options.write_relaxed_phylip ) {
+                write_wrapped( *phylip_os, batch[i] );
             }
-        }
-
-        // Write final new line.
-        if( options.write_fasta ) {
-            (*fasta_os) << "\n";
-        }
-        if( options.write_strict_phylip || options.write_relaxed_phylip ) {
-            (*phylip_os) << "\n";
         }
     }
 }
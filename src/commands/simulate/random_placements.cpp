@@ -25,16 +25,15 @@
 
 #include "options/global.hpp"
 #include "tools/cli_setup.hpp"
+#include "tools/jplace_stream_writer.hpp"
 #include "tools/misc.hpp"
 
 #include "CLI/CLI.hpp"
 
-#include "genesis/placement/formats/jplace_writer.hpp"
 #include "genesis/placement/function/operators.hpp"
+#include "genesis/placement/placement_tree.hpp"
+#include "genesis/placement/pquery.hpp"
 #include "genesis/placement/sample.hpp"
-#include "genesis/placement/simulator/distributions.hpp"
-#include "genesis/placement/simulator/functions.hpp"
-#include "genesis/placement/simulator/simulator.hpp"
 #include "genesis/tree/common_tree/newick_reader.hpp"
 #include "genesis/tree/common_tree/tree.hpp"
 #include "genesis/tree/formats/newick/reader.hpp"
@@ -42,14 +41,21 @@
 #include "genesis/tree/iterator/preorder.hpp"
 #include "genesis/tree/tree.hpp"
 #include "genesis/tree/tree/subtree.hpp"
+#include "genesis/utils/core/options.hpp"
 #include "genesis/utils/io/input_source.hpp"
 #include "genesis/utils/io/output_target.hpp"
 
+#include <algorithm>
+#include <array>
 #include <cassert>
 #include <cctype>
 #include <cmath>
+#include <cstdint>
 #include <cstdlib>
+#include <ctime>
 #include <fstream>
+#include <limits>
+#include <random>
 #include <stdexcept>
 #include <string>
 #include <vector>
@@ -98,6 +104,16 @@ void setup_random_placements( CLI::App& app )
     );
     subtree_opt->group( "Input" );
 
+    // Random seed
+    auto seed_opt = sub->add_option(
+        "--seed",
+        opt->seed,
+        "Seed for the random number generator, allowing to reproduce a dataset. "
+        "The result is independent of the number of threads used for the generation. "
+        "If set to 0 (default), the current time is used as seed instead."
+    );
+    seed_opt->group( "Input" );
+
     // -----------------------------------------------------------
     //     Output Options
     // -----------------------------------------------------------
@@ -153,17 +169,14 @@ void run_random_placements( RandomPlacementsOptions const& options )
 
     // Get an empty sample with the reference tree.
     auto sample = get_empty_sample( options );
+    auto& tree = sample.tree();
+    auto const edge_count = tree.edge_count();
 
-    // Init the simulator to some good values.
-    Simulator sim;
-    sim.extra_placement_distribution().placement_number_weights = { 1.0, 1.0, 1.0, 1.0, 1.0 };
-    sim.extra_placement_distribution().placement_path_length_weights = { 0.0, 4.0, 3.0, 2.0, 1.0 };
-    sim.like_weight_ratio_distribution().intervals = { 0.0, 1.0 };
-    sim.like_weight_ratio_distribution().weights = { 0.0, 1.0 };
-
-    // Only simulate in certain subtrees.
+    // Collect the edges on which we place, which is either the whole tree,
+    // or only a certain subtree of the root.
+    std::vector<size_t> allowed_edges;
     if( options.subtree > -1 ) {
-        auto const degr = static_cast<int>( degree( sample.tree().root_node() ));
+        auto const degr = static_cast<int>( degree( tree.root_node() ));
         if( options.subtree >= degr ) {
             throw CLI::ValidationError(
                 "--subtree (" + std::to_string( options.subtree ) +  ")",
@@ -173,28 +186,171 @@ void run_random_placements( RandomPlacementsOptions const& options )
         }
 
         // Find the correct subtree.
-        auto link = &sample.tree().root_link();
+        auto link = &tree.root_link();
         for( size_t i = 0; i < static_cast<size_t>( options.subtree ); ++i ) {
             link = & link->next();
         }
         auto const subtr = Subtree( link->outer() );
 
-        // Build an edge vector that only has weights in the subtree.
-        auto& edge_weights = sim.edge_distribution().edge_weights;
-        edge_weights = std::vector<double>( sample.tree().edge_count(), 0.0 );
+        // Collect the edges of the subtree, including its root edge.
         for( auto it : preorder( subtr )) {
-            edge_weights[ it.edge().index() ] = 1.0;
+            allowed_edges.push_back( it.edge().index() );
+        }
+        allowed_edges.push_back( subtr.edge().index() );
+        std::sort( allowed_edges.begin(), allowed_edges.end() );
+        allowed_edges.erase(
+            std::unique( allowed_edges.begin(), allowed_edges.end() ), allowed_edges.end()
+        );
+    } else {
+        allowed_edges.resize( edge_count );
+        for( size_t i = 0; i < edge_count; ++i ) {
+            allowed_edges[i] = i;
+        }
+    }
+    assert( ! allowed_edges.empty() );
+
+    // For the extra placements of each pquery, we need to know which edges are located at
+    // a given path distance from the central edge of the pquery. Precompute these
+    // neighborhoods once, up to the maximal path length that we use, via a breadth first
+    // search on the edge adjacency (edges that share a node are at distance one).
+    size_t const max_path_length = 4;
+    std::vector<std::vector<size_t>> edges_of_node( tree.node_count() );
+    for( auto const& edge : tree.edges() ) {
+        edges_of_node[ edge.primary_link().node().index()   ].push_back( edge.index() );
+        edges_of_node[ edge.secondary_link().node().index() ].push_back( edge.index() );
+    }
+    std::vector<std::array<std::vector<size_t>, 4>> edge_neighborhoods( edge_count );
+    #pragma omp parallel
+    {
+        // Per-thread stamp of the last source edge that visited an edge,
+        // so that the vector does not need to be reset between source edges.
+        auto stamp = std::vector<size_t>( edge_count, std::numeric_limits<size_t>::max() );
+
+        #pragma omp for schedule(static)
+        for( size_t e = 0; e < edge_count; ++e ) {
+            stamp[e] = e;
+            std::vector<size_t> frontier{ e };
+            for( size_t d = 0; d < max_path_length; ++d ) {
+                std::vector<size_t> next;
+                for( auto const f : frontier ) {
+                    auto const& edge = tree.edge_at( f );
+                    for( auto const node_index : {
+                        edge.primary_link().node().index(),
+                        edge.secondary_link().node().index()
+                    }) {
+                        for( auto const g : edges_of_node[ node_index ] ) {
+                            if( stamp[g] != e ) {
+                                stamp[g] = e;
+                                next.push_back( g );
+                            }
+                        }
+                    }
+                }
+                edge_neighborhoods[e][d] = next;
+                frontier = std::move( next );
+            }
         }
-        // Also set the root edge to 1.
-        edge_weights[ subtr.edge().index() ] = 1.0;
     }
 
-    // Generate pqueries.
-    sim.generate( sample, options.num_pqueries );
+    // Seed for the generators. Each chunk of pqueries gets its own generator, seeded from the
+    // base seed and the chunk index, so that the result does not depend on the thread count.
+    auto const base_seed = ( options.seed != 0 )
+        ? static_cast<uint64_t>( options.seed )
+        : static_cast<uint64_t>( std::time( nullptr ))
+    ;
+
+    // Generate one chunk of pqueries, using the same distributions that we previously set up
+    // in the genesis simulator: uniform central edge, zero to four extra placements at path
+    // distances one to four (weighted 4:3:2:1), like weight ratios with linearly increasing
+    // density (normalized per pquery), proximal positions uniform along the branch,
+    // and pendant lengths uniform in [0, 1).
+    size_t const chunk_size = 4096;
+    size_t const num_chunks = ( options.num_pqueries + chunk_size - 1 ) / chunk_size;
+    auto const generate_chunk = [&]( size_t chunk_index, std::vector<Pquery>& out )
+    {
+        auto engine = std::mt19937_64( base_seed ^ ( 0x9e3779b97f4a7c15ull * ( chunk_index + 1 )));
+        auto uniform01 = std::uniform_real_distribution<double>( 0.0, 1.0 );
+        auto edge_picker = std::uniform_int_distribution<size_t>( 0, allowed_edges.size() - 1 );
+        auto extra_count_picker = std::uniform_int_distribution<size_t>( 0, 4 );
+
+        auto const begin = chunk_index * chunk_size;
+        auto const end = std::min( begin + chunk_size, options.num_pqueries );
+        out.clear();
+        out.reserve( end - begin );
+
+        for( size_t i = begin; i < end; ++i ) {
+            Pquery pquery;
+            pquery.add_name( random_indexed_name( i, options.num_pqueries ));
+
+            // Central edge, plus extra placements in its neighborhood.
+            auto const central = allowed_edges[ edge_picker( engine ) ];
+            std::vector<size_t> place_edges{ central };
+            auto const extra_count = extra_count_picker( engine );
+            for( size_t x = 0; x < extra_count; ++x ) {
+
+                // Path length with weights 4:3:2:1 for distances one to four.
+                auto const u = uniform01( engine ) * 10.0;
+                size_t dist = ( u < 4.0 ) ? 1 : ( u < 7.0 ) ? 2 : ( u < 9.0 ) ? 3 : 4;
+
+                // On small trees, there might not be any edge at the wanted distance.
+                while( dist > 0 && edge_neighborhoods[ central ][ dist - 1 ].empty() ) {
+                    --dist;
+                }
+                if( dist == 0 ) {
+                    continue;
+                }
+                auto const& bucket = edge_neighborhoods[ central ][ dist - 1 ];
+                place_edges.push_back( bucket[ static_cast<size_t>(
+                    uniform01( engine ) * static_cast<double>( bucket.size() )
+                ) % bucket.size() ]);
+            }
+
+            // Fill in the placements, and normalize their like weight ratios to sum to one.
+            double lwr_sum = 0.0;
+            for( auto const edge_index : place_edges ) {
+                auto& placement = pquery.add_placement( tree.edge_at( edge_index ));
+                placement.like_weight_ratio = std::sqrt( uniform01( engine ));
+                placement.proximal_length
+                    = uniform01( engine )
+                    * tree.edge_at( edge_index ).data<PlacementEdgeData>().branch_length
+                ;
+                placement.pendant_length = uniform01( engine );
+                lwr_sum += placement.like_weight_ratio;
+            }
+            if( lwr_sum > 0.0 ) {
+                for( auto& placement : pquery.placements() ) {
+                    placement.like_weight_ratio /= lwr_sum;
+                }
+            }
+
+            out.push_back( std::move( pquery ));
+        }
+    };
 
-    // Write result file.
-    JplaceWriter().write(
-        sample,
-        options.file_output.get_output_target( "random-placements", "jplace" )
+    // Generate the chunks in parallel batches, and stream each finished batch to the output
+    // in order, so that we never hold more than a bounded number of pqueries in memory.
+    auto writer = JplaceStreamWriter(
+        tree, options.file_output.get_output_target( "random-placements", "jplace" )
+    );
+    size_t const batch_chunks = std::max<size_t>(
+        1, 2 * genesis::utils::Options::get().number_of_threads()
     );
+    std::vector<std::vector<Pquery>> chunk_buffers;
+    for( size_t batch_begin = 0; batch_begin < num_chunks; batch_begin += batch_chunks ) {
+        auto const batch_end = std::min( batch_begin + batch_chunks, num_chunks );
+        chunk_buffers.resize( batch_end - batch_begin );
+
+        #pragma omp parallel for schedule(dynamic)
+        for( size_t c = 0; c < chunk_buffers.size(); ++c ) {
+            generate_chunk( batch_begin + c, chunk_buffers[c] );
+        }
+
+        for( auto const& chunk : chunk_buffers ) {
+            for( auto const& pquery : chunk ) {
+                writer.write( pquery );
+            }
+        }
+    }
+    writer.finish();
+    assert( writer.written_pquery_count() == options.num_pqueries );
 }
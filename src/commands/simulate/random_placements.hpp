@@ -44,6 +44,7 @@ public:
     std::string input_tree;
     size_t num_pqueries;
     int subtree = -1;
+    size_t seed = 0;
 
     // Output options.
     FileOutputOptions file_output;
@@ -29,14 +29,16 @@
 
 #include "CLI/CLI.hpp"
 
-#include "genesis/tree/common_tree/newick_writer.hpp"
-#include "genesis/tree/common_tree/tree.hpp"
-#include "genesis/tree/function/manipulation.hpp"
-#include "genesis/tree/tree.hpp"
 #include "genesis/utils/io/output_target.hpp"
 
+#include <algorithm>
 #include <cassert>
 #include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <limits>
+#include <random>
 #include <string>
 #include <stdexcept>
 #include <vector>
@@ -96,10 +98,10 @@ void setup_random_tree( CLI::App& app )
 void run_random_tree( RandomTreeOptions const& options )
 {
     using namespace ::genesis;
-    using namespace ::genesis::tree;
 
     // Init randomness.
-    std::srand( std::time( nullptr ));
+    auto engine = std::mt19937_64( static_cast<uint64_t>( std::time( nullptr )));
+    auto uniform01 = std::uniform_real_distribution<double>( 0.0, 1.0 );
 
     // Check that at least one of the options is set.
     if( options.num_leaves < 3 ) {
@@ -112,46 +114,142 @@ void run_random_tree( RandomTreeOptions const& options )
     // Check if the output file name already exists. If so, fail early.
     options.file_output.check_output_files_nonexistence( "random-tree", "newick" );
 
-    // Make a minimal tree with common data types.
-    auto tree = minimal_tree();
-    if( ! validate_topology( tree )) {
-        throw std::runtime_error( "Internal error: Invalid tree created." );
+    // We previously grew a genesis tree by repeated single leaf insertion, which spends
+    // quadratic time in the tree manipulation functions. Instead, we now build the same
+    // random topology in flat parent/children arrays, where splitting an edge to attach
+    // a new leaf is a constant time operation, and serialize the arrays to newick directly,
+    // which makes the whole construction linear in the number of leaves.
+    auto const num_nodes = 2 * options.num_leaves - 2;
+    auto const no_parent = std::numeric_limits<size_t>::max();
+    std::vector<size_t> parent;
+    std::vector<std::vector<size_t>> children;
+    std::vector<double> length;
+    parent.reserve( num_nodes );
+    children.reserve( num_nodes );
+    length.reserve( num_nodes );
+    auto const add_node = [&]( size_t parent_index )
+    {
+        parent.push_back( parent_index );
+        children.emplace_back();
+        length.push_back( 0.0 );
+        return parent.size() - 1;
+    };
+
+    // Start with a minimal tree of two nodes connected by one edge,
+    // and a list of all edges, identified by the node below them.
+    auto const initial_root = add_node( no_parent );
+    auto const first_leaf = add_node( initial_root );
+    children[ initial_root ].push_back( first_leaf );
+    std::vector<size_t> edge_nodes{ first_leaf };
+
+    // The minimal tree already has 2 leaves. Create the remaining ones, by picking a random
+    // edge, splitting it with a new inner node, and attaching the new leaf to that node.
+    for( size_t i = 2; i < options.num_leaves; ++i ) {
+        auto const rand_edge = std::uniform_int_distribution<size_t>(
+            0, edge_nodes.size() - 1
+        )( engine );
+        auto const lower = edge_nodes[ rand_edge ];
+        auto const upper = parent[ lower ];
+
+        auto const inner = add_node( upper );
+        auto const leaf  = add_node( inner );
+        for( auto& child : children[ upper ] ) {
+            if( child == lower ) {
+                child = inner;
+            }
+        }
+        children[ inner ] = { lower, leaf };
+        parent[ lower ] = inner;
+
+        edge_nodes.push_back( inner );
+        edge_nodes.push_back( leaf );
     }
+    assert( parent.size() == num_nodes );
 
-    // The minimal tree already has 2 leaves. Create the remaining ones.
-    for( size_t i = 2; i < options.num_leaves; ++i ) {
-        // Pick a random edge to attach the leaf to.
-        auto& rand_edge = tree.edge_at( std::rand() % tree.edge_count() );
-        add_new_leaf_node( tree, rand_edge );
+    // Give random edge lengths in [ 0.0, 1.0 ] to all edges.
+    for( size_t n = 0; n < num_nodes; ++n ) {
+        length[n] = uniform01( engine );
+    }
+
+    // Reroot on a random inner node, by flipping the parent pointers along the path from
+    // that node to the initial root. The branch between two nodes keeps its length;
+    // it is simply stored at the other node once the direction flips.
+    size_t rand_node_index = 0;
+    while( children[ rand_node_index ].size() < 2 ) {
+        rand_node_index = std::uniform_int_distribution<size_t>( 0, num_nodes - 1 )( engine );
+    }
+    std::vector<size_t> path;
+    for( size_t n = rand_node_index; n != no_parent; n = parent[n] ) {
+        path.push_back( n );
     }
-    if( ! validate_topology( tree )) {
-        throw std::runtime_error( "Internal error: Invalid tree created." );
+    for( size_t i = 0; i + 1 < path.size(); ++i ) {
+        auto const lower = path[ i ];
+        auto const upper = path[ i + 1 ];
+        children[ upper ].erase(
+            std::find( children[ upper ].begin(), children[ upper ].end(), lower )
+        );
+        children[ lower ].push_back( upper );
+        parent[ upper ] = lower;
+        length[ upper ] = length[ lower ];
     }
+    auto const root = rand_node_index;
+    parent[ root ] = no_parent;
 
     // Give random names to the leaf nodes.
+    std::vector<std::string> names( num_nodes );
     size_t leaf_node_cnt = 0;
-    for( auto& node : tree.nodes() ) {
-        if( is_leaf( node )) {
+    size_t total_name_size = 0;
+    for( size_t n = 0; n < num_nodes; ++n ) {
+        if( children[n].empty() ) {
             assert( leaf_node_cnt < options.num_leaves );
-            node.data<CommonNodeData>().name = random_indexed_name( leaf_node_cnt, options.num_leaves );
+            names[n] = random_indexed_name( leaf_node_cnt, options.num_leaves );
+            total_name_size += names[n].size();
             ++leaf_node_cnt;
         }
     }
-
-    // Give random edge lengths in [ 0.0, 1.0 ] to all edges.
-    for( auto& edge : tree.edges() ) {
-        auto const r = static_cast<double>( std::rand() ) / static_cast<double>( RAND_MAX );
-        edge.data<CommonEdgeData>().branch_length = r;
-    }
-
-    // Reroot on random inner node.
-    size_t rand_node_index = 0;
-    while( is_leaf( tree.node_at( rand_node_index ))) {
-        rand_node_index = std::rand() % tree.node_count();
+    assert( leaf_node_cnt == options.num_leaves );
+
+    // Serialize the arrays to newick, into a single preallocated buffer,
+    // using an iterative traversal to avoid deep recursion on large trees.
+    std::string buffer;
+    buffer.reserve( total_name_size + num_nodes * 14 + 2 );
+    auto const append_branch_length = [&]( double value )
+    {
+        char local[ 32 ];
+        auto const len = std::snprintf( local, sizeof( local ), "%.6f", value );
+        assert( len > 0 && static_cast<size_t>( len ) < sizeof( local ));
+        buffer += ':';
+        buffer.append( local, static_cast<size_t>( len ));
+    };
+    struct Frame
+    {
+        size_t node;
+        size_t next_child;
+    };
+    std::vector<Frame> stack;
+    stack.push_back({ root, 0 });
+    while( ! stack.empty() ) {
+        auto& frame = stack.back();
+        auto const node = frame.node;
+        if( frame.next_child < children[ node ].size() ) {
+            buffer += ( frame.next_child == 0 ) ? '(' : ',';
+            auto const child = children[ node ][ frame.next_child ];
+            ++frame.next_child;
+            stack.push_back({ child, 0 });
+            continue;
+        }
+        if( ! children[ node ].empty() ) {
+            buffer += ')';
+        }
+        buffer += names[ node ];
+        if( node != root ) {
+            append_branch_length( length[ node ] );
+        }
+        stack.pop_back();
     }
-    change_rooting( tree, tree.node_at( rand_node_index ));
+    buffer += ";\n";
 
-    // Create a newick tree from it.
-    auto nw = CommonTreeNewickWriter();
-    nw.write( tree, options.file_output.get_output_target( "random-tree", "newick" ));
+    // Write the newick tree.
+    auto target = options.file_output.get_output_target( "random-tree", "newick" );
+    target->ostream().write( buffer.data(), buffer.size() );
 }
@@ -28,6 +28,8 @@
 
 #include "commands/tools/citation.hpp"
 #include "commands/tools/license.hpp"
+#include "commands/tools/pipeline.hpp"
+#include "commands/tools/server.hpp"
 #include "commands/tools/version.hpp"
 #include "commands/tools/wiki.hpp"
 
@@ -52,6 +54,8 @@ inline void setup_tools( CLI::App& app )
     // Add module subcommands.
     setup_citation( *sub );
     setup_license( *sub );
+    setup_pipeline( *sub );
+    setup_server( *sub );
     setup_version( *sub );
     setup_wiki( *sub );
 }
@@ -0,0 +1,183 @@
+/*
+    gappa - Genesis Applications for Phylogenetic Placement Analysis
+    Copyright (C) 2017-2024 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+#include "commands/tools/pipeline.hpp"
+
+#include "options/global.hpp"
+#include "tools/cli_runner.hpp"
+#include "tools/cli_setup.hpp"
+
+#include "genesis/utils/core/fs.hpp"
+#include "genesis/utils/text/string.hpp"
+
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifdef GENESIS_OPENMP
+#   include <omp.h>
+#endif
+
+// =================================================================================================
+//      Setup
+// =================================================================================================
+
+void setup_pipeline( CLI::App& app )
+{
+    // Create the options and subcommand objects.
+    auto opt = std::make_shared<PipelineOptions>();
+    auto sub = app.add_subcommand(
+        "pipeline",
+        "Load a set of samples into memory once, and run a script of commands against it."
+    );
+
+    // Jplace input
+    opt->jplace_input.add_jplace_input_opt_to_app( sub );
+
+    // Script file
+    sub->add_option(
+        "--script-file",
+        opt->script_file,
+        "Path of the script to run, with one gappa command line per line, without the "
+        "leading `gappa`, for example `examine graft --jplace-path sample.jplace "
+        "--out-dir graft`. Empty lines and lines starting with `#` are skipped. "
+        "Use `-` to read the script from standard input. Commands whose input files "
+        "are among the samples loaded by this command skip reading and parsing them "
+        "again, so that chains of commands over the same files read them only once."
+    )->required()->group( "Settings" );
+
+    // Error handling
+    sub->add_flag(
+        "--continue-on-error",
+        opt->continue_on_error,
+        "By default, the pipeline stops at the first command that fails. With this flag, "
+        "the remaining commands are run regardless, and the pipeline fails at the end if "
+        "any of them failed."
+    )->group( "Settings" );
+
+    // Set the run function as callback to be called when this subcommand is issued.
+    // Hand over the options by copy, so that their shared ptr stays alive in the lambda.
+    sub->callback( gappa_cli_callback(
+        sub,
+        {},
+        [ opt ]() {
+            run_pipeline( *opt );
+        }
+    ));
+}
+
+// =================================================================================================
+//      Run
+// =================================================================================================
+
+void run_pipeline( PipelineOptions const& options )
+{
+    using namespace genesis::utils;
+
+    // Base checks
+    if( options.jplace_input.file_count() < 1 ) {
+        throw std::runtime_error( "No jplace input files to preload." );
+    }
+
+    // Read the script, one command line per line, skipping empty lines and comments.
+    std::string script;
+    if( options.script_file == "-" ) {
+        script.assign(
+            std::istreambuf_iterator<char>( std::cin ), std::istreambuf_iterator<char>()
+        );
+    } else {
+        script = file_read( options.script_file );
+    }
+    auto commands = std::vector<std::string>();
+    for( auto& line : split( script, "\n" )) {
+        line = trim( line );
+        if( line.empty() || line[0] == '#' ) {
+            continue;
+        }
+        commands.push_back( line );
+    }
+    if( commands.empty() ) {
+        throw std::runtime_error(
+            "Script '" + options.script_file + "' does not contain any commands."
+        );
+    }
+
+    // Print some user output.
+    options.jplace_input.print();
+    LOG_MSG1 << "Found " << commands.size() << " commands in the script.";
+
+    // Read all samples once, and install them in the process-wide store, from which the
+    // commands run below get them instead of parsing the files again, see
+    // JplaceInputOptions::preload_sample().
+    LOG_MSG1 << "Preloading samples.";
+    auto const paths = options.jplace_input.file_paths();
+    size_t file_count = 0;
+    #pragma omp parallel for schedule(dynamic)
+    for( size_t fi = 0; fi < paths.size(); ++fi ) {
+        LOG_MSG2 << "Reading file " << ( ++file_count ) << " of " << paths.size()
+                 << ": " << paths[ fi ];
+        auto sample = options.jplace_input.sample( fi );
+        #pragma omp critical(GAPPA_PIPELINE_PRELOAD)
+        {
+            JplaceInputOptions::preload_sample( paths[ fi ], std::move( sample ));
+        }
+    }
+    LOG_MSG1 << "Preloaded " << JplaceInputOptions::preloaded_sample_count() << " samples.";
+
+    // Run the commands of the script in order, against the preloaded samples.
+    auto failures = std::vector<std::string>();
+    for( size_t ci = 0; ci < commands.size(); ++ci ) {
+        LOG_BOLD;
+        LOG_MSG1 << "Running command " << ( ci + 1 ) << " of " << commands.size()
+                 << ": " << commands[ ci ];
+        auto const error = run_gappa_command_line( commands[ ci ] );
+        if( ! error.empty() ) {
+            if( ! options.continue_on_error ) {
+                JplaceInputOptions::clear_preloaded_samples();
+                throw std::runtime_error(
+                    "Command " + std::to_string( ci + 1 ) + " of the pipeline failed: " + error
+                );
+            }
+            failures.push_back(
+                "Command " + std::to_string( ci + 1 ) + " failed: " + error
+            );
+        }
+    }
+
+    // Clean up, and report the collected failures, if any.
+    JplaceInputOptions::clear_preloaded_samples();
+    LOG_BOLD;
+    if( ! failures.empty() ) {
+        for( auto const& failure : failures ) {
+            LOG_MSG1 << failure;
+        }
+        throw std::runtime_error(
+            std::to_string( failures.size() ) + " of " + std::to_string( commands.size() )
+            + " commands of the pipeline failed."
+        );
+    }
+    LOG_MSG1 << "Pipeline finished.";
+}
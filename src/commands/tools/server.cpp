@@ -0,0 +1,218 @@
+/*
+    gappa - Genesis Applications for Phylogenetic Placement Analysis
+    Copyright (C) 2017-2024 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+#include "commands/tools/server.hpp"
+
+#include "options/global.hpp"
+#include "tools/cli_runner.hpp"
+#include "tools/cli_setup.hpp"
+
+#include "genesis/utils/core/fs.hpp"
+#include "genesis/utils/text/string.hpp"
+
+#include <cstdio>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#   include <cstring>
+#   include <sys/socket.h>
+#   include <sys/un.h>
+#   include <unistd.h>
+#endif
+
+#ifdef GENESIS_OPENMP
+#   include <omp.h>
+#endif
+
+// =================================================================================================
+//      Setup
+// =================================================================================================
+
+void setup_server( CLI::App& app )
+{
+    // Create the options and subcommand objects.
+    auto opt = std::make_shared<ServerOptions>();
+    auto sub = app.add_subcommand(
+        "server",
+        "Load a set of samples into memory once, and run repeated commands against it."
+    );
+
+    // Jplace input
+    opt->jplace_input.add_jplace_input_opt_to_app( sub );
+
+    // Socket file
+    sub->add_option(
+        "--socket-file",
+        opt->socket_file,
+        "Path of the local (unix domain) socket to listen on for command requests. "
+        "Each request is one gappa command line without the leading `gappa`, sent as a "
+        "single line, for example via `echo \"examine info --jplace-path sample.jplace\" "
+        "| nc -U socket-file`. Commands whose input files are among the preloaded samples "
+        "skip reading and parsing them again. Send `quit` to stop the server; the socket "
+        "file is removed on shutdown."
+    )->required()->group( "Settings" );
+
+    // Set the run function as callback to be called when this subcommand is issued.
+    // Hand over the options by copy, so that their shared ptr stays alive in the lambda.
+    sub->callback( gappa_cli_callback(
+        sub,
+        {},
+        [ opt ]() {
+            run_server( *opt );
+        }
+    ));
+}
+
+// =================================================================================================
+//      Run
+// =================================================================================================
+
+void run_server( ServerOptions const& options )
+{
+#ifdef _WIN32
+
+    (void) options;
+    throw std::runtime_error( "The server command is not available on Windows." );
+
+#else
+
+    using namespace genesis::utils;
+
+    // Base checks
+    if( options.jplace_input.file_count() < 1 ) {
+        throw std::runtime_error( "No jplace input files to preload." );
+    }
+    if( file_exists( options.socket_file )) {
+        throw std::runtime_error(
+            "Socket file '" + options.socket_file + "' already exists. Is another server "
+            "running? If not, remove the file and start again."
+        );
+    }
+
+    // Print some user output.
+    options.jplace_input.print();
+
+    // Read all samples once, and install them in the process-wide store, from which the
+    // commands run below get them instead of parsing the files again, see
+    // JplaceInputOptions::preload_sample().
+    LOG_MSG1 << "Preloading samples.";
+    auto const paths = options.jplace_input.file_paths();
+    size_t file_count = 0;
+    #pragma omp parallel for schedule(dynamic)
+    for( size_t fi = 0; fi < paths.size(); ++fi ) {
+        LOG_MSG2 << "Reading file " << ( ++file_count ) << " of " << paths.size()
+                 << ": " << paths[ fi ];
+        auto sample = options.jplace_input.sample( fi );
+        #pragma omp critical(GAPPA_SERVER_PRELOAD)
+        {
+            JplaceInputOptions::preload_sample( paths[ fi ], std::move( sample ));
+        }
+    }
+    LOG_MSG1 << "Preloaded " << JplaceInputOptions::preloaded_sample_count() << " samples.";
+
+    // Open the local socket.
+    auto const server_fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+    if( server_fd < 0 ) {
+        throw std::runtime_error( "Cannot create socket." );
+    }
+    struct sockaddr_un addr;
+    std::memset( &addr, 0, sizeof( addr ));
+    addr.sun_family = AF_UNIX;
+    if( options.socket_file.size() >= sizeof( addr.sun_path )) {
+        close( server_fd );
+        throw std::runtime_error(
+            "Socket file path '" + options.socket_file + "' is too long."
+        );
+    }
+    std::strncpy( addr.sun_path, options.socket_file.c_str(), sizeof( addr.sun_path ) - 1 );
+    if( bind( server_fd, reinterpret_cast<struct sockaddr*>( &addr ), sizeof( addr )) != 0 ) {
+        close( server_fd );
+        throw std::runtime_error(
+            "Cannot bind to socket file '" + options.socket_file + "'."
+        );
+    }
+    if( listen( server_fd, 1 ) != 0 ) {
+        close( server_fd );
+        std::remove( options.socket_file.c_str() );
+        throw std::runtime_error(
+            "Cannot listen on socket file '" + options.socket_file + "'."
+        );
+    }
+    LOG_MSG1 << "Listening on " << options.socket_file << ". Send gappa command lines "
+             << "(without the leading `gappa`), one per connection, or `quit` to stop.";
+
+    // Serve requests until asked to quit, one at a time.
+    bool quit = false;
+    while( ! quit ) {
+        auto const client_fd = accept( server_fd, nullptr, nullptr );
+        if( client_fd < 0 ) {
+            continue;
+        }
+
+        // Read the request line.
+        std::string request;
+        char buffer[ 4096 ];
+        while( request.find( '\n' ) == std::string::npos ) {
+            auto const got = read( client_fd, buffer, sizeof( buffer ));
+            if( got <= 0 ) {
+                break;
+            }
+            request.append( buffer, got );
+        }
+        auto const eol = request.find( '\n' );
+        if( eol != std::string::npos ) {
+            request.resize( eol );
+        }
+        request = trim( request );
+
+        // Process it.
+        std::string response;
+        if( request.empty() ) {
+            response = "ERROR: Empty request.\n";
+        } else if( request == "quit" ) {
+            quit = true;
+            response = "OK\n";
+        } else {
+            LOG_BOLD;
+            LOG_MSG1 << "Running request: " << request;
+            auto const error = run_gappa_command_line( request );
+            response = error.empty() ? "OK\n" : "ERROR: " + error + "\n";
+        }
+
+        // Reply. If the client has gone away, we do not care.
+        auto const written = write( client_fd, response.c_str(), response.size() );
+        (void) written;
+        close( client_fd );
+    }
+
+    // Clean up.
+    close( server_fd );
+    std::remove( options.socket_file.c_str() );
+    JplaceInputOptions::clear_preloaded_samples();
+    LOG_MSG1 << "Server stopped.";
+
+#endif
+}
@@ -39,8 +39,12 @@
 
 #include "genesis/utils/core/exception.hpp"
 
+#include <functional>
 #include <memory>
 #include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
 
 // =================================================================================================
 //      Main Program
@@ -105,13 +109,30 @@ int main( int argc, char** argv )
     // have them initialized to proper values that they can use (e.g., for the help output).
     global_options.initialize( argc, argv );
 
-    // Set up all subcommands.
-    setup_analyze( app );
-    setup_edit( app );
-    setup_examine( app );
-    setup_prepare( app );
-    setup_simulate( app );
-    setup_tools( app );
+    // Set up the subcommands. Building a module constructs the full CLI11 tree of all its
+    // commands and options, which adds up when gappa is invoked tens of thousands of times
+    // in chunked per-sample pipelines. The first command line argument already determines
+    // which module can possibly be run, so if it names exactly one of them, we only build
+    // that one. In all other cases (no arguments, `--help`, `--version`, or a mistyped
+    // module name), we build everything, so that the help and error output is complete.
+    std::vector<std::pair<std::string, std::function<void( CLI::App& )>>> const modules = {
+        { "analyze",  setup_analyze },
+        { "edit",     setup_edit },
+        { "examine",  setup_examine },
+        { "prepare",  setup_prepare },
+        { "simulate", setup_simulate },
+        { "tools",    setup_tools }
+    };
+    std::string const module_arg = ( argc > 1 ? argv[1] : "" );
+    bool module_found = false;
+    for( auto const& module : modules ) {
+        module_found |= ( module.first == module_arg );
+    }
+    for( auto const& module : modules ) {
+        if( ! module_found || module.first == module_arg ) {
+            module.second( app );
+        }
+    }
 
     // -------------------------------------------------------------------------
     //     Final Checks and Steps
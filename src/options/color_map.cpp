@@ -289,6 +289,19 @@ genesis::utils::ColorMap const& ColorMapOptions::color_map() const
     return color_map_;
 }
 
+std::vector<genesis::utils::Color> ColorMapOptions::map_colors(
+    genesis::utils::ColorMap const& map,
+    genesis::utils::ColorNormalization const& norm,
+    std::vector<double> const& values
+) {
+    auto result = std::vector<genesis::utils::Color>( values.size() );
+    #pragma omp parallel for schedule(static)
+    for( size_t i = 0; i < values.size(); ++i ) {
+        result[i] = map( norm, values[i] );
+    }
+    return result;
+}
+
 // =================================================================================================
 //      Helper Functions
 // =================================================================================================
@@ -30,6 +30,7 @@
 
 #include "genesis/utils/color/color.hpp"
 #include "genesis/utils/color/map.hpp"
+#include "genesis/utils/color/normalization.hpp"
 
 #include <limits>
 #include <memory>
@@ -115,6 +116,20 @@ public:
      */
     genesis::utils::ColorMap const& color_map() const;
 
+    /**
+     * @brief Map a whole vector of values to colors in one parallel pass.
+     *
+     * The genesis ColorMap maps a value vector sequentially, one value at a time through
+     * the normalization and palette interpolation. For the tree renderings, where one color
+     * is needed per edge, this is a measurable serial stage on large trees. The per-value
+     * lookups are independent of each other, so this helper computes them in parallel.
+     */
+    static std::vector<genesis::utils::Color> map_colors(
+        genesis::utils::ColorMap const& map,
+        genesis::utils::ColorNormalization const& norm,
+        std::vector<double> const& values
+    );
+
     // -------------------------------------------------------------------------
     //     Helper Functions
     // -------------------------------------------------------------------------
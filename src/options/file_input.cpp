@@ -24,11 +24,14 @@
 #include "options/file_input.hpp"
 
 #include "options/global.hpp"
+#include "tools/gzip_seek_index.hpp"
+#include "tools/remote_fetch.hpp"
 
 #include "genesis/utils/core/fs.hpp"
 #include "genesis/utils/text/string.hpp"
 
 #include <algorithm>
+#include <fstream>
 #include <iostream>
 #include <stdexcept>
 
@@ -62,14 +65,25 @@ CLI::Option* FileInputOptions::add_multi_file_input_opt_to_app(
         "--" + type + "-path",
         raw_paths_,
         "List of " + type + " files or directories to process. For directories, " +
-        "only files with the extension `." + extension_nice + "` are processed."
+        "only files with the extension `." + extension_nice + "` are processed. " +
+        "Files can also be given as http(s) URLs (e.g., presigned object store links), " +
+        "which are then downloaded on first use, see `--remote-range-jobs`."
     );
     if( required ) {
         option_->required();
     }
 
-    // Check if it is a path.
-    option_->check( CLI::ExistingPath );
+    // Check if it is a path. Remote URLs cannot be checked here;
+    // their download reports any errors instead.
+    option_->check( CLI::Validator(
+        []( std::string& path ) -> std::string {
+            if( is_remote_path( path )) {
+                return std::string();
+            }
+            return CLI::ExistingPath( path );
+        },
+        "PATH(existing) or URL"
+    ));
     option_->group( group );
 
     return option_;
@@ -91,16 +105,34 @@ std::vector<std::string> const& FileInputOptions::file_paths() const
         if( resolved_paths_.empty() ) {
             using namespace genesis::utils;
             for( auto const& path : raw_paths_ ) {
-                if( is_file( path ) ) {
+                if( is_remote_path( path )) {
+
+                    // Remote objects are kept as URLs here; file_path() stages them
+                    // to local files on first use. Remote "directories" (bucket
+                    // prefixes) are not supported; each URL names one object.
+                    resolved_paths_.push_back( path );
+
+                } else if( is_file( path ) ) {
 
                     resolved_paths_.push_back( path );
 
                 } else if( is_dir( path ) ) {
 
-                    // Get all files in dir.
-                    auto list = dir_list_files( path, true, ".*\\." + file_ext_ + "$" );
-                    for( auto const& jplace : list ) {
-                        resolved_paths_.push_back( jplace );
+                    // Get all entries in the dir that match the extension. The listing itself
+                    // is one pass over the directory; the per-entry stat calls that tell
+                    // actual files from stray directories with a matching name are what takes
+                    // long on large network directories, so we run them in parallel,
+                    // instead of using the sequential stat loop of dir_list_files.
+                    auto list = dir_list_contents( path, true, ".*\\." + file_ext_ + "$" );
+                    auto is_file_flags = std::vector<char>( list.size(), 0 );
+                    #pragma omp parallel for schedule(dynamic)
+                    for( size_t i = 0; i < list.size(); ++i ) {
+                        is_file_flags[i] = is_file( list[i] ) ? 1 : 0;
+                    }
+                    for( size_t i = 0; i < list.size(); ++i ) {
+                        if( is_file_flags[i] ) {
+                            resolved_paths_.push_back( std::move( list[i] ));
+                        }
                     }
 
                 } else {
@@ -120,6 +152,30 @@ std::vector<std::string> const& FileInputOptions::file_paths() const
 
             // We sort them to get reproducible order.
             std::sort( resolved_paths_.begin(), resolved_paths_.end() );
+
+            // Precompute the base file names once, so that the per-file name lookups
+            // during the run are simple index accesses, instead of repeatedly
+            // re-processing the path strings for every file and call.
+            base_names_.resize( resolved_paths_.size() );
+            for( size_t i = 0; i < resolved_paths_.size(); ++i ) {
+                auto path = resolved_paths_[i];
+                if( is_remote_path( path )) {
+                    // Use the object name, without any query string of presigned URLs.
+                    auto const query_pos = path.find_first_of( "?#" );
+                    if( query_pos != std::string::npos ) {
+                        path = path.substr( 0, query_pos );
+                    }
+                }
+                auto fn = file_basename( path );
+                if( ends_with( fn, ".gz" ) ) {
+                    fn.erase( fn.size() - 3 );
+                }
+                base_names_[i] = file_filename( fn );
+            }
+
+            // Prepare the download state for any remote input files.
+            remote_fetch_->status.assign( resolved_paths_.size(), 0 );
+            remote_fetch_->local_paths.resize( resolved_paths_.size() );
         }
     }
 
@@ -132,7 +188,57 @@ std::string const& FileInputOptions::file_path( size_t index ) const
     if( index >= files.size() ) {
         throw std::runtime_error( "Invalid file index." );
     }
-    return files[ index ];
+    if( ! is_remote_path( files[ index ] )) {
+        return files[ index ];
+    }
+
+    // Remote input: stage the object to a local file on first use. Callers for the same
+    // index wait for the in-flight download; callers for other indices (for example, the
+    // parallel read loops of the commands) run their downloads concurrently, so that the
+    // download concurrency follows the existing per-command read parallelism.
+    auto& state = *remote_fetch_;
+    std::unique_lock<std::mutex> lock( state.mutex );
+    while( state.status[ index ] == 1 ) {
+        state.cond.wait( lock );
+    }
+    if( state.status[ index ] == 2 ) {
+        return state.local_paths[ index ];
+    }
+    state.status[ index ] = 1;
+    if( state.staging_dir.empty() ) {
+        state.staging_dir = make_remote_staging_dir();
+    }
+
+    // Stage under the index plus the object name, so that objects with equal names do not
+    // collide, and so that the `.gz` detection of the readers works on the staged file.
+    auto object_name = files[ index ];
+    auto const query_pos = object_name.find_first_of( "?#" );
+    if( query_pos != std::string::npos ) {
+        object_name = object_name.substr( 0, query_pos );
+    }
+    auto const target
+        = state.staging_dir + "/" + std::to_string( index ) + "_"
+        + genesis::utils::file_basename( object_name )
+    ;
+    lock.unlock();
+
+    std::string local_path;
+    try {
+        local_path = fetch_remote_file(
+            files[ index ], target, global_options.remote_range_jobs()
+        );
+    } catch( ... ) {
+        lock.lock();
+        state.status[ index ] = 0;
+        state.cond.notify_all();
+        throw;
+    }
+
+    lock.lock();
+    state.local_paths[ index ] = local_path;
+    state.status[ index ] = 2;
+    state.cond.notify_all();
+    return state.local_paths[ index ];
 }
 
 std::vector<std::string> const& FileInputOptions::raw_file_paths() const
@@ -140,29 +246,90 @@ std::vector<std::string> const& FileInputOptions::raw_file_paths() const
     return raw_paths_;
 }
 
-std::vector<std::string> FileInputOptions::base_file_names() const
+std::string FileInputOptions::file_contents( size_t index ) const
 {
     using namespace genesis::utils;
 
-    auto paths = file_paths();
-    for( auto& path : paths ) {
-        auto fn = file_basename( path );
-        if( ends_with( fn, ".gz" ) ) {
-            fn.erase( fn.size() - 3 );
+    // If the background decode of the previous call happens to be for this file, use it.
+    // Otherwise, read (and decompress) the file right here.
+    std::string content;
+    std::unique_lock<std::mutex> lock( decode_ahead_->mutex );
+    if( decode_ahead_->valid && decode_ahead_->index == index ) {
+        auto future = std::move( decode_ahead_->future );
+        decode_ahead_->valid = false;
+        lock.unlock();
+        content = future.get();
+        lock.lock();
+    } else {
+        lock.unlock();
+        content = file_read( file_path( index ));
+        lock.lock();
+    }
+
+    // Start decoding the next file in the background, so that sequential consumers
+    // find it ready. If a decode is already pending (for example, because multiple
+    // threads read different files concurrently), we leave it alone.
+    if( ! decode_ahead_->valid && index + 1 < file_count() ) {
+        auto const next_path = file_path( index + 1 );
+        decode_ahead_->future = global_options.thread_pool().enqueue( [ next_path ](){
+            return file_read( next_path );
+        });
+        decode_ahead_->index = index + 1;
+        decode_ahead_->valid = true;
+    }
+
+    return content;
+}
+
+std::string FileInputOptions::file_contents_range(
+    size_t index, size_t offset, size_t length
+) const {
+    using namespace genesis::utils;
+    auto const& path = file_path( index );
+
+    if( ends_with( path, ".gz" )) {
+
+        // With a seek index, only decompress the blocks covering the range.
+        GzipSeekIndex seek_index;
+        if( seek_index.load( path )) {
+            return seek_index.read_range( offset, length );
         }
-        path = file_filename( fn );
+
+        // Without one, decompress the whole file and cut out the range.
+        auto const content = file_contents( index );
+        if( offset >= content.size() ) {
+            return std::string();
+        }
+        return content.substr( offset, length );
     }
-    return paths;
+
+    // Plain files support direct range reads.
+    std::ifstream file( path, std::ios::binary );
+    if( ! file ) {
+        throw std::runtime_error( "Cannot read file: " + path );
+    }
+    file.seekg( static_cast<std::streamoff>( offset ));
+    auto result = std::string( length, '\0' );
+    file.read( &result[0], length );
+    auto const got = file.gcount();
+    result.resize( got > 0 ? static_cast<size_t>( got ) : 0 );
+    return result;
 }
 
-std::string FileInputOptions::base_file_name( size_t index ) const
+std::vector<std::string> const& FileInputOptions::base_file_names() const
 {
-    using namespace genesis::utils;
-    auto fn = file_basename( file_path( index ));
-    if( ends_with( fn, ".gz" ) ) {
-        fn.erase( fn.size() - 3 );
+    // Resolving the file paths also fills the base name index.
+    file_paths();
+    return base_names_;
+}
+
+std::string const& FileInputOptions::base_file_name( size_t index ) const
+{
+    auto const& names = base_file_names();
+    if( index >= names.size() ) {
+        throw std::runtime_error( "Invalid file index." );
     }
-    return file_filename( fn );
+    return names[ index ];
 }
 
 void FileInputOptions::print() const
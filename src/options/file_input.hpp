@@ -26,6 +26,10 @@
 
 #include "CLI/CLI.hpp"
 
+#include <condition_variable>
+#include <future>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -123,9 +127,16 @@ public:
     std::vector<std::string> const& file_paths() const;
 
     /**
-     * @brief Get a specific file from the list.
+     * @brief Get a specific file from the list, as a path that can be opened locally.
      *
-     * Returns `file_paths().at( index )`.
+     * For local files, this simply returns `file_paths().at( index )`. For remote input
+     * (http(s) URLs, e.g., presigned object store links), the object is downloaded into a
+     * temporary staging directory on first access, and the staged local path is returned;
+     * subsequent calls for the same index reuse the staged file. Concurrent callers for
+     * different indices (such as the parallel read loops of the commands) download their
+     * files concurrently, so that remote input streams in alongside the analysis instead
+     * of requiring a separate staging step. See fetch_remote_file() for the download
+     * mechanics, including parallel ranged requests for large objects.
      */
     std::string const& file_path( size_t index ) const;
 
@@ -134,20 +145,44 @@ public:
      */
     std::vector<std::string> const& raw_file_paths() const;
 
+    /**
+     * @brief Read the whole content of the file at @p index, decompressing gzip if needed.
+     *
+     * The decompression of the next file in the list is started on a background thread,
+     * so that commands which process files sequentially overlap the (single-threaded)
+     * gzip inflate of one file with the parsing of the previous one, instead of
+     * serializing the whole pipeline on the decode.
+     */
+    std::string file_contents( size_t index ) const;
+
+    /**
+     * @brief Read a range of the (decompressed) content of the file at @p index.
+     *
+     * For plain files, this is a direct seek and read. For gzip files with a `.gzi` seek
+     * index sidecar (as written by our blocked gzip output, or by `bgzip -i`), only the
+     * compressed blocks covering the range are decompressed, see GzipSeekIndex. Gzip
+     * files without an index fall back to decompressing the whole file, so partial access
+     * patterns only pay off on indexed files. A range that extends beyond the end of the
+     * content is shortened accordingly.
+     */
+    std::string file_contents_range( size_t index, size_t offset, size_t length ) const;
+
     /**
      * @brief Get the file names of the provided files, i.e., without directory and ending.
      *
-     * This function calls genesis::utils::file_basename() and genesis::utils::file_filename() for
-     * all paths. The result is for example useful for user output.
+     * The names are computed once when the file paths are resolved, using
+     * genesis::utils::file_basename() and genesis::utils::file_filename(), and then kept
+     * as an index, so that lookups stay cheap even for very large file lists.
+     * The result is for example useful for user output.
      */
-    std::vector<std::string> base_file_names() const;
+    std::vector<std::string> const& base_file_names() const;
 
     /**
      * @brief Get the file name of the file at the index, i.e., without directory and ending.
      *
      * This function is the same as base_file_names(), just for one file.
      */
-    std::string base_file_name( size_t index ) const;
+    std::string const& base_file_name( size_t index ) const;
 
     /**
      * @brief Print some user output related to these options.
@@ -160,8 +195,40 @@ public:
 
 private:
 
+    /**
+     * @brief State of the background decode of the next file, see file_contents().
+     *
+     * Held via a shared pointer, as mutexes and futures are not copyable,
+     * but options classes need to be.
+     */
+    struct DecodeAhead
+    {
+        std::mutex mutex;
+        bool valid = false;
+        size_t index = 0;
+        std::future<std::string> future;
+    };
+
+    /**
+     * @brief State of the staged downloads for remote input files, see file_path().
+     *
+     * Per file, the status is 0 (not staged), 1 (download in flight), or 2 (staged).
+     * Held via a shared pointer for the same copyability reason as DecodeAhead.
+     */
+    struct RemoteFetchState
+    {
+        std::mutex mutex;
+        std::condition_variable cond;
+        std::string staging_dir;
+        std::vector<char> status;
+        std::vector<std::string> local_paths;
+    };
+
     std::vector<std::string> raw_paths_;
     mutable std::vector<std::string> resolved_paths_;
+    mutable std::vector<std::string> base_names_;
+    mutable std::shared_ptr<DecodeAhead> decode_ahead_ = std::make_shared<DecodeAhead>();
+    mutable std::shared_ptr<RemoteFetchState> remote_fetch_ = std::make_shared<RemoteFetchState>();
 
     std::string file_type_;
     std::string file_ext_;
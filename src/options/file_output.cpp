@@ -31,6 +31,7 @@
 
 #include "options/global.hpp"
 #include "tools/misc.hpp"
+#include "tools/parallel_gzip_output_target.hpp"
 
 #include <algorithm>
 #include <cassert>
@@ -291,6 +292,18 @@ std::shared_ptr<genesis::utils::BaseOutputTarget> FileOutputOptions::get_output_
     // so let's not bother with this.
     dir_create( out_dir_, true );
 
+    // With compression and multiple threads, use our multi-threaded block compression,
+    // which produces a pigz-compatible multi-member gzip file. Also used single-threaded
+    // when a seek index is requested, as the index needs the blocked format.
+    #ifdef GENESIS_ZLIB
+        auto const num_threads = Options::get().number_of_threads();
+        if( compress_ && ( num_threads > 1 || gzip_seek_index_ )) {
+            return std::make_shared<ParallelGzipOutputTarget>(
+                get_output_filename( infix, extension ), num_threads, gzip_seek_index_
+            );
+        }
+    #endif
+
     // Make an output target, optionally using gzip compression.
     return to_file(
         get_output_filename( infix, extension ),
@@ -189,6 +189,23 @@ public:
         return compress_;
     }
 
+    /**
+     * @brief Request that compressed output files of this set are written in blocked gzip
+     * with a `.gzi` seek index sidecar, see tools/gzip_seek_index.hpp.
+     *
+     * This enables later random access into the files without full decompression.
+     * Has no effect when compression is not active.
+     */
+    void set_gzip_seek_index( bool value )
+    {
+        gzip_seek_index_ = value;
+    }
+
+    bool gzip_seek_index() const
+    {
+        return gzip_seek_index_;
+    }
+
     // -------------------------------------------------------------------------
     //     Output Filenames
     // -------------------------------------------------------------------------
@@ -232,6 +249,7 @@ private:
     std::string prefix_;
     std::string suffix_;
     bool compress_ = false;
+    bool gzip_seek_index_ = false;
 
 public:
 
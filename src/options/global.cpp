@@ -23,13 +23,79 @@
 
 #include "options/global.hpp"
 
+#include "tools/misc.hpp"
+#include "tools/profiler.hpp"
+#include "tools/simd_dispatch.hpp"
 #include "tools/version.hpp"
 
 #include "genesis/utils/core/info.hpp"
 #include "genesis/utils/core/logging.hpp"
 #include "genesis/utils/core/options.hpp"
+#include "genesis/utils/text/string.hpp"
 
+#include <stdexcept>
 #include <thread>
+#include <vector>
+
+#ifdef GENESIS_OPENMP
+#   include <omp.h>
+#endif
+
+#ifdef __linux__
+#   include <sched.h>
+#endif
+
+// =================================================================================================
+//      Local Helpers
+// =================================================================================================
+
+/**
+ * @brief Pin each OpenMP worker thread to one CPU core, see the --pin-threads option.
+ */
+static void pin_threads_()
+{
+    #if defined( GENESIS_OPENMP ) && defined( __linux__ )
+
+        // Get the CPUs that the process is allowed to use, so that the pinning respects
+        // restrictions imposed by the scheduler (taskset, cgroups, slurm).
+        cpu_set_t process_mask;
+        CPU_ZERO( &process_mask );
+        if( sched_getaffinity( 0, sizeof( process_mask ), &process_mask ) != 0 ) {
+            LOG_WARN << "Warning: Cannot determine the CPU affinity of the process. "
+                     << "Ignoring --pin-threads.";
+            return;
+        }
+        std::vector<int> cpus;
+        for( int cpu = 0; cpu < CPU_SETSIZE; ++cpu ) {
+            if( CPU_ISSET( cpu, &process_mask )) {
+                cpus.push_back( cpu );
+            }
+        }
+        if( cpus.empty() ) {
+            return;
+        }
+
+        // Pin each thread to one of the allowed CPUs, round-robin in thread order.
+        // With the usual CPU enumeration, consecutive threads then end up close to each
+        // other (same socket on multi-socket machines), keeping memory accesses local.
+        // Opening the parallel region here also starts the OpenMP runtime, so that all
+        // later parallel regions reuse the pinned threads.
+        #pragma omp parallel
+        {
+            auto const tid = static_cast<size_t>( omp_get_thread_num() );
+            cpu_set_t thread_mask;
+            CPU_ZERO( &thread_mask );
+            CPU_SET( cpus[ tid % cpus.size() ], &thread_mask );
+            sched_setaffinity( 0, sizeof( thread_mask ), &thread_mask );
+        }
+
+    #else
+
+        LOG_WARN << "Warning: Thread pinning (--pin-threads) is only available on Linux "
+                 << "with OpenMP. Ignoring the option.";
+
+    #endif
+}
 
 // =================================================================================================
 //      Setup Functions
@@ -101,6 +167,84 @@ void GlobalOptions::add_to_subcommand( CLI::App& subcommand )
     );
     opt_log_file->group( "Global Options" );
 
+    // Profiling
+    auto opt_profile = subcommand.add_flag(
+        "--profile",
+        opt_profile_,
+        "Measure the major stages of the command (input reading, compute, output writing), "
+        "and print a table with per-stage wall time, CPU utilization, and peak memory use "
+        "at the end of the run."
+    );
+    opt_profile->group( "Global Options" );
+
+    // Resource usage
+    auto opt_resource_usage = subcommand.add_flag(
+        "--resource-usage",
+        opt_resource_usage_,
+        "Report the peak memory use, total bytes read and written, and total CPU time "
+        "of the command at the end of the run. Useful for sizing memory requests "
+        "when scheduling gappa on a cluster."
+    );
+    opt_resource_usage->group( "Global Options" );
+
+    // Memory limit
+    auto opt_memory_limit = subcommand.add_option(
+        "--memory-limit",
+        opt_memory_limit_,
+        "Rough memory budget for the command, e.g., `64G`. Accepts the suffixes `K`, `M`, `G`, "
+        "and `T`, using factors of 1024. Commands that read many jplace files limit how many "
+        "samples they keep in memory at the same time to stay within the budget, trading "
+        "parallel input reading for predictable memory use. The bound is based on estimates "
+        "from the input file sizes, and hence best-effort, not a hard guarantee."
+    );
+    opt_memory_limit->group( "Global Options" );
+
+    // Huge pages
+    auto opt_huge_pages = subcommand.add_flag(
+        "--huge-pages",
+        opt_huge_pages_,
+        "Back large matrix allocations (above " + std::to_string( huge_pages_threshold >> 20 )
+        + " MB) with 2 MB transparent huge pages. This reduces TLB misses for dense sweeps "
+        "over multi-GB matrices, such as distance matrices and placement profiles. The option "
+        "is advisory: on systems without transparent huge page support, it has no effect. "
+        "Linux only."
+    );
+    opt_huge_pages->group( "Global Options" );
+
+    // Remote input download concurrency
+    auto opt_remote_range_jobs = subcommand.add_option(
+        "--remote-range-jobs",
+        opt_remote_range_jobs_,
+        "For input files given as http(s) URLs, use this many parallel ranged requests per "
+        "file when downloading large objects, which typically saturates the connection to an "
+        "object store far better than a single request. Set to 1 to disable ranged requests. "
+        "Only relevant for remote input paths.",
+        true
+    );
+    opt_remote_range_jobs->group( "Global Options" );
+
+    // Tree preprocessing cache
+    auto opt_tree_cache_dir = subcommand.add_option(
+        "--tree-cache-dir",
+        opt_tree_cache_dir_,
+        "Directory for caching expensive structures derived from the reference tree, such as "
+        "the node distance matrix used by `examine edpl`. Cache files are keyed by a fingerprint "
+        "of the tree, so that commands working on the same reference tree compute these "
+        "structures only once and reuse them across runs. The files can grow large for big "
+        "trees; the cache is never cleaned up automatically. If not set, no caching is done."
+    );
+    opt_tree_cache_dir->group( "Global Options" );
+
+    // Thread pinning
+    auto opt_pin_threads = subcommand.add_flag(
+        "--pin-threads",
+        opt_pin_threads_,
+        "Pin each thread to one CPU core, distributed over the cores that the process is "
+        "allowed to use. On multi-socket (NUMA) systems, this prevents threads from migrating "
+        "between sockets during a run, and so keeps their memory accesses local. Linux only."
+    );
+    opt_pin_threads->group( "Global Options" );
+
     // TODO add random seed option
 }
 
@@ -136,12 +280,24 @@ void GlobalOptions::run_global()
         genesis::utils::Logging::log_to_file( opt_log_file_ );
     }
 
+    // Enable stage profiling if requested.
+    Profiler::enable( opt_profile_ );
+
+    // Pin threads to CPU cores if requested. Has to be done after the number of threads is set.
+    if( opt_pin_threads_ ) {
+        pin_threads_();
+    }
+
     // Set verbosity level for logging output.
     if( opt_verbose_ ) {
         genesis::utils::Logging::max_level( genesis::utils::Logging::LoggingLevel::kMessage2 );
     } else {
         genesis::utils::Logging::max_level( genesis::utils::Logging::LoggingLevel::kMessage1 );
     }
+
+    // Report which vector instruction set the dispatched dense kernels run with,
+    // see the simd dispatch layer. Only shown with --verbose.
+    LOG_MSG2 << "Using " << simd_level_name( simd_level() ) << " kernels.";
 }
 
 // =================================================================================================
@@ -157,6 +313,52 @@ std::string GlobalOptions::command_line() const
     return ret;
 }
 
+size_t GlobalOptions::memory_limit() const
+{
+    if( opt_memory_limit_.empty() ) {
+        return 0;
+    }
+
+    // Parse the numeric part, followed by an optional binary size suffix.
+    size_t pos = 0;
+    unsigned long long value = 0;
+    try {
+        value = std::stoull( opt_memory_limit_, &pos );
+    } catch( ... ) {
+        pos = 0;
+    }
+    auto const suffix = genesis::utils::to_lower( opt_memory_limit_.substr( pos ));
+
+    size_t factor = 0;
+    if( suffix.empty() || suffix == "b" ) {
+        factor = 1;
+    } else if( suffix == "k" || suffix == "kb" ) {
+        factor = 1024ull;
+    } else if( suffix == "m" || suffix == "mb" ) {
+        factor = 1024ull * 1024;
+    } else if( suffix == "g" || suffix == "gb" ) {
+        factor = 1024ull * 1024 * 1024;
+    } else if( suffix == "t" || suffix == "tb" ) {
+        factor = 1024ull * 1024 * 1024 * 1024;
+    }
+    if( pos == 0 || factor == 0 ) {
+        throw std::runtime_error(
+            "Invalid memory limit \"" + opt_memory_limit_ +
+            "\". Expected a byte size such as `500M` or `16G`."
+        );
+    }
+    return value * factor;
+}
+
+ThreadPool& GlobalOptions::thread_pool()
+{
+    std::call_once( thread_pool_once_, [this](){
+        // If run_global() has not been called (e.g., in tests), fall back to one worker.
+        thread_pool_.reset( new ThreadPool( opt_threads_ == 0 ? 1 : opt_threads_ ));
+    });
+    return *thread_pool_;
+}
+
 // =================================================================================================
 //      Global Instance
 // =================================================================================================
@@ -27,10 +27,13 @@
 #include "CLI/CLI.hpp"
 
 #include "tools/cli_option.hpp"
+#include "tools/thread_pool.hpp"
 #include "tools/version.hpp"
 
 #include "genesis/utils/core/logging.hpp"
 
+#include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -76,6 +79,59 @@ public:
 
     std::string command_line() const;
 
+    /**
+     * @brief Return the process-wide pool of worker threads for background tasks,
+     * sized according to the --threads option.
+     *
+     * The pool is created lazily on first use, so that commands without background work
+     * do not spawn any extra threads. See ThreadPool for the intended usage.
+     */
+    ThreadPool& thread_pool();
+
+    /**
+     * @brief Whether the --resource-usage option was set, in which case the run wrapper
+     * reports peak memory, total I/O, and CPU time at command completion.
+     */
+    bool resource_usage() const
+    {
+        return opt_resource_usage_;
+    }
+
+    /**
+     * @brief Return the memory budget of the --memory-limit option, in bytes,
+     * or 0 if no limit was set.
+     *
+     * Throws if the user provided a value that cannot be parsed as a byte size.
+     */
+    size_t memory_limit() const;
+
+    /**
+     * @brief Whether the --huge-pages option was set, in which case large matrix
+     * allocations are backed by transparent huge pages, see advise_huge_pages().
+     */
+    bool huge_pages() const
+    {
+        return opt_huge_pages_;
+    }
+
+    /**
+     * @brief Number of parallel ranged requests per file for remote input downloads,
+     * see the --remote-range-jobs option and fetch_remote_file().
+     */
+    size_t remote_range_jobs() const
+    {
+        return opt_remote_range_jobs_;
+    }
+
+    /**
+     * @brief Directory of the reference tree preprocessing cache, see the --tree-cache-dir
+     * option and tools/tree_cache.hpp. Empty if caching is disabled.
+     */
+    std::string const& tree_cache_dir() const
+    {
+        return opt_tree_cache_dir_;
+    }
+
     // -------------------------------------------------------------------------
     //     Option Members
     // -------------------------------------------------------------------------
@@ -93,9 +149,20 @@ private:
     bool        opt_verbose_ = false;
     size_t      opt_threads_ = 0;
     std::string opt_log_file_ = "";
+    bool        opt_profile_ = false;
+    bool        opt_resource_usage_ = false;
+    bool        opt_pin_threads_ = false;
+    std::string opt_memory_limit_ = "";
+    bool        opt_huge_pages_ = false;
+    size_t      opt_remote_range_jobs_ = 4;
+    std::string opt_tree_cache_dir_ = "";
 
     std::vector<std::string> command_line_;
 
+    // Lazily created background thread pool, see thread_pool().
+    std::unique_ptr<ThreadPool> thread_pool_;
+    std::once_flag              thread_pool_once_;
+
 };
 
 // =================================================================================================
@@ -24,18 +24,47 @@
 #include "options/jplace_input.hpp"
 
 #include "options/global.hpp"
-
-#include "genesis/placement/function/epca.hpp"
+#include "tools/edge_imbalance.hpp"
+#include "tools/misc.hpp"
+#include "tools/progress.hpp"
+#include "tools/remote_fetch.hpp"
+#include "tools/sample_columns.hpp"
+#include "tools/profiler.hpp"
+#include "tools/tree_fingerprint.hpp"
+
+#include "genesis/placement/formats/newick_reader.hpp"
+#include "genesis/placement/formats/newick_writer.hpp"
 #include "genesis/placement/function/functions.hpp"
 #include "genesis/placement/function/masses.hpp"
 #include "genesis/placement/function/operators.hpp"
+#include "genesis/tree/common_tree/newick_reader.hpp"
+#include "genesis/tree/common_tree/newick_writer.hpp"
+#include "genesis/tree/function/manipulation.hpp"
+#include "genesis/tree/iterator/postorder.hpp"
 #include "genesis/tree/mass_tree/functions.hpp"
+#include "genesis/tree/mass_tree/tree.hpp"
+#include "genesis/tree/tree/subtree.hpp"
 #include "genesis/utils/core/fs.hpp"
+#include "genesis/utils/core/options.hpp"
 #include "genesis/utils/io/input_source.hpp"
+#include "genesis/utils/io/deserializer.hpp"
+#include "genesis/utils/io/output_target.hpp"
+#include "genesis/utils/io/serializer.hpp"
 #include "genesis/utils/text/string.hpp"
 
+#include <algorithm>
+#include <cassert>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
 #include <iostream>
+#include <map>
+#include <random>
 #include <stdexcept>
+#include <utility>
+
+#include <sys/stat.h>
 
 #ifdef GENESIS_OPENMP
 #   include <omp.h>
@@ -57,9 +86,55 @@ CLI::Option* JplaceInputOptions::add_jplace_input_opt_to_app( CLI::App* sub, boo
     jplace_input_option = FileInputOptions::add_multi_file_input_opt_to_app(
         sub, "jplace", "jplace(\\.gz)?", "jplace[.gz]", required, "Input"
     );
+
+    // Every command that reads jplace files can also use the binary cache.
+    add_jplace_cache_opt_to_app( sub );
+
     return jplace_input_option;
 }
 
+CLI::Option* JplaceInputOptions::add_jplace_cache_opt_to_app( CLI::App* sub )
+{
+    // Correct setup check.
+    if( jplace_cache_option != nullptr ) {
+        throw std::domain_error( "Cannot set up --jplace-cache option multiple times." );
+    }
+
+    jplace_cache_option = sub->add_flag(
+        "--jplace-cache",
+        jplace_cache_,
+        "Cache the parsed content of each input jplace file in a binary sidecar file "
+        "(with added extension `.bin`) next to the input file. On subsequent runs, "
+        "the cache is loaded instead of parsing the jplace file again, which is "
+        "considerably faster. Caches are rewritten when the jplace file is newer."
+    )->group( "Input" );
+
+    return jplace_cache_option;
+}
+
+CLI::Option* JplaceInputOptions::add_profile_cache_opt_to_app( CLI::App* sub )
+{
+    // Correct setup check.
+    if( profile_cache_option != nullptr ) {
+        throw std::domain_error( "Cannot set up --profile-cache option multiple times." );
+    }
+
+    profile_cache_option = sub->add_option(
+        "--profile-cache",
+        profile_cache_,
+        "Cache the computed placement profile (reference tree and per-edge masses and "
+        "imbalances of all samples) in the given binary file. If the file does not exist, "
+        "it is written after reading all input jplace files; subsequent commands that are "
+        "given the same cache file load it instead of re-reading the whole dataset, "
+        "which cuts the redundant full-dataset reads out of pipelines that run several "
+        "analyses over the same samples. The cache records the input files with their "
+        "modification times and sizes as well as all mass settings, and is rejected if "
+        "any of them changed since it was written."
+    )->group( "Input" );
+
+    return profile_cache_option;
+}
+
 CLI::Option* JplaceInputOptions::add_point_mass_opt_to_app( CLI::App* sub )
 {
     // Correct setup check.
@@ -122,17 +197,712 @@ CLI::Option* JplaceInputOptions::add_mass_norm_opt_to_app( CLI::App* sub, bool r
     return mass_norm_option;
 }
 
+CLI::Option* JplaceInputOptions::add_subsample_opt_to_app( CLI::App* sub )
+{
+    // Correct setup check.
+    if( subsample_option != nullptr ) {
+        throw std::domain_error( "Cannot set up --subsample option multiple times." );
+    }
+
+    subsample_option = sub->add_option(
+        "--subsample",
+        subsample_,
+        "If set, randomly subsample each input sample down to the given number of pqueries "
+        "at read time, scaling the multiplicities of the kept pqueries so that the total "
+        "mass of the sample is preserved. This is meant for fast exploratory runs on large "
+        "datasets; final analyses should be run without it. The subsampling is deterministic "
+        "per input file, so that repeated runs on the same files give the same result."
+    )->group( "Settings" );
+
+    return subsample_option;
+}
+
+// =================================================================================================
+//      Cache Helper Functions
+// =================================================================================================
+
+/**
+ * @brief Magic bytes and version at the beginning of a jplace cache file.
+ *
+ * Needs to be changed whenever the layout of the cache format changes,
+ * so that stale caches from older gappa versions are not misinterpreted.
+ */
+static char const* jplace_cache_magic_ = "gappa-jplace-cache-v1";
+
+/**
+ * @brief Return whether the cache file at @p cache_path exists and is newer
+ * than the jplace file at @p jplace_path.
+ */
+static bool jplace_cache_is_fresh_( std::string const& jplace_path, std::string const& cache_path )
+{
+    struct stat jplace_stat;
+    struct stat cache_stat;
+    if( stat( cache_path.c_str(), &cache_stat ) != 0 ) {
+        return false;
+    }
+    if( stat( jplace_path.c_str(), &jplace_stat ) != 0 ) {
+        return false;
+    }
+    return cache_stat.st_mtime >= jplace_stat.st_mtime;
+}
+
+/**
+ * @brief Write a flat binary representation of a Sample to a cache file.
+ */
+static void jplace_cache_write_( genesis::placement::Sample const& sample, std::string const& path )
+{
+    using namespace genesis;
+    using namespace genesis::placement;
+
+    auto serial = utils::Serializer( utils::to_file( path ));
+
+    // Header: magic bytes, then the reference tree in newick format.
+    serial.put_raw_string( jplace_cache_magic_ );
+    serial.put_string( PlacementTreeNewickWriter().to_string( sample.tree() ));
+
+    // Pqueries, with placements referring to edges by their index in the tree.
+    serial.put_int<uint64_t>( sample.size() );
+    for( auto const& pquery : sample ) {
+        serial.put_int<uint64_t>( pquery.placement_size() );
+        for( auto const& placement : pquery.placements() ) {
+            serial.put_int<uint64_t>( placement.edge().index() );
+            serial.put_float<double>( placement.likelihood );
+            serial.put_float<double>( placement.like_weight_ratio );
+            serial.put_float<double>( placement.proximal_length );
+            serial.put_float<double>( placement.pendant_length );
+        }
+        serial.put_int<uint64_t>( pquery.name_size() );
+        for( auto const& name : pquery.names() ) {
+            serial.put_string( name.name );
+            serial.put_float<double>( name.multiplicity );
+        }
+    }
+}
+
+/**
+ * @brief Read a Sample back from a cache file written by jplace_cache_write_().
+ */
+static genesis::placement::Sample jplace_cache_read_( std::string const& path )
+{
+    using namespace genesis;
+    using namespace genesis::placement;
+
+    auto deserial = utils::Deserializer( utils::from_file( path ));
+
+    // Header.
+    auto const magic_len = std::string( jplace_cache_magic_ ).size();
+    if( deserial.get_raw_string( magic_len ) != jplace_cache_magic_ ) {
+        throw std::runtime_error( "Invalid jplace cache file: " + path );
+    }
+    auto const tree = PlacementTreeNewickReader().read( utils::from_string( deserial.get_string() ));
+    Sample sample( tree );
+
+    // Pqueries.
+    auto const pquery_count = deserial.get_int<uint64_t>();
+    for( size_t pi = 0; pi < pquery_count; ++pi ) {
+        auto& pquery = sample.add();
+        auto const placement_count = deserial.get_int<uint64_t>();
+        for( size_t qi = 0; qi < placement_count; ++qi ) {
+            auto const edge_index = deserial.get_int<uint64_t>();
+            if( edge_index >= sample.tree().edge_count() ) {
+                throw std::runtime_error( "Invalid jplace cache file: " + path );
+            }
+            auto& placement = pquery.add_placement( sample.tree().edge_at( edge_index ));
+            placement.likelihood        = deserial.get_float<double>();
+            placement.like_weight_ratio = deserial.get_float<double>();
+            placement.proximal_length   = deserial.get_float<double>();
+            placement.pendant_length    = deserial.get_float<double>();
+        }
+        auto const name_count = deserial.get_int<uint64_t>();
+        for( size_t ni = 0; ni < name_count; ++ni ) {
+            auto const name = deserial.get_string();
+            pquery.add_name( name, deserial.get_float<double>() );
+        }
+    }
+
+    return sample;
+}
+
+// =================================================================================================
+//      Parallel Parsing Helper Functions
+// =================================================================================================
+
+/**
+ * @brief Minimum document size (in bytes, after decompression) for which we attempt
+ * to parse the "placements" array of a jplace file with multiple threads.
+ *
+ * Below that, the splitting overhead is not worth it.
+ */
+static const size_t jplace_parallel_min_file_size_ = 64 * 1024 * 1024;
+
+/**
+ * @brief Find a top-level array (such as "placements" or "fields") in a jplace document,
+ * and the boundaries of its elements.
+ *
+ * Fills @p elements with the begin (inclusive) and end (exclusive) offsets of each top-level
+ * element of the array, and @p array_open / @p array_close with the offsets of the enclosing
+ * brackets. Returns false if the document does not have the expected structure, in which case
+ * the caller is expected to fall back to normal parsing, which will then report proper errors.
+ */
+static bool jplace_find_top_level_array_(
+    std::string const& text,
+    std::string const& key,
+    size_t& array_open,
+    size_t& array_close,
+    std::vector<std::pair<size_t, size_t>>& elements
+) {
+    size_t depth = 0;
+    bool in_string = false;
+    bool escaped = false;
+    bool in_array = false;
+    size_t array_depth = 0;
+    size_t element_begin = 0;
+    std::string last_string;
+    bool last_was_key_candidate = false;
+
+    for( size_t i = 0; i < text.size(); ++i ) {
+        auto const c = text[i];
+
+        // String content, with escape handling. We also collect the string itself,
+        // as we need it to detect the key.
+        if( in_string ) {
+            if( escaped ) {
+                escaped = false;
+            } else if( c == '\\' ) {
+                escaped = true;
+            } else if( c == '"' ) {
+                in_string = false;
+                last_was_key_candidate = true;
+            } else {
+                last_string += c;
+            }
+            continue;
+        }
+
+        switch( c ) {
+            case '"': {
+                in_string = true;
+                last_string.clear();
+                break;
+            }
+            case ':': {
+                // A string followed by a colon at depth 1 is a top-level key.
+                if( last_was_key_candidate && depth == 1 && last_string == key ) {
+                    // Find the opening bracket of the array.
+                    auto j = i + 1;
+                    while( j < text.size() && std::isspace( text[j] )) {
+                        ++j;
+                    }
+                    if( j >= text.size() || text[j] != '[' ) {
+                        return false;
+                    }
+                    in_array = true;
+                    array_depth = depth;
+                    array_open = j;
+                    element_begin = j + 1;
+                    i = j;
+                    ++depth;
+                }
+                last_was_key_candidate = false;
+                break;
+            }
+            case '{':
+            case '[': {
+                ++depth;
+                break;
+            }
+            case '}':
+            case ']': {
+                if( depth == 0 ) {
+                    return false;
+                }
+                --depth;
+                if( in_array && depth == array_depth ) {
+                    // Closing bracket of the array.
+                    if( i > element_begin ) {
+                        elements.emplace_back( element_begin, i );
+                    }
+                    array_close = i;
+                    return true;
+                }
+                break;
+            }
+            case ',': {
+                if( in_array && depth == array_depth + 1 ) {
+                    elements.emplace_back( element_begin, i );
+                    element_begin = i + 1;
+                }
+                break;
+            }
+            default: {
+                break;
+            }
+        }
+        if( c != ':' && ! std::isspace( c )) {
+            last_was_key_candidate = false;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * @brief Parse a jplace document with multiple threads by splitting its "placements" array
+ * into chunks, parsing each chunk as its own document, and merging the results.
+ *
+ * Returns an empty Sample (no tree) if the document could not be split, in which case
+ * the caller needs to parse it normally.
+ */
+static genesis::placement::Sample jplace_parallel_parse_(
+    std::string const& text,
+    genesis::placement::JplaceReader const& reader,
+    size_t num_threads
+) {
+    using namespace genesis;
+    using namespace genesis::placement;
+
+    // Find the placements array. If the document is unexpected, give up.
+    size_t array_open  = 0;
+    size_t array_close = 0;
+    std::vector<std::pair<size_t, size_t>> elements;
+    if( ! jplace_find_top_level_array_( text, "placements", array_open, array_close, elements )) {
+        return Sample();
+    }
+    if( elements.size() < 2 * num_threads ) {
+        return Sample();
+    }
+
+    // Build one document per chunk, consisting of everything around the placements array,
+    // with only the chunk's share of elements in between. Each chunk hence repeats the tree,
+    // which is cheap compared to the placements of a huge file.
+    auto const prefix = text.substr( 0, array_open + 1 );
+    auto const suffix = text.substr( array_close );
+    auto const num_chunks = num_threads;
+    auto chunk_samples = std::vector<Sample>( num_chunks );
+
+    #pragma omp parallel for schedule(dynamic)
+    for( size_t ci = 0; ci < num_chunks; ++ci ) {
+        auto const elem_begin = ci * elements.size() / num_chunks;
+        auto const elem_end   = ( ci + 1 ) * elements.size() / num_chunks;
+
+        std::string chunk_text = prefix;
+        for( size_t ei = elem_begin; ei < elem_end; ++ei ) {
+            if( ei > elem_begin ) {
+                chunk_text += ',';
+            }
+            chunk_text.append( text, elements[ei].first, elements[ei].second - elements[ei].first );
+        }
+        chunk_text += suffix;
+
+        chunk_samples[ci] = reader.read( utils::from_string( chunk_text ));
+    }
+
+    // Merge the chunks, keeping the original pquery order.
+    auto result = std::move( chunk_samples[0] );
+    for( size_t ci = 1; ci < num_chunks; ++ci ) {
+        copy_pqueries( chunk_samples[ci], result );
+    }
+    return result;
+}
+
+// =================================================================================================
+//      Point Mass Pruning Helper Functions
+// =================================================================================================
+
+/**
+ * @brief Find the index of the "like_weight_ratio" column in the "fields" array
+ * of a jplace document. Returns false if the document does not have the expected structure.
+ */
+static bool jplace_like_weight_ratio_field_index_(
+    std::string const& text,
+    size_t& lwr_index
+) {
+    size_t array_open  = 0;
+    size_t array_close = 0;
+    std::vector<std::pair<size_t, size_t>> elements;
+    if( ! jplace_find_top_level_array_( text, "fields", array_open, array_close, elements )) {
+        return false;
+    }
+
+    for( size_t i = 0; i < elements.size(); ++i ) {
+        // Each element is a quoted field name, possibly with surrounding whitespace.
+        auto b = elements[i].first;
+        while( b < elements[i].second && text[b] != '"' ) {
+            ++b;
+        }
+        auto e = b + 1;
+        while( e < elements[i].second && text[e] != '"' ) {
+            ++e;
+        }
+        if( b >= elements[i].second || e >= elements[i].second ) {
+            return false;
+        }
+        if( text.compare( b + 1, e - b - 1, "like_weight_ratio" ) == 0 ) {
+            lwr_index = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Parse the @p n -th comma-separated number of a placement row.
+ */
+static bool jplace_parse_nth_number_(
+    std::string const& text,
+    size_t begin,
+    size_t end,
+    size_t n,
+    double& value
+) {
+    size_t i = begin;
+    for( size_t field = 0; field < n; ++field ) {
+        while( i < end && text[i] != ',' ) {
+            ++i;
+        }
+        if( i >= end ) {
+            return false;
+        }
+        ++i;
+    }
+    if( i >= end ) {
+        return false;
+    }
+    // The field ends at a comma or the closing bracket of the row, both of which stop strtod.
+    value = std::strtod( text.c_str() + i, nullptr );
+    return true;
+}
+
+/**
+ * @brief Within one element of the "placements" array, find the "p" array and the row
+ * with the highest like_weight_ratio.
+ *
+ * Sets @p p_open / @p p_close to the offsets of the brackets of the "p" array, and, if
+ * @p have_best is set, @p best_begin (inclusive) and @p best_end (exclusive) to the span
+ * of the best row, including its brackets. Returns false if the element does not have
+ * the expected structure.
+ */
+static bool jplace_best_placement_row_(
+    std::string const& text,
+    size_t begin,
+    size_t end,
+    size_t lwr_index,
+    size_t& p_open,
+    size_t& p_close,
+    bool&   have_best,
+    size_t& best_begin,
+    size_t& best_end
+) {
+    // Find the "p" key at the top level of the pquery object.
+    size_t depth = 0;
+    bool in_string = false;
+    bool escaped = false;
+    std::string last_string;
+    bool last_was_key_candidate = false;
+    bool found_p = false;
+    size_t i = begin;
+    for( ; i < end; ++i ) {
+        auto const c = text[i];
+        if( in_string ) {
+            if( escaped ) {
+                escaped = false;
+            } else if( c == '\\' ) {
+                escaped = true;
+            } else if( c == '"' ) {
+                in_string = false;
+                last_was_key_candidate = true;
+            } else {
+                last_string += c;
+            }
+            continue;
+        }
+        if( c == '"' ) {
+            in_string = true;
+            last_string.clear();
+            continue;
+        }
+        if( c == ':' ) {
+            if( last_was_key_candidate && depth == 1 && last_string == "p" ) {
+                auto j = i + 1;
+                while( j < end && std::isspace( text[j] )) {
+                    ++j;
+                }
+                if( j >= end || text[j] != '[' ) {
+                    return false;
+                }
+                p_open = j;
+                found_p = true;
+                break;
+            }
+            last_was_key_candidate = false;
+            continue;
+        }
+        if( c == '{' || c == '[' ) {
+            ++depth;
+        } else if( c == '}' || c == ']' ) {
+            if( depth == 0 ) {
+                return false;
+            }
+            --depth;
+        }
+        if( ! std::isspace( c )) {
+            last_was_key_candidate = false;
+        }
+    }
+    if( ! found_p ) {
+        return false;
+    }
+
+    // Walk the rows of the "p" array, keeping a running max of the like_weight_ratio.
+    // Rows contain only plain numbers, so we can scan for the closing bracket directly.
+    have_best = false;
+    double best_lwr = 0.0;
+    i = p_open + 1;
+    while( true ) {
+        while( i < end && ( std::isspace( text[i] ) || text[i] == ',' )) {
+            ++i;
+        }
+        if( i >= end ) {
+            return false;
+        }
+        if( text[i] == ']' ) {
+            p_close = i;
+            return true;
+        }
+        if( text[i] != '[' ) {
+            return false;
+        }
+        auto const row_begin = i;
+        auto j = i + 1;
+        while( j < end && text[j] != ']' ) {
+            ++j;
+        }
+        if( j >= end ) {
+            return false;
+        }
+        double lwr;
+        if( ! jplace_parse_nth_number_( text, row_begin + 1, j, lwr_index, lwr )) {
+            return false;
+        }
+        if( ! have_best || lwr > best_lwr ) {
+            have_best  = true;
+            best_lwr   = lwr;
+            best_begin = row_begin;
+            best_end   = j + 1;
+        }
+        i = j + 1;
+    }
+}
+
+/**
+ * @brief With point mass mode active, reduce a jplace document to the best placement
+ * per pquery, at the text level, before any parsing.
+ *
+ * In point mass mode, all but the highest like_weight_ratio placement of each pquery are
+ * discarded right after parsing anyway. For long-tailed pqueries with dozens of placements,
+ * that wastes almost all of the placement parsing and allocation. This pass rewrites each
+ * pquery's "p" array to hold only its running-max row, so that the reader never materializes
+ * the others. Everything outside the "p" arrays (names, multiplicities, the tree) is copied
+ * verbatim.
+ *
+ * Returns an empty string if the document does not have the expected structure, in which
+ * case the caller parses the full document and filters afterwards, as before.
+ */
+static std::string jplace_point_mass_prune_( std::string const& text )
+{
+    size_t lwr_index = 0;
+    if( ! jplace_like_weight_ratio_field_index_( text, lwr_index )) {
+        return std::string();
+    }
+
+    size_t array_open  = 0;
+    size_t array_close = 0;
+    std::vector<std::pair<size_t, size_t>> elements;
+    if( ! jplace_find_top_level_array_( text, "placements", array_open, array_close, elements )) {
+        return std::string();
+    }
+
+    std::string result;
+    result.reserve( text.size() / 4 );
+    result.append( text, 0, array_open + 1 );
+    for( size_t ei = 0; ei < elements.size(); ++ei ) {
+        size_t p_open = 0;
+        size_t p_close = 0;
+        bool have_best = false;
+        size_t best_begin = 0;
+        size_t best_end = 0;
+        if( ! jplace_best_placement_row_(
+            text, elements[ei].first, elements[ei].second, lwr_index,
+            p_open, p_close, have_best, best_begin, best_end
+        )) {
+            return std::string();
+        }
+
+        if( ei > 0 ) {
+            result += ',';
+        }
+        result.append( text, elements[ei].first, p_open + 1 - elements[ei].first );
+        if( have_best ) {
+            result.append( text, best_begin, best_end - best_begin );
+        }
+        result.append( text, p_close, elements[ei].second - p_close );
+    }
+    result.append( text, array_close, text.size() - array_close );
+    return result;
+}
+
+// =================================================================================================
+//      Preloaded Samples
+// =================================================================================================
+
+std::unordered_map<std::string, genesis::placement::Sample> JplaceInputOptions::preloaded_samples_;
+
+void JplaceInputOptions::preload_sample(
+    std::string const& path, genesis::placement::Sample&& sample
+) {
+    preloaded_samples_[ path ] = std::move( sample );
+}
+
+size_t JplaceInputOptions::preloaded_sample_count()
+{
+    return preloaded_samples_.size();
+}
+
+void JplaceInputOptions::clear_preloaded_samples()
+{
+    preloaded_samples_.clear();
+}
+
 // =================================================================================================
 //      Run Functions
 // =================================================================================================
 
 genesis::placement::Sample JplaceInputOptions::sample( size_t index ) const
+{
+    return sample_( index, discard_names_ );
+}
+
+genesis::placement::Sample JplaceInputOptions::sample_( size_t index, bool discard_names ) const
 {
     using namespace genesis;
     using namespace genesis::placement;
 
-    // Do the reading.
-    auto sample = reader_.read( utils::from_file( file_path( index ) ));
+    // Profiling stage for the --profile option. As samples may be read in parallel or in the
+    // background, the wall time of this stage can overlap with other stages.
+    ProfilerGuard profiler_guard( "jplace input read" );
+
+    // Do the reading: from the process-wide preloaded store if the file was preloaded
+    // (see `gappa tools server`), from the binary cache if the user wants it and it is
+    // up to date, or from the actual jplace file, in which case we might want to
+    // (re-)write the cache. Both the store and the cache keep the sample as it appears
+    // in the file, that is, before any of the transformations below, so that they are
+    // valid independently of the other option flags.
+    Sample sample;
+    auto const cache_path = file_path( index ) + ".bin";
+    auto const preloaded = preloaded_samples_.find( file_path( index ));
+    if( preloaded != preloaded_samples_.end() ) {
+        sample = preloaded->second;
+    } else if( jplace_cache_ && jplace_cache_is_fresh_( file_path( index ), cache_path )) {
+        sample = jplace_cache_read_( cache_path );
+    } else {
+        // For large files, try to parse the "placements" array with multiple threads.
+        // This only kicks in if we are not already parsing multiple files in parallel,
+        // as the parallel region in the helper is serialized when nested.
+        // Obtain the (decompressed) document. This also kicks off the background decode
+        // of the next file in the list, so that sequential consumers overlap the gzip
+        // inflate of one file with the parsing of the previous one.
+        auto text = file_contents( index );
+
+        // In point mass mode, reduce the document to the best placement per pquery before
+        // parsing, so that the discarded placements are never materialized. Not done when
+        // the binary cache is active, as the cache stores the sample as it appears in the
+        // file. If the document structure is unexpected, the pruning returns an empty
+        // string, and we parse the full document and filter afterwards, as before.
+        if( point_mass_option && point_mass_ && ! jplace_cache_ ) {
+            auto pruned = jplace_point_mass_prune_( text );
+            if( ! pruned.empty() ) {
+                text = std::move( pruned );
+            }
+        }
+
+        auto const num_threads = utils::Options::get().number_of_threads();
+        if( num_threads > 1 && text.size() >= jplace_parallel_min_file_size_ ) {
+            sample = jplace_parallel_parse_( text, reader_, num_threads );
+            if( sample.tree().empty() ) {
+                // Could not split the document. Parse it normally from the already read text.
+                sample = reader_.read( utils::from_string( text ));
+            }
+        } else {
+            sample = reader_.read( utils::from_string( text ));
+        }
+        if( jplace_cache_ ) {
+            jplace_cache_write_( sample, cache_path );
+        }
+    }
+
+    // Subsample the pqueries for fast exploratory runs, see add_subsample_opt_to_app().
+    // This happens after the cache handling, so that the store and the cache always keep
+    // the full sample, but before all mass transformations, which then see the reduced set.
+    if( subsample_option && subsample_ > 0 && sample.size() > subsample_ ) {
+
+        // Keep track of the total multiplicity, so that the kept pqueries can be scaled
+        // to preserve the total mass of the sample.
+        double total_before = 0.0;
+        for( auto const& pquery : sample ) {
+            total_before += total_multiplicity( pquery );
+        }
+
+        // Choose the kept pqueries by a partial Fisher-Yates shuffle: after the loop,
+        // the first subsample_ pqueries are a uniform random subset of the sample.
+        // The engine is seeded from the file path, so that repeated runs (and commands
+        // that read files in a different order or thread count) give the same subset.
+        auto engine = std::mt19937_64( std::hash<std::string>{}( file_path( index )));
+        for( size_t i = 0; i < subsample_; ++i ) {
+            auto const j = std::uniform_int_distribution<size_t>( i, sample.size() - 1 )( engine );
+            if( j != i ) {
+                std::swap( sample.at( i ), sample.at( j ));
+            }
+        }
+        for( size_t i = sample.size(); i > subsample_; --i ) {
+            sample.remove( i - 1 );
+        }
+
+        // Scale the kept multiplicities so that the total mass stays the same.
+        double total_after = 0.0;
+        for( auto const& pquery : sample ) {
+            total_after += total_multiplicity( pquery );
+        }
+        if( total_after > 0.0 ) {
+            auto const factor = total_before / total_after;
+            for( auto& pquery : sample ) {
+                for( auto& name : pquery.names() ) {
+                    name.multiplicity *= factor;
+                }
+            }
+        }
+    }
+
+    // If the command declared that it does not need names, fold the names of each pquery
+    // into a single anonymous one that carries their total multiplicity, so that all
+    // mass and imbalance computations are unaffected while the name strings are freed.
+    if( discard_names ) {
+        for( auto& pquery : sample ) {
+            auto const tm = total_multiplicity( pquery );
+            pquery.clear_names();
+            pquery.add_name( "", tm );
+        }
+    }
+
+    // Trim allocator slack on the pquery name strings. The parser grows them
+    // incrementally, which can leave considerable excess capacity per string;
+    // over millions of names, that adds up to a notable share of resident memory.
+    // An actual interning pool (unique name bytes stored once, names as offsets)
+    // would need the genesis PqueryName class to not hold its own std::string.
+    for( auto& pquery : sample ) {
+        for( auto& name : pquery.names() ) {
+            name.name.shrink_to_fit();
+        }
+    }
 
     // Point mass: remove all but the most likely placement, and set its weight to one.
     if( point_mass_option && point_mass_ ) {
@@ -170,6 +940,55 @@ genesis::placement::Sample JplaceInputOptions::sample( size_t index ) const
     return sample;
 }
 
+genesis::placement::Sample JplaceInputOptions::sample_prefetch( size_t index ) const
+{
+    using namespace genesis::placement;
+
+    // Number of files that we read and parse ahead of the caller. With a streaming consumer
+    // that writes its output sequentially, this keeps several input parses in flight at once,
+    // while bounding the buffered memory to a fixed number of samples. We scale with the
+    // thread count, but cap the window, as more read-ahead only costs memory once the parsing
+    // keeps up with the (serial) consumer anyway.
+    // The memory budget additionally caps the number of buffered samples, see --memory-limit.
+    auto const window = std::min(
+        std::min<size_t>( 4, utils::Options::get().number_of_threads() ),
+        max_concurrent_samples()
+    );
+
+    // Helper to launch the background parses of the files following the given index,
+    // limited to the read-ahead window. Expects the mutex to be locked.
+    auto launch_window = [&]( size_t next ){
+        for( ; next < file_count() && prefetch_->futures.size() < window; ++next ) {
+            if( prefetch_->futures.count( next ) > 0 ) {
+                continue;
+            }
+            prefetch_->futures[ next ] = global_options.thread_pool().enqueue( [ this, next ](){
+                return sample( next );
+            });
+        }
+    };
+
+    // If a background parse for this file is pending, use it, and immediately refill the
+    // window, so that the next parses run while we wait for and process this one.
+    // Otherwise, start the window at this file, and read the file right here.
+    Sample result;
+    std::unique_lock<std::mutex> lock( prefetch_->mutex );
+    auto const it = prefetch_->futures.find( index );
+    if( it != prefetch_->futures.end() ) {
+        auto future = std::move( it->second );
+        prefetch_->futures.erase( it );
+        launch_window( index + 1 );
+        lock.unlock();
+        result = future.get();
+    } else {
+        launch_window( index + 1 );
+        lock.unlock();
+        result = sample( index );
+    }
+
+    return result;
+}
+
 genesis::placement::SampleSet JplaceInputOptions::sample_set() const
 {
     using namespace genesis;
@@ -186,22 +1005,22 @@ genesis::placement::SampleSet JplaceInputOptions::sample_set() const
     // Result.
     SampleSet set;
     auto const paths = file_paths();
-    size_t file_count = 0;
 
     // Make a vector of default-constructed Samples of the needed size.
     // We do this so that the order of input jplace files is kept.
     auto tmp = std::vector<Sample>( paths.size() );
 
-    // Parallel parsing.
-    #pragma omp parallel for schedule(dynamic)
+    // Parallel parsing. With a single input file, we leave this region inactive,
+    // so that the intra-file parallel parsing in sample() can use the threads instead.
+    // The memory budget caps how many samples are parsed at once, see --memory-limit.
+    auto progress = ProgressReporter( "Reading jplace files", paths.size() );
+    auto const max_in_flight = max_concurrent_samples();
+    #pragma omp parallel for schedule(dynamic) if( paths.size() > 1 ) num_threads( max_in_flight )
     for( size_t fi = 0; fi < paths.size(); ++fi ) {
-
-        // User output.
-        LOG_MSG2 << "Reading file " << ( ++file_count ) << " of " << paths.size()
-                 << ": " << paths[ fi ];
-
         tmp[ fi ] = sample( fi );
+        progress.increment();
     }
+    progress.finish();
 
     // Move to target SampleSet.
     for( size_t fi = 0; fi < paths.size(); ++fi ) {
@@ -212,87 +1031,486 @@ genesis::placement::SampleSet JplaceInputOptions::sample_set() const
     return set;
 }
 
+void JplaceInputOptions::for_each_pquery(
+    std::function<void(
+        genesis::placement::Pquery&,
+        genesis::placement::Sample const&
+    )> const& callback
+) const {
+    using namespace genesis;
+    using namespace genesis::placement;
+
+    // We process files strictly one at a time, so that only one sample is in memory at once.
+    // The fingerprint of the first tree is kept for compatibility checks against all
+    // following files, instead of keeping a copy of the whole tree for pairwise comparisons.
+    Murmur3::DigestType first_fingerprint;
+    bool have_fingerprint = false;
+    for( size_t fi = 0; fi < file_count(); ++fi ) {
+
+        // User output.
+        LOG_MSG2 << "Reading file " << ( fi + 1 ) << " of " << file_count()
+                 << ": " << file_path( fi );
+
+        auto smpl = sample_prefetch( fi );
+        auto const fingerprint = placement_tree_fingerprint( smpl.tree() );
+        if( ! have_fingerprint ) {
+            first_fingerprint = fingerprint;
+            have_fingerprint = true;
+        } else if( fingerprint != first_fingerprint ) {
+            throw std::runtime_error( "Input jplace files have differing reference trees." );
+        }
+
+        for( auto& pquery : smpl ) {
+            callback( pquery, smpl );
+        }
+
+        // Free the sample on a background thread, so that the next file can be
+        // processed while the millions of small allocations are being returned.
+        dispose_async( smpl );
+    }
+}
+
 // =================================================================================================
 //      Covenience Functions
 // =================================================================================================
 
 JplaceInputOptions::PlacementProfile JplaceInputOptions::placement_profile(
     bool with_imbalances,
-    bool force_imbal_norm
+    bool force_imbal_norm,
+    bool with_masses
 ) const {
     using namespace genesis;
     using namespace genesis::placement;
     using namespace genesis::utils;
 
     PlacementProfile result;
-    size_t fc = 0;
-
-    // Read all jplace files and accumulate their data.
-    #pragma omp parallel for schedule(dynamic)
-    for( size_t fi = 0; fi < file_count(); ++fi ) {
+    if( file_count() == 0 ) {
+        return result;
+    }
 
-        // User output.
-        LOG_MSG2 << "Reading file " << ( ++fc ) << " of " << file_count()
-                 << ": " << file_path( fi );
+    // If a profile cache file is given and already exists, load it instead of
+    // re-reading the whole dataset. Otherwise, compute the profile as usual,
+    // and write the cache at the end, see below.
+    if( ! profile_cache_.empty() && is_file( profile_cache_ )) {
+        LOG_MSG1 << "Loading placement profile from cache file " << profile_cache_;
+        result = load_profile_cache_( with_imbalances, force_imbal_norm, with_masses );
+        advise_huge_pages(
+            result.edge_masses.data().data(),
+            result.edge_masses.rows() * result.edge_masses.cols() * sizeof( double )
+        );
+        advise_huge_pages(
+            result.edge_imbalances.data().data(),
+            result.edge_imbalances.rows() * result.edge_imbalances.cols() * sizeof( double )
+        );
+        return result;
+    }
 
-        // Read in file and get data vectors.
-        // This is the part that can trivially be done in parallel.
-        auto const smpl = sample( fi );
-        auto const edge_masses = placement_mass_per_edges_with_multiplicities( smpl );
+    // Postorder layout of the reference tree, built once from the first sample below.
+    // It derives each sample's imbalance vector from its per-edge masses with a single
+    // prefix scan, instead of the per-sample tree traversal of epca_imbalance_vector().
+    EdgeImbalanceLayout imbalance_layout;
+
+    // Helper to compute the data vectors of one sample and store them in its row of the
+    // matrices. Each file writes a distinct row, so no synchronization is needed here.
+    // The mass accumulation itself is threaded when the caller is not already processing
+    // samples in parallel, so that large samples in small datasets also use all cores.
+    auto fill_row = [&]( size_t fi, Sample const& smpl, bool parallel_masses ){
+        // The mass vector is also the input of the imbalance computation,
+        // so we need it for either of the two matrices.
+        auto const edge_masses = accumulate_edge_masses( smpl, parallel_masses );
         auto const edge_imbals
             = with_imbalances
-            ? epca_imbalance_vector( smpl, force_imbal_norm || mass_norm_relative() )
+            ? imbalance_layout.imbalance_vector(
+                edge_masses, force_imbal_norm || mass_norm_relative()
+            )
             : std::vector<double>()
         ;
 
-        // The main merging is single threaded.
-        // Could be done in parallel if we make sure that the matrices are initialized first.
-        // Right now, not worth the effort.
-        #pragma omp critical(GAPPA_JPLACE_INPUT_ACCUMULATE)
-        {
-            // Set tree
-            if( result.tree.empty() ) {
-                result.tree = smpl.tree();
-            } else if( ! genesis::placement::compatible_trees( result.tree, smpl.tree() ) ) {
-                throw std::runtime_error( "Input jplace files have differing reference trees." );
-            }
+        // Do some checks for correct input.
+        if(
+            ( with_masses && edge_masses.size() != result.edge_masses.cols() ) ||
+            ( with_imbalances && edge_imbals.size() != result.edge_imbalances.cols() )
+        ) {
+            throw std::runtime_error(
+                "Internal Error: Placement profile matrices have wrong number of columns."
+            );
+        }
+
+        // Fill the matrices.
+        if( with_masses ) {
+            result.edge_masses.row( fi ) = edge_masses;
+        }
+        if( with_imbalances ) {
+            result.edge_imbalances.row( fi ) = edge_imbals;
+        }
+    };
+
+    // Read the first file up front, so that the tree is known and the matrices can be
+    // initialized once, before the parallel loop over the remaining files starts.
+    auto progress = ProgressReporter( "Reading jplace files", file_count() );
+    Murmur3::DigestType reference_fingerprint;
+    {
+        auto const smpl = sample_( 0, true );
+        result.tree = smpl.tree();
+        reference_fingerprint = placement_tree_fingerprint( result.tree );
+        if( with_imbalances ) {
+            imbalance_layout = EdgeImbalanceLayout( result.tree );
+        }
+        if( with_masses ) {
+            result.edge_masses = Matrix<double>( file_count(), result.tree.edge_count() );
+            advise_huge_pages(
+                result.edge_masses.data().data(),
+                result.edge_masses.rows() * result.edge_masses.cols() * sizeof( double )
+            );
+        }
+        if( with_imbalances ) {
+            result.edge_imbalances = Matrix<double>( file_count(), result.tree.edge_count() );
+            advise_huge_pages(
+                result.edge_imbalances.data().data(),
+                result.edge_imbalances.rows() * result.edge_imbalances.cols() * sizeof( double )
+            );
+        }
+        fill_row( 0, smpl, true );
+        progress.increment();
+    }
+
+    // Read the remaining jplace files in parallel. Each iteration only writes to its own
+    // matrix row, and the tree compatibility check only reads the shared tree, so this
+    // loop runs lock-free, without the former critical section around the accumulation.
+    // The memory budget caps how many samples are parsed at once, see --memory-limit.
+    bool const parallel_samples = file_count() > 2;
+    auto const max_in_flight = max_concurrent_samples();
+    #pragma omp parallel for schedule(dynamic) if( parallel_samples ) num_threads( max_in_flight )
+    for( size_t fi = 1; fi < file_count(); ++fi ) {
+        auto const smpl = sample_( fi, true );
+        if( placement_tree_fingerprint( smpl.tree() ) != reference_fingerprint ) {
+            throw std::runtime_error( "Input jplace files have differing reference trees." );
+        }
+        fill_row( fi, smpl, ! parallel_samples );
+        progress.increment();
+    }
+    progress.finish();
+
+    // Store the freshly computed profile for later commands in the pipeline.
+    if( ! profile_cache_.empty() ) {
+        LOG_MSG1 << "Writing placement profile to cache file " << profile_cache_;
+        write_profile_cache_( result, with_imbalances, force_imbal_norm, with_masses );
+    }
+
+    return result;
+}
+
+/**
+ * @brief Magic header of the profile cache file format, see write_profile_cache_().
+ */
+static std::string const profile_cache_magic_ = "gappa-placement-profile-v3";
+
+/**
+ * @brief Get the modification time and size of an input file for the profile cache,
+ * used to detect inputs that were regenerated in place under the same name.
+ */
+static void profile_cache_file_signature_(
+    std::string const& path, uint64_t& mtime, uint64_t& size
+) {
+    struct stat file_stat;
+    if( stat( path.c_str(), &file_stat ) != 0 ) {
+        throw std::runtime_error( "Cannot stat input file '" + path + "'." );
+    }
+    mtime = static_cast<uint64_t>( file_stat.st_mtime );
+    size  = static_cast<uint64_t>( file_stat.st_size );
+}
+
+/**
+ * @brief Helper to write a matrix to the profile cache, as dimensions plus raw values.
+ */
+static void serialize_matrix_(
+    genesis::utils::Serializer& ser, genesis::utils::Matrix<double> const& mat
+) {
+    ser << static_cast<uint64_t>( mat.rows() );
+    ser << static_cast<uint64_t>( mat.cols() );
+    for( auto const& e : mat ) {
+        ser << e;
+    }
+}
 
-            // Init matrices if needed.
-            if( result.edge_masses.empty() ) {
-                result.edge_masses = Matrix<double>( file_count(), result.tree.edge_count() );
+/**
+ * @brief Helper to read a matrix from the profile cache.
+ */
+static genesis::utils::Matrix<double> deserialize_matrix_( genesis::utils::Deserializer& des )
+{
+    uint64_t rows = 0;
+    uint64_t cols = 0;
+    des >> rows;
+    des >> cols;
+    auto mat = genesis::utils::Matrix<double>( rows, cols );
+    for( auto& e : mat ) {
+        des >> e;
+    }
+    return mat;
+}
+
+void JplaceInputOptions::write_profile_cache_(
+    PlacementProfile const& profile,
+    bool with_imbalances, bool force_imbal_norm, bool with_masses
+) const {
+    using namespace genesis::tree;
+    using namespace genesis::utils;
+
+    auto ser = Serializer( to_file( profile_cache_ ));
+
+    // Header: magic string, the flags that the profile was computed with, and the settings
+    // that change the matrix contents, so that a stale or mismatched cache is detected.
+    ser << profile_cache_magic_;
+    ser << with_imbalances;
+    ser << force_imbal_norm;
+    ser << with_masses;
+    ser << point_mass_;
+    ser << ignore_multiplicities_;
+    ser << mass_norm_;
+    ser << static_cast<uint64_t>( subsample_ );
+
+    // Input file names, to make sure that the cache is only used for the same dataset,
+    // along with their modification times and sizes, so that a file regenerated in place
+    // under the same name invalidates the cache as well.
+    auto const names = base_file_names();
+    ser << static_cast<uint64_t>( names.size() );
+    for( size_t i = 0; i < names.size(); ++i ) {
+        uint64_t mtime = 0;
+        uint64_t size = 0;
+        profile_cache_file_signature_( file_path( i ), mtime, size );
+        ser << names[i];
+        ser << mtime;
+        ser << size;
+    }
+
+    // The tree (as newick) and the matrices.
+    ser << CommonTreeNewickWriter().to_string( profile.tree );
+    if( with_masses ) {
+        serialize_matrix_( ser, profile.edge_masses );
+    }
+    if( with_imbalances ) {
+        serialize_matrix_( ser, profile.edge_imbalances );
+    }
+}
+
+JplaceInputOptions::PlacementProfile JplaceInputOptions::load_profile_cache_(
+    bool with_imbalances, bool force_imbal_norm, bool with_masses
+) const {
+    using namespace genesis::tree;
+    using namespace genesis::utils;
+
+    auto des = Deserializer( from_file( profile_cache_ ));
+    auto const invalid_cache = [&]( std::string const& reason ){
+        return std::runtime_error(
+            "Profile cache file '" + profile_cache_ + "' " + reason +
+            ". Delete the file to have it recomputed."
+        );
+    };
+
+    // Check the header against the current request and settings.
+    std::string magic;
+    des >> magic;
+    if( magic != profile_cache_magic_ ) {
+        throw invalid_cache( "is not a valid gappa placement profile cache" );
+    }
+    bool cached_imbalances = false;
+    bool cached_force_norm = false;
+    bool cached_masses = false;
+    bool cached_point_mass = false;
+    bool cached_ignore_mult = false;
+    std::string cached_mass_norm;
+    uint64_t cached_subsample = 0;
+    des >> cached_imbalances;
+    des >> cached_force_norm;
+    des >> cached_masses;
+    des >> cached_point_mass;
+    des >> cached_ignore_mult;
+    des >> cached_mass_norm;
+    des >> cached_subsample;
+    if(
+        ( with_imbalances && ! cached_imbalances ) ||
+        ( with_masses && ! cached_masses ) ||
+        ( with_imbalances && force_imbal_norm != cached_force_norm )
+    ) {
+        throw invalid_cache( "does not contain the matrices needed by this command" );
+    }
+    if(
+        cached_point_mass != point_mass_ ||
+        cached_ignore_mult != ignore_multiplicities_ ||
+        cached_mass_norm != mass_norm_ ||
+        cached_subsample != static_cast<uint64_t>( subsample_ )
+    ) {
+        throw invalid_cache( "was computed with different mass settings" );
+    }
+
+    // Check that it was computed from the same input files.
+    uint64_t name_count = 0;
+    des >> name_count;
+    auto const names = base_file_names();
+    if( name_count != names.size() ) {
+        throw invalid_cache( "was computed from a different set of input files" );
+    }
+    for( size_t i = 0; i < names.size(); ++i ) {
+        std::string cached_name;
+        uint64_t cached_mtime = 0;
+        uint64_t cached_size = 0;
+        des >> cached_name;
+        des >> cached_mtime;
+        des >> cached_size;
+        if( cached_name != names[i] ) {
+            throw invalid_cache( "was computed from a different set of input files" );
+        }
+        uint64_t mtime = 0;
+        uint64_t size = 0;
+        profile_cache_file_signature_( file_path( i ), mtime, size );
+        if( cached_mtime != mtime || cached_size != size ) {
+            throw invalid_cache(
+                "was computed from an older version of input file '" + file_path( i ) + "'"
+            );
+        }
+    }
+
+    // Read the payload.
+    PlacementProfile result;
+    std::string newick;
+    des >> newick;
+    result.tree = CommonTreeNewickReader().read( from_string( newick ));
+    if( cached_masses ) {
+        result.edge_masses = deserialize_matrix_( des );
+    }
+    if( cached_imbalances ) {
+        result.edge_imbalances = deserialize_matrix_( des );
+    }
+    return result;
+}
+
+/**
+ * @brief Set the branch lengths of a mass tree to the given per-edge averages,
+ * rescaling the mass positions on each edge accordingly.
+ *
+ * This is the per-tree half of mass_trees_make_average_branch_lengths(): the averages
+ * are accumulated across the trees during the load already, and applying them is
+ * independent per tree, so the caller can parallelize over the trees, instead of the
+ * single-threaded pass over all trees that the genesis function does.
+ */
+static void mass_tree_apply_average_branch_lengths_(
+    genesis::tree::MassTree& tree,
+    std::vector<double> const& avg_lengths
+) {
+    using namespace genesis::tree;
+
+    assert( tree.edge_count() == avg_lengths.size() );
+    for( size_t ei = 0; ei < tree.edge_count(); ++ei ) {
+        auto& edge_data = tree.edge_at( ei ).data<MassTreeEdgeData>();
+        auto const avg_length = avg_lengths[ ei ];
+        if( edge_data.branch_length == avg_length ) {
+            continue;
+        }
+
+        // Move the masses to their relative position on the new branch length.
+        // On a zero length branch, all masses sit at position zero and stay there.
+        if( edge_data.branch_length > 0.0 && ! edge_data.masses.empty() ) {
+            auto const scaler = avg_length / edge_data.branch_length;
+            auto new_masses = std::map<double, double>();
+            for( auto const& mass : edge_data.masses ) {
+                new_masses[ mass.first * scaler ] += mass.second;
             }
-            if( with_imbalances && result.edge_imbalances.empty() ) {
-                result.edge_imbalances = Matrix<double>( file_count(), result.tree.edge_count() );
+            edge_data.masses = std::move( new_masses );
+        }
+        edge_data.branch_length = avg_length;
+    }
+}
+
+/**
+ * @brief Remove subtrees that carry no mass in any of the given mass trees.
+ *
+ * For sparse samples, most edges of the reference tree carry no placement mass at all,
+ * but the earth movers distance still traverses every edge of every tree, for every pair.
+ * Subtrees that are mass-free in all samples contribute nothing to any of the distances,
+ * so we can delete them from all trees alike (keeping their topologies identical),
+ * which makes the per-pair cost scale with the occupied part of the tree instead.
+ */
+static void mass_trees_compact_zero_subtrees_( std::vector<genesis::tree::MassTree>& mass_trees )
+{
+    using namespace genesis::tree;
+
+    if( mass_trees.empty() || mass_trees[0].edge_count() < 2 ) {
+        return;
+    }
+    auto const total_edges = mass_trees[0].edge_count();
+    size_t deleted_edges = 0;
+
+    // We delete one maximal mass-free subtree per round, in lockstep across all trees,
+    // as each deletion re-indexes the tree elements. The number of rounds is the number
+    // of such subtrees, which is small compared to the number of edges they contain.
+    while( true ) {
+        auto const& ref = mass_trees[0];
+
+        // Mark edges that carry mass in any of the trees.
+        auto occupied = std::vector<char>( ref.edge_count(), 0 );
+        for( auto const& tree : mass_trees ) {
+            auto const masses = mass_tree_mass_per_edge( tree );
+            assert( masses.size() == occupied.size() );
+            for( size_t ei = 0; ei < masses.size(); ++ei ) {
+                if( masses[ei] > 0.0 ) {
+                    occupied[ei] = 1;
+                }
             }
+        }
 
-            // Do some checks for correct input.
-            if( fi >= result.edge_masses.rows() || fi >= result.edge_imbalances.rows() ) {
-                throw std::runtime_error(
-                    "Internal Error: Placement profile matrices have wrong number of rows."
-                );
+        // If no edge carries any mass at all (all samples empty), there is nothing
+        // meaningful to compact, and we must not delete the whole tree.
+        if( std::none_of( occupied.begin(), occupied.end(), []( char o ){ return o == 1; })) {
+            return;
+        }
+
+        // For each edge, check whether the subtree away from the root contains any mass.
+        // The postorder traversal visits the subtree of an edge before the edge itself.
+        auto subtree_occupied = std::vector<char>( ref.edge_count(), 0 );
+        for( auto it : postorder( ref )) {
+            if( it.is_last_iteration() ) {
+                continue;
             }
-            if(
-                edge_masses.size() != edge_imbals.size()            ||
-                edge_masses.size() != result.edge_masses.cols()     ||
-                ( with_imbalances && edge_imbals.size() != result.edge_imbalances.cols() )
-            ) {
-                throw std::runtime_error(
-                    "Internal Error: Placement profile matrices have wrong number of columns."
-                );
+            char occ = occupied[ it.edge().index() ];
+            auto const& link = it.edge().secondary_link();
+            for( auto const* cl = &link.next(); cl != &link; cl = &cl->next() ) {
+                occ |= subtree_occupied[ cl->edge().index() ];
             }
+            subtree_occupied[ it.edge().index() ] = occ;
+        }
 
-            // Fill the matrices.
-            result.edge_masses.row( fi ) = edge_masses;
-            if( with_imbalances ) {
-                result.edge_imbalances.row( fi ) = edge_imbals;
+        // Find a maximal mass-free subtree, that is, one whose parent edge leads to mass.
+        // Nested mass-free edges are covered by deleting their topmost ancestor.
+        size_t target = ref.edge_count();
+        for( size_t ei = 0; ei < ref.edge_count(); ++ei ) {
+            if( subtree_occupied[ei] ) {
+                continue;
+            }
+            auto const& pnode = ref.edge_at(ei).primary_link().node();
+            if( is_root( pnode ) || subtree_occupied[ pnode.primary_link().edge().index() ] ) {
+                target = ei;
+                break;
             }
         }
+        if( target == ref.edge_count() ) {
+            break;
+        }
+
+        // Delete the subtree from all trees. As the trees have identical topologies and are
+        // modified identically, the edge indices are valid in all of them, and stay identical.
+        deleted_edges += 1;
+        for( auto& tree : mass_trees ) {
+            delete_subtree( tree, Subtree( tree.edge_at( target )));
+        }
     }
 
-    return result;
+    if( deleted_edges > 0 ) {
+        LOG_MSG2 << "Compacted mass trees from " << total_edges << " to "
+                 << mass_trees[0].edge_count() << " edges by removing mass-free subtrees.";
+    }
 }
 
-std::vector<genesis::tree::MassTree> JplaceInputOptions::mass_tree_set( bool normalize ) const
+std::vector<genesis::tree::MassTree> JplaceInputOptions::mass_tree_set( bool normalize, bool compact ) const
 {
     using namespace genesis;
     using namespace genesis::placement;
@@ -301,32 +1519,77 @@ std::vector<genesis::tree::MassTree> JplaceInputOptions::mass_tree_set( bool nor
     // Prepare storage.
     auto const set_size = file_count();
     auto mass_trees = std::vector<MassTree>( set_size );
-    size_t fc = 0;
 
     // TODO branch length and compatibility checks!
 
-    // Load files.
-    #pragma omp parallel for schedule(dynamic)
+    // Load files. The memory budget caps how many samples are parsed at once,
+    // see --memory-limit. The resulting mass trees are much smaller than the samples.
+    // We also accumulate the per-edge branch length sums for the averaging below
+    // already during the load, so that it overlaps with the file reading, instead of
+    // a separate pass over all trees once the parallel load has finished.
+    auto branch_length_sums = std::vector<double>();
+    auto fingerprints = std::vector<Murmur3::DigestType>( set_size );
+    auto progress = ProgressReporter( "Reading jplace files", set_size );
+    auto const max_in_flight = max_concurrent_samples();
+    #pragma omp parallel for schedule(dynamic) if( set_size > 1 ) num_threads( max_in_flight )
     for( size_t fi = 0; fi < set_size; ++fi ) {
 
-        // User output.
-        LOG_MSG2 << "Reading file " << ( ++fc ) << " of " << set_size
-                 << ": " << file_path( fi );
-
         // Read in file.
-        auto const smpl = sample( fi );
+        auto const smpl = sample_( fi, true );
 
-        // Turn it into a mass tree.
+        // Turn it into a mass tree, and fingerprint its topology for the
+        // compatibility check after the loop.
         mass_trees[fi] = convert_sample_to_mass_tree( smpl, normalize ).first;
+        fingerprints[fi] = tree_topology_fingerprint( mass_trees[fi] );
+
+        // Add its branch lengths to the sums. If the edge counts disagree, we skip here,
+        // and leave the error to the topology check after the loop.
+        auto const& tree = mass_trees[fi];
+        auto local_lengths = std::vector<double>( tree.edge_count() );
+        for( size_t ei = 0; ei < tree.edge_count(); ++ei ) {
+            local_lengths[ei] = tree.edge_at( ei ).data<MassTreeEdgeData>().branch_length;
+        }
+        #pragma omp critical(GAPPA_JPLACE_BRANCH_LENGTH_SUMS)
+        {
+            if( branch_length_sums.empty() ) {
+                branch_length_sums.resize( local_lengths.size(), 0.0 );
+            }
+            if( branch_length_sums.size() == local_lengths.size() ) {
+                for( size_t ei = 0; ei < local_lengths.size(); ++ei ) {
+                    branch_length_sums[ei] += local_lengths[ei];
+                }
+            }
+        }
+        progress.increment();
+    }
+    progress.finish();
+
+    // Check for compatibility, using the topology fingerprints computed during the load:
+    // one digest comparison per tree, instead of the pairwise traversals over all trees
+    // that identical_topology() would do here.
+    for( size_t fi = 1; fi < set_size; ++fi ) {
+        if( fingerprints[fi] != fingerprints[0] ) {
+            throw std::runtime_error( "Sample reference trees do not have identical topology." );
+        }
     }
 
-    // Check for compatibility.
-    if( ! identical_topology( mass_trees ) ) {
-        throw std::runtime_error( "Sample reference trees do not have identical topology." );
+    // Make sure all have the same branch lengths, by setting them to their average
+    // across the trees. Applying the averages rescales the mass positions on every
+    // edge, which is independent per tree, and hence done in parallel here.
+    if( set_size > 1 ) {
+        for( auto& sum : branch_length_sums ) {
+            sum /= static_cast<double>( set_size );
+        }
+        #pragma omp parallel for schedule(dynamic)
+        for( size_t fi = 0; fi < set_size; ++fi ) {
+            mass_tree_apply_average_branch_lengths_( mass_trees[fi], branch_length_sums );
+        }
     }
 
-    // Make sure all have the same branch lengths.
-    mass_trees_make_average_branch_lengths( mass_trees );
+    // If requested, remove subtrees without any mass, to speed up the distance computations.
+    if( compact ) {
+        mass_trees_compact_zero_subtrees_( mass_trees );
+    }
 
     return mass_trees;
 }
@@ -336,45 +1599,128 @@ genesis::placement::Sample JplaceInputOptions::merged_samples() const
     using namespace genesis;
     using namespace genesis::placement;
 
-    Sample result;
-    size_t fc = 0;
+    if( file_count() == 0 ) {
+        return Sample();
+    }
 
-    // Read all jplace files and accumulate their pqueries.
-    #pragma omp parallel for schedule(dynamic)
-    for( size_t fi = 0; fi < file_count(); ++fi ) {
+    // Each thread accumulates its share of the files into its own partial sample,
+    // so that the merging itself runs in parallel as well, instead of funneling
+    // every file through one critical section. The reading loop below runs with a
+    // team of max_in_flight threads (see --memory-limit), and dynamic scheduling can
+    // hand an iteration to any thread of the team, so we need one partial per
+    // possible thread id, regardless of the number of files.
+    auto const max_in_flight = max_concurrent_samples();
+    #if defined( GENESIS_OPENMP )
+        auto const num_partials = max_in_flight;
+    #else
+        auto const num_partials = static_cast<size_t>( 1 );
+    #endif
+    auto partials = std::vector<Sample>( num_partials );
+
+    // Helper to merge one sample into a partial result. The first sample of a partial
+    // is simply moved in; all following ones have their pqueries copied over, which also
+    // re-links their placements to the edges of the partial's tree.
+    auto merge_into = [&]( Sample& partial, Sample&& smpl ){
+        if( partial.empty() ) {
+            partial = std::move( smpl );
+        } else {
+            try{
+                // The function only throws if something is wrong with the trees.
+                copy_pqueries( smpl, partial );
+            } catch( ... ) {
+                throw std::runtime_error( "Input jplace files have differing reference trees." );
+            }
+        }
+    };
 
-        // User output.
-        LOG_MSG2 << "Reading file " << ( ++fc ) << " of " << file_count()
-                 << ": " << file_path( fi );
+    // Read all jplace files and accumulate their pqueries into the per-thread partials.
+    // The memory budget caps how many samples are parsed at once, see --memory-limit;
+    // the accumulated partials themselves grow with the data and are not bounded by it.
+    auto progress = ProgressReporter( "Reading jplace files", file_count() );
+    #pragma omp parallel for schedule(dynamic) if( file_count() > 1 ) num_threads( max_in_flight )
+    for( size_t fi = 0; fi < file_count(); ++fi ) {
 
         // Read in file. This is the part that can trivially be done in parallel.
         auto smpl = sample( fi );
 
-        // The main merging is single threaded.
-        #pragma omp critical(GAPPA_JPLACE_INPUT_ACCUMULATE)
-        {
-            // Merge
-            if( result.empty() ) {
-                result = std::move( smpl );
-            } else {
-                try{
-                    // The function only throws if something is wrong with the trees.
-                    copy_pqueries( smpl, result );
-                } catch( ... ) {
-                    throw std::runtime_error( "Input jplace files have differing reference trees." );
-                }
+        // Merge into the partial of this thread, which no other thread touches.
+        #if defined( GENESIS_OPENMP )
+            auto& partial = partials[ omp_get_thread_num() ];
+        #else
+            auto& partial = partials[ 0 ];
+        #endif
+        merge_into( partial, std::move( smpl ));
+        progress.increment();
+    }
+    progress.finish();
+
+    // Pairwise tree reduction of the partials: in each round, merge pairs of partials
+    // that are `step` apart, in parallel, until everything ends up in the first one.
+    for( size_t step = 1; step < num_partials; step *= 2 ) {
+        #pragma omp parallel for schedule(dynamic)
+        for( size_t pi = 0; pi < num_partials; pi += 2 * step ) {
+            if( pi + step < num_partials && ! partials[ pi + step ].empty() ) {
+                merge_into( partials[ pi ], std::move( partials[ pi + step ] ));
             }
-
         }
     }
 
-    return result;
+    return std::move( partials[0] );
 }
 
 // =================================================================================================
 //      Helper Functions
 // =================================================================================================
 
+size_t JplaceInputOptions::max_concurrent_samples() const
+{
+    auto const threads = std::max<size_t>( 1, utils::Options::get().number_of_threads() );
+    auto const budget = global_options.memory_limit();
+    if( budget == 0 || file_count() == 0 ) {
+        return threads;
+    }
+    if( max_concurrent_samples_ > 0 ) {
+        return max_concurrent_samples_;
+    }
+
+    // Rough estimate of the memory needed per parsed sample, derived from the largest
+    // input file: the parsed placement data with its per-pquery allocations takes around
+    // five times the size of the jplace text, and gzip compresses the text by another
+    // factor of five. The estimate errs on the large side on purpose, as the point of
+    // the budget is to stay clear of the OOM killer; at worst, it costs some parallelism
+    // of the input reading.
+    size_t max_file_bytes = 0;
+    #pragma omp parallel for schedule(dynamic) reduction(max:max_file_bytes)
+    for( size_t fi = 0; fi < file_count(); ++fi ) {
+        // Use the resolved path, not file_path(): remote input files have no local size
+        // before they are downloaded, and the estimate must not trigger the downloads.
+        auto const& path = file_paths()[ fi ];
+        if( is_remote_path( path )) {
+            continue;
+        }
+        auto bytes = genesis::utils::file_size( path );
+        if( genesis::utils::ends_with( path, ".gz" )) {
+            bytes *= 5;
+        }
+        max_file_bytes = std::max( max_file_bytes, bytes );
+    }
+    auto const bytes_per_sample = std::max<size_t>( 1, max_file_bytes * 5 );
+
+    auto limit = budget / bytes_per_sample;
+    if( limit < 1 ) {
+        LOG_WARN << "The --memory-limit budget is smaller than the estimated memory need "
+                 << "of a single sample. Processing one sample at a time, "
+                 << "but the limit may still be exceeded.";
+        limit = 1;
+    }
+    max_concurrent_samples_ = std::min( limit, threads );
+    if( max_concurrent_samples_ < threads ) {
+        LOG_MSG2 << "Memory limit: processing at most " << max_concurrent_samples_
+                 << " samples concurrently.";
+    }
+    return max_concurrent_samples_;
+}
+
 bool JplaceInputOptions::mass_norm_absolute() const
 {
     if( mass_norm_ != "absolute" && mass_norm_ != "relative" ) {
@@ -34,7 +34,13 @@
 #include "genesis/tree/mass_tree/tree.hpp"
 #include "genesis/utils/math/matrix.hpp"
 
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 // =================================================================================================
@@ -68,9 +74,12 @@ public:
 
     CLI::Option* add_jplace_input_opt_to_app( CLI::App* sub, bool required = true );
 
+    CLI::Option* add_jplace_cache_opt_to_app( CLI::App* sub );
+    CLI::Option* add_profile_cache_opt_to_app( CLI::App* sub );
     CLI::Option* add_point_mass_opt_to_app( CLI::App* sub );
     CLI::Option* add_ignore_multiplicities_opt_to_app( CLI::App* sub );
     CLI::Option* add_mass_norm_opt_to_app( CLI::App* sub, bool required );
+    CLI::Option* add_subsample_opt_to_app( CLI::App* sub );
 
     // -------------------------------------------------------------------------
     //     Run Functions
@@ -84,11 +93,45 @@ public:
      */
     genesis::placement::Sample sample( size_t index ) const;
 
+    /**
+     * @brief Same as sample(), but additionally start reading and parsing the next file
+     * in the list on a background thread.
+     *
+     * For commands that process files strictly sequentially, this hides the read latency
+     * and parsing time of each file behind the processing of the previous one.
+     * Commands that read files in a parallel loop should keep using sample() instead.
+     */
+    genesis::placement::Sample sample_prefetch( size_t index ) const;
+
     /**
      * @brief Read in all jplace files given by the user and return them as a SampleSet.
+     *
+     * Note on memory: every Sample in the set owns a full copy of the reference tree,
+     * as the tree is a by-value member of the genesis Sample class. For large trees and
+     * many samples, this duplication dominates memory use, but cannot be avoided here
+     * without changing the genesis data model to share one immutable tree instance.
+     * Commands that do not need the full placement data should hence prefer
+     * placement_profile(), mass_tree_set(), or for_each_pquery(), which avoid keeping
+     * all samples (and thus all tree copies) in memory at once.
      */
     genesis::placement::SampleSet sample_set() const;
 
+    /**
+     * @brief Iterate the pqueries of all input files, one file at a time.
+     *
+     * The callback is called for each pquery, with the sample that it belongs to as context
+     * (for example, to access the reference tree). Only one sample is kept in memory at a time,
+     * so that commands which process pqueries independently of each other (such as the edit
+     * commands) do not need to hold all input files in memory at once.
+     * This expects that all files use the same reference tree. Otherwise, the function throws.
+     */
+    void for_each_pquery(
+        std::function<void(
+            genesis::placement::Pquery&,
+            genesis::placement::Sample const&
+        )> const& callback
+    ) const;
+
     // -------------------------------------------------------------------------
     //     Covenience Functions
     // -------------------------------------------------------------------------
@@ -113,10 +156,13 @@ public:
      * Can choose whether also do compute imbalances.
      * If the additional second parameter is set to true, the imbalances are normalzied independently
      * from the norm setting in this class.
+     * If the third parameter is set to false, the edge masses matrix is not computed and left
+     * empty, which halves the memory for commands that only need the imbalances, such as edgepca.
      */
     PlacementProfile placement_profile(
         bool with_imbalances = true,
-        bool force_imbal_norm = false
+        bool force_imbal_norm = false,
+        bool with_masses = true
     ) const;
 
     /**
@@ -124,8 +170,18 @@ public:
      *
      * This is useful for commands that do not work on Samples directly, but only need their
      * mass tree representation.
+     *
+     * If @p compact is set, subtrees of the reference tree that carry no mass in any of the
+     * samples are removed from all trees alike. This does not change any of the pairwise
+     * earth movers distances, but makes their cost scale with the occupied part of the tree,
+     * which for sparse samples on large reference trees is a substantial speedup.
+     * Commands that need the resulting trees to match the full reference tree
+     * (for example, to write per-edge results) must not use this.
      */
-    std::vector<genesis::tree::MassTree> mass_tree_set( bool normalize = true ) const;
+    std::vector<genesis::tree::MassTree> mass_tree_set(
+        bool normalize = true,
+        bool compact = false
+    ) const;
 
     /**
      * @brief Read in all jplace files given by the user and merge all their pqueries them into a sample.
@@ -134,6 +190,39 @@ public:
      */
     genesis::placement::Sample merged_samples() const;
 
+    /**
+     * @brief Number of samples that may be held in memory at the same time,
+     * according to the --memory-limit option.
+     *
+     * Without a memory limit, this is simply the number of threads, as the per-file loops
+     * keep at most one sample in flight per thread. With a limit, the per-sample memory is
+     * estimated from the input file sizes, and the count is reduced so that the concurrently
+     * held samples fit into the budget. Commands with parallel per-file loops should use
+     * this as the `num_threads` of those loops.
+     */
+    size_t max_concurrent_samples() const;
+
+    // -------------------------------------------------------------------------
+    //     Preloaded Samples
+    // -------------------------------------------------------------------------
+
+    /**
+     * @brief Install a parsed sample in the process-wide preloaded sample store,
+     * keyed by its input file path.
+     *
+     * Used by `gappa tools server`: commands that run in the same process afterwards
+     * and list the file as input get a copy of the preloaded sample from sample(),
+     * instead of reading and parsing the file again. The store keeps the samples as
+     * they appear in the files; the per-command transformations (point mass, name
+     * discarding, multiplicities, mass normalization) are applied to the copy, so
+     * that the store is valid independently of the option flags of each invocation.
+     */
+    static void preload_sample( std::string const& path, genesis::placement::Sample&& sample );
+
+    static size_t preloaded_sample_count();
+
+    static void clear_preloaded_samples();
+
     // -------------------------------------------------------------------------
     //     Helper Functions
     // -------------------------------------------------------------------------
@@ -154,6 +243,34 @@ public:
         return reader_;
     }
 
+    bool jplace_cache() const
+    {
+        return jplace_cache_;
+    }
+
+    /**
+     * @brief Declare that the command does not need pquery names.
+     *
+     * If set, the names of each pquery are discarded right after reading, and folded into
+     * a single anonymous name that carries their total multiplicity, so that all mass and
+     * imbalance computations stay unchanged. For name-heavy datasets, this cuts a large
+     * share of the per-sample memory. The scalar placement fields (likelihood, lengths)
+     * are plain members of the genesis placement struct and do not allocate, so there is
+     * nothing to be saved by masking them.
+     *
+     * The convenience functions placement_profile() and mass_tree_set() use this
+     * automatically, as their results do not contain names.
+     */
+    void discard_names( bool value )
+    {
+        discard_names_ = value;
+    }
+
+    bool discard_names() const
+    {
+        return discard_names_;
+    }
+
     bool point_mass() const
     {
         return point_mass_;
@@ -172,24 +289,91 @@ public:
     bool mass_norm_absolute() const;
     bool mass_norm_relative() const;
 
+    size_t subsample() const
+    {
+        return subsample_;
+    }
+
+    std::string const& profile_cache() const
+    {
+        return profile_cache_;
+    }
+
     // -------------------------------------------------------------------------
     //     Option Members
     // -------------------------------------------------------------------------
 
 private:
 
+    /**
+     * @brief Implementation of sample(), with explicit control over name discarding,
+     * for the convenience functions whose results do not contain names.
+     */
+    genesis::placement::Sample sample_( size_t index, bool discard_names ) const;
+
+    /**
+     * @brief Load a placement profile from the profile cache file, see placement_profile().
+     *
+     * Throws if the cache was written for a different set of input files,
+     * or does not contain the matrices requested by the given flags.
+     */
+    PlacementProfile load_profile_cache_(
+        bool with_imbalances, bool force_imbal_norm, bool with_masses
+    ) const;
+
+    /**
+     * @brief Write a computed placement profile to the profile cache file.
+     */
+    void write_profile_cache_(
+        PlacementProfile const& profile,
+        bool with_imbalances, bool force_imbal_norm, bool with_masses
+    ) const;
+
+    /**
+     * @brief State of the background parses of upcoming files, see sample_prefetch().
+     *
+     * The map holds the pending parses, keyed by file index. Its size is bounded by the
+     * read-ahead window of sample_prefetch(), so that memory usage stays at a fixed number
+     * of samples, no matter how many input files there are.
+     *
+     * Held via a shared pointer, as mutexes and futures are not copyable,
+     * but options classes need to be.
+     */
+    struct SamplePrefetch
+    {
+        std::mutex mutex;
+        std::map<size_t, std::future<genesis::placement::Sample>> futures;
+    };
+
+    /**
+     * @brief Process-wide store of preloaded samples, see preload_sample().
+     */
+    static std::unordered_map<std::string, genesis::placement::Sample> preloaded_samples_;
+
     genesis::placement::JplaceReader reader_;
 
+    mutable std::shared_ptr<SamplePrefetch> prefetch_ = std::make_shared<SamplePrefetch>();
+
+    // Cached result of max_concurrent_samples(), as the estimate stats all input files.
+    mutable size_t max_concurrent_samples_ = 0;
+
+    bool jplace_cache_          = false;
+    bool discard_names_         = false;
     bool point_mass_            = false;
     bool ignore_multiplicities_ = false;
     std::string mass_norm_      = "absolute";
+    size_t subsample_           = 0;
+    std::string profile_cache_;
 
 public:
 
     CLI::Option* jplace_input_option          = nullptr;
+    CLI::Option* jplace_cache_option          = nullptr;
+    CLI::Option* profile_cache_option         = nullptr;
     CLI::Option* point_mass_option            = nullptr;
     CLI::Option* ignore_multiplicities_option = nullptr;
     CLI::Option* mass_norm_option             = nullptr;
+    CLI::Option* subsample_option             = nullptr;
 
 };
 
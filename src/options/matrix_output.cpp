@@ -28,6 +28,9 @@
 #include "genesis/utils/io/output_target.hpp"
 #include "genesis/utils/text/string.hpp"
 
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
 #include <iostream>
 #include <stdexcept>
 
@@ -45,14 +48,17 @@ void MatrixOutputOptions::add_matrix_output_opts_to_app(
     std::string const group = "Matrix Output";
 
     // Add output format.
-    auto formats = std::set<std::string>{ "matrix", "list" };
+    auto formats = std::set<std::string>{ "matrix", "list", "binary" };
     if( offer_triangular_mode ) {
         formats.insert( "triangular" );
     }
     sub->add_option(
         "--" + name + ( name.empty() ? "" : "-" ) + "matrix-format",
         format_,
-        "Format of the output matrix file.",
+        "Format of the output matrix file. The text formats (`matrix`, `list`, `triangular`) "
+        "write comma separated values; `binary` writes raw little-endian values with a small "
+        "header carrying the dimensions and row names, which is much faster to write and to "
+        "parse downstream for large matrices.",
         true
     )->group( group )
     ->transform(
@@ -73,13 +79,186 @@ void MatrixOutputOptions::add_matrix_output_opts_to_app(
 //      Run Functions
 // =================================================================================================
 
-void MatrixOutputOptions::write_matrix(
+/**
+ * @brief Minimal row-major view on a raw value buffer.
+ *
+ * This offers the small part of the Matrix interface that our writers use, so that they
+ * can also work on matrices that are not stored in a genesis Matrix, see the raw data
+ * overloads of write_matrix().
+ */
+template<typename T>
+struct MatrixDataView
+{
+    using value_type = T;
+
+    T const* data;
+    size_t num_rows;
+    size_t num_cols;
+
+    size_t rows() const
+    {
+        return num_rows;
+    }
+
+    size_t cols() const
+    {
+        return num_cols;
+    }
+
+    T const& operator()( size_t r, size_t c ) const
+    {
+        return data[ r * num_cols + c ];
+    }
+};
+
+/**
+ * @brief Write a matrix in the binary format: a magic string, the value size, the dimensions,
+ * the row names, and then the raw values in row-major order.
+ *
+ * The values are written in the native byte order, which is little-endian on all platforms
+ * that we support, and matches what downstream tooling (such as numpy.fromfile) expects.
+ */
+template<typename M>
+static void write_matrix_binary_(
     std::shared_ptr<genesis::utils::BaseOutputTarget> target,
-    genesis::utils::Matrix<double> const& mat,
+    M const& mat,
+    std::vector<std::string> const& row_names,
+    bool omit_labels
+) {
+    using T = typename M::value_type;
+    auto& os = target->ostream();
+    auto write_uint64 = [&]( uint64_t value ){
+        os.write( reinterpret_cast<char const*>( &value ), sizeof( value ));
+    };
+
+    // Header: magic and version, value size in bytes, dimensions.
+    char const magic[9] = "GAPPAMX1";
+    os.write( magic, 8 );
+    uint8_t const value_size = sizeof( T );
+    os.write( reinterpret_cast<char const*>( &value_size ), sizeof( value_size ));
+    write_uint64( mat.rows() );
+    write_uint64( mat.cols() );
+
+    // Row names: count, then each as length plus characters.
+    if( omit_labels || row_names.empty() ) {
+        write_uint64( 0 );
+    } else {
+        if( row_names.size() != mat.rows() ) {
+            throw std::runtime_error(
+                "Internal Error: Matrix row names do not match the number of rows."
+            );
+        }
+        write_uint64( row_names.size() );
+        for( auto const& name : row_names ) {
+            write_uint64( name.size() );
+            os.write( name.data(), name.size() );
+        }
+    }
+
+    // The values, row-major. The matrix stores its elements contiguously,
+    // so we can write them row by row without any per-value formatting.
+    for( size_t r = 0; r < mat.rows(); ++r ) {
+        os.write(
+            reinterpret_cast<char const*>( &mat( r, 0 )),
+            mat.cols() * sizeof( T )
+        );
+    }
+}
+
+/**
+ * @brief Write a matrix in the text `matrix` format, with the rows formatted in parallel.
+ *
+ * The double-to-string conversion dominates the output time for large matrices when done
+ * sequentially inside the genesis MatrixWriter. Here, worker threads format blocks of rows
+ * into strings (using the same `%g` representation that stream output produces), which are
+ * then written to the target in order, so that the writing saturates the disk instead of
+ * a single formatting core. The blocks bound the memory use to a few hundred text rows.
+ */
+template<typename M>
+static void write_matrix_text_parallel_(
+    std::shared_ptr<genesis::utils::BaseOutputTarget> target,
+    M const& mat,
+    std::vector<std::string> const& row_names,
+    std::vector<std::string> const& col_names,
+    std::string const& corner,
+    bool omit_labels
+) {
+    auto& os = target->ostream();
+    std::string const sep = "\t";
+
+    bool const with_row_names = ! omit_labels && ! row_names.empty();
+    bool const with_col_names = ! omit_labels && ! col_names.empty();
+    if( with_row_names && row_names.size() != mat.rows() ) {
+        throw std::runtime_error(
+            "Internal Error: Matrix row names do not match the number of rows."
+        );
+    }
+    if( with_col_names && col_names.size() != mat.cols() ) {
+        throw std::runtime_error(
+            "Internal Error: Matrix column names do not match the number of columns."
+        );
+    }
+
+    // Header line.
+    if( with_col_names ) {
+        if( with_row_names ) {
+            os << corner;
+        }
+        for( size_t c = 0; c < col_names.size(); ++c ) {
+            if( c > 0 || with_row_names ) {
+                os << sep;
+            }
+            os << col_names[c];
+        }
+        os << "\n";
+    }
+
+    // Format blocks of rows in parallel, and write each block in order.
+    size_t const block_size = 256;
+    auto lines = std::vector<std::string>( std::min( block_size, mat.rows() ));
+    for( size_t begin = 0; begin < mat.rows(); begin += block_size ) {
+        auto const end = std::min( begin + block_size, mat.rows() );
+
+        #pragma omp parallel for schedule(static)
+        for( size_t r = begin; r < end; ++r ) {
+            auto& line = lines[ r - begin ];
+            line.clear();
+            if( with_row_names ) {
+                line += row_names[r];
+            }
+            char buffer[32];
+            for( size_t c = 0; c < mat.cols(); ++c ) {
+                if( c > 0 || with_row_names ) {
+                    line += sep;
+                }
+                auto const len = std::snprintf(
+                    buffer, sizeof( buffer ), "%g", static_cast<double>( mat( r, c ))
+                );
+                line.append( buffer, len );
+            }
+            line += "\n";
+        }
+
+        for( size_t r = begin; r < end; ++r ) {
+            os << lines[ r - begin ];
+        }
+    }
+}
+
+/**
+ * @brief Shared implementation of the write_matrix() overloads, over the matrix value type.
+ */
+template<typename T>
+static void write_matrix_(
+    std::string const& name,
+    std::string const& format,
+    bool omit_labels,
+    std::shared_ptr<genesis::utils::BaseOutputTarget> target,
+    genesis::utils::Matrix<T> const& mat,
     std::vector<std::string> const& row_names,
     std::vector<std::string> const& col_names,
     std::string const& corner
-) const {
+) {
     using namespace genesis;
     using namespace genesis::utils;
 
@@ -87,25 +266,115 @@ void MatrixOutputOptions::write_matrix(
     // TODO add double presicison
     // TODO add separator char
 
-    auto writer = MatrixWriter<double>();
+    // The binary format bypasses the genesis text writer.
+    if( format == "binary" ) {
+        write_matrix_binary_( target, mat, row_names, omit_labels );
+        return;
+    }
+
+    // The standard matrix format uses our parallel row formatting, as the value-to-text
+    // conversion otherwise dominates the output time for large matrices.
+    if( format == "matrix" ) {
+        write_matrix_text_parallel_( target, mat, row_names, col_names, corner, omit_labels );
+        return;
+    }
+
+    auto writer = MatrixWriter<T>();
 
     // Set output format.
-    if( format_ == "matrix" ) {
-        writer.format( MatrixWriter<double>::Format::kMatrix );
-    } else if( format_ == "list" ) {
-        writer.format( MatrixWriter<double>::Format::kList );
-    } else if( format_ == "triangular" ) {
-        writer.format( MatrixWriter<double>::Format::kTriangular );
+    if( format == "list" ) {
+        writer.format( MatrixWriter<T>::Format::kList );
+    } else if( format == "triangular" ) {
+        writer.format( MatrixWriter<T>::Format::kTriangular );
     } else {
         throw CLI::ValidationError(
-            "--" + name_ + ( name_.empty() ? "" : "-" ) + "matrix-format", "Invalid format '" + format_ + "'."
+            "--" + name + ( name.empty() ? "" : "-" ) + "matrix-format", "Invalid format '" + format + "'."
         );
     }
 
     // Do the writing
-    if( omit_labels_ ) {
+    if( omit_labels ) {
         writer.write( mat, target);
     } else {
         writer.write( mat, target, row_names, col_names, corner );
     }
 }
+
+void MatrixOutputOptions::write_matrix(
+    std::shared_ptr<genesis::utils::BaseOutputTarget> target,
+    genesis::utils::Matrix<double> const& mat,
+    std::vector<std::string> const& row_names,
+    std::vector<std::string> const& col_names,
+    std::string const& corner
+) const {
+    write_matrix_( name_, format_, omit_labels_, target, mat, row_names, col_names, corner );
+}
+
+void MatrixOutputOptions::write_matrix(
+    std::shared_ptr<genesis::utils::BaseOutputTarget> target,
+    genesis::utils::Matrix<float> const& mat,
+    std::vector<std::string> const& row_names,
+    std::vector<std::string> const& col_names,
+    std::string const& corner
+) const {
+    write_matrix_( name_, format_, omit_labels_, target, mat, row_names, col_names, corner );
+}
+
+/**
+ * @brief Shared implementation of the raw data write_matrix() overloads.
+ *
+ * The large-matrix formats (`matrix`, `binary`) write directly from the buffer; the genesis
+ * writer used for the `list` and `triangular` formats needs a Matrix, so there the data is
+ * copied over once. Those formats are meant for small matrices anyway.
+ */
+template<typename T>
+static void write_matrix_data_(
+    std::string const& name,
+    std::string const& format,
+    bool omit_labels,
+    std::shared_ptr<genesis::utils::BaseOutputTarget> target,
+    T const* data,
+    size_t rows,
+    size_t cols,
+    std::vector<std::string> const& row_names,
+    std::vector<std::string> const& col_names,
+    std::string const& corner
+) {
+    if( format == "binary" ) {
+        write_matrix_binary_( target, MatrixDataView<T>{ data, rows, cols }, row_names, omit_labels );
+    } else if( format == "matrix" ) {
+        write_matrix_text_parallel_(
+            target, MatrixDataView<T>{ data, rows, cols },
+            row_names, col_names, corner, omit_labels
+        );
+    } else {
+        auto const mat = genesis::utils::Matrix<T>(
+            rows, cols, std::vector<T>( data, data + rows * cols )
+        );
+        write_matrix_( name, format, omit_labels, target, mat, row_names, col_names, corner );
+    }
+}
+
+void MatrixOutputOptions::write_matrix(
+    std::shared_ptr<genesis::utils::BaseOutputTarget> target,
+    double const* data,
+    size_t rows,
+    size_t cols,
+    std::vector<std::string> const& row_names,
+    std::vector<std::string> const& col_names,
+    std::string const& corner
+) const {
+    write_matrix_data_( name_, format_, omit_labels_, target, data, rows, cols, row_names, col_names, corner );
+}
+
+void MatrixOutputOptions::write_matrix(
+    std::shared_ptr<genesis::utils::BaseOutputTarget> target,
+    float const* data,
+    size_t rows,
+    size_t cols,
+    std::vector<std::string> const& row_names,
+    std::vector<std::string> const& col_names,
+    std::string const& corner
+) const {
+    write_matrix_data_( name_, format_, omit_labels_, target, data, rows, cols, row_names, col_names, corner );
+}
@@ -81,8 +81,56 @@ public:
         std::string const& corner = ""
     ) const;
 
+    /**
+     * @brief Overload for single precision matrices, see the `--precision` option of
+     * the commands that store their result matrix in `float` to save memory.
+     */
+    void write_matrix(
+        std::shared_ptr<genesis::utils::BaseOutputTarget> target,
+        genesis::utils::Matrix<float> const& mat,
+        std::vector<std::string> const& row_names = {},
+        std::vector<std::string> const& col_names = {},
+        std::string const& corner = ""
+    ) const;
+
+    /**
+     * @brief Overloads that write a matrix given as a raw row-major value buffer.
+     *
+     * Commands that manage their matrix memory themselves, for NUMA-aware first-touch
+     * allocation, use these to write their result without copying it into a Matrix first.
+     * Only the `list` and `triangular` text formats still need such a copy internally.
+     */
+    void write_matrix(
+        std::shared_ptr<genesis::utils::BaseOutputTarget> target,
+        double const* data,
+        size_t rows,
+        size_t cols,
+        std::vector<std::string> const& row_names = {},
+        std::vector<std::string> const& col_names = {},
+        std::string const& corner = ""
+    ) const;
+
+    void write_matrix(
+        std::shared_ptr<genesis::utils::BaseOutputTarget> target,
+        float const* data,
+        size_t rows,
+        size_t cols,
+        std::vector<std::string> const& row_names = {},
+        std::vector<std::string> const& col_names = {},
+        std::string const& corner = ""
+    ) const;
+
     // void write_matrix( genesis::utils::Matrix<std::string> const& mat ) const;
 
+    /**
+     * @brief File extension fitting the selected format: `bin` for the binary format,
+     * `csv` for the text formats. Commands use this when creating the output target.
+     */
+    std::string file_extension() const
+    {
+        return format_ == "binary" ? "bin" : "csv";
+    }
+
     // -------------------------------------------------------------------------
     //     Option Members
     // -------------------------------------------------------------------------
@@ -33,9 +33,14 @@
 
 #include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <limits>
 #include <stdexcept>
 #include <unordered_set>
+#include <vector>
 
 // =================================================================================================
 //      Setup Functions
@@ -103,6 +108,184 @@ void TableInputOptions::add_column_selection_opts_to_app(
     ignore_columns_opt.option()->excludes( select_columns_opt.option() );
 }
 
+// =================================================================================================
+//      Fast Table Parsing
+// =================================================================================================
+
+/**
+ * @brief Read the whole input file (potentially compressed) into a string at once.
+ */
+static std::string read_table_file_content_( std::string const& file_name )
+{
+    auto source = genesis::utils::from_file( file_name );
+    std::string content;
+    auto buffer = std::vector<char>( 1024 * 1024 );
+    while( true ) {
+        auto const got = source->read( buffer.data(), buffer.size() );
+        if( got == 0 ) {
+            break;
+        }
+        content.append( buffer.data(), got );
+    }
+    return content;
+}
+
+/**
+ * @brief Split one line of the table into cells, without any quoting or escaping.
+ */
+static std::vector<std::string> split_table_line_(
+    std::string const& content, size_t begin, size_t end, char separator
+) {
+    std::vector<std::string> result;
+    size_t pos = begin;
+    while( true ) {
+        auto const* found = static_cast<char const*>(
+            std::memchr( content.data() + pos, separator, end - pos )
+        );
+        auto const cell_end = found
+            ? static_cast<size_t>( found - content.data() )
+            : end
+        ;
+        result.push_back( content.substr( pos, cell_end - pos ));
+        if( ! found ) {
+            break;
+        }
+        pos = cell_end + 1;
+    }
+    return result;
+}
+
+/**
+ * @brief Parse a numerical table with row and column names directly into a Dataframe.
+ *
+ * This is the fast path for large OTU and metadata tables: the whole file content is scanned
+ * for row boundaries once, and the rows are then parsed in parallel with strtod() directly on
+ * the content buffer, writing straight into the Dataframe columns, without the per-cell string
+ * allocations of the generic csv machinery. The caller needs to ensure that the content does
+ * not use quoting, as this simple scanning does not support it.
+ */
+static genesis::utils::Dataframe parse_double_dataframe_fast_(
+    std::string const& content, char separator
+) {
+    using namespace genesis::utils;
+    Dataframe df;
+    if( content.empty() ) {
+        return df;
+    }
+
+    // Find the line starts. The first line is the header.
+    std::vector<size_t> line_starts;
+    size_t pos = 0;
+    while( pos < content.size() ) {
+        line_starts.push_back( pos );
+        auto const* found = static_cast<char const*>(
+            std::memchr( content.data() + pos, '\n', content.size() - pos )
+        );
+        pos = found
+            ? static_cast<size_t>( found - content.data() ) + 1
+            : content.size()
+        ;
+    }
+    auto const line_end = [&]( size_t line_index )
+    {
+        auto end = ( line_index + 1 < line_starts.size() )
+            ? line_starts[ line_index + 1 ] - 1
+            : content.size()
+        ;
+        if( end > line_starts[ line_index ] && content[ end - 1 ] == '\r' ) {
+            --end;
+        }
+        return end;
+    };
+
+    // Parse the header. Its first cell belongs to the row names column, and is ignored,
+    // same as in the generic dataframe reader.
+    auto const header = split_table_line_( content, line_starts[0], line_end(0), separator );
+    assert( ! header.empty() );
+    auto const num_cols = header.size() - 1;
+    for( size_t c = 0; c < num_cols; ++c ) {
+        df.add_col<double>( header[ c + 1 ] );
+    }
+
+    // Collect the data rows, skipping trailing empty lines, and add them to the dataframe.
+    // The row name is everything up to the first separator of each line.
+    std::vector<size_t> row_lines;
+    for( size_t l = 1; l < line_starts.size(); ++l ) {
+        if( line_end(l) > line_starts[l] ) {
+            row_lines.push_back( l );
+        }
+    }
+    for( auto const l : row_lines ) {
+        auto const* found = static_cast<char const*>(
+            std::memchr( content.data() + line_starts[l], separator, line_end(l) - line_starts[l] )
+        );
+        auto const name_end = found
+            ? static_cast<size_t>( found - content.data() )
+            : line_end(l)
+        ;
+        df.add_row( content.substr( line_starts[l], name_end - line_starts[l] ));
+    }
+
+    // Get direct access to the column storage, so that the parallel loop below can fill
+    // the cells without going through the per-cell accessors.
+    std::vector<double*> col_data( num_cols );
+    for( size_t c = 0; c < num_cols; ++c ) {
+        col_data[c] = &*df.at(c).as<double>().begin();
+    }
+
+    // Parse all rows in parallel. Cells that are not (fully) numerical become NaN,
+    // same as with the parse functor that we use in the generic reader path.
+    // Errors are recorded and reported after the loop, as we cannot throw from within.
+    size_t error_row = std::numeric_limits<size_t>::max();
+    #pragma omp parallel for schedule(static)
+    for( size_t r = 0; r < row_lines.size(); ++r ) {
+        auto const l = row_lines[r];
+        auto const end = line_end(l);
+
+        // Skip the row name cell.
+        auto cell = line_starts[l];
+        auto const* found = static_cast<char const*>(
+            std::memchr( content.data() + cell, separator, end - cell )
+        );
+        cell = found ? static_cast<size_t>( found - content.data() ) + 1 : end;
+
+        // Parse the value cells.
+        size_t c = 0;
+        while( cell <= end && found ) {
+            found = static_cast<char const*>(
+                std::memchr( content.data() + cell, separator, end - cell )
+            );
+            auto const cell_end = found
+                ? static_cast<size_t>( found - content.data() )
+                : end
+            ;
+            if( c < num_cols ) {
+                char* parse_end = nullptr;
+                auto const value = std::strtod( content.data() + cell, &parse_end );
+                auto const parsed = static_cast<size_t>( parse_end - content.data() );
+                col_data[c][r] = ( parse_end > content.data() + cell && parsed <= cell_end )
+                    ? value
+                    : std::numeric_limits<double>::quiet_NaN()
+                ;
+            }
+            ++c;
+            cell = cell_end + 1;
+        }
+        if( c != num_cols ) {
+            #pragma omp critical(GAPPA_TABLE_INPUT_ERROR)
+            error_row = std::min( error_row, r );
+        }
+    }
+    if( error_row != std::numeric_limits<size_t>::max() ) {
+        throw std::runtime_error(
+            "Input table has lines with differing number of columns, "
+            "first at data row " + std::to_string( error_row + 1 ) + "."
+        );
+    }
+
+    return df;
+}
+
 // =================================================================================================
 //      Run Functions
 // =================================================================================================
@@ -164,21 +347,31 @@ genesis::utils::Dataframe TableInputOptions::read_double_dataframe(
 ) const {
     using namespace genesis::utils;
 
-    // Prepare a reader that can convert anything to double.
-    // We filter out later.
-    auto reader = DataframeReader<double>( csv_reader() );
-    reader.parse_value_functor( []( std::string const& cell ){
-        double v;
-        try{
-            v = std::stod( cell );
-        } catch( ... ) {
-            v = std::numeric_limits<double>::quiet_NaN();
-        }
-        return v;
-    });
+    // Read the whole file at once, and use the fast parsing path if possible, that is,
+    // if the table does not use quoting. Large numerical tables (such as OTU tables) never do,
+    // and the parallel direct parsing is an order of magnitude faster than the generic reader.
+    Dataframe df;
+    auto const content = read_table_file_content_( table_input_opt.value() );
+    if( content.find( '"' ) == std::string::npos ) {
+        df = parse_double_dataframe_fast_( content, separator_char()[0] );
+    } else {
 
-    // Do the reading.
-    auto df = reader.read( from_file( table_input_opt.value() ));
+        // Otherwise, prepare a generic reader that can convert anything to double.
+        // We filter out later.
+        auto reader = DataframeReader<double>( csv_reader() );
+        reader.parse_value_functor( []( std::string const& cell ){
+            double v;
+            try{
+                v = std::stod( cell );
+            } catch( ... ) {
+                v = std::numeric_limits<double>::quiet_NaN();
+            }
+            return v;
+        });
+
+        // Do the reading.
+        df = reader.read( from_string( content ));
+    }
 
     // Filter columns.
     if( filter_by_header_line ) {
@@ -23,16 +23,24 @@
 
 #include "options/tree_output.hpp"
 #include "options/global.hpp"
+#include "tools/png_writer.hpp"
 
+#include "genesis/tree/common_tree/distances.hpp"
 #include "genesis/tree/drawing/functions.hpp"
+#include "genesis/tree/function/functions.hpp"
+#include "genesis/tree/iterator/postorder.hpp"
+#include "genesis/tree/iterator/preorder.hpp"
 #include "genesis/utils/text/string.hpp"
 #include "genesis/utils/color/functions.hpp"
 #include "genesis/utils/color/helpers.hpp"
 #include "genesis/utils/tools/tickmarks.hpp"
 
+#include <algorithm>
 #include <cassert>
+#include <cmath>
 #include <iostream>
 #include <stdexcept>
+#include <vector>
 
 // =================================================================================================
 //      Setup Functions
@@ -60,18 +68,150 @@ void TreeOutputOptions::add_tree_output_opts_to_app( CLI::App* sub )
         write_svg_tree_,
         "If set, the tree is written to a SVG file. This gives a file for vector graphics editors."
     )->group( "Tree Output" );
+    auto png_tree_opt = sub->add_flag(
+        "--write-png-tree",
+        write_png_tree_,
+        "If set, the tree is written to a PNG raster image, using a rectangular phylogram "
+        "layout. For dense trees with many taxa, this is much faster to produce than the "
+        "SVG output, and yields files that image viewers can actually open."
+    )->group( "Tree Output" );
+    sub->add_option(
+        "--png-tree-size",
+        png_tree_size_,
+        "Width and height (in pixels) of the PNG tree image.",
+        true
+    )->group( "Tree Output" )->needs( png_tree_opt );
 
     newick_tree_output.add_newick_tree_output_opts_to_app( sub, newick_tree_opt );
     svg_tree_output.add_svg_tree_output_opts_to_app( sub, svg_tree_opt );
 }
 
+// =================================================================================================
+//      Png Rendering
+// =================================================================================================
+
+/**
+ * @brief Render the tree into a square RGB pixel buffer using a rectangular phylogram
+ * layout, with one color per edge, and write it as a png file.
+ *
+ * Unlike the svg output, this draws the edges directly into the pixel buffer, in parallel,
+ * without building any per-element document structure, which makes it both fast to produce
+ * and usable for trees whose svg files become too large to open.
+ */
+static void write_color_tree_to_png_file_(
+    genesis::tree::CommonTree const& tree,
+    std::vector<genesis::utils::Color> const& color_per_branch,
+    size_t image_size,
+    std::string const& filename
+) {
+    using namespace genesis::tree;
+
+    if( tree.empty() || image_size < 2 ) {
+        throw std::runtime_error( "Cannot write png tree: empty tree or image too small." );
+    }
+    if( color_per_branch.size() != tree.edge_count() ) {
+        throw std::runtime_error( "Internal Error: Branch colors do not match the tree." );
+    }
+
+    // Horizontal positions: distance from the root, using branch lengths.
+    auto node_x = node_branch_length_distance_vector( tree );
+    double max_x = 0.0;
+    for( auto& x : node_x ) {
+        if( ! std::isfinite( x ) || x < 0.0 ) {
+            x = 0.0;
+        }
+        max_x = std::max( max_x, x );
+    }
+
+    // Vertical positions: leaves evenly spaced in preorder, inner nodes centered
+    // over their children.
+    auto node_y = std::vector<double>( tree.node_count(), 0.0 );
+    size_t leaf_count = 0;
+    for( auto it : preorder( tree )) {
+        if( is_leaf( it.node() )) {
+            node_y[ it.node().index() ] = static_cast<double>( leaf_count );
+            ++leaf_count;
+        }
+    }
+    for( auto it : postorder( tree )) {
+        auto const& node = it.node();
+        if( is_leaf( node )) {
+            continue;
+        }
+        double sum = 0.0;
+        size_t cnt = 0;
+        auto const* link = &node.link().next();
+        while( link != &node.link() ) {
+            sum += node_y[ link->outer().node().index() ];
+            ++cnt;
+            link = &link->next();
+        }
+        if( is_root( node )) {
+            // For the root, the first link leads to a child as well, not to a parent.
+            sum += node_y[ node.link().outer().node().index() ];
+            ++cnt;
+        }
+        assert( cnt > 0 );
+        node_y[ node.index() ] = sum / static_cast<double>( cnt );
+    }
+
+    // Scale both axes to the image. Degenerate cases (a star tree without branch lengths,
+    // or a single leaf) simply collapse onto one row or column.
+    auto const x_scale = max_x > 0.0
+        ? static_cast<double>( image_size - 1 ) / max_x
+        : 0.0
+    ;
+    auto const y_scale = leaf_count > 1
+        ? static_cast<double>( image_size - 1 ) / static_cast<double>( leaf_count - 1 )
+        : 0.0
+    ;
+
+    // White background. Three bytes per pixel, row-major.
+    auto pixels = std::vector<unsigned char>( image_size * image_size * 3, 255 );
+    auto const set_pixel = [&]( size_t x, size_t y, genesis::utils::Color const& color ){
+        assert( x < image_size && y < image_size );
+        auto const offset = ( y * image_size + x ) * 3;
+        pixels[ offset + 0 ] = color.r_byte();
+        pixels[ offset + 1 ] = color.g_byte();
+        pixels[ offset + 2 ] = color.b_byte();
+    };
+
+    // Draw the edges in parallel, each as the horizontal line of its branch at the child,
+    // plus the vertical connector at the parent. Edges that map to the same pixels simply
+    // overwrite each other, which is fine for this kind of dense overview image.
+    #pragma omp parallel for schedule(static)
+    for( size_t ei = 0; ei < tree.edge_count(); ++ei ) {
+        auto const& edge = tree.edge_at( ei );
+        auto const& color = color_per_branch[ ei ];
+        auto const par = edge.primary_node().index();
+        auto const chd = edge.secondary_node().index();
+
+        auto const px = static_cast<size_t>( std::round( node_x[ par ] * x_scale ));
+        auto const py = static_cast<size_t>( std::round( node_y[ par ] * y_scale ));
+        auto const cx = static_cast<size_t>( std::round( node_x[ chd ] * x_scale ));
+        auto const cy = static_cast<size_t>( std::round( node_y[ chd ] * y_scale ));
+
+        for( size_t y = std::min( py, cy ); y <= std::max( py, cy ); ++y ) {
+            set_pixel( px, y, color );
+        }
+        for( size_t x = std::min( px, cx ); x <= std::max( px, cx ); ++x ) {
+            set_pixel( x, cy, color );
+        }
+    }
+
+    write_png_file( pixels, image_size, image_size, filename );
+}
+
 // =================================================================================================
 //      Run Functions
 // =================================================================================================
 
 void TreeOutputOptions::check_tree_formats() const
 {
-    if( ! write_newick_tree_ && ! write_nexus_tree_ && ! write_phyloxml_tree_ && ! write_svg_tree_ ) {
+    if(
+        ! write_newick_tree_ && ! write_nexus_tree_ && ! write_phyloxml_tree_ &&
+        ! write_svg_tree_ && ! write_png_tree_
+    ) {
         LOG_WARN << "Warning: You did not specify any tree output format. "
                  << "Thus, no tree files will be written. "
                  << "In order to specify the wanted formats, use the --write-...-tree options.";
@@ -94,6 +234,9 @@ std::vector<std::string> TreeOutputOptions::get_extensions() const
     if( write_svg_tree_ ) {
         res.push_back( "svg" );
     }
+    if( write_png_tree_ ) {
+        res.push_back( "png" );
+    }
 
     return res;
 }
@@ -137,6 +280,15 @@ void TreeOutputOptions::write_tree_to_files(
             file_output_options.get_output_filename( infix, "svg" )
         );
     }
+
+    if( write_png_tree_ ) {
+        write_color_tree_to_png_file_(
+            tree,
+            std::vector<genesis::utils::Color>( tree.edge_count(), genesis::utils::Color( 0, 0, 0 )),
+            png_tree_size_,
+            file_output_options.get_output_filename( infix, "png" )
+        );
+    }
 }
 
 void TreeOutputOptions::write_tree_to_files(
@@ -159,33 +311,63 @@ void TreeOutputOptions::write_tree_to_files(
                      << "Use another format such as nexus, phyloxml, or svg to get a colored tree!";
         }
 
-        newick_tree_output.write_tree(
-            tree, file_output_options.get_output_target( infix, "newick" )
-        );
-        // write_tree_to_newick_file(
-        //     tree, file_output_options.get_output_filename( infix, "newick" )
-        // );
     }
 
-    if( write_nexus_tree_ ) {
-        write_color_tree_to_nexus_file(
-            tree, color_per_branch, file_output_options.get_output_filename( infix, "nexus" )
-        );
-    }
+    // The formats are written to independent files, and the svg layout is by far the most
+    // expensive of them, so we write the formats in parallel, which hides the cheap ones
+    // behind the svg drawing.
+    #pragma omp parallel sections
+    {
+        #pragma omp section
+        {
+            if( write_newick_tree_ ) {
+                newick_tree_output.write_tree(
+                    tree, file_output_options.get_output_target( infix, "newick" )
+                );
+            }
+        }
 
-    if( write_phyloxml_tree_ ) {
-        write_color_tree_to_phyloxml_file(
-            tree, color_per_branch, file_output_options.get_output_filename( infix, "phyloxml" )
-        );
-    }
+        #pragma omp section
+        {
+            if( write_nexus_tree_ ) {
+                write_color_tree_to_nexus_file(
+                    tree, color_per_branch, file_output_options.get_output_filename( infix, "nexus" )
+                );
+            }
+        }
 
-    if( write_svg_tree_ ) {
-        write_color_tree_to_svg_file(
-            tree,
-            svg_tree_output.layout_parameters(),
-            color_per_branch,
-            file_output_options.get_output_filename( infix, "svg" )
-        );
+        #pragma omp section
+        {
+            if( write_phyloxml_tree_ ) {
+                write_color_tree_to_phyloxml_file(
+                    tree, color_per_branch, file_output_options.get_output_filename( infix, "phyloxml" )
+                );
+            }
+        }
+
+        #pragma omp section
+        {
+            if( write_svg_tree_ ) {
+                write_color_tree_to_svg_file(
+                    tree,
+                    svg_tree_output.layout_parameters(),
+                    color_per_branch,
+                    file_output_options.get_output_filename( infix, "svg" )
+                );
+            }
+        }
+
+        #pragma omp section
+        {
+            if( write_png_tree_ ) {
+                write_color_tree_to_png_file_(
+                    tree,
+                    color_per_branch,
+                    png_tree_size_,
+                    file_output_options.get_output_filename( infix, "png" )
+                );
+            }
+        }
     }
 }
 
@@ -216,68 +398,101 @@ void TreeOutputOptions::write_tree_to_files(
                      << "Use another format such as nexus, phyloxml, or svg to get a colored tree!";
         }
 
-        newick_tree_output.write_tree(
-            tree, file_output_options.get_output_target( infix, "newick" )
-        );
-        // write_tree_to_newick_file(
-        //     tree, file_output_options.get_output_filename( infix, "newick" )
-        // );
     }
+    print_legend = write_nexus_tree_ || write_phyloxml_tree_ || write_png_tree_;
+
+    // As above, write the formats in parallel, so that the cheap ones are hidden behind
+    // the svg layout and drawing.
+    #pragma omp parallel sections
+    {
+        #pragma omp section
+        {
+            if( write_newick_tree_ ) {
+                newick_tree_output.write_tree(
+                    tree, file_output_options.get_output_target( infix, "newick" )
+                );
+            }
+        }
 
-    if( write_nexus_tree_ ) {
-        write_color_tree_to_nexus_file(
-            tree, color_per_branch, file_output_options.get_output_filename( infix, "nexus" )
-        );
-        print_legend = true;
-    }
+        #pragma omp section
+        {
+            if( write_nexus_tree_ ) {
+                write_color_tree_to_nexus_file(
+                    tree, color_per_branch, file_output_options.get_output_filename( infix, "nexus" )
+                );
+            }
+        }
 
-    if( write_phyloxml_tree_ ) {
-        write_color_tree_to_phyloxml_file(
-            tree, color_per_branch, file_output_options.get_output_filename( infix, "phyloxml" )
-        );
-        print_legend = true;
-    }
+        #pragma omp section
+        {
+            if( write_phyloxml_tree_ ) {
+                write_color_tree_to_phyloxml_file(
+                    tree, color_per_branch, file_output_options.get_output_filename( infix, "phyloxml" )
+                );
+            }
+        }
 
-    if( write_svg_tree_ ) {
-        write_color_tree_to_svg_file(
-            tree,
-            svg_tree_output.layout_parameters(),
-            color_per_branch,
-            color_map,
-            color_norm,
-            file_output_options.get_output_filename( infix, "svg" )
-        );
+        #pragma omp section
+        {
+            if( write_svg_tree_ ) {
+                write_color_tree_to_svg_file(
+                    tree,
+                    svg_tree_output.layout_parameters(),
+                    color_per_branch,
+                    color_map,
+                    color_norm,
+                    file_output_options.get_output_filename( infix, "svg" )
+                );
+            }
+        }
+
+        #pragma omp section
+        {
+            if( write_png_tree_ ) {
+                write_color_tree_to_png_file_(
+                    tree,
+                    color_per_branch,
+                    png_tree_size_,
+                    file_output_options.get_output_filename( infix, "png" )
+                );
+            }
+        }
     }
 
     if( print_legend ) {
         // TODO maybe make the num ticks changable. if so, also use it for the svg output!
         auto const tickmarks = color_tickmarks( color_norm, 5 );
 
-        LOG_MSG1 << "Output options --write-nexus-tree and --write-phyloxml-tree produce trees "
-                 << "with colored branches. These formats are however not able to store the legend, "
-                 << "that is, which color represents which value. Thus, use to following positions "
-                 << "to create a legend (with linear color interpolation between the positions). "
-                 << "These positions range from 0.0 (lowest) to 1.0 (heighest), and are labeled "
-                 << "with the values and colors represented by those positions.";
-
-        for( auto const& tick : tickmarks ) {
-            auto const rel_pos = tick.first;
-            auto label = tick.second;
-
-            if( rel_pos == 0.0 && color_map.clip_under() ) {
-                label = "≤ " + label;
-            }
-            if( rel_pos == 1.0 && color_map.clip_over() ) {
-                label = "≥ " + label;
+        // Commands that write several trees render them concurrently, so keep the
+        // multi-line legend of each tree together in the user output.
+        #pragma omp critical(GAPPA_TREE_OUTPUT_LEGEND)
+        {
+            LOG_MSG1 << "Output options --write-nexus-tree and --write-phyloxml-tree produce trees "
+                     << "with colored branches. These formats are however not able to store the legend, "
+                     << "that is, which color represents which value. Thus, use to following positions "
+                     << "to create a legend (with linear color interpolation between the positions). "
+                     << "These positions range from 0.0 (lowest) to 1.0 (heighest), and are labeled "
+                     << "with the values and colors represented by those positions.";
+
+            for( auto const& tick : tickmarks ) {
+                auto const rel_pos = tick.first;
+                auto label = tick.second;
+
+                if( rel_pos == 0.0 && color_map.clip_under() ) {
+                    label = "≤ " + label;
+                }
+                if( rel_pos == 1.0 && color_map.clip_over() ) {
+                    label = "≥ " + label;
+                }
+
+                auto const col_str = color_to_hex( color_map( rel_pos ));
+                LOG_MSG1 << "    At " << to_string_precise( rel_pos, 3 ) << ": Label '"
+                         << label << "', Color " << col_str;
             }
 
-            auto const col_str = color_to_hex( color_map( rel_pos ));
-            LOG_MSG1 << "    At " << to_string_precise( rel_pos, 3 ) << ": Label '"
-                     << label << "', Color " << col_str;
+            LOG_MSG1 << "Alternatively, use the option --write-svg-tree to create an SVG file "
+                     << "from which the color legend can be copied using a vector graphics editor.";
+            LOG_BOLD;
         }
-
-        LOG_MSG1 << "Alternatively, use the option --write-svg-tree to create an SVG file "
-                 << "from which the color legend can be copied using a vector graphics editor.";
-        LOG_BOLD;
     }
 }
@@ -133,6 +133,9 @@ private:
     bool write_nexus_tree_    = false;
     bool write_phyloxml_tree_ = false;
     bool write_svg_tree_      = false;
+    bool write_png_tree_      = false;
+
+    size_t png_tree_size_ = 2048;
 
     NewickTreeOutputOptions newick_tree_output;
     SvgTreeOutputOptions svg_tree_output;
@@ -23,6 +23,8 @@
 
 #include "options/tree_output_newick.hpp"
 
+#include "tools/newick_buffer_writer.hpp"
+
 #include "genesis/utils/io/output_target.hpp"
 
 #include <iostream>
@@ -81,8 +83,12 @@ void NewickTreeOutputOptions::write_tree(
     genesis::tree::CommonTree const& tree,
     std::shared_ptr<genesis::utils::BaseOutputTarget> target
 ) const {
-    auto writer = genesis::tree::CommonTreeNewickWriter();
-    write_tree( writer, tree, target );
+    // For the plain case without a customized genesis writer, use our buffered serializer,
+    // which writes large trees considerably faster than the generic genesis writer.
+    auto writer = NewickBufferWriter();
+    writer.branch_length_precision( branch_length_precision_ );
+    writer.quote_invalid_chars( quote_invalid_chars_ );
+    writer.write( tree, target );
 }
 
 void NewickTreeOutputOptions::write_tree(
@@ -0,0 +1,406 @@
+/*
+    gappa - Genesis Applications for Phylogenetic Placement Analysis
+    Copyright (C) 2017-2024 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+#include "tools/abundance_map.hpp"
+
+#include "options/global.hpp"
+#include "tools/version.hpp"
+
+#include "genesis/utils/core/std.hpp"
+#include "genesis/utils/formats/json/document.hpp"
+#include "genesis/utils/formats/json/reader.hpp"
+#include "genesis/utils/io/deserializer.hpp"
+#include "genesis/utils/io/input_source.hpp"
+#include "genesis/utils/text/string.hpp"
+
+#include <cstdint>
+#include <stdexcept>
+
+// =================================================================================================
+//      Local Helper Functions
+// =================================================================================================
+
+/**
+ * @brief Magic string at the beginning of binary abundance map files,
+ * for identification and versioning of the format.
+ */
+static const std::string abundance_map_magic_ = "gappa-abundance-map-v1";
+
+/**
+ * @brief Append an unsigned integer to the serializer, base-128 varint encoded.
+ *
+ * Small values take a single byte, instead of the fixed eight bytes of the
+ * serializer integer operators, which matters for the per-label abundances.
+ */
+static void write_varint_( genesis::utils::Serializer& ser, uint64_t value )
+{
+    while( value >= 0x80 ) {
+        ser << static_cast<uint8_t>(( value & 0x7F ) | 0x80 );
+        value >>= 7;
+    }
+    ser << static_cast<uint8_t>( value );
+}
+
+/**
+ * @brief Read an unsigned integer written by write_varint_().
+ */
+static uint64_t read_varint_( genesis::utils::Deserializer& des )
+{
+    uint64_t result = 0;
+    for( size_t shift = 0; shift < 64; shift += 7 ) {
+        uint8_t byte;
+        des >> byte;
+        result |= static_cast<uint64_t>( byte & 0x7F ) << shift;
+        if( !( byte & 0x80 )) {
+            return result;
+        }
+    }
+    throw std::runtime_error( "Invalid varint in binary abundance map." );
+}
+
+/**
+ * @brief Convert a hash in hex representation to its raw bytes.
+ */
+static std::string hex_to_bytes_( std::string const& hex )
+{
+    auto hex_value = []( char c ) -> int {
+        if( c >= '0' && c <= '9' ) {
+            return c - '0';
+        }
+        if( c >= 'a' && c <= 'f' ) {
+            return c - 'a' + 10;
+        }
+        if( c >= 'A' && c <= 'F' ) {
+            return c - 'A' + 10;
+        }
+        return -1;
+    };
+
+    if( hex.size() % 2 != 0 ) {
+        throw std::runtime_error( "Invalid hash hex string: " + hex );
+    }
+    std::string bytes;
+    bytes.reserve( hex.size() / 2 );
+    for( size_t i = 0; i < hex.size(); i += 2 ) {
+        auto const hi = hex_value( hex[ i ] );
+        auto const lo = hex_value( hex[ i + 1 ] );
+        if( hi < 0 || lo < 0 ) {
+            throw std::runtime_error( "Invalid hash hex string: " + hex );
+        }
+        bytes += static_cast<char>(( hi << 4 ) | lo );
+    }
+    return bytes;
+}
+
+/**
+ * @brief Convert raw hash bytes back to their hex representation.
+ */
+static std::string bytes_to_hex_( std::string const& bytes )
+{
+    static const char hex_chars[] = "0123456789abcdef";
+    std::string hex;
+    hex.reserve( bytes.size() * 2 );
+    for( auto const c : bytes ) {
+        auto const byte = static_cast<unsigned char>( c );
+        hex += hex_chars[ byte >> 4 ];
+        hex += hex_chars[ byte & 0x0F ];
+    }
+    return hex;
+}
+
+/**
+ * @brief Escape a string for use in a JSON document.
+ */
+static std::string abundance_map_json_escape_( std::string const& text )
+{
+    std::string result;
+    result.reserve( text.size() );
+    for( auto const c : text ) {
+        switch( c ) {
+            case '"':  result += "\\\""; break;
+            case '\\': result += "\\\\"; break;
+            case '\b': result += "\\b";  break;
+            case '\f': result += "\\f";  break;
+            case '\n': result += "\\n";  break;
+            case '\r': result += "\\r";  break;
+            case '\t': result += "\\t";  break;
+            default:   result += c;      break;
+        }
+    }
+    return result;
+}
+
+// =================================================================================================
+//      Abundance Map Writer
+// =================================================================================================
+
+AbundanceMapWriter::AbundanceMapWriter(
+    std::shared_ptr<genesis::utils::BaseOutputTarget> target,
+    AbundanceMapFormat format,
+    std::string const& sample,
+    std::string const& hash_function
+)
+    : format_( format )
+    , target_( target )
+{
+    using namespace genesis::utils;
+
+    if( ! target_ ) {
+        throw std::runtime_error( "Internal Error: No output target for AbundanceMapWriter." );
+    }
+
+    if( format_ == AbundanceMapFormat::kJson ) {
+
+        // Write the json file header, up to and including the opening bracket of
+        // the "abundances" array. Same layout as the original chunkify output.
+        auto& ofs = *target_;
+        ofs << "{\n";
+        ofs << "  \"sample\": \"" << abundance_map_json_escape_( sample ) << "\",\n";
+        ofs << "  \"gappa\": \"" << gappa_version() << "\",\n";
+        ofs << "  \"invocation\": \"" << global_options.command_line() << "\",\n";
+        ofs << "  \"hash\": \"" << hash_function << "\",\n";
+        ofs << "  \"abundances\": [";
+
+    } else {
+
+        // Binary format: magic and metadata, followed by the entries written below.
+        serializer_ = genesis::utils::make_unique<Serializer>( target_ );
+        (*serializer_) << abundance_map_magic_;
+        (*serializer_) << sample;
+        (*serializer_) << hash_function;
+    }
+}
+
+AbundanceMapWriter::~AbundanceMapWriter()
+{
+    // Try to close the file, so that no invalid file remains if a command forgets
+    // to call finish(). Never throw from here though.
+    try {
+        finish();
+    } catch( ... ) {
+        // Nothing to be done. If the target is broken, the write in finish() failed anyway.
+    }
+}
+
+void AbundanceMapWriter::write(
+    std::string const& hash_hex,
+    size_t chunk_num,
+    std::unordered_map<std::string, size_t> const& abundances
+) {
+    if( finished_ ) {
+        throw std::runtime_error( "Internal Error: AbundanceMapWriter used after finish()." );
+    }
+
+    if( format_ == AbundanceMapFormat::kJson ) {
+
+        auto& ofs = *target_;
+
+        // Print comma for all but the first entry.
+        if( ! is_first_seq_ ) {
+            ofs << ",";
+        }
+        is_first_seq_ = false;
+        ofs << "\n";
+
+        // Print sequence data.
+        ofs << "    [ \"" << hash_hex << "\", ";
+        ofs << chunk_num << ", {";
+
+        // Write per label abundances.
+        bool is_first_abun = true;
+        for( auto const& label_abun : abundances ) {
+
+            // Print comma for all but the first entry.
+            if( ! is_first_abun ) {
+                ofs << ",";
+            }
+            is_first_abun = false;
+            ofs << "\n";
+
+            ofs << "      \"" << abundance_map_json_escape_( label_abun.first )
+                << "\": " << label_abun.second;
+        }
+
+        ofs << "\n    }]";
+
+    } else {
+
+        // Each entry starts with a marker byte, so that the reader knows whether
+        // another entry follows, without the entry count being known up front.
+        auto& ser = *serializer_;
+        ser << static_cast<uint8_t>( 1 );
+        ser << hex_to_bytes_( hash_hex );
+        write_varint_( ser, chunk_num );
+        write_varint_( ser, abundances.size() );
+        for( auto const& label_abun : abundances ) {
+            ser << label_abun.first;
+            write_varint_( ser, label_abun.second );
+        }
+    }
+}
+
+void AbundanceMapWriter::finish()
+{
+    if( finished_ || ! target_ ) {
+        // Nothing to do if called again, or on a moved-from instance.
+        return;
+    }
+    finished_ = true;
+
+    if( format_ == AbundanceMapFormat::kJson ) {
+        auto& ofs = *target_;
+        ofs << "\n  ]\n";
+        ofs << "}\n";
+    } else {
+        (*serializer_) << static_cast<uint8_t>( 0 );
+    }
+}
+
+// =================================================================================================
+//      Abundance Map Reading
+// =================================================================================================
+
+bool is_binary_abundance_map_file( std::string const& path )
+{
+    using namespace genesis::utils;
+    return ends_with( path, ".bmap" ) || ends_with( path, ".bmap.gz" );
+}
+
+/**
+ * @brief Read a binary abundance map, see AbundanceMapFormat::kBinary for the format.
+ */
+static AbundanceMap read_abundance_map_binary_( std::string const& path )
+{
+    using namespace genesis::utils;
+
+    AbundanceMap map;
+    auto des = Deserializer( from_file( path ));
+
+    // Check the magic, so that renamed non-map files fail with a clear message.
+    std::string magic;
+    des >> magic;
+    if( magic != abundance_map_magic_ ) {
+        throw std::runtime_error( "Invalid abundance map: " + path );
+    }
+    des >> map.sample;
+    des >> map.hash_function;
+
+    // Read the entries, until the end marker.
+    while( true ) {
+        uint8_t marker;
+        des >> marker;
+        if( marker == 0 ) {
+            break;
+        }
+        if( marker != 1 ) {
+            throw std::runtime_error( "Invalid abundance map: " + path );
+        }
+
+        AbundanceMapEntry entry;
+        std::string raw_digest;
+        des >> raw_digest;
+        entry.hash_hex  = bytes_to_hex_( raw_digest );
+        entry.chunk_num = read_varint_( des );
+        auto const label_count = read_varint_( des );
+        entry.abundances.reserve( label_count );
+        for( uint64_t li = 0; li < label_count; ++li ) {
+            std::string label;
+            des >> label;
+            auto const abundance = read_varint_( des );
+            entry.abundances.push_back({ std::move( label ), abundance });
+        }
+        map.entries.push_back( std::move( entry ));
+    }
+    return map;
+}
+
+/**
+ * @brief Read a json abundance map, as written by chunkify since its beginnings.
+ */
+static AbundanceMap read_abundance_map_json_( std::string const& path )
+{
+    using namespace genesis::utils;
+
+    // Read the file, and do some checks.
+    auto const doc = JsonReader().read( from_file( path ));
+    if( ! doc.is_object() ) {
+        throw std::runtime_error( "Invalid abundance map: " + path );
+    }
+    auto const sample_it = doc.find( "sample" );
+    if( sample_it == doc.end() || ! sample_it->is_string() ) {
+        throw std::runtime_error( "Invalid abundance map: " + path );
+    }
+    auto const hash_it = doc.find( "hash" );
+    if( hash_it == doc.end() || ! hash_it->is_string() ) {
+        throw std::runtime_error( "Invalid abundance map: " + path );
+    }
+    auto const abun_it = doc.find( "abundances" );
+    if( abun_it == doc.end() || ! abun_it->is_array() ) {
+        throw std::runtime_error( "Invalid abundance map: " + path );
+    }
+
+    AbundanceMap map;
+    map.sample        = sample_it->get_string();
+    map.hash_function = hash_it->get_string();
+
+    // Convert the entries:
+    //  [0]: the hash hex value
+    //  [1]: the chunk number
+    //  [2]: the object that maps sequence labels to abundances
+    map.entries.reserve( abun_it->size() );
+    for( auto const& seq_entry : abun_it->get_array() ) {
+        if(
+            ! seq_entry.is_array() ||
+            seq_entry.size() != 3  ||
+            ! seq_entry[0].is_string() ||
+            ! seq_entry[1].is_number_unsigned() ||
+            ! seq_entry[2].is_object()
+        ) {
+            throw std::runtime_error( "Invalid abundance map: " + path );
+        }
+
+        AbundanceMapEntry entry;
+        entry.hash_hex  = seq_entry[0].get_string();
+        entry.chunk_num = seq_entry[1].get_number_unsigned();
+        auto const& mult_arr = seq_entry[2].get_object();
+        entry.abundances.reserve( mult_arr.size() );
+        for( auto const& mult_obj : mult_arr ) {
+            if( ! mult_obj.second.is_number_unsigned() ) {
+                throw std::runtime_error( "Invalid abundance map: " + path );
+            }
+            entry.abundances.push_back({
+                mult_obj.first, mult_obj.second.get_number_unsigned()
+            });
+        }
+        map.entries.push_back( std::move( entry ));
+    }
+    return map;
+}
+
+AbundanceMap read_abundance_map( std::string const& path )
+{
+    if( is_binary_abundance_map_file( path )) {
+        return read_abundance_map_binary_( path );
+    }
+    return read_abundance_map_json_( path );
+}
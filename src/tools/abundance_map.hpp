@@ -0,0 +1,180 @@
+#ifndef GAPPA_TOOLS_ABUNDANCE_MAP_H_
+#define GAPPA_TOOLS_ABUNDANCE_MAP_H_
+
+/*
+    gappa - Genesis Applications for Phylogenetic Placement Analysis
+    Copyright (C) 2017-2024 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+#include "genesis/utils/io/output_target.hpp"
+#include "genesis/utils/io/serializer.hpp"
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// =================================================================================================
+//      Abundance Map
+// =================================================================================================
+
+/**
+ * @brief One sequence entry of an abundance map, see AbundanceMap.
+ */
+struct AbundanceMapEntry
+{
+    // Hash of the sequence, in hex representation.
+    std::string hash_hex;
+
+    // Number of the chunk file that the sequence was stored in.
+    size_t chunk_num;
+
+    // Per-label abundances of the sequence in its input file.
+    std::vector<std::pair<std::string, size_t>> abundances;
+};
+
+/**
+ * @brief Contents of an abundance map file, as written by `gappa prepare chunkify`,
+ * and read back by `gappa prepare unchunkify`.
+ */
+struct AbundanceMap
+{
+    std::string sample;
+    std::string hash_function;
+    std::vector<AbundanceMapEntry> entries;
+};
+
+/**
+ * @brief File format of an abundance map, see AbundanceMapWriter.
+ */
+enum class AbundanceMapFormat
+{
+    /**
+     * @brief Human-readable json format, the original format of chunkify.
+     */
+    kJson,
+
+    /**
+     * @brief Binary format, storing raw digest bytes and variable-length integers.
+     *
+     * Roughly an order of magnitude smaller and faster to read than the json format,
+     * as the hash hex strings and the per-entry json syntax dominate both the file
+     * size and the parse time for maps with many unique sequences.
+     */
+    kBinary
+};
+
+// =================================================================================================
+//      Abundance Map Writer
+// =================================================================================================
+
+/**
+ * @brief Write an abundance map file one entry at a time, in either format.
+ *
+ * The writer produces the file header on construction, appends each entry given
+ * to write(), and closes the file in finish(), so that chunkify can stream entries
+ * without holding the whole map in memory, see --abundance-map-limit there.
+ */
+class AbundanceMapWriter
+{
+public:
+
+    // -------------------------------------------------------------------------
+    //     Constructor and Rule of Five
+    // -------------------------------------------------------------------------
+
+    /**
+     * @brief Start an abundance map file for the given sample, writing to the given target.
+     *
+     * The sample and hash function names are stored in the file header, so that
+     * unchunkify can identify the map and check hash consistency.
+     */
+    AbundanceMapWriter(
+        std::shared_ptr<genesis::utils::BaseOutputTarget> target,
+        AbundanceMapFormat format,
+        std::string const& sample,
+        std::string const& hash_function
+    );
+
+    /**
+     * @brief Close the file if finish() has not been called explicitly.
+     */
+    ~AbundanceMapWriter();
+
+    AbundanceMapWriter( AbundanceMapWriter const& ) = delete;
+    AbundanceMapWriter( AbundanceMapWriter&& )      = default;
+
+    AbundanceMapWriter& operator= ( AbundanceMapWriter const& ) = delete;
+    AbundanceMapWriter& operator= ( AbundanceMapWriter&& )      = default;
+
+    // -------------------------------------------------------------------------
+    //     Writing Functions
+    // -------------------------------------------------------------------------
+
+    /**
+     * @brief Append the entry of one sequence to the map.
+     */
+    void write(
+        std::string const& hash_hex,
+        size_t chunk_num,
+        std::unordered_map<std::string, size_t> const& abundances
+    );
+
+    /**
+     * @brief Write the remaining parts of the file and close it.
+     */
+    void finish();
+
+    // -------------------------------------------------------------------------
+    //     Members
+    // -------------------------------------------------------------------------
+
+private:
+
+    AbundanceMapFormat format_;
+
+    std::shared_ptr<genesis::utils::BaseOutputTarget> target_;
+    std::unique_ptr<genesis::utils::Serializer> serializer_;
+
+    bool is_first_seq_ = true;
+    bool finished_     = false;
+
+};
+
+// =================================================================================================
+//      Abundance Map Reading
+// =================================================================================================
+
+/**
+ * @brief Return whether the given file path looks like a binary abundance map file,
+ * judging from its file extension.
+ */
+bool is_binary_abundance_map_file( std::string const& path );
+
+/**
+ * @brief Read an abundance map file in either format, dispatching on the file extension.
+ *
+ * Throws if the file is not a valid abundance map.
+ */
+AbundanceMap read_abundance_map( std::string const& path );
+
+#endif // include guard
@@ -0,0 +1,147 @@
+#ifndef GAPPA_TOOLS_BLOOM_FILTER_H_
+#define GAPPA_TOOLS_BLOOM_FILTER_H_
+
+/*
+    gappa - Genesis Applications for Phylogenetic Placement Analysis
+    Copyright (C) 2017-2024 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// =================================================================================================
+//      Bloom Filter
+// =================================================================================================
+
+/**
+ * @brief Blocked Bloom filter, used as a prefilter in front of large hash maps.
+ *
+ * For lookup workloads where a large share of the probes miss (such as the unchunkify
+ * hash lookups, where many sequences were filtered out between chunkify and placement),
+ * probing a multi-GB hash map costs several dependent cache misses per miss. This filter
+ * answers most of those misses from a single cache line instead: all probe bits of a key
+ * live in one 64-byte block, selected by the first hash, so a negative answer touches
+ * exactly one line. Only keys that pass the filter (all inserted keys, plus a few percent
+ * false positives) go on to the real map probe.
+ *
+ * The caller provides two independent 64 bit hashes per key. For keys that are already
+ * cryptographic digests, two words of the digest do; otherwise, use two differently
+ * seeded hashes. The filter is sized at construction for the expected number of elements
+ * and cannot grow; inserting more than expected degrades the false positive rate, not
+ * correctness. Insertion is not thread safe; lookups are, once building is done.
+ */
+class BloomFilter
+{
+public:
+
+    // -------------------------------------------------------------------------
+    //     Constructor and Rule of Five
+    // -------------------------------------------------------------------------
+
+    BloomFilter() = default;
+
+    /**
+     * @brief Create a filter sized for the given number of elements,
+     * using roughly 12 bits per element, for a false positive rate of a few percent.
+     */
+    explicit BloomFilter( size_t expected_elements )
+    {
+        // One block holds 512 bits. Use the next power of two of the needed block count,
+        // so that block selection is a mask instead of a modulo.
+        auto const bits = 12 * ( expected_elements > 0 ? expected_elements : 1 );
+        size_t block_count = 1;
+        while( block_count * 512 < bits ) {
+            block_count *= 2;
+        }
+        block_mask_ = block_count - 1;
+        words_ = std::vector<uint64_t>( block_count * words_per_block_, 0 );
+    }
+
+    BloomFilter( BloomFilter const& ) = default;
+    BloomFilter( BloomFilter&& )      = default;
+
+    BloomFilter& operator= ( BloomFilter const& ) = default;
+    BloomFilter& operator= ( BloomFilter&& )      = default;
+
+    // -------------------------------------------------------------------------
+    //     Members
+    // -------------------------------------------------------------------------
+
+    /**
+     * @brief Insert a key, given by two independent 64 bit hashes.
+     */
+    void insert( uint64_t hash_1, uint64_t hash_2 )
+    {
+        auto const base = ( hash_1 & block_mask_ ) * words_per_block_;
+        auto probe = hash_2;
+        for( size_t i = 0; i < probe_count_; ++i ) {
+            auto const bit = probe & 511;
+            probe >>= 9;
+            words_[ base + ( bit >> 6 )] |= 1ull << ( bit & 63 );
+        }
+    }
+
+    /**
+     * @brief Return whether the key might have been inserted.
+     *
+     * A `false` answer is definite; a `true` answer is correct up to the
+     * false positive rate of the filter.
+     */
+    bool may_contain( uint64_t hash_1, uint64_t hash_2 ) const
+    {
+        auto const base = ( hash_1 & block_mask_ ) * words_per_block_;
+        auto probe = hash_2;
+        for( size_t i = 0; i < probe_count_; ++i ) {
+            auto const bit = probe & 511;
+            probe >>= 9;
+            if( !( words_[ base + ( bit >> 6 )] & ( 1ull << ( bit & 63 )))) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * @brief Return whether the filter was default constructed, i.e., has no storage.
+     */
+    bool empty() const
+    {
+        return words_.empty();
+    }
+
+    // -------------------------------------------------------------------------
+    //     Internal Members
+    // -------------------------------------------------------------------------
+
+private:
+
+    // 8 * 64 bit = one 64 byte cache line per block. 6 probe bits per key,
+    // using 6 * 9 = 54 bits of the second hash.
+    static const size_t words_per_block_ = 8;
+    static const size_t probe_count_ = 6;
+
+    std::vector<uint64_t> words_;
+    uint64_t block_mask_ = 0;
+
+};
+
+#endif // include guard
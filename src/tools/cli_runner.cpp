@@ -0,0 +1,119 @@
+/*
+    gappa - Genesis Applications for Phylogenetic Placement Analysis
+    Copyright (C) 2017-2024 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+#include "tools/cli_runner.hpp"
+
+#include "CLI/CLI.hpp"
+
+#include "commands/analyze.hpp"
+#include "commands/edit.hpp"
+#include "commands/examine.hpp"
+#include "commands/prepare.hpp"
+#include "commands/simulate.hpp"
+
+#include "options/global.hpp"
+#include "tools/cli_formatter.hpp"
+#include "tools/cli_setup.hpp"
+#include "tools/version.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <memory>
+#include <sstream>
+
+// =================================================================================================
+//      CLI11 In-Process Command Runner
+// =================================================================================================
+
+std::vector<std::string> split_gappa_command_line( std::string const& line )
+{
+    std::vector<std::string> result;
+    std::string current;
+    char quote = 0;
+    bool quoted = false;
+    for( auto const c : line ) {
+        if( quote ) {
+            if( c == quote ) {
+                quote = 0;
+            } else {
+                current += c;
+            }
+        } else if( c == '"' || c == '\'' ) {
+            quote = c;
+            quoted = true;
+        } else if( std::isspace( static_cast<unsigned char>( c )) ) {
+            if( quoted || ! current.empty() ) {
+                result.push_back( current );
+                current.clear();
+                quoted = false;
+            }
+        } else {
+            current += c;
+        }
+    }
+    if( quoted || ! current.empty() ) {
+        result.push_back( current );
+    }
+    return result;
+}
+
+std::string run_gappa_command_line( std::string const& command_line )
+{
+    CLI::App app{ gappa_header() };
+    app.name( "gappa" );
+    app.formatter( std::make_shared<GappaFormatter>() );
+    app.set_help_flag( "--help", "Print this help message and exit." );
+    app.option_defaults()->always_capture_default( true );
+    app.require_subcommand( 1 );
+    setup_analyze( app );
+    setup_edit( app );
+    setup_examine( app );
+    setup_prepare( app );
+    setup_simulate( app );
+    fix_cli_default_values( app );
+
+    try {
+
+        // The CLI parse function expects the arguments in reverse order,
+        // the same way that the main function hands them over.
+        auto args = split_gappa_command_line( command_line );
+        std::reverse( args.begin(), args.end() );
+        app.parse( args );
+
+    } catch( CLI::ParseError const& error ) {
+        std::stringstream ss;
+        auto const exit_code = app.exit( error, ss, ss );
+        auto const message = ss.str();
+        if( ! message.empty() ) {
+            LOG_BOLD << message;
+        }
+        if( exit_code != 0 ) {
+            return std::string( error.what() );
+        }
+        return "";
+    } catch( std::exception const& error ) {
+        LOG_BOLD << "Error: " << error.what();
+        return std::string( error.what() );
+    }
+    return "";
+}
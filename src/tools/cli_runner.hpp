@@ -0,0 +1,52 @@
+#ifndef GAPPA_TOOLS_CLI_RUNNER_H_
+#define GAPPA_TOOLS_CLI_RUNNER_H_
+
+/*
+    gappa - Genesis Applications for Phylogenetic Placement Analysis
+    Copyright (C) 2017-2024 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+#include <string>
+#include <vector>
+
+// =================================================================================================
+//      CLI11 In-Process Command Runner
+// =================================================================================================
+
+/**
+ * @brief Split a gappa command line into its arguments, honoring simple quoting.
+ */
+std::vector<std::string> split_gappa_command_line( std::string const& line );
+
+/**
+ * @brief Run one gappa command line (without the leading `gappa`) within this process.
+ *
+ * This is used by the commands that execute other gappa commands against samples that are
+ * already in memory, see `gappa tools server` and `gappa tools pipeline`. We build a fresh
+ * CLI app per invocation, mirroring the setup in main(), so that option values of one
+ * command cannot leak into the next. The tools module is left out, so that the driver
+ * commands cannot nest themselves.
+ *
+ * Returns an empty string on success, or the error message of the failed command.
+ */
+std::string run_gappa_command_line( std::string const& command_line );
+
+#endif // include guard
@@ -27,6 +27,7 @@
 
 #include "tools/cli_option.hpp"
 #include "tools/misc.hpp"
+#include "tools/profiler.hpp"
 #include "tools/references.hpp"
 #include "tools/version.hpp"
 
@@ -34,6 +35,9 @@
 #include "genesis/utils/text/string.hpp"
 #include "genesis/utils/tools/date_time.hpp"
 
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
 #include <stdexcept>
 #include <unordered_set>
 
@@ -153,6 +157,83 @@ void print_option_values( CLI::App const* subcommand )
     }
 }
 
+/**
+ * @brief Get the total bytes read and written by the process so far, via /proc/self/io.
+ *
+ * We use the rchar/wchar counters, which include all I/O of the process, also reads that
+ * were served from the page cache. Returns false if the information is not available,
+ * which is the case on non-Linux systems.
+ */
+bool process_io_bytes( uint64_t& read_bytes, uint64_t& write_bytes )
+{
+    read_bytes  = 0;
+    write_bytes = 0;
+
+    std::ifstream io_file( "/proc/self/io" );
+    if( ! io_file ) {
+        return false;
+    }
+
+    bool found = false;
+    std::string key;
+    uint64_t value;
+    while( io_file >> key >> value ) {
+        if( key == "rchar:" ) {
+            read_bytes = value;
+            found = true;
+        }
+        if( key == "wchar:" ) {
+            write_bytes = value;
+            found = true;
+        }
+    }
+    return found;
+}
+
+/**
+ * @brief Format a byte count with a fitting unit, e.g., "1.23 GB".
+ */
+std::string format_byte_size( uint64_t bytes )
+{
+    char buffer[ 32 ];
+    auto const value = static_cast<double>( bytes );
+    if( bytes >= 1024ull * 1024ull * 1024ull ) {
+        std::snprintf( buffer, sizeof( buffer ), "%.2f GB", value / ( 1024.0 * 1024.0 * 1024.0 ));
+    } else if( bytes >= 1024ull * 1024ull ) {
+        std::snprintf( buffer, sizeof( buffer ), "%.2f MB", value / ( 1024.0 * 1024.0 ));
+    } else if( bytes >= 1024ull ) {
+        std::snprintf( buffer, sizeof( buffer ), "%.2f KB", value / 1024.0 );
+    } else {
+        std::snprintf( buffer, sizeof( buffer ), "%lu B", static_cast<unsigned long>( bytes ));
+    }
+    return std::string( buffer );
+}
+
+void print_resource_usage()
+{
+    char buffer[ 32 ];
+
+    LOG_MSG << "Resource usage:";
+
+    std::snprintf( buffer, sizeof( buffer ), "%.2f GB", Profiler::process_peak_rss_gb() );
+    LOG_MSG << format_columns( "  Peak memory (RSS):", buffer, left_column_width_ );
+
+    std::snprintf( buffer, sizeof( buffer ), "%.2f s", Profiler::process_cpu_seconds() );
+    LOG_MSG << format_columns( "  Total CPU time:", buffer, left_column_width_ );
+
+    uint64_t read_bytes;
+    uint64_t write_bytes;
+    if( process_io_bytes( read_bytes, write_bytes )) {
+        LOG_MSG << format_columns(
+            "  Total bytes read:", format_byte_size( read_bytes ), left_column_width_
+        );
+        LOG_MSG << format_columns(
+            "  Total bytes written:", format_byte_size( write_bytes ), left_column_width_
+        );
+    }
+    LOG_BOLD;
+}
+
 void print_citations( std::vector<std::string> const& citations )
 {
     LOG_BOLD << "Run the following command to get the references that need to be cited:";
@@ -208,9 +289,21 @@ std::function<void()> gappa_cli_callback(
         LOG_BOLD;
 
         // Run the actual command callback function.
-        run_function();
+        {
+            ProfilerGuard guard( "total run" );
+            run_function();
+        }
+
+        // Print the stage profile, if the --profile option was given.
+        Profiler::report();
 
         LOG_BOLD;
+
+        // Print the resource usage summary, if the --resource-usage option was given.
+        if( global_options.resource_usage() ) {
+            print_resource_usage();
+        }
+
         LOG_MSG << "Finished " << genesis::utils::current_date() << " " << genesis::utils::current_time();
     };
 }
@@ -0,0 +1,105 @@
+/*
+    gappa - Genesis Applications for Phylogenetic Placement Analysis
+    Copyright (C) 2017-2024 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+#include "tools/edge_imbalance.hpp"
+
+#include "genesis/tree/function/functions.hpp"
+#include "genesis/tree/iterator/postorder.hpp"
+
+#include <cassert>
+#include <stdexcept>
+
+// =================================================================================================
+//      Edge Imbalance Layout
+// =================================================================================================
+
+const size_t EdgeImbalanceLayout::no_parent_;
+
+EdgeImbalanceLayout::EdgeImbalanceLayout( genesis::tree::Tree const& tree )
+{
+    using namespace genesis::tree;
+
+    // Collect the edges in postorder, that is, children before parents.
+    auto const num_edges = tree.edge_count();
+    auto rank_of_edge = std::vector<size_t>( num_edges, 0 );
+    postorder_edges_.reserve( num_edges );
+    for( auto it : postorder( tree )) {
+        if( it.is_last_iteration() ) {
+            continue;
+        }
+        rank_of_edge[ it.edge().index() ] = postorder_edges_.size();
+        postorder_edges_.push_back( it.edge().index() );
+    }
+    assert( postorder_edges_.size() == num_edges );
+
+    // Store the parent edge of each edge, that is, the next edge towards the root,
+    // which in postorder always has a higher rank than all edges of its subtree.
+    parent_ranks_.resize( num_edges, no_parent_ );
+    for( size_t rank = 0; rank < num_edges; ++rank ) {
+        auto const& prox = tree.edge_at( postorder_edges_[rank] ).primary_node();
+        if( is_root( prox )) {
+            continue;
+        }
+        parent_ranks_[rank] = rank_of_edge[ prox.primary_link().edge().index() ];
+        assert( parent_ranks_[rank] > rank );
+    }
+}
+
+std::vector<double> EdgeImbalanceLayout::imbalance_vector(
+    std::vector<double> const& edge_masses,
+    bool normalize
+) const {
+    auto const num_edges = postorder_edges_.size();
+    if( edge_masses.size() != num_edges ) {
+        throw std::runtime_error(
+            "Cannot compute imbalances of a sample whose tree differs from the reference tree."
+        );
+    }
+
+    // Gather the masses into postorder, and get the total while we are at it.
+    auto subtree = std::vector<double>( num_edges );
+    double total = 0.0;
+    for( size_t rank = 0; rank < num_edges; ++rank ) {
+        auto const mass = edge_masses[ postorder_edges_[rank] ];
+        subtree[rank] = mass;
+        total += mass;
+    }
+
+    // Ascending prefix scan: when an edge is reached, its entry already holds the mass
+    // of its whole subtree (children come before parents), which we push up to the parent.
+    for( size_t rank = 0; rank < num_edges; ++rank ) {
+        if( parent_ranks_[rank] != no_parent_ ) {
+            subtree[ parent_ranks_[rank] ] += subtree[rank];
+        }
+    }
+
+    // The imbalance of an edge is its distal mass (the subtree sum, including the edge
+    // itself) minus its proximal mass (the rest). This final pass is branch-free.
+    auto result = std::vector<double>( num_edges );
+    auto const scale = ( normalize && total > 0.0 ) ? 1.0 / total : 1.0;
+    #pragma omp simd
+    for( size_t rank = 0; rank < num_edges; ++rank ) {
+        result[ postorder_edges_[rank] ] = scale * ( 2.0 * subtree[rank] - total );
+    }
+    return result;
+}
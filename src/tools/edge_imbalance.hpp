@@ -0,0 +1,109 @@
+#ifndef GAPPA_TOOLS_EDGE_IMBALANCE_H_
+#define GAPPA_TOOLS_EDGE_IMBALANCE_H_
+
+/*
+    gappa - Genesis Applications for Phylogenetic Placement Analysis
+    Copyright (C) 2017-2024 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+#include "genesis/tree/tree.hpp"
+
+#include <cstddef>
+#include <vector>
+
+// =================================================================================================
+//      Edge Imbalance Layout
+// =================================================================================================
+
+/**
+ * @brief Postorder layout of a reference tree, for computing edge imbalance vectors
+ * from per-edge mass vectors.
+ *
+ * The imbalance of an edge is the placement mass on its distal side (the subtree away
+ * from the root, including the mass on the edge itself) minus the mass on its proximal
+ * side, as used by edge PCA. The genesis epca_imbalance_vector() derives this with a
+ * link-based tree traversal per sample, which for many samples on a large tree costs
+ * as much as the parsing itself. As all samples share the tree, this class instead
+ * stores the postorder arrangement of the edges once: each sample's imbalances then
+ * follow from its per-edge mass vector via a single ascending scan over contiguous
+ * arrays (children come before their parents in postorder), and the layout can be
+ * shared read-only across a parallel loop over the samples.
+ */
+class EdgeImbalanceLayout
+{
+public:
+
+    // -------------------------------------------------------------------------
+    //     Constructor and Rule of Five
+    // -------------------------------------------------------------------------
+
+    EdgeImbalanceLayout() = default;
+
+    /**
+     * @brief Build the layout from a reference tree, whose topology all samples share.
+     */
+    explicit EdgeImbalanceLayout( genesis::tree::Tree const& tree );
+
+    ~EdgeImbalanceLayout() = default;
+
+    EdgeImbalanceLayout( EdgeImbalanceLayout const& ) = default;
+    EdgeImbalanceLayout( EdgeImbalanceLayout&& )      = default;
+
+    EdgeImbalanceLayout& operator= ( EdgeImbalanceLayout const& ) = default;
+    EdgeImbalanceLayout& operator= ( EdgeImbalanceLayout&& )      = default;
+
+    // -------------------------------------------------------------------------
+    //     Computation
+    // -------------------------------------------------------------------------
+
+    size_t edge_count() const
+    {
+        return postorder_edges_.size();
+    }
+
+    /**
+     * @brief Compute the imbalance vector for a sample, given its masses per edge
+     * (indexed by edge index, as returned by placement_mass_per_edges_with_multiplicities()).
+     *
+     * Computes the same values as the genesis epca_imbalance_vector() on the sample.
+     * If @p normalize is set, the imbalances are divided by the total mass of the sample.
+     */
+    std::vector<double> imbalance_vector(
+        std::vector<double> const& edge_masses,
+        bool normalize
+    ) const;
+
+    // -------------------------------------------------------------------------
+    //     Internal Members
+    // -------------------------------------------------------------------------
+
+private:
+
+    static const size_t no_parent_ = static_cast<size_t>( -1 );
+
+    // Edges in postorder: the edge index per rank, and the rank of the parent edge
+    // (the next edge towards the root; no_parent_ at the root) per rank.
+    std::vector<size_t> postorder_edges_;
+    std::vector<size_t> parent_ranks_;
+
+};
+
+#endif // include guard
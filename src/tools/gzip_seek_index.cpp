@@ -0,0 +1,169 @@
+/*
+    gappa - Genesis Applications for Phylogenetic Placement Analysis
+    Copyright (C) 2017-2024 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+#include "tools/gzip_seek_index.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <fstream>
+#include <stdexcept>
+
+#ifdef GENESIS_ZLIB
+#   include <zlib.h>
+#endif
+
+// =================================================================================================
+//      Gzip Seek Index
+// =================================================================================================
+
+std::string gzip_seek_index_path( std::string const& gz_path )
+{
+    return gz_path + ".gzi";
+}
+
+bool GzipSeekIndex::load( std::string const& gz_path )
+{
+    valid_ = false;
+    checkpoints_.clear();
+
+    std::ifstream index_file( gzip_seek_index_path( gz_path ), std::ios::binary );
+    if( ! index_file ) {
+        return false;
+    }
+
+    // The `.gzi` layout: entry count, then (compressed, uncompressed) start offsets
+    // of every member except the first, as 64 bit values, see ParallelGzipStreambuf.
+    uint64_t count = 0;
+    index_file.read( reinterpret_cast<char*>( &count ), sizeof( count ));
+    if( ! index_file ) {
+        return false;
+    }
+    checkpoints_.reserve( count + 1 );
+    checkpoints_.emplace_back( 0, 0 );
+    for( uint64_t i = 0; i < count; ++i ) {
+        uint64_t compressed_offset = 0;
+        uint64_t uncompressed_offset = 0;
+        index_file.read( reinterpret_cast<char*>( &compressed_offset ), sizeof( uint64_t ));
+        index_file.read( reinterpret_cast<char*>( &uncompressed_offset ), sizeof( uint64_t ));
+        if( ! index_file ) {
+            checkpoints_.clear();
+            return false;
+        }
+
+        // Offsets have to be strictly increasing; anything else is a broken index,
+        // which we treat as absent rather than producing wrong data.
+        if(
+            compressed_offset <= checkpoints_.back().first ||
+            uncompressed_offset <= checkpoints_.back().second
+        ) {
+            checkpoints_.clear();
+            return false;
+        }
+        checkpoints_.emplace_back( compressed_offset, uncompressed_offset );
+    }
+
+    gz_path_ = gz_path;
+    valid_ = true;
+    return true;
+}
+
+#ifdef GENESIS_ZLIB
+
+std::string GzipSeekIndex::read_range( uint64_t offset, uint64_t length ) const
+{
+    if( ! valid_ ) {
+        throw std::runtime_error( "Invalid use of a gzip seek index that was not loaded." );
+    }
+
+    // Find the last member that starts at or before the offset.
+    auto it = std::upper_bound(
+        checkpoints_.begin(), checkpoints_.end(), offset,
+        []( uint64_t off, std::pair<uint64_t, uint64_t> const& checkpoint ){
+            return off < checkpoint.second;
+        }
+    );
+    assert( it != checkpoints_.begin() );
+    --it;
+
+    std::ifstream gz_file( gz_path_, std::ios::binary );
+    if( ! gz_file ) {
+        throw std::runtime_error( "Cannot read file: " + gz_path_ );
+    }
+    gz_file.seekg( static_cast<std::streamoff>( it->first ));
+
+    z_stream zs = {};
+    if( inflateInit2( &zs, 15 + 16 ) != Z_OK ) {
+        throw std::runtime_error( "Cannot initialize zlib inflate for " + gz_path_ );
+    }
+
+    // Inflate member by member from the checkpoint, discarding output up to the offset,
+    // and collecting output until the requested length is reached or the file ends.
+    uint64_t skip = offset - it->second;
+    std::string result;
+    result.reserve( length );
+    char in_buffer[ 64 * 1024 ];
+    char out_buffer[ 64 * 1024 ];
+    while( result.size() < length ) {
+        if( zs.avail_in == 0 ) {
+            gz_file.read( in_buffer, sizeof( in_buffer ));
+            auto const got = gz_file.gcount();
+            if( got <= 0 ) {
+                break;
+            }
+            zs.next_in  = reinterpret_cast<Bytef*>( in_buffer );
+            zs.avail_in = static_cast<uInt>( got );
+        }
+
+        zs.next_out  = reinterpret_cast<Bytef*>( out_buffer );
+        zs.avail_out = sizeof( out_buffer );
+        auto const ret = inflate( &zs, Z_NO_FLUSH );
+        if( ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR ) {
+            inflateEnd( &zs );
+            throw std::runtime_error( "Corrupt gzip data in " + gz_path_ );
+        }
+
+        auto const produced = sizeof( out_buffer ) - zs.avail_out;
+        auto const skipped = std::min<uint64_t>( produced, skip );
+        skip -= skipped;
+        auto const take = std::min<uint64_t>( produced - skipped, length - result.size() );
+        result.append( out_buffer + skipped, take );
+
+        // End of a member: the next member (if any) follows in the remaining input.
+        if( ret == Z_STREAM_END ) {
+            inflateReset( &zs );
+        }
+    }
+    inflateEnd( &zs );
+    return result;
+}
+
+#else // GENESIS_ZLIB
+
+std::string GzipSeekIndex::read_range( uint64_t, uint64_t ) const
+{
+    // Without zlib, genesis cannot read gzip files in the first place,
+    // so this path is unreachable in practice.
+    throw std::runtime_error( "Cannot read gzip files: gappa was compiled without zlib." );
+}
+
+#endif // GENESIS_ZLIB
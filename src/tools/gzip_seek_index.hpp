@@ -0,0 +1,114 @@
+#ifndef GAPPA_TOOLS_GZIP_SEEK_INDEX_H_
+#define GAPPA_TOOLS_GZIP_SEEK_INDEX_H_
+
+/*
+    gappa - Genesis Applications for Phylogenetic Placement Analysis
+    Copyright (C) 2017-2024 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// =================================================================================================
+//      Gzip Seek Index
+// =================================================================================================
+
+/**
+ * @brief Path of the seek index sidecar for a gzip file, i.e., `<gz_path>.gzi`.
+ */
+std::string gzip_seek_index_path( std::string const& gz_path );
+
+/**
+ * @brief Seek index for random access into blocked gzip files.
+ *
+ * A plain gzip stream cannot be entered in the middle, so any partial access to a `.gz`
+ * file decompresses from the start. Our blocked gzip output (see ParallelGzipOutputTarget)
+ * instead writes a sequence of independent gzip members, and can record their
+ * (compressed, uncompressed) start offsets in a `<file>.gzi` sidecar, using the bgzip
+ * index layout. With such an index, reading a range of the uncompressed stream only
+ * decompresses from the nearest member boundary before the range, turning partial access
+ * from O(file size) into O(range + block size).
+ *
+ * Indexes produced by `bgzip -i` work as well, as BGZF block boundaries are also gzip
+ * member boundaries.
+ */
+class GzipSeekIndex
+{
+public:
+
+    // -------------------------------------------------------------------------
+    //     Constructor and Rule of Five
+    // -------------------------------------------------------------------------
+
+    GzipSeekIndex() = default;
+
+    GzipSeekIndex( GzipSeekIndex const& ) = default;
+    GzipSeekIndex( GzipSeekIndex&& )      = default;
+
+    GzipSeekIndex& operator= ( GzipSeekIndex const& ) = default;
+    GzipSeekIndex& operator= ( GzipSeekIndex&& )      = default;
+
+    // -------------------------------------------------------------------------
+    //     Members
+    // -------------------------------------------------------------------------
+
+    /**
+     * @brief Load the `.gzi` sidecar of the given gzip file.
+     *
+     * Returns whether a usable index was found; without one, callers fall back
+     * to full decompression.
+     */
+    bool load( std::string const& gz_path );
+
+    /**
+     * @brief Whether a usable index is loaded.
+     */
+    bool valid() const
+    {
+        return valid_;
+    }
+
+    /**
+     * @brief Read a range of the uncompressed stream of the indexed file.
+     *
+     * Decompresses from the nearest member boundary at or before @p offset. If the range
+     * extends beyond the end of the stream, the result is shortened accordingly.
+     */
+    std::string read_range( uint64_t offset, uint64_t length ) const;
+
+    // -------------------------------------------------------------------------
+    //     Internal Members
+    // -------------------------------------------------------------------------
+
+private:
+
+    std::string gz_path_;
+    bool valid_ = false;
+
+    // Member start offsets as (compressed, uncompressed) pairs, in increasing order,
+    // including the implicit first member at (0, 0).
+    std::vector<std::pair<uint64_t, uint64_t>> checkpoints_;
+
+};
+
+#endif // include guard
@@ -0,0 +1,243 @@
+/*
+    gappa - Genesis Applications for Phylogenetic Placement Analysis
+    Copyright (C) 2017-2022 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+#include "tools/jplace_stream_writer.hpp"
+
+#include "genesis/placement/formats/newick_writer.hpp"
+
+#include <cstdio>
+#include <stdexcept>
+
+// =================================================================================================
+//      Local Helper Functions
+// =================================================================================================
+
+/**
+ * @brief Escape a string for use in a JSON document.
+ */
+static std::string jplace_json_escape_( std::string const& text )
+{
+    std::string result;
+    result.reserve( text.size() );
+    for( auto const c : text ) {
+        switch( c ) {
+            case '"':  result += "\\\""; break;
+            case '\\': result += "\\\\"; break;
+            case '\b': result += "\\b";  break;
+            case '\f': result += "\\f";  break;
+            case '\n': result += "\\n";  break;
+            case '\r': result += "\\r";  break;
+            case '\t': result += "\\t";  break;
+            default:   result += c;      break;
+        }
+    }
+    return result;
+}
+
+/**
+ * @brief Append a double to the buffer, with enough digits to round-trip exactly.
+ *
+ * This produces the same representation as an ostream with max_digits10 precision,
+ * but without the locale and formatting state handling of the stream machinery,
+ * which dominates the time when writing millions of values.
+ */
+static void jplace_append_double_( std::string& buffer, double value )
+{
+    char chars[ 32 ];
+    auto const len = std::snprintf( chars, sizeof( chars ), "%.17g", value );
+    buffer.append( chars, len );
+}
+
+/**
+ * @brief Append an integer to the buffer.
+ */
+static void jplace_append_int_( std::string& buffer, long value )
+{
+    char chars[ 24 ];
+    auto const len = std::snprintf( chars, sizeof( chars ), "%ld", value );
+    buffer.append( chars, len );
+}
+
+// =================================================================================================
+//      Constructor
+// =================================================================================================
+
+// Out-of-line definition, to satisfy the one definition rule.
+const size_t JplaceStreamWriter::flush_threshold_;
+
+JplaceStreamWriter::JplaceStreamWriter(
+    genesis::placement::PlacementTree const& tree,
+    std::shared_ptr<genesis::utils::BaseOutputTarget> target
+)
+    : target_( target )
+{
+    using namespace genesis::placement;
+
+    if( ! target_ ) {
+        throw std::runtime_error( "Internal Error: No output target for JplaceStreamWriter." );
+    }
+
+    // Serialize into the reusable buffer, and hand it to the output target in large
+    // blocks, so that the per-field cost of the virtual stream interface is avoided.
+    buffer_.reserve( 2 * flush_threshold_ );
+
+    // Write the document header, up to and including the opening bracket of the
+    // "placements" array. The tree is written in the jplace newick dialect,
+    // with edge nums in curly brackets.
+    buffer_ += "{\n";
+    buffer_ += "    \"version\": 3,\n";
+    buffer_ += "    \"tree\": \"";
+    buffer_ += jplace_json_escape_( PlacementTreeNewickWriter().to_string( tree ));
+    buffer_ += "\",\n";
+    buffer_ += "    \"placements\": [\n";
+}
+
+JplaceStreamWriter::~JplaceStreamWriter()
+{
+    // Try to close the document, so that no invalid file remains if a command forgets
+    // to call finish(). Never throw from here though.
+    try {
+        finish();
+    } catch( ... ) {
+        // Nothing to be done. If the stream is broken, the write in finish() failed anyway.
+    }
+}
+
+// =================================================================================================
+//      Writing Functions
+// =================================================================================================
+
+void JplaceStreamWriter::write( genesis::placement::Pquery const& pquery )
+{
+    if( finished_ ) {
+        throw std::runtime_error( "Internal Error: JplaceStreamWriter used after finish()." );
+    }
+
+    if( pquery_count_ > 0 ) {
+        buffer_ += ",\n";
+    }
+    ++pquery_count_;
+
+    format_pquery( pquery, buffer_ );
+    if( buffer_.size() >= flush_threshold_ ) {
+        flush_();
+    }
+}
+
+void JplaceStreamWriter::write_formatted( std::string const& formatted )
+{
+    if( finished_ ) {
+        throw std::runtime_error( "Internal Error: JplaceStreamWriter used after finish()." );
+    }
+
+    if( pquery_count_ > 0 ) {
+        buffer_ += ",\n";
+    }
+    ++pquery_count_;
+
+    buffer_ += formatted;
+    if( buffer_.size() >= flush_threshold_ ) {
+        flush_();
+    }
+}
+
+void JplaceStreamWriter::format_pquery(
+    genesis::placement::Pquery const& pquery,
+    std::string& buffer
+) {
+    // Placement locations, in the field order stated in the "fields" entry of the document.
+    buffer += "        {\"p\": [";
+    bool first = true;
+    for( auto const& placement : pquery.placements() ) {
+        if( ! first ) {
+            buffer += ", ";
+        }
+        first = false;
+        buffer += "[";
+        jplace_append_int_( buffer, placement.edge_num() );
+        buffer += ", ";
+        jplace_append_double_( buffer, placement.likelihood );
+        buffer += ", ";
+        jplace_append_double_( buffer, placement.like_weight_ratio );
+        buffer += ", ";
+        jplace_append_double_( buffer, placement.proximal_length );
+        buffer += ", ";
+        jplace_append_double_( buffer, placement.pendant_length );
+        buffer += "]";
+    }
+    buffer += "],\n";
+
+    // Names with multiplicities.
+    buffer += "         \"nm\": [";
+    first = true;
+    for( auto const& name : pquery.names() ) {
+        if( ! first ) {
+            buffer += ", ";
+        }
+        first = false;
+        buffer += "[\"";
+        buffer += jplace_json_escape_( name.name );
+        buffer += "\", ";
+        jplace_append_double_( buffer, name.multiplicity );
+        buffer += "]";
+    }
+    buffer += "]}";
+}
+
+void JplaceStreamWriter::finish()
+{
+    if( finished_ || ! target_ ) {
+        // Nothing to do if called again, or on a moved-from instance.
+        return;
+    }
+    finished_ = true;
+
+    // Close the "placements" array, and write the "fields" entry that describes
+    // the layout of the placement arrays written above.
+    buffer_ += "\n    ],\n";
+    buffer_ += "    \"fields\": [\"edge_num\", \"likelihood\", \"like_weight_ratio\", "
+               "\"proximal_length\", \"pendant_length\"]\n";
+    buffer_ += "}\n";
+    flush_();
+}
+
+void JplaceStreamWriter::flush_()
+{
+    target_->ostream().write( buffer_.data(), buffer_.size() );
+    buffer_.clear();
+}
+
+// =================================================================================================
+//      Convenience Functions
+// =================================================================================================
+
+void write_jplace_sample(
+    genesis::placement::Sample const& sample,
+    std::shared_ptr<genesis::utils::BaseOutputTarget> target
+) {
+    auto writer = JplaceStreamWriter( sample.tree(), target );
+    for( auto const& pquery : sample ) {
+        writer.write( pquery );
+    }
+    writer.finish();
+}
@@ -0,0 +1,169 @@
+#ifndef GAPPA_TOOLS_JPLACE_STREAM_WRITER_H_
+#define GAPPA_TOOLS_JPLACE_STREAM_WRITER_H_
+
+/*
+    gappa - Genesis Applications for Phylogenetic Placement Analysis
+    Copyright (C) 2017-2022 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+#include "genesis/placement/placement_tree.hpp"
+#include "genesis/placement/pquery.hpp"
+#include "genesis/placement/sample.hpp"
+#include "genesis/utils/io/output_target.hpp"
+
+#include <memory>
+#include <string>
+
+// =================================================================================================
+//      Jplace Stream Writer
+// =================================================================================================
+
+/**
+ * @brief Write a jplace file one pquery at a time, without needing the whole Sample in memory.
+ *
+ * The class writes the document header (version, reference tree) on construction,
+ * then appends each pquery given to write(), and closes the document in finish().
+ * This allows commands that process pqueries independently of each other to run as
+ * constant-memory pipelines, instead of first accumulating a full Sample and handing
+ * it to the genesis JplaceWriter.
+ *
+ * Pqueries are serialized into a reusable buffer that is flushed to the output target
+ * in large blocks, with snprintf-based number formatting, instead of going through
+ * per-field ostream operators. For outputs with millions of pqueries, the formatting
+ * and the virtual stream calls otherwise dominate the write time, in particular for
+ * compressed targets. Commands that produce pqueries in a parallel loop can format
+ * them into their own (thread-local) buffers via format_pquery(), and hand the
+ * finished blocks over in order via write_formatted().
+ */
+class JplaceStreamWriter
+{
+public:
+
+    // -------------------------------------------------------------------------
+    //     Constructor and Rule of Five
+    // -------------------------------------------------------------------------
+
+    /**
+     * @brief Start a jplace document, using the given reference tree, writing to the given target.
+     */
+    JplaceStreamWriter(
+        genesis::placement::PlacementTree const& tree,
+        std::shared_ptr<genesis::utils::BaseOutputTarget> target
+    );
+
+    /**
+     * @brief Close the document if finish() has not been called explicitly.
+     */
+    ~JplaceStreamWriter();
+
+    JplaceStreamWriter( JplaceStreamWriter const& ) = delete;
+    JplaceStreamWriter( JplaceStreamWriter&& )      = default;
+
+    JplaceStreamWriter& operator= ( JplaceStreamWriter const& ) = delete;
+    JplaceStreamWriter& operator= ( JplaceStreamWriter&& )      = default;
+
+    // -------------------------------------------------------------------------
+    //     Writing Functions
+    // -------------------------------------------------------------------------
+
+    /**
+     * @brief Append a pquery to the "placements" array of the document.
+     *
+     * The placements of the pquery need to refer to edges of the tree that was
+     * given at construction.
+     */
+    void write( genesis::placement::Pquery const& pquery );
+
+    /**
+     * @brief Append an already formatted pquery, see format_pquery().
+     *
+     * The given string needs to hold exactly one pquery entry, without separating
+     * comma; the separators between entries are added here. This is meant for
+     * commands that format pqueries concurrently into thread-local buffers,
+     * and append the results in order.
+     */
+    void write_formatted( std::string const& formatted );
+
+    /**
+     * @brief Serialize one pquery into the given buffer, appending to its content.
+     *
+     * This produces the entry for the "placements" array of the document, without
+     * the separating comma. The buffer keeps its capacity across calls, so that a
+     * reused (for example thread-local) buffer serializes without allocations.
+     */
+    static void format_pquery( genesis::placement::Pquery const& pquery, std::string& buffer );
+
+    /**
+     * @brief Close the "placements" array and write the remaining document parts.
+     */
+    void finish();
+
+    /**
+     * @brief Return the number of pqueries written so far.
+     */
+    size_t written_pquery_count() const
+    {
+        return pquery_count_;
+    }
+
+    // -------------------------------------------------------------------------
+    //     Members
+    // -------------------------------------------------------------------------
+
+private:
+
+    /**
+     * @brief Write the buffer to the output target in one block, and clear it.
+     */
+    void flush_();
+
+    /**
+     * @brief Buffer size at which write() flushes to the output target.
+     */
+    static const size_t flush_threshold_ = 1024 * 1024;
+
+    std::shared_ptr<genesis::utils::BaseOutputTarget> target_;
+
+    std::string buffer_;
+
+    size_t pquery_count_ = 0;
+    bool   finished_     = false;
+
+};
+
+// =================================================================================================
+//      Convenience Functions
+// =================================================================================================
+
+/**
+ * @brief Write a whole Sample as a jplace file, using the JplaceStreamWriter.
+ *
+ * Drop-in replacement for the genesis JplaceWriter for commands that already hold a
+ * full Sample in memory: it streams the pqueries through the buffered serializer,
+ * instead of first building the JSON document as an object, which roughly doubles
+ * the memory and dominates the write time for large samples.
+ */
+void write_jplace_sample(
+    genesis::placement::Sample const& sample,
+    std::shared_ptr<genesis::utils::BaseOutputTarget> target
+);
+
+#endif // include guard
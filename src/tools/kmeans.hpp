@@ -0,0 +1,938 @@
+#ifndef GAPPA_TOOLS_KMEANS_H_
+#define GAPPA_TOOLS_KMEANS_H_
+
+/*
+    gappa - Genesis Applications for Phylogenetic Placement Analysis
+    Copyright (C) 2017-2022 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+#include "genesis/utils/containers/matrix.hpp"
+#include "genesis/utils/math/kmeans.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <functional>
+#include <limits>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+// =================================================================================================
+//      Accelerated Kmeans
+// =================================================================================================
+
+/**
+ * @brief K-means driver with triangle-inequality pruning of distance evaluations.
+ *
+ * This is a drop-in replacement for the genesis Kmeans classes as used by the clustering
+ * commands, which recompute the distance from every sample to every centroid in every
+ * Lloyd iteration. Here, we maintain Hamerly-style bounds per sample: an upper bound on
+ * the distance to its assigned centroid, and a lower bound on the distance to all other
+ * centroids. Samples whose upper bound is below both the lower bound and half the distance
+ * of their centroid to its nearest other centroid cannot change cluster, so all their
+ * distance evaluations are skipped. After the first iterations, when centroids barely move,
+ * this eliminates the vast majority of distance calls, which for expensive metrics such as
+ * the earth movers distance between mass trees dominates the runtime.
+ *
+ * The point type is generic; callers provide the metric and the centroid computation via
+ * the two function members, see phylogenetic-kmeans and imbalance-kmeans for the two uses.
+ * The pruning is exact, that is, the resulting clustering is the same as with full scans.
+ */
+template<class Point>
+class AcceleratedKmeans
+{
+public:
+
+    // -------------------------------------------------------------------------
+    //     Constructor and Rule of Five
+    // -------------------------------------------------------------------------
+
+    AcceleratedKmeans()  = default;
+    ~AcceleratedKmeans() = default;
+
+    AcceleratedKmeans( AcceleratedKmeans const& ) = default;
+    AcceleratedKmeans( AcceleratedKmeans&& )      = default;
+
+    AcceleratedKmeans& operator= ( AcceleratedKmeans const& ) = default;
+    AcceleratedKmeans& operator= ( AcceleratedKmeans&& )      = default;
+
+    // -------------------------------------------------------------------------
+    //     Function Members
+    // -------------------------------------------------------------------------
+
+    /**
+     * @brief Metric between two points. Has to satisfy the triangle inequality
+     * for the pruning bounds to be exact.
+     */
+    std::function<double( Point const&, Point const& )> distance_function;
+
+    /**
+     * @brief Compute the centroid of the points of @p data given by @p members.
+     */
+    std::function<Point(
+        std::vector<Point> const& data, std::vector<size_t> const& members
+    )> centroid_function;
+
+    std::function<void( size_t iteration )> report_iteration;
+
+    /**
+     * @brief Called with the per-sample assignments after each completed Lloyd iteration,
+     * so that the caller can checkpoint them, see the --checkpoint-dir option of the
+     * clustering commands. Not called in mini-batch runs, where full assignments only
+     * exist after the final assignment pass.
+     */
+    std::function<void( size_t iteration, std::vector<size_t> const& assignments )> checkpoint_iteration;
+
+    /**
+     * @brief Move @p centroid towards @p point by the given @p learning_rate in `[0, 1]`.
+     *
+     * Only needed for mini-batch runs, see mini_batch_size(), where centroids are updated
+     * per batch as the convex combination `(1 - rate) * centroid + rate * point`.
+     */
+    std::function<void( Point& centroid, Point const& point, double learning_rate )> blend_function;
+
+    // -------------------------------------------------------------------------
+    //     Settings
+    // -------------------------------------------------------------------------
+
+    AcceleratedKmeans& max_iterations( size_t value )
+    {
+        max_iterations_ = value;
+        return *this;
+    }
+
+    size_t max_iterations() const
+    {
+        return max_iterations_;
+    }
+
+    /**
+     * @brief Number of samples per mini-batch. If 0 (default), full-batch Lloyd
+     * iterations with pruning bounds are run instead.
+     *
+     * With a batch size, each iteration assigns only a random batch of samples and
+     * updates the centroids with per-centroid learning rates (mini-batch k-means after
+     * Sculley, 2010), so the cost per iteration is independent of the total number of
+     * samples. The result is an approximation of the full-batch clustering; a final
+     * exact assignment pass over all samples is always done.
+     */
+    AcceleratedKmeans& mini_batch_size( size_t value )
+    {
+        mini_batch_size_ = value;
+        return *this;
+    }
+
+    size_t mini_batch_size() const
+    {
+        return mini_batch_size_;
+    }
+
+    /**
+     * @brief Warm-start the clustering from a previous per-sample cluster assignment.
+     *
+     * If set (and matching the data size), the initial centroids are computed from the
+     * given clusters instead of kmeans++ seeding, which typically cuts the number of
+     * iterations massively when re-running with mostly unchanged samples.
+     * Entries that are not a valid cluster index (that is, `>= k`) mark samples without
+     * a previous assignment, such as newly added ones; they do not take part in the
+     * seeding and are simply assigned in the initial assignment pass. If the previous
+     * clustering used fewer clusters than the requested k, the remaining centroids are
+     * filled in with kmeans++ sampling.
+     */
+    AcceleratedKmeans& initial_assignments( std::vector<size_t> value )
+    {
+        initial_assignments_ = std::move( value );
+        return *this;
+    }
+
+    std::vector<size_t> const& initial_assignments() const
+    {
+        return initial_assignments_;
+    }
+
+    /**
+     * @brief Wall time in seconds spent in the initialization of the last run(),
+     * that is, the kmeans++ seeding and the initial assignment pass.
+     */
+    double initialization_seconds() const
+    {
+        return init_seconds_;
+    }
+
+    /**
+     * @brief Wall time in seconds spent in the iterations of the last run().
+     */
+    double iteration_seconds() const
+    {
+        return iter_seconds_;
+    }
+
+    // -------------------------------------------------------------------------
+    //     Run Functions
+    // -------------------------------------------------------------------------
+
+    /**
+     * @brief Run the clustering of @p data into @p k clusters.
+     * Returns the number of Lloyd iterations used.
+     */
+    size_t run( std::vector<Point> const& data, size_t k )
+    {
+        if( ! distance_function || ! centroid_function ) {
+            throw std::runtime_error( "Internal Error: Kmeans functions not set." );
+        }
+        if( k == 0 || data.size() < k ) {
+            throw std::runtime_error(
+                "Cannot run k-means with k=" + std::to_string( k ) + " on " +
+                std::to_string( data.size() ) + " samples."
+            );
+        }
+        if( mini_batch_size_ > 0 ) {
+            return run_mini_batch_( data, k );
+        }
+
+        auto const init_start = std::chrono::steady_clock::now();
+        initialize_( data, k );
+        auto const init_end = std::chrono::steady_clock::now();
+        init_seconds_ = std::chrono::duration_cast<std::chrono::duration<double>>(
+            init_end - init_start
+        ).count();
+
+        // Lloyd iterations, until the assignments are stable.
+        size_t iteration = 1;
+        for( ; iteration <= max_iterations_; ++iteration ) {
+            if( report_iteration ) {
+                report_iteration( iteration );
+            }
+            auto const changed = lloyd_iteration_( data );
+            if( checkpoint_iteration ) {
+                checkpoint_iteration( iteration, assignments_ );
+            }
+            if( ! changed ) {
+                break;
+            }
+        }
+        iter_seconds_ = std::chrono::duration_cast<std::chrono::duration<double>>(
+            std::chrono::steady_clock::now() - init_end
+        ).count();
+        return std::min( iteration, max_iterations_ );
+    }
+
+    /**
+     * @brief Compute the per-sample distances and per-cluster statistics of the
+     * final clustering, in the format of the genesis Kmeans classes.
+     */
+    genesis::utils::KmeansClusteringInfo cluster_info( std::vector<Point> const& data ) const
+    {
+        auto const k = centroids_.size();
+        auto info = genesis::utils::KmeansClusteringInfo();
+        info.variances = std::vector<double>( k, 0.0 );
+        info.counts    = std::vector<size_t>( k, 0 );
+        info.distances = std::vector<double>( data.size(), 0.0 );
+
+        #pragma omp parallel for schedule(dynamic)
+        for( size_t s = 0; s < data.size(); ++s ) {
+            info.distances[s] = distance_function( data[s], centroids_[ assignments_[s] ] );
+        }
+        for( size_t s = 0; s < data.size(); ++s ) {
+            info.variances[ assignments_[s] ] += info.distances[s] * info.distances[s];
+            info.counts[ assignments_[s] ]    += 1;
+        }
+        for( size_t c = 0; c < k; ++c ) {
+            if( info.counts[c] > 0 ) {
+                info.variances[c] /= static_cast<double>( info.counts[c] );
+            }
+        }
+        return info;
+    }
+
+    std::vector<size_t> const& assignments() const
+    {
+        return assignments_;
+    }
+
+    std::vector<Point> const& centroids() const
+    {
+        return centroids_;
+    }
+
+    // -------------------------------------------------------------------------
+    //     Internal Functions
+    // -------------------------------------------------------------------------
+
+private:
+
+    /**
+     * @brief Mini-batch k-means: per iteration, assign a random batch of samples and
+     * move the affected centroids towards them with decaying per-centroid learning rates.
+     */
+    size_t run_mini_batch_( std::vector<Point> const& data, size_t k )
+    {
+        if( ! blend_function ) {
+            throw std::runtime_error( "Internal Error: Kmeans blend function not set." );
+        }
+        auto engine = std::mt19937( std::random_device{}() );
+        auto const batch_size = std::min( mini_batch_size_, data.size() );
+
+        // Seed the centroids with kmeans++ on a random subsample, so that the
+        // initialization cost does not scale with the full data set either.
+        auto const seed_size = std::min( data.size(), std::max( batch_size, 10 * k ));
+        auto seed_indices = std::vector<size_t>( data.size() );
+        for( size_t s = 0; s < data.size(); ++s ) {
+            seed_indices[s] = s;
+        }
+        std::shuffle( seed_indices.begin(), seed_indices.end(), engine );
+        seed_indices.resize( seed_size );
+        auto seed_data = std::vector<Point>();
+        seed_data.reserve( seed_size );
+        for( auto const si : seed_indices ) {
+            seed_data.push_back( data[si] );
+        }
+
+        // Restrict a warm start to the seeding subsample, and restore it afterwards.
+        auto full_initial = std::move( initial_assignments_ );
+        if( full_initial.size() == data.size() ) {
+            initial_assignments_.resize( seed_size );
+            for( size_t si = 0; si < seed_size; ++si ) {
+                initial_assignments_[si] = full_initial[ seed_indices[si] ];
+            }
+        }
+
+        auto const init_start = std::chrono::steady_clock::now();
+        initialize_( seed_data, k );
+        initial_assignments_ = std::move( full_initial );
+        auto const init_end = std::chrono::steady_clock::now();
+        init_seconds_ = std::chrono::duration_cast<std::chrono::duration<double>>(
+            init_end - init_start
+        ).count();
+
+        // Iterate over random batches. Per-centroid counts give the decaying
+        // learning rate with which each centroid moves towards its batch samples.
+        auto counts = std::vector<size_t>( k, 0 );
+        auto batch = std::vector<size_t>( batch_size );
+        auto batch_assignments = std::vector<size_t>( batch_size );
+        auto index_dist = std::uniform_int_distribution<size_t>( 0, data.size() - 1 );
+        size_t iteration = 1;
+        for( ; iteration <= max_iterations_; ++iteration ) {
+            if( report_iteration ) {
+                report_iteration( iteration );
+            }
+            for( size_t b = 0; b < batch_size; ++b ) {
+                batch[b] = index_dist( engine );
+            }
+
+            // Assign the batch samples to their nearest centroids, in parallel.
+            #pragma omp parallel for schedule(dynamic)
+            for( size_t b = 0; b < batch_size; ++b ) {
+                size_t best_c = 0;
+                double best_d = std::numeric_limits<double>::max();
+                for( size_t c = 0; c < k; ++c ) {
+                    auto const d = distance_function( data[ batch[b] ], centroids_[c] );
+                    if( d < best_d ) {
+                        best_d = d;
+                        best_c = c;
+                    }
+                }
+                batch_assignments[b] = best_c;
+            }
+
+            // Update the centroids towards their batch samples.
+            for( size_t b = 0; b < batch_size; ++b ) {
+                auto const c = batch_assignments[b];
+                ++counts[c];
+                blend_function(
+                    centroids_[c], data[ batch[b] ],
+                    1.0 / static_cast<double>( counts[c] )
+                );
+            }
+        }
+
+        // Final exact assignment of all samples to the resulting centroids.
+        assignments_ = std::vector<size_t>( data.size(), 0 );
+        upper_bound_ = std::vector<double>( data.size(), 0.0 );
+        lower_bound_ = std::vector<double>( data.size(), 0.0 );
+        #pragma omp parallel for schedule(dynamic)
+        for( size_t s = 0; s < data.size(); ++s ) {
+            assign_full_scan_( data, s );
+        }
+        iter_seconds_ = std::chrono::duration_cast<std::chrono::duration<double>>(
+            std::chrono::steady_clock::now() - init_end
+        ).count();
+        return std::min( iteration, max_iterations_ );
+    }
+
+    /**
+     * @brief Kmeans++ initialization: spread the initial centroids out by sampling
+     * points with probability proportional to their squared distance to the
+     * closest centroid chosen so far. Then do one exact full assignment pass
+     * that also establishes the pruning bounds.
+     */
+    void initialize_( std::vector<Point> const& data, size_t k )
+    {
+        auto engine = std::mt19937( std::random_device{}() );
+
+        centroids_.clear();
+        centroids_.reserve( k );
+        auto min_dists = std::vector<double>( data.size(), std::numeric_limits<double>::max() );
+
+        // Warm start: seed the centroids from the clusters of a previous assignment,
+        // see initial_assignments(). Samples without a valid previous cluster are skipped.
+        if( initial_assignments_.size() == data.size() ) {
+            auto members = std::vector<std::vector<size_t>>( k );
+            for( size_t s = 0; s < data.size(); ++s ) {
+                if( initial_assignments_[s] < k ) {
+                    members[ initial_assignments_[s] ].push_back( s );
+                }
+            }
+            for( size_t c = 0; c < k; ++c ) {
+                if( ! members[c].empty() ) {
+                    centroids_.push_back( centroid_function( data, members[c] ));
+                }
+            }
+        }
+
+        // Without warm-started centroids, start from a uniformly random sample.
+        if( centroids_.empty() ) {
+            auto first_dist = std::uniform_int_distribution<size_t>( 0, data.size() - 1 );
+            centroids_.push_back( data[ first_dist( engine ) ] );
+        }
+
+        // Remaining centroids via D^2 sampling. The distance scans against the centroids
+        // not folded into the minima yet are by far the dominant cost of the seeding, and
+        // are independent per sample, so they are distributed across the threads;
+        // the sampling itself is cheap.
+        size_t scanned = 0;
+        while( centroids_.size() < k ) {
+            #pragma omp parallel for schedule(dynamic)
+            for( size_t s = 0; s < data.size(); ++s ) {
+                for( size_t c = scanned; c < centroids_.size(); ++c ) {
+                    auto const d = distance_function( data[s], centroids_[c] );
+                    min_dists[s] = std::min( min_dists[s], d );
+                }
+            }
+            scanned = centroids_.size();
+            auto weights = std::vector<double>( data.size() );
+            for( size_t s = 0; s < data.size(); ++s ) {
+                weights[s] = min_dists[s] * min_dists[s];
+            }
+            auto sample_dist = std::discrete_distribution<size_t>( weights.begin(), weights.end() );
+            centroids_.push_back( data[ sample_dist( engine ) ] );
+        }
+
+        // Exact initial assignment, keeping the distance to the best and second best
+        // centroid per sample as the initial upper and lower pruning bounds.
+        assignments_ = std::vector<size_t>( data.size(), 0 );
+        upper_bound_ = std::vector<double>( data.size(), 0.0 );
+        lower_bound_ = std::vector<double>( data.size(), 0.0 );
+        #pragma omp parallel for schedule(dynamic)
+        for( size_t s = 0; s < data.size(); ++s ) {
+            assign_full_scan_( data, s );
+        }
+    }
+
+    /**
+     * @brief Compute the distances of sample @p s to all centroids, and store
+     * the assignment and the bounds.
+     */
+    void assign_full_scan_( std::vector<Point> const& data, size_t s )
+    {
+        size_t best_c = 0;
+        double best_d = std::numeric_limits<double>::max();
+        double second_d = std::numeric_limits<double>::max();
+        for( size_t c = 0; c < centroids_.size(); ++c ) {
+            auto const d = distance_function( data[s], centroids_[c] );
+            if( d < best_d ) {
+                second_d = best_d;
+                best_d = d;
+                best_c = c;
+            } else if( d < second_d ) {
+                second_d = d;
+            }
+        }
+        assignments_[s] = best_c;
+        upper_bound_[s] = best_d;
+        lower_bound_[s] = second_d;
+    }
+
+    /**
+     * @brief One Lloyd iteration with Hamerly pruning.
+     * Returns whether any sample changed its cluster.
+     */
+    bool lloyd_iteration_( std::vector<Point> const& data )
+    {
+        auto const k = centroids_.size();
+
+        // Half the distance of each centroid to its nearest other centroid.
+        // A sample whose upper bound is below this cannot be closer to any other centroid.
+        auto half_min_dist = std::vector<double>( k, std::numeric_limits<double>::max() );
+        #pragma omp parallel for schedule(dynamic)
+        for( size_t c = 0; c < k; ++c ) {
+            for( size_t o = 0; o < k; ++o ) {
+                if( o == c ) {
+                    continue;
+                }
+                auto const d = distance_function( centroids_[c], centroids_[o] );
+                half_min_dist[c] = std::min( half_min_dist[c], d / 2.0 );
+            }
+        }
+
+        // Assignment step. Samples whose bounds show that they cannot change cluster
+        // are skipped without any distance evaluation; for the others, we first try to
+        // tighten the upper bound with a single evaluation before doing a full scan.
+        int changed = 0;
+        #pragma omp parallel for schedule(dynamic) reduction(|:changed)
+        for( size_t s = 0; s < data.size(); ++s ) {
+            auto const a = assignments_[s];
+            auto const bound = std::max( half_min_dist[a], lower_bound_[s] );
+            if( upper_bound_[s] <= bound ) {
+                continue;
+            }
+            upper_bound_[s] = distance_function( data[s], centroids_[a] );
+            if( upper_bound_[s] <= bound ) {
+                continue;
+            }
+            auto const prev = assignments_[s];
+            assign_full_scan_( data, s );
+            changed |= static_cast<int>( assignments_[s] != prev );
+        }
+
+        // Collect the members of each cluster. Should a cluster have run empty,
+        // give it the sample that is farthest from its current centroid.
+        auto members = cluster_members_( data.size(), k );
+        for( size_t c = 0; c < k; ++c ) {
+            if( ! members[c].empty() ) {
+                continue;
+            }
+            size_t farthest = 0;
+            for( size_t s = 0; s < data.size(); ++s ) {
+                if( upper_bound_[s] > upper_bound_[farthest] ) {
+                    farthest = s;
+                }
+            }
+            assignments_[ farthest ] = c;
+            changed = 1;
+            members = cluster_members_( data.size(), k );
+        }
+
+        // Update step: recompute the centroids, and adjust the bounds by how far
+        // the centroids moved, so that they stay valid for the next iteration.
+        auto new_centroids = std::vector<Point>( k );
+        auto drift = std::vector<double>( k, 0.0 );
+        #pragma omp parallel for schedule(dynamic)
+        for( size_t c = 0; c < k; ++c ) {
+            new_centroids[c] = centroid_function( data, members[c] );
+            drift[c] = distance_function( centroids_[c], new_centroids[c] );
+        }
+        auto const max_drift = *std::max_element( drift.begin(), drift.end() );
+        for( size_t s = 0; s < data.size(); ++s ) {
+            upper_bound_[s] += drift[ assignments_[s] ];
+            lower_bound_[s] -= max_drift;
+        }
+        centroids_ = std::move( new_centroids );
+
+        return changed != 0;
+    }
+
+    std::vector<std::vector<size_t>> cluster_members_( size_t data_size, size_t k ) const
+    {
+        auto members = std::vector<std::vector<size_t>>( k );
+        for( size_t s = 0; s < data_size; ++s ) {
+            members[ assignments_[s] ].push_back( s );
+        }
+        return members;
+    }
+
+    // -------------------------------------------------------------------------
+    //     Internal Members
+    // -------------------------------------------------------------------------
+
+private:
+
+    size_t max_iterations_ = 100;
+    size_t mini_batch_size_ = 0;
+    std::vector<size_t> initial_assignments_;
+
+    double init_seconds_ = 0.0;
+    double iter_seconds_ = 0.0;
+
+    std::vector<Point>  centroids_;
+    std::vector<size_t> assignments_;
+    std::vector<double> upper_bound_;
+    std::vector<double> lower_bound_;
+
+};
+
+// =================================================================================================
+//      Matrix K-Medoids
+// =================================================================================================
+
+/**
+ * @brief K-medoids clustering on a precomputed pairwise distance matrix.
+ *
+ * Counterpart of AcceleratedKmeans for the case where the pairwise distances between all
+ * samples are already known, see the --distance-matrix-file option of the clustering
+ * commands. The cluster centers are samples (medoids) instead of computed centroids, so
+ * no point type or distance function is needed, and each run only reads the given matrix.
+ *
+ * We use Voronoi iteration (alternating between assigning each sample to its nearest
+ * medoid, and moving each medoid to the member of its cluster that minimizes the sum of
+ * distances to the other members), which mirrors the Lloyd iterations of the k-means
+ * classes. The seeding is deterministic: the first medoid is the sample minimizing the
+ * total distance to all others, and the remaining ones are chosen farthest-first, so that
+ * repeated runs over different k (the typical use of cached distance matrices) give
+ * reproducible clusterings.
+ */
+class MatrixKmedoids
+{
+public:
+
+    // -------------------------------------------------------------------------
+    //     Constructor and Rule of Five
+    // -------------------------------------------------------------------------
+
+    MatrixKmedoids()  = default;
+    ~MatrixKmedoids() = default;
+
+    MatrixKmedoids( MatrixKmedoids const& ) = default;
+    MatrixKmedoids( MatrixKmedoids&& )      = default;
+
+    MatrixKmedoids& operator= ( MatrixKmedoids const& ) = default;
+    MatrixKmedoids& operator= ( MatrixKmedoids&& )      = default;
+
+    // -------------------------------------------------------------------------
+    //     Settings
+    // -------------------------------------------------------------------------
+
+    std::function<void( size_t iteration )> report_iteration;
+
+    MatrixKmedoids& max_iterations( size_t value )
+    {
+        max_iterations_ = value;
+        return *this;
+    }
+
+    size_t max_iterations() const
+    {
+        return max_iterations_;
+    }
+
+    /**
+     * @brief Warm-start the clustering from a previous per-sample cluster assignment,
+     * see AcceleratedKmeans::initial_assignments() for the semantics.
+     *
+     * The initial medoids are computed from the given clusters; entries that are not a
+     * valid cluster index mark samples without a previous assignment. Missing clusters
+     * are filled in with farthest-first seeding.
+     */
+    MatrixKmedoids& initial_assignments( std::vector<size_t> value )
+    {
+        initial_assignments_ = std::move( value );
+        return *this;
+    }
+
+    double initialization_seconds() const
+    {
+        return init_seconds_;
+    }
+
+    double iteration_seconds() const
+    {
+        return iter_seconds_;
+    }
+
+    // -------------------------------------------------------------------------
+    //     Run Functions
+    // -------------------------------------------------------------------------
+
+    /**
+     * @brief Run the clustering of the samples of the given square @p distances matrix
+     * into @p k clusters. Returns the number of iterations used.
+     */
+    size_t run( genesis::utils::Matrix<double> const& distances, size_t k )
+    {
+        auto const n = distances.rows();
+        if( distances.cols() != n ) {
+            throw std::runtime_error( "Internal Error: Distance matrix is not square." );
+        }
+        if( k == 0 || n < k ) {
+            throw std::runtime_error(
+                "Cannot run k-medoids with k=" + std::to_string( k ) + " on " +
+                std::to_string( n ) + " samples."
+            );
+        }
+
+        auto const init_start = std::chrono::steady_clock::now();
+        initialize_( distances, k );
+        auto const init_end = std::chrono::steady_clock::now();
+        init_seconds_ = std::chrono::duration_cast<std::chrono::duration<double>>(
+            init_end - init_start
+        ).count();
+
+        // Voronoi iterations, until neither the medoids nor the assignments change.
+        size_t iteration = 1;
+        for( ; iteration <= max_iterations_; ++iteration ) {
+            if( report_iteration ) {
+                report_iteration( iteration );
+            }
+            auto const moved = update_medoids_( distances );
+            auto const changed = assign_( distances );
+            if( ! moved && ! changed ) {
+                break;
+            }
+        }
+        iter_seconds_ = std::chrono::duration_cast<std::chrono::duration<double>>(
+            std::chrono::steady_clock::now() - init_end
+        ).count();
+        return std::min( iteration, max_iterations_ );
+    }
+
+    /**
+     * @brief Compute the per-sample distances and per-cluster statistics of the
+     * final clustering, in the format of the genesis Kmeans classes.
+     */
+    genesis::utils::KmeansClusteringInfo cluster_info(
+        genesis::utils::Matrix<double> const& distances
+    ) const {
+        auto const k = medoids_.size();
+        auto const n = assignments_.size();
+        auto info = genesis::utils::KmeansClusteringInfo();
+        info.variances = std::vector<double>( k, 0.0 );
+        info.counts    = std::vector<size_t>( k, 0 );
+        info.distances = std::vector<double>( n, 0.0 );
+
+        for( size_t s = 0; s < n; ++s ) {
+            info.distances[s] = distances( s, medoids_[ assignments_[s] ] );
+            info.variances[ assignments_[s] ] += info.distances[s] * info.distances[s];
+            info.counts[ assignments_[s] ]    += 1;
+        }
+        for( size_t c = 0; c < k; ++c ) {
+            if( info.counts[c] > 0 ) {
+                info.variances[c] /= static_cast<double>( info.counts[c] );
+            }
+        }
+        return info;
+    }
+
+    std::vector<size_t> const& assignments() const
+    {
+        return assignments_;
+    }
+
+    /**
+     * @brief Sample indices of the cluster centers, one per cluster.
+     */
+    std::vector<size_t> const& medoids() const
+    {
+        return medoids_;
+    }
+
+    // -------------------------------------------------------------------------
+    //     Internal Functions
+    // -------------------------------------------------------------------------
+
+private:
+
+    /**
+     * @brief Seed the medoids, either from a previous assignment or farthest-first,
+     * and do the initial assignment pass.
+     */
+    void initialize_( genesis::utils::Matrix<double> const& distances, size_t k )
+    {
+        auto const n = distances.rows();
+        medoids_.clear();
+        medoids_.reserve( k );
+        auto is_medoid = std::vector<bool>( n, false );
+
+        // Warm start: use the medoids of the clusters of a previous assignment,
+        // see initial_assignments(). Samples without a valid previous cluster are skipped.
+        if( initial_assignments_.size() == n ) {
+            auto members = std::vector<std::vector<size_t>>( k );
+            for( size_t s = 0; s < n; ++s ) {
+                if( initial_assignments_[s] < k ) {
+                    members[ initial_assignments_[s] ].push_back( s );
+                }
+            }
+            for( size_t c = 0; c < k; ++c ) {
+                if( ! members[c].empty() ) {
+                    auto const m = cluster_medoid_( distances, members[c] );
+                    medoids_.push_back( m );
+                    is_medoid[m] = true;
+                }
+            }
+        }
+
+        // Without warm-started medoids, start from the most central sample.
+        if( medoids_.empty() ) {
+            size_t best_s = 0;
+            double best_sum = std::numeric_limits<double>::max();
+            for( size_t s = 0; s < n; ++s ) {
+                double sum = 0.0;
+                for( size_t j = 0; j < n; ++j ) {
+                    sum += distances( s, j );
+                }
+                if( sum < best_sum ) {
+                    best_sum = sum;
+                    best_s = s;
+                }
+            }
+            medoids_.push_back( best_s );
+            is_medoid[ best_s ] = true;
+        }
+
+        // Remaining medoids farthest-first: always add the sample that is farthest
+        // from its nearest already chosen medoid, which spreads the seeds out.
+        while( medoids_.size() < k ) {
+            size_t best_s = 0;
+            double best_d = - std::numeric_limits<double>::max();
+            for( size_t s = 0; s < n; ++s ) {
+                if( is_medoid[s] ) {
+                    continue;
+                }
+                double min_d = std::numeric_limits<double>::max();
+                for( auto const m : medoids_ ) {
+                    min_d = std::min( min_d, distances( s, m ));
+                }
+                if( min_d > best_d ) {
+                    best_d = min_d;
+                    best_s = s;
+                }
+            }
+            medoids_.push_back( best_s );
+            is_medoid[ best_s ] = true;
+        }
+
+        assignments_ = std::vector<size_t>( n, 0 );
+        assign_( distances );
+    }
+
+    /**
+     * @brief Assign every sample to its nearest medoid.
+     * Returns whether any sample changed its cluster.
+     */
+    bool assign_( genesis::utils::Matrix<double> const& distances )
+    {
+        auto const n = assignments_.size();
+        int changed = 0;
+        #pragma omp parallel for schedule(static) reduction(|:changed)
+        for( size_t s = 0; s < n; ++s ) {
+            size_t best_c = 0;
+            double best_d = std::numeric_limits<double>::max();
+            for( size_t c = 0; c < medoids_.size(); ++c ) {
+                auto const d = distances( s, medoids_[c] );
+                if( d < best_d ) {
+                    best_d = d;
+                    best_c = c;
+                }
+            }
+            changed |= static_cast<int>( assignments_[s] != best_c );
+            assignments_[s] = best_c;
+        }
+        return changed != 0;
+    }
+
+    /**
+     * @brief Move each medoid to the best member of its cluster.
+     * Returns whether any medoid changed.
+     */
+    bool update_medoids_( genesis::utils::Matrix<double> const& distances )
+    {
+        auto const k = medoids_.size();
+        auto const n = assignments_.size();
+
+        // Collect the members of each cluster. Should a cluster have run empty,
+        // give it the sample that is farthest from its current medoid.
+        auto members = std::vector<std::vector<size_t>>( k );
+        for( size_t s = 0; s < n; ++s ) {
+            members[ assignments_[s] ].push_back( s );
+        }
+        for( size_t c = 0; c < k; ++c ) {
+            if( ! members[c].empty() ) {
+                continue;
+            }
+            size_t farthest = 0;
+            double farthest_d = - std::numeric_limits<double>::max();
+            for( size_t s = 0; s < n; ++s ) {
+                auto const d = distances( s, medoids_[ assignments_[s] ] );
+                if( d > farthest_d ) {
+                    farthest_d = d;
+                    farthest = s;
+                }
+            }
+            assignments_[ farthest ] = c;
+            members = std::vector<std::vector<size_t>>( k );
+            for( size_t s = 0; s < n; ++s ) {
+                members[ assignments_[s] ].push_back( s );
+            }
+        }
+
+        int moved = 0;
+        #pragma omp parallel for schedule(dynamic) reduction(|:moved)
+        for( size_t c = 0; c < k; ++c ) {
+            auto const m = cluster_medoid_( distances, members[c] );
+            moved |= static_cast<int>( m != medoids_[c] );
+            medoids_[c] = m;
+        }
+        return moved != 0;
+    }
+
+    /**
+     * @brief Member of a cluster that minimizes the sum of distances to the other members.
+     */
+    size_t cluster_medoid_(
+        genesis::utils::Matrix<double> const& distances,
+        std::vector<size_t> const& members
+    ) const {
+        assert( ! members.empty() );
+        size_t best_s = members[0];
+        double best_sum = std::numeric_limits<double>::max();
+        for( auto const s : members ) {
+            double sum = 0.0;
+            for( auto const o : members ) {
+                sum += distances( s, o );
+            }
+            if( sum < best_sum ) {
+                best_sum = sum;
+                best_s = s;
+            }
+        }
+        return best_s;
+    }
+
+    // -------------------------------------------------------------------------
+    //     Internal Members
+    // -------------------------------------------------------------------------
+
+private:
+
+    size_t max_iterations_ = 100;
+    std::vector<size_t> initial_assignments_;
+
+    double init_seconds_ = 0.0;
+    double iter_seconds_ = 0.0;
+
+    std::vector<size_t> medoids_;
+    std::vector<size_t> assignments_;
+
+};
+
+#endif // include guard
@@ -25,11 +25,19 @@
 
 #include "genesis/utils/core/info.hpp"
 #include "genesis/utils/core/options.hpp"
+#include "genesis/utils/formats/csv/reader.hpp"
+#include "genesis/utils/io/input_source.hpp"
 #include "genesis/utils/text/string.hpp"
 
 #include <cmath>
+#include <cstdint>
 #include <cstdlib>
 #include <stdexcept>
+#include <unordered_map>
+
+#ifdef __linux__
+#   include <sys/mman.h>
+#endif
 
 // =================================================================================================
 //      Legacy Commands
@@ -115,6 +123,62 @@ void write_columns(
     out << "\n";
 }
 
+// =================================================================================================
+//      Sample Pair Lists
+// =================================================================================================
+
+std::vector<std::pair<size_t, size_t>> read_sample_pairs(
+    std::string const& option_name,
+    std::string const& path,
+    std::vector<std::string> const& names
+) {
+    using namespace genesis::utils;
+
+    // Index of the sample names for the name lookups.
+    std::unordered_map<std::string, size_t> name_index;
+    for( size_t i = 0; i < names.size(); ++i ) {
+        name_index[ names[i] ] = i;
+    }
+    auto look_up = [&]( std::string const& name ){
+        auto const it = name_index.find( name );
+        if( it == name_index.end() ) {
+            throw CLI::ValidationError(
+                option_name + " (" + path + ")",
+                "Sample name '" + name + "' is not among the input samples. The names need "
+                "to be the base file names of the samples, without directory and extensions."
+            );
+        }
+        return it->second;
+    };
+
+    // Read the file line by line, that is, pair by pair.
+    auto reader = CsvReader();
+    reader.separator_chars( ",\t" );
+    auto const table = reader.read( from_file( path ));
+
+    std::vector<std::pair<size_t, size_t>> result;
+    result.reserve( table.size() );
+    for( auto const& line : table ) {
+        if( line.empty() || ( line.size() == 1 && line[0].empty() )) {
+            continue;
+        }
+        if( line.size() != 2 ) {
+            throw CLI::ValidationError(
+                option_name + " (" + path + ")",
+                "Invalid pair list. Needs to contain two tab- or comma-separated "
+                "sample names per line."
+            );
+        }
+        result.emplace_back( look_up( line[0] ), look_up( line[1] ));
+    }
+    if( result.empty() ) {
+        throw CLI::ValidationError(
+            option_name + " (" + path + ")", "No sample pairs found."
+        );
+    }
+    return result;
+}
+
 // =================================================================================================
 //      Misc
 // =================================================================================================
@@ -141,3 +205,43 @@ std::string random_indexed_name( size_t index, size_t max )
     }
     return result;
 }
+
+void advise_huge_pages( void const* data, size_t bytes )
+{
+    #if defined( __linux__ )
+
+        if( ! global_options.huge_pages() ) {
+            return;
+        }
+        if( data == nullptr || bytes < huge_pages_threshold ) {
+            return;
+        }
+
+        // The advice needs page-aligned addresses, and only fully covered 2 MB regions
+        // can be collapsed into huge pages, so we shrink the range inward to the
+        // enclosed 2 MB-aligned part. For the multi-GB matrices that we call this on,
+        // the up to 4 MB of normal pages at the edges do not matter.
+        auto const huge  = static_cast<uintptr_t>( 2 * 1024 * 1024 );
+        auto const addr  = reinterpret_cast<uintptr_t>( data );
+        auto const begin = ( addr + huge - 1 ) / huge * huge;
+        auto const last  = ( addr + bytes ) / huge * huge;
+        if( last <= begin ) {
+            return;
+        }
+
+        // Best-effort: if the kernel does not support transparent huge pages,
+        // or declines the advice, we simply keep running on normal pages.
+        ::madvise(
+            reinterpret_cast<void*>( begin ),
+            static_cast<size_t>( last - begin ),
+            MADV_HUGEPAGE
+        );
+
+    #else
+
+        // No transparent huge pages on this platform; the option help says Linux only.
+        (void) data;
+        (void) bytes;
+
+    #endif
+}
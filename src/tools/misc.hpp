@@ -26,9 +26,14 @@
 
 #include "CLI/CLI.hpp"
 
+#include "options/global.hpp"
+
 #include <iosfwd>
 #include <string>
 #include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 // =================================================================================================
 //      Legacy Commands
@@ -67,12 +72,79 @@ void write_columns(
     size_t right_width
 );
 
+// =================================================================================================
+//      Sample Pair Lists
+// =================================================================================================
+
+/**
+ * @brief Read a file listing pairs of sample names, and resolve them against the given
+ * sample names, see the `--pairs` option of the pairwise distance commands.
+ *
+ * The file needs one pair per line, given as two tab- or comma-separated sample names,
+ * using the base file names of the input samples (without directory and extensions).
+ * Returns the pairs as index pairs into @p names, in the order of the file.
+ * Empty lines are skipped; malformed lines and unknown names cause an error that
+ * reports the given @p option_name.
+ */
+std::vector<std::pair<size_t, size_t>> read_sample_pairs(
+    std::string const& option_name,
+    std::string const& path,
+    std::vector<std::string> const& names
+);
+
 // =================================================================================================
 //      Misc
 // =================================================================================================
 
 std::string random_indexed_name( size_t index, size_t max );
 
+/**
+ * @brief Destroy an object on a background thread, leaving the given instance empty.
+ *
+ * Tearing down large data structures such as a Sample with millions of pqueries means
+ * freeing millions of small allocations, which can take a substantial amount of time.
+ * This helper moves the object out and runs its destructor on the global background
+ * thread pool, so that per-file loops can start reading the next file while the previous
+ * one is being freed. If the task cannot be enqueued, the object is destroyed inline.
+ */
+template<class T>
+void dispose_async( T& object )
+{
+    using U = typename std::decay<T>::type;
+    auto ptr = new U( std::move( object ));
+    try {
+        global_options.thread_pool().enqueue( [ptr](){ delete ptr; } );
+    } catch( ... ) {
+        delete ptr;
+    }
+}
+
+/**
+ * @brief Size threshold in bytes above which advise_huge_pages() applies its advice.
+ *
+ * Small allocations do not suffer measurable TLB pressure, and the kernel rounds the
+ * advice to whole 2 MB regions anyway, so we only bother for matrices of 16 MB or more.
+ */
+constexpr size_t huge_pages_threshold = 16ull * 1024 * 1024;
+
+/**
+ * @brief Advise the kernel to back the given allocation with 2 MB transparent huge pages,
+ * if the --huge-pages option is set, see GlobalOptions.
+ *
+ * Dense row sweeps over multi-GB matrices, such as the distance matrices of krd and the
+ * placement profile matrices, touch a new 4 KB page every 512 doubles, and the resulting
+ * TLB misses are a measurable part of their runtime. Huge pages cut the number of TLB
+ * entries needed by a factor of 512. The genesis Matrix class allocates through
+ * std::vector, so we cannot swap in a custom allocator; instead, this helper is called
+ * on the finished allocation and uses `madvise( MADV_HUGEPAGE )` on the 2 MB-aligned
+ * interior of the range, which lets the kernel collapse the pages in place.
+ *
+ * The call is best-effort: it does nothing if the option is not set, if the range is
+ * smaller than huge_pages_threshold, or on platforms without transparent huge pages.
+ * Errors from the advice are ignored, as they only mean that the kernel declined it.
+ */
+void advise_huge_pages( void const* data, size_t bytes );
+
 /**
  * @brief Alternative for normal `assert()` that allows to specify an error message,
  * throws an exception instead of terminating, and is always used, also in release mode.
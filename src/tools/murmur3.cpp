@@ -0,0 +1,219 @@
+/*
+    gappa - Genesis Applications for Phylogenetic Placement Analysis
+    Copyright (C) 2017-2024 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+#include "tools/murmur3.hpp"
+
+#include <cassert>
+#include <cstring>
+#include <stdexcept>
+
+// =================================================================================================
+//      Internal Helper Functions
+// =================================================================================================
+
+/**
+ * @brief Load a 64 bit little endian word from a byte buffer.
+ *
+ * We go through memcpy to avoid alignment issues; compilers turn this into a single load.
+ */
+static inline uint64_t murmur3_load_64_( unsigned char const* data )
+{
+    uint64_t result;
+    std::memcpy( &result, data, sizeof( result ));
+    return result;
+}
+
+static inline uint64_t murmur3_rotl_64_( uint64_t value, int shift )
+{
+    return ( value << shift ) | ( value >> ( 64 - shift ));
+}
+
+/**
+ * @brief Final avalanche mix of MurmurHash3.
+ */
+static inline uint64_t murmur3_fmix_64_( uint64_t k )
+{
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdull;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ull;
+    k ^= k >> 33;
+    return k;
+}
+
+// =================================================================================================
+//      Murmur3 Hash
+// =================================================================================================
+
+Murmur3::DigestType Murmur3::read_digest(
+    std::shared_ptr<genesis::utils::BaseInputSource> source
+) {
+    // The x64 128 bit variant of MurmurHash3 is a block hash, not a stream hash: the tail
+    // handling needs the total length. So we simply pull all data from the source first.
+    // The sequences that we hash easily fit in memory anyway.
+    std::string data;
+    char buffer[ 16384 ];
+    while( true ) {
+        auto const got = source->read( buffer, sizeof( buffer ));
+        data.append( buffer, got );
+        if( got < sizeof( buffer )) {
+            break;
+        }
+    }
+    return string_digest( data );
+}
+
+Murmur3::DigestType Murmur3::string_digest( std::string const& data )
+{
+    // MurmurHash3, x64 variant, 128 bit output, by Austin Appleby, who placed it in the
+    // public domain. This follows the reference implementation, with a fixed zero seed,
+    // restructured to our conventions.
+    auto const* bytes = reinterpret_cast<unsigned char const*>( data.data() );
+    auto const len = data.size();
+    auto const num_blocks = len / 16;
+
+    uint64_t h1 = 0;
+    uint64_t h2 = 0;
+
+    uint64_t const c1 = 0x87c37b91114253d5ull;
+    uint64_t const c2 = 0x4cf5ad432745937full;
+
+    // Body: process all full 16 byte blocks.
+    for( size_t i = 0; i < num_blocks; ++i ) {
+        uint64_t k1 = murmur3_load_64_( bytes + i * 16 );
+        uint64_t k2 = murmur3_load_64_( bytes + i * 16 + 8 );
+
+        k1 *= c1;
+        k1  = murmur3_rotl_64_( k1, 31 );
+        k1 *= c2;
+        h1 ^= k1;
+
+        h1  = murmur3_rotl_64_( h1, 27 );
+        h1 += h2;
+        h1  = h1 * 5 + 0x52dce729;
+
+        k2 *= c2;
+        k2  = murmur3_rotl_64_( k2, 33 );
+        k2 *= c1;
+        h2 ^= k2;
+
+        h2  = murmur3_rotl_64_( h2, 31 );
+        h2 += h1;
+        h2  = h2 * 5 + 0x38495ab5;
+    }
+
+    // Tail: process the remaining up to 15 bytes.
+    auto const* tail = bytes + num_blocks * 16;
+    uint64_t k1 = 0;
+    uint64_t k2 = 0;
+    switch( len & 15 ) {
+        case 15: k2 ^= static_cast<uint64_t>( tail[14] ) << 48; // fallthrough
+        case 14: k2 ^= static_cast<uint64_t>( tail[13] ) << 40; // fallthrough
+        case 13: k2 ^= static_cast<uint64_t>( tail[12] ) << 32; // fallthrough
+        case 12: k2 ^= static_cast<uint64_t>( tail[11] ) << 24; // fallthrough
+        case 11: k2 ^= static_cast<uint64_t>( tail[10] ) << 16; // fallthrough
+        case 10: k2 ^= static_cast<uint64_t>( tail[ 9] ) <<  8; // fallthrough
+        case  9: k2 ^= static_cast<uint64_t>( tail[ 8] );
+                 k2 *= c2;
+                 k2  = murmur3_rotl_64_( k2, 33 );
+                 k2 *= c1;
+                 h2 ^= k2;
+                 // fallthrough
+        case  8: k1 ^= static_cast<uint64_t>( tail[ 7] ) << 56; // fallthrough
+        case  7: k1 ^= static_cast<uint64_t>( tail[ 6] ) << 48; // fallthrough
+        case  6: k1 ^= static_cast<uint64_t>( tail[ 5] ) << 40; // fallthrough
+        case  5: k1 ^= static_cast<uint64_t>( tail[ 4] ) << 32; // fallthrough
+        case  4: k1 ^= static_cast<uint64_t>( tail[ 3] ) << 24; // fallthrough
+        case  3: k1 ^= static_cast<uint64_t>( tail[ 2] ) << 16; // fallthrough
+        case  2: k1 ^= static_cast<uint64_t>( tail[ 1] ) <<  8; // fallthrough
+        case  1: k1 ^= static_cast<uint64_t>( tail[ 0] );
+                 k1 *= c1;
+                 k1  = murmur3_rotl_64_( k1, 31 );
+                 k1 *= c2;
+                 h1 ^= k1;
+                 // fallthrough
+        case  0: break;
+    }
+
+    // Finalization.
+    h1 ^= static_cast<uint64_t>( len );
+    h2 ^= static_cast<uint64_t>( len );
+    h1 += h2;
+    h2 += h1;
+    h1  = murmur3_fmix_64_( h1 );
+    h2  = murmur3_fmix_64_( h2 );
+    h1 += h2;
+    h2 += h1;
+
+    DigestType result;
+    result.h1 = h1;
+    result.h2 = h2;
+    return result;
+}
+
+std::string Murmur3::digest_to_hex( DigestType const& digest )
+{
+    static char const hex_digits[] = "0123456789abcdef";
+
+    std::string result;
+    result.reserve( 32 );
+    for( int shift = 60; shift >= 0; shift -= 4 ) {
+        result += hex_digits[ ( digest.h1 >> shift ) & 0xf ];
+    }
+    for( int shift = 60; shift >= 0; shift -= 4 ) {
+        result += hex_digits[ ( digest.h2 >> shift ) & 0xf ];
+    }
+    assert( result.size() == 32 );
+    return result;
+}
+
+Murmur3::DigestType Murmur3::hex_to_digest( std::string const& hex )
+{
+    if( hex.size() != 32 ) {
+        throw std::runtime_error( "Invalid MurmurHash3 hex digest: " + hex );
+    }
+
+    auto parse_half = [&]( size_t offset ){
+        uint64_t value = 0;
+        for( size_t i = offset; i < offset + 16; ++i ) {
+            auto const c = hex[i];
+            uint64_t nibble;
+            if( c >= '0' && c <= '9' ) {
+                nibble = c - '0';
+            } else if( c >= 'a' && c <= 'f' ) {
+                nibble = c - 'a' + 10;
+            } else if( c >= 'A' && c <= 'F' ) {
+                nibble = c - 'A' + 10;
+            } else {
+                throw std::runtime_error( "Invalid MurmurHash3 hex digest: " + hex );
+            }
+            value = ( value << 4 ) | nibble;
+        }
+        return value;
+    };
+
+    DigestType result;
+    result.h1 = parse_half( 0 );
+    result.h2 = parse_half( 16 );
+    return result;
+}
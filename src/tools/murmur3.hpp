@@ -0,0 +1,124 @@
+#ifndef GAPPA_TOOLS_MURMUR3_H_
+#define GAPPA_TOOLS_MURMUR3_H_
+
+/*
+    gappa - Genesis Applications for Phylogenetic Placement Analysis
+    Copyright (C) 2017-2024 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+#include "genesis/utils/io/input_source.hpp"
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+// =================================================================================================
+//      Murmur3 Hash
+// =================================================================================================
+
+/**
+ * @brief Compute 128 bit MurmurHash3 (x64 variant) hashes.
+ *
+ * This is a fast non-cryptographic hash function, for use cases such as deduplicating sequences,
+ * where we only need well-distributed, collision-resistant keys, but no cryptographic guarantees.
+ * It processes input at a few bytes per cycle, instead of the few cycles per byte that the
+ * cryptographic hashes take, which matters when hashing billions of short reads.
+ *
+ * The class mimics the static interface of the genesis hash classes (MD5, SHA1, SHA256),
+ * so that it can be used as a drop-in alternative in the templated hashing commands.
+ */
+class Murmur3
+{
+public:
+
+    // -------------------------------------------------------------------------
+    //     Member Types
+    // -------------------------------------------------------------------------
+
+    /**
+     * @brief The 128 bit digest, as two 64 bit halves.
+     */
+    struct DigestType
+    {
+        uint64_t h1 = 0;
+        uint64_t h2 = 0;
+    };
+
+    // -------------------------------------------------------------------------
+    //     Static Functions
+    // -------------------------------------------------------------------------
+
+    /**
+     * @brief Read all data from an input source and return its digest.
+     */
+    static DigestType read_digest(
+        std::shared_ptr<genesis::utils::BaseInputSource> source
+    );
+
+    /**
+     * @brief Compute the digest of a string of data.
+     */
+    static DigestType string_digest( std::string const& data );
+
+    /**
+     * @brief Return the hex representation of a digest, as 32 lowercase hex digits.
+     */
+    static std::string digest_to_hex( DigestType const& digest );
+
+    /**
+     * @brief Parse the hex representation of a digest, as produced by digest_to_hex().
+     */
+    static DigestType hex_to_digest( std::string const& hex );
+};
+
+// =================================================================================================
+//      Comparison and Hashing Operators
+// =================================================================================================
+
+inline bool operator == ( Murmur3::DigestType const& lhs, Murmur3::DigestType const& rhs )
+{
+    return lhs.h1 == rhs.h1 && lhs.h2 == rhs.h2;
+}
+
+inline bool operator != ( Murmur3::DigestType const& lhs, Murmur3::DigestType const& rhs )
+{
+    return !( lhs == rhs );
+}
+
+namespace std
+{
+    /**
+     * @brief Hash function for Murmur3 digests, so that they can be used as keys in hash maps.
+     *
+     * The digest bits are already well mixed, so combining the two halves is enough here.
+     */
+    template<>
+    struct hash<Murmur3::DigestType>
+    {
+        size_t operator()( Murmur3::DigestType const& digest ) const
+        {
+            return static_cast<size_t>( digest.h1 ^ ( digest.h2 * 0x9e3779b97f4a7c15ull ));
+        }
+    };
+}
+
+#endif // include guard
@@ -0,0 +1,425 @@
+/*
+    gappa - Genesis Applications for Phylogenetic Placement Analysis
+    Copyright (C) 2017-2024 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+#include "tools/name_matcher.hpp"
+
+#include "genesis/utils/core/fs.hpp"
+
+#include <cassert>
+#include <cctype>
+#include <cstring>
+#include <deque>
+
+// =================================================================================================
+//      Pattern Classification
+// =================================================================================================
+
+/**
+ * @brief Classification of one alternation branch of a pattern.
+ */
+struct BranchSpec
+{
+    enum class Kind
+    {
+        kExact,
+        kPrefix,
+        kSubstring,
+
+        /**
+         * @brief The branch is not a plain literal form; the whole pattern needs `std::regex`.
+         */
+        kRegex
+    };
+
+    Kind kind = Kind::kRegex;
+    std::string literal;
+};
+
+/**
+ * @brief If the whole pattern is wrapped in a single group, e.g., `(a|b)` or `(?:a|b)`,
+ * strip the group, so that the alternation inside can be classified.
+ */
+static void strip_enclosing_group_( std::string& spec )
+{
+    if( spec.size() < 2 || spec.front() != '(' || spec.back() != ')' ) {
+        return;
+    }
+
+    // The closing paren at the end has to belong to the opening one at the front,
+    // that is, the nesting depth must not reach zero anywhere in between.
+    size_t depth = 0;
+    for( size_t i = 0; i < spec.size(); ++i ) {
+        auto const c = spec[i];
+        if( c == '\\' ) {
+            ++i;
+            continue;
+        }
+        if( c == '(' ) {
+            ++depth;
+        } else if( c == ')' ) {
+            assert( depth > 0 );
+            --depth;
+            if( depth == 0 && i + 1 < spec.size() ) {
+                return;
+            }
+        }
+    }
+    if( depth != 0 ) {
+        return;
+    }
+
+    spec = spec.substr( 1, spec.size() - 2 );
+    if( spec.compare( 0, 2, "?:" ) == 0 ) {
+        spec = spec.substr( 2 );
+    }
+}
+
+/**
+ * @brief Split a pattern at its top-level alternations. Returns false if the pattern
+ * contains groups or character classes, which we leave to the regex engine.
+ */
+static bool split_alternation_( std::string const& spec, std::vector<std::string>& branches )
+{
+    std::string current;
+    for( size_t i = 0; i < spec.size(); ++i ) {
+        auto const c = spec[i];
+        if( c == '\\' && i + 1 < spec.size() ) {
+            current += c;
+            current += spec[ i + 1 ];
+            ++i;
+            continue;
+        }
+        if( c == '(' || c == '[' ) {
+            return false;
+        }
+        if( c == '|' ) {
+            branches.push_back( current );
+            current.clear();
+            continue;
+        }
+        current += c;
+    }
+    branches.push_back( current );
+    return true;
+}
+
+/**
+ * @brief Classify one alternation branch as exact literal, literal prefix (`abc.*`),
+ * literal substring (`.*abc.*`), or as needing the regex engine.
+ */
+static BranchSpec classify_branch_( std::string const& branch )
+{
+    BranchSpec result;
+    auto const size = branch.size();
+
+    size_t i = 0;
+    bool leading_any  = false;
+    bool trailing_any = false;
+    if( size >= 2 && branch[0] == '.' && branch[1] == '*' ) {
+        leading_any = true;
+        i = 2;
+    }
+
+    while( i < size ) {
+        auto const c = branch[i];
+        if( c == '\\' ) {
+            if( i + 1 >= size ) {
+                return result;
+            }
+            auto const escaped = branch[ i + 1 ];
+
+            // Escaped metacharacters such as `\.` are literals; class escapes such as
+            // `\d` or `\w` are not, and need the regex engine.
+            if( std::isalnum( static_cast<unsigned char>( escaped )) ) {
+                return result;
+            }
+            result.literal += escaped;
+            i += 2;
+            continue;
+        }
+        if( c == '.' && i + 2 == size && branch[ i + 1 ] == '*' ) {
+            trailing_any = true;
+            break;
+        }
+        if( std::strchr( ".^$*+?()[]{}|", c )) {
+            return result;
+        }
+        result.literal += c;
+        ++i;
+    }
+
+    // An empty literal (e.g., a branch that is just `.*`) is left to the regex engine;
+    // such patterns match everything anyway and are not worth special structures.
+    // A leading `.*` without a trailing one is a suffix pattern, which none of our
+    // structures covers, so that also goes to the regex engine.
+    if( result.literal.empty() || ( leading_any && ! trailing_any )) {
+        return result;
+    }
+
+    if( leading_any && trailing_any ) {
+        result.kind = BranchSpec::Kind::kSubstring;
+    } else if( trailing_any ) {
+        result.kind = BranchSpec::Kind::kPrefix;
+    } else {
+        result.kind = BranchSpec::Kind::kExact;
+    }
+    return result;
+}
+
+// =================================================================================================
+//      Name Matcher
+// =================================================================================================
+
+// -------------------------------------------------------------------------
+//     Factories
+// -------------------------------------------------------------------------
+
+NameMatcher NameMatcher::from_file( std::string const& path )
+{
+    using namespace genesis::utils;
+
+    NameMatcher matcher;
+    matcher.active_ = true;
+    auto const list = file_read_lines( path );
+    matcher.exact_names_ = std::unordered_set<std::string>( list.begin(), list.end() );
+    return matcher;
+}
+
+NameMatcher NameMatcher::from_pattern( std::string const& pattern )
+{
+    NameMatcher matcher;
+    matcher.active_ = true;
+
+    // Try to decompose the pattern into literal branches. If every branch is a plain
+    // literal form, fill the dedicated structures; otherwise, fall back to std::regex
+    // for the whole pattern, preserving its exact semantics.
+    auto spec = pattern;
+    strip_enclosing_group_( spec );
+    std::vector<std::string> branches;
+    bool literal_engine = split_alternation_( spec, branches );
+    if( literal_engine ) {
+        for( auto const& branch : branches ) {
+            auto const classified = classify_branch_( branch );
+            switch( classified.kind ) {
+                case BranchSpec::Kind::kExact: {
+                    matcher.add_exact_( classified.literal );
+                    break;
+                }
+                case BranchSpec::Kind::kPrefix: {
+                    matcher.add_prefix_( classified.literal );
+                    break;
+                }
+                case BranchSpec::Kind::kSubstring: {
+                    matcher.add_substring_( classified.literal );
+                    break;
+                }
+                case BranchSpec::Kind::kRegex: {
+                    literal_engine = false;
+                    break;
+                }
+            }
+            if( ! literal_engine ) {
+                break;
+            }
+        }
+    }
+
+    if( literal_engine ) {
+        matcher.build_automaton_();
+    } else {
+        matcher.exact_names_.clear();
+        matcher.trie_.clear();
+        matcher.automaton_.clear();
+        matcher.use_regex_ = true;
+        matcher.regex_ = std::regex( pattern );
+    }
+    return matcher;
+}
+
+// -------------------------------------------------------------------------
+//     Matching
+// -------------------------------------------------------------------------
+
+bool NameMatcher::matches( std::string const& name ) const
+{
+    if( use_regex_ ) {
+        return std::regex_match( name, regex_ );
+    }
+    if( exact_names_.count( name ) > 0 ) {
+        return true;
+    }
+    if( matches_prefix_( name )) {
+        return true;
+    }
+    return matches_substring_( name );
+}
+
+bool NameMatcher::matches_prefix_( std::string const& name ) const
+{
+    if( trie_.empty() ) {
+        return false;
+    }
+    uint32_t node = 0;
+    for( auto const c : name ) {
+        auto const it = trie_[node].children.find( c );
+        if( it == trie_[node].children.end() ) {
+            return false;
+        }
+        node = it->second;
+        if( trie_[node].terminal ) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool NameMatcher::matches_substring_( std::string const& name ) const
+{
+    if( automaton_.empty() ) {
+        return false;
+    }
+    uint32_t node = 0;
+    for( auto const c : name ) {
+
+        // Follow failure links until a state with a transition for the character is found,
+        // or we are back at the root.
+        while( true ) {
+            auto const it = automaton_[node].children.find( c );
+            if( it != automaton_[node].children.end() ) {
+                node = it->second;
+                break;
+            }
+            if( node == 0 ) {
+                break;
+            }
+            node = automaton_[node].fail;
+        }
+        if( automaton_[node].output ) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// -------------------------------------------------------------------------
+//     Building
+// -------------------------------------------------------------------------
+
+void NameMatcher::add_exact_( std::string const& name )
+{
+    exact_names_.insert( name );
+}
+
+void NameMatcher::add_prefix_( std::string const& prefix )
+{
+    if( trie_.empty() ) {
+        trie_.emplace_back();
+    }
+    uint32_t node = 0;
+    for( auto const c : prefix ) {
+        auto const it = trie_[node].children.find( c );
+        if( it != trie_[node].children.end() ) {
+            node = it->second;
+        } else {
+            trie_.emplace_back();
+            auto const fresh = static_cast<uint32_t>( trie_.size() - 1 );
+            trie_[node].children[c] = fresh;
+            node = fresh;
+        }
+    }
+    trie_[node].terminal = true;
+}
+
+void NameMatcher::add_substring_( std::string const& needle )
+{
+    if( automaton_.empty() ) {
+        automaton_.emplace_back();
+    }
+    uint32_t node = 0;
+    for( auto const c : needle ) {
+        auto const it = automaton_[node].children.find( c );
+        if( it != automaton_[node].children.end() ) {
+            node = it->second;
+        } else {
+            automaton_.emplace_back();
+            auto const fresh = static_cast<uint32_t>( automaton_.size() - 1 );
+            automaton_[node].children[c] = fresh;
+            node = fresh;
+        }
+    }
+    automaton_[node].output = true;
+}
+
+void NameMatcher::build_automaton_()
+{
+    if( automaton_.empty() ) {
+        return;
+    }
+
+    // Standard breadth-first construction of the failure links. A node inherits the
+    // output flag of its failure target, so that patterns that are suffixes of other
+    // patterns are found without walking the failure chain at match time.
+    std::deque<uint32_t> queue;
+    for( auto const& child : automaton_[0].children ) {
+        automaton_[ child.second ].fail = 0;
+        queue.push_back( child.second );
+    }
+    while( ! queue.empty() ) {
+        auto const node = queue.front();
+        queue.pop_front();
+        automaton_[node].output |= automaton_[ automaton_[node].fail ].output;
+
+        for( auto const& child : automaton_[node].children ) {
+            auto const c = child.first;
+            auto const v = child.second;
+            auto f = automaton_[node].fail;
+            while( true ) {
+                auto const it = automaton_[f].children.find( c );
+                if( it != automaton_[f].children.end() ) {
+                    automaton_[v].fail = it->second;
+                    break;
+                }
+                if( f == 0 ) {
+                    automaton_[v].fail = 0;
+                    break;
+                }
+                f = automaton_[f].fail;
+            }
+            queue.push_back( v );
+        }
+    }
+}
+
+// =================================================================================================
+//      Factory Function
+// =================================================================================================
+
+NameMatcher make_name_matcher( std::string const& value )
+{
+    using namespace genesis::utils;
+
+    if( is_file( value )) {
+        return NameMatcher::from_file( value );
+    }
+    return NameMatcher::from_pattern( value );
+}
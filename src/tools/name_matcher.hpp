@@ -0,0 +1,156 @@
+#ifndef GAPPA_TOOLS_NAME_MATCHER_H_
+#define GAPPA_TOOLS_NAME_MATCHER_H_
+
+/*
+    gappa - Genesis Applications for Phylogenetic Placement Analysis
+    Copyright (C) 2017-2024 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+#include <cstdint>
+#include <regex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// =================================================================================================
+//      Name Matcher
+// =================================================================================================
+
+/**
+ * @brief Match names against a user-provided filter spec, such as the `--keep-names` and
+ * `--remove-names` options of the `edit filter` command.
+ *
+ * The spec is either a file with one name per line, or a regular expression. Evaluating a
+ * general regex per name is fine for hand-written patterns, but becomes the bottleneck when
+ * users provide generated keep-lists with hundreds of thousands of names as one giant
+ * alternation. For such specs, we hence build dedicated matching structures instead of
+ * handing them to `std::regex`:
+ *
+ *   * Plain literal names (from a file, or alternation branches without any regex
+ *     metacharacters, e.g., `nameA|nameB`) go into a flat hash set, giving one lookup
+ *     per name instead of one pattern evaluation per alternation branch.
+ *   * Literal prefixes (branches of the form `abc.*`) go into a trie, so that all
+ *     prefixes are tested in a single walk over the name.
+ *   * Literal substrings (branches of the form `.*abc.*`) go into an Aho-Corasick
+ *     automaton, which scans the name once for all substrings simultaneously.
+ *
+ * The engine is selected automatically from the spec via make_name_matcher(). Any spec
+ * (or alternation branch) that does not fall into the above forms makes the matcher fall
+ * back to `std::regex` for the whole spec, so that the matching semantics of arbitrary
+ * patterns are always preserved. As before, patterns have to match the whole name,
+ * equivalent to `std::regex_match`.
+ */
+class NameMatcher
+{
+public:
+
+    // -------------------------------------------------------------------------
+    //     Constructors and Factories
+    // -------------------------------------------------------------------------
+
+    NameMatcher() = default;
+
+    /**
+     * @brief Build a matcher from a file with one name per line, using exact hash lookup.
+     */
+    static NameMatcher from_file( std::string const& path );
+
+    /**
+     * @brief Build a matcher from a pattern, picking the matching structures
+     * automatically as described in the class description.
+     */
+    static NameMatcher from_pattern( std::string const& pattern );
+
+    // -------------------------------------------------------------------------
+    //     Matching
+    // -------------------------------------------------------------------------
+
+    /**
+     * @brief Return whether this matcher was set up with a filter spec at all.
+     */
+    bool active() const
+    {
+        return active_;
+    }
+
+    /**
+     * @brief Return whether the given name matches the filter spec.
+     */
+    bool matches( std::string const& name ) const;
+
+    // -------------------------------------------------------------------------
+    //     Internal Members
+    // -------------------------------------------------------------------------
+
+private:
+
+    /**
+     * @brief Node of the prefix trie. Children are sparse, as name alphabets usually are.
+     */
+    struct TrieNode
+    {
+        std::unordered_map<char, uint32_t> children;
+        bool terminal = false;
+    };
+
+    /**
+     * @brief Node of the Aho-Corasick automaton for substring patterns.
+     */
+    struct AcNode
+    {
+        std::unordered_map<char, uint32_t> children;
+        uint32_t fail = 0;
+        bool output = false;
+    };
+
+    void add_exact_( std::string const& name );
+    void add_prefix_( std::string const& prefix );
+    void add_substring_( std::string const& needle );
+
+    /**
+     * @brief Finalize the Aho-Corasick automaton by computing its failure links.
+     */
+    void build_automaton_();
+
+    bool matches_prefix_( std::string const& name ) const;
+    bool matches_substring_( std::string const& name ) const;
+
+    bool active_    = false;
+    bool use_regex_ = false;
+
+    std::unordered_set<std::string> exact_names_;
+    std::vector<TrieNode> trie_;
+    std::vector<AcNode> automaton_;
+    std::regex regex_;
+};
+
+// =================================================================================================
+//      Factory Function
+// =================================================================================================
+
+/**
+ * @brief Prepare a NameMatcher from a user-provided option value,
+ * which is either a file with one name per line, or a pattern.
+ */
+NameMatcher make_name_matcher( std::string const& value );
+
+#endif // include guard
@@ -0,0 +1,321 @@
+/*
+    gappa - Genesis Applications for Phylogenetic Placement Analysis
+    Copyright (C) 2017-2024 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+#include "tools/newick_buffer_writer.hpp"
+
+#include "genesis/tree/common_tree/tree.hpp"
+#include "genesis/tree/tree/edge.hpp"
+#include "genesis/tree/tree/link.hpp"
+#include "genesis/tree/tree/node.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cctype>
+#include <cstdio>
+#include <stdexcept>
+#include <vector>
+
+// =================================================================================================
+//      Local Helpers
+// =================================================================================================
+
+/**
+ * @brief Lookup table of characters that are invalid in unquoted Newick node labels,
+ * that is, whitespace and `:;()[],{}` as well as the quotation mark itself.
+ */
+static std::array<bool, 256> make_invalid_newick_char_table_()
+{
+    std::array<bool, 256> table;
+    for( size_t c = 0; c < table.size(); ++c ) {
+        table[c] = ( ! ::isprint(c) )
+            || ::isspace(c)
+            || c == ':'
+            || c == ';'
+            || c == '('
+            || c == ')'
+            || c == '['
+            || c == ']'
+            || c == ','
+            || c == '{'
+            || c == '}'
+            || c == '"'
+        ;
+    }
+    return table;
+}
+
+static std::array<bool, 256> const invalid_newick_char_table_ = make_invalid_newick_char_table_();
+
+// =================================================================================================
+//      Element Formatting
+// =================================================================================================
+
+void NewickBufferWriter::append_label_( std::string& buffer, std::string const& name ) const
+{
+    // Fast path: no invalid characters, append as-is.
+    bool valid = true;
+    for( size_t i = 0; i < name.size(); ++i ) {
+        if( invalid_newick_char_table_[ static_cast<unsigned char>( name[i] ) ] ) {
+            valid = false;
+            break;
+        }
+    }
+    if( valid ) {
+        buffer += name;
+        return;
+    }
+
+    if( quote_invalid_chars_ ) {
+        buffer += '"';
+        buffer += name;
+        buffer += '"';
+    } else {
+        for( size_t i = 0; i < name.size(); ++i ) {
+            auto const c = name[i];
+            if( invalid_newick_char_table_[ static_cast<unsigned char>( c ) ] ) {
+                buffer += '_';
+            } else {
+                buffer += c;
+            }
+        }
+    }
+}
+
+void NewickBufferWriter::append_branch_length_( std::string& buffer, double value ) const
+{
+    // Format directly into a stack buffer, in fixed notation with the given precision,
+    // which is what the genesis writer produces as well. The clamping matches the buffer size,
+    // and any reasonable precision that a user would request.
+    auto const precision = std::min( std::max( branch_length_precision_, 0 ), 48 );
+    char local[ 80 ];
+    auto const len = std::snprintf( local, sizeof( local ), "%.*f", precision, value );
+    if( len < 0 || static_cast<size_t>( len ) >= sizeof( local )) {
+        throw std::runtime_error( "Cannot format branch length for Newick output." );
+    }
+    buffer += ':';
+    buffer.append( local, static_cast<size_t>( len ));
+}
+
+// =================================================================================================
+//      Tree Serialization
+// =================================================================================================
+
+void NewickBufferWriter::write_(
+    genesis::tree::Tree const& tree,
+    std::function<void(
+        std::string&, genesis::tree::TreeNode const&, genesis::tree::TreeEdge const*
+    )> const& element_extras,
+    size_t extra_size_estimate,
+    std::shared_ptr<genesis::utils::BaseOutputTarget> target
+) const {
+    using namespace ::genesis::tree;
+
+    if( ! target ) {
+        throw std::runtime_error( "No output target for Newick tree writing." );
+    }
+    auto& out = target->ostream();
+
+    // Degenerate cases that the traversal below does not need to bother with.
+    if( tree.node_count() < 2 ) {
+        std::string buffer;
+        if( tree.node_count() == 1 ) {
+            append_label_( buffer, tree.root_node().data<CommonNodeData>().name );
+            if( element_extras ) {
+                element_extras( buffer, tree.root_node(), nullptr );
+            }
+        }
+        buffer += ";\n";
+        out.write( buffer.data(), buffer.size() );
+        return;
+    }
+
+    // Estimate the output size: node names (with potential quotation marks), one branch length
+    // per inner edge, and the structure characters, so that the buffer is allocated once.
+    size_t estimate = extra_size_estimate + 2;
+    for( auto const& node : tree.nodes() ) {
+        estimate += node.data<CommonNodeData>().name.size() + 2;
+    }
+    size_t const branch_length_size =
+        enable_branch_lengths_
+        ? static_cast<size_t>( std::max( branch_length_precision_, 0 )) + 8
+        : 0
+    ;
+    estimate += tree.node_count() * ( branch_length_size + 3 );
+
+    std::string buffer;
+    buffer.reserve( estimate );
+
+    // Iterative depth first traversal, in order to not overflow the call stack on huge
+    // ladder-like trees, using one frame per node on the path to the currently open subtree.
+    struct Frame
+    {
+        TreeNode const* node;
+
+        // Next child link to descend into, or nullptr once all children are done.
+        TreeLink const* next_child;
+
+        // First link of the node, at which the child iteration wraps around and stops.
+        TreeLink const* stop;
+
+        // Whether we still need to open the subtree, and whether a child was already written.
+        bool entered;
+        bool first;
+    };
+    std::vector<Frame> stack;
+    stack.reserve( 64 );
+
+    auto const* root_node = &tree.root_node();
+    auto push_frame = [&]( TreeNode const* node )
+    {
+        Frame frame;
+        frame.node = node;
+        auto const* prim = &node->primary_link();
+        if( node == root_node ) {
+            // At the root, all links point towards children.
+            frame.next_child = prim;
+        } else {
+            // At any other node, the primary link points towards the parent,
+            // so the children start at the next link. If that wraps around immediately,
+            // the node is a leaf.
+            auto const* next = &prim->next();
+            frame.next_child = ( next == prim ) ? nullptr : next;
+        }
+        frame.stop = prim;
+        frame.entered = false;
+        frame.first = true;
+        stack.push_back( frame );
+    };
+    push_frame( root_node );
+
+    while( ! stack.empty() ) {
+        auto& frame = stack.back();
+
+        // Open the subtree when first reaching a node that has children.
+        if( ! frame.entered ) {
+            frame.entered = true;
+            if( frame.next_child ) {
+                buffer += '(';
+            }
+        }
+
+        // Descend into the next child, if any.
+        if( frame.next_child ) {
+            if( ! frame.first ) {
+                buffer += ',';
+            }
+            frame.first = false;
+
+            auto const* child_link = frame.next_child;
+            auto const* next = &child_link->next();
+            frame.next_child = ( next == frame.stop ) ? nullptr : next;
+
+            // This invalidates `frame`, so it has to be the last access in this iteration.
+            push_frame( &child_link->outer().node() );
+            continue;
+        }
+
+        // All children done: close the subtree and write the node element itself.
+        auto const* node = frame.node;
+        if( ! frame.first ) {
+            buffer += ')';
+        }
+        append_label_( buffer, node->data<CommonNodeData>().name );
+        auto const* edge = ( node == root_node )
+            ? nullptr
+            : &node->primary_link().edge()
+        ;
+        if( edge && enable_branch_lengths_ ) {
+            append_branch_length_( buffer, edge->data<CommonEdgeData>().branch_length );
+        }
+        if( element_extras ) {
+            element_extras( buffer, *node, edge );
+        }
+        stack.pop_back();
+    }
+    buffer += ";\n";
+
+    out.write( buffer.data(), buffer.size() );
+}
+
+// =================================================================================================
+//      Run Functions
+// =================================================================================================
+
+void NewickBufferWriter::write(
+    genesis::tree::CommonTree const& tree,
+    std::shared_ptr<genesis::utils::BaseOutputTarget> target
+) const {
+    write_( tree, {}, 0, target );
+}
+
+void NewickBufferWriter::write(
+    genesis::tree::SimpleNewickTree const& tree,
+    std::shared_ptr<genesis::utils::BaseOutputTarget> target
+) const {
+    using namespace ::genesis::tree;
+
+    // Account for the additional element content in the buffer size estimate.
+    size_t extra_size = 0;
+    for( auto const& node : tree.nodes() ) {
+        for( auto const& comment : node.data<SimpleNewickNodeData>().comments ) {
+            extra_size += comment.size() + 2;
+        }
+    }
+    for( auto const& edge : tree.edges() ) {
+        auto const& data = edge.data<SimpleNewickEdgeData>();
+        for( auto const& value : data.values ) {
+            extra_size += value.size() + 1;
+        }
+        for( auto const& tag : data.tags ) {
+            extra_size += tag.size() + 2;
+        }
+    }
+
+    // Append the extra element content in the same order as the genesis Newick writer:
+    // values (after the branch length), then comments, then tags.
+    auto element_extras = [](
+        std::string& buffer, TreeNode const& node, TreeEdge const* edge
+    ){
+        if( edge ) {
+            for( auto const& value : edge->data<SimpleNewickEdgeData>().values ) {
+                buffer += ':';
+                buffer += value;
+            }
+        }
+        for( auto const& comment : node.data<SimpleNewickNodeData>().comments ) {
+            buffer += '[';
+            buffer += comment;
+            buffer += ']';
+        }
+        if( edge ) {
+            for( auto const& tag : edge->data<SimpleNewickEdgeData>().tags ) {
+                buffer += '{';
+                buffer += tag;
+                buffer += '}';
+            }
+        }
+    };
+
+    write_( tree, element_extras, extra_size, target );
+}
@@ -0,0 +1,156 @@
+#ifndef GAPPA_TOOLS_NEWICK_BUFFER_WRITER_H_
+#define GAPPA_TOOLS_NEWICK_BUFFER_WRITER_H_
+
+/*
+    gappa - Genesis Applications for Phylogenetic Placement Analysis
+    Copyright (C) 2017-2024 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+#include "genesis/tree/common_tree/tree.hpp"
+#include "genesis/tree/formats/newick/simple_tree.hpp"
+#include "genesis/tree/tree.hpp"
+#include "genesis/utils/io/output_target.hpp"
+
+#include <functional>
+#include <memory>
+#include <string>
+
+// =================================================================================================
+//      Newick Buffer Writer
+// =================================================================================================
+
+/**
+ * @brief Write a tree in Newick format into a single preallocated buffer.
+ *
+ * The generic genesis Newick writer builds its output out of many small string concatenations,
+ * which dominates the run time when writing trees with hundreds of thousands of taxa.
+ * This class instead estimates the output size up front, serializes the whole tree into one
+ * reserved string via an iterative traversal, and formats branch lengths directly into a small
+ * stack buffer, before handing the result to the output target in one go.
+ *
+ * The settings mirror the subset of the genesis writer settings that gappa uses:
+ * branch length precision, and whether invalid characters in node labels are quoted or
+ * replaced by underscores, see NewickTreeOutputOptions.
+ */
+class NewickBufferWriter
+{
+public:
+
+    // -------------------------------------------------------------------------
+    //     Constructor and Rule of Five
+    // -------------------------------------------------------------------------
+
+    NewickBufferWriter()  = default;
+    ~NewickBufferWriter() = default;
+
+    NewickBufferWriter( NewickBufferWriter const& ) = default;
+    NewickBufferWriter( NewickBufferWriter&& )      = default;
+
+    NewickBufferWriter& operator= ( NewickBufferWriter const& ) = default;
+    NewickBufferWriter& operator= ( NewickBufferWriter&& )      = default;
+
+    // -------------------------------------------------------------------------
+    //     Settings
+    // -------------------------------------------------------------------------
+
+    /**
+     * @brief Set whether to write branch lengths at all. Default is `true`.
+     */
+    void enable_branch_lengths( bool value )
+    {
+        enable_branch_lengths_ = value;
+    }
+
+    /**
+     * @brief Set the number of digits to print for branch lengths. Default is 6,
+     * which is also the default of the genesis writers.
+     */
+    void branch_length_precision( int value )
+    {
+        branch_length_precision_ = value;
+    }
+
+    /**
+     * @brief If set, node labels containing characters that are invalid in Newick are wrapped
+     * in quotation marks; otherwise (default), those characters are replaced by underscores.
+     */
+    void quote_invalid_chars( bool value )
+    {
+        quote_invalid_chars_ = value;
+    }
+
+    // -------------------------------------------------------------------------
+    //     Run Functions
+    // -------------------------------------------------------------------------
+
+    /**
+     * @brief Write a CommonTree, that is, node names and branch lengths.
+     */
+    void write(
+        genesis::tree::CommonTree const& tree,
+        std::shared_ptr<genesis::utils::BaseOutputTarget> target
+    ) const;
+
+    /**
+     * @brief Write a SimpleNewickTree, which additionally carries comments, extra values,
+     * and (jplace) tags, in the same element order as the genesis Newick writer uses.
+     */
+    void write(
+        genesis::tree::SimpleNewickTree const& tree,
+        std::shared_ptr<genesis::utils::BaseOutputTarget> target
+    ) const;
+
+    // -------------------------------------------------------------------------
+    //     Internal Functions
+    // -------------------------------------------------------------------------
+
+private:
+
+    /**
+     * @brief Shared serialization of the tree structure, names, and branch lengths.
+     *
+     * The @p element_extras callback is invoked per node after its branch length, and appends
+     * any additional element content (comments, values, tags) for trees that carry them.
+     * For the root, the edge pointer is `nullptr`, as there is no edge towards a parent.
+     */
+    void write_(
+        genesis::tree::Tree const& tree,
+        std::function<void(
+            std::string&, genesis::tree::TreeNode const&, genesis::tree::TreeEdge const*
+        )> const& element_extras,
+        size_t extra_size_estimate,
+        std::shared_ptr<genesis::utils::BaseOutputTarget> target
+    ) const;
+
+    void append_label_( std::string& buffer, std::string const& name ) const;
+    void append_branch_length_( std::string& buffer, double value ) const;
+
+    // -------------------------------------------------------------------------
+    //     Member Variables
+    // -------------------------------------------------------------------------
+
+    bool enable_branch_lengths_   = true;
+    int  branch_length_precision_ = 6;
+    bool quote_invalid_chars_     = false;
+
+};
+
+#endif // include guard
@@ -0,0 +1,195 @@
+/*
+    gappa - Genesis Applications for Phylogenetic Placement Analysis
+    Copyright (C) 2017-2022 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+#include "tools/parallel_gzip_output_target.hpp"
+
+#ifdef GENESIS_ZLIB
+
+#include <cassert>
+#include <stdexcept>
+
+#include <zlib.h>
+
+// =================================================================================================
+//      Local Helper Functions
+// =================================================================================================
+
+/**
+ * @brief Size of the blocks that are compressed independently. Same default as pigz (128 kB).
+ */
+static const size_t parallel_gzip_block_size_ = 128 * 1024;
+
+/**
+ * @brief Deflate a block of data into a complete, self-contained gzip member.
+ */
+static std::string deflate_gzip_member_( std::string const& data )
+{
+    z_stream zs = {};
+    if( deflateInit2(
+        &zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+        15 + 16, // 15 window bits, +16 for a gzip header instead of a zlib one.
+        8, Z_DEFAULT_STRATEGY
+    ) != Z_OK ) {
+        throw std::runtime_error( "Cannot initialize zlib deflate for parallel gzip output." );
+    }
+
+    std::string result;
+    result.resize( deflateBound( &zs, data.size() ) + 32 );
+    // zlib's next_in is non-const unless ZLIB_CONST is defined; the data is not modified.
+    zs.next_in   = reinterpret_cast<Bytef*>( const_cast<char*>( data.data() ));
+    zs.avail_in  = data.size();
+    zs.next_out  = reinterpret_cast<Bytef*>( &result[0] );
+    zs.avail_out = result.size();
+
+    auto const ret = deflate( &zs, Z_FINISH );
+    if( ret != Z_STREAM_END ) {
+        deflateEnd( &zs );
+        throw std::runtime_error( "Error in zlib deflate for parallel gzip output." );
+    }
+    result.resize( zs.total_out );
+    deflateEnd( &zs );
+    return result;
+}
+
+// =================================================================================================
+//      Parallel Gzip Stream Buffer
+// =================================================================================================
+
+ParallelGzipStreambuf::ParallelGzipStreambuf(
+    std::string const& filename, size_t num_threads, bool write_seek_index
+)
+    : file_( filename, std::ios::out | std::ios::binary )
+    , block_( parallel_gzip_block_size_ )
+    , num_threads_( num_threads == 0 ? 1 : num_threads )
+    , index_path_( write_seek_index ? filename + ".gzi" : "" )
+{
+    if( ! file_ ) {
+        throw std::runtime_error( "Cannot write to file '" + filename + "'." );
+    }
+    setp( block_.data(), block_.data() + block_.size() );
+}
+
+ParallelGzipStreambuf::~ParallelGzipStreambuf()
+{
+    // Make sure everything ends up in the file, but never throw from a destructor.
+    try {
+        close();
+    } catch( ... ) {
+        // Nothing to be done; a failed write would have to fail loudly elsewhere.
+    }
+}
+
+void ParallelGzipStreambuf::close()
+{
+    if( closed_ ) {
+        return;
+    }
+    closed_ = true;
+
+    dispatch_block_();
+    drain_( 0 );
+
+    // An empty gzip file is not a valid gzip file; if nothing was written,
+    // emit one empty member so that downstream tools can read the output.
+    if( ! wrote_member_ ) {
+        auto const member = deflate_gzip_member_( "" );
+        file_.write( member.data(), member.size() );
+    }
+    file_.close();
+
+    // Write the seek index sidecar, in the bgzip `.gzi` layout: the number of entries,
+    // followed by the (compressed, uncompressed) start offsets of every member except
+    // the first, all as 64 bit values in host byte order.
+    if( ! index_path_.empty() ) {
+        std::ofstream index_file( index_path_, std::ios::out | std::ios::binary );
+        if( ! index_file ) {
+            throw std::runtime_error( "Cannot write to file '" + index_path_ + "'." );
+        }
+        uint64_t const count = index_entries_.size();
+        index_file.write( reinterpret_cast<char const*>( &count ), sizeof( count ));
+        for( auto const& entry : index_entries_ ) {
+            index_file.write( reinterpret_cast<char const*>( &entry.first ), sizeof( uint64_t ));
+            index_file.write( reinterpret_cast<char const*>( &entry.second ), sizeof( uint64_t ));
+        }
+    }
+}
+
+ParallelGzipStreambuf::int_type ParallelGzipStreambuf::overflow( int_type c )
+{
+    dispatch_block_();
+    if( c != traits_type::eof() ) {
+        *pptr() = traits_type::to_char_type( c );
+        pbump( 1 );
+    }
+    return traits_type::not_eof( c );
+}
+
+int ParallelGzipStreambuf::sync()
+{
+    // A flush cuts the current block short, which starts a new gzip member.
+    // That costs a bit of compression ratio, but keeps the semantics of flush().
+    dispatch_block_();
+    drain_( 0 );
+    file_.flush();
+    return file_ ? 0 : -1;
+}
+
+void ParallelGzipStreambuf::dispatch_block_()
+{
+    auto const fill = static_cast<size_t>( pptr() - pbase() );
+    if( fill == 0 ) {
+        return;
+    }
+    auto data = std::string( pbase(), fill );
+    setp( block_.data(), block_.data() + block_.size() );
+
+    pending_.push_back( std::async( std::launch::async, [ data ](){
+        return deflate_gzip_member_( data );
+    }));
+    pending_sizes_.push_back( fill );
+
+    // Keep a bounded number of blocks in flight, so that memory use stays limited
+    // and the writing of finished members overlaps with the compression.
+    drain_( 2 * num_threads_ );
+}
+
+void ParallelGzipStreambuf::drain_( size_t max_pending )
+{
+    while( pending_.size() > max_pending ) {
+        auto const member = pending_.front().get();
+        pending_.pop_front();
+
+        // Record the start offsets of every member but the first for the seek index.
+        if( ! index_path_.empty() && wrote_member_ ) {
+            index_entries_.emplace_back( compressed_offset_, uncompressed_offset_ );
+        }
+        compressed_offset_   += member.size();
+        uncompressed_offset_ += pending_sizes_.front();
+        pending_sizes_.pop_front();
+
+        file_.write( member.data(), member.size() );
+        wrote_member_ = true;
+    }
+}
+
+#endif // GENESIS_ZLIB
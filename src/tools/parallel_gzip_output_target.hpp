@@ -0,0 +1,198 @@
+#ifndef GAPPA_TOOLS_PARALLEL_GZIP_OUTPUT_TARGET_H_
+#define GAPPA_TOOLS_PARALLEL_GZIP_OUTPUT_TARGET_H_
+
+/*
+    gappa - Genesis Applications for Phylogenetic Placement Analysis
+    Copyright (C) 2017-2022 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+#include "genesis/utils/io/output_target.hpp"
+
+#ifdef GENESIS_ZLIB
+
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <future>
+#include <memory>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <utility>
+#include <vector>
+
+// =================================================================================================
+//      Parallel Gzip Stream Buffer
+// =================================================================================================
+
+/**
+ * @brief Stream buffer that compresses its data as a sequence of independent gzip members,
+ * using multiple threads.
+ *
+ * Data is collected in fixed-size blocks. Each full block is handed to a background task
+ * that deflates it into its own complete gzip member, while the writing thread continues
+ * to fill the next block. The compressed members are written to the file in order, and
+ * their concatenation is a valid (pigz-compatible) multi-member gzip file.
+ *
+ * With @p write_seek_index set, the (compressed, uncompressed) offsets of the member
+ * boundaries are additionally written to a `<filename>.gzi` sidecar in the bgzip index
+ * layout, so that readers can later seek to any uncompressed offset and only decompress
+ * from the nearest member boundary, see tools/gzip_seek_index.hpp.
+ */
+class ParallelGzipStreambuf
+    : public std::streambuf
+{
+public:
+
+    // -------------------------------------------------------------------------
+    //     Constructor and Rule of Five
+    // -------------------------------------------------------------------------
+
+    ParallelGzipStreambuf(
+        std::string const& filename, size_t num_threads, bool write_seek_index = false
+    );
+    ~ParallelGzipStreambuf() override;
+
+    ParallelGzipStreambuf( ParallelGzipStreambuf const& ) = delete;
+    ParallelGzipStreambuf( ParallelGzipStreambuf&& )      = delete;
+
+    ParallelGzipStreambuf& operator= ( ParallelGzipStreambuf const& ) = delete;
+    ParallelGzipStreambuf& operator= ( ParallelGzipStreambuf&& )      = delete;
+
+    // -------------------------------------------------------------------------
+    //     Functions
+    // -------------------------------------------------------------------------
+
+    /**
+     * @brief Compress and write all remaining data, and close the file.
+     */
+    void close();
+
+protected:
+
+    int_type overflow( int_type c ) override;
+    int sync() override;
+
+private:
+
+    /**
+     * @brief Hand the current block to a background compression task.
+     */
+    void dispatch_block_();
+
+    /**
+     * @brief Write finished compressed members to the file, in order,
+     * until at most @p max_pending tasks remain.
+     */
+    void drain_( size_t max_pending );
+
+    // -------------------------------------------------------------------------
+    //     Members
+    // -------------------------------------------------------------------------
+
+    std::ofstream file_;
+    std::vector<char> block_;
+    std::deque<std::future<std::string>> pending_;
+    std::deque<size_t> pending_sizes_;
+
+    size_t num_threads_;
+    bool   wrote_member_ = false;
+    bool   closed_       = false;
+
+    // Seek index bookkeeping, see the class description.
+    std::string index_path_;
+    uint64_t compressed_offset_   = 0;
+    uint64_t uncompressed_offset_ = 0;
+    std::vector<std::pair<uint64_t, uint64_t>> index_entries_;
+
+};
+
+// =================================================================================================
+//      Parallel Gzip Output Target
+// =================================================================================================
+
+/**
+ * @brief Output target that writes a gzip file using multi-threaded block compression.
+ *
+ * Drop-in alternative to the genesis file output target with gzip compression,
+ * for use when multiple threads are available. See ParallelGzipStreambuf for the format.
+ */
+class ParallelGzipOutputTarget
+    : public genesis::utils::BaseOutputTarget
+{
+public:
+
+    // -------------------------------------------------------------------------
+    //     Constructor and Rule of Five
+    // -------------------------------------------------------------------------
+
+    ParallelGzipOutputTarget(
+        std::string const& filename, size_t num_threads, bool write_seek_index = false
+    )
+        : filename_( filename )
+        , buffer_( filename, num_threads, write_seek_index )
+        , stream_( &buffer_ )
+    {}
+
+    ~ParallelGzipOutputTarget() override
+    {
+        // Flush and close, so that the file is complete when the target goes out of scope.
+        // The streambuf close never throws after the stream has been flushed.
+        stream_.flush();
+        buffer_.close();
+    }
+
+    ParallelGzipOutputTarget( ParallelGzipOutputTarget const& ) = delete;
+    ParallelGzipOutputTarget( ParallelGzipOutputTarget&& )      = delete;
+
+    ParallelGzipOutputTarget& operator= ( ParallelGzipOutputTarget const& ) = delete;
+    ParallelGzipOutputTarget& operator= ( ParallelGzipOutputTarget&& )      = delete;
+
+    // -------------------------------------------------------------------------
+    //     Members
+    // -------------------------------------------------------------------------
+
+private:
+
+    std::ostream& out_stream_() override
+    {
+        return stream_;
+    }
+
+    std::string target_name_() const override
+    {
+        return "output file";
+    }
+
+    std::string target_string_() const override
+    {
+        return filename_;
+    }
+
+    std::string filename_;
+    ParallelGzipStreambuf buffer_;
+    std::ostream stream_;
+
+};
+
+#endif // GENESIS_ZLIB
+
+#endif // include guard
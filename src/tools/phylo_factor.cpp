@@ -0,0 +1,305 @@
+/*
+    gappa - Genesis Applications for Phylogenetic Placement Analysis
+    Copyright (C) 2017-2024 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+#include "tools/phylo_factor.hpp"
+
+#include "genesis/tree/function/functions.hpp"
+#include "genesis/tree/iterator/postorder.hpp"
+#include "genesis/tree/iterator/preorder.hpp"
+#include "genesis/tree/tree/subtree.hpp"
+#include "genesis/utils/containers/matrix.hpp"
+
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <unordered_set>
+#include <vector>
+
+#ifdef GENESIS_OPENMP
+#   include <omp.h>
+#endif
+
+using namespace genesis;
+using namespace genesis::tree;
+
+// =================================================================================================
+//      Balance Aggregates
+// =================================================================================================
+
+/**
+ * @brief Additive per-edge aggregates from which the balance of any split can be derived.
+ *
+ * The balance of two disjoint edge sets only depends on sums that are additive over the edges
+ * of each set: the taxon-weighted log masses per sample, the taxon weight sum, and the edge count.
+ * We hence collect these sums once per factor in a single postorder pass over the tree
+ * (`subtree_*` holds the sums of the candidate edges below each edge, bounded by the winning
+ * edges of previous factors, `bin_*` holds the sums of each region between those winning edges),
+ * so that evaluating a candidate edge afterwards is a constant-size subtraction instead of
+ * a full tree traversal per candidate.
+ */
+struct BalanceAggregates
+{
+    // Taxon weight and weighted log masses (one sum per sample) of each single edge.
+    std::vector<double>            edge_weights;
+    genesis::utils::Matrix<double> edge_sums;
+
+    // Sums over all candidate edges strictly below an edge, bounded by non-candidate edges.
+    std::vector<size_t>            subtree_counts;
+    std::vector<double>            subtree_weights;
+    genesis::utils::Matrix<double> subtree_sums;
+
+    // Bin (region between the winning edges of previous factors) of each node,
+    // and the sums over all candidate edges of each bin.
+    std::vector<size_t>            node_bins;
+    std::vector<size_t>            bin_counts;
+    std::vector<double>            bin_weights;
+    genesis::utils::Matrix<double> bin_sums;
+};
+
+/**
+ * @brief Collect the balance aggregates for one factor iteration.
+ */
+static BalanceAggregates compute_balance_aggregates_(
+    BalanceData const& data,
+    std::unordered_set<size_t> const& candidate_edges
+) {
+    auto const edge_count   = data.tree.edge_count();
+    auto const sample_count = data.edge_masses.rows();
+    BalanceAggregates aggs;
+
+    // Assign each node to its bin. The winning edges of previous factors are no longer
+    // candidates and act as boundaries, so a child node inherits the bin of its parent
+    // unless the edge between them is such a boundary, which starts a new bin.
+    aggs.node_bins = std::vector<size_t>( data.tree.node_count(), 0 );
+    size_t bin_count = 1;
+    for( auto it : preorder( data.tree )) {
+        if( it.is_first_iteration() ) {
+            continue;
+        }
+        auto const parent_bin = aggs.node_bins[ it.edge().primary_node().index() ];
+        if( candidate_edges.count( it.edge().index() ) > 0 ) {
+            aggs.node_bins[ it.node().index() ] = parent_bin;
+        } else {
+            aggs.node_bins[ it.node().index() ] = bin_count;
+            ++bin_count;
+        }
+    }
+
+    // Compute the terms of each candidate edge: its taxon weight, and for each sample
+    // the weighted log of its mass. These are the quantities that the weighted geometric
+    // means of the balance computation sum over, see genesis::tree::mass_balance().
+    aggs.edge_weights = std::vector<double>( edge_count, 0.0 );
+    aggs.edge_sums    = utils::Matrix<double>( edge_count, sample_count, 0.0 );
+
+    #pragma omp parallel for schedule(dynamic)
+    for( size_t e = 0; e < edge_count; ++e ) {
+        if( candidate_edges.count( e ) == 0 ) {
+            continue;
+        }
+        auto const weight = data.taxon_weights.empty() ? 1.0 : data.taxon_weights[ e ];
+        aggs.edge_weights[ e ] = weight;
+        if( weight == 0.0 ) {
+            continue;
+        }
+        for( size_t s = 0; s < sample_count; ++s ) {
+            aggs.edge_sums( e, s ) = weight * std::log( data.edge_masses( s, e ));
+        }
+    }
+
+    // Accumulate the subtree sums bottom-up. Each edge collects the terms and subtree sums
+    // of the candidate edges below its secondary node; non-candidate child edges are skipped,
+    // so that their subtrees (which belong to other bins) do not leak across the boundary.
+    aggs.subtree_counts  = std::vector<size_t>( edge_count, 0 );
+    aggs.subtree_weights = std::vector<double>( edge_count, 0.0 );
+    aggs.subtree_sums    = utils::Matrix<double>( edge_count, sample_count, 0.0 );
+
+    for( auto it : postorder( data.tree )) {
+        if( it.is_last_iteration() ) {
+            continue;
+        }
+        auto const e = it.edge().index();
+
+        auto link = &it.node().primary_link().next();
+        while( link != &it.node().primary_link() ) {
+            auto const c = link->edge().index();
+            link = &link->next();
+            if( candidate_edges.count( c ) == 0 ) {
+                continue;
+            }
+            aggs.subtree_counts[ e ]  += aggs.subtree_counts[ c ] + 1;
+            aggs.subtree_weights[ e ] += aggs.subtree_weights[ c ] + aggs.edge_weights[ c ];
+            for( size_t s = 0; s < sample_count; ++s ) {
+                aggs.subtree_sums( e, s ) += aggs.subtree_sums( c, s ) + aggs.edge_sums( c, s );
+            }
+        }
+    }
+
+    // Accumulate the totals of each bin, by adding up the terms of its candidate edges.
+    aggs.bin_counts  = std::vector<size_t>( bin_count, 0 );
+    aggs.bin_weights = std::vector<double>( bin_count, 0.0 );
+    aggs.bin_sums    = utils::Matrix<double>( bin_count, sample_count, 0.0 );
+
+    for( size_t e = 0; e < edge_count; ++e ) {
+        if( candidate_edges.count( e ) == 0 ) {
+            continue;
+        }
+        auto const bin = aggs.node_bins[ data.tree.edge_at( e ).secondary_node().index() ];
+        aggs.bin_counts[ bin ]  += 1;
+        aggs.bin_weights[ bin ] += aggs.edge_weights[ e ];
+        for( size_t s = 0; s < sample_count; ++s ) {
+            aggs.bin_sums( bin, s ) += aggs.edge_sums( e, s );
+        }
+    }
+
+    return aggs;
+}
+
+// =================================================================================================
+//      Parallel Phylogenetic Factorization
+// =================================================================================================
+
+std::vector<PhyloFactor> parallel_phylogenetic_factorization(
+    BalanceData const& data,
+    std::function<double( size_t iteration, size_t edge_index, std::vector<double> const& balances )> objective,
+    size_t max_iterations,
+    std::function<void( size_t iteration, size_t max_iterations )> log_progress
+) {
+    if( ! objective ) {
+        throw std::runtime_error(
+            "Cannot run Phylogenetic Factorization without an objective function."
+        );
+    }
+    auto const edge_count   = data.tree.edge_count();
+    auto const sample_count = data.edge_masses.rows();
+
+    // All edges start out as candidates. Edges that yield an empty side
+    // (that is, edges leading to a leaf) are skipped in the evaluation below,
+    // and the winning edge of each factor is removed from the candidates,
+    // so that it serves as a boundary for the subtree sets of later factors.
+    auto candidate_edges = std::unordered_set<size_t>();
+    for( size_t e = 0; e < edge_count; ++e ) {
+        candidate_edges.insert( e );
+    }
+
+    auto result = std::vector<PhyloFactor>();
+    for( size_t it = 0; it < max_iterations; ++it ) {
+        if( log_progress ) {
+            log_progress( it + 1, max_iterations );
+        }
+
+        // Collect the balance aggregates of this iteration in one pass over the tree.
+        // The two sides of the split induced by a candidate edge are then its subtree sums
+        // (secondary side) and the remainder of its bin (primary side), so that each
+        // candidate below only costs one subtraction per sample, instead of the full
+        // subtree traversal and mass accumulation that mass_balance() does per edge.
+        auto const aggs = compute_balance_aggregates_( data, candidate_edges );
+
+        // Evaluate all candidate edges of this factor in parallel. Each edge only writes
+        // to its own entry of the objective values, so the loop runs lock-free; the
+        // objective function is called concurrently and must be thread-safe as well.
+        auto objective_values = std::vector<double>(
+            edge_count, std::numeric_limits<double>::quiet_NaN()
+        );
+
+        #pragma omp parallel for schedule(dynamic)
+        for( size_t e = 0; e < edge_count; ++e ) {
+            if( candidate_edges.count( e ) == 0 ) {
+                continue;
+            }
+            auto const bin = aggs.node_bins[ data.tree.edge_at( e ).secondary_node().index() ];
+
+            // The candidate edge itself belongs to neither side of its split.
+            // Skip edges where one of the sides is empty, that is, edges leading to a leaf,
+            // and edges whose sides only contain taxa with weight zero.
+            auto const sec_count = aggs.subtree_counts[ e ];
+            assert( aggs.bin_counts[ bin ] >= sec_count + 1 );
+            auto const prm_count = aggs.bin_counts[ bin ] - sec_count - 1;
+            if( sec_count == 0 || prm_count == 0 ) {
+                continue;
+            }
+            auto const sec_weight = aggs.subtree_weights[ e ];
+            auto const prm_weight
+                = aggs.bin_weights[ bin ] - sec_weight - aggs.edge_weights[ e ]
+            ;
+            if( sec_weight <= 0.0 || prm_weight <= 0.0 ) {
+                continue;
+            }
+
+            // Compute the balance of the two sides across all samples from the aggregates,
+            // and evaluate the objective function on it. This is the same weighted isometric
+            // log ratio that mass_balance() computes, written in terms of the log mass sums.
+            auto const scaling = std::sqrt(
+                ( sec_weight * prm_weight ) / ( sec_weight + prm_weight )
+            );
+            auto balances = std::vector<double>( sample_count, 0.0 );
+            for( size_t s = 0; s < sample_count; ++s ) {
+                auto const sec_mean = aggs.subtree_sums( e, s ) / sec_weight;
+                auto const prm_mean
+                    = ( aggs.bin_sums( bin, s ) - aggs.subtree_sums( e, s ) - aggs.edge_sums( e, s ))
+                    / prm_weight
+                ;
+                balances[ s ] = scaling * ( sec_mean - prm_mean );
+            }
+            objective_values[ e ] = objective( it, e, balances );
+        }
+
+        // Find the best edge of this iteration.
+        size_t best_edge = std::numeric_limits<size_t>::max();
+        double best_value = - std::numeric_limits<double>::infinity();
+        for( size_t e = 0; e < edge_count; ++e ) {
+            if( std::isfinite( objective_values[ e ] ) && objective_values[ e ] > best_value ) {
+                best_edge = e;
+                best_value = objective_values[ e ];
+            }
+        }
+        if( best_edge == std::numeric_limits<size_t>::max() ) {
+            // No edge yielded a usable objective value any more. Stop the factorization here.
+            break;
+        }
+
+        // Compute the data of the winning edge again (cheap, as it is just one edge),
+        // using the exact genesis functions, so that the stored factor matches what the
+        // downstream output writers expect, and store the factor.
+        auto const& edge = data.tree.edge_at( best_edge );
+        PhyloFactor factor;
+        factor.edge_index = best_edge;
+        factor.edge_indices_primary = phylo_factor_subtree_indices(
+            Subtree{ edge.primary_link() }, candidate_edges
+        );
+        factor.edge_indices_secondary = phylo_factor_subtree_indices(
+            Subtree{ edge.secondary_link() }, candidate_edges
+        );
+        factor.balances = mass_balance(
+            data, factor.edge_indices_secondary, factor.edge_indices_primary
+        );
+        factor.all_objective_values = std::move( objective_values );
+        factor.objective_value = best_value;
+        result.push_back( std::move( factor ));
+
+        // The winning edge is no longer a candidate, and acts as a boundary from now on.
+        candidate_edges.erase( best_edge );
+    }
+
+    return result;
+}
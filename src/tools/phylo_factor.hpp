@@ -0,0 +1,62 @@
+#ifndef GAPPA_TOOLS_PHYLO_FACTOR_H_
+#define GAPPA_TOOLS_PHYLO_FACTOR_H_
+
+/*
+    gappa - Genesis Applications for Phylogenetic Placement Analysis
+    Copyright (C) 2017-2024 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+#include "genesis/tree/mass_tree/balances.hpp"
+#include "genesis/tree/mass_tree/phylo_factor.hpp"
+
+#include <functional>
+#include <vector>
+
+// =================================================================================================
+//      Parallel Phylogenetic Factorization
+// =================================================================================================
+
+/**
+ * @brief Run the Phylogenetic Factorization of [Washburne2017-phylofactorization],
+ * with the per-edge objective evaluations of each factor parallelized.
+ *
+ * This mirrors the genesis phylogenetic_factorization() function, which evaluates the
+ * candidate edges of each factor sequentially. The evaluations (balance computation and
+ * objective function) of the edges are however independent of each other, so we run them
+ * in an OpenMP loop here, which speeds up each factor by roughly the number of threads.
+ * The objective function is hence called concurrently for different edges, and must only
+ * write to per-edge state, as the one in our placement-factorization command does.
+ *
+ * Furthermore, instead of recomputing the subtree mass balances from scratch for each
+ * candidate edge, which costs a full tree traversal per candidate, we collect additive
+ * per-edge aggregates of the weighted log masses in a single postorder pass per factor,
+ * and derive the balance of each candidate split from them by subtraction. This makes
+ * whole-tree factor searches feasible on large reference trees, where the quadratic
+ * per-factor cost of the naive evaluation dominates the runtime.
+ */
+std::vector<genesis::tree::PhyloFactor> parallel_phylogenetic_factorization(
+    genesis::tree::BalanceData const& data,
+    std::function<double( size_t iteration, size_t edge_index, std::vector<double> const& balances )> objective,
+    size_t max_iterations,
+    std::function<void( size_t iteration, size_t max_iterations )> log_progress
+);
+
+#endif // include guard
@@ -0,0 +1,191 @@
+/*
+    gappa - Genesis Applications for Phylogenetic Placement Analysis
+    Copyright (C) 2017-2024 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+#include "tools/png_writer.hpp"
+
+#include "genesis/utils/io/output_stream.hpp"
+
+#include <array>
+#include <cassert>
+#include <cstdint>
+#include <fstream>
+#include <stdexcept>
+
+// =================================================================================================
+//      Helper Functions
+// =================================================================================================
+
+/**
+ * @brief Build the CRC-32 lookup table used by png_crc32_().
+ */
+static std::array<uint32_t, 256> png_crc32_table_()
+{
+    std::array<uint32_t, 256> table;
+    for( uint32_t n = 0; n < 256; ++n ) {
+        uint32_t c = n;
+        for( size_t k = 0; k < 8; ++k ) {
+            c = ( c & 1 ) ? 0xedb88320u ^ ( c >> 1 ) : ( c >> 1 );
+        }
+        table[n] = c;
+    }
+    return table;
+}
+
+/**
+ * @brief CRC-32 as used by the png chunk format.
+ */
+static uint32_t png_crc32_( unsigned char const* data, size_t length, uint32_t crc = 0 )
+{
+    // Build once, thread safe: pngs are written from concurrent renders.
+    static auto const table = png_crc32_table_();
+
+    crc = crc ^ 0xffffffffu;
+    for( size_t i = 0; i < length; ++i ) {
+        crc = table[ ( crc ^ data[i] ) & 0xffu ] ^ ( crc >> 8 );
+    }
+    return crc ^ 0xffffffffu;
+}
+
+/**
+ * @brief Adler-32 checksum of the zlib stream.
+ */
+static uint32_t png_adler32_( unsigned char const* data, size_t length )
+{
+    uint32_t a = 1;
+    uint32_t b = 0;
+    for( size_t i = 0; i < length; ++i ) {
+        a = ( a + data[i] ) % 65521u;
+        b = ( b + a ) % 65521u;
+    }
+    return ( b << 16 ) | a;
+}
+
+/**
+ * @brief Append a big-endian 32 bit value to a byte buffer.
+ */
+static void push_uint32_be_( std::vector<unsigned char>& buffer, uint32_t value )
+{
+    buffer.push_back( ( value >> 24 ) & 0xffu );
+    buffer.push_back( ( value >> 16 ) & 0xffu );
+    buffer.push_back( ( value >>  8 ) & 0xffu );
+    buffer.push_back( value & 0xffu );
+}
+
+/**
+ * @brief Write one png chunk: length, type, data, and the crc over type and data.
+ */
+static void write_chunk_(
+    std::ostream& os,
+    char const* type,
+    std::vector<unsigned char> const& data
+) {
+    std::vector<unsigned char> head;
+    push_uint32_be_( head, static_cast<uint32_t>( data.size() ));
+    head.push_back( type[0] );
+    head.push_back( type[1] );
+    head.push_back( type[2] );
+    head.push_back( type[3] );
+    os.write( reinterpret_cast<char const*>( head.data() ), head.size() );
+    if( ! data.empty() ) {
+        os.write( reinterpret_cast<char const*>( data.data() ), data.size() );
+    }
+
+    auto crc = png_crc32_( head.data() + 4, 4 );
+    crc = png_crc32_( data.data(), data.size(), crc );
+    std::vector<unsigned char> tail;
+    push_uint32_be_( tail, crc );
+    os.write( reinterpret_cast<char const*>( tail.data() ), tail.size() );
+}
+
+// =================================================================================================
+//      Png Writer
+// =================================================================================================
+
+void write_png_file(
+    std::vector<unsigned char> const& pixels,
+    size_t width,
+    size_t height,
+    std::string const& filename
+) {
+    if( pixels.size() != width * height * 3 ) {
+        throw std::runtime_error(
+            "Internal Error: Pixel buffer size does not match the png image dimensions."
+        );
+    }
+
+    std::ofstream os;
+    genesis::utils::file_output_stream(
+        filename, os, std::ios_base::out | std::ios_base::binary
+    );
+
+    // Signature.
+    unsigned char const signature[8] = { 0x89, 0x50, 0x4e, 0x47, 0x0d, 0x0a, 0x1a, 0x0a };
+    os.write( reinterpret_cast<char const*>( signature ), 8 );
+
+    // Header chunk: dimensions, 8 bit depth, RGB color type, default methods.
+    std::vector<unsigned char> ihdr;
+    push_uint32_be_( ihdr, static_cast<uint32_t>( width ));
+    push_uint32_be_( ihdr, static_cast<uint32_t>( height ));
+    ihdr.push_back( 8 ); // bit depth
+    ihdr.push_back( 2 ); // color type: truecolor
+    ihdr.push_back( 0 ); // compression method
+    ihdr.push_back( 0 ); // filter method
+    ihdr.push_back( 0 ); // interlace method
+    write_chunk_( os, "IHDR", ihdr );
+
+    // Raw scanline data: each row prefixed with filter type 0 (none).
+    auto const row_bytes = width * 3;
+    std::vector<unsigned char> raw;
+    raw.reserve( height * ( row_bytes + 1 ));
+    for( size_t y = 0; y < height; ++y ) {
+        raw.push_back( 0 );
+        raw.insert(
+            raw.end(),
+            pixels.begin() + y * row_bytes,
+            pixels.begin() + ( y + 1 ) * row_bytes
+        );
+    }
+
+    // Image data chunk, as a zlib stream of stored (uncompressed) deflate blocks.
+    std::vector<unsigned char> idat;
+    idat.reserve( raw.size() + raw.size() / 65535 * 5 + 16 );
+    idat.push_back( 0x78 ); // zlib header: deflate, 32k window
+    idat.push_back( 0x01 ); // zlib header: no preset dict, fastest compression level
+    size_t pos = 0;
+    while( pos < raw.size() ) {
+        auto const block = std::min<size_t>( raw.size() - pos, 65535 );
+        bool const final_block = ( pos + block == raw.size() );
+        idat.push_back( final_block ? 1 : 0 );
+        idat.push_back( block & 0xffu );
+        idat.push_back( ( block >> 8 ) & 0xffu );
+        idat.push_back( ~block & 0xffu );
+        idat.push_back( ( ~block >> 8 ) & 0xffu );
+        idat.insert( idat.end(), raw.begin() + pos, raw.begin() + pos + block );
+        pos += block;
+    }
+    push_uint32_be_( idat, png_adler32_( raw.data(), raw.size() ));
+    write_chunk_( os, "IDAT", idat );
+
+    // End chunk.
+    write_chunk_( os, "IEND", {} );
+}
@@ -0,0 +1,53 @@
+#ifndef GAPPA_TOOLS_PNG_WRITER_H_
+#define GAPPA_TOOLS_PNG_WRITER_H_
+
+/*
+    gappa - Genesis Applications for Phylogenetic Placement Analysis
+    Copyright (C) 2017-2024 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// =================================================================================================
+//      Png Writer
+// =================================================================================================
+
+/**
+ * @brief Write an 8 bit RGB image to a png file.
+ *
+ * The pixels are expected in row-major order, three bytes (red, green, blue) per pixel,
+ * that is, @p pixels needs to hold `width * height * 3` bytes.
+ *
+ * The encoder is self-contained and does not need any image or compression library:
+ * it emits the image data in stored (uncompressed) deflate blocks. The files are hence
+ * about as large as the raw pixel data, which is still far smaller and faster to produce
+ * than text-based vector output for dense images.
+ */
+void write_png_file(
+    std::vector<unsigned char> const& pixels,
+    size_t width,
+    size_t height,
+    std::string const& filename
+);
+
+#endif // include guard
@@ -0,0 +1,226 @@
+/*
+    gappa - Genesis Applications for Phylogenetic Placement Analysis
+    Copyright (C) 2017-2024 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+#include "tools/profiler.hpp"
+
+#include "genesis/utils/core/logging.hpp"
+
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+#ifndef _WIN32
+#    include <sys/resource.h>
+#endif
+
+// =================================================================================================
+//      Local State
+// =================================================================================================
+
+namespace {
+
+    struct ProfilerStage
+    {
+        std::string name;
+        double wall_seconds = 0.0;
+        double cpu_seconds  = 0.0;
+        size_t count        = 0;
+        double peak_rss_gb  = 0.0;
+    };
+
+    bool profiler_enabled_ = false;
+    std::mutex profiler_mutex_;
+    std::vector<ProfilerStage> profiler_stages_;
+
+    /**
+     * @brief Process CPU time (user plus system, all threads) in seconds.
+     */
+    double process_cpu_seconds_()
+    {
+        #ifndef _WIN32
+            struct rusage usage;
+            if( getrusage( RUSAGE_SELF, &usage ) == 0 ) {
+                return
+                    static_cast<double>( usage.ru_utime.tv_sec  + usage.ru_stime.tv_sec )
+                    + static_cast<double>( usage.ru_utime.tv_usec + usage.ru_stime.tv_usec ) / 1e6
+                ;
+            }
+        #endif
+        return 0.0;
+    }
+
+    /**
+     * @brief Peak resident set size of the process so far, in GB.
+     */
+    double peak_rss_gb_()
+    {
+        #ifndef _WIN32
+            struct rusage usage;
+            if( getrusage( RUSAGE_SELF, &usage ) == 0 ) {
+                // ru_maxrss is in kilobytes on Linux, but in bytes on macOS.
+                #ifdef __APPLE__
+                    return static_cast<double>( usage.ru_maxrss ) / ( 1024.0 * 1024.0 * 1024.0 );
+                #else
+                    return static_cast<double>( usage.ru_maxrss ) / ( 1024.0 * 1024.0 );
+                #endif
+            }
+        #endif
+        return 0.0;
+    }
+
+    /**
+     * @brief Format a number with two decimal digits.
+     */
+    std::string format_fixed_( double value )
+    {
+        char buffer[ 32 ];
+        std::snprintf( buffer, sizeof( buffer ), "%.2f", value );
+        return std::string( buffer );
+    }
+
+} // namespace
+
+// =================================================================================================
+//      Profiler
+// =================================================================================================
+
+void Profiler::enable( bool value )
+{
+    profiler_enabled_ = value;
+}
+
+bool Profiler::enabled()
+{
+    return profiler_enabled_;
+}
+
+void Profiler::add_measurement(
+    std::string const& stage_name,
+    double wall_seconds,
+    double cpu_seconds
+) {
+    auto const rss = peak_rss_gb_();
+    std::lock_guard<std::mutex> lock( profiler_mutex_ );
+    ProfilerStage* stage = nullptr;
+    for( auto& entry : profiler_stages_ ) {
+        if( entry.name == stage_name ) {
+            stage = &entry;
+            break;
+        }
+    }
+    if( ! stage ) {
+        profiler_stages_.push_back( ProfilerStage() );
+        profiler_stages_.back().name = stage_name;
+        stage = &profiler_stages_.back();
+    }
+    stage->wall_seconds += wall_seconds;
+    stage->cpu_seconds  += cpu_seconds;
+    stage->count        += 1;
+    if( rss > stage->peak_rss_gb ) {
+        stage->peak_rss_gb = rss;
+    }
+}
+
+void Profiler::report()
+{
+    if( ! profiler_enabled_ ) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock( profiler_mutex_ );
+
+    LOG_BOLD;
+    LOG_MSG << "Profile of the run, per stage, in order of first appearance. "
+            << "CPU time is process-wide, so CPU/Wall shows how many cores a stage kept busy; "
+            << "Peak RSS is the peak memory use of the whole process up to the end of the stage.";
+    LOG_MSG;
+
+    // Print a header, then one line per stage.
+    char line[ 256 ];
+    std::snprintf(
+        line, sizeof( line ), "%-40s %8s %12s %12s %10s %12s",
+        "Stage", "Count", "Wall [s]", "CPU [s]", "CPU/Wall", "Peak RSS [GB]"
+    );
+    LOG_MSG << line;
+    for( auto const& stage : profiler_stages_ ) {
+        auto const util = ( stage.wall_seconds > 0.0 )
+            ? stage.cpu_seconds / stage.wall_seconds
+            : 0.0
+        ;
+        std::snprintf(
+            line, sizeof( line ), "%-40s %8zu %12s %12s %9sx %12s",
+            stage.name.substr( 0, 40 ).c_str(),
+            stage.count,
+            format_fixed_( stage.wall_seconds ).c_str(),
+            format_fixed_( stage.cpu_seconds ).c_str(),
+            format_fixed_( util ).c_str(),
+            format_fixed_( stage.peak_rss_gb ).c_str()
+        );
+        LOG_MSG << line;
+    }
+    LOG_MSG;
+    LOG_MSG << "Total process CPU time: " << format_fixed_( process_cpu_seconds_() ) << " s; "
+            << "peak RSS: " << format_fixed_( peak_rss_gb_() ) << " GB.";
+}
+
+double Profiler::process_cpu_seconds()
+{
+    return process_cpu_seconds_();
+}
+
+double Profiler::process_peak_rss_gb()
+{
+    return peak_rss_gb_();
+}
+
+// =================================================================================================
+//      Profiler Guard
+// =================================================================================================
+
+ProfilerGuard::ProfilerGuard( std::string stage_name )
+    : stage_name_( std::move( stage_name ))
+{
+    if( ! Profiler::enabled() ) {
+        return;
+    }
+    active_ = true;
+    wall_start_ = std::chrono::steady_clock::now();
+    cpu_start_ = process_cpu_seconds_();
+}
+
+ProfilerGuard::~ProfilerGuard()
+{
+    stop();
+}
+
+void ProfilerGuard::stop()
+{
+    if( ! active_ ) {
+        return;
+    }
+    active_ = false;
+    auto const wall = std::chrono::duration_cast<std::chrono::duration<double>>(
+        std::chrono::steady_clock::now() - wall_start_
+    ).count();
+    auto const cpu = process_cpu_seconds_() - cpu_start_;
+    Profiler::add_measurement( stage_name_, wall, cpu );
+}
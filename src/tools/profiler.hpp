@@ -0,0 +1,136 @@
+#ifndef GAPPA_TOOLS_PROFILER_H_
+#define GAPPA_TOOLS_PROFILER_H_
+
+/*
+    gappa - Genesis Applications for Phylogenetic Placement Analysis
+    Copyright (C) 2017-2024 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+#include <chrono>
+#include <string>
+
+// =================================================================================================
+//      Profiler
+// =================================================================================================
+
+/**
+ * @brief Lightweight stage profiling for the global --profile flag.
+ *
+ * Commands mark their major phases (input reading, per-sample or per-pair compute,
+ * output writing) with a scoped ProfilerGuard. When profiling is enabled, each guard
+ * accumulates the wall time and process CPU time spent in its stage, and records the
+ * peak memory use (RSS) seen so far; at the end of the run, report() prints a table
+ * of all stages in the order in which they first appeared. When profiling is disabled
+ * (the default), the guards are close to free.
+ *
+ * CPU time is measured process-wide (user plus system time of all threads), so the
+ * ratio of CPU to wall time shows how many cores a stage kept busy. Stages that run
+ * concurrently (such as background prefetching) share this attribution.
+ */
+class Profiler
+{
+public:
+
+    // -------------------------------------------------------------------------
+    //     Settings
+    // -------------------------------------------------------------------------
+
+    /**
+     * @brief Enable or disable profiling. Set from the global --profile option.
+     */
+    static void enable( bool value );
+
+    static bool enabled();
+
+    // -------------------------------------------------------------------------
+    //     Run Functions
+    // -------------------------------------------------------------------------
+
+    /**
+     * @brief Accumulate a finished measurement into the stage of the given name.
+     *
+     * Mostly for internal use by ProfilerGuard; the stage is created on first use.
+     * Thread safe.
+     */
+    static void add_measurement(
+        std::string const& stage_name,
+        double wall_seconds,
+        double cpu_seconds
+    );
+
+    /**
+     * @brief Print the per-stage profile table, if profiling is enabled.
+     */
+    static void report();
+
+    // -------------------------------------------------------------------------
+    //     Resource Measurement
+    // -------------------------------------------------------------------------
+
+    /**
+     * @brief CPU time (user plus system, all threads) of the process so far, in seconds.
+     *
+     * Also used by the resource usage report of the run wrapper, see gappa_cli_callback().
+     */
+    static double process_cpu_seconds();
+
+    /**
+     * @brief Peak resident set size of the process so far, in GB.
+     */
+    static double process_peak_rss_gb();
+
+};
+
+// =================================================================================================
+//      Profiler Guard
+// =================================================================================================
+
+/**
+ * @brief Scoped guard that measures one execution of a profiling stage, see Profiler.
+ */
+class ProfilerGuard
+{
+public:
+
+    explicit ProfilerGuard( std::string stage_name );
+    ~ProfilerGuard();
+
+    /**
+     * @brief End the stage before the end of the scope, recording its measurement now.
+     */
+    void stop();
+
+    ProfilerGuard( ProfilerGuard const& ) = delete;
+    ProfilerGuard( ProfilerGuard&& )      = delete;
+
+    ProfilerGuard& operator= ( ProfilerGuard const& ) = delete;
+    ProfilerGuard& operator= ( ProfilerGuard&& )      = delete;
+
+private:
+
+    std::string stage_name_;
+    bool active_ = false;
+    std::chrono::steady_clock::time_point wall_start_;
+    double cpu_start_ = 0.0;
+
+};
+
+#endif // include guard
@@ -0,0 +1,132 @@
+/*
+    gappa - Genesis Applications for Phylogenetic Placement Analysis
+    Copyright (C) 2017-2024 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+#include "tools/progress.hpp"
+
+#include "genesis/utils/core/logging.hpp"
+
+#include <cstdio>
+#include <utility>
+
+// =================================================================================================
+//      Local Helpers
+// =================================================================================================
+
+/**
+ * @brief How often the reporter thread logs the progress.
+ */
+static std::chrono::seconds const report_interval_( 10 );
+
+/**
+ * @brief Format a duration in seconds as a compact `3h 25m` / `4m 10s` / `35s` string.
+ */
+static std::string format_duration_( double seconds )
+{
+    auto const total = static_cast<long>( seconds + 0.5 );
+    char buffer[32];
+    if( total >= 3600 ) {
+        std::snprintf( buffer, sizeof( buffer ), "%ldh %ldm", total / 3600, ( total % 3600 ) / 60 );
+    } else if( total >= 60 ) {
+        std::snprintf( buffer, sizeof( buffer ), "%ldm %lds", total / 60, total % 60 );
+    } else {
+        std::snprintf( buffer, sizeof( buffer ), "%lds", total );
+    }
+    return buffer;
+}
+
+// =================================================================================================
+//      Progress Reporter
+// =================================================================================================
+
+ProgressReporter::ProgressReporter( std::string label, size_t total )
+    : label_( std::move( label ))
+    , total_( total )
+    , count_( 0 )
+    , done_( false )
+    , start_( std::chrono::steady_clock::now() )
+{
+    // Without verbose logging, nobody would see the reports, so we do not even start
+    // the thread, and the workers only ever touch the (then unused) atomic counter.
+    if(
+        genesis::utils::Logging::max_level()
+        < genesis::utils::Logging::LoggingLevel::kMessage2
+    ) {
+        done_.store( true );
+        return;
+    }
+
+    reporter_ = std::thread( [this](){
+        size_t last_reported = 0;
+        auto next_report = start_ + report_interval_;
+
+        // Sleep in short steps so that finish() does not have to wait out a full
+        // report interval, and log whenever the interval has passed and there is news.
+        while( ! done_.load( std::memory_order_relaxed )) {
+            std::this_thread::sleep_for( std::chrono::milliseconds( 100 ));
+            auto const now = std::chrono::steady_clock::now();
+            if( now < next_report ) {
+                continue;
+            }
+            next_report = now + report_interval_;
+
+            auto const current = count_.load( std::memory_order_relaxed );
+            if( current == last_reported || current == 0 ) {
+                continue;
+            }
+            last_reported = current;
+            report_( current );
+        }
+    });
+}
+
+ProgressReporter::~ProgressReporter()
+{
+    finish();
+}
+
+void ProgressReporter::finish()
+{
+    if( reporter_.joinable() ) {
+        done_.store( true );
+        reporter_.join();
+    }
+}
+
+void ProgressReporter::report_( size_t current ) const
+{
+    auto const elapsed = std::chrono::duration_cast<std::chrono::duration<double>>(
+        std::chrono::steady_clock::now() - start_
+    ).count();
+
+    auto msg = label_ + ": " + std::to_string( current );
+    if( total_ > 0 ) {
+        msg += " of " + std::to_string( total_ );
+        msg += " (" + std::to_string( 100 * current / total_ ) + "%)";
+        if( current < total_ && elapsed > 0.0 ) {
+            auto const eta = elapsed / static_cast<double>( current )
+                           * static_cast<double>( total_ - current );
+            msg += ", ETA " + format_duration_( eta );
+        }
+    }
+    LOG_MSG2 << msg;
+}
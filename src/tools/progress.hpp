@@ -0,0 +1,120 @@
+#ifndef GAPPA_TOOLS_PROGRESS_H_
+#define GAPPA_TOOLS_PROGRESS_H_
+
+/*
+    gappa - Genesis Applications for Phylogenetic Placement Analysis
+    Copyright (C) 2017-2024 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <thread>
+
+// =================================================================================================
+//      Progress Reporter
+// =================================================================================================
+
+/**
+ * @brief Rate-limited progress reporting for parallel loops, without synchronization
+ * on the hot path.
+ *
+ * The per-file and per-pair loops used to log one message per work item from inside the
+ * parallel region, which increments a shared counter and serializes the threads on the
+ * logging sink, and interleaves messages from different threads. Instead, the workers of
+ * this reporter only bump a relaxed atomic counter, and a single background thread samples
+ * it at a fixed interval and logs the progress with an ETA estimated from the elapsed time.
+ *
+ * The reports go to the verbose log level (as the per-item messages did); without
+ * --verbose, no reporter thread is started and increment() is all that ever runs.
+ * Usage:
+ *
+ *     auto progress = ProgressReporter( "Reading jplace files", file_count );
+ *     // parallel loop calling progress.increment() per finished item
+ *     progress.finish();
+ */
+class ProgressReporter
+{
+public:
+
+    // -------------------------------------------------------------------------
+    //     Constructor and Rule of Five
+    // -------------------------------------------------------------------------
+
+    /**
+     * @brief Start reporting progress towards @p total items under the given @p label.
+     */
+    ProgressReporter( std::string label, size_t total );
+
+    ProgressReporter() = delete;
+
+    /**
+     * @brief Stop the reporter thread, see finish().
+     */
+    ~ProgressReporter();
+
+    ProgressReporter( ProgressReporter const& ) = delete;
+    ProgressReporter( ProgressReporter&& )      = delete;
+
+    ProgressReporter& operator= ( ProgressReporter const& ) = delete;
+    ProgressReporter& operator= ( ProgressReporter&& )      = delete;
+
+    // -------------------------------------------------------------------------
+    //     Members
+    // -------------------------------------------------------------------------
+
+    /**
+     * @brief Record @p amount finished work items. Safe to call from any thread.
+     */
+    void increment( size_t amount = 1 )
+    {
+        count_.fetch_add( amount, std::memory_order_relaxed );
+    }
+
+    /**
+     * @brief Stop the reporter thread. Idempotent; also called by the destructor.
+     *
+     * Call this when the loop is done, so that no report can interleave with the
+     * messages that follow the loop.
+     */
+    void finish();
+
+    // -------------------------------------------------------------------------
+    //     Internal Members
+    // -------------------------------------------------------------------------
+
+private:
+
+    void report_( size_t current ) const;
+
+    std::string label_;
+    size_t total_;
+
+    std::atomic<size_t> count_;
+    std::atomic<bool>   done_;
+
+    std::chrono::steady_clock::time_point start_;
+    std::thread reporter_;
+
+};
+
+#endif // include guard
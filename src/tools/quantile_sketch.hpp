@@ -0,0 +1,226 @@
+#ifndef GAPPA_TOOLS_QUANTILE_SKETCH_H_
+#define GAPPA_TOOLS_QUANTILE_SKETCH_H_
+
+/*
+    gappa - Genesis Applications for Phylogenetic Placement Analysis
+    Copyright (C) 2017-2024 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <random>
+#include <utility>
+#include <vector>
+
+// =================================================================================================
+//      Item Quantile Sketch
+// =================================================================================================
+
+/**
+ * @brief Mergeable streaming quantile sketch over arbitrary items.
+ *
+ * Multi-level sampling sketch in the style of Manku-Rajagopalan-Lindsay and KLL:
+ * items are inserted into a level-0 buffer; whenever a level buffer runs full, it is
+ * sorted and every other item (with a random start offset) is promoted to the next
+ * level, so that an item on level `l` represents `2^l` inserted items. The memory is
+ * hence bounded by the buffer size times the (logarithmic) number of levels, no matter
+ * how many items are inserted, and the rank of an item in the final sorted sequence is
+ * approximated with an error that shrinks with the buffer size.
+ *
+ * Unlike a plain scalar sketch, the items themselves are kept, so that the quantile
+ * positions can be reported with all the data attached to the sampled item, see the
+ * lwr-distribution command. The sketch only needs a strict weak ordering of the items,
+ * given as a comparator; sketches with the same buffer size and ordering can be merged,
+ * so that per-thread sketches can be combined after a parallel pass over the input.
+ */
+template<typename T>
+class ItemQuantileSketch
+{
+public:
+
+    // -------------------------------------------------------------------------
+    //     Typedefs and Constants
+    // -------------------------------------------------------------------------
+
+    using Comparator = std::function<bool( T const&, T const& )>;
+
+    /**
+     * @brief An item of the final sorted sequence, with the number of inserted items
+     * that it represents.
+     */
+    struct WeightedItem
+    {
+        T        item;
+        uint64_t weight;
+    };
+
+    // -------------------------------------------------------------------------
+    //     Constructor and Rule of Five
+    // -------------------------------------------------------------------------
+
+    ItemQuantileSketch( size_t buffer_size, Comparator comparator )
+        : buffer_size_( std::max<size_t>( buffer_size, 8 ))
+        , comparator_( std::move( comparator ))
+        , engine_( std::random_device{}() )
+    {}
+
+    ItemQuantileSketch()  = delete;
+    ~ItemQuantileSketch() = default;
+
+    ItemQuantileSketch( ItemQuantileSketch const& ) = default;
+    ItemQuantileSketch( ItemQuantileSketch&& )      = default;
+
+    ItemQuantileSketch& operator= ( ItemQuantileSketch const& ) = default;
+    ItemQuantileSketch& operator= ( ItemQuantileSketch&& )      = default;
+
+    // -------------------------------------------------------------------------
+    //     Accumulation
+    // -------------------------------------------------------------------------
+
+    void insert( T item )
+    {
+        if( levels_.empty() ) {
+            levels_.resize( 1 );
+        }
+        levels_[0].push_back( std::move( item ));
+        ++count_;
+        if( levels_[0].size() >= buffer_size_ ) {
+            compact_( 0 );
+        }
+    }
+
+    /**
+     * @brief Fold another sketch (over the same ordering) into this one.
+     */
+    void merge( ItemQuantileSketch&& other )
+    {
+        if( levels_.size() < other.levels_.size() ) {
+            levels_.resize( other.levels_.size() );
+        }
+        for( size_t lvl = 0; lvl < other.levels_.size(); ++lvl ) {
+            auto& level = levels_[lvl];
+            level.insert(
+                level.end(),
+                std::make_move_iterator( other.levels_[lvl].begin() ),
+                std::make_move_iterator( other.levels_[lvl].end() )
+            );
+        }
+        count_ += other.count_;
+        other.levels_.clear();
+        other.count_ = 0;
+        for( size_t lvl = 0; lvl < levels_.size(); ++lvl ) {
+            if( levels_[lvl].size() >= buffer_size_ ) {
+                compact_( lvl );
+            }
+        }
+    }
+
+    // -------------------------------------------------------------------------
+    //     Result
+    // -------------------------------------------------------------------------
+
+    /**
+     * @brief Number of items inserted into the sketch (and its merged-in sketches).
+     */
+    uint64_t count() const
+    {
+        return count_;
+    }
+
+    /**
+     * @brief Whether the sketch still holds every inserted item, that is,
+     * whether no compaction has happened and the result is exact.
+     */
+    bool is_exact() const
+    {
+        return levels_.size() <= 1;
+    }
+
+    /**
+     * @brief The retained items in sorted order, each with the number of inserted
+     * items that it represents. The weights sum to approximately count().
+     */
+    std::vector<WeightedItem> sorted_weighted_items() const
+    {
+        auto result = std::vector<WeightedItem>();
+        for( size_t lvl = 0; lvl < levels_.size(); ++lvl ) {
+            for( auto const& item : levels_[lvl] ) {
+                result.push_back({ item, uint64_t{1} << lvl });
+            }
+        }
+        std::sort(
+            result.begin(), result.end(),
+            [this]( WeightedItem const& lhs, WeightedItem const& rhs ){
+                return comparator_( lhs.item, rhs.item );
+            }
+        );
+        return result;
+    }
+
+    // -------------------------------------------------------------------------
+    //     Internal Functions
+    // -------------------------------------------------------------------------
+
+private:
+
+    /**
+     * @brief Sort the given level and promote every other item to the next level.
+     */
+    void compact_( size_t lvl )
+    {
+        assert( lvl < levels_.size() );
+        if( lvl + 1 >= levels_.size() ) {
+            levels_.resize( lvl + 2 );
+        }
+        auto& level = levels_[lvl];
+        std::sort( level.begin(), level.end(), comparator_ );
+
+        // Promote the items at the odd or even positions, chosen at random,
+        // so that the rank estimates stay unbiased.
+        auto offset_dist = std::uniform_int_distribution<size_t>( 0, 1 );
+        for( size_t i = offset_dist( engine_ ); i < level.size(); i += 2 ) {
+            levels_[ lvl + 1 ].push_back( std::move( level[i] ));
+        }
+        level.clear();
+
+        if( levels_[ lvl + 1 ].size() >= buffer_size_ ) {
+            compact_( lvl + 1 );
+        }
+    }
+
+    // -------------------------------------------------------------------------
+    //     Internal Members
+    // -------------------------------------------------------------------------
+
+private:
+
+    size_t buffer_size_;
+    Comparator comparator_;
+    std::mt19937 engine_;
+
+    std::vector<std::vector<T>> levels_;
+    uint64_t count_ = 0;
+
+};
+
+#endif // include guard
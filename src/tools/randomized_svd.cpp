@@ -0,0 +1,325 @@
+/*
+    gappa - Genesis Applications for Phylogenetic Placement Analysis
+    Copyright (C) 2017-2023 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+#include "tools/randomized_svd.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+
+#ifdef GENESIS_OPENMP
+#   include <omp.h>
+#endif
+
+using namespace genesis::utils;
+
+// =================================================================================================
+//      Helper Functions
+// =================================================================================================
+
+/**
+ * @brief Compute `data * other`, with `other` being a thin matrix,
+ * parallelized over the rows of `data`.
+ */
+static Matrix<double> multiply_thin_(
+    Matrix<double> const& data,
+    Matrix<double> const& other
+) {
+    assert( data.cols() == other.rows() );
+    auto result = Matrix<double>( data.rows(), other.cols(), 0.0 );
+
+    #pragma omp parallel for schedule(static)
+    for( size_t r = 0; r < data.rows(); ++r ) {
+        for( size_t k = 0; k < data.cols(); ++k ) {
+            auto const v = data( r, k );
+            if( v == 0.0 ) {
+                continue;
+            }
+            for( size_t c = 0; c < other.cols(); ++c ) {
+                result( r, c ) += v * other( k, c );
+            }
+        }
+    }
+    return result;
+}
+
+/**
+ * @brief Compute `data^T * other`, with `other` being a thin matrix with as many rows as `data`,
+ * parallelized over the rows of `data` with per-thread accumulators.
+ */
+static Matrix<double> multiply_transposed_thin_(
+    Matrix<double> const& data,
+    Matrix<double> const& other
+) {
+    assert( data.rows() == other.rows() );
+    auto result = Matrix<double>( data.cols(), other.cols(), 0.0 );
+
+    #pragma omp parallel
+    {
+        auto local = Matrix<double>( data.cols(), other.cols(), 0.0 );
+
+        #pragma omp for schedule(static) nowait
+        for( size_t r = 0; r < data.rows(); ++r ) {
+            for( size_t k = 0; k < data.cols(); ++k ) {
+                auto const v = data( r, k );
+                if( v == 0.0 ) {
+                    continue;
+                }
+                for( size_t c = 0; c < other.cols(); ++c ) {
+                    local( k, c ) += v * other( r, c );
+                }
+            }
+        }
+
+        #pragma omp critical (gappa_randomized_svd_reduce)
+        {
+            for( size_t k = 0; k < result.rows(); ++k ) {
+                for( size_t c = 0; c < result.cols(); ++c ) {
+                    result( k, c ) += local( k, c );
+                }
+            }
+        }
+    }
+    return result;
+}
+
+/**
+ * @brief Orthonormalize the columns of the given thin matrix in place,
+ * using modified Gram-Schmidt, which is numerically stable enough for our few columns.
+ */
+static void orthonormalize_columns_( Matrix<double>& mat )
+{
+    for( size_t c = 0; c < mat.cols(); ++c ) {
+
+        // Remove the components of all previous columns from this one.
+        for( size_t p = 0; p < c; ++p ) {
+            double dot = 0.0;
+
+            #pragma omp parallel for schedule(static) reduction(+:dot)
+            for( size_t r = 0; r < mat.rows(); ++r ) {
+                dot += mat( r, p ) * mat( r, c );
+            }
+
+            #pragma omp parallel for schedule(static)
+            for( size_t r = 0; r < mat.rows(); ++r ) {
+                mat( r, c ) -= dot * mat( r, p );
+            }
+        }
+
+        // Normalize the column. If it is (numerically) zero, the range of the data is
+        // exhausted; we keep the zero column, the corresponding singular value comes out
+        // as zero then, which is what we want.
+        double norm = 0.0;
+        #pragma omp parallel for schedule(static) reduction(+:norm)
+        for( size_t r = 0; r < mat.rows(); ++r ) {
+            norm += mat( r, c ) * mat( r, c );
+        }
+        norm = std::sqrt( norm );
+        if( norm > 0.0 ) {
+            #pragma omp parallel for schedule(static)
+            for( size_t r = 0; r < mat.rows(); ++r ) {
+                mat( r, c ) /= norm;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Eigen-decomposition of a small symmetric matrix via cyclic Jacobi rotations.
+ *
+ * The matrix is destroyed in the process; its diagonal ends up holding the eigenvalues.
+ * Returns the eigenvalues and the matrix of eigenvectors (in columns), sorted descending.
+ */
+static std::pair<std::vector<double>, Matrix<double>> jacobi_eigen_( Matrix<double>& mat )
+{
+    assert( mat.rows() == mat.cols() );
+    auto const n = mat.rows();
+    auto vecs = Matrix<double>( n, n, 0.0 );
+    for( size_t i = 0; i < n; ++i ) {
+        vecs( i, i ) = 1.0;
+    }
+
+    // Sweep until the off-diagonal mass is gone. The matrix is tiny (rank + oversample),
+    // so the quadratic sweeps are negligible compared to the big matrix products.
+    for( size_t sweep = 0; sweep < 100; ++sweep ) {
+        double off = 0.0;
+        for( size_t p = 0; p < n; ++p ) {
+            for( size_t q = p + 1; q < n; ++q ) {
+                off += mat( p, q ) * mat( p, q );
+            }
+        }
+        if( off < 1e-24 ) {
+            break;
+        }
+
+        for( size_t p = 0; p < n; ++p ) {
+            for( size_t q = p + 1; q < n; ++q ) {
+                if( mat( p, q ) == 0.0 ) {
+                    continue;
+                }
+
+                // Standard symmetric Jacobi rotation that zeroes out mat( p, q ).
+                auto const theta = ( mat( q, q ) - mat( p, p )) / ( 2.0 * mat( p, q ));
+                auto const t = ( theta >= 0.0 ? 1.0 : -1.0 )
+                             / ( std::fabs( theta ) + std::sqrt( theta * theta + 1.0 ));
+                auto const c = 1.0 / std::sqrt( t * t + 1.0 );
+                auto const s = t * c;
+
+                for( size_t i = 0; i < n; ++i ) {
+                    auto const mip = mat( i, p );
+                    auto const miq = mat( i, q );
+                    mat( i, p ) = c * mip - s * miq;
+                    mat( i, q ) = s * mip + c * miq;
+                }
+                for( size_t i = 0; i < n; ++i ) {
+                    auto const mpi = mat( p, i );
+                    auto const mqi = mat( q, i );
+                    mat( p, i ) = c * mpi - s * mqi;
+                    mat( q, i ) = s * mpi + c * mqi;
+
+                    auto const vip = vecs( i, p );
+                    auto const viq = vecs( i, q );
+                    vecs( i, p ) = c * vip - s * viq;
+                    vecs( i, q ) = s * vip + c * viq;
+                }
+            }
+        }
+    }
+
+    // Sort eigenpairs descending by eigenvalue.
+    auto order = std::vector<size_t>( n );
+    std::iota( order.begin(), order.end(), size_t( 0 ));
+    std::sort( order.begin(), order.end(), [&]( size_t a, size_t b ){
+        return mat( a, a ) > mat( b, b );
+    });
+
+    auto vals = std::vector<double>( n );
+    auto sorted_vecs = Matrix<double>( n, n );
+    for( size_t c = 0; c < n; ++c ) {
+        vals[c] = mat( order[c], order[c] );
+        for( size_t r = 0; r < n; ++r ) {
+            sorted_vecs( r, c ) = vecs( r, order[c] );
+        }
+    }
+    return { std::move( vals ), std::move( sorted_vecs ) };
+}
+
+// =================================================================================================
+//      Randomized SVD
+// =================================================================================================
+
+RandomizedSvdResult randomized_svd(
+    Matrix<double> const& data,
+    size_t rank,
+    size_t oversample,
+    size_t power_iterations
+) {
+    if( rank == 0 ) {
+        throw std::runtime_error( "Cannot compute a randomized SVD with rank 0." );
+    }
+    auto const n = data.rows();
+    auto const m = data.cols();
+    rank = std::min( rank, std::min( n, m ));
+
+    // Number of columns of the sketch: the requested rank plus some oversampling,
+    // capped by the matrix dimensions.
+    auto const sketch = std::min( rank + oversample, std::min( n, m ));
+
+    // Gaussian test matrix, m x sketch. A fixed seed keeps repeated runs on the same
+    // data comparable; the oversampling makes the result robust to the choice anyway.
+    auto omega = Matrix<double>( m, sketch );
+    std::mt19937 engine( 4013 );
+    std::normal_distribution<double> gaussian( 0.0, 1.0 );
+    for( auto& e : omega ) {
+        e = gaussian( engine );
+    }
+
+    // Range finder: Y = X * Omega, refined by power iterations Y = X * (X^T * Y),
+    // with orthonormalization after each product to keep the columns from collapsing
+    // onto the dominant singular direction.
+    auto q = multiply_thin_( data, omega );
+    orthonormalize_columns_( q );
+    for( size_t it = 0; it < power_iterations; ++it ) {
+        auto z = multiply_transposed_thin_( data, q );
+        orthonormalize_columns_( z );
+        q = multiply_thin_( data, z );
+        orthonormalize_columns_( q );
+    }
+
+    // Project the data onto the subspace: B = Q^T * X, stored transposed as m x sketch,
+    // and decompose its small Gram matrix B * B^T (sketch x sketch).
+    auto const bt = multiply_transposed_thin_( data, q );
+    auto gram = Matrix<double>( sketch, sketch, 0.0 );
+    #pragma omp parallel for schedule(static)
+    for( size_t i = 0; i < sketch; ++i ) {
+        for( size_t j = 0; j < sketch; ++j ) {
+            double sum = 0.0;
+            for( size_t r = 0; r < m; ++r ) {
+                sum += bt( r, i ) * bt( r, j );
+            }
+            gram( i, j ) = sum;
+        }
+    }
+    auto const eigen = jacobi_eigen_( gram );
+
+    // Assemble the truncated result: sigma = sqrt( eigenvalues of the Gram matrix ),
+    // U = Q * U_B, and V = B^T * U_B / sigma.
+    auto result = RandomizedSvdResult();
+    result.singular_values = std::vector<double>( rank, 0.0 );
+    result.u = Matrix<double>( n, rank, 0.0 );
+    result.v = Matrix<double>( m, rank, 0.0 );
+
+    for( size_t c = 0; c < rank; ++c ) {
+        result.singular_values[c] = std::sqrt( std::max( eigen.first[c], 0.0 ));
+    }
+
+    #pragma omp parallel for schedule(static)
+    for( size_t r = 0; r < n; ++r ) {
+        for( size_t c = 0; c < rank; ++c ) {
+            double sum = 0.0;
+            for( size_t k = 0; k < sketch; ++k ) {
+                sum += q( r, k ) * eigen.second( k, c );
+            }
+            result.u( r, c ) = sum;
+        }
+    }
+
+    #pragma omp parallel for schedule(static)
+    for( size_t r = 0; r < m; ++r ) {
+        for( size_t c = 0; c < rank; ++c ) {
+            if( result.singular_values[c] <= 0.0 ) {
+                continue;
+            }
+            double sum = 0.0;
+            for( size_t k = 0; k < sketch; ++k ) {
+                sum += bt( r, k ) * eigen.second( k, c );
+            }
+            result.v( r, c ) = sum / result.singular_values[c];
+        }
+    }
+
+    return result;
+}
@@ -0,0 +1,63 @@
+#ifndef GAPPA_TOOLS_RANDOMIZED_SVD_H_
+#define GAPPA_TOOLS_RANDOMIZED_SVD_H_
+
+/*
+    gappa - Genesis Applications for Phylogenetic Placement Analysis
+    Copyright (C) 2017-2023 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+#include "genesis/utils/math/matrix.hpp"
+
+#include <vector>
+
+// =================================================================================================
+//      Randomized SVD
+// =================================================================================================
+
+/**
+ * @brief Result of randomized_svd(): the leading singular values and the corresponding
+ * left (`u`, rows x rank) and right (`v`, cols x rank) singular vectors of the input.
+ */
+struct RandomizedSvdResult
+{
+    std::vector<double> singular_values;
+    genesis::utils::Matrix<double> u;
+    genesis::utils::Matrix<double> v;
+};
+
+/**
+ * @brief Compute a truncated singular value decomposition of a large dense matrix,
+ * using the randomized range finder of Halko, Martinsson, Tropp (2011).
+ *
+ * Only the leading @p rank singular triplets are computed, so that the cost is a few
+ * blocked matrix products of the input with thin matrices of `rank + oversample` columns
+ * (parallelized across threads), instead of a full dense decomposition. The
+ * @p power_iterations improve the accuracy for matrices with slowly decaying spectra;
+ * two iterations are plenty for the leading components of typical data matrices.
+ */
+RandomizedSvdResult randomized_svd(
+    genesis::utils::Matrix<double> const& data,
+    size_t rank,
+    size_t oversample = 8,
+    size_t power_iterations = 2
+);
+
+#endif // include guard
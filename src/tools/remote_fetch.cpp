@@ -0,0 +1,274 @@
+/*
+    gappa - Genesis Applications for Phylogenetic Placement Analysis
+    Copyright (C) 2017-2024 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+#include "tools/remote_fetch.hpp"
+
+#include "genesis/utils/core/logging.hpp"
+#include "genesis/utils/text/string.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#ifndef _WIN32
+#   include <unistd.h>
+#endif
+
+// =================================================================================================
+//      Local Helpers
+// =================================================================================================
+
+/**
+ * @brief Minimum object size for which we use parallel ranged requests.
+ *
+ * Below this, the per-request overhead outweighs the extra connections.
+ */
+static long long const range_min_size_ = 32ll * 1024 * 1024;
+
+/**
+ * @brief Registry of staged files and directories, removed again at program exit.
+ */
+static std::mutex cleanup_mutex_;
+static std::vector<std::string> cleanup_files_;
+static std::vector<std::string> cleanup_dirs_;
+
+static void cleanup_staging_()
+{
+    // No locking here; atexit handlers run after all threads that stage files.
+    for( auto const& file : cleanup_files_ ) {
+        std::remove( file.c_str() );
+    }
+    for( auto const& dir : cleanup_dirs_ ) {
+        #ifndef _WIN32
+            ::rmdir( dir.c_str() );
+        #endif
+    }
+}
+
+static void register_cleanup_file_( std::string const& path )
+{
+    std::lock_guard<std::mutex> lock( cleanup_mutex_ );
+    cleanup_files_.push_back( path );
+}
+
+/**
+ * @brief Reject URLs with characters that could break out of the shell quoting below.
+ *
+ * Valid URLs (RFC 3986) never contain these; anything else is percent-encoded.
+ */
+static void validate_url_( std::string const& url )
+{
+    for( auto const c : url ) {
+        auto const uc = static_cast<unsigned char>( c );
+        if( uc < 0x21 || uc > 0x7e || c == '\'' || c == '"' || c == '\\' || c == '`' ) {
+            throw std::runtime_error( "Invalid character in remote input URL: " + url );
+        }
+    }
+}
+
+/**
+ * @brief Run a command, optionally capturing its standard output.
+ * Returns the exit status as reported by `pclose()`.
+ */
+static int run_command_( std::string const& command, std::string* output = nullptr )
+{
+    auto pipe = ::popen( command.c_str(), "r" );
+    if( ! pipe ) {
+        throw std::runtime_error( "Cannot start download process for remote input files." );
+    }
+    char buffer[ 4096 ];
+    while( std::fgets( buffer, sizeof( buffer ), pipe )) {
+        if( output ) {
+            *output += buffer;
+        }
+    }
+    return ::pclose( pipe );
+}
+
+/**
+ * @brief Size and range support of a remote object, as reported by a HEAD request.
+ */
+struct RemoteObjectInfo
+{
+    long long size = -1;
+    bool ranges = false;
+};
+
+static RemoteObjectInfo remote_object_info_( std::string const& url )
+{
+    RemoteObjectInfo info;
+
+    // If the HEAD request fails (some presigned URLs only allow GET), we simply fall
+    // back to a single plain download, which then reports any real errors.
+    std::string headers;
+    auto const command = "curl --silent --head --location --fail '" + url + "'";
+    if( run_command_( command, &headers ) != 0 ) {
+        return info;
+    }
+
+    // With redirects, curl prints one header block per hop; the last values win.
+    std::istringstream stream( headers );
+    std::string line;
+    while( std::getline( stream, line )) {
+        auto const lower = genesis::utils::to_lower( line );
+        if( lower.compare( 0, 15, "content-length:" ) == 0 ) {
+            try {
+                info.size = std::stoll( line.substr( 15 ));
+            } catch( ... ) {
+                info.size = -1;
+            }
+        } else if( lower.compare( 0, 14, "accept-ranges:" ) == 0 ) {
+            info.ranges = ( lower.find( "bytes" ) != std::string::npos );
+        }
+    }
+    return info;
+}
+
+// =================================================================================================
+//      Remote Fetch
+// =================================================================================================
+
+bool is_remote_path( std::string const& path )
+{
+    return path.compare( 0, 7, "http://" ) == 0 || path.compare( 0, 8, "https://" ) == 0;
+}
+
+std::string fetch_remote_file(
+    std::string const& url,
+    std::string const& target_path,
+    size_t range_jobs
+) {
+    validate_url_( url );
+    LOG_MSG2 << "Downloading " << url;
+
+    // See whether the object is large enough, and the server willing, for ranged requests.
+    RemoteObjectInfo info;
+    if( range_jobs > 1 ) {
+        info = remote_object_info_( url );
+    }
+
+    if( range_jobs > 1 && info.ranges && info.size >= range_min_size_ ) {
+
+        // Parallel ranged requests: start one curl process per range, into part files.
+        // The processes run concurrently; we then wait for each of them in turn.
+        // No threads are needed, as the transfers happen in the child processes.
+        auto const chunk = ( info.size + static_cast<long long>( range_jobs ) - 1 )
+                         / static_cast<long long>( range_jobs );
+        std::vector<FILE*> processes;
+        std::vector<std::string> part_paths;
+        for( size_t job = 0; job < range_jobs; ++job ) {
+            auto const begin = static_cast<long long>( job ) * chunk;
+            auto const end = std::min( begin + chunk, info.size ) - 1;
+            if( begin > end ) {
+                break;
+            }
+            auto const part_path = target_path + ".part" + std::to_string( job );
+            auto const command
+                = "curl --silent --show-error --fail --location --range "
+                + std::to_string( begin ) + "-" + std::to_string( end )
+                + " --output '" + part_path + "' '" + url + "'"
+            ;
+            auto process = ::popen( command.c_str(), "r" );
+            if( ! process ) {
+                throw std::runtime_error(
+                    "Cannot start download process for remote input files."
+                );
+            }
+            processes.push_back( process );
+            part_paths.push_back( part_path );
+        }
+
+        bool success = true;
+        for( auto process : processes ) {
+            char buffer[ 4096 ];
+            while( std::fgets( buffer, sizeof( buffer ), process )) {
+                // Drain; curl is silent on success.
+            }
+            success &= ( ::pclose( process ) == 0 );
+        }
+        if( ! success ) {
+            for( auto const& part_path : part_paths ) {
+                std::remove( part_path.c_str() );
+            }
+            throw std::runtime_error( "Failed to download remote input: " + url );
+        }
+
+        // Concatenate the parts into the target file, in range order.
+        std::ofstream target( target_path, std::ios::binary );
+        for( auto const& part_path : part_paths ) {
+            std::ifstream part( part_path, std::ios::binary );
+            target << part.rdbuf();
+            part.close();
+            std::remove( part_path.c_str() );
+        }
+        if( ! target ) {
+            throw std::runtime_error( "Cannot write staged remote input: " + target_path );
+        }
+
+    } else {
+
+        // Plain single download.
+        auto const command
+            = "curl --silent --show-error --fail --location --output '"
+            + target_path + "' '" + url + "'"
+        ;
+        if( run_command_( command ) != 0 ) {
+            std::remove( target_path.c_str() );
+            throw std::runtime_error(
+                "Failed to download remote input (is `curl` installed?): " + url
+            );
+        }
+    }
+
+    register_cleanup_file_( target_path );
+    return target_path;
+}
+
+std::string make_remote_staging_dir()
+{
+    auto const* tmpdir = std::getenv( "TMPDIR" );
+    auto const base = ( tmpdir && *tmpdir ) ? std::string( tmpdir ) : std::string( "/tmp" );
+    auto templ = base + "/gappa-remote-XXXXXX";
+
+    std::vector<char> buffer( templ.begin(), templ.end() );
+    buffer.push_back( '\0' );
+    if( ::mkdtemp( buffer.data() ) == nullptr ) {
+        throw std::runtime_error(
+            "Cannot create staging directory for remote input files under " + base
+        );
+    }
+    auto const dir = std::string( buffer.data() );
+
+    std::lock_guard<std::mutex> lock( cleanup_mutex_ );
+    if( cleanup_dirs_.empty() ) {
+        std::atexit( cleanup_staging_ );
+    }
+    cleanup_dirs_.push_back( dir );
+    return dir;
+}
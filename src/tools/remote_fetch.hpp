@@ -0,0 +1,65 @@
+#ifndef GAPPA_TOOLS_REMOTE_FETCH_H_
+#define GAPPA_TOOLS_REMOTE_FETCH_H_
+
+/*
+    gappa - Genesis Applications for Phylogenetic Placement Analysis
+    Copyright (C) 2017-2024 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+#include <string>
+
+// =================================================================================================
+//      Remote Fetch
+// =================================================================================================
+
+/**
+ * @brief Return whether the given input path is a remote object URL, i.e., starts with
+ * `http://` or `https://`.
+ *
+ * Input files in S3-compatible object storage are addressed via their (presigned) https
+ * URLs, so this covers the common object store setups without needing a vendor SDK.
+ */
+bool is_remote_path( std::string const& path );
+
+/**
+ * @brief Download a remote object to the given local path, and return that path.
+ *
+ * The download is done by invoking `curl`, which has to be available on the system;
+ * this avoids linking an http stack into gappa for a feature that most runs do not use.
+ * For large objects on servers that support range requests, the object is fetched with
+ * @p range_jobs parallel ranged requests, which typically saturates the network far
+ * better than a single connection to an object store. Throws if the download fails.
+ */
+std::string fetch_remote_file(
+    std::string const& url,
+    std::string const& target_path,
+    size_t range_jobs
+);
+
+/**
+ * @brief Create a unique staging directory for downloaded remote input files.
+ *
+ * The directory is created under `$TMPDIR` (or `/tmp`), and it and the files staged
+ * into it via fetch_remote_file() are removed when the program exits.
+ */
+std::string make_remote_staging_dir();
+
+#endif // include guard
@@ -0,0 +1,134 @@
+/*
+    gappa - Genesis Applications for Phylogenetic Placement Analysis
+    Copyright (C) 2017-2024 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+#include "tools/sample_columns.hpp"
+
+#include "genesis/placement/function/functions.hpp"
+#include "genesis/placement/function/masses.hpp"
+
+#include <cassert>
+
+#ifdef GENESIS_OPENMP
+#   include <omp.h>
+#endif
+
+// =================================================================================================
+//      Sample Columns
+// =================================================================================================
+
+SampleColumns sample_columns( genesis::placement::Sample const& sample )
+{
+    using namespace genesis::placement;
+
+    SampleColumns result;
+    auto const total = total_placement_count( sample );
+    result.pquery_offsets.reserve( sample.size() + 1 );
+    result.multiplicities.reserve( sample.size() );
+    result.edge_indices.reserve( total );
+    result.like_weight_ratios.reserve( total );
+    result.proximal_lengths.reserve( total );
+    result.pendant_lengths.reserve( total );
+
+    result.pquery_offsets.push_back( 0 );
+    for( auto const& pquery : sample ) {
+        result.multiplicities.push_back( total_multiplicity( pquery ));
+        for( auto const& placement : pquery.placements() ) {
+            result.edge_indices.push_back( placement.edge().index() );
+            result.like_weight_ratios.push_back( placement.like_weight_ratio );
+            result.proximal_lengths.push_back( placement.proximal_length );
+            result.pendant_lengths.push_back( placement.pendant_length );
+        }
+        result.pquery_offsets.push_back( result.edge_indices.size() );
+    }
+    assert( result.placement_count() == total );
+    return result;
+}
+
+// =================================================================================================
+//      Edge Masses
+// =================================================================================================
+
+std::vector<double> accumulate_edge_masses(
+    SampleColumns const& columns,
+    size_t edge_count,
+    bool parallel
+) {
+    auto result = std::vector<double>( edge_count, 0.0 );
+
+    #if defined( GENESIS_OPENMP )
+    if( parallel ) {
+        // Each thread scatters its share of the pqueries into its own mass buffer,
+        // so that the accumulation needs no synchronization.
+        auto partials = std::vector<std::vector<double>>( omp_get_max_threads() );
+        #pragma omp parallel
+        {
+            auto& partial = partials[ omp_get_thread_num() ];
+            partial.assign( edge_count, 0.0 );
+
+            #pragma omp for schedule(static)
+            for( size_t qi = 0; qi < columns.pquery_count(); ++qi ) {
+                auto const mult = columns.multiplicities[qi];
+                auto const end  = columns.placements_end( qi );
+                for( size_t k = columns.placements_begin( qi ); k < end; ++k ) {
+                    partial[ columns.edge_indices[k] ] += mult * columns.like_weight_ratios[k];
+                }
+            }
+
+            // The loop above ends with a barrier, after which all buffers are complete.
+            // Merge them, with the edge range partitioned across the threads.
+            #pragma omp for schedule(static)
+            for( size_t e = 0; e < edge_count; ++e ) {
+                double mass = 0.0;
+                for( size_t t = 0; t < partials.size(); ++t ) {
+                    // Threads that did not join the team leave their buffer empty.
+                    if( ! partials[t].empty() ) {
+                        mass += partials[t][e];
+                    }
+                }
+                result[e] = mass;
+            }
+        }
+        return result;
+    }
+    #else
+    (void) parallel;
+    #endif
+
+    for( size_t qi = 0; qi < columns.pquery_count(); ++qi ) {
+        auto const mult = columns.multiplicities[qi];
+        auto const end  = columns.placements_end( qi );
+        for( size_t k = columns.placements_begin( qi ); k < end; ++k ) {
+            result[ columns.edge_indices[k] ] += mult * columns.like_weight_ratios[k];
+        }
+    }
+    return result;
+}
+
+std::vector<double> accumulate_edge_masses(
+    genesis::placement::Sample const& sample,
+    bool parallel
+) {
+    return accumulate_edge_masses(
+        sample_columns( sample ), sample.tree().edge_count(), parallel
+    );
+}
@@ -0,0 +1,120 @@
+#ifndef GAPPA_TOOLS_SAMPLE_COLUMNS_H_
+#define GAPPA_TOOLS_SAMPLE_COLUMNS_H_
+
+/*
+    gappa - Genesis Applications for Phylogenetic Placement Analysis
+    Copyright (C) 2017-2024 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+#include "genesis/placement/sample.hpp"
+
+#include <cstddef>
+#include <vector>
+
+// =================================================================================================
+//      Sample Columns
+// =================================================================================================
+
+/**
+ * @brief Columnar (structure of arrays) view of the placement data of a Sample.
+ *
+ * The genesis Sample stores its placements as a graph of small heap objects
+ * (pquery, placements, edge pointers), which makes loops over all placements chase
+ * pointers for every field access. This view gathers the numeric per-placement fields
+ * into contiguous arrays once, grouped by pquery via an offsets array, so that the
+ * per-placement loops of the examine and edit commands read linear memory instead.
+ * Names are not part of the view; loops that need them keep reading the Sample.
+ *
+ * The view is a copy of the data at construction time: modifying the sample afterwards
+ * does not change the view, which commands that rewrite their pqueries (such as
+ * accumulate) rely on.
+ */
+struct SampleColumns
+{
+    /**
+     * @brief Offsets of each pquery into the placement columns, with one past-the-end
+     * entry, so that the placements of pquery `i` are the range `[ offsets[i], offsets[i+1] )`.
+     */
+    std::vector<size_t> pquery_offsets;
+
+    /**
+     * @brief Total multiplicity per pquery, that is, the sum over its names.
+     */
+    std::vector<double> multiplicities;
+
+    // Per-placement columns, grouped by pquery, in sample order.
+    std::vector<size_t> edge_indices;
+    std::vector<double> like_weight_ratios;
+    std::vector<double> proximal_lengths;
+    std::vector<double> pendant_lengths;
+
+    size_t pquery_count() const
+    {
+        return multiplicities.size();
+    }
+
+    size_t placement_count() const
+    {
+        return edge_indices.size();
+    }
+
+    size_t placements_begin( size_t pquery_index ) const
+    {
+        return pquery_offsets[ pquery_index ];
+    }
+
+    size_t placements_end( size_t pquery_index ) const
+    {
+        return pquery_offsets[ pquery_index + 1 ];
+    }
+};
+
+/**
+ * @brief Build the columnar view of a sample, see SampleColumns.
+ */
+SampleColumns sample_columns( genesis::placement::Sample const& sample );
+
+/**
+ * @brief Accumulate the placement mass per edge of the reference tree, weighted by the
+ * pquery multiplicities, equivalent to the genesis
+ * placement_mass_per_edges_with_multiplicities().
+ *
+ * The masses are scattered into the result from the contiguous placement columns.
+ * If @p parallel is set, the pqueries are partitioned across threads with per-thread
+ * mass buffers, which are then merged over thread-partitioned edge ranges. This is
+ * meant for processing one large sample at a time; commands that already parallelize
+ * over their samples should leave it unset.
+ */
+std::vector<double> accumulate_edge_masses(
+    SampleColumns const& columns,
+    size_t edge_count,
+    bool parallel = false
+);
+
+/**
+ * @brief Convenience overload that builds the columnar view of the sample first.
+ */
+std::vector<double> accumulate_edge_masses(
+    genesis::placement::Sample const& sample,
+    bool parallel = false
+);
+
+#endif // include guard
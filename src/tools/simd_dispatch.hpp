@@ -0,0 +1,88 @@
+#ifndef GAPPA_TOOLS_SIMD_DISPATCH_H_
+#define GAPPA_TOOLS_SIMD_DISPATCH_H_
+
+/*
+    gappa - Genesis Applications for Phylogenetic Placement Analysis
+    Copyright (C) 2017-2024 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+#include <cstddef>
+
+// =================================================================================================
+//      SIMD Dispatch
+// =================================================================================================
+
+/**
+ * @brief Instruction set extensions that the dense kernels below are compiled for.
+ *
+ * One gappa binary is often deployed across heterogeneous cluster nodes, so a single
+ * compile-time instruction set choice either leaves performance on the table on newer
+ * CPUs, or crashes on older ones. Instead, the hot dense kernels are compiled into the
+ * binary several times, once per extension level (via per-function target attributes),
+ * and the best variant that the executing CPU supports is selected once at runtime.
+ *
+ * On arm, advanced SIMD (NEON) is part of the baseline architecture, so no runtime
+ * selection is needed there; the level is reported for logging symmetry.
+ */
+enum class SimdLevel
+{
+    kScalar,
+    kAvx2,
+    kAvx512,
+    kNeon
+};
+
+/**
+ * @brief The best SIMD level that the executing CPU supports, detected once on first use.
+ */
+SimdLevel simd_level();
+
+/**
+ * @brief Printable name of a SIMD level, for logging.
+ */
+char const* simd_level_name( SimdLevel level );
+
+// =================================================================================================
+//      Dispatched Kernels
+// =================================================================================================
+
+/**
+ * @brief Euclidean distance between two contiguous vectors of equal size,
+ * dispatched to the widest vector instructions of the executing CPU.
+ *
+ * This is the inner kernel of the imbalance k-means distance evaluations, where the
+ * vectors are the imbalance profiles of samples and centroids, with tens of thousands
+ * of entries for large reference trees.
+ */
+double euclidean_distance( double const* lhs, double const* rhs, size_t size );
+
+/**
+ * @brief Weighted sum of absolute differences of two contiguous vectors,
+ * `sum_i |lhs[i] - rhs[i]| * weights[i]`, dispatched like euclidean_distance().
+ *
+ * This is the inner kernel of the node histogram distance, where the vectors are the
+ * flattened per-node histogram CDFs of two samples, and the weights the bin widths.
+ */
+double weighted_l1_distance(
+    double const* lhs, double const* rhs, double const* weights, size_t size
+);
+
+#endif // include guard
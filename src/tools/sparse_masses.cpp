@@ -0,0 +1,361 @@
+/*
+    gappa - Genesis Applications for Phylogenetic Placement Analysis
+    Copyright (C) 2017-2024 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+#include "tools/sparse_masses.hpp"
+
+#include "genesis/tree/function/functions.hpp"
+#include "genesis/tree/iterator/postorder.hpp"
+#include "genesis/tree/mass_tree/tree.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <queue>
+#include <stdexcept>
+#include <utility>
+
+// =================================================================================================
+//      Sparse Masses
+// =================================================================================================
+
+SparseMasses merge_sparse_masses(
+    SparseMasses const& lhs,
+    SparseMasses const& rhs,
+    double scaler_lhs,
+    double scaler_rhs
+) {
+    auto const& le = lhs.entries;
+    auto const& re = rhs.entries;
+
+    SparseMasses result;
+    result.entries.reserve( le.size() + re.size() );
+    size_t li = 0;
+    size_t ri = 0;
+    while( li < le.size() || ri < re.size() ) {
+        // Take the entry with the lower (edge, position) key. Keys present in both
+        // buffers are combined into one entry, summing up the scaled masses.
+        if( ri == re.size() || (
+            li < le.size() && (
+                le[li].edge < re[ri].edge || (
+                    le[li].edge == re[ri].edge && le[li].position < re[ri].position
+                )
+            )
+        )) {
+            result.entries.push_back({ le[li].edge, le[li].position, scaler_lhs * le[li].mass });
+            ++li;
+        } else if(
+            li < le.size() && le[li].edge == re[ri].edge && le[li].position == re[ri].position
+        ) {
+            result.entries.push_back({
+                le[li].edge, le[li].position,
+                scaler_lhs * le[li].mass + scaler_rhs * re[ri].mass
+            });
+            ++li;
+            ++ri;
+        } else {
+            result.entries.push_back({ re[ri].edge, re[ri].position, scaler_rhs * re[ri].mass });
+            ++ri;
+        }
+    }
+    return result;
+}
+
+// =================================================================================================
+//      Mass Tree Layout
+// =================================================================================================
+
+const uint32_t MassTreeLayout::no_parent_;
+
+MassTreeLayout::MassTreeLayout( genesis::tree::MassTree const& tree )
+{
+    using namespace genesis::tree;
+
+    // Keep a mass-free copy of the reference tree, for expand().
+    template_tree_ = tree;
+    for( auto& edge : template_tree_.edges() ) {
+        edge.data<MassTreeEdgeData>().masses.clear();
+    }
+
+    auto const num_edges = template_tree_.edge_count();
+    if( num_edges >= static_cast<size_t>( no_parent_ )) {
+        throw std::runtime_error( "Tree is too large for the sparse mass representation." );
+    }
+
+    // Collect the edges in postorder, that is, children before parents.
+    postorder_edges_.reserve( num_edges );
+    branch_lengths_.reserve( num_edges );
+    rank_of_edge_.resize( num_edges, 0 );
+    for( auto it : postorder( template_tree_ )) {
+        if( it.is_last_iteration() ) {
+            continue;
+        }
+        rank_of_edge_[ it.edge().index() ] = static_cast<uint32_t>( postorder_edges_.size() );
+        postorder_edges_.push_back( it.edge().index() );
+        branch_lengths_.push_back( it.edge().data<MassTreeEdgeData>().branch_length );
+    }
+    assert( postorder_edges_.size() == num_edges );
+
+    // Store the parent edge of each edge, that is, the next edge towards the root,
+    // which in postorder always has a higher rank than all edges of its subtree.
+    parent_ranks_.resize( num_edges, no_parent_ );
+    for( size_t rank = 0; rank < num_edges; ++rank ) {
+        auto const& prox = template_tree_.edge_at( postorder_edges_[rank] ).primary_node();
+        if( is_root( prox )) {
+            continue;
+        }
+        parent_ranks_[rank] = rank_of_edge_[ prox.primary_link().edge().index() ];
+        assert( parent_ranks_[rank] > rank );
+    }
+}
+
+SparseMasses MassTreeLayout::compress( genesis::tree::MassTree const& tree ) const
+{
+    using namespace genesis::tree;
+
+    if( tree.edge_count() != edge_count() ) {
+        throw std::runtime_error(
+            "Cannot compress masses of a tree whose topology differs from the reference tree."
+        );
+    }
+
+    SparseMasses result;
+    size_t total = 0;
+    for( auto const& edge : tree.edges() ) {
+        total += edge.data<MassTreeEdgeData>().masses.size();
+    }
+    result.entries.reserve( total );
+
+    // The mass maps are sorted by position, so visiting the edges by rank yields
+    // the entries in their (edge, position) sort order directly.
+    for( size_t rank = 0; rank < postorder_edges_.size(); ++rank ) {
+        auto const& masses
+            = tree.edge_at( postorder_edges_[rank] ).data<MassTreeEdgeData>().masses
+        ;
+        for( auto const& mass : masses ) {
+            result.entries.push_back({ static_cast<uint32_t>( rank ), mass.first, mass.second });
+        }
+    }
+    return result;
+}
+
+genesis::tree::MassTree MassTreeLayout::expand( SparseMasses const& masses ) const
+{
+    using namespace genesis::tree;
+
+    auto tree = template_tree_;
+    for( auto const& entry : masses.entries ) {
+        assert( entry.edge < postorder_edges_.size() );
+        auto& edge_masses
+            = tree.edge_at( postorder_edges_[ entry.edge ] ).data<MassTreeEdgeData>().masses
+        ;
+        edge_masses[ entry.position ] += entry.mass;
+    }
+    return tree;
+}
+
+MassTreeLayout::Coarsening MassTreeLayout::coarsening( double resolution ) const
+{
+    auto const num_edges = postorder_edges_.size();
+
+    // Height of the subtree below the distal node of each edge: the longest path from
+    // that node to any leaf below it. As children have lower ranks than their parents,
+    // one ascending pass suffices.
+    auto subtree_heights = std::vector<double>( num_edges, 0.0 );
+    for( size_t rank = 0; rank < num_edges; ++rank ) {
+        auto const parent = parent_ranks_[rank];
+        if( parent != no_parent_ ) {
+            subtree_heights[parent] = std::max(
+                subtree_heights[parent], branch_lengths_[rank] + subtree_heights[rank]
+            );
+        }
+    }
+
+    // An edge is absorbed if the whole subtree below its parent's distal node fits within
+    // the resolution; its mass then moves to the anchor of the parent, which is the parent
+    // itself, or a further ancestor if the collapsed subtrees nest. Iterating parents
+    // before children (descending ranks) resolves the chains in one pass.
+    Coarsening result;
+    result.anchors.resize( num_edges );
+    result.up_distances.resize( num_edges, 0.0 );
+    for( size_t i = 0; i < num_edges; ++i ) {
+        auto const rank = num_edges - 1 - i;
+        auto const parent = parent_ranks_[rank];
+        if( parent != no_parent_ && subtree_heights[parent] <= resolution ) {
+            result.anchors[rank] = result.anchors[parent];
+            result.up_distances[rank]
+                = ( result.anchors[parent] == parent )
+                ? 0.0
+                : result.up_distances[parent] + branch_lengths_[parent]
+            ;
+        } else {
+            result.anchors[rank] = static_cast<uint32_t>( rank );
+            ++result.kept_edge_count;
+        }
+    }
+    return result;
+}
+
+SparseMasses MassTreeLayout::coarsen(
+    SparseMasses const& masses,
+    Coarsening const& coarsening,
+    double& moved_mass_distance
+) const {
+    SparseMasses result;
+    result.entries.reserve( masses.entries.size() );
+
+    // Move each entry of a collapsed subtree to the distal end of its anchor edge.
+    // The path to that point leads from the entry's position to the proximal node of
+    // its edge, and from there up to the anchor.
+    for( auto const& entry : masses.entries ) {
+        assert( entry.edge < coarsening.anchors.size() );
+        auto const anchor = coarsening.anchors[ entry.edge ];
+        if( anchor == entry.edge ) {
+            result.entries.push_back( entry );
+            continue;
+        }
+        moved_mass_distance
+            += std::abs( entry.mass )
+            *  ( entry.position + coarsening.up_distances[ entry.edge ] )
+        ;
+        result.entries.push_back({ anchor, branch_lengths_[anchor], entry.mass });
+    }
+
+    // Moving entries to higher ranks breaks the (edge, position) sort order,
+    // so restore it and combine the entries that landed on the same point.
+    std::sort(
+        result.entries.begin(), result.entries.end(),
+        []( SparseMasses::Entry const& lhs, SparseMasses::Entry const& rhs ){
+            return lhs.edge < rhs.edge
+                || ( lhs.edge == rhs.edge && lhs.position < rhs.position );
+        }
+    );
+    size_t out = 0;
+    for( size_t i = 0; i < result.entries.size(); ++i ) {
+        if(
+            out > 0
+            && result.entries[ out - 1 ].edge     == result.entries[i].edge
+            && result.entries[ out - 1 ].position == result.entries[i].position
+        ) {
+            result.entries[ out - 1 ].mass += result.entries[i].mass;
+        } else {
+            result.entries[ out ] = result.entries[i];
+            ++out;
+        }
+    }
+    result.entries.resize( out );
+    return result;
+}
+
+double MassTreeLayout::earth_movers_distance(
+    SparseMasses const& lhs,
+    SparseMasses const& rhs,
+    double p,
+    double limit
+) const {
+    auto const& le = lhs.entries;
+    auto const& re = rhs.entries;
+    size_t li = 0;
+    size_t ri = 0;
+
+    // Subtree masses that have been pushed up to edges not yet processed,
+    // as (edge rank, mass) pairs, with the lowest rank on top.
+    using Pending = std::pair<uint32_t, double>;
+    std::priority_queue<Pending, std::vector<Pending>, std::greater<Pending>> pending;
+
+    double work = 0.0;
+    while( li < le.size() || ri < re.size() || ! pending.empty() ) {
+
+        // Find the next occupied edge: the lowest rank that has local masses in either
+        // sample, or mass arriving from its subtree. All other edges contribute nothing.
+        uint32_t rank = no_parent_;
+        if( li < le.size() ) {
+            rank = std::min( rank, le[li].edge );
+        }
+        if( ri < re.size() ) {
+            rank = std::min( rank, re[ri].edge );
+        }
+        if( ! pending.empty() ) {
+            rank = std::min( rank, pending.top().first );
+        }
+        assert( rank != no_parent_ );
+
+        // Mass that arrives at the distal end of the edge from its subtree.
+        double current = 0.0;
+        while( ! pending.empty() && pending.top().first == rank ) {
+            current += pending.top().second;
+            pending.pop();
+        }
+
+        // Ranges of the local masses of both samples on this edge, sorted by position.
+        auto const lbegin = li;
+        while( li < le.size() && le[li].edge == rank ) {
+            ++li;
+        }
+        auto const rbegin = ri;
+        while( ri < re.size() && re[ri].edge == rank ) {
+            ++ri;
+        }
+
+        // Sweep the edge from its distal end to its proximal end: each segment between
+        // mass positions moves the so far accumulated mass (rhs negated) across it.
+        double pos = branch_lengths_[rank];
+        auto lj = li;
+        auto rj = ri;
+        while( lj > lbegin || rj > rbegin ) {
+            double mass;
+            double mass_pos;
+            if( rj == rbegin || ( lj > lbegin && le[lj-1].position >= re[rj-1].position )) {
+                --lj;
+                mass_pos = le[lj].position;
+                mass     = le[lj].mass;
+            } else {
+                --rj;
+                mass_pos = re[rj].position;
+                mass     = - re[rj].mass;
+            }
+            if( pos > mass_pos ) {
+                work += std::pow( std::abs( current ), p ) * ( pos - mass_pos );
+                pos = mass_pos;
+            }
+            current += mass;
+        }
+        if( pos > 0.0 ) {
+            work += std::pow( std::abs( current ), p ) * pos;
+        }
+
+        // Push the remaining mass up to the parent edge. Mass that reaches the root
+        // stays there; for pairs of normalized samples, it cancels out to zero anyway.
+        if( parent_ranks_[rank] != no_parent_ && current != 0.0 ) {
+            pending.emplace( parent_ranks_[rank], current );
+        }
+
+        // The work only ever grows, so once it exceeds the limit, the pair cannot
+        // qualify any more, and we can abandon the rest of the sweep.
+        if( work > limit ) {
+            return work;
+        }
+    }
+    return work;
+}
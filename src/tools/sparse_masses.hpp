@@ -0,0 +1,242 @@
+#ifndef GAPPA_TOOLS_SPARSE_MASSES_H_
+#define GAPPA_TOOLS_SPARSE_MASSES_H_
+
+/*
+    gappa - Genesis Applications for Phylogenetic Placement Analysis
+    Copyright (C) 2017-2024 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+#include "genesis/tree/mass_tree/tree.hpp"
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+// =================================================================================================
+//      Sparse Masses
+// =================================================================================================
+
+/**
+ * @brief Compressed representation of the masses of a MassTree.
+ *
+ * A MassTree stores a mass map on every edge, even when most edges of a sparse sample are
+ * empty, with considerable allocation overhead per mass point. This struct instead keeps
+ * only the occupied entries, in one contiguous buffer, sorted by edge (and by position
+ * within an edge), which for sparse samples shrinks the memory needed per sample by more
+ * than an order of magnitude. Edges are referred to by their postorder rank in the
+ * MassTreeLayout of the reference tree, so that the earth movers distance kernel can
+ * process the entries bottom-up in a single merged sweep, see
+ * MassTreeLayout::earth_movers_distance().
+ */
+struct SparseMasses
+{
+    struct Entry
+    {
+        /**
+         * @brief Postorder rank of the edge that the mass sits on, see MassTreeLayout.
+         */
+        uint32_t edge;
+
+        /**
+         * @brief Position of the mass along the branch, measured from the proximal node.
+         */
+        double position;
+
+        double mass;
+    };
+
+    std::vector<Entry> entries;
+};
+
+/**
+ * @brief Merge two sparse mass sets into one, scaling their masses by the given factors.
+ *
+ * This is the sparse equivalent of mass_tree_merge_trees(): the entry buffers are combined
+ * in one merge pass, with masses at the same edge and position summed up.
+ */
+SparseMasses merge_sparse_masses(
+    SparseMasses const& lhs,
+    SparseMasses const& rhs,
+    double scaler_lhs = 1.0,
+    double scaler_rhs = 1.0
+);
+
+// =================================================================================================
+//      Mass Tree Layout
+// =================================================================================================
+
+/**
+ * @brief Flattened topology of a reference MassTree, for working with SparseMasses.
+ *
+ * All samples of a run share the topology of their reference tree, so we store it once:
+ * the edges in postorder (children before parents), each with its branch length and its
+ * parent edge, that is, the next edge towards the root. SparseMasses refer to edges by
+ * their rank in this postorder, which allows earth_movers_distance() to push subtree
+ * masses towards the root while only ever touching edges that actually carry mass,
+ * instead of traversing all edges of the tree per sample pair.
+ */
+class MassTreeLayout
+{
+public:
+
+    // -------------------------------------------------------------------------
+    //     Constructor and Rule of Five
+    // -------------------------------------------------------------------------
+
+    MassTreeLayout() = default;
+
+    /**
+     * @brief Build the layout from a reference tree, whose topology all samples share.
+     */
+    explicit MassTreeLayout( genesis::tree::MassTree const& tree );
+
+    ~MassTreeLayout() = default;
+
+    MassTreeLayout( MassTreeLayout const& ) = default;
+    MassTreeLayout( MassTreeLayout&& )      = default;
+
+    MassTreeLayout& operator= ( MassTreeLayout const& ) = default;
+    MassTreeLayout& operator= ( MassTreeLayout&& )      = default;
+
+    // -------------------------------------------------------------------------
+    //     Conversion
+    // -------------------------------------------------------------------------
+
+    size_t edge_count() const
+    {
+        return branch_lengths_.size();
+    }
+
+    /**
+     * @brief Mass-free copy of the reference tree, for rebuilding trees via expand().
+     */
+    genesis::tree::MassTree const& template_tree() const
+    {
+        return template_tree_;
+    }
+
+    /**
+     * @brief Compress the masses of a tree (with the topology of the reference tree)
+     * into their sparse representation.
+     */
+    SparseMasses compress( genesis::tree::MassTree const& tree ) const;
+
+    /**
+     * @brief Rebuild a MassTree from a sparse mass set, for outputs that need a tree.
+     */
+    genesis::tree::MassTree expand( SparseMasses const& masses ) const;
+
+    // -------------------------------------------------------------------------
+    //     Coarsening
+    // -------------------------------------------------------------------------
+
+    /**
+     * @brief Mapping that collapses all subtrees whose height is below a branch-length
+     * resolution into single mass points, see coarsening().
+     *
+     * For each edge rank, @p anchors holds the rank of the edge at whose distal end the
+     * mass of the edge ends up (its own rank if the edge is kept), and @p up_distances
+     * the path length from the proximal node of the edge to that anchor point.
+     */
+    struct Coarsening
+    {
+        std::vector<uint32_t> anchors;
+        std::vector<double>   up_distances;
+
+        /**
+         * @brief Number of edges that remain distinguishable after collapsing.
+         */
+        size_t kept_edge_count = 0;
+    };
+
+    /**
+     * @brief Compute the coarsening of the reference tree at the given branch-length
+     * @p resolution: every maximal subtree whose height (the longest path from its root
+     * to any of its leaves) is at most the resolution is collapsed into a single mass
+     * point at its root.
+     *
+     * Masses within a collapsed subtree hence move by at most the resolution, which
+     * bounds the error of distances computed on the coarsened masses, see coarsen().
+     */
+    Coarsening coarsening( double resolution ) const;
+
+    /**
+     * @brief Apply a coarsening to a sparse mass set, moving all masses of collapsed
+     * subtrees to their anchor points.
+     *
+     * Adds the total of mass times distance moved to @p moved_mass_distance. For an
+     * exponent of 1, the earth movers distance between coarsened samples differs from
+     * the exact one by at most the sum of the two samples' moved totals, as each mass
+     * point can be re-routed to its original position at that cost.
+     */
+    SparseMasses coarsen(
+        SparseMasses const& masses,
+        Coarsening const& coarsening,
+        double& moved_mass_distance
+    ) const;
+
+    // -------------------------------------------------------------------------
+    //     Distance Kernel
+    // -------------------------------------------------------------------------
+
+    /**
+     * @brief Earth movers distance between two sparse mass sets, equivalent to the
+     * genesis earth_movers_distance() on the corresponding MassTrees.
+     *
+     * The kernel sweeps the occupied edges of both samples in postorder, accumulating
+     * the mass (rhs negated) that has to be moved across each branch segment, and pushing
+     * the remainder up to the parent edge. Empty edges only ever appear as such parents,
+     * so the work per pair scales with the number of occupied entries and their depth,
+     * instead of the size of the tree.
+     *
+     * If a @p limit is given, the computation is abandoned once the accumulated work
+     * exceeds it, returning a value greater than the limit instead of the exact distance.
+     * As the work only ever grows during the sweep, this allows searches that only need
+     * distances below a bound (such as nearest neighbor searches) to skip most of the
+     * work for pairs that cannot qualify.
+     */
+    double earth_movers_distance(
+        SparseMasses const& lhs,
+        SparseMasses const& rhs,
+        double p = 1.0,
+        double limit = std::numeric_limits<double>::infinity()
+    ) const;
+
+    // -------------------------------------------------------------------------
+    //     Internal Members
+    // -------------------------------------------------------------------------
+
+private:
+
+    static const uint32_t no_parent_ = 4294967295u;
+
+    genesis::tree::MassTree template_tree_;
+
+    // Edges in postorder: the edge index per rank, and its inverse, as well as the
+    // branch length and the rank of the parent edge (no_parent_ at the root) per rank.
+    std::vector<size_t>   postorder_edges_;
+    std::vector<uint32_t> rank_of_edge_;
+    std::vector<uint32_t> parent_ranks_;
+    std::vector<double>   branch_lengths_;
+
+};
+
+#endif // include guard
@@ -0,0 +1,673 @@
+/*
+    gappa - Genesis Applications for Phylogenetic Placement Analysis
+    Copyright (C) 2017-2022 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+#include "tools/squash_clustering.hpp"
+
+#include "genesis/utils/core/fs.hpp"
+#include "genesis/utils/core/logging.hpp"
+#include "genesis/utils/io/deserializer.hpp"
+#include "genesis/utils/io/input_source.hpp"
+#include "genesis/utils/io/output_target.hpp"
+#include "genesis/utils/io/serializer.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+
+#ifdef GENESIS_OPENMP
+#   include <omp.h>
+#endif
+
+// =================================================================================================
+//      Disk-Backed Tree Store
+// =================================================================================================
+
+std::string ParallelSquashClustering::spill_path_( size_t index ) const
+{
+    return spill_dir_ + "/cluster_" + std::to_string( index ) + ".bin";
+}
+
+/**
+ * @brief Write the sparse mass entries of a cluster to its spill file.
+ */
+void ParallelSquashClustering::spill_locked_(
+    size_t index, SparseMasses const& masses
+) const {
+    using namespace genesis::utils;
+
+    auto ser = Serializer( to_file( spill_path_( index )));
+    ser << static_cast<uint64_t>( masses.entries.size() );
+    for( auto const& entry : masses.entries ) {
+        ser << static_cast<uint64_t>( entry.edge );
+        ser << entry.position;
+        ser << entry.mass;
+    }
+}
+
+/**
+ * @brief Reconstruct the sparse masses of a cluster from its spill file.
+ */
+SparseMasses ParallelSquashClustering::load_locked_( size_t index ) const
+{
+    using namespace genesis::utils;
+
+    SparseMasses masses;
+    auto des = Deserializer( from_file( spill_path_( index )));
+    uint64_t entry_count = 0;
+    des >> entry_count;
+    masses.entries.reserve( entry_count );
+    for( uint64_t i = 0; i < entry_count; ++i ) {
+        uint64_t edge = 0;
+        double position = 0.0;
+        double mass = 0.0;
+        des >> edge;
+        des >> position;
+        des >> mass;
+        if( edge >= layout_.edge_count() ) {
+            throw std::runtime_error(
+                "Invalid spilled cluster file '" + spill_path_( index ) + "'."
+            );
+        }
+        masses.entries.push_back({ static_cast<uint32_t>( edge ), position, mass });
+    }
+    return masses;
+}
+
+/**
+ * @brief Evict least recently used clusters until the store is within its capacity.
+ *
+ * Clusters that have not been spilled yet are written to disk first. Masses of a cluster
+ * never change once it is created, so a cluster only needs to be spilled once.
+ */
+void ParallelSquashClustering::evict_locked_()
+{
+    auto const capacity = std::max<size_t>( 1, max_in_memory_ );
+    while( cache_.size() > capacity ) {
+        auto const victim = lru_.back();
+        auto const it = cache_.find( victim );
+        assert( it != cache_.end() );
+        if( on_disk_.count( victim ) == 0 ) {
+            spill_locked_( victim, it->second.first );
+            on_disk_.insert( victim );
+        }
+        cache_.erase( it );
+        lru_.pop_back();
+    }
+}
+
+/**
+ * @brief Put the masses of a new cluster into the store, evicting older ones as needed.
+ */
+void ParallelSquashClustering::store_insert_( size_t index, SparseMasses&& masses )
+{
+    std::lock_guard<std::mutex> lock( *store_mutex_ );
+    lru_.push_front( index );
+    cache_.emplace( index, std::make_pair( std::move( masses ), lru_.begin() ));
+    evict_locked_();
+}
+
+/**
+ * @brief Get a copy of the masses of a cluster, loading them from disk if not in memory.
+ *
+ * The store hands out copies instead of references, so that concurrent evictions
+ * cannot pull a cluster out from under a thread that is still computing with it.
+ */
+SparseMasses ParallelSquashClustering::fetch_copy_( size_t index )
+{
+    std::lock_guard<std::mutex> lock( *store_mutex_ );
+    auto it = cache_.find( index );
+    if( it != cache_.end() ) {
+        lru_.splice( lru_.begin(), lru_, it->second.second );
+        return it->second.first;
+    }
+    assert( on_disk_.count( index ) > 0 );
+    auto masses = load_locked_( index );
+    lru_.push_front( index );
+    cache_.emplace( index, std::make_pair( std::move( masses ), lru_.begin() ));
+    evict_locked_();
+    return cache_.at( index ).first;
+}
+
+/**
+ * @brief Remove a cluster from the store, including its spill file.
+ */
+void ParallelSquashClustering::store_drop_( size_t index )
+{
+    std::lock_guard<std::mutex> lock( *store_mutex_ );
+    auto it = cache_.find( index );
+    if( it != cache_.end() ) {
+        lru_.erase( it->second.second );
+        cache_.erase( it );
+    }
+    if( on_disk_.count( index ) > 0 ) {
+        std::remove( spill_path_( index ).c_str() );
+        on_disk_.erase( index );
+    }
+}
+
+void ParallelSquashClustering::store_clear_()
+{
+    std::lock_guard<std::mutex> lock( *store_mutex_ );
+    for( auto const index : on_disk_ ) {
+        std::remove( spill_path_( index ).c_str() );
+    }
+    on_disk_.clear();
+    cache_.clear();
+    lru_.clear();
+}
+
+// =================================================================================================
+//      Checkpointing
+// =================================================================================================
+
+/**
+ * @brief Magic header of the squash clustering checkpoint file, see checkpoint_directory().
+ */
+static std::string const squash_checkpoint_magic_ = "gappa-squash-checkpoint-v1";
+
+std::string ParallelSquashClustering::checkpoint_path_() const
+{
+    return checkpoint_dir_ + "/squash_checkpoint.bin";
+}
+
+/**
+ * @brief Store the clustering state in the checkpoint file.
+ *
+ * The file contains the metadata of all clusters (activity, sample counts, and the
+ * pairwise distances) and all merge steps so far, but not the cluster masses, which are
+ * rebuilt by replaying the merge steps on resume, see load_checkpoint_().
+ * The file is written to a temporary path first and then renamed, so that an interruption
+ * during the write cannot leave a truncated checkpoint behind.
+ */
+void ParallelSquashClustering::save_checkpoint_() const
+{
+    using namespace genesis::utils;
+
+    auto const path = checkpoint_path_();
+    auto const tmp_path = path + ".tmp";
+    {
+        auto ser = Serializer( to_file( tmp_path ));
+        ser << squash_checkpoint_magic_;
+        ser << p_;
+        ser << static_cast<uint64_t>( clusters_.size() );
+        for( auto const& cluster : clusters_ ) {
+            ser << static_cast<uint8_t>( cluster.active ? 1 : 0 );
+            ser << static_cast<uint64_t>( cluster.count );
+            ser << static_cast<uint64_t>( cluster.distances.size() );
+            for( auto const dist : cluster.distances ) {
+                ser << dist;
+            }
+        }
+        ser << static_cast<uint64_t>( mergers_.size() );
+        for( auto const& merger : mergers_ ) {
+            ser << merger.distance;
+            ser << static_cast<uint64_t>( merger.index_a );
+            ser << merger.distance_a;
+            ser << static_cast<uint64_t>( merger.index_b );
+            ser << merger.distance_b;
+        }
+    }
+    if( std::rename( tmp_path.c_str(), path.c_str() ) != 0 ) {
+        throw std::runtime_error( "Cannot write checkpoint file '" + path + "'." );
+    }
+}
+
+/**
+ * @brief Load a checkpoint written by save_checkpoint_(), if present and matching.
+ *
+ * Expects clusters_ to hold the freshly initialized input clusters, whose masses are kept;
+ * the loaded metadata is applied on top of them. Returns whether the checkpoint was
+ * loaded. On a mismatch (different number of samples, or different settings), a warning
+ * is issued and the checkpoint is ignored.
+ */
+bool ParallelSquashClustering::load_checkpoint_( size_t initial_size )
+{
+    using namespace genesis::utils;
+
+    auto const path = checkpoint_path_();
+    if( ! file_exists( path )) {
+        return false;
+    }
+    auto const mismatch = [&]( std::string const& reason ){
+        LOG_WARN << "Warning: Checkpoint file " << path << " " << reason
+                 << ". Ignoring it and starting over.";
+        return false;
+    };
+
+    struct ClusterMeta
+    {
+        bool active;
+        size_t count;
+        std::vector<double> distances;
+    };
+
+    try {
+        auto des = Deserializer( from_file( path ));
+        std::string magic;
+        des >> magic;
+        if( magic != squash_checkpoint_magic_ ) {
+            return mismatch( "is not a squash clustering checkpoint" );
+        }
+        double p = 0.0;
+        des >> p;
+        if( p != p_ ) {
+            return mismatch( "was written with a different exponent" );
+        }
+        uint64_t cluster_count = 0;
+        des >> cluster_count;
+        if( cluster_count < initial_size || cluster_count >= 2 * initial_size ) {
+            return mismatch( "uses a different number of samples" );
+        }
+
+        auto metas = std::vector<ClusterMeta>( cluster_count );
+        for( size_t i = 0; i < cluster_count; ++i ) {
+            uint8_t active = 0;
+            uint64_t count = 0;
+            uint64_t dist_count = 0;
+            des >> active;
+            des >> count;
+            des >> dist_count;
+            if( dist_count != i ) {
+                return mismatch( "is inconsistent" );
+            }
+            metas[i].active = ( active != 0 );
+            metas[i].count = count;
+            metas[i].distances.resize( dist_count );
+            for( auto& dist : metas[i].distances ) {
+                des >> dist;
+            }
+        }
+        uint64_t merger_count = 0;
+        des >> merger_count;
+        if( initial_size + merger_count != cluster_count ) {
+            return mismatch( "is inconsistent" );
+        }
+        auto mergers = std::vector<Merger>( merger_count );
+        for( auto& merger : mergers ) {
+            uint64_t index_a = 0;
+            uint64_t index_b = 0;
+            des >> merger.distance;
+            des >> index_a;
+            des >> merger.distance_a;
+            des >> index_b;
+            des >> merger.distance_b;
+            if( index_a >= index_b || index_b >= cluster_count ) {
+                return mismatch( "is inconsistent" );
+            }
+            merger.index_a = index_a;
+            merger.index_b = index_b;
+        }
+
+        // Everything read and validated, apply the metadata. The masses of the input
+        // clusters are kept; those of the merged clusters are rebuilt in run().
+        assert( clusters_.size() == initial_size );
+        for( size_t i = 0; i < initial_size; ++i ) {
+            clusters_[i].active = metas[i].active;
+            clusters_[i].count = metas[i].count;
+            clusters_[i].distances = std::move( metas[i].distances );
+        }
+        for( size_t i = initial_size; i < cluster_count; ++i ) {
+            clusters_.push_back({
+                SparseMasses(), metas[i].active, metas[i].count,
+                std::move( metas[i].distances )
+            });
+        }
+        mergers_ = std::move( mergers );
+    } catch( ... ) {
+        return mismatch( "cannot be read" );
+    }
+    return true;
+}
+
+// =================================================================================================
+//      Run
+// =================================================================================================
+
+void ParallelSquashClustering::run( std::vector<genesis::tree::MassTree>&& trees )
+{
+    using namespace genesis::tree;
+
+    if( trees.size() < 2 ) {
+        throw std::runtime_error( "Cannot run squash clustering with fewer than 2 samples." );
+    }
+
+    // Initialize: compress the input trees into sparse clusters of size one each, freeing
+    // each tree once it is converted. The layout keeps a mass-free copy of the reference
+    // tree, which is all we need to rebuild the trees for the write_cluster_tree callback.
+    if( report_initialization ) {
+        report_initialization();
+    }
+    clusters_.clear();
+    mergers_.clear();
+    layout_ = MassTreeLayout( trees[0] );
+    clusters_.reserve( trees.size() * 2 - 1 );
+    for( auto& tree : trees ) {
+        clusters_.push_back({ layout_.compress( tree ), true, 1, {} });
+        tree = MassTree();
+    }
+    trees.clear();
+    auto const initial_size = clusters_.size();
+    for( size_t i = 0; i < initial_size; ++i ) {
+        clusters_[i].distances.resize( i, 0.0 );
+    }
+
+    // With a spill directory, the masses are handed over to the disk-backed store,
+    // and the clusters only keep their metadata.
+    if( spilling_() ) {
+        genesis::utils::dir_create( spill_dir_, true );
+        for( size_t i = 0; i < initial_size; ++i ) {
+            store_insert_( i, std::move( clusters_[i].masses ));
+            clusters_[i].masses = SparseMasses();
+        }
+    }
+
+    // Checkpointing: load the state of a previous interrupted run, if present, see
+    // checkpoint_directory(). The checkpoint contains all distances and merge steps, so on
+    // resume we can skip the initial pairwise distances, and only replay the recorded
+    // merge steps below to rebuild the trees of the merged clusters.
+    bool resumed = false;
+    if( checkpointing_() ) {
+        genesis::utils::dir_create( checkpoint_dir_, true );
+        resumed = load_checkpoint_( initial_size );
+    }
+
+    // Distance between the masses of two clusters, either directly or via the store.
+    auto const emd_pair = [&]( size_t i, size_t j ){
+        if( spilling_() ) {
+            auto const masses_i = fetch_copy_( i );
+            auto const masses_j = fetch_copy_( j );
+            return layout_.earth_movers_distance( masses_i, masses_j, p_ );
+        }
+        return layout_.earth_movers_distance( clusters_[i].masses, clusters_[j].masses, p_ );
+    };
+
+    // Compute all pairwise distances of the input trees, in parallel over the rows.
+    // When resuming, the checkpoint already contains them.
+    if( ! resumed ) {
+        #pragma omp parallel for schedule(dynamic)
+        for( size_t i = 1; i < initial_size; ++i ) {
+            for( size_t j = 0; j < i; ++j ) {
+                clusters_[i].distances[j] = emd_pair( i, j );
+            }
+        }
+
+        // The initial distance matrix is a large part of the total work,
+        // so store a first checkpoint right away.
+        if( checkpointing_() ) {
+            save_checkpoint_();
+        }
+    }
+
+    // When resuming, replay the recorded merge steps to rebuild the masses of the merged
+    // clusters. This repeats the cheap mass merges (and re-writes the cluster trees via
+    // the callback), but none of the earth movers distance evaluations, which dominate
+    // the run time of the clustering.
+    for( size_t step = 0; step < mergers_.size(); ++step ) {
+        auto const& merger = mergers_[step];
+        auto& cl_a = clusters_[ merger.index_a ];
+        auto& cl_b = clusters_[ merger.index_b ];
+        auto const count_a = static_cast<double>( cl_a.count );
+        auto const count_b = static_cast<double>( cl_b.count );
+        auto const scaler_a = count_a / ( count_a + count_b );
+        auto const scaler_b = count_b / ( count_a + count_b );
+
+        SparseMasses new_masses;
+        if( spilling_() ) {
+            new_masses = merge_sparse_masses(
+                fetch_copy_( merger.index_a ), fetch_copy_( merger.index_b ),
+                scaler_a, scaler_b
+            );
+            store_drop_( merger.index_a );
+            store_drop_( merger.index_b );
+        } else {
+            new_masses = merge_sparse_masses( cl_a.masses, cl_b.masses, scaler_a, scaler_b );
+            cl_a.masses = SparseMasses();
+            cl_b.masses = SparseMasses();
+        }
+        if( write_cluster_tree ) {
+            write_cluster_tree( layout_.expand( new_masses ), step );
+        }
+
+        auto const new_index = initial_size + step;
+        assert( new_index < clusters_.size() );
+        if( spilling_() ) {
+            store_insert_( new_index, std::move( new_masses ));
+        } else {
+            clusters_[ new_index ].masses = std::move( new_masses );
+        }
+    }
+
+    // List of the clusters that have not been merged into another one yet.
+    auto active = std::vector<size_t>();
+    active.reserve( initial_size );
+    for( size_t i = 0; i < clusters_.size(); ++i ) {
+        if( clusters_[i].active ) {
+            active.push_back( i );
+        }
+    }
+
+    // Distance between two clusters, stored triangularly at the higher index.
+    auto const pair_dist = [&]( size_t a, size_t b ){
+        return a < b ? clusters_[b].distances[a] : clusters_[a].distances[b];
+    };
+
+    // Merge pairs of mutual nearest neighbors, until only one cluster is left.
+    // When resuming, continue after the already replayed merge steps.
+    // The chain below follows nearest neighbors from cluster to cluster until two of
+    // them point at each other; as the squash linkage is reducible (merging two clusters
+    // does not bring any third cluster closer to them than it was to either), merging
+    // such mutual pairs yields the same hierarchy as always merging the globally closest
+    // pair, while replacing the quadratic closest-pair scan of each step with a few
+    // linear nearest neighbor searches, for quadratic total work over the whole run.
+    // After a merge, the remainder of the chain stays valid and is continued from.
+    auto chain = std::vector<size_t>();
+    chain.reserve( initial_size );
+    auto const total_steps = initial_size - 1;
+    auto const start_step = mergers_.size();
+    auto last_checkpoint = std::chrono::steady_clock::now();
+    for( size_t step = start_step; step < total_steps; ++step ) {
+        if( report_step ) {
+            report_step( step + 1, total_steps );
+        }
+
+        // Extend the chain until it ends in a pair of mutual nearest neighbors.
+        while( true ) {
+            if( chain.empty() ) {
+                chain.push_back( active.front() );
+            }
+            auto const c = chain.back();
+
+            // Nearest active cluster of the chain end. Starting with the predecessor in
+            // the chain (and only accepting strictly smaller distances) resolves ties
+            // towards it, so that mutual nearest neighbors are always detected and the
+            // chain cannot cycle.
+            size_t nearest = std::numeric_limits<size_t>::max();
+            double nearest_d = std::numeric_limits<double>::max();
+            if( chain.size() > 1 ) {
+                nearest = chain[ chain.size() - 2 ];
+                nearest_d = pair_dist( c, nearest );
+            }
+            for( auto const j : active ) {
+                if( j == c ) {
+                    continue;
+                }
+                auto const d = pair_dist( c, j );
+                if( d < nearest_d ) {
+                    nearest = j;
+                    nearest_d = d;
+                }
+            }
+            assert( nearest != std::numeric_limits<size_t>::max() );
+
+            if( chain.size() > 1 && nearest == chain[ chain.size() - 2 ] ) {
+                break;
+            }
+            chain.push_back( nearest );
+        }
+
+        // The last two chain elements are mutual nearest neighbors: merge them.
+        assert( chain.size() >= 2 );
+        auto const min_a = std::min( chain[ chain.size() - 1 ], chain[ chain.size() - 2 ] );
+        auto const min_b = std::max( chain[ chain.size() - 1 ], chain[ chain.size() - 2 ] );
+        auto const min_d = clusters_[min_b].distances[min_a];
+        chain.pop_back();
+        chain.pop_back();
+        assert( min_a < min_b && min_b < clusters_.size() );
+        auto& cl_a = clusters_[ min_a ];
+        auto& cl_b = clusters_[ min_b ];
+
+        // Squash the two clusters, that is, average their masses weighted by the number
+        // of samples they contain, and get the distances of the children to the new cluster,
+        // which become the branch lengths in the resulting cluster tree.
+        auto const count_a = static_cast<double>( cl_a.count );
+        auto const count_b = static_cast<double>( cl_b.count );
+        auto const scaler_a = count_a / ( count_a + count_b );
+        auto const scaler_b = count_b / ( count_a + count_b );
+        SparseMasses new_masses;
+        double dist_a;
+        double dist_b;
+        if( spilling_() ) {
+            auto const masses_a = fetch_copy_( min_a );
+            auto const masses_b = fetch_copy_( min_b );
+            new_masses = merge_sparse_masses( masses_a, masses_b, scaler_a, scaler_b );
+            dist_a = layout_.earth_movers_distance( new_masses, masses_a, p_ );
+            dist_b = layout_.earth_movers_distance( new_masses, masses_b, p_ );
+        } else {
+            new_masses = merge_sparse_masses( cl_a.masses, cl_b.masses, scaler_a, scaler_b );
+            dist_a = layout_.earth_movers_distance( new_masses, cl_a.masses, p_ );
+            dist_b = layout_.earth_movers_distance( new_masses, cl_b.masses, p_ );
+        }
+
+        // Deactivate the children and free their masses, which are no longer needed.
+        cl_a.active = false;
+        cl_b.active = false;
+        cl_a.masses = SparseMasses();
+        cl_b.masses = SparseMasses();
+        if( spilling_() ) {
+            store_drop_( min_a );
+            store_drop_( min_b );
+        }
+
+        // Compute the distances of the new cluster to all remaining active clusters.
+        // These are independent earth movers distance evaluations, so we run them in
+        // parallel, which is where the bulk of the per-step work is spent.
+        auto const new_index = clusters_.size();
+        auto new_distances = std::vector<double>( new_index, 0.0 );
+        #pragma omp parallel for schedule(dynamic)
+        for( size_t ai = 0; ai < active.size(); ++ai ) {
+            auto const j = active[ai];
+            if( j == min_a || j == min_b ) {
+                continue;
+            }
+            assert( j < new_index );
+            if( spilling_() ) {
+                auto const masses_j = fetch_copy_( j );
+                new_distances[j] = layout_.earth_movers_distance( new_masses, masses_j, p_ );
+            } else {
+                new_distances[j] = layout_.earth_movers_distance(
+                    new_masses, clusters_[j].masses, p_
+                );
+            }
+        }
+
+        // Record the merger, and hand the new cluster tree to the caller for writing.
+        mergers_.push_back({ min_d, min_a, dist_a, min_b, dist_b });
+        if( write_cluster_tree ) {
+            write_cluster_tree( layout_.expand( new_masses ), step );
+        }
+
+        // Add the new cluster, either keeping its masses directly, or storing them away.
+        clusters_.push_back({
+            SparseMasses(), true,
+            cl_a.count + cl_b.count,
+            std::move( new_distances )
+        });
+        if( spilling_() ) {
+            store_insert_( new_index, std::move( new_masses ));
+        } else {
+            clusters_.back().masses = std::move( new_masses );
+        }
+
+        // Update the active list: the children are gone, the new cluster takes part.
+        active.erase( std::remove_if(
+            active.begin(), active.end(),
+            [&]( size_t i ){ return i == min_a || i == min_b; }
+        ), active.end() );
+        active.push_back( new_index );
+
+        // Periodically store the clustering state, see checkpoint_directory().
+        if( checkpointing_() ) {
+            auto const now = std::chrono::steady_clock::now();
+            auto const since = std::chrono::duration_cast<std::chrono::seconds>(
+                now - last_checkpoint
+            ).count();
+            if( since >= 600 ) {
+                last_checkpoint = now;
+                save_checkpoint_();
+            }
+        }
+    }
+    assert( active.size() == 1 );
+    assert( mergers_.size() == total_steps );
+
+    // Clean up the spill files. The cluster masses have all served their purpose.
+    if( spilling_() ) {
+        store_clear_();
+    }
+
+    // The clustering is done, so the checkpoint is no longer needed.
+    if( checkpointing_() ) {
+        std::remove( checkpoint_path_().c_str() );
+    }
+}
+
+// =================================================================================================
+//      Tree String
+// =================================================================================================
+
+std::string ParallelSquashClustering::tree_string( std::vector<std::string> const& labels ) const
+{
+    if( mergers_.empty() || labels.size() != mergers_.size() + 1 ) {
+        throw std::runtime_error(
+            "Labels for squash cluster tree do not fit the number of clustered samples."
+        );
+    }
+
+    // Build the newick string bottom-up along the mergers, using the distances of the
+    // children to their merged cluster as branch lengths.
+    auto list = labels;
+    list.reserve( labels.size() + mergers_.size() );
+    for( auto const& merger : mergers_ ) {
+        auto const node_a = std::move( list[ merger.index_a ] )
+                          + ":" + std::to_string( merger.distance_a );
+        auto const node_b = std::move( list[ merger.index_b ] )
+                          + ":" + std::to_string( merger.distance_b );
+        list.push_back( "(" + node_a + "," + node_b + ")" );
+    }
+    return list.back() + ";";
+}
@@ -0,0 +1,289 @@
+#ifndef GAPPA_TOOLS_SQUASH_CLUSTERING_H_
+#define GAPPA_TOOLS_SQUASH_CLUSTERING_H_
+
+/*
+    gappa - Genesis Applications for Phylogenetic Placement Analysis
+    Copyright (C) 2017-2022 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+#include "tools/sparse_masses.hpp"
+
+#include "genesis/tree/mass_tree/tree.hpp"
+
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// =================================================================================================
+//      Parallel Squash Clustering
+// =================================================================================================
+
+/**
+ * @brief Agglomerative Squash Clustering of a set of MassTrees, with parallel distance updates.
+ *
+ * This follows the Squash Clustering of [Matsen2011-edgepca-and-squash-clustering], and mirrors
+ * the interface of the genesis SquashClustering class, which runs its per-merge distance
+ * recomputation sequentially. As each merge needs one earth movers distance evaluation per
+ * remaining cluster, and these are independent of each other, we run them in an OpenMP loop here,
+ * using the global thread count, which for large sample sets speeds up each clustering step by
+ * roughly the number of threads.
+ *
+ * Internally, the cluster masses are kept in their compressed sparse representation, see
+ * SparseMasses, with the distance evaluations running on the sparse kernel of MassTreeLayout,
+ * so that both the memory per cluster and the work per distance scale with the number of
+ * placed masses instead of the size of the tree.
+ *
+ * The agglomeration itself uses the nearest-neighbor chain algorithm, which merges pairs
+ * of mutual nearest neighbors instead of scanning the whole distance matrix for the
+ * globally closest pair at every step. For the reducible squash linkage, this yields the
+ * same hierarchy, at quadratic instead of cubic total work over all merge steps.
+ */
+class ParallelSquashClustering
+{
+public:
+
+    // -------------------------------------------------------------------------
+    //     Typedefs
+    // -------------------------------------------------------------------------
+
+    /**
+     * @brief One cluster of the clustering, that is, an input sample or a merged cluster.
+     *
+     * Distances to all clusters with lower index are stored triangularly per cluster.
+     * Clusters that have been merged into a new one become inactive, and their masses are freed.
+     */
+    struct Cluster
+    {
+        SparseMasses masses;
+        bool active;
+        size_t count;
+        std::vector<double> distances;
+    };
+
+    /**
+     * @brief One merging step, with the distance between the two merged clusters,
+     * and the distances of each of them to the newly formed cluster,
+     * which become the branch lengths of the resulting cluster tree.
+     */
+    struct Merger
+    {
+        double distance;
+        size_t index_a;
+        double distance_a;
+        size_t index_b;
+        double distance_b;
+    };
+
+    // -------------------------------------------------------------------------
+    //     Constructor and Rule of Five
+    // -------------------------------------------------------------------------
+
+    ParallelSquashClustering()  = default;
+    ~ParallelSquashClustering() = default;
+
+    ParallelSquashClustering( ParallelSquashClustering const& ) = default;
+    ParallelSquashClustering( ParallelSquashClustering&& )      = default;
+
+    ParallelSquashClustering& operator= ( ParallelSquashClustering const& ) = default;
+    ParallelSquashClustering& operator= ( ParallelSquashClustering&& )      = default;
+
+    // -------------------------------------------------------------------------
+    //     Settings
+    // -------------------------------------------------------------------------
+
+    /**
+     * @brief Exponent `p` for the earth movers distance calculations.
+     */
+    ParallelSquashClustering& p( double value )
+    {
+        p_ = value;
+        return *this;
+    }
+
+    double p() const
+    {
+        return p_;
+    }
+
+    /**
+     * @brief Directory to spill cluster masses to when they are evicted from memory.
+     *
+     * If set, cluster masses are kept in a disk-backed least-recently-used store instead of
+     * in memory, see max_trees_in_memory(), so that the memory use of the clustering is
+     * bounded by the store capacity instead of the number of active clusters.
+     * Loading and saving masses costs time, so this is meant for runs that otherwise
+     * do not fit into memory. If empty (default), all active clusters are kept in memory.
+     */
+    ParallelSquashClustering& spill_directory( std::string const& value )
+    {
+        spill_dir_ = value;
+        return *this;
+    }
+
+    std::string const& spill_directory() const
+    {
+        return spill_dir_;
+    }
+
+    /**
+     * @brief Number of cluster mass sets to keep in memory when spill_directory() is set.
+     */
+    ParallelSquashClustering& max_trees_in_memory( size_t value )
+    {
+        max_in_memory_ = value;
+        return *this;
+    }
+
+    size_t max_trees_in_memory() const
+    {
+        return max_in_memory_;
+    }
+
+    /**
+     * @brief Directory to periodically store the clustering state in, for resuming.
+     *
+     * If set, the cluster metadata (distances and merge steps, but not the trees) is
+     * written to a checkpoint file in this directory, roughly every ten minutes.
+     * When run() finds a matching checkpoint there, it resumes from it: the recorded
+     * merge steps are replayed to rebuild the merged trees, which only costs the cheap
+     * mass merges, while all earth movers distance evaluations up to that point are
+     * reused from the checkpoint. The file is removed once the clustering has finished.
+     * If empty (default), no checkpoints are written.
+     */
+    ParallelSquashClustering& checkpoint_directory( std::string const& value )
+    {
+        checkpoint_dir_ = value;
+        return *this;
+    }
+
+    std::string const& checkpoint_directory() const
+    {
+        return checkpoint_dir_;
+    }
+
+    // -------------------------------------------------------------------------
+    //     Run Functions
+    // -------------------------------------------------------------------------
+
+    /**
+     * @brief Run the clustering on the given trees, which are consumed in the process.
+     */
+    void run( std::vector<genesis::tree::MassTree>&& trees );
+
+    /**
+     * @brief Build the newick representation of the cluster hierarchy,
+     * using the given labels for the input samples.
+     */
+    std::string tree_string( std::vector<std::string> const& labels ) const;
+
+    std::vector<Cluster> const& clusters() const
+    {
+        return clusters_;
+    }
+
+    std::vector<Merger> const& mergers() const
+    {
+        return mergers_;
+    }
+
+    // -------------------------------------------------------------------------
+    //     Callbacks
+    // -------------------------------------------------------------------------
+
+    std::function<void( void )> report_initialization;
+    std::function<void( size_t i, size_t total )> report_step;
+
+    /**
+     * @brief Called with each newly merged cluster tree and its merger index,
+     * so that the caller can write it to a file while it is in memory.
+     */
+    std::function<void( genesis::tree::MassTree const& cluster_tree, size_t index )> write_cluster_tree;
+
+    // -------------------------------------------------------------------------
+    //     Internal Functions
+    // -------------------------------------------------------------------------
+
+private:
+
+    bool spilling_() const
+    {
+        return ! spill_dir_.empty();
+    }
+
+    std::string spill_path_( size_t index ) const;
+
+    void store_insert_( size_t index, SparseMasses&& masses );
+    SparseMasses fetch_copy_( size_t index );
+    void store_drop_( size_t index );
+    void store_clear_();
+
+    void evict_locked_();
+    void spill_locked_( size_t index, SparseMasses const& masses ) const;
+    SparseMasses load_locked_( size_t index ) const;
+
+    bool checkpointing_() const
+    {
+        return ! checkpoint_dir_.empty();
+    }
+
+    std::string checkpoint_path_() const;
+
+    void save_checkpoint_() const;
+    bool load_checkpoint_( size_t initial_size );
+
+    // -------------------------------------------------------------------------
+    //     Internal Members
+    // -------------------------------------------------------------------------
+
+private:
+
+    double p_ = 1.0;
+
+    std::vector<Cluster> clusters_;
+    std::vector<Merger>  mergers_;
+
+    std::string checkpoint_dir_;
+
+    // Flattened topology of the shared reference tree, for the sparse distance kernel,
+    // and for rebuilding the trees that are handed to the write_cluster_tree callback.
+    MassTreeLayout layout_;
+
+    // Disk-backed LRU store for the cluster masses, used when spill_directory() is set.
+    // The mutex guards the store, as the distance loops fetch masses from multiple
+    // threads; it is held via a shared pointer to keep the defaulted copy and move
+    // operations of this class valid.
+    std::string spill_dir_;
+    size_t max_in_memory_ = 0;
+    std::list<size_t> lru_;
+    std::unordered_map<
+        size_t, std::pair<SparseMasses, std::list<size_t>::iterator>
+    > cache_;
+    std::unordered_set<size_t> on_disk_;
+    std::shared_ptr<std::mutex> store_mutex_ = std::make_shared<std::mutex>();
+
+};
+
+#endif // include guard
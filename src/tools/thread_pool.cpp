@@ -0,0 +1,74 @@
+/*
+    gappa - Genesis Applications for Phylogenetic Placement Analysis
+    Copyright (C) 2017-2024 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+#include "tools/thread_pool.hpp"
+
+#include <cassert>
+
+// =================================================================================================
+//      Thread Pool
+// =================================================================================================
+
+ThreadPool::ThreadPool( size_t thread_count )
+{
+    if( thread_count == 0 ) {
+        thread_count = 1;
+    }
+    workers_.reserve( thread_count );
+    for( size_t i = 0; i < thread_count; ++i ) {
+        workers_.emplace_back( &ThreadPool::work_, this );
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock( mutex_ );
+        stop_ = true;
+    }
+    condition_.notify_all();
+    for( auto& worker : workers_ ) {
+        worker.join();
+    }
+}
+
+void ThreadPool::work_()
+{
+    while( true ) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock( mutex_ );
+            condition_.wait( lock, [this](){
+                return stop_ || ! tasks_.empty();
+            });
+            if( tasks_.empty() ) {
+                // Can only happen when stopping: finish remaining tasks first, then return.
+                assert( stop_ );
+                return;
+            }
+            task = std::move( tasks_.front() );
+            tasks_.pop_front();
+        }
+        task();
+    }
+}
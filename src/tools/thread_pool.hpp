@@ -0,0 +1,139 @@
+#ifndef GAPPA_TOOLS_THREAD_POOL_H_
+#define GAPPA_TOOLS_THREAD_POOL_H_
+
+/*
+    gappa - Genesis Applications for Phylogenetic Placement Analysis
+    Copyright (C) 2017-2024 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// =================================================================================================
+//      Thread Pool
+// =================================================================================================
+
+/**
+ * @brief Process-wide pool of worker threads for background tasks.
+ *
+ * Several commands run coarse-grained background work next to their main compute loops:
+ * prefetching and decoding input files, writing finished chunks, and disposing of large
+ * data structures. Previously, each of these sites spawned its own threads via std::async
+ * or detached std::thread, so the total number of threads was unbounded and not related to
+ * the --threads option. This pool provides a single shared set of workers, sized by the
+ * global thread option (see GlobalOptions::thread_pool()), that all such tasks are
+ * routed through.
+ *
+ * The compute loops themselves stay on OpenMP, which genesis uses internally as well;
+ * nesting between file-level and genesis-internal parallelism is handled at the loop sites.
+ * The pool intentionally uses a single shared queue: the tasks are few and long-running,
+ * so per-thread queues with work stealing would add complexity without measurable benefit.
+ *
+ * Tasks must not block on futures of other tasks of this pool, as that could exhaust the
+ * workers and deadlock. All current uses are self-contained leaf tasks; in particular, the
+ * parallel gzip output keeps its own bounded std::async set, as its compression blocks are
+ * awaited from within tasks (chunk writers) that may themselves run on this pool.
+ */
+class ThreadPool
+{
+public:
+
+    // -------------------------------------------------------------------------
+    //     Constructor and Rule of Five
+    // -------------------------------------------------------------------------
+
+    /**
+     * @brief Start the pool with the given number of worker threads (at least one).
+     */
+    explicit ThreadPool( size_t thread_count );
+
+    /**
+     * @brief Wait for all remaining tasks to finish, then join the workers.
+     */
+    ~ThreadPool();
+
+    ThreadPool( ThreadPool const& ) = delete;
+    ThreadPool( ThreadPool&& )      = delete;
+
+    ThreadPool& operator= ( ThreadPool const& ) = delete;
+    ThreadPool& operator= ( ThreadPool&& )      = delete;
+
+    // -------------------------------------------------------------------------
+    //     Members
+    // -------------------------------------------------------------------------
+
+    size_t thread_count() const
+    {
+        return workers_.size();
+    }
+
+    /**
+     * @brief Add a task to the queue, and return a future for its result.
+     *
+     * The future can be discarded if the result is not needed; the task still runs.
+     * Exceptions thrown by the task are captured in the future, as with std::async.
+     */
+    template<class F>
+    auto enqueue( F task ) -> std::future<decltype( task() )>
+    {
+        using Result = decltype( task() );
+        auto packaged = std::make_shared<std::packaged_task<Result()>>( std::move( task ));
+        auto future = packaged->get_future();
+        {
+            std::lock_guard<std::mutex> lock( mutex_ );
+            if( stop_ ) {
+                throw std::runtime_error( "Cannot enqueue task on a stopped thread pool." );
+            }
+            tasks_.push_back( [ packaged ](){ (*packaged)(); });
+        }
+        condition_.notify_one();
+        return future;
+    }
+
+    // -------------------------------------------------------------------------
+    //     Internal Functions
+    // -------------------------------------------------------------------------
+
+private:
+
+    void work_();
+
+    // -------------------------------------------------------------------------
+    //     Member Variables
+    // -------------------------------------------------------------------------
+
+    std::vector<std::thread> workers_;
+    std::deque<std::function<void()>> tasks_;
+    std::mutex mutex_;
+    std::condition_variable condition_;
+    bool stop_ = false;
+
+};
+
+#endif // include guard
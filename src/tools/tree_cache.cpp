@@ -0,0 +1,161 @@
+/*
+    gappa - Genesis Applications for Phylogenetic Placement Analysis
+    Copyright (C) 2017-2024 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+#include "tools/tree_cache.hpp"
+
+#include "options/global.hpp"
+
+#include "genesis/utils/core/fs.hpp"
+#include "genesis/utils/core/logging.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#ifndef _WIN32
+#   include <unistd.h>
+#endif
+
+// =================================================================================================
+//      Cache File Format
+// =================================================================================================
+
+/**
+ * @brief Fixed size header of a cache entry. Exactly 64 bytes, so that the payload
+ * starts at an aligned offset, which keeps the files mmap-friendly.
+ */
+struct TreeCacheHeader
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t element_size;
+    uint64_t count;
+    uint64_t reserved[5];
+};
+
+static_assert(
+    sizeof( TreeCacheHeader ) == 64,
+    "TreeCacheHeader is expected to be exactly 64 bytes."
+);
+
+static char const tree_cache_magic_[8] = { 'G', 'A', 'P', 'P', 'A', 'T', 'C', '\0' };
+static uint32_t const tree_cache_version_ = 1;
+
+// =================================================================================================
+//      Tree Preprocessing Cache
+// =================================================================================================
+
+bool tree_cache_enabled()
+{
+    return ! global_options.tree_cache_dir().empty();
+}
+
+std::string tree_cache_file_path(
+    Murmur3::DigestType const& fingerprint,
+    std::string const& name
+) {
+    auto const dir = genesis::utils::dir_normalize_path( global_options.tree_cache_dir() );
+    return dir + "tree-" + Murmur3::digest_to_hex( fingerprint ) + "-" + name + ".bin";
+}
+
+bool tree_cache_read_raw(
+    std::string const& path,
+    uint64_t element_size,
+    uint64_t expected_count,
+    void* data
+) {
+    std::ifstream ifs( path, std::ios::binary );
+    if( ! ifs ) {
+        return false;
+    }
+
+    // Validate the header. Any mismatch is a miss, so that stale or truncated entries
+    // (for example, from an older gappa version) are silently recomputed.
+    TreeCacheHeader header;
+    ifs.read( reinterpret_cast<char*>( &header ), sizeof( header ));
+    if(
+        ! ifs ||
+        std::memcmp( header.magic, tree_cache_magic_, sizeof( header.magic )) != 0 ||
+        header.version != tree_cache_version_ ||
+        header.element_size != element_size ||
+        header.count != expected_count
+    ) {
+        return false;
+    }
+
+    ifs.read( reinterpret_cast<char*>( data ), element_size * expected_count );
+    if( ! ifs || static_cast<uint64_t>( ifs.gcount() ) != element_size * expected_count ) {
+        return false;
+    }
+
+    LOG_MSG2 << "Loaded " << path << " from the tree cache";
+    return true;
+}
+
+void tree_cache_write_raw(
+    std::string const& path,
+    uint64_t element_size,
+    uint64_t count,
+    void const* data
+) {
+    auto const dir = genesis::utils::dir_normalize_path( global_options.tree_cache_dir() );
+    if( ! genesis::utils::dir_exists( dir )) {
+        genesis::utils::dir_create( dir );
+    }
+
+    // Write to a temporary file first, and rename it into place once complete, so that
+    // concurrently running gappa commands never read a partial entry. The pid in the
+    // temporary name keeps concurrent writers of the same entry from clobbering each other;
+    // whichever rename lands last wins, with identical content.
+    #ifndef _WIN32
+        auto const tmp_path = path + ".tmp-" + std::to_string( getpid() );
+    #else
+        auto const tmp_path = path + ".tmp";
+    #endif
+
+    {
+        std::ofstream ofs( tmp_path, std::ios::binary );
+        if( ! ofs ) {
+            throw std::runtime_error( "Cannot write tree cache file " + tmp_path );
+        }
+
+        TreeCacheHeader header = {};
+        std::memcpy( header.magic, tree_cache_magic_, sizeof( header.magic ));
+        header.version = tree_cache_version_;
+        header.element_size = static_cast<uint32_t>( element_size );
+        header.count = count;
+
+        ofs.write( reinterpret_cast<char const*>( &header ), sizeof( header ));
+        ofs.write( reinterpret_cast<char const*>( data ), element_size * count );
+        if( ! ofs ) {
+            throw std::runtime_error( "Cannot write tree cache file " + tmp_path );
+        }
+    }
+
+    if( std::rename( tmp_path.c_str(), path.c_str() ) != 0 ) {
+        std::remove( tmp_path.c_str() );
+        throw std::runtime_error( "Cannot move tree cache file into place: " + path );
+    }
+    LOG_MSG2 << "Stored " << path << " in the tree cache";
+}
@@ -0,0 +1,133 @@
+#ifndef GAPPA_TOOLS_TREE_CACHE_H_
+#define GAPPA_TOOLS_TREE_CACHE_H_
+
+/*
+    gappa - Genesis Applications for Phylogenetic Placement Analysis
+    Copyright (C) 2017-2024 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+#include "tools/murmur3.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// =================================================================================================
+//      Tree Preprocessing Cache
+// =================================================================================================
+
+/**
+ * @brief Cache for expensive structures derived from a reference tree,
+ * see the --tree-cache-dir global option.
+ *
+ * Several commands derive the same structures from the same reference tree, the node distance
+ * matrix of `examine edpl` being the largest. Pipelines that run multiple gappa commands on
+ * the same tree rebuild these structures on every invocation. With --tree-cache-dir set,
+ * they are instead stored in that directory, keyed by a fingerprint of the tree, and loaded
+ * on subsequent runs.
+ *
+ * Each cache entry is one file, holding a fixed 64 byte header (magic, element size, element
+ * count) followed by the raw array payload, so that the payload starts at an aligned offset
+ * and the files can also be mmapped or consumed by external tooling. Entries are written to a
+ * temporary file first and renamed into place, so that concurrently running commands never
+ * see partial entries; a stale or truncated entry is treated as a miss and recomputed.
+ */
+
+/**
+ * @brief Whether the --tree-cache-dir option was set, i.e., whether caching is active.
+ */
+bool tree_cache_enabled();
+
+/**
+ * @brief Path of the cache entry for the given tree fingerprint and structure name.
+ */
+std::string tree_cache_file_path(
+    Murmur3::DigestType const& fingerprint,
+    std::string const& name
+);
+
+/**
+ * @brief Read a cache entry into @p data, which has to hold @p expected_count elements
+ * of @p element_size bytes each. Returns false (a cache miss) if the entry does not exist
+ * or does not match.
+ */
+bool tree_cache_read_raw(
+    std::string const& path,
+    uint64_t element_size,
+    uint64_t expected_count,
+    void* data
+);
+
+/**
+ * @brief Write a cache entry, atomically with respect to concurrent gappa runs.
+ */
+void tree_cache_write_raw(
+    std::string const& path,
+    uint64_t element_size,
+    uint64_t count,
+    void const* data
+);
+
+/**
+ * @brief Load a cached vector of trivially copyable elements for the given tree.
+ *
+ * Returns false and leaves @p data empty if caching is disabled or the entry is missing
+ * or does not match the expected element count, in which case the caller computes the
+ * structure and calls tree_cache_store() with it.
+ */
+template< typename T >
+bool tree_cache_load(
+    Murmur3::DigestType const& fingerprint,
+    std::string const& name,
+    size_t expected_count,
+    std::vector<T>& data
+) {
+    if( ! tree_cache_enabled() ) {
+        return false;
+    }
+    data.resize( expected_count );
+    auto const path = tree_cache_file_path( fingerprint, name );
+    if( tree_cache_read_raw( path, sizeof( T ), expected_count, data.data() )) {
+        return true;
+    }
+    data.clear();
+    data.shrink_to_fit();
+    return false;
+}
+
+/**
+ * @brief Store a vector of trivially copyable elements for the given tree.
+ * Does nothing if caching is disabled.
+ */
+template< typename T >
+void tree_cache_store(
+    Murmur3::DigestType const& fingerprint,
+    std::string const& name,
+    std::vector<T> const& data
+) {
+    if( ! tree_cache_enabled() ) {
+        return;
+    }
+    auto const path = tree_cache_file_path( fingerprint, name );
+    tree_cache_write_raw( path, sizeof( T ), data.size(), data.data() );
+}
+
+#endif // include guard
@@ -0,0 +1,112 @@
+/*
+    gappa - Genesis Applications for Phylogenetic Placement Analysis
+    Copyright (C) 2017-2024 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+#include "tools/tree_fingerprint.hpp"
+
+#include "genesis/tree/common_tree/tree.hpp"
+
+#include <cstdint>
+#include <string>
+
+// =================================================================================================
+//      Local Helpers
+// =================================================================================================
+
+/**
+ * @brief Append the raw bytes of a value to the hash buffer.
+ */
+template< typename T >
+static void append_value_( std::string& buffer, T const& value )
+{
+    buffer.append( reinterpret_cast<char const*>( &value ), sizeof( value ));
+}
+
+/**
+ * @brief Append the link structure of the tree, which fully determines its topology.
+ */
+static void append_link_structure_( std::string& buffer, genesis::tree::Tree const& tree )
+{
+    for( size_t li = 0; li < tree.link_count(); ++li ) {
+        auto const& link = tree.link_at( li );
+        append_value_( buffer, static_cast<uint64_t>( link.next().index() ));
+        append_value_( buffer, static_cast<uint64_t>( link.outer().index() ));
+        append_value_( buffer, static_cast<uint64_t>( link.node().index() ));
+        append_value_( buffer, static_cast<uint64_t>( link.edge().index() ));
+    }
+}
+
+// =================================================================================================
+//      Tree Fingerprint
+// =================================================================================================
+
+Murmur3::DigestType tree_topology_fingerprint( genesis::tree::Tree const& tree )
+{
+    std::string buffer;
+    buffer.reserve( tree.link_count() * 4 * sizeof( uint64_t ));
+    append_link_structure_( buffer, tree );
+    return Murmur3::string_digest( buffer );
+}
+
+Murmur3::DigestType tree_metric_fingerprint( genesis::tree::Tree const& tree )
+{
+    using namespace genesis::tree;
+
+    std::string buffer;
+    buffer.reserve(
+        tree.link_count() * 4 * sizeof( uint64_t ) + tree.edge_count() * sizeof( double )
+    );
+    append_link_structure_( buffer, tree );
+
+    // Branch lengths, as raw bit patterns, so that no formatting or rounding is involved.
+    for( size_t ei = 0; ei < tree.edge_count(); ++ei ) {
+        append_value_( buffer, tree.edge_at( ei ).data<CommonEdgeData>().branch_length );
+    }
+
+    return Murmur3::string_digest( buffer );
+}
+
+Murmur3::DigestType placement_tree_fingerprint( genesis::placement::PlacementTree const& tree )
+{
+    using namespace genesis::placement;
+
+    std::string buffer;
+    buffer.reserve(
+        tree.link_count() * 4 * sizeof( uint64_t ) + tree.node_count() * 16
+    );
+    append_link_structure_( buffer, tree );
+
+    // Node names, length-prefixed so that name boundaries cannot be confused.
+    for( size_t ni = 0; ni < tree.node_count(); ++ni ) {
+        auto const& name = tree.node_at( ni ).data<PlacementNodeData>().name;
+        append_value_( buffer, static_cast<uint64_t>( name.size() ));
+        buffer.append( name );
+    }
+
+    // Edge nums of the jplace reference tree.
+    for( size_t ei = 0; ei < tree.edge_count(); ++ei ) {
+        auto const edge_num = tree.edge_at( ei ).data<PlacementEdgeData>().edge_num();
+        append_value_( buffer, static_cast<int64_t>( edge_num ));
+    }
+
+    return Murmur3::string_digest( buffer );
+}
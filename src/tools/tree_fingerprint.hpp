@@ -0,0 +1,67 @@
+#ifndef GAPPA_TOOLS_TREE_FINGERPRINT_H_
+#define GAPPA_TOOLS_TREE_FINGERPRINT_H_
+
+/*
+    gappa - Genesis Applications for Phylogenetic Placement Analysis
+    Copyright (C) 2017-2024 Lucas Czech
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    Contact:
+    Lucas Czech <lczech@carnegiescience.edu>
+    Department of Plant Biology, Carnegie Institution For Science
+    260 Panama Street, Stanford, CA 94305, USA
+*/
+
+#include "tools/murmur3.hpp"
+
+#include "genesis/placement/placement_tree.hpp"
+#include "genesis/tree/tree.hpp"
+
+// =================================================================================================
+//      Tree Fingerprint
+// =================================================================================================
+
+/**
+ * @brief Compute a 128 bit fingerprint of the topology of a tree.
+ *
+ * The fingerprint hashes the full link structure of the tree (the next, outer, node, and
+ * edge indices of every link), so two trees have equal fingerprints exactly if
+ * `identical_topology()` holds for them, up to hash collisions of the 128 bit digest.
+ *
+ * This turns the compatibility check of a set of n trees from n pairwise tree traversals
+ * after the load into one O(edges) hash per tree at parse time (inside the parallel load
+ * loops) plus n digest comparisons, which matters for runs with many thousands of files.
+ */
+Murmur3::DigestType tree_topology_fingerprint( genesis::tree::Tree const& tree );
+
+/**
+ * @brief Compute a 128 bit fingerprint of the topology and branch lengths of a tree.
+ *
+ * Like tree_topology_fingerprint(), but additionally hashing the branch length of every
+ * edge (as its raw bit pattern). Use this as a cache key for structures that depend on
+ * the branch lengths, such as node distance matrices, see tools/tree_cache.hpp.
+ */
+Murmur3::DigestType tree_metric_fingerprint( genesis::tree::Tree const& tree );
+
+/**
+ * @brief Compute a 128 bit fingerprint of the reference tree of a placement sample.
+ *
+ * In addition to the topology covered by tree_topology_fingerprint(), this includes the
+ * node names and the edge nums, so that equal fingerprints correspond to the
+ * `compatible_trees()` check for jplace reference trees.
+ */
+Murmur3::DigestType placement_tree_fingerprint( genesis::placement::PlacementTree const& tree );
+
+#endif // include guard
@@ -0,0 +1,9 @@
+#!/bin/bash
+
+${GAPPA} analyze knn \
+    --jplace-path "data/jplace" \
+    --k 3 \
+    --out-dir ${OUTDIR}
+
+# The printed length of the distance values varies, so we check a size interval.
+testfile  "${OUTDIR}/knn.csv"      1500     15000    ||  return  1
@@ -0,0 +1,6 @@
+#!/bin/bash
+
+# The command produces no output files; it exits with an error if any file is invalid.
+${GAPPA} examine validate \
+    --jplace-path "data/jplace" \
+    ||  return  1
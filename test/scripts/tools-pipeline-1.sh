@@ -0,0 +1,16 @@
+#!/bin/bash
+
+# Run a script of two commands against the preloaded samples.
+cat > ${OUTDIR}/script.txt << EOF
+# Comments and empty lines are skipped.
+
+analyze krd --jplace-path data/jplace --out-dir ${OUTDIR}
+examine validate --jplace-path data/jplace
+EOF
+
+${GAPPA} tools pipeline \
+    --jplace-path "data/jplace" \
+    --script-file ${OUTDIR}/script.txt \
+    ||  return  1
+
+testfile  "${OUTDIR}/krd_matrix.csv"      7847     ||  return  1
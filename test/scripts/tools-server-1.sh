@@ -0,0 +1,25 @@
+#!/bin/bash
+
+# We need `nc` to send requests over the local socket. Skip the test if it is missing.
+command -v nc > /dev/null  ||  return  0
+
+SOCKET=${OUTDIR}/socket
+
+${GAPPA} tools server \
+    --jplace-path "data/jplace" \
+    --socket-file ${SOCKET} &
+SERVER=$!
+
+# Wait for the server to finish preloading and open its socket.
+for i in `seq 1 300`; do
+    [[ -S ${SOCKET} ]] && break
+    sleep 0.1
+done
+[[ -S ${SOCKET} ]]  ||  { kill ${SERVER} 2> /dev/null; return 1; }
+
+# Send a command request, then stop the server.
+echo "analyze krd --jplace-path data/jplace --out-dir ${OUTDIR}" | nc -U ${SOCKET}
+echo "quit" | nc -U ${SOCKET}
+wait ${SERVER}  ||  return  1
+
+testfile  "${OUTDIR}/krd_matrix.csv"      7847     ||  return  1